@@ -0,0 +1,296 @@
+#include <benchmark/benchmark.h>
+#include "common/gpu/frame_capture.hpp"
+#include "common/gpu/readback_capture.hpp"
+#include <memory>
+#include <vector>
+
+using namespace anarchy::gpu;
+
+namespace {
+
+constexpr uint32_t CAPTURE_WIDTH = 1920;
+constexpr uint32_t CAPTURE_HEIGHT = 1080;
+constexpr VkFormat CAPTURE_FORMAT = VK_FORMAT_B8G8R8A8_UNORM;
+constexpr uint32_t IMAGE_COUNT = 2;     // Alternated, so no frame repeats the last
+
+// The first physical device, with what FrameCapture needs enabled, and
+// images standing in for a swapchain: device-local, in PRESENT_SRC_KHR and
+// each cleared to its own grey level. Set up once for every benchmark.
+class CaptureDevice {
+public:
+    static CaptureDevice& get() {
+        static CaptureDevice device;
+        return device;
+    }
+
+    bool valid() const { return valid_; }
+    VkDevice device() const { return device_; }
+    VkPhysicalDevice physicalDevice() const { return physical_device_; }
+    VkImage image(size_t index) const { return images_[index % IMAGE_COUNT]; }
+
+private:
+    CaptureDevice() { valid_ = createDevice() && createImages(); }
+
+    ~CaptureDevice() {
+        for (uint32_t i = 0; i < IMAGE_COUNT; i++) {
+            if (images_[i] != VK_NULL_HANDLE) vkDestroyImage(device_, images_[i], nullptr);
+            if (memory_[i] != VK_NULL_HANDLE) vkFreeMemory(device_, memory_[i], nullptr);
+        }
+        if (device_ != VK_NULL_HANDLE) vkDestroyDevice(device_, nullptr);
+        if (instance_ != VK_NULL_HANDLE) vkDestroyInstance(instance_, nullptr);
+    }
+
+    bool createDevice() {
+        VkInstanceCreateInfo instance_create_info = {};
+        instance_create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        if (vkCreateInstance(&instance_create_info, nullptr, &instance_) != VK_SUCCESS) {
+            instance_ = VK_NULL_HANDLE;
+            return false;
+        }
+
+        uint32_t device_count = 1;
+        VkResult result = vkEnumeratePhysicalDevices(instance_, &device_count, &physical_device_);
+        if ((result != VK_SUCCESS && result != VK_INCOMPLETE) || device_count == 0) {
+            return false;
+        }
+
+        VkDeviceQueueCreateInfo queue_create_info = {};
+        queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queue_create_info.queueFamilyIndex = 0;
+        queue_create_info.queueCount = 1;
+        float queue_priority = 1.0f;
+        queue_create_info.pQueuePriorities = &queue_priority;
+
+        auto extensions = FrameCapture::requiredDeviceExtensions();
+        VkPhysicalDeviceTimelineSemaphoreFeatures timeline_features = {};
+        timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+        timeline_features.timelineSemaphore = VK_TRUE;
+
+        VkDeviceCreateInfo device_create_info = {};
+        device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        device_create_info.pNext = &timeline_features;
+        device_create_info.queueCreateInfoCount = 1;
+        device_create_info.pQueueCreateInfos = &queue_create_info;
+        device_create_info.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+        device_create_info.ppEnabledExtensionNames = extensions.data();
+        if (vkCreateDevice(physical_device_, &device_create_info, nullptr, &device_) !=
+            VK_SUCCESS) {
+            device_ = VK_NULL_HANDLE;
+            return false;
+        }
+        vkGetDeviceQueue(device_, 0, 0, &queue_);
+        return true;
+    }
+
+    bool createImages() {
+        VkImageCreateInfo image_create_info = {};
+        image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        image_create_info.imageType = VK_IMAGE_TYPE_2D;
+        image_create_info.format = CAPTURE_FORMAT;
+        image_create_info.extent = {CAPTURE_WIDTH, CAPTURE_HEIGHT, 1};
+        image_create_info.mipLevels = 1;
+        image_create_info.arrayLayers = 1;
+        image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+        image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        image_create_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        VkPhysicalDeviceMemoryProperties properties;
+        vkGetPhysicalDeviceMemoryProperties(physical_device_, &properties);
+        for (uint32_t i = 0; i < IMAGE_COUNT; i++) {
+            if (vkCreateImage(device_, &image_create_info, nullptr, &images_[i]) != VK_SUCCESS) {
+                images_[i] = VK_NULL_HANDLE;
+                return false;
+            }
+
+            VkMemoryRequirements requirements;
+            vkGetImageMemoryRequirements(device_, images_[i], &requirements);
+            uint32_t type = properties.memoryTypeCount;
+            for (uint32_t t = 0; t < properties.memoryTypeCount; t++) {
+                if ((requirements.memoryTypeBits & (1u << t)) &&
+                    (properties.memoryTypes[t].propertyFlags &
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+                    type = t;
+                    break;
+                }
+            }
+            if (type == properties.memoryTypeCount) return false;
+
+            VkMemoryAllocateInfo allocate_info = {};
+            allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocate_info.allocationSize = requirements.size;
+            allocate_info.memoryTypeIndex = type;
+            if (vkAllocateMemory(device_, &allocate_info, nullptr, &memory_[i]) != VK_SUCCESS) {
+                memory_[i] = VK_NULL_HANDLE;
+                return false;
+            }
+            if (vkBindImageMemory(device_, images_[i], memory_[i], 0) != VK_SUCCESS) {
+                return false;
+            }
+        }
+        return fillImages();
+    }
+
+    // Clears image i to grey level (i + 1) / (IMAGE_COUNT + 1) and leaves it in
+    // PRESENT_SRC_KHR
+    bool fillImages() {
+        VkCommandPoolCreateInfo pool_info = {};
+        pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        pool_info.queueFamilyIndex = 0;
+        VkCommandPool pool;
+        if (vkCreateCommandPool(device_, &pool_info, nullptr, &pool) != VK_SUCCESS) return false;
+
+        VkCommandBufferAllocateInfo allocate_info = {};
+        allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocate_info.commandPool = pool;
+        allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocate_info.commandBufferCount = 1;
+        VkCommandBuffer cmd;
+        if (vkAllocateCommandBuffers(device_, &allocate_info, &cmd) != VK_SUCCESS) {
+            vkDestroyCommandPool(device_, pool, nullptr);
+            return false;
+        }
+
+        VkCommandBufferBeginInfo begin_info = {};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(cmd, &begin_info);
+
+        for (uint32_t i = 0; i < IMAGE_COUNT; i++) {
+            VkImageMemoryBarrier barrier = {};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = images_[i];
+            barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+            float level = static_cast<float>(i + 1) / (IMAGE_COUNT + 1);
+            VkClearColorValue color = {};
+            color.float32[0] = level;
+            color.float32[1] = level;
+            color.float32[2] = level;
+            color.float32[3] = 1.0f;
+            vkCmdClearColorImage(cmd, images_[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1,
+                &barrier.subresourceRange);
+
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = 0;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        }
+        vkEndCommandBuffer(cmd);
+
+        VkSubmitInfo submit_info = {};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &cmd;
+        bool filled = vkQueueSubmit(queue_, 1, &submit_info, VK_NULL_HANDLE) == VK_SUCCESS &&
+            vkQueueWaitIdle(queue_) == VK_SUCCESS;
+        vkDestroyCommandPool(device_, pool, nullptr);
+        return filled;
+    }
+
+    bool valid_{false};
+    VkInstance instance_{VK_NULL_HANDLE};
+    VkPhysicalDevice physical_device_{VK_NULL_HANDLE};
+    VkDevice device_{VK_NULL_HANDLE};
+    VkQueue queue_{VK_NULL_HANDLE};
+    VkImage images_[IMAGE_COUNT] = {};
+    VkDeviceMemory memory_[IMAGE_COUNT] = {};
+};
+
+// Times one frame from capture to collection on backend: captureFrame and
+// then getEncodedFrame until the frame is complete
+void captureLoop(benchmark::State& state, CaptureBackend& backend) {
+    CaptureDevice& device = CaptureDevice::get();
+    std::vector<uint8_t> frame_data;
+    size_t index = 0;
+    int64_t encoded_bytes = 0;
+    for (auto _ : state) {
+        if (!backend.captureFrame(device.image(index), index)) {
+            state.SkipWithError("frame dropped");
+            break;
+        }
+        bool end_of_frame = false;
+        while (!end_of_frame) {
+            if (!backend.getEncodedFrame(frame_data, &end_of_frame)) {
+                state.SkipWithError("no encoded frame");
+                break;
+            }
+            encoded_bytes += static_cast<int64_t>(frame_data.size());
+        }
+        if (!end_of_frame) break;
+        index++;
+    }
+    backend.flush();
+
+    int64_t frame_bytes = static_cast<int64_t>(CAPTURE_WIDTH) * CAPTURE_HEIGHT * 4;
+    state.SetBytesProcessed(state.iterations() * frame_bytes);
+    state.SetItemsProcessed(state.iterations());
+    state.counters["encoded_bytes"] = benchmark::Counter(static_cast<double>(encoded_bytes),
+        benchmark::Counter::kAvgIterations);
+}
+
+// GPU copy, CUDA color conversion and NVENC, per codec
+void BM_HardwareCapture(benchmark::State& state) {
+    CaptureDevice& device = CaptureDevice::get();
+    if (!device.valid()) {
+        state.SkipWithError("no Vulkan device");
+        return;
+    }
+
+    FrameCapture::CaptureConfig config;
+    config.width = CAPTURE_WIDTH;
+    config.height = CAPTURE_HEIGHT;
+    config.format = CAPTURE_FORMAT;
+    config.fps = 60;
+    config.bitrate = 5000000;
+    config.gop_size = 30;
+    config.codec = static_cast<FrameCapture::Codec>(state.range(0));
+    config.hardware_encoding = true;
+    FrameCapture capture(config);
+    if (!capture.initialize(device.device(), device.physicalDevice())) {
+        state.SkipWithError("NVENC initialization failed");
+        return;
+    }
+    captureLoop(state, capture);
+}
+
+// Copy into host-visible memory and SoftwareEncoder, raw or compressed
+void BM_ReadbackCapture(benchmark::State& state) {
+    CaptureDevice& device = CaptureDevice::get();
+    if (!device.valid()) {
+        state.SkipWithError("no Vulkan device");
+        return;
+    }
+
+    ReadbackCapture::Config config;
+    config.width = CAPTURE_WIDTH;
+    config.height = CAPTURE_HEIGHT;
+    config.format = CAPTURE_FORMAT;
+    config.compress = state.range(0) != 0;
+    ReadbackCapture capture(config);
+    if (!capture.initialize(device.device(), device.physicalDevice(), 0)) {
+        state.SkipWithError("readback initialization failed");
+        return;
+    }
+    captureLoop(state, capture);
+}
+
+} // namespace
+
+BENCHMARK(BM_HardwareCapture)
+    ->Arg(static_cast<int64_t>(FrameCapture::Codec::H264))
+    ->Arg(static_cast<int64_t>(FrameCapture::Codec::HEVC))
+    ->ArgName("codec")->UseRealTime();
+BENCHMARK(BM_ReadbackCapture)->Arg(0)->Arg(1)->ArgName("compress")->UseRealTime();
@@ -0,0 +1,70 @@
+#include <benchmark/benchmark.h>
+#include "common/gpu/software_codec.hpp"
+#include "payloads.hpp"
+#include <vector>
+
+using namespace anarchy::bench;
+using namespace anarchy::gpu;
+
+namespace {
+
+constexpr size_t SEQUENCE_LENGTH = 8;  // Frames cycled through; only the first is a keyframe
+
+// Desktop frames where only the video window changes, or none at all
+std::vector<std::vector<uint8_t>> frameSequence(bool motion) {
+    std::vector<std::vector<uint8_t>> frames;
+    for (size_t i = 0; i < SEQUENCE_LENGTH; i++) {
+        frames.push_back(desktopFrame(motion ? static_cast<uint32_t>(i) : 0));
+    }
+    return frames;
+}
+
+// Per frame cost of the software path: XOR against the last frame and LZ4
+void BM_SoftwareEncode(benchmark::State& state) {
+    bool motion = state.range(0) != 0;
+    bool compress = state.range(1) != 0;
+    std::vector<std::vector<uint8_t>> frames = frameSequence(motion);
+    SoftwareEncoder encoder(compress);
+    std::vector<uint8_t> encoded;
+
+    size_t index = 0;
+    int64_t encoded_bytes = 0;
+    for (auto _ : state) {
+        encoder.encode(frames[index].data(), FRAME_WIDTH, FRAME_HEIGHT,
+            VK_FORMAT_R8G8B8A8_UNORM, FRAME_BYTES_PER_PIXEL, encoded);
+        encoded_bytes += static_cast<int64_t>(encoded.size());
+        index = (index + 1) % SEQUENCE_LENGTH;
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(frames[0].size()));
+    state.SetItemsProcessed(state.iterations());
+    state.counters["encoded_bytes"] = benchmark::Counter(static_cast<double>(encoded_bytes),
+        benchmark::Counter::kAvgIterations);
+}
+
+void BM_SoftwareDecode(benchmark::State& state) {
+    bool motion = state.range(0) != 0;
+    std::vector<std::vector<uint8_t>> frames = frameSequence(motion);
+    std::vector<std::vector<uint8_t>> encoded(SEQUENCE_LENGTH);
+    SoftwareEncoder encoder(true);
+    for (size_t i = 0; i < SEQUENCE_LENGTH; i++) {
+        encoder.encode(frames[i].data(), FRAME_WIDTH, FRAME_HEIGHT, VK_FORMAT_R8G8B8A8_UNORM,
+            FRAME_BYTES_PER_PIXEL, encoded[i]);
+    }
+
+    SoftwareDecoder decoder;
+    size_t index = 0;
+    for (auto _ : state) {
+        if (!decoder.decode(encoded[index].data(), encoded[index].size())) {
+            state.SkipWithError("decode failed");
+            break;
+        }
+        index = (index + 1) % SEQUENCE_LENGTH;
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(frames[0].size()));
+    state.SetItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+BENCHMARK(BM_SoftwareEncode)->ArgsProduct({{0, 1}, {0, 1}})->ArgNames({"motion", "compress"});
+BENCHMARK(BM_SoftwareDecode)->Arg(0)->Arg(1)->ArgName("motion");
@@ -0,0 +1,121 @@
+#include <benchmark/benchmark.h>
+#include "common/network/compression.hpp"
+#include "payloads.hpp"
+#include <string>
+
+using namespace anarchy::bench;
+using namespace anarchy::network;
+
+namespace {
+
+enum Payload : int64_t {
+    COMMANDS,
+    RGBA,
+    BITSTREAM,
+};
+
+const std::vector<uint8_t>& payload(int64_t which) {
+    static const std::vector<uint8_t> commands = commandBatch();
+    static const std::vector<uint8_t> rgba = desktopFrame();
+    static const std::vector<uint8_t> bitstream = encodedFrame();
+    switch (which) {
+        case COMMANDS:
+            return commands;
+        case RGBA:
+            return rgba;
+        default:
+            return bitstream;
+    }
+}
+
+const char* payloadName(int64_t which) {
+    switch (which) {
+        case COMMANDS:
+            return "commands";
+        case RGBA:
+            return "rgba";
+        default:
+            return "bitstream";
+    }
+}
+
+const char* levelName(CompressionLevel level) {
+    switch (level) {
+        case CompressionLevel::FAST:
+            return "fast";
+        case CompressionLevel::MAX:
+            return "max";
+        default:
+            return "balanced";
+    }
+}
+
+struct Case {
+    const std::vector<uint8_t>& input;
+    CompressionType type;
+    CompressionLevel level;
+};
+
+Case setUp(benchmark::State& state) {
+    Case c = {payload(state.range(0)), static_cast<CompressionType>(state.range(1)),
+        static_cast<CompressionLevel>(state.range(2))};
+    state.SetLabel(std::string(payloadName(state.range(0))) + "/" +
+        (c.type == CompressionType::LZ4 ? "lz4" : "zlib") + "/" + levelName(c.level));
+    return c;
+}
+
+void BM_Compress(benchmark::State& state) {
+    // The codec ZMQWrapper sends with; the thread's state is set up in the
+    // first iteration and only reset after that, as on a worker thread
+    Case c = setUp(state);
+    std::vector<uint8_t> output(compressBound(c.type, c.input.size()));
+
+    size_t compressed = 0;
+    for (auto _ : state) {
+        compressed = compressData(c.type, c.level, c.input.data(), c.input.size(),
+            output.data(), output.size());
+        benchmark::DoNotOptimize(compressed);
+    }
+    if (compressed == 0) {
+        state.SkipWithError("compression failed");
+        return;
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(c.input.size()));
+    state.counters["ratio"] = static_cast<double>(compressed) / c.input.size();
+}
+
+void BM_Decompress(benchmark::State& state) {
+    Case c = setUp(state);
+    std::vector<uint8_t> compressed(compressBound(c.type, c.input.size()));
+    compressed.resize(compressData(c.type, c.level, c.input.data(), c.input.size(),
+        compressed.data(), compressed.size()));
+    if (compressed.empty()) {
+        state.SkipWithError("compression failed");
+        return;
+    }
+
+    std::vector<uint8_t> output(c.input.size());
+    for (auto _ : state) {
+        size_t size = decompressData(c.type, compressed.data(), compressed.size(),
+            output.data(), output.size());
+        if (size != c.input.size()) {
+            state.SkipWithError("decompression failed");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(c.input.size()));
+}
+
+// Payload x codec x level
+const std::vector<std::vector<int64_t>> CASES = {
+    {COMMANDS, RGBA, BITSTREAM},
+    {static_cast<int64_t>(CompressionType::ZLIB), static_cast<int64_t>(CompressionType::LZ4)},
+    {static_cast<int64_t>(CompressionLevel::FAST),
+        static_cast<int64_t>(CompressionLevel::BALANCED),
+        static_cast<int64_t>(CompressionLevel::MAX)},
+};
+
+} // namespace
+
+BENCHMARK(BM_Compress)->ArgsProduct(CASES)->ArgNames({"payload", "codec", "level"});
+BENCHMARK(BM_Decompress)->ArgsProduct(CASES)->ArgNames({"payload", "codec", "level"});
@@ -0,0 +1,83 @@
+#include <benchmark/benchmark.h>
+#include "common/network/command_stream.hpp"
+#include "common/network/vulkan_commands.hpp"
+#include "loopback.hpp"
+#include <vector>
+
+using namespace anarchy::bench;
+using namespace anarchy::network;
+
+namespace {
+
+constexpr int64_t SYNC_INTERVAL = 256;     // Deferred calls between sync points
+
+// What the ICD sends for vkAllocateMemory, one of the calls that waits for
+// its result
+std::vector<uint8_t> allocateCall() {
+    AllocateMemoryParams params = {};
+    params.allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    params.allocate_info.allocationSize = 64 * 1024;
+    std::vector<uint8_t> buffer;
+    encodeWire(params, buffer, [](HandleType, uint64_t handle) { return handle; });
+    return buffer;
+}
+
+// Calls that wait for the server: each one is a round trip
+void BM_SynchronousCalls(benchmark::State& state, const char* endpoint) {
+    Loopback loopback(endpoint, false, MessageType::VK_ALLOCATE_MEMORY);
+    if (!loopback.start()) {
+        state.SkipWithError("transport did not connect");
+        return;
+    }
+
+    Message call = loopback.request(0);
+    call.payload = allocateCall();
+    call.header.size = static_cast<uint32_t>(call.payload.size());
+    for (auto _ : state) {
+        if (!loopback.send(call) || !loopback.wait(1)) {
+            state.SkipWithError("reply timed out");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Calls the ICD defers: packed by the command stream and sent as batches,
+// with a round trip only at each sync point, like a fence wait
+void BM_DeferredCalls(benchmark::State& state, const char* endpoint) {
+    Loopback loopback(endpoint, false, MessageType::VK_COMMAND_BATCH);
+    if (!loopback.start()) {
+        state.SkipWithError("transport did not connect");
+        return;
+    }
+
+    int64_t batches = 0;
+    CommandStream stream([&](Message& batch) {
+        batches++;
+        return loopback.send(batch);
+    });
+
+    uint64_t handle = 0x1234;
+    uint64_t sequence = 0;
+    for (auto _ : state) {
+        batches = 0;
+        for (int64_t i = 0; i < SYNC_INTERVAL; i++) {
+            stream.enqueue(MessageType::VK_DESTROY_BUFFER, ++sequence, &handle, sizeof(handle));
+        }
+        if (!stream.flush() || !loopback.wait(static_cast<size_t>(batches))) {
+            state.SkipWithError("batch reply timed out");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * SYNC_INTERVAL);
+}
+
+} // namespace
+
+BENCHMARK_CAPTURE(BM_SynchronousCalls, zmq, "tcp://127.0.0.1:5720")->UseRealTime();
+BENCHMARK_CAPTURE(BM_DeferredCalls, zmq, "tcp://127.0.0.1:5720")->UseRealTime();
+
+#ifdef __linux__
+BENCHMARK_CAPTURE(BM_SynchronousCalls, raw, "raw://127.0.0.1:5730")->UseRealTime();
+BENCHMARK_CAPTURE(BM_DeferredCalls, raw, "raw://127.0.0.1:5730")->UseRealTime();
+#endif
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "common/network/transport.hpp"
+#include "common/network/zmq_wrapper.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace anarchy {
+namespace bench {
+
+// A server and a client transport on the loopback interface. The server
+// answers every message of the request type, with the payload echoed or an
+// empty reply; the client counts the answers so a benchmark can wait for
+// them. Compression is off for the request type, so what is measured is
+// the transport's own cost. Not thread-safe, apart from the callbacks.
+class Loopback {
+public:
+    static constexpr auto CONNECT_TIMEOUT = std::chrono::seconds(5);
+    static constexpr auto REPLY_TIMEOUT = std::chrono::seconds(10);
+
+    Loopback(const std::string& endpoint, bool echo_payload,
+        network::MessageType type = network::MessageType::VK_WRITE_MEMORY)
+        : server_(network::Transport::create(endpoint, network::Transport::Role::SERVER))
+        , client_(network::Transport::create(endpoint, network::Transport::Role::CLIENT))
+        , echo_payload_(echo_payload)
+        , type_(type)
+    {
+        for (network::Transport* transport : {server_.get(), client_.get()}) {
+            if (auto* zmq = dynamic_cast<network::ZMQWrapper*>(transport)) {
+                zmq->setCompressionRule(type_, {network::CompressionType::NONE, 0});
+            }
+        }
+
+        server_->setMessageCallback([this](const network::Message& message) {
+            if (message.header.type != type_) {
+                return;
+            }
+            network::Message reply;
+            reply.header = message.header;
+            reply.peer = message.peer;
+            if (echo_payload_) {
+                reply.payload = message.payload;
+            } else {
+                reply.header.size = 0;
+            }
+            server_->sendMessage(std::move(reply));
+        });
+        client_->setMessageCallback([this](const network::Message& message) {
+            if (message.header.type != type_) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            replies_++;
+            replied_.notify_one();
+        });
+    }
+
+    ~Loopback() {
+        client_->stop();
+        server_->stop();
+    }
+
+    Loopback(const Loopback&) = delete;
+    Loopback& operator=(const Loopback&) = delete;
+
+    // The raw client connects in start(), so the server goes first
+    bool start() {
+        if (!server_->start() || !client_->start()) {
+            return false;
+        }
+        auto deadline = std::chrono::steady_clock::now() + CONNECT_TIMEOUT;
+        while (!client_->isConnected()) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        // A ZeroMQ client counts as connected before its first message is
+        // through, and the server learns new peers from their first message
+        network::Message warmup = request(0);
+        return send(warmup) && wait(1);
+    }
+
+    // A message of the request type with size bytes of payload
+    network::Message request(size_t size) const {
+        network::Message message;
+        message.header.type = type_;
+        message.header.size = static_cast<uint32_t>(size);
+        message.payload.resize(size);
+        for (size_t i = 0; i < size; i++) {
+            message.payload[i] = static_cast<uint8_t>(i * 131 + (i >> 12));
+        }
+        return message;
+    }
+
+    bool send(const network::Message& message) { return client_->sendMessage(message); }
+
+    // Blocks until count more replies are in; false after REPLY_TIMEOUT
+    bool wait(size_t count) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        size_t target = consumed_ + count;
+        bool done = replied_.wait_for(lock, REPLY_TIMEOUT, [&] { return replies_ >= target; });
+        consumed_ = target;
+        return done;
+    }
+
+private:
+    std::unique_ptr<network::Transport> server_;
+    std::unique_ptr<network::Transport> client_;
+    const bool echo_payload_;
+    const network::MessageType type_;
+
+    std::mutex mutex_;
+    std::condition_variable replied_;
+    size_t replies_{0};
+    size_t consumed_{0};
+};
+
+} // namespace bench
+} // namespace anarchy
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "common/gpu/software_codec.hpp"
+#include "common/network/command_stream.hpp"
+#include "common/network/vulkan_commands.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace anarchy {
+namespace bench {
+
+constexpr uint32_t FRAME_WIDTH = 1280;
+constexpr uint32_t FRAME_HEIGHT = 720;
+constexpr uint32_t FRAME_BYTES_PER_PIXEL = 4;
+
+// A synthetic desktop in RGBA: a gradient background, flat windows and one
+// window of noise standing in for video or a game, which is the only part
+// that changes with frame
+inline std::vector<uint8_t> desktopFrame(uint32_t frame = 0,
+    uint32_t width = FRAME_WIDTH, uint32_t height = FRAME_HEIGHT)
+{
+    std::vector<uint8_t> pixels(size_t(width) * height * FRAME_BYTES_PER_PIXEL);
+    uint32_t noise = 0x9E3779B9u ^ (frame * 0x85EBCA6Bu);
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            uint8_t* pixel = &pixels[(size_t(y) * width + x) * FRAME_BYTES_PER_PIXEL];
+            bool window = x > width / 8 && x < width / 2 && y > height / 8 && y < height * 3 / 4;
+            bool video = x > width * 5 / 8 && x < width * 7 / 8 && y > height / 4 &&
+                y < height * 5 / 8;
+            if (video) {
+                noise ^= noise << 13;
+                noise ^= noise >> 17;
+                noise ^= noise << 5;
+                pixel[0] = static_cast<uint8_t>(noise);
+                pixel[1] = static_cast<uint8_t>(noise >> 8);
+                pixel[2] = static_cast<uint8_t>(noise >> 16);
+            } else if (window) {
+                bool text = (y / 12) % 2 == 0 && ((x * 7 + y) % 11) < 4;
+                uint8_t shade = text ? 0x20 : 0xF0;
+                pixel[0] = pixel[1] = pixel[2] = shade;
+            } else {
+                pixel[0] = static_cast<uint8_t>(y * 255 / height);
+                pixel[1] = 0x40;
+                pixel[2] = static_cast<uint8_t>(0xFF - y * 255 / height);
+            }
+            pixel[3] = 0xFF;
+        }
+    }
+    return pixels;
+}
+
+// What the ICD sends for a frame's worth of deferred calls: queue submits
+// with their semaphores and command buffers, as one VK_COMMAND_BATCH
+inline std::vector<uint8_t> commandBatch(size_t commands = 2048) {
+    std::vector<uint8_t> batch;
+    network::CommandStream stream([&](network::Message& message) {
+        batch = std::move(message.payload);
+        return true;
+    }, 1024 * 1024, 1024 * 1024);
+
+    std::vector<uint8_t> params_buffer;
+    for (size_t i = 0; i < commands; i++) {
+        VkSemaphore wait_semaphore = reinterpret_cast<VkSemaphore>(uint64_t(0x1000 + i % 3));
+        VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        VkCommandBuffer command_buffer = reinterpret_cast<VkCommandBuffer>(uint64_t(0x2000 + i));
+
+        VkSubmitInfo submit = {};
+        submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit.waitSemaphoreCount = 1;
+        submit.pWaitSemaphores = &wait_semaphore;
+        submit.pWaitDstStageMask = &wait_stage;
+        submit.commandBufferCount = 1;
+        submit.pCommandBuffers = &command_buffer;
+
+        network::QueueSubmitParams params = {};
+        params.queue = 1;
+        params.submit_count = 1;
+        params.submits = &submit;
+        network::encodeWire(params, params_buffer,
+            [](network::HandleType, uint64_t handle) { return handle; });
+        stream.enqueue(network::MessageType::VK_QUEUE_SUBMIT, i + 1, params_buffer.data(),
+            params_buffer.size());
+    }
+    stream.flush();
+    return batch;
+}
+
+// The desktop as an LZ4 software keyframe: already compressed, standing in
+// for an encoder's bitstream, which general purpose codecs barely shrink
+inline std::vector<uint8_t> encodedFrame() {
+    std::vector<uint8_t> pixels = desktopFrame();
+    std::vector<uint8_t> frame;
+    gpu::SoftwareEncoder encoder(true);
+    encoder.encode(pixels.data(), FRAME_WIDTH, FRAME_HEIGHT, VK_FORMAT_R8G8B8A8_UNORM,
+        FRAME_BYTES_PER_PIXEL, frame);
+    return frame;
+}
+
+} // namespace bench
+} // namespace anarchy
@@ -0,0 +1,114 @@
+#include <benchmark/benchmark.h>
+#include "common/network/vulkan_commands.hpp"
+#include <cstring>
+#include <vector>
+
+using namespace anarchy::network;
+
+namespace {
+
+uint64_t identityMap(HandleType, uint64_t handle) {
+    return handle;
+}
+
+struct InstanceCall {
+    VkApplicationInfo app_info{};
+    const char* extensions[2] = {"VK_KHR_surface", "VK_KHR_win32_surface"};
+    CreateInstanceParams params{};
+
+    InstanceCall() {
+        app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+        app_info.pApplicationName = "Anarchy";
+        app_info.pEngineName = "Engine";
+        params.instance = 0x42;
+        params.create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        params.create_info.pApplicationInfo = &app_info;
+        params.create_info.enabledExtensionCount = 2;
+        params.create_info.ppEnabledExtensionNames = extensions;
+    }
+};
+
+// The per-frame hot call: a submit with a timeline wait and a few command buffers
+struct SubmitCall {
+    VkSemaphore wait_semaphores[1] = {reinterpret_cast<VkSemaphore>(uint64_t(10))};
+    VkPipelineStageFlags wait_stages[1] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+    VkCommandBuffer command_buffers[4] = {};
+    uint64_t wait_values[1] = {7};
+    VkTimelineSemaphoreSubmitInfo timeline{};
+    VkSubmitInfo submit{};
+    QueueSubmitParams params{};
+
+    SubmitCall() {
+        for (uint64_t i = 0; i < 4; i++) {
+            command_buffers[i] = reinterpret_cast<VkCommandBuffer>(20 + i);
+        }
+        timeline.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timeline.waitSemaphoreValueCount = 1;
+        timeline.pWaitSemaphoreValues = wait_values;
+        submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit.pNext = &timeline;
+        submit.waitSemaphoreCount = 1;
+        submit.pWaitSemaphores = wait_semaphores;
+        submit.pWaitDstStageMask = wait_stages;
+        submit.commandBufferCount = 4;
+        submit.pCommandBuffers = command_buffers;
+        params.queue = 1;
+        params.submit_count = 1;
+        params.submits = &submit;
+    }
+};
+
+struct AllocateCall {
+    VkMemoryAllocateFlagsInfo flags_info{};
+    AllocateMemoryParams params{};
+
+    AllocateCall() {
+        flags_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+        flags_info.deviceMask = 1;
+        params.allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        params.allocate_info.pNext = &flags_info;
+        params.allocate_info.allocationSize = 64 * 1024 * 1024;
+    }
+};
+
+template <typename Call>
+void BM_Encode(benchmark::State& state) {
+    Call call;
+    std::vector<uint8_t> buffer;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(encodeWire(call.params, buffer, identityMap));
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(buffer.size()));
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Decoding rewrites the offsets in place, so every call starts from a fresh
+// copy of the encoded block, as the server's receive buffer would be
+template <typename Call>
+void BM_Decode(benchmark::State& state) {
+    Call call;
+    std::vector<uint8_t> encoded;
+    encodeWire(call.params, encoded, identityMap);
+    std::vector<uint8_t> buffer(encoded.size());
+    for (auto _ : state) {
+        std::memcpy(buffer.data(), encoded.data(), encoded.size());
+        auto* decoded = decodeWire<decltype(call.params)>(buffer.data(), buffer.size(),
+            identityMap);
+        if (!decoded) {
+            state.SkipWithError("decode failed");
+            break;
+        }
+        benchmark::DoNotOptimize(decoded);
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(encoded.size()));
+    state.SetItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_Encode, InstanceCall);
+BENCHMARK_TEMPLATE(BM_Encode, SubmitCall);
+BENCHMARK_TEMPLATE(BM_Encode, AllocateCall);
+BENCHMARK_TEMPLATE(BM_Decode, InstanceCall);
+BENCHMARK_TEMPLATE(BM_Decode, SubmitCall);
+BENCHMARK_TEMPLATE(BM_Decode, AllocateCall);
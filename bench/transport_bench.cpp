@@ -0,0 +1,69 @@
+#include <benchmark/benchmark.h>
+#include "loopback.hpp"
+#include <string>
+
+using namespace anarchy::bench;
+using namespace anarchy::network;
+
+namespace {
+
+constexpr int64_t MIN_PAYLOAD = 64;
+constexpr int64_t MAX_PAYLOAD = 16 * 1024 * 1024;
+constexpr int64_t THROUGHPUT_WINDOW = 8;    // Messages in flight per iteration
+
+// One request out, the same payload back: the latency of a synchronous call
+void BM_RoundTrip(benchmark::State& state, const char* endpoint) {
+    size_t size = static_cast<size_t>(state.range(0));
+    Loopback loopback(endpoint, true);
+    if (!loopback.start()) {
+        state.SkipWithError("transport did not connect");
+        return;
+    }
+
+    Message request = loopback.request(size);
+    for (auto _ : state) {
+        if (!loopback.send(request) || !loopback.wait(1)) {
+            state.SkipWithError("reply timed out");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(size) * 2);
+}
+
+// A window of requests answered by empty replies: one-way bandwidth
+void BM_Throughput(benchmark::State& state, const char* endpoint) {
+    size_t size = static_cast<size_t>(state.range(0));
+    Loopback loopback(endpoint, false);
+    if (!loopback.start()) {
+        state.SkipWithError("transport did not connect");
+        return;
+    }
+
+    Message request = loopback.request(size);
+    for (auto _ : state) {
+        for (int64_t i = 0; i < THROUGHPUT_WINDOW; i++) {
+            loopback.send(request);
+        }
+        if (!loopback.wait(THROUGHPUT_WINDOW)) {
+            state.SkipWithError("replies timed out");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * THROUGHPUT_WINDOW * static_cast<int64_t>(size));
+    state.SetItemsProcessed(state.iterations() * THROUGHPUT_WINDOW);
+}
+
+} // namespace
+
+// ZeroMQ takes the given port and the next ones for its other channels
+BENCHMARK_CAPTURE(BM_RoundTrip, zmq, "tcp://127.0.0.1:5700")
+    ->RangeMultiplier(4)->Range(MIN_PAYLOAD, MAX_PAYLOAD)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Throughput, zmq, "tcp://127.0.0.1:5700")
+    ->RangeMultiplier(4)->Range(MIN_PAYLOAD, MAX_PAYLOAD)->UseRealTime();
+
+#ifdef __linux__
+BENCHMARK_CAPTURE(BM_RoundTrip, raw, "raw://127.0.0.1:5710")
+    ->RangeMultiplier(4)->Range(MIN_PAYLOAD, MAX_PAYLOAD)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Throughput, raw, "raw://127.0.0.1:5710")
+    ->RangeMultiplier(4)->Range(MIN_PAYLOAD, MAX_PAYLOAD)->UseRealTime();
+#endif
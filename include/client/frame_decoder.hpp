@@ -0,0 +1,117 @@
+#pragma once
+
+#include "client/jitter_buffer.hpp"
+#include "common/network/buffer_pool.hpp"
+#include "common/network/protocol.hpp"
+#include "common/gpu/software_codec.hpp"
+#include <vulkan/vulkan.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace anarchy {
+namespace client {
+
+// Shows the frames the server streams back in the application's window.
+// FRAME_DATA slices are put together in pooled buffers and decoded on the
+// GPU by a Media Foundation hardware decoder into D3D11 textures, which a
+// video processor scales and converts straight into the back buffer of a
+// flip-model swapchain on the window, so decoded pictures never touch
+// system memory. Software frames are decoded on the CPU and uploaded once.
+// Decoded pictures wait in a JitterBuffer of 0-1 frames before presenting.
+// Windows only; initialize() fails elsewhere.
+class FrameDecoder {
+public:
+    struct Config {
+        void* window;               // HWND the application's surface was made for
+        uint32_t width;             // Swapchain size; frames are scaled to it
+        uint32_t height;
+        uint32_t fps;               // Paces the jitter buffer
+        uint32_t jitter_frames = 0; // 0 is lowest latency, 1 smooths late frames
+    };
+
+    struct Statistics {
+        uint64_t frames_received;
+        uint64_t frames_decoded;
+        uint64_t frames_presented;
+        uint64_t frames_dropped;        // Incomplete, or skipped by the jitter buffer
+        uint64_t decode_errors;
+        double average_decode_time;     // ms, submit to picture out
+        double average_latency;         // ms, last slice in to present
+    };
+
+    // Called from the decode thread once a frame is decoded, for FRAME_ACK.
+    // Acking before the jitter buffer keeps its delay out of the round trip
+    // the server measures.
+    using FrameCallback = std::function<void(uint64_t sequence)>;
+
+    explicit FrameDecoder(const Config& config);
+    ~FrameDecoder();
+
+    FrameDecoder(const FrameDecoder&) = delete;
+    FrameDecoder& operator=(const FrameDecoder&) = delete;
+
+    // Opens the D3D11 device and the swapchain and starts the decode
+    // thread. The decoder itself is created with the first frame, once its
+    // encoding is known.
+    bool initialize();
+
+    // From the network thread. Returns quickly: decoding happens elsewhere.
+    // Every complete frame is decoded, even ones that will not be shown.
+    void onFrameData(const network::Message& message);
+
+    void setFrameCallback(FrameCallback callback);
+    void setJitterFrames(uint32_t frames);
+    Statistics getStatistics() const;
+
+    // The window behind a VK_KHR_win32_surface surface, nullptr otherwise
+    static void* windowFromSurface(VkSurfaceKHR surface);
+
+private:
+    struct EncodedFrame {
+        uint64_t sequence;
+        uint64_t frame_id;      // The present's, for the tracer
+        network::FrameEncoding encoding;
+        std::vector<uint8_t> data;      // From buffer_pool_; empty repeats the last picture
+        std::chrono::steady_clock::time_point received;
+    };
+
+    // Windows objects live in the source file
+    struct Platform;
+
+    void decodeThread();
+    bool decodeFrame(EncodedFrame& frame);
+    void presentDue(std::chrono::steady_clock::time_point now);
+
+    const Config config_;
+    std::unique_ptr<Platform> platform_;
+    network::BufferPool buffer_pool_;
+
+    // Slices of the frame being received, network thread only
+    EncodedFrame assembling_{};
+    bool assembling_active_{false};
+    std::atomic<uint64_t> incomplete_frames_{0};
+
+    std::deque<EncodedFrame> queue_;
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cv_;
+    std::atomic<uint32_t> jitter_frames_;
+    std::thread thread_;
+    std::atomic<bool> running_{false};
+
+    gpu::SoftwareDecoder software_decoder_;     // Decode thread only
+    FrameCallback callback_;
+    std::mutex callback_mutex_;
+
+    Statistics stats_{};
+    mutable std::mutex stats_mutex_;
+};
+
+} // namespace client
+} // namespace anarchy
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+namespace anarchy {
+namespace client {
+
+// Holds decoded pictures between decode and present, trading latency for
+// smoothness. With depth 0 a picture is due as soon as it arrives, and a
+// newer one replaces it if it has not been shown yet. With depth 1 pictures
+// are paced a frame interval apart, so a burst of late frames plays out
+// evenly; none waits more than one interval past its arrival, and once more
+// than one is waiting the oldest is dropped. Pictures are dropped only after
+// decoding, so the decoder never loses a reference. Not thread-safe.
+template <typename T>
+class JitterBuffer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr uint32_t MAX_DEPTH = 1;
+
+    JitterBuffer(uint32_t depth, Clock::duration frame_interval)
+        : depth_(std::min(depth, MAX_DEPTH))
+        , frame_interval_(frame_interval)
+    {
+    }
+
+    // Applies to pictures pushed from now on
+    void setDepth(uint32_t depth) { depth_ = std::min(depth, MAX_DEPTH); }
+    uint32_t depth() const { return depth_; }
+
+    void push(T picture, Clock::time_point arrival) {
+        Clock::time_point due = arrival;
+        if (depth_ > 0 && has_last_due_) {
+            due = std::clamp(last_due_ + frame_interval_, arrival,
+                arrival + frame_interval_ * depth_);
+        }
+        last_due_ = due;
+        has_last_due_ = true;
+
+        pictures_.push_back({std::move(picture), due});
+        while (pictures_.size() > depth_ + 1) {
+            pictures_.pop_front();
+            dropped_++;
+        }
+    }
+
+    // The picture to show at now, if one is due. Of several due, the
+    // earlier ones are dropped: showing them would only add delay.
+    bool pop(Clock::time_point now, T& picture) {
+        if (pictures_.empty() || pictures_.front().due > now) {
+            return false;
+        }
+        while (pictures_.size() > 1 && pictures_[1].due <= now) {
+            pictures_.pop_front();
+            dropped_++;
+        }
+        picture = std::move(pictures_.front().picture);
+        pictures_.pop_front();
+        return true;
+    }
+
+    // When the next picture is due; time_point::max() with none waiting
+    Clock::time_point nextDue() const {
+        return pictures_.empty() ? Clock::time_point::max() : pictures_.front().due;
+    }
+
+    void clear() {
+        pictures_.clear();
+        has_last_due_ = false;
+    }
+
+    size_t size() const { return pictures_.size(); }
+    uint64_t dropped() const { return dropped_; }
+
+private:
+    struct Entry {
+        T picture;
+        Clock::time_point due;
+    };
+
+    uint32_t depth_;
+    Clock::duration frame_interval_;
+    std::deque<Entry> pictures_;
+    Clock::time_point last_due_;
+    bool has_last_due_{false};
+    uint64_t dropped_{0};
+};
+
+} // namespace client
+} // namespace anarchy
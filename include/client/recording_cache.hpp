@@ -0,0 +1,115 @@
+#pragma once
+
+#include "common/network/vulkan_commands.hpp"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace anarchy {
+namespace client {
+
+// The recordings the server holds, so a command buffer recorded the same
+// way as before (as most are, frame after frame) goes out as a replay of
+// the server's copy rather than command by command. A recording with the
+// same commands but different parameters is replayed with patches for the
+// bytes that changed.
+//
+// The server keeps the same slots without deciding anything: it fills one
+// from each VK_RECORDING and patches it from each VK_REPLAY_RECORDING, in
+// the order they are sent, so both sides always hold the same bytes. That
+// order is only kept within one thread's command stream, so each recording
+// thread gets its own cache over its own range of slots. Not thread-safe.
+class RecordingCache {
+public:
+    // Patches closer than this are sent as one, their headers costing more
+    static constexpr uint32_t MERGE_GAP = 16;
+
+    struct Lookup {
+        bool replay;    // Or send the recording, to be stored in slot id
+        uint32_t id;
+        std::vector<network::RecordingPatch> patches;   // Offsets into the recording
+    };
+
+    struct Statistics {
+        uint64_t recordings_sent{0};
+        uint64_t replays{0};
+        uint64_t patched_replays{0};
+        uint64_t bytes_recorded{0};     // Recorded, in total
+        uint64_t bytes_sent{0};         // Of those, what went out as recordings or patches
+    };
+
+    explicit RecordingCache(uint32_t first_id = 0, uint32_t capacity = network::MAX_RECORDINGS);
+
+    // A packed recording (see RecordingParams). Afterwards slot id holds it,
+    // as the server's will once the returned action reaches it.
+    Lookup lookup(const std::vector<uint8_t>& recording);
+
+    const std::vector<uint8_t>& recording(uint32_t id) const { return slots_[id - first_id_].data; }
+    uint32_t firstId() const { return first_id_; }
+    uint32_t capacity() const { return static_cast<uint32_t>(slots_.size()); }
+    Statistics getStatistics() const { return statistics_; }
+
+private:
+    struct Slot {
+        std::vector<uint8_t> data;
+        uint64_t hash{0};
+        uint64_t shape{0};      // Hash of the record types and sizes only
+        uint64_t last_use{0};
+    };
+
+    // Patches turning slot into recording, or false when sending it whole
+    // is about as cheap
+    bool diff(const Slot& slot, const std::vector<uint8_t>& recording,
+        std::vector<network::RecordingPatch>& patches) const;
+    void store(uint32_t index, const std::vector<uint8_t>& recording, uint64_t hash,
+        uint64_t shape);
+    uint32_t victim() const;   // Slot index
+
+    const uint32_t first_id_;
+    std::vector<Slot> slots_;
+    std::unordered_map<uint64_t, uint32_t> by_hash_;    // Slot indices
+    std::unordered_map<uint64_t, uint32_t> by_shape_;  // Most recently stored
+    uint64_t clock_{0};
+    Statistics statistics_;
+};
+
+// Hands each recording thread a cache over its own range of slots. A range
+// goes back on the free list when its thread exits, so a thread pool that
+// churns keeps replaying; a thread that finds every range taken gets no
+// cache and sends its recordings as they are. Thread-safe.
+class RecordingCachePool {
+public:
+    static constexpr uint32_t SLOTS_PER_THREAD = 32;   // 16 threads over MAX_RECORDINGS
+
+    explicit RecordingCachePool(uint32_t slots_per_thread = SLOTS_PER_THREAD,
+        uint32_t slot_count = network::MAX_RECORDINGS);
+    ~RecordingCachePool();
+
+    RecordingCachePool(const RecordingCachePool&) = delete;
+    RecordingCachePool& operator=(const RecordingCachePool&) = delete;
+
+    // The calling thread's cache, nullptr when every range is taken. Only
+    // valid on that thread, until it exits.
+    RecordingCache* local();
+
+    size_t threadCount() const;     // Threads holding a range
+
+private:
+    // One per thread, gives its range back to every pool it used on exit
+    struct ThreadExit;
+
+    void releaseThread(std::thread::id thread);
+
+    const uint64_t pool_id_;
+    const uint32_t slots_per_thread_;
+
+    mutable std::mutex mutex_;
+    std::vector<uint32_t> free_ranges_;     // First slot ids, the next one handed out last
+    std::unordered_map<std::thread::id, std::unique_ptr<RecordingCache>> caches_;
+};
+
+} // namespace client
+} // namespace anarchy
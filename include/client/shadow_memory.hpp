@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace anarchy {
+namespace client {
+
+// Client-side copy of a host-visible VkDeviceMemory, handed to the
+// application as its mapping. Maps and unmaps never leave the client; what
+// the application wrote goes to the server in page-sized pieces at the next
+// submit or unmap, so persistently mapped buffers cost only their changes.
+// Written pages come from the OS's write watch where it has one
+// (MEM_WRITE_WATCH on Windows), which is free until queried; elsewhere each
+// page is compared against a copy of what was last sent.
+//
+// Contents the GPU writes come back through load(), when memory the
+// application reads from is mapped. Not thread-safe.
+class ShadowMemory {
+public:
+    static constexpr uint64_t PAGE_SIZE = 4096;
+
+    struct Range {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    // Zero-filled, like the server's memory is assumed to be
+    explicit ShadowMemory(uint64_t size, bool use_write_watch = true);
+    ~ShadowMemory();
+
+    ShadowMemory(const ShadowMemory&) = delete;
+    ShadowMemory& operator=(const ShadowMemory&) = delete;
+
+    uint8_t* data() { return data_; }
+    uint64_t size() const { return size_; }
+    bool usesWriteWatch() const { return write_watch_; }
+
+    // Appends the ranges of [offset, offset + size) written since they were
+    // last collected, page aligned, merged and clipped to the allocation,
+    // and from then on treats them as sent
+    void collectDirty(uint64_t offset, uint64_t size, std::vector<Range>& ranges);
+
+    // Replaces [offset, offset + size) with what the server's memory holds,
+    // clipped to the allocation, without it counting as written. Writes to
+    // the pages it touches must have been collected already.
+    void load(uint64_t offset, const uint8_t* data, uint64_t size);
+
+private:
+    void addPage(uint64_t page, std::vector<Range>& ranges) const;
+
+    uint8_t* data_{nullptr};
+    uint64_t size_;
+    uint64_t allocated_;        // Whole pages
+    bool write_watch_{false};
+    std::vector<uint8_t> sent_; // Without write watch: what the server has
+};
+
+} // namespace client
+} // namespace anarchy
@@ -1,12 +1,24 @@
 #pragma once
 
-#include "common/network/zmq_wrapper.hpp"
+#include "client/frame_decoder.hpp"
+#include "client/recording_cache.hpp"
+#include "client/shadow_memory.hpp"
+#include "common/network/transport.hpp"
 #include "common/network/protocol.hpp"
+#include "common/network/command_stream.hpp"
+#include "common/network/swapchain_ring.hpp"
+#include "common/network/virtual_handle.hpp"
+#include "common/network/vulkan_commands.hpp"
 #include <vulkan/vulkan.hpp>
+#include <atomic>
+#include <condition_variable>
 #include <memory>
 #include <unordered_map>
 #include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace anarchy {
 namespace client {
@@ -16,6 +28,24 @@ public:
     VulkanICD(const std::string& server_address);
     ~VulkanICD();
 
+    // Synchronous calls wait for their reply as long as the connection is up;
+    // one with a timeout of its own gives up that long plus the round trip
+    static constexpr uint64_t WAIT_FOREVER = UINT64_MAX;
+    static constexpr uint32_t REPLY_MARGIN_MS = 5000;
+    static constexpr uint32_t CONNECTION_CHECK_MS = 100;
+
+    // Spin on replies and in the receive loop instead of blocking; lowest
+    // latency when the application can spare a core for it
+    void setBusyPoll(bool enable);
+
+    // Frames of jitter buffer before streamed frames are shown, 0 or 1.
+    // Applies to the current window and later ones.
+    void setJitterFrames(uint32_t frames);
+
+    // Frame trace points go to Tracer::global(), which has to be enabled.
+    // The client's clock is the one both hosts' traces are written on.
+    bool writeTrace(const std::string& path);
+
     // Vulkan instance functions
     VkResult vkCreateInstance(const VkInstanceCreateInfo* pCreateInfo,
         const VkAllocationCallbacks* pAllocator, VkInstance* pInstance);
@@ -28,6 +58,8 @@ public:
         const VkDeviceCreateInfo* pCreateInfo, const VkAllocationCallbacks* pAllocator,
         VkDevice* pDevice);
     void vkDestroyDevice(VkDevice device, const VkAllocationCallbacks* pAllocator);
+    void vkGetDeviceQueue(VkDevice device, uint32_t queueFamilyIndex,
+        uint32_t queueIndex, VkQueue* pQueue);
     VkResult vkEnumerateDeviceExtensionProperties(VkPhysicalDevice physicalDevice,
         const char* pLayerName, uint32_t* pPropertyCount,
         VkExtensionProperties* pProperties);
@@ -38,6 +70,8 @@ public:
         const VkAllocationCallbacks* pAllocator, VkSwapchainKHR* pSwapchain);
     void vkDestroySwapchainKHR(VkDevice device, VkSwapchainKHR swapchain,
         const VkAllocationCallbacks* pAllocator);
+    VkResult vkGetSwapchainImagesKHR(VkDevice device, VkSwapchainKHR swapchain,
+        uint32_t* pSwapchainImageCount, VkImage* pSwapchainImages);
     VkResult vkAcquireNextImageKHR(VkDevice device, VkSwapchainKHR swapchain,
         uint64_t timeout, VkSemaphore semaphore, VkFence fence,
         uint32_t* pImageIndex);
@@ -92,6 +126,13 @@ public:
     VkResult vkBindImageMemory(VkDevice device, VkImage image,
         VkDeviceMemory memory, VkDeviceSize memoryOffset);
 
+    // Vulkan shader functions
+    VkResult vkCreateShaderModule(VkDevice device,
+        const VkShaderModuleCreateInfo* pCreateInfo,
+        const VkAllocationCallbacks* pAllocator, VkShaderModule* pShaderModule);
+    void vkDestroyShaderModule(VkDevice device, VkShaderModule shaderModule,
+        const VkAllocationCallbacks* pAllocator);
+
     // Vulkan synchronization functions
     VkResult vkCreateSemaphore(VkDevice device,
         const VkSemaphoreCreateInfo* pCreateInfo,
@@ -109,9 +150,38 @@ public:
 
 private:
     // Network communication
-    std::unique_ptr<network::ZMQWrapper> network_;
+    std::unique_ptr<network::Transport> network_;
     std::string server_address_;
 
+    // Deferred command batching (declared after network_ so it flushes first on teardown)
+    std::unique_ptr<network::CommandStream> command_stream_;
+    std::atomic<uint64_t> next_sequence_{1};
+    std::atomic<uint64_t> next_frame_id_{1};    // Per present, for the tracer
+
+    // Synchronous calls wait on the entry for their request id, which
+    // handleResponse() fills in from the network thread
+    struct PendingResponse {
+        std::mutex mutex;
+        std::condition_variable ready_cv;
+        std::atomic<bool> ready{false};
+        VkResult result{VK_SUCCESS};
+        std::vector<uint8_t> payload;
+    };
+    std::unordered_map<uint64_t, std::shared_ptr<PendingResponse>> pending_responses_;
+    std::mutex pending_mutex_;
+    std::atomic<bool> busy_poll_{false};
+    network::ConnectionParams connection_params_{};  // Agreed on with the server at CONNECT
+
+    // Object handles are minted locally so creation never waits on the server
+    network::HandleAllocator handle_allocator_;
+
+    // Client-side storage behind dispatchable handles. The loader writes its
+    // dispatch table pointer into the first field, the virtual handle goes on the wire.
+    struct DispatchableObject {
+        uintptr_t loader_data;
+        uint64_t handle;
+    };
+
     // Resource tracking
     struct InstanceInfo {
         VkInstance instance;
@@ -120,40 +190,116 @@ private:
     struct DeviceInfo {
         VkDevice device;
         VkPhysicalDevice physical_device;
-        std::vector<VkQueue> queues;
+        std::unordered_map<uint64_t, VkQueue> queues;  // Keyed by family << 32 | index
     };
+    // The server's images are offscreen; indices are handed out here, in
+    // the order the server's SwapchainRing expects them
     struct SwapchainInfo {
         VkSwapchainKHR swapchain;
         VkDevice device;
         std::vector<VkImage> images;
+        network::SwapchainRing ring;
+    };
+    // Maps hand out the shadow; its dirty pages are sent at unmap and
+    // before every submit while mapped
+    struct MemoryInfo {
+        VkDevice device;
+        VkDeviceSize size;
+        std::unique_ptr<ShadowMemory> shadow;   // Created at the first map
+        bool readback;                          // Host cached: a map fetches the contents
+        bool mapped;
+        VkDeviceSize map_offset;
+        VkDeviceSize map_size;
     };
     struct CommandPoolInfo {
         VkCommandPool command_pool;
         VkDevice device;
     };
+    // Between begin and end, commands are packed here rather than sent, so
+    // the span can go out as a replay of what the server already holds
     struct CommandBufferInfo {
         VkCommandBuffer command_buffer;
         VkCommandPool command_pool;
         VkDevice device;
+        bool recording_open{false};
+        std::vector<uint8_t> recording;
     };
 
     std::unordered_map<VkInstance, InstanceInfo> instances_;
     std::unordered_map<VkDevice, DeviceInfo> devices_;
     std::unordered_map<VkSwapchainKHR, SwapchainInfo> swapchains_;
+    std::unordered_map<VkPhysicalDevice, uint32_t> readback_memory_types_;  // instance_mutex_
+    std::unordered_map<VkDeviceMemory, MemoryInfo> memories_;
     std::unordered_map<VkCommandPool, CommandPoolInfo> command_pools_;
     std::unordered_map<VkCommandBuffer, CommandBufferInfo> command_buffers_;
 
     std::mutex instance_mutex_;
     std::mutex device_mutex_;
     std::mutex swapchain_mutex_;
+    std::mutex memory_mutex_;
     std::mutex command_pool_mutex_;
     std::mutex command_buffer_mutex_;
 
+    // One per recording thread, over its own slots, since only one
+    // thread's commands are sure to reach the server in the order sent
+    RecordingCachePool recording_caches_;
+
+    // Shaders the server has the SPIR-V of, by hash, so each is uploaded
+    // once per application rather than at every launch. Filled from the
+    // server's inventory at the first shader module.
+    std::set<network::ContentHash> known_shaders_;
+    bool shader_inventory_fetched_{false};
+    std::mutex shader_mutex_;
+
+    // Shows the server's frames in the window of the swapchain presented
+    // to; one window at a time
+    std::unique_ptr<FrameDecoder> frame_decoder_;
+    VkSwapchainKHR decoder_swapchain_{VK_NULL_HANDLE};
+    uint32_t jitter_frames_{0};
+    std::mutex decoder_mutex_;
+
+    // Handle helpers
+    template <typename T>
+    T createDispatchable(network::HandleType type);
+    template <typename T>
+    void destroyDispatchable(T handle);
+    template <typename T>
+    T createHandle(network::HandleType type);
+
+    static uint64_t toWire(VkInstance instance);
+    static uint64_t toWire(VkPhysicalDevice physical_device);
+    static uint64_t toWire(VkDevice device);
+    static uint64_t toWire(VkQueue queue);
+    static uint64_t toWire(VkCommandBuffer command_buffer);
+    template <typename T>
+    static uint64_t toWire(T handle);  // Non-dispatchable handles are the virtual handle
+    static uint64_t mapHandle(network::HandleType type, uint64_t handle);  // Wire encoder hook
+
     // Helper functions
-    VkResult sendCommand(const network::Message& message);
-    VkResult waitForResponse(uint64_t sequence);
+    VkResult sendCommand(network::Message& message,  // Sync point: flush and wait
+        std::vector<uint8_t>* response = nullptr, uint64_t timeout_ns = WAIT_FOREVER);
+    VkResult enqueueCommand(const network::Message& message);  // Deferred, no round trip
+    template <typename T>
+    VkResult enqueueEncoded(network::MessageType type, const T& params);
+    template <typename T>
+    network::Message encodeCommand(network::MessageType type, const T& params);
+    VkResult flushCommands();
+    VkResult uploadMemory(VkDeviceMemory memory, MemoryInfo& info);  // memory_mutex_ held
+    VkResult fetchMemory(VkDeviceMemory memory, MemoryInfo& info);   // memory_mutex_ held
+    VkResult recordCommand(VkCommandBuffer command_buffer, network::MessageType type,
+        const void* payload, size_t size);    // Into the open recording, if there is one
+    VkResult sendRecording(VkCommandBuffer command_buffer, const std::vector<uint8_t>& recording);
+    VkResult fetchShaderInventory(VkDevice device);     // shader_mutex_ held
+    uint64_t nextSequence();
+    VkResult waitForResponse(const std::shared_ptr<PendingResponse>& pending,
+        uint64_t request_id, std::vector<uint8_t>* response, uint64_t timeout_ns);
+    void completeResponse(uint64_t request_id, VkResult result, const uint8_t* data, size_t size);
+    VkResult connectToServer();
     void handleResponse(const network::Message& message);
     void handleError(const network::Message& message);
+    void createFrameDecoder(VkSwapchainKHR swapchain, const VkSwapchainCreateInfoKHR& create_info);
+    void requestFrame(VkSwapchainKHR swapchain);
+    void sendFrameAck(uint64_t sequence);
     void cleanupResources();
 };
 
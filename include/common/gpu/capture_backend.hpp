@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+
+namespace anarchy {
+namespace gpu {
+
+// One way of turning presented Vulkan images into frames for the client.
+// CaptureEngine picks one at startup; see there for the implementations.
+class CaptureBackend {
+public:
+    struct Statistics {
+        uint64_t frames_captured;
+        uint64_t frames_encoded;
+        uint64_t frames_dropped;
+        uint64_t frames_skipped;    // Unchanged, not encoded
+        uint64_t total_bytes;
+        double average_fps;
+        double average_latency;     // Capture to bitstream, ms
+
+        // Per-stage averages in ms, 0 where a backend has no such stage.
+        // Stages of different frames overlap, so they add up to more than
+        // the time between frames.
+        double average_queue_time;      // Waiting for the encoder to pick the frame up
+        double average_copy_time;       // Image to slot copy on the GPU
+        double average_convert_time;    // RGB to YUV kernel
+        double average_encode_time;     // Encoder submission to bitstream ready
+    };
+
+    virtual ~CaptureBackend() = default;
+
+    // Frames are copied on queue 0 of queue_family
+    virtual bool initialize(VkDevice device, VkPhysicalDevice physical_device,
+        uint32_t queue_family) = 0;
+
+    // Queue a copy of image. The image must be in PRESENT_SRC_KHR layout and
+    // is left in it; the copy is ordered after earlier work on the capture
+    // queue. Returns false if the frame was dropped. frame_id is the trace
+    // frame id (see Tracer), handed back with the frame.
+    virtual bool captureFrame(VkImage image, uint64_t frame_id = 0) = 0;
+
+    // The next frame, waiting if a captured one is still in progress; false
+    // once nothing is. frame_data is swapped or overwritten, so passing the
+    // same vector back in each time avoids allocating. end_of_frame is false
+    // for all but the last piece of a frame handed out in slices.
+    virtual bool getEncodedFrame(std::vector<uint8_t>& frame_data,
+        bool* end_of_frame = nullptr, uint64_t* frame_id = nullptr) = 0;
+
+    // Finish pending frames and discard any nobody collected
+    virtual void flush() = 0;
+
+    // Bits per second, from the next frame encoded; ignored if lossless
+    virtual void setBitrate(uint32_t bitrate) = 0;
+
+    // For frames captured from now on, no larger than the configured size
+    virtual bool setResolution(uint32_t width, uint32_t height) = 0;
+
+    virtual Statistics getStatistics() const = 0;
+};
+
+} // namespace gpu
+} // namespace anarchy
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "common/gpu/capture_backend.hpp"
+#include "common/gpu/frame_capture.hpp"
+#include "common/network/protocol.hpp"
+#include <memory>
+#include <vector>
+
+namespace anarchy {
+namespace gpu {
+
+// Frame capture for the server: runs the fastest backend the host has and
+// falls back from there. NVENC keeps frames on the GPU until they are a
+// bitstream (FrameCapture). Without it frames are read back and encoded on
+// the CPU (ReadbackCapture): lossless and much larger, but it works on any
+// Vulkan device. Raw readback skips even the encoding, for local consumers.
+class CaptureEngine : public CaptureBackend {
+public:
+    enum class Backend {
+        NVENC,
+        SOFTWARE,
+        RAW,
+    };
+
+    // Backends are tried in order. By default that is NVENC then SOFTWARE
+    // with config.hardware_encoding, SOFTWARE alone without.
+    explicit CaptureEngine(const FrameCapture::CaptureConfig& config,
+        std::vector<Backend> order = {});
+    ~CaptureEngine() override;
+
+    CaptureEngine(const CaptureEngine&) = delete;
+    CaptureEngine& operator=(const CaptureEngine&) = delete;
+
+    // Fails only if no backend initializes
+    bool initialize(VkDevice device, VkPhysicalDevice physical_device,
+        uint32_t queue_family = 0) override;
+
+    Backend backend() const { return backend_; }
+    // What the frames are, for FRAME_DATA headers
+    network::FrameEncoding encoding() const;
+    static const char* backendName(Backend backend);
+
+    bool captureFrame(VkImage image, uint64_t frame_id = 0) override;
+    bool getEncodedFrame(std::vector<uint8_t>& frame_data, bool* end_of_frame = nullptr,
+        uint64_t* frame_id = nullptr) override;
+    void flush() override;
+    void setBitrate(uint32_t bitrate) override;
+    bool setResolution(uint32_t width, uint32_t height) override;
+    Statistics getStatistics() const override;
+
+private:
+    std::unique_ptr<CaptureBackend> createBackend(Backend backend) const;
+
+    const FrameCapture::CaptureConfig config_;
+    std::vector<Backend> order_;
+    std::unique_ptr<CaptureBackend> active_;
+    Backend backend_{Backend::SOFTWARE};
+};
+
+} // namespace gpu
+} // namespace anarchy
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cuda.h>
+#include <vulkan/vulkan.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace anarchy {
+namespace gpu {
+
+// Packed RGB layouts a swapchain image arrives in
+enum class SourceFormat : uint8_t {
+    BGRA8,      // VK_FORMAT_B8G8R8A8_*
+    RGBA8,      // VK_FORMAT_R8G8B8A8_*
+    RGB10A2,    // VK_FORMAT_A2B10G10R10_UNORM_PACK32, R in the low bits
+    BGR10A2,    // VK_FORMAT_A2R10G10B10_UNORM_PACK32, B in the low bits
+};
+
+// Planar YUV layouts NVENC takes as input
+enum class TargetFormat : uint8_t {
+    NV12,           // 8-bit Y plane, interleaved half-resolution UV
+    P010,           // NV12 with 16-bit samples, value in the high 10 bits
+    YUV444,         // Three full-resolution 8-bit planes
+    YUV444_10BIT,   // YUV444 with 16-bit samples, value in the high 10 bits
+};
+
+enum class ColorMatrix : uint8_t {
+    BT601,
+    BT709,
+    BT2020,     // Non-constant luminance, for HDR
+};
+
+// Maps normalized RGB straight to code values of the target bit depth
+struct ColorCoefficients {
+    float y[4];     // R, G, B weights and offset
+    float u[4];
+    float v[4];
+    float max_code; // Largest code value; results are clamped to [0, max_code]
+};
+
+struct ColorConvertParams {
+    CUdeviceptr source;
+    size_t source_pitch;
+    SourceFormat source_format;
+    CUdeviceptr target;         // Luma plane; chroma planes follow it
+    size_t target_pitch;
+    TargetFormat target_format;
+    uint32_t width;             // Even for the 4:2:0 targets
+    uint32_t height;
+    ColorCoefficients coefficients;
+};
+
+bool toSourceFormat(VkFormat format, SourceFormat& source_format);
+bool isTenBit(SourceFormat format);
+bool isTenBit(TargetFormat format);
+bool isChroma444(TargetFormat format);
+
+// Bytes per sample and rows of target_pitch needed for a full frame
+size_t bytesPerSample(TargetFormat format);
+uint32_t targetRows(TargetFormat format, uint32_t height);
+
+ColorCoefficients colorCoefficients(ColorMatrix matrix, bool full_range, TargetFormat target);
+
+// Converts one frame on the GPU, queued on stream after whatever is already
+// on it. One thread per 2x2 block for the 4:2:0 targets, so the whole frame
+// is a single read and write pass.
+CUresult convertColor(const ColorConvertParams& params, CUstream stream);
+
+} // namespace gpu
+} // namespace anarchy
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace anarchy {
+namespace gpu {
+
+// The ordering half of DXCompat's D3D12 submission: which queued command
+// lists can go to their queue now, and what each batch must wait for. Each
+// queue has one fence, signalled after every batch with the next value, so
+// a list is done once its queue's fence reaches the value it went out with.
+//
+// Lists go to their queue in the order queued; all that are ready leave as
+// one batch, for one ExecuteCommandLists. A list whose dependency is still
+// queued waits for it, along with everything queued behind it. Dependencies
+// already submitted to another queue, and not done yet, become waits on
+// that queue's fence on the GPU, so none of this blocks the CPU.
+//
+// Lists are opaque here. Not thread-safe.
+class CommandListGraph {
+public:
+    using List = const void*;
+
+    // A queue's fence, as far as the GPU has got
+    using CompletedValue = std::function<uint64_t(uint32_t queue)>;
+
+    struct Wait {
+        uint32_t queue;
+        uint64_t value;
+    };
+
+    struct Batch {
+        uint32_t queue;
+        std::vector<List> lists;
+        std::vector<Wait> waits;    // Before the lists, at most one per queue
+        uint64_t fence_value;       // To signal after them
+    };
+
+    void queue(uint32_t queue, List list);
+
+    // Holds list's next submission until dependency's pending one has gone
+    // out, or its last if none is pending. Never-submitted dependencies
+    // hold the list until they are.
+    void addDependency(List list, List dependency);
+
+    // Batches in the order they must be executed; lists left waiting stay
+    // queued for the next call
+    std::vector<Batch> takeReady(const CompletedValue& completed);
+
+    // Submitted, and not queued again since, and done on the GPU
+    bool complete(List list, const CompletedValue& completed) const;
+    bool dependenciesComplete(List list, const CompletedValue& completed) const;
+
+    // A released list, forgotten wherever it appears
+    void forget(List list);
+
+    size_t pending() const;
+    uint64_t lastValue(uint32_t queue) const;
+
+private:
+    struct Submission {
+        uint32_t queue;
+        uint64_t value;
+    };
+
+    struct Queue {
+        std::deque<List> lists;
+        uint64_t last_value{0};
+    };
+
+    // False if list must keep waiting; otherwise the GPU waits it needs
+    bool ready(List list, uint32_t queue, const CompletedValue& completed,
+        std::vector<Wait>& waits) const;
+
+    std::map<uint32_t, Queue> queues_;      // Ordered, so batches come out the same way
+    std::unordered_map<List, Submission> submissions_;     // Latest, by list
+    std::unordered_map<List, std::vector<List>> dependencies_;
+    std::unordered_map<List, uint32_t> queued_;     // Times each list is queued
+};
+
+} // namespace gpu
+} // namespace anarchy
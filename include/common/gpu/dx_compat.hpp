@@ -1,7 +1,14 @@
 #pragma once
 
+#include "client/shadow_memory.hpp"
+#include "common/gpu/command_list_graph.hpp"
+#include "common/gpu/staging_ring.hpp"
+#include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace anarchy {
@@ -11,6 +18,7 @@ namespace gpu {
 #include <d3d11.h>
 #include <d3d12.h>
 #include <dxgi1_6.h>
+#include <wrl/client.h>
 #else
 // Define Windows types for Linux compilation
 typedef unsigned long DWORD;
@@ -25,6 +33,7 @@ typedef struct { char dummy; } *ID3D11DeviceContext;
 typedef struct { char dummy; } *ID3D12Device;
 typedef struct { char dummy; } *ID3D12CommandQueue;
 typedef struct { char dummy; } *ID3D12CommandList;
+typedef struct { char dummy; } *ID3D12Fence;
 typedef struct { char dummy; } *IDXGIFactory;
 typedef struct { char dummy; } *IDXGIAdapter;
 typedef struct { char dummy; } *ID3D11Resource;
@@ -44,6 +53,20 @@ enum D3D11_USAGE {
     D3D11_USAGE_STAGING = 3
 };
 
+enum D3D11_MAP {
+    D3D11_MAP_READ = 1,
+    D3D11_MAP_WRITE = 2,
+    D3D11_MAP_READ_WRITE = 3,
+    D3D11_MAP_WRITE_DISCARD = 4,
+    D3D11_MAP_WRITE_NO_OVERWRITE = 5
+};
+
+struct D3D11_MAPPED_SUBRESOURCE {
+    void* pData;
+    UINT RowPitch;
+    UINT DepthPitch;
+};
+
 enum D3D12_COMMAND_LIST_TYPE {
     D3D12_COMMAND_LIST_TYPE_DIRECT = 0,
     D3D12_COMMAND_LIST_TYPE_BUNDLE = 1,
@@ -79,13 +102,19 @@ public:
         UINT cpu_access_flags;
         UINT misc_flags;
         UINT structure_byte_stride;
+        UINT64 size;    // Buffers: the byte width
     };
 
+    // One per command list type. Its fence lives as long as the queue and
+    // is signalled after every batch with the next value, so whether a
+    // list is done is a GetCompletedValue() away.
     struct CommandQueue {
 #ifdef _WIN32
-        std::unique_ptr<ID3D12CommandQueue, decltype(&ID3D12CommandQueue::Release)> queue;
+        Microsoft::WRL::ComPtr<ID3D12CommandQueue> queue;
+        Microsoft::WRL::ComPtr<ID3D12Fence> fence;
 #else
         ID3D12CommandQueue* queue;
+        ID3D12Fence* fence;
 #endif
         D3D12_COMMAND_LIST_TYPE type;
         UINT node_mask;
@@ -93,19 +122,18 @@ public:
         D3D12_COMMAND_QUEUE_FLAGS flags;
     };
 
-    struct CommandListBatch {
-        std::vector<ID3D12CommandList*> command_lists;
-        UINT64 fence_value;
-    };
+    // Every ready list of one type, for one ExecuteCommandLists
+    using CommandListBatch = CommandListGraph::Batch;
 
-    struct CommandListDependency {
-        ID3D12CommandList* dependent_list;
-        UINT64 fence_value;
-    };
-
-    struct CommandListOptimization {
-        std::vector<ID3D12CommandList*> merged_lists;
-        UINT64 optimization_timestamp;
+    // A fence the application asked for with a list, signalled once the
+    // list has gone out. Null when it asked for none.
+    struct FenceSignal {
+#ifdef _WIN32
+        Microsoft::WRL::ComPtr<ID3D12Fence> fence;
+#else
+        ID3D12Fence* fence;
+#endif
+        UINT64 value;
     };
 
     DXCompat() = default;
@@ -121,12 +149,75 @@ public:
 #endif
     }
 
+    // Dynamic buffers mapped for writing get staging memory from a ring
+    // rather than an allocation per map; other maps go to the resource
+    static constexpr uint64_t STAGING_RING_SIZE = 16 * 1024 * 1024;
+
+    HRESULT Map(ID3D11Resource* pResource, UINT Subresource, D3D11_MAP MapType, UINT MapFlags,
+        D3D11_MAPPED_SUBRESOURCE* pMappedResource);
+    void Unmap(ID3D11Resource* pResource, UINT Subresource);
+
+    // D3D12 submission. Lists are queued per type and go out in batches:
+    // execute, signal and wait flush everything that is ready first.
+    HRESULT ExecuteCommandLists(UINT NumCommandLists, ID3D12CommandList* const* ppCommandLists);
+    HRESULT ExecuteCommandList(ID3D12CommandList* pCommandList, ID3D12Fence* pFence,
+        UINT64 FenceValue);
+    HRESULT queueCommandList(ID3D12CommandList* pCommandList, ID3D12Fence* pFence = nullptr,
+        UINT64 FenceValue = 0);
+    HRESULT flushCommandLists();    // E_PENDING while lists wait on dependencies
+    HRESULT playbackCommandList(ID3D12CommandList* pCommandList);   // Queued, not flushed
+    HRESULT Signal(ID3D12Fence* pFence, UINT64 FenceValue);
+    HRESULT WaitForFence(ID3D12Fence* pFence, UINT64 FenceValue);
+
+    // pCommandList's next submission waits for pDependency's
+    HRESULT addCommandListDependency(ID3D12CommandList* pCommandList,
+        ID3D12CommandList* pDependency);
+    // S_OK once everything it waits for is done on the GPU, else E_PENDING
+    HRESULT checkCommandListDependencies(ID3D12CommandList* pCommandList);
+
 private:
+    using SubresourceKey = std::pair<ID3D11Resource*, UINT>;
+
+    // A subresource's staging region, kept between maps: it holds what was
+    // last copied to the resource, so WRITE_NO_OVERWRITE maps it again in
+    // place and only what the application wrote is copied. Or, while
+    // staged is false, the resource itself is mapped.
+    struct StagedMapping {
+        uint64_t offset;    // Into staging_memory_
+        uint64_t size;
+        bool staged;
+        bool mapped;
+        bool discarded;     // Mapped with WRITE_DISCARD: all of it is new
+    };
+
+    // resource_mutex_ held for all of these
+    HRESULT mapDirect(const SubresourceKey& key, D3D11_MAP MapType, UINT MapFlags,
+        D3D11_MAPPED_SUBRESOURCE* pMappedResource);
+    bool stageRegion(const SubresourceKey& key, uint64_t size, uint64_t& offset);
+    void releaseRegion(const SubresourceKey& key);
+    bool uploadStaged(const SubresourceKey& key, const StagedMapping& mapping);
+
+    // command_queue_mutex_ held for all of these
+    HRESULT ensureCommandQueue(D3D12_COMMAND_LIST_TYPE type, UINT node_mask, UINT priority,
+        D3D12_COMMAND_QUEUE_FLAGS flags);
+    HRESULT submitReady();
+    CommandListGraph::CompletedValue completedValue() const;
+
     std::unordered_map<ID3D11Resource*, ResourceInfo> resource_info_;
+
+    // Staging for the immediate context. Regions are copied out at unmap,
+    // so one is free once released; uploads_ is its fence.
+    std::unique_ptr<client::ShadowMemory> staging_memory_;     // Write-watched
+    std::unique_ptr<StagingRing> staging_ring_;
+    std::map<SubresourceKey, StagedMapping> mappings_;
+    std::unordered_map<uint64_t, SubresourceKey> region_owners_;   // By offset
+    uint64_t uploads_{0};
+
     std::unordered_map<D3D12_COMMAND_LIST_TYPE, CommandQueue> command_queues_;
-    UINT64 current_fence_value_;
-    std::unordered_map<ID3D12CommandList*, std::vector<CommandListDependency>> command_dependencies_;
-    std::unordered_map<ID3D12CommandList*, CommandListOptimization> command_optimizations_;
+    CommandListGraph command_list_graph_;
+    std::unordered_map<ID3D12CommandList*, std::deque<FenceSignal>> fence_signals_;  // Per queuing
+    std::vector<ID3D12CommandList*> submit_lists_;     // Reused for each batch
+    std::mutex command_queue_mutex_;
 };
 
 } // namespace gpu
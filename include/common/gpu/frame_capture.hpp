@@ -1,8 +1,16 @@
 #pragma once
 
+#include "common/gpu/capture_backend.hpp"
+#include "common/gpu/color_convert.hpp"
+#include "common/gpu/frame_diff.hpp"
+#include "common/spsc_ring.hpp"
 #include <vulkan/vulkan.hpp>
+#include <cuda.h>
 #include <cuda_runtime.h>
 #include <nvEncodeAPI.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <memory>
 #include <vector>
 #include <queue>
@@ -14,8 +22,47 @@
 namespace anarchy {
 namespace gpu {
 
-class FrameCapture {
+// Captures Vulkan images into NVENC without a host round trip. Each frame is
+// copied on the GPU into a device-local buffer exported to CUDA
+// (VK_KHR_external_memory_fd), converted to YUV by a CUDA kernel and handed
+// to NVENC; an exported timeline semaphore orders the copy before the
+// conversion. Only the bitstream reaches system memory.
+//
+// Frames move through a ring of slots, so while one frame is copied the
+// previous one can be converting, another encoding and the oldest waiting to
+// be collected. Submission and bitstream retrieval run on separate threads.
+// Bitstreams wait for collection in a latest-wins ring: if the reader falls
+// behind, the oldest are dropped and the encoder restarts on an IDR frame.
+// The NVENC backend of CaptureEngine.
+class FrameCapture : public CaptureBackend {
 public:
+    static constexpr uint32_t DEFAULT_SLOT_COUNT = 4;
+    static constexpr uint32_t MIN_SLOT_COUNT = 2;
+    static constexpr uint32_t DEFAULT_SLICE_COUNT = 4;
+
+    enum class Codec {
+        H264,
+        HEVC,
+        AV1,    // 4:2:0 only
+    };
+
+    enum class LatencyProfile {
+        // CBR low delay with an IDR frame every gop_size frames
+        LOW_LATENCY,
+        // Infinite GOP: intra refresh sweeps the picture every gop_size frames,
+        // so no frame is much larger than the rest. H.264 and HEVC frames are
+        // split into slices, each handed out as soon as NVENC writes it.
+        ULTRA_LOW_LATENCY,
+    };
+
+    // What to do with a frame identical to the one before: menus, paused
+    // games and desktop windows repeat for seconds at a time
+    enum class UnchangedFrames {
+        ENCODE,     // No check
+        SKIP,       // No output at all
+        REPEAT,     // An empty frame, meaning show the last one again
+    };
+
     struct CaptureConfig {
         uint32_t width;
         uint32_t height;
@@ -23,42 +70,78 @@ public:
         uint32_t fps;
         uint32_t bitrate;
         uint32_t gop_size;
-        bool h264;
+        Codec codec = Codec::H264;
         bool hardware_encoding;
+        LatencyProfile latency_profile = LatencyProfile::LOW_LATENCY;
+        uint32_t slice_count = DEFAULT_SLICE_COUNT;     // ULTRA_LOW_LATENCY only
+        UnchangedFrames unchanged_frames = UnchangedFrames::ENCODE;
+
+        // YUV the encoder is fed. 10-bit sources stay 10-bit unless the
+        // codec is H.264, which NVENC only encodes at 8 bits. AV1 cannot
+        // take yuv444.
+        ColorMatrix color_matrix = ColorMatrix::BT709;
+        bool full_range = false;
+        bool yuv444 = false;
+
+        // Frames in flight between capture and collection; a capture with
+        // every slot busy is dropped
+        uint32_t slot_count = DEFAULT_SLOT_COUNT;
     };
 
     FrameCapture(const CaptureConfig& config);
-    ~FrameCapture();
-
-    // Initialize capture system
-    bool initialize(VkDevice device, VkPhysicalDevice physical_device);
-    
-    // Capture and encode frame
-    bool captureFrame(VkCommandBuffer command_buffer, VkImage image);
-    
-    // Get encoded frame data
-    bool getEncodedFrame(std::vector<uint8_t>& frame_data);
-    
-    // Flush any pending frames
-    void flush();
-    
-    // Get capture statistics
-    struct Statistics {
-        uint64_t frames_captured;
-        uint64_t frames_encoded;
-        uint64_t total_bytes;
-        double average_fps;
-        double average_latency;
-    };
-    Statistics getStatistics() const;
+    ~FrameCapture() override;
+
+    // The device must have these enabled, plus the timelineSemaphore feature
+    static std::vector<const char*> requiredDeviceExtensions();
+
+    // Initialize capture system. Frames are copied on queue 0 of queue_family.
+    bool initialize(VkDevice device, VkPhysicalDevice physical_device,
+        uint32_t queue_family = 0) override;
+
+    // Queue a copy of image for encoding. The image must be in
+    // PRESENT_SRC_KHR layout and is left in it; the copy is ordered after
+    // earlier work on the capture queue. Returns false if the frame was dropped.
+    bool captureFrame(VkImage image, uint64_t frame_id = 0) override;
+
+    // Get encoded frame data, waiting if a captured frame is still encoding.
+    // Empty with UnchangedFrames::REPEAT for a frame like the last one.
+    // frame_data is swapped with a pooled buffer, so passing the same vector
+    // back in each time avoids allocating. Frames that cannot be decoded
+    // after a drop are skipped up to the next IDR frame.
+    // With slice output each call returns the slices written since the last
+    // one, and end_of_frame tells whether the frame is complete.
+    // Call this and flush() from one thread only.
+    bool getEncodedFrame(std::vector<uint8_t>& frame_data, bool* end_of_frame = nullptr,
+        uint64_t* frame_id = nullptr) override;
+
+    // Finish encoding pending frames and discard any nobody collected
+    void flush() override;
+
+    // From the next frame encoded. Keeps the reference frames, so changing
+    // it every few frames costs nothing.
+    void setBitrate(uint32_t bitrate) override;
+
+    // For frames captured from now on, which must come from images at least
+    // this large; no larger than the configured size. The encoder drains and
+    // restarts on an IDR frame at the new size.
+    bool setResolution(uint32_t width, uint32_t height) override;
+
+    Statistics getStatistics() const override;
 
 private:
     // CUDA resources
     struct CUDAResources {
         CUcontext context;
         CUstream stream;
-        CUdeviceptr device_buffer;
-        size_t buffer_size;
+        CUexternalSemaphore timeline;
+
+        // Change detection runs on its own stream, so waiting for it never
+        // waits for NVENC
+        CUstream diff_stream;
+        CUdeviceptr tile_hashes;
+        CUdeviceptr changed_tiles;
+        uint32_t* changed_host;     // Pinned
+        CUevent diff_done;
     };
 
     // NVENC resources
@@ -67,55 +150,126 @@ private:
         void* encoder;
         NV_ENC_INITIALIZE_PARAMS init_params;
         NV_ENC_CONFIG encode_config;
-        std::vector<NV_ENC_OUTPUT_PTR> output_buffers;
-        std::vector<NV_ENC_REGISTERED_PTR> registered_buffers;
+        NV_ENC_BUFFER_FORMAT buffer_format;
     };
 
     // Vulkan resources
     struct VulkanResources {
         VkDevice device;
         VkPhysicalDevice physical_device;
-        VkBuffer staging_buffer;
-        VkDeviceMemory staging_memory;
+        uint32_t queue_family;
+        VkQueue queue;
         VkCommandPool command_pool;
+        VkQueryPool timestamps;     // Two per slot, around the copy
+        float timestamp_period;     // ns per tick, 0 if the queue has no timestamps
+        VkSemaphore timeline;
+        uint64_t timeline_value;
+        PFN_vkGetMemoryFdKHR get_memory_fd;
+        PFN_vkGetSemaphoreFdKHR get_semaphore_fd;
+    };
+
+    // One frame in flight: the Vulkan copy target and the same memory as seen
+    // by CUDA, the YUV buffer NVENC reads, and the bitstream it encodes into
+    struct CaptureSlot {
+        VkBuffer buffer;
+        VkDeviceMemory memory;
+        VkDeviceSize memory_size;
         VkCommandBuffer command_buffer;
+        uint32_t width;     // Of the frame in the slot, up to the configured size
+        uint32_t height;
+        CUexternalMemory external_memory;
+        CUdeviceptr device_ptr;
+        CUdeviceptr yuv_ptr;
+        size_t yuv_pitch;
+        NV_ENC_REGISTERED_PTR registered;
+        uint32_t registered_width;
+        uint32_t registered_height;
+        NV_ENC_INPUT_PTR mapped;    // Set while NVENC owns the input
+        NV_ENC_OUTPUT_PTR bitstream;
+        std::vector<uint32_t> slice_offsets;    // Filled in by NVENC on lock
+        bool unchanged;     // Passed through without encoding
+        CUevent convert_start;
+        CUevent convert_end;
+        uint32_t first_query;
+        uint64_t ready_value;   // Timeline value signalled once the copy landed
+        uint64_t frame_id;      // For the tracer
+        std::chrono::steady_clock::time_point captured;
+        std::chrono::steady_clock::time_point submitted;
     };
 
     // Configuration
     CaptureConfig config_;
-    
+    SourceFormat source_format_;
+    TargetFormat target_format_;
+    ColorCoefficients color_coefficients_;
+
     // Resources
-    CUDAResources cuda_;
-    NVENCResources nvenc_;
-    VulkanResources vulkan_;
-    
-    // Frame queue
+    CUDAResources cuda_{};
+    NVENCResources nvenc_{};
+    VulkanResources vulkan_{};
+    std::vector<CaptureSlot> slots_;
+
+    // Slot indices by stage
+    std::deque<uint32_t> free_slots_;
+    std::queue<uint32_t> capture_queue_;   // Copy submitted
+    std::queue<uint32_t> encode_queue_;    // Encode submitted, in submission order
+    uint32_t pending_frames_{0};    // Captured and not yet encoded
+    uint32_t capture_width_{0};     // Size of the next capture
+    uint32_t capture_height_{0};
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cv_;
+
+    // Encoded output, from the completion thread to the reader: whole
+    // frames, or runs of slices with slice output. The reader only takes the
+    // mutex to sleep on an empty ring.
     struct FrameData {
         std::vector<uint8_t> data;
         uint64_t timestamp;
+        uint64_t sequence;      // Gaps mean the ring dropped frames
+        uint64_t frame_id;
+        bool keyframe;          // Starts an IDR frame
+        bool end_of_frame;
     };
-    std::queue<FrameData> frame_queue_;
-    std::mutex queue_mutex_;
-    std::condition_variable queue_cv_;
-    
-    // Encoding thread
+    SpscRing<FrameData> frame_ring_;
+    std::atomic<bool> force_idr_{false};
+    std::atomic<uint32_t> pending_bitrate_{0};     // 0 = unchanged
+    bool tile_hashes_valid_{false};     // Encode thread only
+    uint64_t next_sequence_{0};         // Completion thread only
+    uint64_t expected_sequence_{0};     // Reader only
+    bool awaiting_keyframe_{false};     // Reader only
+
+    // Encoding threads
     std::thread encode_thread_;
+    std::thread completion_thread_;
     bool should_stop_;
-    
+
     // Statistics
     Statistics stats_;
+    std::chrono::steady_clock::time_point fps_since_;
+    uint64_t fps_frames_{0};
     mutable std::mutex stats_mutex_;
 
     // Helper functions
     bool initializeCUDA();
     bool initializeNVENC();
     bool initializeVulkan();
+    bool createSlot(CaptureSlot& slot);
     void cleanupResources();
     void encodeThread();
-    bool copyImageToBuffer(VkCommandBuffer command_buffer, VkImage image);
-    bool encodeFrame(const void* frame_data);
+    void completionThread();
+    void releaseSlot(uint32_t index);
+    void finishSlot(uint32_t index);
+    bool recordCopy(CaptureSlot& slot, VkImage image);
+    bool registerInput(CaptureSlot& slot);
+    bool applyEncoderSettings(CaptureSlot& slot);
+    bool frameChanged(CaptureSlot& slot);
+    bool submitEncode(CaptureSlot& slot);
+    bool retrieveBitstream(CaptureSlot& slot, size_t& bytes);
+    void publish(const CaptureSlot& slot, const uint8_t* data, size_t size, bool keyframe,
+        bool end_of_frame);
     void updateStatistics(uint64_t bytes, double latency);
+    void updateStageTimings(CaptureSlot& slot, std::chrono::steady_clock::time_point done);
 };
 
 } // namespace gpu
-} // namespace anarchy 
\ No newline at end of file
+} // namespace anarchy
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cuda.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace anarchy {
+namespace gpu {
+
+// Side of the square tiles a frame is hashed in
+constexpr uint32_t DIFF_TILE_SIZE = 64;
+
+inline uint32_t diffTileCount(uint32_t width, uint32_t height) {
+    return ((width + DIFF_TILE_SIZE - 1) / DIFF_TILE_SIZE) *
+        ((height + DIFF_TILE_SIZE - 1) / DIFF_TILE_SIZE);
+}
+
+struct TileHashParams {
+    CUdeviceptr source;     // 32-bit pixels, any of the SourceFormat layouts
+    size_t source_pitch;
+    uint32_t width;
+    uint32_t height;
+    CUdeviceptr hashes;     // diffTileCount() uint64_t, the previous frame's on entry
+    CUdeviceptr changed;    // uint32_t, incremented once per tile that differs
+};
+
+// Hashes each tile of the frame and replaces the stored hash of any tile
+// that differs, counting them. One block per tile reads every pixel once,
+// which costs a fraction of the colour conversion it may save.
+CUresult hashTiles(const TileHashParams& params, CUstream stream);
+
+} // namespace gpu
+} // namespace anarchy
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "common/gpu/capture_backend.hpp"
+#include "common/gpu/software_codec.hpp"
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+namespace anarchy {
+namespace gpu {
+
+// Copies frames into host-visible staging buffers and encodes them on the
+// CPU with SoftwareEncoder: the raw readback and software encoder backends
+// of CaptureEngine, for hosts where NVENC is not available. The buffers are
+// allocated and mapped once, each with its own command buffer and fence,
+// so a capture only records and submits a copy, and collecting a frame only
+// waits for that copy. Cached memory is preferred, since the CPU reads
+// every byte back.
+class ReadbackCapture : public CaptureBackend {
+public:
+    static constexpr uint32_t DEFAULT_SLOT_COUNT = 3;
+
+    struct Config {
+        uint32_t width;
+        uint32_t height;
+        VkFormat format;
+        bool compress;      // Else raw pixels, one keyframe after another
+        uint32_t keyframe_interval = SoftwareEncoder::DEFAULT_KEYFRAME_INTERVAL;
+        uint32_t slot_count = DEFAULT_SLOT_COUNT;
+    };
+
+    explicit ReadbackCapture(const Config& config);
+    ~ReadbackCapture() override;
+
+    ReadbackCapture(const ReadbackCapture&) = delete;
+    ReadbackCapture& operator=(const ReadbackCapture&) = delete;
+
+    // Zero for formats it cannot read back
+    static uint32_t bytesPerPixel(VkFormat format);
+
+    bool initialize(VkDevice device, VkPhysicalDevice physical_device,
+        uint32_t queue_family) override;
+    bool captureFrame(VkImage image, uint64_t frame_id = 0) override;
+
+    // Frames come out as SoftwareFrameHeader and pixels, whole. Call this
+    // and flush() from one thread only.
+    bool getEncodedFrame(std::vector<uint8_t>& frame_data, bool* end_of_frame = nullptr,
+        uint64_t* frame_id = nullptr) override;
+    void flush() override;
+    void setBitrate(uint32_t) override {}
+    bool setResolution(uint32_t width, uint32_t height) override;
+    Statistics getStatistics() const override;
+
+private:
+    struct Slot {
+        VkBuffer buffer;
+        VkDeviceMemory memory;
+        void* mapped;       // For the slot's lifetime
+        bool coherent;      // Else invalidated before each read
+        VkCommandBuffer command_buffer;
+        VkFence fence;
+        uint32_t width;
+        uint32_t height;
+        uint64_t frame_id;
+        std::chrono::steady_clock::time_point captured;
+    };
+
+    bool createSlot(Slot& slot);
+    bool recordCopy(Slot& slot, VkImage image);
+    bool waitForCopy(Slot& slot);
+    void releaseSlot(uint32_t index);
+    void cleanupResources();
+
+    const Config config_;
+    uint32_t bytes_per_pixel_{0};
+    SoftwareEncoder encoder_;   // Reader only
+
+    VkDevice device_{VK_NULL_HANDLE};
+    VkPhysicalDevice physical_device_{VK_NULL_HANDLE};
+    uint32_t queue_family_{0};
+    VkQueue queue_{VK_NULL_HANDLE};
+    VkCommandPool command_pool_{VK_NULL_HANDLE};
+    std::vector<Slot> slots_;
+
+    // Slot indices by stage
+    std::deque<uint32_t> free_slots_;
+    std::queue<uint32_t> pending_;      // Copy submitted, in submission order
+    uint32_t capture_width_{0};
+    uint32_t capture_height_{0};
+    std::mutex mutex_;
+
+    Statistics stats_{};
+    std::chrono::steady_clock::time_point fps_since_;
+    uint64_t fps_frames_{0};
+    mutable std::mutex stats_mutex_;
+};
+
+} // namespace gpu
+} // namespace anarchy
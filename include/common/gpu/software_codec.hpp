@@ -0,0 +1,79 @@
+#pragma once
+
+#include "common/network/protocol.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace anarchy {
+namespace gpu {
+
+// Lossless frames for hosts without a hardware encoder. A delta frame is the
+// XOR of its pixels with the previous frame's, so whatever did not change is
+// zeros, which LZ4 collapses: a mostly static desktop costs little, full
+// motion far more than a video codec would. Uncompressed it is plain raw
+// readback, one keyframe after another.
+constexpr uint32_t SOFTWARE_FRAME_MAGIC = 0x46575341;   // "ASWF"
+
+struct SoftwareFrameHeader {
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;            // VkFormat of the pixels, tightly packed
+    uint32_t raw_size;          // Bytes of pixels once decoded
+    uint8_t keyframe;           // Else XORed with the frame before
+    uint8_t compression;        // network::CompressionType, NONE or LZ4
+    uint16_t reserved;
+};
+
+static_assert(sizeof(SoftwareFrameHeader) == 24, "SoftwareFrameHeader wire size changed");
+
+class SoftwareEncoder {
+public:
+    static constexpr uint32_t DEFAULT_KEYFRAME_INTERVAL = 120;
+
+    // Without compression every frame is a raw keyframe
+    SoftwareEncoder(bool compress, uint32_t keyframe_interval = DEFAULT_KEYFRAME_INTERVAL);
+
+    // Replaces the contents of frame with the encoded pixels; its capacity
+    // is reused
+    void encode(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t format,
+        uint32_t bytes_per_pixel, std::vector<uint8_t>& frame);
+
+    // The next frame stands on its own, e.g. after frames were dropped
+    void forceKeyframe();
+
+private:
+    const bool compress_;
+    const uint32_t keyframe_interval_;
+    uint32_t since_keyframe_{0};
+    bool force_keyframe_{true};
+    std::vector<uint8_t> previous_;
+    std::vector<uint8_t> residual_;
+    uint32_t width_{0};
+    uint32_t height_{0};
+    uint32_t format_{0};
+};
+
+class SoftwareDecoder {
+public:
+    // False for a malformed frame, or a delta frame without the one before
+    // it; then every delta up to the next keyframe fails too
+    bool decode(const uint8_t* data, size_t size);
+
+    const std::vector<uint8_t>& pixels() const { return pixels_; }
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+    uint32_t format() const { return format_; }
+
+private:
+    std::vector<uint8_t> pixels_;
+    std::vector<uint8_t> residual_;
+    uint32_t width_{0};
+    uint32_t height_{0};
+    uint32_t format_{0};
+    bool valid_{false};
+};
+
+} // namespace gpu
+} // namespace anarchy
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+namespace anarchy {
+namespace gpu {
+
+// Offsets into a linear ring of staging memory, for maps that would
+// otherwise each allocate. Regions are handed out one after another and
+// wrap at the end; a region returned with release() is reclaimed once the
+// fence value it was released with has completed, and only in the order
+// regions were handed out, so reclaiming is popping from the front.
+//
+// Only the bookkeeping: the caller owns the memory and decides what the
+// fence values are. Not thread-safe.
+class StagingRing {
+public:
+    // Regions start on an alignment boundary; a power of two
+    StagingRing(uint64_t capacity, uint64_t alignment);
+
+    // False when there is no contiguous room until more is reclaimed
+    bool allocate(uint64_t size, uint64_t& offset);
+
+    // The region at offset is done with once fence_value has completed
+    void release(uint64_t offset, uint64_t fence_value);
+
+    // Frees released regions up to the first still in use or in flight
+    void reclaim(uint64_t completed_value);
+
+    // The region holding up reclamation, if any
+    bool oldest(uint64_t& offset) const;
+
+    uint64_t capacity() const { return capacity_; }
+    uint64_t used() const;
+    size_t regionCount() const { return regions_.size(); }
+
+private:
+    struct Region {
+        uint64_t offset;
+        uint64_t size;          // Including any gap skipped at the end to wrap
+        bool released{false};
+        uint64_t fence_value{0};
+    };
+
+    const uint64_t capacity_;
+    const uint64_t alignment_;
+    std::deque<Region> regions_;    // In the order handed out
+    uint64_t head_{0};              // Where the next region goes
+};
+
+} // namespace gpu
+} // namespace anarchy
@@ -37,6 +37,8 @@ public:
         ~Device();
 
         vk::Device get() const { return device_.get(); }
+        vk::Queue getGraphicsQueue() const { return graphics_queue_; }
+        uint32_t getGraphicsQueueFamily() const { return graphics_queue_family_; }
         vk::PhysicalDevice physical_device_;
 
         // Command buffer management
@@ -44,14 +46,11 @@ public:
         void endCommandBuffer(vk::CommandBuffer cmd_buffer);
         void submitCommandBuffer(vk::CommandBuffer cmd_buffer);
 
-        // Frame capture
-        std::vector<uint8_t> captureFramebuffer(vk::Image image, vk::Format format, 
-            uint32_t width, uint32_t height);
-
     private:
         std::vector<const char*> enabled_extensions_;
         vk::UniqueDevice device_;
         vk::Queue graphics_queue_;
+        uint32_t graphics_queue_family_;
         vk::UniqueCommandPool command_pool_;
     };
 
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace anarchy {
+namespace network {
+
+// Recycles payload buffers so multi-megabyte frames don't hit the allocator
+// on every message. Thread-safe: buffers come back from the ZeroMQ I/O thread
+// once a zero-copy send completes, and from whichever thread drops a
+// received message.
+class BufferPool {
+public:
+    static constexpr size_t DEFAULT_MAX_BUFFERS = 8;
+    static constexpr size_t MIN_SIZE_CLASS = 4096;
+
+    explicit BufferPool(size_t max_buffers = DEFAULT_MAX_BUFFERS);
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Returns a buffer of exactly size bytes, reusing the smallest pooled
+    // buffer that fits. Contents are unspecified.
+    std::vector<uint8_t> acquire(size_t size);
+
+    // Hands a buffer back; dropped if the pool is already full
+    void release(std::vector<uint8_t>&& buffer);
+
+    // Capacity reserved for a new buffer of the given size
+    static size_t sizeClass(size_t size);
+
+    size_t available() const;
+    uint64_t allocations() const { return allocations_; }  // acquire() calls that allocated
+
+private:
+    size_t max_buffers_;
+    std::vector<std::vector<uint8_t>> buffers_;
+    mutable std::mutex mutex_;
+    std::atomic<uint64_t> allocations_{0};
+};
+
+} // namespace network
+} // namespace anarchy
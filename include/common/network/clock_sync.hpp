@@ -0,0 +1,54 @@
+#pragma once
+
+#include "common/network/protocol.hpp"
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+namespace anarchy {
+namespace network {
+
+// Offset between this host's steady clock and each peer's, from the
+// heartbeats both sides send anyway. Every heartbeat echoes the last one
+// heard from the receiver and when it arrived (HeartbeatTiming), which
+// gives the four timestamps of an NTP exchange: the offset is what is left
+// once the round trip is split evenly between the two directions. Queueing
+// only ever adds to a round trip, so the estimate is the sample with the
+// shortest one among the last few. Thread-safe.
+class ClockSync {
+public:
+    static constexpr size_t WINDOW = 8;     // Samples kept per peer
+
+    struct Estimate {
+        int64_t offset;         // us: peer clock minus ours
+        int64_t round_trip;     // us, not counting the time the peer held the echo
+    };
+
+    // Steady clock microseconds, as heartbeats carry them
+    static uint64_t now();
+
+    // Fills in a heartbeat's timestamp and the echo for peer
+    void stamp(Message& heartbeat, uint64_t peer);
+
+    // A heartbeat from peer, received at received
+    void onHeartbeat(const MessageHeader& header, const uint8_t* payload, size_t size,
+        uint64_t peer, uint64_t received);
+
+    // False until a full exchange with peer has been seen
+    bool estimate(uint64_t peer, Estimate& estimate) const;
+
+    void forget(uint64_t peer);
+
+private:
+    struct Peer {
+        HeartbeatTiming echo{};     // What the next heartbeat to it carries
+        std::deque<Estimate> samples;
+    };
+
+    std::unordered_map<uint64_t, Peer> peers_;
+    mutable std::mutex mutex_;
+};
+
+} // namespace network
+} // namespace anarchy
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "common/network/protocol.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace anarchy {
+namespace network {
+
+// Packs deferred commands into per-thread buffers and sends them as
+// VK_COMMAND_BATCH messages, so calls whose result can be predicted locally
+// don't pay a network round trip each. Whenever any buffer goes out, every
+// thread's pending commands go with it, merged in sequence order: the
+// server runs batches as they arrive, and a command must not overtake one
+// another thread enqueued before it. A thread's buffer is flushed and freed
+// when the thread exits. Failures are replayed back through
+// VK_COMMAND_RESULT messages and surface at the next sync point.
+class CommandStream {
+public:
+    using FlushCallback = std::function<bool(Message&)>;
+
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 256 * 1024;     // 256KB per thread
+    static constexpr size_t DEFAULT_FLUSH_THRESHOLD = 64 * 1024;  // Send once 64KB is pending
+
+    struct Statistics {
+        uint64_t commands_enqueued{0};
+        uint64_t batches_sent{0};
+        uint64_t bytes_sent{0};
+        uint64_t deferred_failures{0};
+        uint64_t thread_buffers{0};     // Threads with a buffer right now
+    };
+
+    explicit CommandStream(FlushCallback flush_callback,
+        size_t buffer_size = DEFAULT_BUFFER_SIZE,
+        size_t flush_threshold = DEFAULT_FLUSH_THRESHOLD);
+    ~CommandStream();
+
+    CommandStream(const CommandStream&) = delete;
+    CommandStream& operator=(const CommandStream&) = delete;
+
+    // Append a command to the calling thread's buffer. Sequences are
+    // expected to grow in the order commands are enqueued.
+    bool enqueue(MessageType type, uint64_t sequence, const void* payload, size_t size);
+
+    // Send the pending commands of every thread (sync points)
+    bool flush();
+
+    // Completion/error replay
+    void handleResult(const Message& message);
+    int32_t takeDeferredError();  // VK_SUCCESS (0) if no deferred command failed
+    uint64_t getCompletedSequence() const { return completed_sequence_; }
+    uint64_t getSubmittedSequence() const { return submitted_sequence_; }
+
+    Statistics getStatistics() const;
+
+private:
+    struct ThreadBuffer {
+        std::mutex mutex;
+        std::vector<uint8_t> data;
+        size_t used{0};
+        uint32_t count{0};
+        uint64_t last_sequence{0};
+    };
+
+    // One per thread, unregisters it from every stream it used on exit
+    struct ThreadExit;
+
+    struct PendingRecord {
+        uint64_t sequence;
+        const uint8_t* data;
+        size_t size;
+    };
+
+    ThreadBuffer& localBuffer();
+
+    // Sends the pending commands of every thread, and extra if given, as one
+    // batch in sequence order. Takes registry_mutex_ and then every buffer's
+    // mutex, so no buffer mutex may be held by the caller.
+    bool flushAll(const uint8_t* extra = nullptr, size_t extra_size = 0);
+    bool sendBatch(const uint8_t* data, size_t size, uint64_t last_sequence);
+    void releaseThread(std::thread::id thread);
+
+    const uint64_t stream_id_;
+    FlushCallback flush_callback_;
+    size_t buffer_size_;
+    size_t flush_threshold_;
+
+    mutable std::mutex registry_mutex_;
+    std::unordered_map<std::thread::id, std::unique_ptr<ThreadBuffer>> buffers_;
+    std::vector<PendingRecord> pending_;    // Reused by flushAll(), registry_mutex_ held
+    std::vector<uint8_t> merged_;
+
+    // Keeps batches whole and in order on the transport
+    std::mutex send_mutex_;
+
+    std::atomic<uint64_t> submitted_sequence_{0};
+    std::atomic<uint64_t> completed_sequence_{0};
+    std::atomic<int32_t> deferred_error_{0};
+
+    std::atomic<uint64_t> commands_enqueued_{0};
+    std::atomic<uint64_t> batches_sent_{0};
+    std::atomic<uint64_t> bytes_sent_{0};
+    std::atomic<uint64_t> deferred_failures_{0};
+};
+
+// Walk the commands packed into a VK_COMMAND_BATCH payload.
+// Returns false if the batch is malformed or the visitor stops early.
+using CommandRecordVisitor = std::function<bool(const CommandRecordHeader&, const uint8_t*)>;
+bool forEachCommandRecord(const Message& batch, const CommandRecordVisitor& visitor);
+bool forEachCommandRecord(const uint8_t* data, size_t size, const CommandRecordVisitor& visitor);
+
+// Size of a record including its header and alignment padding
+constexpr size_t commandRecordSize(size_t payload_size) {
+    return (sizeof(CommandRecordHeader) + payload_size + COMMAND_RECORD_ALIGNMENT - 1) &
+        ~(COMMAND_RECORD_ALIGNMENT - 1);
+}
+
+} // namespace network
+} // namespace anarchy
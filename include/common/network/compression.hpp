@@ -0,0 +1,29 @@
+#pragma once
+
+#include "common/network/protocol.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace anarchy {
+namespace network {
+
+enum class CompressionLevel {
+    FAST,
+    BALANCED,
+    MAX
+};
+
+// Payload codecs at the settings each level maps to. The zlib and LZ4 state
+// is per thread, set up on first use and reset between messages, so the
+// steady-state path neither allocates nor re-initializes. Thread-safe.
+size_t compressBound(CompressionType type, size_t size);
+
+// Both return the bytes written, 0 on failure. stream_initialized, when
+// given, is set if the thread's zlib stream had to be set up for the call.
+size_t compressData(CompressionType type, CompressionLevel level, const uint8_t* input,
+    size_t input_size, uint8_t* output, size_t output_size, bool* stream_initialized = nullptr);
+size_t decompressData(CompressionType type, const uint8_t* input, size_t input_size,
+    uint8_t* output, size_t output_size, bool* stream_initialized = nullptr);
+
+} // namespace network
+} // namespace anarchy
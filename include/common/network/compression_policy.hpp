@@ -0,0 +1,91 @@
+#pragma once
+
+#include "common/network/protocol.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace anarchy {
+namespace network {
+
+// How payloads of one message type are compressed
+struct CompressionRule {
+    CompressionType codec{CompressionType::NONE};  // NONE = never compressed
+    uint32_t min_size{0};                          // Smaller payloads go out as is
+};
+
+// Exponentially weighted moving average with O(1) updates. Lock-free:
+// concurrent updates may lose a sample, which an estimate can live with.
+class EwmaEstimate {
+public:
+    static constexpr double WEIGHT = 0.125;  // Same smoothing as TCP's SRTT
+
+    void add(double sample);
+    double value() const { return value_.load(std::memory_order_relaxed); }
+    bool valid() const { return valid_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<double> value_{0.0};
+    std::atomic<bool> valid_{false};
+};
+
+// Decides per message whether and how to compress. Each message type has a
+// rule: control traffic and encoded frames are never compressed, tiny Vulkan
+// commands aren't either, memory uploads use LZ4. In adaptive mode a message
+// its rule allows is only compressed when that should get it across sooner,
+// i.e. when codec_throughput * (1 - ratio) > bandwidth, with all three kept
+// as moving averages. Thread-safe.
+class CompressionPolicy {
+public:
+    static constexpr uint32_t MIN_COMMAND_SIZE = 4096;    // Vulkan commands below this stay raw
+    static constexpr uint32_t MIN_UPLOAD_SIZE = 1024;
+    static constexpr uint32_t PROBE_INTERVAL = 64;        // Skipped messages between ratio probes
+    static constexpr size_t MIN_BANDWIDTH_SAMPLE = 64 * 1024;  // Smaller transfers time too coarsely
+
+    CompressionPolicy();
+
+    CompressionPolicy(const CompressionPolicy&) = delete;
+    CompressionPolicy& operator=(const CompressionPolicy&) = delete;
+
+    void setRule(MessageType type, CompressionRule rule);
+    CompressionRule rule(MessageType type) const;
+
+    // Replaces the codec of every rule that compresses; NONE restores the
+    // per-type codecs
+    void setCodecOverride(CompressionType codec);
+    void setAdaptive(bool enable);
+
+    // Codec for this payload, NONE to send it as is
+    CompressionType select(MessageType type, size_t size);
+
+    // Bytes handed to the transport and how long that took
+    void recordTransfer(size_t bytes, std::chrono::microseconds elapsed);
+
+    // after == before records an attempt that didn't pay off
+    void recordCompression(MessageType type, CompressionType codec, size_t before, size_t after,
+        std::chrono::microseconds elapsed);
+
+    double bandwidth() const { return bandwidth_.value(); }  // Bytes per second
+    double codecThroughput(CompressionType codec) const;     // Input bytes per second
+    double compressionRatio(MessageType type) const;         // Compressed / original
+
+private:
+    static constexpr size_t TYPE_COUNT = 256;
+    static constexpr size_t CODEC_COUNT = 3;
+
+    static uint64_t pack(CompressionRule rule);
+    static CompressionRule unpack(uint64_t packed);
+
+    std::array<std::atomic<uint64_t>, TYPE_COUNT> rules_;
+    std::array<EwmaEstimate, TYPE_COUNT> ratios_;
+    std::array<std::atomic<uint32_t>, TYPE_COUNT> skipped_;
+    std::array<EwmaEstimate, CODEC_COUNT> codec_throughput_;
+    EwmaEstimate bandwidth_;
+    std::atomic<CompressionType> codec_override_{CompressionType::NONE};
+    std::atomic<bool> adaptive_{false};
+};
+
+} // namespace network
+} // namespace anarchy
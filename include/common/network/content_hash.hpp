@@ -0,0 +1,32 @@
+#pragma once
+
+#include "common/network/vulkan_commands.hpp"
+#include <openssl/sha.h>
+#include <cstddef>
+#include <string>
+
+namespace anarchy {
+namespace network {
+
+inline ContentHash hashContent(const void* data, size_t size) {
+    ContentHash hash;
+    SHA256(static_cast<const unsigned char*>(data), size, hash.data());
+    return hash;
+}
+
+inline std::string toHex(const uint8_t* data, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(size * 2, '0');
+    for (size_t i = 0; i < size; i++) {
+        hex[i * 2] = digits[data[i] >> 4];
+        hex[i * 2 + 1] = digits[data[i] & 0xF];
+    }
+    return hex;
+}
+
+inline std::string toHex(const ContentHash& hash) {
+    return toHex(hash.data(), hash.size());
+}
+
+} // namespace network
+} // namespace anarchy
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "common/network/protocol.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace anarchy {
+namespace network {
+
+inline bool isPartialFrame(const MessageHeader& header) {
+    return (header.flags & HEADER_FLAG_PARTIAL_FRAME) != 0;
+}
+
+// Receive side frame dropping shared by the transports. A frame is the run
+// of FRAME_DATA slices sharing a sequence, up to one without
+// HEADER_FLAG_PARTIAL_FRAME, and is kept or dropped whole: of the frames a
+// poll pass picks up only the newest is delivered, and only if it is newer
+// than the last frame delivered, but the rest of a frame already started
+// always follows. Not thread-safe, the transport's worker owns it.
+class FrameFilter {
+public:
+    // Moves the slices to deliver out of one pass worth of them, in arrival
+    // order, and returns how many frames were dropped. Whatever is left in
+    // slices is the caller's to release.
+    template <typename Slice>
+    size_t select(std::vector<Slice>& slices, std::vector<Slice>& deliver) {
+        size_t i = 0;
+        while (i < slices.size() && open_ && slices[i].header.sequence == last_sequence_) {
+            open_ = isPartialFrame(slices[i].header);
+            deliver.push_back(std::move(slices[i++]));
+        }
+        if (i == slices.size()) {
+            return 0;
+        }
+
+        // Slices of one frame arrive back to back, so every sequence change
+        // ends a frame older than the newest
+        size_t dropped = 0;
+        size_t newest = i;
+        for (size_t j = i + 1; j < slices.size(); ++j) {
+            if (slices[j].header.sequence != slices[newest].header.sequence) {
+                dropped += countDrop(slices[newest].header.sequence);
+                newest = j;
+            }
+        }
+
+        uint64_t sequence = slices[newest].header.sequence;
+        int64_t age = static_cast<int64_t>(sequence - last_sequence_);
+        if (delivered_ && age <= 0) {
+            return dropped + countDrop(sequence);
+        }
+
+        last_sequence_ = sequence;
+        delivered_ = true;
+        for (size_t j = newest; j < slices.size(); ++j) {
+            open_ = isPartialFrame(slices[j].header);
+            deliver.push_back(std::move(slices[j]));
+        }
+        return dropped;
+    }
+
+private:
+    // The rest of a frame dropped in an earlier pass isn't counted again
+    size_t countDrop(uint64_t sequence) {
+        if (skipping_ && skipped_sequence_ == sequence) {
+            return 0;
+        }
+        skipping_ = true;
+        skipped_sequence_ = sequence;
+        return 1;
+    }
+
+    uint64_t last_sequence_{0};     // Newest frame delivered
+    bool delivered_{false};
+    bool open_{false};              // More slices of that frame to come
+    uint64_t skipped_sequence_{0};
+    bool skipping_{false};
+};
+
+} // namespace network
+} // namespace anarchy
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <type_traits>
 #include <vector>
 #include <string>
 #include <variant>
@@ -26,32 +29,128 @@ enum class MessageType : uint8_t {
     VK_QUEUE_SUBMIT = 0x17,
     VK_ACQUIRE_NEXT_IMAGE = 0x18,
     VK_PRESENT = 0x19,
+    VK_DESTROY_INSTANCE = 0x1A,
+    VK_ENUMERATE_PHYSICAL_DEVICES = 0x1B,
+    VK_DESTROY_DEVICE = 0x1C,
+    VK_DESTROY_SWAPCHAIN = 0x1D,
+    VK_DESTROY_COMMAND_POOL = 0x1E,
+    VK_ALLOCATE_COMMAND_BUFFERS = 0x1F,
 
     // Frame operations
-    FRAME_DATA = 0x20,
-    FRAME_ACK = 0x21,
+    FRAME_DATA = 0x20,         // Empty payload: show the previous frame again
+    FRAME_ACK = 0x21,          // Empty; the sequence is that of the FRAME_DATA decoded
     FRAME_REQUEST = 0x22,
 
+    // Vulkan resource operations
+    VK_FREE_COMMAND_BUFFERS = 0x30,
+    VK_RESET_COMMAND_BUFFER = 0x31,
+    VK_QUEUE_WAIT_IDLE = 0x32,
+    VK_ALLOCATE_MEMORY = 0x33,
+    VK_FREE_MEMORY = 0x34,
+    VK_MAP_MEMORY = 0x35,
+    VK_UNMAP_MEMORY = 0x36,
+    VK_CREATE_BUFFER = 0x37,
+    VK_DESTROY_BUFFER = 0x38,
+    VK_BIND_BUFFER_MEMORY = 0x39,
+    VK_CREATE_IMAGE = 0x3A,
+    VK_DESTROY_IMAGE = 0x3B,
+    VK_BIND_IMAGE_MEMORY = 0x3C,
+    VK_CREATE_SEMAPHORE = 0x3D,
+    VK_DESTROY_SEMAPHORE = 0x3E,
+    VK_CREATE_FENCE = 0x3F,
+    VK_DESTROY_FENCE = 0x40,
+    VK_WAIT_FOR_FENCES = 0x41,
+    VK_RESET_FENCES = 0x42,
+    VK_GET_DEVICE_QUEUE = 0x43,
+    VK_WRITE_MEMORY = 0x44,    // Dirty ranges of a client-mapped allocation
+    VK_RECORDING = 0x45,       // A command buffer's commands, cached by the server
+    VK_REPLAY_RECORDING = 0x46, // A cached recording again, with the bytes that changed
+    VK_CREATE_SHADER_MODULE = 0x47,
+    VK_DESTROY_SHADER_MODULE = 0x48,
+    VK_GET_SHADER_INVENTORY = 0x49, // Which shaders the server has stored for the application
+    VK_READ_MEMORY = 0x4A,     // Contents of a mapped allocation, for readback
+
+    // Deferred command stream
+    VK_COMMAND_BATCH = 0x50,   // Several deferred commands packed into one payload
+    VK_COMMAND_RESULT = 0x51,  // Batch completion and deferred failures
+
     // Error handling
     ERROR = 0xF0,
     RESET = 0xF1
 };
 
-enum class CompressionType {
+enum class CompressionType : uint8_t {
     NONE,
     ZLIB,
     LZ4
 };
 
-// Message header structure
+// MessageHeader::flags bits
+constexpr uint8_t HEADER_COMPRESSION_MASK = 0x03;   // CompressionType of the payload
+constexpr uint8_t HEADER_FLAG_FRAGMENT = 0x04;      // One part of a message split by the sender
+constexpr uint8_t HEADER_FLAG_LAST_FRAGMENT = 0x08;  // Final part of a fragmented message
+constexpr uint8_t HEADER_PRIORITY_MASK = 0x30;      // 0 = normal, higher is more urgent
+constexpr uint8_t HEADER_PRIORITY_SHIFT = 4;
+constexpr uint8_t HEADER_FLAG_PARTIAL_FRAME = 0x40;  // FRAME_DATA: more slices of this frame follow
+
+// What a FRAME_DATA payload holds, in MessageHeader::format
+enum class FrameEncoding : uint16_t {
+    NONE,
+    H264,       // Annex B
+    HEVC,       // Annex B
+    AV1,        // Low overhead bitstream format
+    SOFTWARE,   // gpu::SoftwareEncoder frames, raw readback included
+};
+
+// Message header, sent as is. Every field sits at its natural alignment so
+// there is no compiler padding on the wire; the static_asserts below pin the
+// layout.
 struct MessageHeader {
-    MessageType type;
-    uint32_t size;  // Size of the payload
-    uint32_t sequence;  // For tracking message order
-    uint64_t timestamp;  // For latency measurement
-    CompressionType compression{CompressionType::NONE};  // Compression type used for payload
+    MessageType type{};
+    uint8_t flags{0};
+    uint16_t format{0};      // FRAME_DATA: FrameEncoding of the payload, otherwise 0
+    uint32_t size{0};        // Size of the payload
+    uint64_t sequence{0};    // For tracking message order
+    uint64_t request_id{0};  // Echoed by the reply to a request, 0 = not a request
+    uint64_t timestamp{0};   // For latency measurement
+
+    CompressionType compression() const {
+        return static_cast<CompressionType>(flags & HEADER_COMPRESSION_MASK);
+    }
+
+    void setCompression(CompressionType type) {
+        flags = static_cast<uint8_t>((flags & ~HEADER_COMPRESSION_MASK) |
+            (static_cast<uint8_t>(type) & HEADER_COMPRESSION_MASK));
+    }
+
+    uint8_t priority() const {
+        return static_cast<uint8_t>((flags & HEADER_PRIORITY_MASK) >> HEADER_PRIORITY_SHIFT);
+    }
+
+    void setPriority(uint8_t priority) {
+        flags = static_cast<uint8_t>((flags & ~HEADER_PRIORITY_MASK) |
+            ((priority << HEADER_PRIORITY_SHIFT) & HEADER_PRIORITY_MASK));
+    }
+
+    FrameEncoding frameEncoding() const {
+        return static_cast<FrameEncoding>(format);
+    }
+
+    void setFrameEncoding(FrameEncoding encoding) {
+        format = static_cast<uint16_t>(encoding);
+    }
 };
 
+static_assert(sizeof(MessageHeader) == 32, "MessageHeader wire size changed");
+static_assert(offsetof(MessageHeader, flags) == 1, "MessageHeader layout changed");
+static_assert(offsetof(MessageHeader, format) == 2, "MessageHeader layout changed");
+static_assert(offsetof(MessageHeader, size) == 4, "MessageHeader layout changed");
+static_assert(offsetof(MessageHeader, sequence) == 8, "MessageHeader layout changed");
+static_assert(offsetof(MessageHeader, request_id) == 16, "MessageHeader layout changed");
+static_assert(offsetof(MessageHeader, timestamp) == 24, "MessageHeader layout changed");
+static_assert(std::is_trivially_copyable<MessageHeader>::value,
+    "MessageHeader is copied to and from the wire");
+
 // Protocol version information
 struct ProtocolVersion {
     uint8_t major;
@@ -59,15 +158,67 @@ struct ProtocolVersion {
     uint8_t patch;
 };
 
-// Connection parameters
+// Peers with a different major version can't talk to each other. 2.0 is the
+// first fixed-layout header.
+constexpr ProtocolVersion PROTOCOL_VERSION = {2, 0, 0};
+
+// Connection parameters, the CONNECT payload in both directions: the client
+// sends what it supports, the server replies with what was agreed on
 struct ConnectionParams {
     ProtocolVersion version;
+    uint8_t reserved0;
     uint32_t max_message_size;
     uint32_t max_frame_size;
     bool compression_enabled;
     bool encryption_enabled;
+    uint16_t reserved1;
 };
 
+static_assert(sizeof(ConnectionParams) == 16, "ConnectionParams wire size changed");
+
+// Settles on what both sides support: the older of the two versions, so a
+// 2.1 server answering a 2.0 client speaks 2.0. Fails when the major
+// versions differ.
+inline bool negotiateConnection(const ConnectionParams& local, const ConnectionParams& remote,
+    ConnectionParams& agreed)
+{
+    if (local.version.major != remote.version.major) {
+        return false;
+    }
+
+    agreed = {};
+    bool remote_older = remote.version.minor != local.version.minor ?
+        remote.version.minor < local.version.minor : remote.version.patch < local.version.patch;
+    agreed.version = remote_older ? remote.version : local.version;
+    agreed.max_message_size = std::min(local.max_message_size, remote.max_message_size);
+    agreed.max_frame_size = std::min(local.max_frame_size, remote.max_frame_size);
+    agreed.compression_enabled = local.compression_enabled && remote.compression_enabled;
+    agreed.encryption_enabled = local.encryption_enabled && remote.encryption_enabled;
+    return true;
+}
+
+// FRAME_REQUEST payload, optional. The swapchain's last presented image and
+// every one presented after it come back as FRAME_DATA; a frame split into
+// slices arrives as several.
+struct FrameRequest {
+    uint64_t swapchain;     // Virtual handle, 0 = whichever presented last
+};
+
+static_assert(sizeof(FrameRequest) == 8, "FrameRequest wire size changed");
+
+// FRAME_DATA carries the trace frame id of the present it shows in
+// MessageHeader::request_id (see QueuePresentParams::frame_id), 0 if none
+
+// HEARTBEAT payload, optional: the last heartbeat heard from the receiver,
+// for the round trip and clock offset (see ClockSync). Timestamps are steady
+// clock microseconds, like MessageHeader::timestamp on a heartbeat.
+struct HeartbeatTiming {
+    uint64_t echo_timestamp;    // That heartbeat's timestamp, 0 = none heard yet
+    uint64_t echo_received;     // When it arrived, on the sender's clock
+};
+
+static_assert(sizeof(HeartbeatTiming) == 16, "HeartbeatTiming wire size changed");
+
 // Error information
 struct ErrorInfo {
     uint32_t code;
@@ -78,6 +229,57 @@ struct ErrorInfo {
 struct Message {
     MessageHeader header;
     std::vector<uint8_t> payload;
+    uint64_t peer{0};  // Transport peer it came from / goes to, 0 = most recent peer
+};
+
+// Logical transport channels, each on its own socket so that bulk frame data
+// never queues up in front of commands or heartbeats
+enum class Channel : uint8_t {
+    CONTROL = 0,  // Connection management, heartbeats, acks: low latency
+    COMMAND = 1,  // Vulkan commands and replies: ordered and reliable
+    FRAME = 2     // Encoded frames: stale frames may be dropped
+};
+
+constexpr size_t CHANNEL_COUNT = 3;
+
+inline Channel channelForMessage(MessageType type) {
+    switch (type) {
+        case MessageType::CONNECT:
+        case MessageType::DISCONNECT:
+        case MessageType::HEARTBEAT:
+        case MessageType::FRAME_ACK:
+        case MessageType::FRAME_REQUEST:
+        case MessageType::ERROR:
+        case MessageType::RESET:
+            return Channel::CONTROL;
+        case MessageType::FRAME_DATA:
+            return Channel::FRAME;
+        default:
+            return Channel::COMMAND;
+    }
+}
+
+// Header preceding each command packed into a VK_COMMAND_BATCH payload.
+// Records are padded to COMMAND_RECORD_ALIGNMENT bytes.
+struct CommandRecordHeader {
+    MessageType type;
+    uint8_t reserved[3];
+    uint32_t size;  // Size of the record payload that follows
+    uint64_t sequence;
+};
+
+// VK_COMMAND_RESULT payload: followed by failure_count CommandFailure entries
+struct CommandBatchResult {
+    uint64_t last_sequence;  // Highest sequence executed by the server
+    uint32_t failure_count;
+    uint32_t reserved;
+};
+
+// A deferred command that did not return VK_SUCCESS on the server
+struct CommandFailure {
+    uint64_t sequence;
+    int32_t result;  // VkResult
+    uint32_t reserved;
 };
 
 // Protocol constants
@@ -85,6 +287,18 @@ constexpr uint32_t MAX_MESSAGE_SIZE = 1024 * 1024;  // 1MB
 constexpr uint32_t MAX_FRAME_SIZE = 16 * 1024 * 1024;  // 16MB
 constexpr uint32_t HEARTBEAT_INTERVAL_MS = 1000;  // 1 second
 constexpr uint32_t CONNECTION_TIMEOUT_MS = 5000;  // 5 seconds
+constexpr size_t COMMAND_RECORD_ALIGNMENT = 8;
+
+// What this build supports, offered at CONNECT
+inline ConnectionParams localConnectionParams() {
+    ConnectionParams params = {};
+    params.version = PROTOCOL_VERSION;
+    params.max_message_size = MAX_MESSAGE_SIZE;
+    params.max_frame_size = MAX_FRAME_SIZE;
+    params.compression_enabled = true;
+    params.encryption_enabled = false;
+    return params;
+}
 
 class Protocol {
 public:
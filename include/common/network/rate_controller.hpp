@@ -0,0 +1,144 @@
+#pragma once
+
+#include "common/network/compression_policy.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace anarchy {
+namespace network {
+
+struct RateControlConfig {
+    uint32_t width;     // Full resolution; never scaled up past it
+    uint32_t height;
+    uint32_t fps;
+    uint32_t start_bitrate;     // Bits per second
+    uint32_t min_bitrate = 1000000;
+    uint32_t max_bitrate = 100000000;
+
+    // Below this many bits per pixel the picture falls apart faster than a
+    // lower resolution looks soft, so resolution gives way instead
+    double min_bits_per_pixel = 0.03;
+    double min_scale = 0.5;
+};
+
+// Picks the encoder bitrate and resolution from network feedback, favouring
+// latency over quality. Frame acks give round-trip times; their excess over
+// the lowest recently seen is queueing delay, which starts growing as soon as
+// the stream outpaces the link, well before anything is lost. A few frames of
+// that, or acks that stop coming, cut the bitrate multiplicatively; a clear
+// link grows it slowly. The transport's bandwidth estimate caps it. Sustained
+// starvation lowers the resolution a step at a time, and it comes back once
+// the bitrate has stayed high enough for the larger size. Thread-safe.
+class RateController {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr uint32_t OVERUSE_FRAMES = 3;       // Frames of delay before cutting
+    static constexpr size_t MAX_IN_FLIGHT = 1024;       // Frames tracked for acks
+    static constexpr double DECREASE_FACTOR = 0.85;
+    static constexpr double INCREASE_PER_SECOND = 0.08;
+    static constexpr double BANDWIDTH_HEADROOM = 0.9;   // Share of the link estimate used
+    static constexpr double PROBE_STEP = 0.05;          // Smallest increase passed on
+    static constexpr double SCALE_STEP = 0.75;
+    static constexpr std::chrono::milliseconds MIN_DELAY_THRESHOLD{4};
+    static constexpr std::chrono::milliseconds BASE_RTT_WINDOW{10000};
+    static constexpr std::chrono::milliseconds DOWNSCALE_AFTER{2000};
+    static constexpr std::chrono::milliseconds UPSCALE_AFTER{5000};
+
+    enum class Reason {
+        HOLD,
+        QUEUE_DELAY,        // Round trips growing
+        ACKS_MISSING,       // Oldest frame in flight overdue
+        BANDWIDTH_LIMIT,    // Above what the transport says the link moves
+        PROBE,              // Link clear, trying for more
+        DOWNSCALE,
+        UPSCALE,
+    };
+
+    struct Decision {
+        Clock::time_point time;
+        Reason reason;
+        uint32_t bitrate;
+        uint32_t width;
+        uint32_t height;
+        bool bitrate_changed;
+        bool resolution_changed;
+
+        // What it was based on
+        double rtt_ms;
+        double queue_delay_ms;
+        double bandwidth;       // Bytes per second, 0 if unknown
+        size_t frames_in_flight;
+    };
+
+    // Told about every change, for tuning
+    using DecisionCallback = std::function<void(const Decision&)>;
+
+    explicit RateController(const RateControlConfig& config);
+
+    RateController(const RateController&) = delete;
+    RateController& operator=(const RateController&) = delete;
+
+    void onFrameSent(uint64_t sequence, Clock::time_point now = Clock::now());
+
+    // Acks are cumulative: earlier frames still in flight count as arrived
+    void onFrameAck(uint64_t sequence, Clock::time_point now = Clock::now());
+
+    // E.g. ZMQWrapper::getCurrentNetworkSpeed(), bytes per second
+    void onBandwidthEstimate(double bytes_per_second);
+
+    // Call once per frame, before encoding it
+    Decision update(Clock::time_point now = Clock::now());
+
+    void setDecisionCallback(DecisionCallback callback);
+
+    uint32_t bitrate() const;
+    uint32_t width() const;
+    uint32_t height() const;
+
+    static const char* reasonName(Reason reason);
+
+private:
+    struct SentFrame {
+        uint64_t sequence;
+        Clock::time_point sent;
+    };
+
+    double delayThresholdMs() const;
+    double bitsPerPixel(double scale) const;
+    bool adjustBitrate(Clock::time_point now, double queue_delay, bool acks_missing,
+        Reason& reason);
+    bool adjustScale(Clock::time_point now, Reason& reason);
+
+    const RateControlConfig config_;
+    mutable std::mutex mutex_;
+
+    std::deque<SentFrame> in_flight_;
+    EwmaEstimate rtt_;
+    double last_rtt_{0.0};      // ms; unsmoothed, OVERUSE_FRAMES filters the noise
+    double base_rtt_{0.0};
+    Clock::time_point base_rtt_time_;
+    double bandwidth_{0.0};
+
+    double target_bitrate_;     // Grows continuously while probing
+    uint32_t bitrate_;          // What the encoder was last told
+    double scale_{1.0};
+    uint32_t width_;
+    uint32_t height_;
+    uint32_t overuse_frames_{0};
+    Clock::time_point last_update_;
+    Clock::time_point last_decrease_;
+    Clock::time_point starved_since_;
+    Clock::time_point recovered_since_;
+    bool starved_{false};
+    bool recovered_{false};
+
+    DecisionCallback callback_;
+};
+
+} // namespace network
+} // namespace anarchy
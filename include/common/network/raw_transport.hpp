@@ -0,0 +1,166 @@
+#pragma once
+
+#include "common/network/transport.hpp"
+#include "common/network/buffer_pool.hpp"
+#include "common/network/frame_filter.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace anarchy {
+namespace network {
+
+// Precedes every message on a raw connection
+struct RawFrameHeader {
+    MessageHeader header;
+    uint64_t payload_size;
+};
+
+// Plain TCP backend for raw://host:port endpoints (Linux only), meant for a
+// dedicated link such as Thunderbolt networking where ZeroMQ's framing and
+// I/O thread are pure overhead. Each channel is its own TCP connection on
+// consecutive ports; clients open theirs with a 64-bit client id so the
+// server can tie them to one peer. Sockets run with TCP_NODELAY and large
+// buffers, payloads of ZEROCOPY_THRESHOLD and up go out with MSG_ZEROCOPY,
+// and queued messages are written with one sendmsg() per batch.
+class RawTransport : public Transport {
+public:
+    static constexpr int SOCKET_BUFFER_SIZE = 8 * 1024 * 1024;
+    static constexpr size_t ZEROCOPY_THRESHOLD = 64 * 1024;  // Page pinning only pays off for large sends
+    static constexpr int BUSY_POLL_USEC = 50;
+    static constexpr size_t MAX_WRITE_BATCH = 32;           // Messages per sendmsg()
+    static constexpr size_t RECEIVE_BUFFER_SIZE = 64 * 1024;
+    static constexpr size_t MAX_MESSAGES_PER_POLL = 64;   // Per connection, so no channel starves the rest
+    static constexpr size_t FRAME_SEND_QUEUE = 2;           // Unsent frames per peer before dropping
+    static constexpr size_t MAX_MESSAGE_SIZE = 1024 * 1024 * 100;  // 100MB
+    static constexpr uint32_t HEARTBEAT_INTERVAL = 1000;    // 1 second
+
+    RawTransport(const std::string& endpoint, Role role);
+    ~RawTransport() override;
+
+    RawTransport(const RawTransport&) = delete;
+    RawTransport& operator=(const RawTransport&) = delete;
+
+    bool start() override;
+    void stop() override;
+    bool sendMessage(const Message& message) override;
+    bool sendMessage(Message&& message) override;
+    void setMessageCallback(MessageCallback callback) override;
+    void setErrorCallback(ErrorCallback callback) override;
+    bool isConnected() const override;
+    void setBusyPoll(bool enable) override;
+    size_t getDroppedFrames() const override { return frames_dropped_; }
+    bool getClockEstimate(uint64_t peer, ClockSync::Estimate& estimate) const override {
+        return clock_sync_.estimate(peer, estimate);
+    }
+
+private:
+    struct Outgoing {
+        RawFrameHeader frame;
+        std::vector<uint8_t> payload;
+        uint64_t peer{0};
+        uint32_t zerocopy_id{0};     // Last MSG_ZEROCOPY send that covered it
+        bool zerocopy_used{false};
+        bool dropped{false};         // Stale frame, skipped when writing
+    };
+
+    struct Connection {
+        int fd{-1};
+        Channel channel{Channel::CONTROL};
+        uint64_t peer{0};
+        bool identified{false};  // Server side: client id received
+        bool zerocopy{false};    // SO_ZEROCOPY accepted by the kernel
+
+        // Receive state: small messages are parsed out of rx, large payloads
+        // are read straight into their pooled buffer
+        std::vector<uint8_t> rx;
+        size_t rx_pos{0};
+        size_t rx_used{0};
+        bool in_payload{false};
+        RawFrameHeader frame{};
+        std::vector<uint8_t> payload;
+        size_t payload_read{0};
+
+        // Send state. Entries stay where they are until the kernel is done
+        // with them, since after a MSG_ZEROCOPY send it still reads the
+        // pages, frame headers included.
+        std::deque<Outgoing> send_queue;
+        size_t unsent{0};          // First entry not fully written
+        size_t write_offset{0};    // Bytes of that entry already written
+        uint32_t zerocopy_next{0};  // Id the kernel gives the next zerocopy send
+        uint32_t zerocopy_done{0};  // Zerocopy sends below this id have completed
+        bool frame_open{false};     // Last frame slice queued has more to follow
+        uint64_t written_frame{0};  // Newest frame with bytes on the wire
+        bool frame_written{false};
+    };
+
+    bool openListeners();
+    bool openConnections();
+    void workerThread();
+    void sendHeartbeats();
+    void wake();
+    bool queue(Outgoing&& outgoing);
+    void routeQueued();
+    void dropStaleFrames(Connection& connection);
+    void acceptConnections(int listen_fd, Channel channel);
+    bool configureSocket(int fd);
+    void identify(Connection& connection, uint64_t client_id);
+    bool flushConnection(Connection& connection);
+    void reapZerocopy(Connection& connection);
+    void releaseWritten(Connection& connection);
+    bool readConnection(Connection& connection);
+    void completeMessage(Connection& connection);
+    void deliverFrames();
+    void closeConnection(Connection& connection);
+    void closeAll();
+    void handleMessage(const Message& message);
+    void handleError(const std::string& error);
+
+    std::string host_;
+    int port_{0};
+    Role role_;
+    uint64_t client_id_{0};
+
+    std::array<int, CHANNEL_COUNT> listen_fds_;
+    // Worker thread only once started. Clients file their connections
+    // under peer 0.
+    std::vector<std::unique_ptr<Connection>> connections_;
+    std::unordered_map<uint64_t, std::array<Connection*, CHANNEL_COUNT>> peer_connections_;
+    std::unordered_map<uint64_t, uint64_t> peer_ids_;  // Client id -> peer id
+    uint64_t next_peer_id_{1};
+    std::atomic<uint64_t> last_peer_{0};
+
+    // Senders queue, the worker swaps the queue out and owns the sockets
+    std::vector<Outgoing> send_queue_;
+    std::vector<Outgoing> send_batch_;
+    std::mutex send_mutex_;
+    int wake_fd_{-1};
+
+    std::thread worker_thread_;
+    std::atomic<bool> should_stop_{false};
+    std::atomic<bool> connected_{false};
+    std::atomic<bool> busy_poll_{false};
+    std::atomic<size_t> frames_dropped_{0};
+    std::atomic<size_t> messages_received_{0};
+    std::chrono::steady_clock::time_point last_heartbeat_;
+    ClockSync clock_sync_;      // Fed by heartbeats
+    FrameFilter frame_filter_;
+    std::vector<Message> frame_slices_;   // Frame messages read this pass
+    std::vector<Message> frame_deliver_;
+
+    std::shared_ptr<BufferPool> buffer_pool_{std::make_shared<BufferPool>()};
+
+    MessageCallback message_callback_;
+    ErrorCallback error_callback_;
+    std::mutex callback_mutex_;
+};
+
+} // namespace network
+} // namespace anarchy
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+namespace anarchy {
+namespace network {
+
+// Image indices of a virtual swapchain. The client and the server step
+// through the same ring in lockstep, so the client hands out the next index
+// without asking: images come round in order, and one is only handed out
+// again once it has been presented.
+class SwapchainRing {
+public:
+    static constexpr uint32_t MIN_IMAGES = 3;
+    static constexpr uint32_t MAX_IMAGES = 4;
+
+    // Images for a swapchain the application asked min_image_count of
+    static uint32_t imageCount(uint32_t min_image_count) {
+        return std::clamp(min_image_count, MIN_IMAGES, MAX_IMAGES);
+    }
+
+    explicit SwapchainRing(uint32_t image_count = MIN_IMAGES)
+        : image_count_(std::clamp(image_count, 1u, MAX_IMAGES))
+    {
+    }
+
+    // False while the next image in order is still held by the application
+    bool acquire(uint32_t& index) {
+        if (acquired_[next_]) {
+            return false;
+        }
+        index = next_;
+        acquired_[next_] = true;
+        next_ = (next_ + 1) % image_count_;
+        return true;
+    }
+
+    // False for an index that isn't acquired
+    bool present(uint32_t index) {
+        if (index >= image_count_ || !acquired_[index]) {
+            return false;
+        }
+        acquired_[index] = false;
+        return true;
+    }
+
+    // The index acquire() would hand out
+    uint32_t next() const { return next_; }
+    uint32_t imageCount() const { return image_count_; }
+
+private:
+    uint32_t image_count_;
+    uint32_t next_{0};
+    std::array<bool, MAX_IMAGES> acquired_{};
+};
+
+} // namespace network
+} // namespace anarchy
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "common/network/clock_sync.hpp"
+#include "common/network/protocol.hpp"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace anarchy {
+namespace network {
+
+// Message transport between the ICD and the GPU server. create() picks the
+// backend from the endpoint scheme: raw://host:port runs plain TCP sockets
+// (see RawTransport), everything else (tcp://, ipc://, inproc://) goes
+// through ZeroMQ. Both carry the control/command/frame channels.
+class Transport {
+public:
+    enum class Role {
+        SERVER,
+        CLIENT
+    };
+
+    using MessageCallback = std::function<void(const Message&)>;
+    using ErrorCallback = std::function<void(const std::string&)>;
+
+    virtual ~Transport() = default;
+
+    static std::unique_ptr<Transport> create(const std::string& endpoint, Role role);
+
+    virtual bool start() = 0;
+    virtual void stop() = 0;
+    virtual bool sendMessage(const Message& message) = 0;
+    virtual bool sendMessage(Message&& message) = 0;  // Takes the payload without copying it
+    virtual void setMessageCallback(MessageCallback callback) = 0;
+    virtual void setErrorCallback(ErrorCallback callback) = 0;
+    virtual bool isConnected() const = 0;
+
+    // Spin instead of blocking for the lowest latency on a dedicated core
+    virtual void setBusyPoll(bool enable) = 0;
+    virtual size_t getDroppedFrames() const = 0;
+
+    // Round trip and clock offset to peer (0 on a client: the server), from
+    // heartbeats; false until two have crossed
+    virtual bool getClockEstimate(uint64_t peer, ClockSync::Estimate& estimate) const = 0;
+};
+
+} // namespace network
+} // namespace anarchy
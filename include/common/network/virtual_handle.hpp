@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace anarchy {
+namespace network {
+
+// Object types that get their own virtual handle ID space
+enum class HandleType : uint8_t {
+    INVALID = 0,
+    INSTANCE,
+    PHYSICAL_DEVICE,
+    DEVICE,
+    QUEUE,
+    SWAPCHAIN,
+    IMAGE,
+    COMMAND_POOL,
+    COMMAND_BUFFER,
+    DEVICE_MEMORY,
+    BUFFER,
+    SEMAPHORE,
+    FENCE,
+    SHADER_MODULE,
+    COUNT
+};
+
+// Virtual handles carry their type in the top byte and a per-type ID below it
+constexpr uint32_t HANDLE_TYPE_SHIFT = 56;
+constexpr uint64_t HANDLE_INDEX_MASK = (uint64_t(1) << HANDLE_TYPE_SHIFT) - 1;
+constexpr size_t HANDLE_TYPE_COUNT = static_cast<size_t>(HandleType::COUNT);
+
+constexpr uint64_t makeVirtualHandle(HandleType type, uint64_t index) {
+    return (static_cast<uint64_t>(type) << HANDLE_TYPE_SHIFT) | (index & HANDLE_INDEX_MASK);
+}
+
+constexpr HandleType virtualHandleType(uint64_t handle) {
+    return static_cast<HandleType>(handle >> HANDLE_TYPE_SHIFT);
+}
+
+constexpr uint64_t virtualHandleIndex(uint64_t handle) {
+    return handle & HANDLE_INDEX_MASK;
+}
+
+// Dispatchable handles are client pointers, the rest are the virtual handle itself
+constexpr bool isDispatchable(HandleType type) {
+    return type == HandleType::INSTANCE || type == HandleType::PHYSICAL_DEVICE ||
+        type == HandleType::DEVICE || type == HandleType::QUEUE ||
+        type == HandleType::COMMAND_BUFFER;
+}
+
+// Mints virtual handles on the client so object creation never waits on the server
+class HandleAllocator {
+public:
+    HandleAllocator() {
+        for (auto& next : next_index_) {
+            next = 1;  // Index 0 is reserved for VK_NULL_HANDLE
+        }
+    }
+
+    uint64_t allocate(HandleType type) {
+        uint64_t index = next_index_[static_cast<size_t>(type)]++;
+        return makeVirtualHandle(type, index);
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, HANDLE_TYPE_COUNT> next_index_;
+};
+
+} // namespace network
+} // namespace anarchy
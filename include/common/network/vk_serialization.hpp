@@ -0,0 +1,670 @@
+#pragma once
+
+#include "common/network/virtual_handle.hpp"
+#include <vulkan/vulkan.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The Vulkan wire format is little-endian only"
+#endif
+
+namespace anarchy {
+namespace network {
+
+// Wire encoding for Vulkan structs.
+//
+// A parameter block is laid out in one contiguous arena: the root struct
+// comes first, and everything it points to (pNext chains, arrays, strings,
+// nested structs) is appended after it. Each pointer slot holds the offset of
+// its target from the start of the arena, or 0 for null. The server turns the
+// offsets back into pointers in place, so decoding makes no per-field copies.
+//
+// StructTraits<T> lists the pointer fields of each struct. Structs without
+// traits are copied as-is. Handles inside Vulkan structs are mapped through a
+// callback on both ends. uint64_t handle fields in the parameter blocks
+// themselves are already wire handles.
+
+static_assert(sizeof(void*) == sizeof(uint64_t), "Wire format assumes 64-bit pointers");
+static_assert(sizeof(VkSemaphore) == sizeof(uint64_t), "Wire format assumes 64-bit handles");
+
+constexpr size_t WIRE_ALIGNMENT = 8;
+
+// Appends into a caller-owned buffer; once the buffer has grown to its
+// working size, encoding doesn't allocate.
+class WireWriter {
+public:
+    explicit WireWriter(std::vector<uint8_t>& buffer) : buffer_(buffer) { buffer_.clear(); }
+
+    size_t append(const void* data, size_t size) {
+        size_t offset = (buffer_.size() + WIRE_ALIGNMENT - 1) & ~(WIRE_ALIGNMENT - 1);
+        buffer_.resize(offset + size);
+        if (size > 0) {
+            std::memcpy(buffer_.data() + offset, data, size);
+        }
+        return offset;
+    }
+
+    uint64_t read(size_t offset) const {
+        uint64_t value;
+        std::memcpy(&value, buffer_.data() + offset, sizeof(value));
+        return value;
+    }
+
+    void write(size_t offset, uint64_t value) {
+        std::memcpy(buffer_.data() + offset, &value, sizeof(value));
+    }
+
+    size_t size() const { return buffer_.size(); }
+
+private:
+    std::vector<uint8_t>& buffer_;
+};
+
+// Bounds-checks offsets while decoding in place
+class WireReader {
+public:
+    WireReader(uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+    // Slot contents are still an offset at this point
+    static uint64_t slot(const void* field) {
+        uint64_t value;
+        std::memcpy(&value, field, sizeof(value));
+        return value;
+    }
+
+    // Targets must sit past the end of their owner, which also rules out cycles
+    template <typename T, typename O>
+    bool resolve(uint64_t offset, const O* owner, size_t count, T*& out) const {
+        out = nullptr;
+        if (offset == 0 || count == 0) {
+            return true;
+        }
+        size_t owner_end = reinterpret_cast<const uint8_t*>(owner) - data_ + sizeof(O);
+        if (offset < owner_end || offset >= size_ || offset % alignof(T) != 0 ||
+            count > (size_ - offset) / sizeof(T)) {
+            return false;
+        }
+        out = reinterpret_cast<T*>(data_ + offset);
+        return true;
+    }
+
+    template <typename O>
+    bool resolveString(uint64_t offset, const O* owner, const char*& out) const {
+        char* chars;
+        if (!resolve(offset, owner, 1, chars)) {
+            return false;
+        }
+        out = chars;
+        return !chars || std::memchr(chars, 0, size_ - offset) != nullptr;
+    }
+
+private:
+    uint8_t* data_;
+    size_t size_;
+};
+
+template <typename T>
+struct StructTraits {
+    static constexpr auto fields() { return std::make_tuple(); }
+};
+
+namespace wire {
+
+template <typename T, typename = void>
+struct HasNext : std::false_type {};
+template <typename T>
+struct HasNext<T, std::void_t<decltype(std::declval<T>().pNext)>> : std::true_type {};
+
+template <typename S, typename M>
+size_t memberOffset(const S& object, const M& member) {
+    return reinterpret_cast<const uint8_t*>(&member) - reinterpret_cast<const uint8_t*>(&object);
+}
+
+template <typename T, typename Mapper>
+size_t encodeStruct(WireWriter& writer, const T* src, size_t count, Mapper& map);
+template <typename T, typename Mapper>
+void encodeFields(WireWriter& writer, size_t offset, const T& src, Mapper& map);
+template <typename T, typename Resolver>
+bool decodeStruct(const WireReader& reader, T& dst, Resolver& resolve);
+
+// const E* + count, E has no pointers of its own
+template <typename S, typename E, typename C>
+struct ArrayField {
+    const E* S::*data;
+    C S::*count;
+
+    template <typename Mapper>
+    void encode(WireWriter& writer, size_t offset, const S& src, Mapper&) const {
+        size_t n = static_cast<size_t>(src.*count);
+        uint64_t target = (src.*data && n > 0) ? writer.append(src.*data, n * sizeof(E)) : 0;
+        writer.write(offset + memberOffset(src, src.*data), target);
+    }
+
+    template <typename Resolver>
+    bool decode(const WireReader& reader, S& dst, Resolver&) const {
+        E* target;
+        if (!reader.resolve(WireReader::slot(&(dst.*data)), &dst,
+                static_cast<size_t>(dst.*count), target)) {
+            return false;
+        }
+        dst.*data = target;
+        return true;
+    }
+};
+
+// const E* + count, E has traits of its own
+template <typename S, typename E, typename C>
+struct StructArrayField {
+    const E* S::*data;
+    C S::*count;
+
+    template <typename Mapper>
+    void encode(WireWriter& writer, size_t offset, const S& src, Mapper& map) const {
+        size_t n = static_cast<size_t>(src.*count);
+        uint64_t target = (src.*data && n > 0) ? encodeStruct(writer, src.*data, n, map) : 0;
+        writer.write(offset + memberOffset(src, src.*data), target);
+    }
+
+    template <typename Resolver>
+    bool decode(const WireReader& reader, S& dst, Resolver& resolve) const {
+        size_t n = static_cast<size_t>(dst.*count);
+        E* target;
+        if (!reader.resolve(WireReader::slot(&(dst.*data)), &dst, n, target)) {
+            return false;
+        }
+        for (size_t i = 0; target && i < n; ++i) {
+            if (!decodeStruct(reader, target[i], resolve)) {
+                return false;
+            }
+        }
+        dst.*data = target;
+        return true;
+    }
+};
+
+// Single const E*
+template <typename S, typename E>
+struct StructPtrField {
+    const E* S::*data;
+
+    template <typename Mapper>
+    void encode(WireWriter& writer, size_t offset, const S& src, Mapper& map) const {
+        uint64_t target = src.*data ? encodeStruct(writer, src.*data, 1, map) : 0;
+        writer.write(offset + memberOffset(src, src.*data), target);
+    }
+
+    template <typename Resolver>
+    bool decode(const WireReader& reader, S& dst, Resolver& resolve) const {
+        E* target;
+        if (!reader.resolve(WireReader::slot(&(dst.*data)), &dst, 1, target) ||
+            (target && !decodeStruct(reader, *target, resolve))) {
+            return false;
+        }
+        dst.*data = target;
+        return true;
+    }
+};
+
+// Struct embedded by value
+template <typename S, typename M>
+struct ValueField {
+    M S::*member;
+
+    template <typename Mapper>
+    void encode(WireWriter& writer, size_t offset, const S& src, Mapper& map) const {
+        encodeFields(writer, offset + memberOffset(src, src.*member), src.*member, map);
+    }
+
+    template <typename Resolver>
+    bool decode(const WireReader& reader, S& dst, Resolver& resolve) const {
+        return decodeStruct(reader, dst.*member, resolve);
+    }
+};
+
+// Null-terminated const char*
+template <typename S>
+struct StringField {
+    const char* S::*data;
+
+    template <typename Mapper>
+    void encode(WireWriter& writer, size_t offset, const S& src, Mapper&) const {
+        const char* str = src.*data;
+        uint64_t target = str ? writer.append(str, std::strlen(str) + 1) : 0;
+        writer.write(offset + memberOffset(src, src.*data), target);
+    }
+
+    template <typename Resolver>
+    bool decode(const WireReader& reader, S& dst, Resolver&) const {
+        const char* target;
+        if (!reader.resolveString(WireReader::slot(&(dst.*data)), &dst, target)) {
+            return false;
+        }
+        dst.*data = target;
+        return true;
+    }
+};
+
+// const char* const* + count: an offset table followed by the strings
+template <typename S, typename C>
+struct StringArrayField {
+    const char* const* S::*data;
+    C S::*count;
+
+    template <typename Mapper>
+    void encode(WireWriter& writer, size_t offset, const S& src, Mapper&) const {
+        size_t n = static_cast<size_t>(src.*count);
+        uint64_t table = 0;
+        if (src.*data && n > 0) {
+            table = writer.append(src.*data, n * sizeof(uint64_t));
+            for (size_t i = 0; i < n; ++i) {
+                const char* str = (src.*data)[i];
+                uint64_t target = str ? writer.append(str, std::strlen(str) + 1) : 0;
+                writer.write(table + i * sizeof(uint64_t), target);
+            }
+        }
+        writer.write(offset + memberOffset(src, src.*data), table);
+    }
+
+    template <typename Resolver>
+    bool decode(const WireReader& reader, S& dst, Resolver&) const {
+        size_t n = static_cast<size_t>(dst.*count);
+        uint64_t* table;
+        if (!reader.resolve(WireReader::slot(&(dst.*data)), &dst, n, table)) {
+            return false;
+        }
+        for (size_t i = 0; table && i < n; ++i) {
+            const char* str;
+            if (!reader.resolveString(table[i], &table[i], str)) {
+                return false;
+            }
+            std::memcpy(&table[i], &str, sizeof(str));
+        }
+        dst.*data = reinterpret_cast<const char* const*>(table);
+        return true;
+    }
+};
+
+// const H* + count of handles that need translating
+template <typename S, typename H, typename C>
+struct HandleArrayField {
+    const H* S::*data;
+    C S::*count;
+    HandleType type;
+
+    template <typename Mapper>
+    void encode(WireWriter& writer, size_t offset, const S& src, Mapper& map) const {
+        size_t n = static_cast<size_t>(src.*count);
+        uint64_t target = 0;
+        if (src.*data && n > 0) {
+            target = writer.append(src.*data, n * sizeof(uint64_t));
+            for (size_t i = 0; i < n; ++i) {
+                size_t entry = target + i * sizeof(uint64_t);
+                writer.write(entry, map(type, writer.read(entry)));
+            }
+        }
+        writer.write(offset + memberOffset(src, src.*data), target);
+    }
+
+    template <typename Resolver>
+    bool decode(const WireReader& reader, S& dst, Resolver& resolve) const {
+        size_t n = static_cast<size_t>(dst.*count);
+        uint64_t* target;
+        if (!reader.resolve(WireReader::slot(&(dst.*data)), &dst, n, target)) {
+            return false;
+        }
+        for (size_t i = 0; target && i < n; ++i) {
+            target[i] = resolve(type, target[i]);
+            if (target[i] == 0) {
+                return false;
+            }
+        }
+        dst.*data = reinterpret_cast<const H*>(target);
+        return true;
+    }
+};
+
+// Single handle member, may be VK_NULL_HANDLE
+template <typename S, typename H>
+struct HandleField {
+    H S::*member;
+    HandleType type;
+
+    template <typename Mapper>
+    void encode(WireWriter& writer, size_t offset, const S& src, Mapper& map) const {
+        size_t slot = offset + memberOffset(src, src.*member);
+        uint64_t handle = writer.read(slot);
+        writer.write(slot, handle ? map(type, handle) : 0);
+    }
+
+    template <typename Resolver>
+    bool decode(const WireReader&, S& dst, Resolver& resolve) const {
+        uint64_t handle = WireReader::slot(&(dst.*member));
+        if (handle == 0) {
+            return true;
+        }
+        uint64_t real = resolve(type, handle);
+        std::memcpy(&(dst.*member), &real, sizeof(real));
+        return real != 0;
+    }
+};
+
+// Output pointer the server fills locally, never forwarded
+template <typename S, typename P>
+struct OutputField {
+    P S::*member;
+
+    template <typename Mapper>
+    void encode(WireWriter& writer, size_t offset, const S& src, Mapper&) const {
+        writer.write(offset + memberOffset(src, src.*member), 0);
+    }
+
+    template <typename Resolver>
+    bool decode(const WireReader&, S& dst, Resolver&) const {
+        dst.*member = nullptr;
+        return true;
+    }
+};
+
+template <typename S, typename E, typename C>
+constexpr ArrayField<S, E, C> array(const E* S::*data, C S::*count) { return {data, count}; }
+
+template <typename S, typename E, typename C>
+constexpr StructArrayField<S, E, C> structs(const E* S::*data, C S::*count) {
+    return {data, count};
+}
+
+template <typename S, typename E>
+constexpr StructPtrField<S, E> structPtr(const E* S::*data) { return {data}; }
+
+template <typename S, typename M>
+constexpr ValueField<S, M> value(M S::*member) { return {member}; }
+
+template <typename S>
+constexpr StringField<S> string(const char* S::*data) { return {data}; }
+
+template <typename S, typename C>
+constexpr StringArrayField<S, C> strings(const char* const* S::*data, C S::*count) {
+    return {data, count};
+}
+
+template <typename S, typename H, typename C>
+constexpr HandleArrayField<S, H, C> handles(const H* S::*data, C S::*count, HandleType type) {
+    return {data, count, type};
+}
+
+template <typename S, typename H>
+constexpr HandleField<S, H> handle(H S::*member, HandleType type) { return {member, type}; }
+
+template <typename S, typename P>
+constexpr OutputField<S, P> output(P S::*member) { return {member}; }
+
+} // namespace wire
+
+// Vulkan struct set
+template <>
+struct StructTraits<VkApplicationInfo> {
+    static constexpr auto fields() {
+        return std::make_tuple(
+            wire::string(&VkApplicationInfo::pApplicationName),
+            wire::string(&VkApplicationInfo::pEngineName));
+    }
+};
+
+template <>
+struct StructTraits<VkInstanceCreateInfo> {
+    static constexpr auto fields() {
+        return std::make_tuple(
+            wire::structPtr(&VkInstanceCreateInfo::pApplicationInfo),
+            wire::strings(&VkInstanceCreateInfo::ppEnabledLayerNames,
+                &VkInstanceCreateInfo::enabledLayerCount),
+            wire::strings(&VkInstanceCreateInfo::ppEnabledExtensionNames,
+                &VkInstanceCreateInfo::enabledExtensionCount));
+    }
+};
+
+template <>
+struct StructTraits<VkDeviceQueueCreateInfo> {
+    static constexpr auto fields() {
+        return std::make_tuple(
+            wire::array(&VkDeviceQueueCreateInfo::pQueuePriorities,
+                &VkDeviceQueueCreateInfo::queueCount));
+    }
+};
+
+template <>
+struct StructTraits<VkDeviceCreateInfo> {
+    static constexpr auto fields() {
+        return std::make_tuple(
+            wire::structs(&VkDeviceCreateInfo::pQueueCreateInfos,
+                &VkDeviceCreateInfo::queueCreateInfoCount),
+            wire::strings(&VkDeviceCreateInfo::ppEnabledLayerNames,
+                &VkDeviceCreateInfo::enabledLayerCount),
+            wire::strings(&VkDeviceCreateInfo::ppEnabledExtensionNames,
+                &VkDeviceCreateInfo::enabledExtensionCount),
+            wire::structPtr(&VkDeviceCreateInfo::pEnabledFeatures));
+    }
+};
+
+template <>
+struct StructTraits<VkSubmitInfo> {
+    static constexpr auto fields() {
+        return std::make_tuple(
+            wire::handles(&VkSubmitInfo::pWaitSemaphores, &VkSubmitInfo::waitSemaphoreCount,
+                HandleType::SEMAPHORE),
+            wire::array(&VkSubmitInfo::pWaitDstStageMask, &VkSubmitInfo::waitSemaphoreCount),
+            wire::handles(&VkSubmitInfo::pCommandBuffers, &VkSubmitInfo::commandBufferCount,
+                HandleType::COMMAND_BUFFER),
+            wire::handles(&VkSubmitInfo::pSignalSemaphores, &VkSubmitInfo::signalSemaphoreCount,
+                HandleType::SEMAPHORE));
+    }
+};
+
+template <>
+struct StructTraits<VkTimelineSemaphoreSubmitInfo> {
+    static constexpr auto fields() {
+        return std::make_tuple(
+            wire::array(&VkTimelineSemaphoreSubmitInfo::pWaitSemaphoreValues,
+                &VkTimelineSemaphoreSubmitInfo::waitSemaphoreValueCount),
+            wire::array(&VkTimelineSemaphoreSubmitInfo::pSignalSemaphoreValues,
+                &VkTimelineSemaphoreSubmitInfo::signalSemaphoreValueCount));
+    }
+};
+
+template <>
+struct StructTraits<VkCommandBufferBeginInfo> {
+    static constexpr auto fields() {
+        return std::make_tuple(
+            wire::structPtr(&VkCommandBufferBeginInfo::pInheritanceInfo));
+    }
+};
+
+template <>
+struct StructTraits<VkMemoryDedicatedAllocateInfo> {
+    static constexpr auto fields() {
+        return std::make_tuple(
+            wire::handle(&VkMemoryDedicatedAllocateInfo::image, HandleType::IMAGE),
+            wire::handle(&VkMemoryDedicatedAllocateInfo::buffer, HandleType::BUFFER));
+    }
+};
+
+template <>
+struct StructTraits<VkBufferCreateInfo> {
+    static constexpr auto fields() {
+        return std::make_tuple(
+            wire::array(&VkBufferCreateInfo::pQueueFamilyIndices,
+                &VkBufferCreateInfo::queueFamilyIndexCount));
+    }
+};
+
+template <>
+struct StructTraits<VkImageCreateInfo> {
+    static constexpr auto fields() {
+        return std::make_tuple(
+            wire::array(&VkImageCreateInfo::pQueueFamilyIndices,
+                &VkImageCreateInfo::queueFamilyIndexCount));
+    }
+};
+
+template <>
+struct StructTraits<VkImageFormatListCreateInfo> {
+    static constexpr auto fields() {
+        return std::make_tuple(
+            wire::array(&VkImageFormatListCreateInfo::pViewFormats,
+                &VkImageFormatListCreateInfo::viewFormatCount));
+    }
+};
+
+template <>
+struct StructTraits<VkSwapchainCreateInfoKHR> {
+    static constexpr auto fields() {
+        return std::make_tuple(
+            wire::array(&VkSwapchainCreateInfoKHR::pQueueFamilyIndices,
+                &VkSwapchainCreateInfoKHR::queueFamilyIndexCount),
+            wire::handle(&VkSwapchainCreateInfoKHR::oldSwapchain, HandleType::SWAPCHAIN));
+    }
+};
+
+template <>
+struct StructTraits<VkPresentInfoKHR> {
+    static constexpr auto fields() {
+        return std::make_tuple(
+            wire::handles(&VkPresentInfoKHR::pWaitSemaphores,
+                &VkPresentInfoKHR::waitSemaphoreCount, HandleType::SEMAPHORE),
+            wire::handles(&VkPresentInfoKHR::pSwapchains,
+                &VkPresentInfoKHR::swapchainCount, HandleType::SWAPCHAIN),
+            wire::array(&VkPresentInfoKHR::pImageIndices, &VkPresentInfoKHR::swapchainCount),
+            wire::output(&VkPresentInfoKHR::pResults));
+    }
+};
+
+namespace wire {
+
+// Structs that may appear in a pNext chain; anything else is dropped on encode
+template <typename T, VkStructureType SType>
+struct Chained {
+    using type = T;
+    static constexpr VkStructureType stype = SType;
+};
+
+template <typename... Entries>
+struct ChainList {};
+
+using ChainedStructs = ChainList<
+    Chained<VkPhysicalDeviceFeatures2, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2>,
+    Chained<VkPhysicalDeviceVulkan11Features, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES>,
+    Chained<VkPhysicalDeviceVulkan12Features, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES>,
+    Chained<VkPhysicalDeviceTimelineSemaphoreFeatures,
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES>,
+    Chained<VkTimelineSemaphoreSubmitInfo, VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO>,
+    Chained<VkSemaphoreTypeCreateInfo, VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO>,
+    Chained<VkMemoryAllocateFlagsInfo, VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO>,
+    Chained<VkMemoryDedicatedAllocateInfo, VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO>,
+    Chained<VkImageFormatListCreateInfo, VK_STRUCTURE_TYPE_IMAGE_FORMAT_LIST_CREATE_INFO>,
+    Chained<VkCommandBufferInheritanceInfo, VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO>>;
+
+template <typename Mapper, typename... Entries>
+bool encodeChained(WireWriter& writer, const VkBaseInStructure* next, Mapper& map,
+    uint64_t& offset, ChainList<Entries...>)
+{
+    return ((next->sType == Entries::stype ?
+        (offset = encodeStruct(writer, reinterpret_cast<const typename Entries::type*>(next), 1, map),
+            true) : false) || ...);
+}
+
+template <typename Mapper>
+uint64_t encodeChain(WireWriter& writer, const void* next, Mapper& map) {
+    while (next) {
+        auto* base = static_cast<const VkBaseInStructure*>(next);
+        uint64_t offset = 0;
+        if (encodeChained(writer, base, map, offset, ChainedStructs{})) {
+            return offset;  // The encoded struct carries the rest of the chain
+        }
+        next = base->pNext;
+    }
+    return 0;
+}
+
+template <typename Resolver, typename O, typename... Entries>
+bool decodeChained(const WireReader& reader, uint64_t offset, const O* owner,
+    VkStructureType stype, Resolver& resolve, void*& out, ChainList<Entries...>)
+{
+    bool valid = false;
+    bool found = ((stype == Entries::stype ? ([&]() {
+        typename Entries::type* target;
+        valid = reader.resolve(offset, owner, 1, target) && decodeStruct(reader, *target, resolve);
+        out = target;
+    }(), true) : false) || ...);
+    return found && valid;
+}
+
+template <typename T, typename Mapper>
+void encodeFields(WireWriter& writer, size_t offset, const T& src, Mapper& map) {
+    if constexpr (HasNext<T>::value) {
+        writer.write(offset + memberOffset(src, src.pNext), encodeChain(writer, src.pNext, map));
+    }
+    std::apply([&](const auto&... field) {
+        (field.encode(writer, offset, src, map), ...);
+    }, StructTraits<T>::fields());
+}
+
+template <typename T, typename Mapper>
+size_t encodeStruct(WireWriter& writer, const T* src, size_t count, Mapper& map) {
+    size_t offset = writer.append(src, count * sizeof(T));
+    for (size_t i = 0; i < count; ++i) {
+        encodeFields(writer, offset + i * sizeof(T), src[i], map);
+    }
+    return offset;
+}
+
+template <typename T, typename Resolver>
+bool decodeStruct(const WireReader& reader, T& dst, Resolver& resolve) {
+    if constexpr (HasNext<T>::value) {
+        uint64_t offset = WireReader::slot(&dst.pNext);
+        void* next = nullptr;
+        if (offset != 0) {
+            VkBaseInStructure* base;
+            if (!reader.resolve(offset, &dst, 1, base) || !base ||
+                !decodeChained(reader, offset, &dst, base->sType, resolve, next,
+                    ChainedStructs{})) {
+                return false;
+            }
+        }
+        dst.pNext = next;
+    }
+    return std::apply([&](const auto&... field) {
+        return (field.decode(reader, dst, resolve) && ...);
+    }, StructTraits<T>::fields());
+}
+
+} // namespace wire
+
+// Encode a parameter block into buffer. The mapper turns client handles into
+// wire handles: uint64_t map(HandleType type, uint64_t handle).
+template <typename T, typename Mapper>
+size_t encodeWire(const T& params, std::vector<uint8_t>& buffer, Mapper&& map) {
+    WireWriter writer(buffer);
+    wire::encodeStruct(writer, &params, 1, map);
+    return writer.size();
+}
+
+// Decode a parameter block in place. The resolver turns wire handles into
+// real ones and returns 0 for unknown handles:
+// uint64_t resolve(HandleType type, uint64_t handle). Returns nullptr if the
+// payload is malformed. data must be aligned to WIRE_ALIGNMENT.
+template <typename T, typename Resolver>
+T* decodeWire(uint8_t* data, size_t size, Resolver&& resolve) {
+    if (size < sizeof(T) || reinterpret_cast<uintptr_t>(data) % WIRE_ALIGNMENT != 0) {
+        return nullptr;
+    }
+    WireReader reader(data, size);
+    T* params = reinterpret_cast<T*>(data);
+    return wire::decodeStruct(reader, *params, resolve) ? params : nullptr;
+}
+
+} // namespace network
+} // namespace anarchy
@@ -0,0 +1,343 @@
+#pragma once
+
+#include "common/network/swapchain_ring.hpp"
+#include "common/network/virtual_handle.hpp"
+#include "common/network/vk_serialization.hpp"
+#include <vulkan/vulkan.h>
+#include <array>
+#include <cstdint>
+
+namespace anarchy {
+namespace network {
+
+// Parameter blocks shared by the ICD and the server. Every handle on the wire
+// is a 64-bit virtual handle (see virtual_handle.hpp); create commands carry
+// the handle the client already minted for the new object. Blocks that embed
+// or point to Vulkan structs go through encodeWire/decodeWire, the rest are
+// plain fixed-size copies.
+
+struct CreateInstanceParams {
+    uint64_t instance;
+    VkInstanceCreateInfo create_info;
+};
+
+struct CreateDeviceParams {
+    uint64_t physical_device;
+    uint64_t device;
+    VkDeviceCreateInfo create_info;
+};
+
+struct GetDeviceQueueParams {
+    uint64_t device;
+    uint64_t queue;
+    uint32_t queue_family_index;
+    uint32_t queue_index;
+};
+
+// The images are minted by the client too, image_count of them
+struct CreateSwapchainParams {
+    uint64_t device;
+    uint64_t swapchain;
+    uint32_t image_count;
+    uint32_t reserved;
+    uint64_t images[SwapchainRing::MAX_IMAGES];
+    VkSwapchainCreateInfoKHR create_info;
+};
+
+// The client picks image_index itself, by SwapchainRing; the server checks it
+struct AcquireNextImageParams {
+    uint64_t device;
+    uint64_t swapchain;
+    uint64_t timeout;
+    uint64_t semaphore;
+    uint64_t fence;
+    uint32_t image_index;
+    uint32_t reserved;
+};
+
+struct CreateCommandPoolParams {
+    uint64_t device;
+    uint64_t command_pool;
+    VkCommandPoolCreateInfo create_info;
+};
+
+// Followed by command_buffer_count virtual command buffer handles
+struct AllocateCommandBuffersParams {
+    uint64_t device;
+    uint64_t command_pool;
+    uint32_t level;  // VkCommandBufferLevel
+    uint32_t command_buffer_count;
+};
+
+// Followed by command_buffer_count virtual command buffer handles
+struct FreeCommandBuffersParams {
+    uint64_t device;
+    uint64_t command_pool;
+    uint32_t command_buffer_count;
+    uint32_t reserved;
+};
+
+struct BeginCommandBufferParams {
+    uint64_t command_buffer;
+    VkCommandBufferBeginInfo begin_info;
+};
+
+struct ResetCommandBufferParams {
+    uint64_t command_buffer;
+    uint32_t flags;  // VkCommandBufferResetFlags
+    uint32_t reserved;
+};
+
+struct QueueSubmitParams {
+    uint64_t queue;
+    uint64_t fence;
+    uint32_t submit_count;
+    uint32_t reserved;
+    const VkSubmitInfo* submits;
+};
+
+struct QueuePresentParams {
+    uint64_t queue;
+    uint64_t frame_id;      // Minted by the ICD for tracing; FRAME_DATA echoes it
+    VkPresentInfoKHR present_info;
+};
+
+struct WaitForFencesParams {
+    uint64_t device;
+    uint64_t timeout;
+    uint32_t fence_count;
+    VkBool32 wait_all;
+    const VkFence* fences;
+};
+
+struct ResetFencesParams {
+    uint64_t device;
+    uint32_t fence_count;
+    uint32_t reserved;
+    const VkFence* fences;
+};
+
+struct AllocateMemoryParams {
+    uint64_t device;
+    uint64_t memory;
+    VkMemoryAllocateInfo allocate_info;
+};
+
+// Followed by size bytes: what the client wrote to [offset, offset + size)
+// of a mapped allocation
+struct WriteMemoryParams {
+    uint64_t device;
+    uint64_t memory;
+    uint64_t offset;
+    uint64_t size;
+};
+
+// The reply is the size bytes at [offset, offset + size) of a mapped
+// allocation, as the device left them
+struct ReadMemoryParams {
+    uint64_t device;
+    uint64_t memory;
+    uint64_t offset;
+    uint64_t size;
+};
+
+// A vkBeginCommandBuffer..vkEndCommandBuffer span, with its commands
+// packed like a VK_COMMAND_BATCH. In the packed form every record's
+// sequence and leading command buffer handle are zero, so the same
+// commands recorded into another command buffer are the same recording.
+constexpr uint32_t MAX_RECORDINGS = 512;                // Slots on each side
+constexpr uint32_t MAX_RECORDING_SIZE = 64 * 1024;      // Larger spans are sent as they are
+
+// Followed by size bytes of packed records: store them in slot
+// recording_id and record them into command_buffer
+struct RecordingParams {
+    uint64_t command_buffer;
+    uint32_t recording_id;
+    uint32_t size;
+};
+
+// Followed by patch_count patches: record slot recording_id into
+// command_buffer after overwriting the patched bytes, which the slot keeps
+struct ReplayRecordingParams {
+    uint64_t command_buffer;
+    uint32_t recording_id;
+    uint32_t patch_count;
+};
+
+// Followed by size bytes, padded to COMMAND_RECORD_ALIGNMENT
+struct RecordingPatch {
+    uint32_t offset;
+    uint32_t size;
+};
+
+// SHA-256 of a shader's SPIR-V, which the server stores it under
+using ContentHash = std::array<uint8_t, 32>;
+
+// Followed by code_size bytes of SPIR-V, unless has_code is 0 because the
+// server's inventory has it
+struct CreateShaderModuleParams {
+    uint64_t device;
+    uint64_t shader_module;
+    ContentHash hash;
+    uint64_t code_size;
+    uint32_t flags;
+    uint32_t has_code;
+};
+
+// VK_GET_SHADER_INVENTORY reply: followed by count hashes
+struct ShaderInventory {
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct CreateBufferParams {
+    uint64_t device;
+    uint64_t buffer;
+    VkBufferCreateInfo create_info;
+};
+
+struct CreateImageParams {
+    uint64_t device;
+    uint64_t image;
+    VkImageCreateInfo create_info;
+};
+
+struct CreateSemaphoreParams {
+    uint64_t device;
+    uint64_t semaphore;
+    VkSemaphoreCreateInfo create_info;
+};
+
+struct CreateFenceParams {
+    uint64_t device;
+    uint64_t fence;
+    VkFenceCreateInfo create_info;
+};
+
+// vkBindBufferMemory / vkBindImageMemory
+struct BindMemoryParams {
+    uint64_t device;
+    uint64_t object;
+    uint64_t memory;
+    uint64_t memory_offset;
+};
+
+// Destroy/free of a single object; parent is 0 for instances and devices
+struct DestroyObjectParams {
+    uint64_t parent;
+    uint64_t object;
+};
+
+// vkEnumeratePhysicalDevices reply
+struct PhysicalDeviceList {
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t physical_devices[8];
+    uint32_t readback_memory_types[8];  // Bit per memory type that is host cached
+};
+
+template <>
+struct StructTraits<CreateInstanceParams> {
+    static constexpr auto fields() {
+        return std::make_tuple(wire::value(&CreateInstanceParams::create_info));
+    }
+};
+
+template <>
+struct StructTraits<CreateDeviceParams> {
+    static constexpr auto fields() {
+        return std::make_tuple(wire::value(&CreateDeviceParams::create_info));
+    }
+};
+
+template <>
+struct StructTraits<CreateSwapchainParams> {
+    static constexpr auto fields() {
+        return std::make_tuple(wire::value(&CreateSwapchainParams::create_info));
+    }
+};
+
+template <>
+struct StructTraits<CreateCommandPoolParams> {
+    static constexpr auto fields() {
+        return std::make_tuple(wire::value(&CreateCommandPoolParams::create_info));
+    }
+};
+
+template <>
+struct StructTraits<BeginCommandBufferParams> {
+    static constexpr auto fields() {
+        return std::make_tuple(wire::value(&BeginCommandBufferParams::begin_info));
+    }
+};
+
+template <>
+struct StructTraits<QueueSubmitParams> {
+    static constexpr auto fields() {
+        return std::make_tuple(
+            wire::structs(&QueueSubmitParams::submits, &QueueSubmitParams::submit_count));
+    }
+};
+
+template <>
+struct StructTraits<QueuePresentParams> {
+    static constexpr auto fields() {
+        return std::make_tuple(wire::value(&QueuePresentParams::present_info));
+    }
+};
+
+template <>
+struct StructTraits<WaitForFencesParams> {
+    static constexpr auto fields() {
+        return std::make_tuple(
+            wire::handles(&WaitForFencesParams::fences, &WaitForFencesParams::fence_count,
+                HandleType::FENCE));
+    }
+};
+
+template <>
+struct StructTraits<ResetFencesParams> {
+    static constexpr auto fields() {
+        return std::make_tuple(
+            wire::handles(&ResetFencesParams::fences, &ResetFencesParams::fence_count,
+                HandleType::FENCE));
+    }
+};
+
+template <>
+struct StructTraits<AllocateMemoryParams> {
+    static constexpr auto fields() {
+        return std::make_tuple(wire::value(&AllocateMemoryParams::allocate_info));
+    }
+};
+
+template <>
+struct StructTraits<CreateBufferParams> {
+    static constexpr auto fields() {
+        return std::make_tuple(wire::value(&CreateBufferParams::create_info));
+    }
+};
+
+template <>
+struct StructTraits<CreateImageParams> {
+    static constexpr auto fields() {
+        return std::make_tuple(wire::value(&CreateImageParams::create_info));
+    }
+};
+
+template <>
+struct StructTraits<CreateSemaphoreParams> {
+    static constexpr auto fields() {
+        return std::make_tuple(wire::value(&CreateSemaphoreParams::create_info));
+    }
+};
+
+template <>
+struct StructTraits<CreateFenceParams> {
+    static constexpr auto fields() {
+        return std::make_tuple(wire::value(&CreateFenceParams::create_info));
+    }
+};
+
+} // namespace network
+} // namespace anarchy
@@ -1,8 +1,6 @@
 #pragma once
 
 #include <zmq.hpp>
-#include <zlib.h>
-#include <lz4.h>
 #include <string>
 #include <functional>
 #include <thread>
@@ -12,17 +10,19 @@
 #include <chrono>
 #include <vector>
 #include <condition_variable>
+#include <memory>
+#include <array>
+#include <unordered_map>
 #include "common/network/protocol.hpp"
+#include "common/network/buffer_pool.hpp"
+#include "common/network/compression.hpp"
+#include "common/network/compression_policy.hpp"
+#include "common/network/frame_filter.hpp"
+#include "common/network/transport.hpp"
 
 namespace anarchy {
 namespace network {
 
-enum class CompressionLevel {
-    FAST,
-    BALANCED,
-    MAX
-};
-
 // Non-atomic version for returning stats
 struct CompressionStatsData {
     size_t messages_compressed{0};
@@ -31,6 +31,8 @@ struct CompressionStatsData {
     size_t total_bytes_after{0};
     size_t compression_failures{0};
     size_t decompression_failures{0};
+    size_t buffer_allocations{0};       // Pooled buffers that had to be allocated
+    size_t context_initializations{0};  // zlib streams set up (once per thread)
     double average_compression_ratio{0.0};
     std::chrono::microseconds average_compression_time{0};
     std::chrono::microseconds average_decompression_time{0};
@@ -44,6 +46,7 @@ struct CompressionStats {
     std::atomic<size_t> total_bytes_after{0};
     std::atomic<size_t> compression_failures{0};
     std::atomic<size_t> decompression_failures{0};
+    std::atomic<size_t> context_initializations{0};
     std::atomic<double> average_compression_ratio{0.0};
     std::chrono::microseconds average_compression_time{0};
     std::chrono::microseconds average_decompression_time{0};
@@ -57,6 +60,7 @@ struct CompressionStats {
         data.total_bytes_after = total_bytes_after.load();
         data.compression_failures = compression_failures.load();
         data.decompression_failures = decompression_failures.load();
+        data.context_initializations = context_initializations.load();
         data.average_compression_ratio = average_compression_ratio.load();
         data.average_compression_time = average_compression_time;
         data.average_decompression_time = average_decompression_time;
@@ -64,13 +68,49 @@ struct CompressionStats {
     }
 };
 
-class ZMQWrapper {
+// Read-only view of a received payload, valid as long as its ReceivedMessage
+struct PayloadView {
+    const uint8_t* data{nullptr};
+    size_t size{0};
+};
+
+// A received message that references the ZeroMQ frame, or for compressed
+// payloads a pooled decompression buffer, instead of owning a copy. The
+// payload lives as long as the object; move it out of the callback to keep it.
+class ReceivedMessage {
 public:
-    enum class Role {
-        SERVER,
-        CLIENT
-    };
+    ReceivedMessage() = default;
+    ReceivedMessage(const MessageHeader& header, zmq::message_t&& frame);
+    ReceivedMessage(const MessageHeader& header, std::vector<uint8_t>&& buffer,
+        std::shared_ptr<BufferPool> pool);
+    ~ReceivedMessage();
+
+    ReceivedMessage(ReceivedMessage&& other) noexcept;
+    ReceivedMessage& operator=(ReceivedMessage&& other) noexcept;
+    ReceivedMessage(const ReceivedMessage&) = delete;
+    ReceivedMessage& operator=(const ReceivedMessage&) = delete;
+
+    PayloadView payload() const;
+
+    // Owning copy for the Message based API; a pooled buffer is moved out
+    // rather than copied
+    Message toMessage() &&;
 
+    MessageHeader header{};
+    uint64_t peer{0};
+
+private:
+    friend class ZMQWrapper;
+
+    void releaseBuffer();
+
+    zmq::message_t frame_;
+    std::vector<uint8_t> buffer_;
+    std::shared_ptr<BufferPool> pool_;  // Set while buffer_ holds the payload
+};
+
+class ZMQWrapper : public Transport {
+public:
     enum class ConnectionState {
         DISCONNECTED,
         CONNECTING,
@@ -78,50 +118,124 @@ public:
         RECONNECTING
     };
 
-    using MessageCallback = std::function<void(const Message&)>;
-    using ErrorCallback = std::function<void(const std::string&)>;
+    using ZeroCopyCallback = std::function<void(ReceivedMessage&)>;
+    using FreeFunction = void (*)(void* data, void* hint);
 
     static constexpr size_t MAX_MESSAGE_SIZE = 1024 * 1024 * 100;  // 100MB
     static constexpr uint32_t DEFAULT_CONNECTION_TIMEOUT = 5000;    // 5 seconds
     static constexpr uint32_t DEFAULT_HEARTBEAT_INTERVAL = 1000;   // 1 second
     static constexpr uint32_t DEFAULT_MAX_RECONNECT_ATTEMPTS = 5;
     static constexpr uint32_t DEFAULT_RECONNECT_DELAY = 1000;      // 1 second
+    static constexpr int FRAME_SEND_QUEUE = 2;      // Whole frames queued per peer before dropping
+    static constexpr int MAX_MESSAGES_PER_POLL = 64;  // Per channel, so no channel starves the rest
 
+    // Each channel gets its own socket: the server binds ROUTER sockets and
+    // clients connect DEALER sockets that share one routing id. The endpoint
+    // names the control channel; see channelEndpoint() for the others.
     ZMQWrapper(const std::string& endpoint, Role role);
-    ~ZMQWrapper();
-
-    bool start();
-    void stop();
-    bool sendMessage(const Message& message);
-    void setMessageCallback(MessageCallback callback);
-    void setErrorCallback(ErrorCallback callback);
-    bool isConnected() const;
+    ~ZMQWrapper() override;
+
+    // Sockets are only touched by the worker thread: sends are queued and
+    // go out once start() has been called. A true return means queued.
+    bool start() override;
+    void stop() override;
+    bool sendMessage(const Message& message) override;
+    bool sendMessage(Message&& message) override;
+
+    // Send a caller-owned payload without copying it. free_fn(data, hint) is
+    // called exactly once when the payload is no longer needed: before
+    // returning if it was compressed or rejected, otherwise later from the
+    // worker or ZeroMQ I/O thread. The buffer must not be modified until then.
+    // Frames never block the sender: when the peer is behind, the oldest
+    // queued frame is dropped (counted in getDroppedFrames()).
+    bool sendZeroCopy(const MessageHeader& header, void* data, size_t size,
+        FreeFunction free_fn, void* hint, uint64_t peer = 0);
+
+    void setMessageCallback(MessageCallback callback) override;
+    void setZeroCopyCallback(ZeroCopyCallback callback);  // Takes precedence over the Message callback
+    void setErrorCallback(ErrorCallback callback) override;
+    bool isConnected() const override;
     std::string getServerAddress() const;  // Get the server's IP address for client connections
+    size_t getDroppedFrames() const override { return frames_dropped_; }
+    void setBusyPoll(bool enable) override { busy_poll_ = enable; }  // Spins on zmq::poll
+    bool getClockEstimate(uint64_t peer, ClockSync::Estimate& estimate) const override {
+        return clock_sync_.estimate(peer, estimate);
+    }
 
-    // Compression related methods
+    // tcp endpoints use consecutive ports from the given one, anything else
+    // gets a per-channel suffix
+    static std::string channelEndpoint(const std::string& endpoint, Channel channel);
+
+    // Compression related methods. What gets compressed is decided per
+    // message type (see CompressionPolicy); setCompressionType() forces the
+    // codec for the types that are compressed at all.
     void setCompressionType(CompressionType type);
     void setCompressionLevel(CompressionLevel level);
+    void setCompressionRule(MessageType type, CompressionRule rule);
     void enableAdaptiveCompression(bool enable);
     CompressionStatsData getCompressionStats() const;
-    double getCurrentNetworkSpeed() const;
+    double getCurrentNetworkSpeed() const;  // Moving average of send throughput, bytes/s
 
 private:
+    struct ChannelSocket {
+        std::unique_ptr<zmq::socket_t> socket;
+        std::string endpoint;
+    };
+
+    struct OutgoingMessage {
+        MessageHeader header;
+        std::string route;  // ROUTER routing id, server only
+        zmq::message_t payload;
+    };
+
+    enum class ReceiveStatus {
+        EMPTY,
+        RECEIVED,
+        DISCARDED
+    };
+
     void workerThread();
-    void handleMessage(const Message& message);
+    void waitForActivity(std::chrono::milliseconds timeout);
+    void wake();
+    void sendHeartbeats();
+    void flushSendQueue();
+    size_t sendFrames(Channel channel, OutgoingMessage& message);  // Bytes sent
+    ReceiveStatus receiveMessage(Channel channel, ReceivedMessage& message);
+    bool decompressMessage(ReceivedMessage& message);
+    void handleMessage(ReceivedMessage& message);
+    bool canSend(const MessageHeader& header);
+    bool compressPayload(const uint8_t* data, size_t size, MessageHeader& header,
+        zmq::message_t& payload_msg);
+    bool queueMessage(const MessageHeader& header, uint64_t peer, zmq::message_t& payload_msg);
+    size_t dropStaleFrames(std::vector<OutgoingMessage>& queue,
+        std::vector<OutgoingMessage>& stale);  // Frames dropped
+    uint64_t peerForRoute(const zmq::message_t& routing_id);
     void handleError(const std::string& error);
-    bool shouldCompressMessage(size_t message_size) const;
-    CompressionType selectCompressionType(size_t message_size) const;
-    size_t compressData(const uint8_t* input, size_t input_size, uint8_t* output, size_t output_size);
-    size_t decompressData(const uint8_t* input, size_t input_size, uint8_t* output, size_t output_size);
-    void updateNetworkSpeed(size_t bytes_sent);
+    size_t compressData(CompressionType type, const uint8_t* input, size_t input_size,
+                        uint8_t* output, size_t output_size);
+    size_t decompressData(CompressionType type, const uint8_t* input, size_t input_size,
+                          uint8_t* output, size_t output_size);
     void updateCompressionStats(size_t before_size, size_t after_size, 
                               const std::chrono::microseconds& compression_time);
-    void cleanupOldSpeedHistory() const;
 
     std::string endpoint_;
     Role role_;
     zmq::context_t context_;
-    std::unique_ptr<zmq::socket_t> socket_;
+    std::array<ChannelSocket, CHANNEL_COUNT> channels_;
+
+    // Senders queue messages and poke the worker through an inproc pair;
+    // the worker swaps the queues out so neither side reallocates
+    std::array<std::vector<OutgoingMessage>, CHANNEL_COUNT> send_queues_;
+    std::array<std::vector<OutgoingMessage>, CHANNEL_COUNT> send_batch_;
+    std::mutex send_mutex_;
+    bool frame_queue_open_{false};  // Last frame slice queued has more to follow
+    uint64_t handed_frame_{0};      // Newest frame with slices handed to the worker
+    bool frame_handed_{false};
+    std::unique_ptr<zmq::socket_t> wake_send_;
+    std::unique_ptr<zmq::socket_t> wake_recv_;
+    std::mutex wake_mutex_;
+    std::atomic<bool> wake_pending_{false};
+    std::atomic<bool> busy_poll_{false};
     std::thread worker_thread_;
     std::atomic<bool> should_stop_{false};
     std::atomic<bool> connected_{false};
@@ -131,22 +245,38 @@ private:
     std::atomic<uint32_t> reconnect_delay_{DEFAULT_RECONNECT_DELAY};
     std::atomic<uint32_t> connection_timeout_{DEFAULT_CONNECTION_TIMEOUT};
     std::atomic<size_t> messages_received_{0};
-    std::atomic<uint32_t> current_latency_{0};
+    ClockSync clock_sync_;      // Fed by heartbeats
     std::chrono::steady_clock::time_point last_heartbeat_;
+    std::atomic<size_t> frames_dropped_{0};
+
+    // Worker only: frames go out and are delivered a whole frame at a time
+    uint64_t wire_frame_{0};        // Newest frame with a slice sent
+    bool frame_wire_open_{false};   // More of its slices to send
+    uint64_t skipped_frame_{0};     // Frame whose first slice found the socket full
+    bool frame_skipping_{false};
+    FrameFilter frame_filter_;
+    std::vector<ReceivedMessage> frame_slices_;
+    std::vector<ReceivedMessage> frame_deliver_;
+
+    // Server side: ROUTER routing ids of connected clients
+    std::unordered_map<std::string, uint64_t> peer_ids_;
+    std::unordered_map<uint64_t, std::string> peer_routes_;
+    uint64_t next_peer_id_{1};
+    uint64_t last_peer_{0};
+    mutable std::mutex peer_mutex_;
     size_t max_message_size_{MAX_MESSAGE_SIZE};
 
     MessageCallback message_callback_;
+    ZeroCopyCallback zero_copy_callback_;
     ErrorCallback error_callback_;
     mutable std::mutex callback_mutex_;
 
     // Compression related members
-    CompressionType compression_type_{CompressionType::ZLIB};
     CompressionLevel compression_level_{CompressionLevel::BALANCED};
-    bool adaptive_compression_{false};
+    CompressionPolicy compression_policy_;
     CompressionStats compression_stats_;
+    std::shared_ptr<BufferPool> buffer_pool_{std::make_shared<BufferPool>()};
     mutable std::mutex compression_stats_mutex_;
-    mutable std::mutex network_speed_mutex_;
-    mutable std::deque<std::pair<std::chrono::steady_clock::time_point, size_t>> network_speed_history_;
 };
 
 } // namespace network
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace anarchy {
+
+// Bounded queue between one producer thread and one consumer thread, over
+// slots allocated once up front. Nothing is copied or allocated on the way
+// through: the producer fills back() in place and push()es it, the consumer
+// gets the same object from pop(). Slots cycle between producer, queue and
+// consumer, so large members such as vectors keep their capacity.
+//
+// With DROP_OLDEST a push into a full queue discards the oldest entry nobody
+// has popped yet, so a slow consumer sees the newest data instead of a
+// backlog. Producer and consumer never wait for each other; the only
+// contended operation is the claim of the oldest entry when both want it.
+template <typename T>
+class SpscRing {
+public:
+    enum class OverflowPolicy {
+        REJECT,         // push() fails and the producer keeps its slot
+        DROP_OLDEST,    // Latest wins
+    };
+
+    explicit SpscRing(size_t capacity, OverflowPolicy policy = OverflowPolicy::REJECT)
+        : capacity_(capacity > 0 ? capacity : 1)
+        , policy_(policy)
+        , slots_(capacity_ + 2)     // The queue, plus one each for producer and consumer
+        , entries_(new std::atomic<uint32_t>[capacity_])
+        , free_(new std::atomic<uint32_t>[capacity_ + 2])
+    {
+        // The producer starts on slot 0, the rest are free
+        for (uint32_t i = 1; i < slots_.size(); ++i) {
+            free_[i - 1].store(i, std::memory_order_relaxed);
+        }
+        free_head_.store(slots_.size() - 1, std::memory_order_relaxed);
+        for (size_t i = 0; i < capacity_; ++i) {
+            entries_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer: the slot the next push() publishes. Holds whatever it held
+    // when it last went round, so fill in every field that matters.
+    T& back() { return slots_[writing_]; }
+
+    // Producer: publishes back(). Only fails with REJECT on a full queue.
+    bool push() {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        uint64_t tail = tail_.load(std::memory_order_acquire);
+        while (head - tail >= capacity_) {
+            if (policy_ == OverflowPolicy::REJECT) {
+                return false;
+            }
+            // Read the entry before claiming it: once the tail moves past it
+            // the slot may be rewritten. A failed claim reloads the tail, and
+            // the loop rechecks whether the consumer made room meanwhile.
+            uint32_t oldest = entries_[tail % capacity_].load(std::memory_order_relaxed);
+            if (tail_.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel,
+                    std::memory_order_acquire)) {
+                spare_ = oldest;
+                has_spare_ = true;
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+        }
+
+        entries_[head % capacity_].store(writing_, std::memory_order_relaxed);
+        head_.store(head + 1, std::memory_order_release);
+        writing_ = nextWriteSlot();
+        return true;
+    }
+
+    // Consumer: the oldest entry, or nullptr if there is none. It stays
+    // valid, and the consumer's to modify, until the next pop().
+    T* pop() {
+        release();
+
+        uint64_t tail = tail_.load(std::memory_order_acquire);
+        while (tail != head_.load(std::memory_order_acquire)) {
+            uint32_t slot = entries_[tail % capacity_].load(std::memory_order_relaxed);
+            if (tail_.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel,
+                    std::memory_order_acquire)) {
+                reading_ = slot;
+                return &slots_[slot];
+            }
+            // The producer dropped it; tail now holds the new oldest
+        }
+        return nullptr;
+    }
+
+    bool empty() const {
+        return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire);
+    }
+
+    // May be stale by the time it returns if the other side is running
+    size_t size() const {
+        uint64_t tail = tail_.load(std::memory_order_acquire);
+        return static_cast<size_t>(head_.load(std::memory_order_acquire) - tail);
+    }
+
+    size_t capacity() const { return capacity_; }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    // Every slot, for setup before either side starts. Not thread-safe.
+    std::vector<T>& slots() { return slots_; }
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    uint32_t nextWriteSlot() {
+        if (has_spare_) {
+            has_spare_ = false;
+            return spare_;
+        }
+        // There are two more slots than entries and the consumer holds at most
+        // one, so one is always free here. Acquiring the head makes the entry
+        // release() wrote visible.
+        free_head_.load(std::memory_order_acquire);
+        uint64_t tail = free_tail_.load(std::memory_order_relaxed);
+        uint32_t slot = free_[tail % slots_.size()].load(std::memory_order_relaxed);
+        free_tail_.store(tail + 1, std::memory_order_relaxed);
+        return slot;
+    }
+
+    // Hands the previously popped slot back to the producer
+    void release() {
+        if (reading_ == NONE) {
+            return;
+        }
+        uint64_t head = free_head_.load(std::memory_order_relaxed);
+        free_[head % slots_.size()].store(reading_, std::memory_order_relaxed);
+        free_head_.store(head + 1, std::memory_order_release);
+        reading_ = NONE;
+    }
+
+    const size_t capacity_;
+    const OverflowPolicy policy_;
+    std::vector<T> slots_;
+
+    // Published slot indices; tail is claimed by compare-and-swap since a
+    // dropping producer advances it too
+    std::unique_ptr<std::atomic<uint32_t>[]> entries_;
+    alignas(64) std::atomic<uint64_t> head_{0};
+    alignas(64) std::atomic<uint64_t> tail_{0};
+
+    // Slots the consumer is done with, on their way back to the producer
+    std::unique_ptr<std::atomic<uint32_t>[]> free_;
+    alignas(64) std::atomic<uint64_t> free_head_{0};
+    alignas(64) std::atomic<uint64_t> free_tail_{0};
+
+    // Producer only
+    alignas(64) uint32_t writing_{0};
+    uint32_t spare_{0};
+    bool has_spare_{false};
+    std::atomic<uint64_t> dropped_{0};
+
+    // Consumer only
+    alignas(64) uint32_t reading_{NONE};
+};
+
+} // namespace anarchy
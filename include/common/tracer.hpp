@@ -0,0 +1,185 @@
+#pragma once
+
+#include "common/spsc_ring.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace anarchy {
+
+// Where a frame is on its way from vkQueuePresentKHR to the client's window
+enum class TraceStage : uint8_t {
+    PRESENT,    // Client: vkQueuePresentKHR
+    EXECUTE,    // Server: the present, from arrival to its queue work done
+    CAPTURE,    // Server: image copy
+    CONVERT,    // Server: RGB to YUV
+    ENCODE,
+    SEND,       // Server: last piece handed to the transport
+    RECEIVE,    // Client: last piece in
+    DECODE,
+    DISPLAY,    // Client: presented in the window
+};
+
+constexpr size_t TRACE_STAGE_COUNT = 9;
+
+const char* traceStageName(TraceStage stage);
+
+// Microsecond latencies in log-linear buckets, 32 to each power of two, so
+// percentiles are within about 3% whatever the range. Not thread-safe.
+class LatencyHistogram {
+public:
+    static constexpr uint64_t MAX_VALUE = UINT32_MAX;   // Larger values count as this
+
+    void record(uint64_t value);
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    // The smallest value at least p percent of samples are no larger than,
+    // rounded up to its bucket; 0 without samples
+    uint64_t percentile(double p) const;
+
+    uint64_t count() const { return count_; }
+    uint64_t max() const { return max_; }
+    double mean() const { return count_ ? static_cast<double>(sum_) / count_ : 0.0; }
+
+private:
+    static constexpr uint32_t SUB_BUCKET_BITS = 5;
+    static constexpr size_t BUCKET_COUNT = (32 - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+    static size_t bucketIndex(uint64_t value);
+    static uint64_t bucketHighest(size_t index);
+
+    std::array<uint64_t, BUCKET_COUNT> buckets_{};
+    uint64_t count_{0};
+    uint64_t sum_{0};
+    uint64_t max_{0};
+};
+
+// Per-frame trace points on one host. Each thread records into its own
+// ring, so recording is a few stores and never waits; collect() drains the
+// rings into per-stage histograms, the present to display latency of each
+// frame and the recent events kept for writeChromeTrace(). A full ring
+// drops its oldest events. Disabled, a trace point is one relaxed load.
+//
+// Timestamps are microseconds of the local steady clock, the heartbeat
+// clock of the transports. Traces from both hosts line up once the
+// server's are written with its clock offset to the client (ClockSync).
+// Frame ids are minted by the ICD at present and travel with the frame;
+// 0 is a frame nobody assigned one.
+class Tracer {
+public:
+    static constexpr size_t THREAD_EVENTS = 4096;      // Per thread between collections
+    static constexpr size_t KEPT_EVENTS = 65536;       // For writeChromeTrace
+    static constexpr size_t OPEN_FRAMES = 256;         // Presented, not yet displayed
+
+    // Chrome trace pids, so the two hosts' traces can be put in one file
+    static constexpr uint32_t CLIENT_PROCESS = 1;
+    static constexpr uint32_t SERVER_PROCESS = 2;
+
+    struct Event {
+        uint64_t frame_id;
+        int64_t begin;      // us
+        int64_t end;        // Same as begin for an instant
+        TraceStage stage;
+        uint32_t thread;    // Index in order of first record
+    };
+
+    struct StageReport {
+        TraceStage stage;
+        uint64_t count;
+        uint64_t p50;       // us
+        uint64_t p99;
+        uint64_t p999;
+        uint64_t max;
+    };
+
+    struct Report {
+        std::vector<StageReport> stages;    // Spans only, in stage order
+        StageReport end_to_end;             // PRESENT to DISPLAY, stage PRESENT
+        uint64_t events_dropped;
+    };
+
+    Tracer();
+    ~Tracer();
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    // The process's tracer, disabled until enabled
+    static Tracer& global();
+
+    static int64_t time(std::chrono::steady_clock::time_point point) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            point.time_since_epoch()).count();
+    }
+    static int64_t now() { return time(std::chrono::steady_clock::now()); }
+
+    void setEnabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    // From any thread
+    void instant(uint64_t frame_id, TraceStage stage) {
+        if (enabled()) {
+            int64_t time = now();
+            push(frame_id, stage, time, time);
+        }
+    }
+    void span(uint64_t frame_id, TraceStage stage, int64_t begin, int64_t end) {
+        if (enabled()) {
+            push(frame_id, stage, begin, end);
+        }
+    }
+
+    // From any thread; these take a lock between them
+    void collect();
+    Report report();
+    void reset();   // Histograms and kept events
+
+    // Collects, then writes the kept events as Chrome trace JSON (which
+    // Perfetto reads too), timestamps shifted by clock_offset us
+    bool writeChromeTrace(const std::string& path, uint32_t process_id,
+        int64_t clock_offset = 0);
+
+private:
+    struct ThreadBuffer {
+        explicit ThreadBuffer(uint32_t index)
+            : index(index)
+            , ring(THREAD_EVENTS, SpscRing<Event>::OverflowPolicy::DROP_OLDEST)
+        {
+        }
+
+        const uint32_t index;
+        SpscRing<Event> ring;
+    };
+
+    void push(uint64_t frame_id, TraceStage stage, int64_t begin, int64_t end);
+    ThreadBuffer& threadBuffer();
+    void fold(const Event& event);     // collect_mutex_ held
+    StageReport stageReport(TraceStage stage, const LatencyHistogram& histogram) const;
+
+    const uint64_t id_;     // Tells this tracer's thread buffers from another's
+    std::atomic<bool> enabled_{false};
+
+    std::unordered_map<std::thread::id, std::unique_ptr<ThreadBuffer>> buffers_;
+    std::mutex buffers_mutex_;
+
+    // Consumer side
+    std::array<LatencyHistogram, TRACE_STAGE_COUNT> stages_;
+    LatencyHistogram end_to_end_;
+    std::unordered_map<uint64_t, int64_t> open_frames_;    // By id: present time
+    std::deque<uint64_t> open_order_;
+    std::deque<Event> kept_;
+    std::vector<Event> collected_;     // Reused by each collect()
+    std::mutex collect_mutex_;
+};
+
+} // namespace anarchy
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+namespace anarchy {
+namespace server {
+
+// Offsets within one block of device memory, handed out in power-of-two
+// pieces. Every piece is aligned to its own size, which covers the
+// alignment any resource that fits in it can ask for, and a freed piece
+// merges with its buddy straight away, so a block that empties is whole
+// again. Only does the arithmetic; MemoryAllocator owns the memory.
+// Not thread-safe.
+class BuddyAllocator {
+public:
+    static constexpr uint64_t INVALID_OFFSET = ~0ull;
+
+    // Both powers of two, min_size <= size
+    BuddyAllocator(uint64_t size, uint64_t min_size);
+
+    // INVALID_OFFSET if no free piece is large enough
+    uint64_t allocate(uint64_t size);
+    void free(uint64_t offset);
+
+    uint64_t size() const { return size_; }
+    uint64_t used() const { return used_; }     // Rounded up to pieces
+    size_t allocationCount() const { return allocated_.size(); }
+    bool empty() const { return allocated_.empty(); }
+    uint64_t largestFree() const;
+
+private:
+    uint32_t orderFor(uint64_t size) const;
+    uint64_t pieceSize(uint32_t order) const { return min_size_ << order; }
+
+    uint64_t size_;
+    uint64_t min_size_;
+    uint64_t used_{0};
+    std::vector<std::set<uint64_t>> free_;              // Offsets, by order
+    std::unordered_map<uint64_t, uint32_t> allocated_;  // Offset to order
+};
+
+} // namespace server
+} // namespace anarchy
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "common/network/command_stream.hpp"
+#include "common/network/protocol.hpp"
+#include "common/spsc_ring.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace anarchy {
+namespace server {
+
+// Runs the commands of a VK_COMMAND_BATCH across worker threads. Each
+// command comes with a lane: commands on the same lane run in order on the
+// same worker, different lanes run in parallel. Lane IN_ORDER is for
+// everything that must see the effects of all the commands before it
+// (creation, submits, presents): the dispatcher waits for the workers to
+// catch up and runs it on the calling thread, so queue operations keep the
+// order the client issued them in.
+//
+// One thread dispatches; each worker is fed through its own SpscRing, so
+// handing over a command takes no lock and copies the record into a slot
+// that keeps its capacity.
+class CommandDispatcher {
+public:
+    // Runs one command and returns VK_SUCCESS or the VkResult it failed
+    // with. Called from several threads at once, never for the same lane.
+    using Handler = std::function<int32_t(const network::Message& command)>;
+
+    static constexpr uint64_t IN_ORDER = 0;
+    static constexpr size_t QUEUE_DEPTH = 256;     // Commands per worker
+
+    explicit CommandDispatcher(Handler handler, size_t worker_count = defaultWorkerCount());
+    ~CommandDispatcher();
+
+    CommandDispatcher(const CommandDispatcher&) = delete;
+    CommandDispatcher& operator=(const CommandDispatcher&) = delete;
+
+    void dispatch(const network::CommandRecordHeader& record, const uint8_t* payload,
+        uint64_t timestamp, uint64_t lane);
+
+    // Waits for every command dispatched so far and appends the failures,
+    // in sequence order
+    void drain(std::vector<network::CommandFailure>& failures);
+
+    size_t workerCount() const { return workers_.size(); }
+
+    // Leaves a core each for the network thread and the encoder
+    static size_t defaultWorkerCount();
+
+private:
+    struct Worker {
+        Worker() : queue(QUEUE_DEPTH) {}
+
+        SpscRing<network::Message> queue;
+        std::atomic<uint64_t> completed{0};
+        uint64_t dispatched{0};                     // Dispatching thread only
+        std::vector<network::CommandFailure> failures;  // Read once completed catches up
+        std::atomic<bool> sleeping{false};
+        std::mutex sleep_mutex;
+        std::condition_variable wake_cv;
+        std::thread thread;
+    };
+
+    void run(Worker& worker);
+    void fill(network::Message& command, const network::CommandRecordHeader& record,
+        const uint8_t* payload, uint64_t timestamp) const;
+    void addFailure(std::vector<network::CommandFailure>& failures, uint64_t sequence,
+        int32_t result) const;
+
+    Handler handler_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<network::CommandFailure> failures_;  // Of IN_ORDER commands
+    network::Message in_order_;
+    std::atomic<bool> stop_{false};
+};
+
+} // namespace server
+} // namespace anarchy
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace anarchy {
+namespace server {
+
+// Background threads for the slow, self-contained work of shader and
+// pipeline caching (driver compiles, cache files), so the thread running a
+// client's command stream hands it over and moves on. Work is run in the
+// order it was submitted, several at a time; submit() returns a ticket to
+// wait on for the one result that is needed before going further.
+//
+// Tasks must not wait on the pool themselves.
+class CompilePool {
+public:
+    using Task = std::function<void()>;
+    using Ticket = uint64_t;
+
+    explicit CompilePool(size_t thread_count = defaultThreadCount());
+    ~CompilePool();     // Runs what has been submitted first
+
+    CompilePool(const CompilePool&) = delete;
+    CompilePool& operator=(const CompilePool&) = delete;
+
+    Ticket submit(Task task);
+
+    // Until the task has run; at once for tickets already done
+    void wait(Ticket ticket);
+    void waitAll();
+
+    size_t pending() const;     // Queued or running
+    size_t threadCount() const { return threads_.size(); }
+
+    // Half the cores: compiles are heavy, and they share with the workers
+    static size_t defaultThreadCount();
+
+private:
+    void run();
+
+    std::vector<std::thread> threads_;
+    std::deque<std::pair<Ticket, Task>> queue_;
+    std::set<Ticket> pending_;
+    Ticket next_ticket_{1};
+    bool stop_{false};
+    mutable std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+};
+
+} // namespace server
+} // namespace anarchy
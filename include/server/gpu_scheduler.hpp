@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+
+namespace anarchy {
+namespace server {
+
+// Decides whose queue work goes to the GPU next when several clients share
+// it. Each session's work runs in the order it was queued; between
+// sessions the GPU is shared by weighted fair queueing on measured GPU
+// time, so a client with heavy frames gets its share and no more, and a
+// light client's next frame never waits behind a backlog. Only a few jobs
+// are on the GPU at once, which keeps that backlog short.
+//
+// Only the bookkeeping: the caller runs the jobs next() hands out and
+// reports their GPU time through complete(). Not thread-safe.
+class GpuScheduler {
+public:
+    using Job = std::function<void()>;
+
+    // Shares of the GPU, relative to each other
+    enum class Priority : uint8_t {
+        BACKGROUND,
+        NORMAL,
+        INTERACTIVE,
+    };
+
+    static constexpr uint32_t DEFAULT_IN_FLIGHT = 2;
+
+    explicit GpuScheduler(uint32_t max_in_flight = DEFAULT_IN_FLIGHT);
+
+    void addSession(uint64_t session, Priority priority = Priority::NORMAL);
+    // Queued work is dropped, and so is anything queued later; the session
+    // stays until the work it has in flight completes
+    void removeSession(uint64_t session);
+    void setPriority(uint64_t session, Priority priority);
+
+    void enqueue(uint64_t session, Job job);
+
+    // The next job to run, if a slot on the GPU is free
+    bool next(uint64_t& session, Job& job);
+
+    // Work handed out by next() has finished, after gpu_time_ns on the GPU
+    void complete(uint64_t session, uint64_t gpu_time_ns);
+
+    // Nothing queued or in flight
+    bool idle(uint64_t session) const;
+    size_t queued(uint64_t session) const;
+    uint64_t gpuTime(uint64_t session) const;
+    uint32_t inFlight() const { return in_flight_; }
+
+    static uint32_t weight(Priority priority);
+
+private:
+    struct Session {
+        Priority priority{Priority::NORMAL};
+        std::deque<Job> jobs;
+        uint32_t in_flight{0};
+        uint64_t virtual_time{0};       // GPU time divided by weight
+        std::deque<uint64_t> charged;   // Estimates for the jobs in flight, until measured
+        uint64_t estimate{0};           // Recent GPU time per job
+        uint64_t gpu_time{0};           // Measured, in total
+        bool removed{false};
+    };
+
+    uint64_t scaled(const Session& session, uint64_t gpu_time_ns) const;
+    uint64_t minimumVirtualTime() const;
+
+    const uint32_t max_in_flight_;
+    uint32_t in_flight_{0};
+    std::unordered_map<uint64_t, Session> sessions_;
+};
+
+} // namespace server
+} // namespace anarchy
@@ -1,21 +1,54 @@
 #pragma once
 
-#include "common/network/zmq_wrapper.hpp"
+#include "common/network/transport.hpp"
 #include "common/network/protocol.hpp"
+#include "common/network/rate_controller.hpp"
+#include "common/network/vulkan_commands.hpp"
+#include "common/gpu/capture_engine.hpp"
 #include "common/gpu/vulkan_utils.hpp"
+#include "server/command_dispatcher.hpp"
+#include "server/compile_pool.hpp"
+#include "server/gpu_scheduler.hpp"
+#include "server/handle_table.hpp"
+#include "server/memory_allocator.hpp"
+#include "server/shader_cache.hpp"
+#include "server/virtual_swapchain.hpp"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
 #include <memory>
 #include <unordered_map>
 #include <functional>
 #include <mutex>
 #include <string>
 #include <condition_variable>
+#include <thread>
+#include <vector>
 
 namespace anarchy {
 namespace server {
 
 class GPUServer {
 public:
-    GPUServer(const std::string& address);
+    // Clients sharing the GPU at once; more are turned away at CONNECT
+    static constexpr size_t MAX_SESSIONS = 4;
+
+    // What one client holds, for monitoring
+    struct SessionStatistics {
+        uint64_t peer;
+        size_t handle_count;
+        size_t allocation_count;
+        uint64_t memory_bytes;      // Device memory allocated
+        uint64_t gpu_time_ns;       // Queue work, measured
+        uint64_t frames_sent;
+    };
+
+    // How often a session's pipeline cache goes back to disk while it runs
+    static constexpr std::chrono::seconds PIPELINE_CACHE_FLUSH_INTERVAL{30};
+
+    // Shaders and pipeline caches are kept under cache_directory
+    GPUServer(const std::string& address, const std::string& cache_directory = "anarchy_cache");
     ~GPUServer();
 
     // Server lifecycle
@@ -23,65 +56,252 @@ public:
     void stop();
     bool isRunning() const;
 
+    // Device memory held for clients and how well it is packed
+    MemoryAllocator::Statistics getMemoryStatistics();
+    std::vector<SessionStatistics> getSessionStatistics();
+
+    // A client's share of the GPU relative to the others
+    void setPriority(uint64_t peer, GpuScheduler::Priority priority);
+
+    // Encoder tuning for every session; a running capture is set up again
+    // at its next present. ULTRA_LOW_LATENCY streams frames as slices.
+    void setLatencyProfile(gpu::FrameCapture::LatencyProfile profile);
+
     // Command processing
     void processCommand(const network::Message& message);
-    void handleVulkanCommand(const network::Message& message);
-    void handleFrameRequest(const network::Message& message);
 
-    // Vulkan command handlers
-    void handleCreateInstance(const network::Message& message);
-    void handleCreateDevice(const network::Message& message);
-    void handleCreateSwapchain(const network::Message& message);
-    void handleCreateCommandPool(const network::Message& message);
-    void handleCreateCommandBuffer(const network::Message& message);
-    void handleBeginCommandBuffer(const network::Message& message);
-    void handleEndCommandBuffer(const network::Message& message);
-    void handleQueueSubmit(const network::Message& message);
-    void handleAcquireNextImage(const network::Message& message);
-    void handlePresent(const network::Message& message);
+    // Frame trace points go to Tracer::global(), which has to be enabled.
+    // Writes them on peer's clock, so they line up with the client's trace.
+    bool writeTrace(const std::string& path, uint64_t peer);
 
 private:
-    // Vulkan instance and device management
-    std::unique_ptr<gpu::VulkanUtils::Instance> vulkan_instance_;
-    std::unique_ptr<gpu::VulkanUtils::Device> vulkan_device_;
-    std::unique_ptr<gpu::VulkanUtils::Swapchain> vulkan_swapchain_;
-
-    // Network communication
-    std::unique_ptr<network::ZMQWrapper> zmq_;
-    std::string server_address_;
-
-    // Command tracking
-    struct CommandState {
-        vk::CommandBuffer command_buffer;
-        vk::CommandPool command_pool;
-        vk::Queue queue;
+    // Client swapchains, by virtual handle; the handle table maps that to the object
+    struct SwapchainState {
+        std::unique_ptr<VirtualSwapchain> swapchain;
+        std::vector<uint64_t> images;   // Virtual handles, in index order
     };
-    std::unordered_map<uint64_t, CommandState> command_states_;
-    std::mutex command_mutex_;
 
-    // Frame capture
+    // The image a swapchain presented last
     struct FrameState {
         vk::Image image;
         vk::Format format;
         uint32_t width;
         uint32_t height;
+        uint64_t frame_id;      // The client's, for the tracer
+    };
+
+    // Everything one client (transport peer) owns. Clients share
+    // vulkan_device_ but nothing else: each has its own handle table, so
+    // it can neither see nor free another's objects, and its own encoder.
+    struct Session {
+        uint64_t peer{0};
+
+        // Virtual (client-minted) to real handle translation for every object type
+        HandleTable handles;
+        uint64_t physical_device_handle{0};
+        std::unordered_map<uint64_t, SwapchainState> swapchains;
+        std::unordered_map<uint64_t, uint64_t> command_buffer_pools;   // Virtual handles
+
+        // The client's allocations, by virtual handle; handles maps that to
+        // the shared block the allocation lives in. memory_mutex_.
+        std::unordered_map<uint64_t, MemoryAllocator::Allocation> allocations;
+        uint64_t memory_bytes{0};
+
+        // Runs batched commands; only the thread that dispatches touches
+        // command_buffer_pools, since pools are created and freed in order
+        std::unique_ptr<CommandDispatcher> dispatcher;
+
+        // The client's recordings, by slot. Also only touched by the thread
+        // that dispatches, so slots change in the order the client sent
+        // the changes, whichever worker records the commands.
+        std::vector<std::vector<uint8_t>> recordings =
+            std::vector<std::vector<uint8_t>>(network::MAX_RECORDINGS);
+
+        // Shaders and the pipeline cache live on disk under shader_key, set
+        // at VK_CREATE_INSTANCE from the application and the driver. Only
+        // the dispatching thread touches these; the pool writes copies.
+        std::string shader_key;
+        std::map<network::ContentHash, CompilePool::Ticket> shader_stores;
+        vk::PipelineCache pipeline_cache;
+        std::atomic<size_t> pipeline_cache_stored{0};   // Size last written, by the pool
+        CompilePool::Ticket pipeline_cache_flush{0};
+        std::chrono::steady_clock::time_point pipeline_cache_flushed;
+
+        // Queue work fails after its batch was answered, since it runs when
+        // the scheduler gets to it; reported with the next batch.
+        // schedule_mutex_.
+        std::vector<network::CommandFailure> late_failures;
+
+        // Fence waits run here, so a client blocked on its GPU work doesn't
+        // hold up commands from the others
+        std::mutex wait_mutex;
+        std::condition_variable wait_cv;
+        std::deque<network::Message> waits;
+        std::atomic<bool> stop_waiting{false};
+        std::thread wait_thread;
+
+        // Frame capture: presents capture, encode_thread collects the
+        // frames and sends them, so neither the next command nor the next
+        // acquire waits for the encoder. Shared so the thread can finish
+        // with an engine replaced under it. All under frame_mutex.
+        std::mutex frame_mutex;
+        std::unordered_map<uint64_t, FrameState> frame_states;
+        uint64_t last_presented{0};
+        std::shared_ptr<gpu::CaptureEngine> capture;
+        FrameState capture_state{};     // What capture was set up for
+        gpu::FrameCapture::LatencyProfile capture_profile{};
+        std::shared_ptr<network::RateController> rate_controller;  // Fed by FRAME_ACK
+        uint32_t captures_pending{0};
+        bool stop_encoding{false};
+        std::condition_variable capture_cv;
+        std::thread encode_thread;
+        std::atomic<uint64_t> frame_sequence{0};    // Written by encode_thread only
+
+        // Set by FRAME_REQUEST: whose presents to stream
+        bool streaming{false};
+        uint64_t streamed_swapchain{0};     // 0 = all
+    };
+
+    // A marker submitted after a job, signalled when its work is done
+    struct InFlight {
+        uint64_t session;
+        VkFence fence;          // VK_NULL_HANDLE if the marker couldn't be submitted
+        std::chrono::steady_clock::time_point submitted;
     };
-    std::unordered_map<uint64_t, FrameState> frame_states_;
-    std::mutex frame_mutex_;
+
+    // Vulkan instance and device management
+    std::unique_ptr<gpu::VulkanUtils::Instance> vulkan_instance_;
+    std::unique_ptr<gpu::VulkanUtils::Device> vulkan_device_;
+
+    // Client allocations are pieces of blocks shared by every session
+    std::unique_ptr<MemoryAllocator> memory_allocator_;
+    std::mutex memory_mutex_;
+
+    // Shader and pipeline-cache files, written from compile_pool_, which
+    // is declared after it so it finishes with them first
+    ShaderCache shader_cache_;
+    CompilePool compile_pool_;
+
+    // Network communication
+    std::unique_ptr<network::Transport> transport_;
+    std::string server_address_;
+
+    // By transport peer
+    std::unordered_map<uint64_t, std::shared_ptr<Session>> sessions_;
+    std::mutex sessions_mutex_;
+
+    // Queue work (submits, acquires, presents and their captures) from
+    // every session goes through scheduler_, and schedule_thread_ is the
+    // only thread that submits to the queue
+    GpuScheduler scheduler_;
+    std::deque<InFlight> in_flight_;
+    std::vector<VkFence> spare_fences_;
+    std::chrono::steady_clock::time_point last_completion_;
+    bool stop_scheduling_{false};
+    std::mutex schedule_mutex_;
+    std::condition_variable schedule_cv_;
+    std::thread schedule_thread_;
+
+    std::atomic<gpu::FrameCapture::LatencyProfile> latency_profile_{
+        gpu::FrameCapture::LatencyProfile::LOW_LATENCY};
 
     // Server state
     bool running_;
     std::mutex state_mutex_;
     std::condition_variable state_cv_;
 
+    // Sessions
+    std::shared_ptr<Session> findSession(uint64_t peer);
+    std::shared_ptr<Session> openSession(uint64_t peer);   // nullptr when full
+    void closeSession(const std::shared_ptr<Session>& session);
+    void destroySessionObjects(Session& session);
+
+    // Command processing
+    void handleVulkanCommand(Session& session, const network::Message& message);
+    void handleCommandBatch(Session& session, const network::Message& message);
+    void handleFrameRequest(Session& session, const network::Message& message);
+    void handleFrameAck(Session& session, const network::Message& message);
+
+    // Vulkan command handlers
+    void handleCreateInstance(Session& session, const network::Message& message);
+    void handleDestroyInstance(Session& session, const network::Message& message);
+    void handleEnumeratePhysicalDevices(Session& session, const network::Message& message);
+    void handleCreateDevice(Session& session, const network::Message& message);
+    void handleDestroyDevice(Session& session, const network::Message& message);
+    void handleGetDeviceQueue(Session& session, const network::Message& message);
+    void handleCreateSwapchain(Session& session, const network::Message& message);
+    void handleDestroySwapchain(Session& session, const network::Message& message);
+    void handleCreateCommandPool(Session& session, const network::Message& message);
+    void handleDestroyCommandPool(Session& session, const network::Message& message);
+    void handleAllocateCommandBuffers(Session& session, const network::Message& message);
+    void handleFreeCommandBuffers(Session& session, const network::Message& message);
+    void handleBeginCommandBuffer(Session& session, const network::Message& message);
+    void handleEndCommandBuffer(Session& session, const network::Message& message);
+    void handleResetCommandBuffer(Session& session, const network::Message& message);
+    void handleRecording(Session& session, const network::Message& message);
+    void handleQueueSubmit(Session& session, const network::Message& message);
+    void handleQueueWaitIdle(Session& session, const network::Message& message);
+    void handleAcquireNextImage(Session& session, const network::Message& message);
+    void handlePresent(Session& session, const network::Message& message);
+    void handleCreateShaderModule(Session& session, const network::Message& message);
+    void handleDestroyShaderModule(Session& session, const network::Message& message);
+    void handleGetShaderInventory(Session& session, const network::Message& message);
+
+    // Vulkan resource handlers
+    void handleAllocateMemory(Session& session, const network::Message& message);
+    void handleFreeMemory(Session& session, const network::Message& message);
+    void handleWriteMemory(Session& session, const network::Message& message);
+    void handleReadMemory(Session& session, const network::Message& message);
+    void handleCreateBuffer(Session& session, const network::Message& message);
+    void handleDestroyBuffer(Session& session, const network::Message& message);
+    void handleBindBufferMemory(Session& session, const network::Message& message);
+    void handleCreateImage(Session& session, const network::Message& message);
+    void handleDestroyImage(Session& session, const network::Message& message);
+    void handleBindImageMemory(Session& session, const network::Message& message);
+    void handleCreateSemaphore(Session& session, const network::Message& message);
+    void handleDestroySemaphore(Session& session, const network::Message& message);
+    void handleCreateFence(Session& session, const network::Message& message);
+    void handleDestroyFence(Session& session, const network::Message& message);
+    void handleWaitForFences(Session& session, const network::Message& message);
+    void handleResetFences(Session& session, const network::Message& message);
+
+    // Scheduling
+    void scheduleQueueWork(Session& session, const network::Message& message,
+        std::function<void()> work);
+    void waitForSession(const Session& session);
+    void scheduleThread();
+    VkFence submitMarker();
+
+    // Pipeline cache
+    void openPipelineCache(Session& session);
+    void flushPipelineCache(Session& session);     // In the background
+    void closePipelineCache(Session& session);
+
     // Helper functions
+    template <typename T>
+    T& decodeParams(Session& session, const network::Message& message,
+        std::vector<uint8_t>* arena = nullptr);
+    const MemoryAllocator::Allocation& findAllocation(const Session& session,
+        uint64_t memory) const;    // memory_mutex_ held
+    int32_t runDeferredCommand(Session& session, const network::Message& command);   // VkResult
+    void resolveRecording(Session& session, const network::CommandRecordHeader& record,
+        const uint8_t* payload, std::vector<uint8_t>& resolved);   // To a VK_RECORDING payload
+    uint64_t commandLane(const Session& session, const network::CommandRecordHeader& record,
+        const uint8_t* payload) const;
     void sendResponse(const network::Message& original_message, 
         const std::vector<uint8_t>& response_data);
     void sendError(const network::Message& original_message, 
         uint32_t error_code, const std::string& error_message);
+    void sendCommandResult(Session& session, const network::Message& batch,
+        uint64_t last_sequence, std::vector<network::CommandFailure>& failures);
     void handleConnection(const network::Message& message);
     void handleDisconnection(const network::Message& message);
-    void handleHeartbeat(const network::Message& message);
+    bool prepareCapture(Session& session, const FrameState& state);
+    bool queueCapture(Session& session, const FrameState& state);
+    void encodeThread(Session& session);
+    void waitThread(Session& session);
+    void sendFrames(Session& session, gpu::CaptureEngine& capture,
+        network::RateController& rate_controller);
 };
 
 } // namespace server
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "common/network/virtual_handle.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace anarchy {
+namespace server {
+
+// Translates client-minted virtual handles to real server handles.
+// Each handle type owns a directory of fixed-size pages indexed directly by
+// the handle's ID, so a lookup is two array reads without hashing or locks.
+// Pages are allocated on first use and stay put, so readers never see a resize.
+class HandleTable {
+public:
+    static constexpr uint32_t PAGE_BITS = 12;
+    static constexpr size_t PAGE_SIZE = size_t(1) << PAGE_BITS;  // 4096 handles per page
+    static constexpr size_t MAX_PAGES = 4096;                     // 16M handles per type
+
+    HandleTable();
+    ~HandleTable();
+
+    HandleTable(const HandleTable&) = delete;
+    HandleTable& operator=(const HandleTable&) = delete;
+
+    // Returns false if the handle is malformed, out of range or already mapped
+    bool insert(uint64_t virtual_handle, uint64_t real_handle);
+
+    // Returns 0 (VK_NULL_HANDLE) if the handle isn't mapped
+    uint64_t lookup(uint64_t virtual_handle) const;
+
+    // Unmaps the handle and returns the real handle it was mapped to
+    uint64_t remove(uint64_t virtual_handle);
+
+    // Mint a handle on the server, for types the client never creates itself
+    // (physical devices)
+    uint64_t allocate(network::HandleType type, uint64_t real_handle);
+
+    // Drop every mapping, e.g. when the client disconnects
+    void clear();
+
+    // Unmaps every handle of one type and returns the real handles, so a
+    // session's objects can be destroyed when it ends
+    std::vector<uint64_t> take(network::HandleType type);
+
+    size_t size() const { return count_; }
+
+    // Typed helpers for Vulkan C handles
+    template <typename T>
+    bool insert(uint64_t virtual_handle, T real_handle) {
+        return insert(virtual_handle, reinterpret_cast<uint64_t>(real_handle));
+    }
+
+    template <typename T>
+    T get(uint64_t virtual_handle) const {
+        return reinterpret_cast<T>(lookup(virtual_handle));
+    }
+
+private:
+    struct Page {
+        std::atomic<uint64_t> entries[PAGE_SIZE];
+    };
+
+    std::atomic<uint64_t>* slot(uint64_t virtual_handle, bool create);
+
+    std::unique_ptr<std::atomic<Page*>[]> pages_;  // HANDLE_TYPE_COUNT * MAX_PAGES
+    std::mutex page_mutex_;                          // Serializes page allocation
+    std::atomic<uint64_t> next_index_[network::HANDLE_TYPE_COUNT];
+    std::atomic<size_t> count_{0};
+};
+
+} // namespace server
+} // namespace anarchy
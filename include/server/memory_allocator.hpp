@@ -0,0 +1,95 @@
+#pragma once
+
+#include "server/buddy_allocator.hpp"
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace anarchy {
+namespace server {
+
+// Backs the client's vkAllocateMemory calls. Small allocations are pieces
+// of large per-memory-type blocks (BuddyAllocator), so thousands of them
+// cost a handful of driver allocations, stay under
+// maxMemoryAllocationCount, and usually don't call into the driver at all.
+// Large ones, and any with a pNext chain (dedicated, exported, ...), get
+// their own VkDeviceMemory. Host-visible blocks are mapped once, for good.
+// Not thread-safe; the command handlers call it from one thread.
+class MemoryAllocator {
+public:
+    static constexpr vk::DeviceSize BLOCK_SIZE = 64ull << 20;
+    static constexpr vk::DeviceSize MIN_PIECE = 256;   // Raised to bufferImageGranularity
+    static constexpr uint32_t DEDICATED = ~0u;
+
+    struct Allocation {
+        vk::DeviceMemory memory;    // The block, or a dedicated allocation
+        vk::DeviceSize offset;      // Of the allocation within memory
+        vk::DeviceSize size;        // As requested
+        uint8_t* mapped;            // At offset; nullptr unless host visible
+        bool coherent;
+        uint32_t block;             // Index into blocks_, or DEDICATED
+    };
+
+    struct Statistics {
+        uint64_t block_count;
+        uint64_t dedicated_count;
+        uint64_t allocation_count;      // Pieces and dedicated
+        uint64_t reserved_bytes;        // Device memory held
+        uint64_t used_bytes;            // Of that, handed out
+        float fragmentation;            // 1 - largest free piece / free bytes, over blocks
+    };
+
+    MemoryAllocator(vk::Device device, vk::PhysicalDevice physical_device);
+    ~MemoryAllocator();
+
+    MemoryAllocator(const MemoryAllocator&) = delete;
+    MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+    // Throws vk::SystemError, like the handlers that call it
+    Allocation allocate(const VkMemoryAllocateInfo& allocate_info);
+    void free(const Allocation& allocation);
+
+    // Makes host writes to [offset, offset + size) of the allocation visible
+    // to the device; nothing to do for coherent memory
+    void flush(const Allocation& allocation, vk::DeviceSize offset, vk::DeviceSize size);
+
+    // Makes device writes to [offset, offset + size) of the allocation
+    // visible to the host, the other way round
+    void invalidate(const Allocation& allocation, vk::DeviceSize offset, vk::DeviceSize size);
+
+    // Bit per memory type that is host visible and cached, which is where
+    // the host reads back what the device wrote
+    uint32_t readbackMemoryTypes() const;
+
+    // Frees everything at once; the caller makes sure the GPU is done with it
+    void reset();
+
+    Statistics getStatistics() const;
+
+private:
+    struct Block {
+        vk::DeviceMemory memory;
+        uint32_t memory_type;
+        uint8_t* mapped;
+        std::unique_ptr<BuddyAllocator> pieces;   // Null once the block is released
+    };
+
+    vk::DeviceSize blockSize(uint32_t memory_type) const;
+    vk::MappedMemoryRange mappedRange(const Allocation& allocation, vk::DeviceSize offset,
+        vk::DeviceSize size) const;
+    uint32_t createBlock(uint32_t memory_type);
+    void releaseBlock(uint32_t index);
+
+    vk::Device device_;
+    vk::PhysicalDeviceMemoryProperties properties_;
+    vk::DeviceSize min_piece_;  // Buffers and images never share a granularity page
+    vk::DeviceSize atom_size_;  // nonCoherentAtomSize
+    std::vector<Block> blocks_;
+    std::vector<uint32_t> unused_blocks_;   // Released slots in blocks_
+    std::unordered_map<VkDeviceMemory, vk::DeviceSize> dedicated_;
+};
+
+} // namespace server
+} // namespace anarchy
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "common/network/vulkan_commands.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace anarchy {
+namespace server {
+
+// SPIR-V and VkPipelineCache data kept on disk, so a client's next launch
+// uploads no shaders and its pipelines compile from a warm cache. Each
+// application on each driver gets a directory of its own, named for a
+// hash of both, holding shaders/<sha-256>.spv and pipeline_cache.bin.
+// Files are written whole and renamed into place, so a crash mid-write
+// leaves the previous one. Thread-safe.
+class ShaderCache {
+public:
+    explicit ShaderCache(std::string root);
+
+    // Names an application's directory; a new driver starts it afresh
+    static std::string applicationKey(const std::string& application,
+        uint32_t application_version, const std::string& engine, uint32_t engine_version,
+        const uint8_t (&pipeline_cache_uuid)[VK_UUID_SIZE], uint32_t driver_version);
+
+    // False if missing or not what hash says
+    bool loadShader(const std::string& key, const network::ContentHash& hash,
+        std::vector<uint8_t>& code) const;
+    bool storeShader(const std::string& key, const network::ContentHash& hash,
+        const uint8_t* code, size_t size);
+    std::vector<network::ContentHash> shaders(const std::string& key) const;
+
+    bool loadPipelineCache(const std::string& key, std::vector<uint8_t>& data) const;
+    bool storePipelineCache(const std::string& key, const std::vector<uint8_t>& data);
+
+private:
+    std::filesystem::path directory(const std::string& key) const;
+    bool writeFile(const std::filesystem::path& path, const uint8_t* data, size_t size);
+
+    const std::filesystem::path root_;
+    std::atomic<uint64_t> next_temporary_{0};
+};
+
+} // namespace server
+} // namespace anarchy
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "common/network/swapchain_ring.hpp"
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace anarchy {
+namespace server {
+
+// Stands in for a client swapchain. The server has no surface to present
+// to, so the images are plain offscreen images in device memory, and
+// presenting one hands it to frame capture instead. Indices follow
+// network::SwapchainRing, which the client has already stepped through
+// locally: acquire and present only check that the two sides agree, and
+// never wait on the network or the GPU.
+class VirtualSwapchain {
+public:
+    // Throws vk::SystemError, like the handlers that create it
+    VirtualSwapchain(uint64_t handle, vk::Device device, vk::PhysicalDevice physical_device,
+        const VkSwapchainCreateInfoKHR& create_info, uint32_t image_count);
+
+    VirtualSwapchain(const VirtualSwapchain&) = delete;
+    VirtualSwapchain& operator=(const VirtualSwapchain&) = delete;
+
+    // VK_ERROR_OUT_OF_DATE_KHR if the client predicted another index than
+    // the ring gives, i.e. the two have drifted apart
+    void acquire(uint32_t index);
+    void present(uint32_t index);
+
+    uint64_t handle() const { return handle_; }     // The client's virtual handle
+    vk::Image image(uint32_t index) const;
+    const std::vector<vk::Image>& images() const { return images_; }
+    vk::Format format() const { return format_; }
+    vk::Extent2D extent() const { return extent_; }
+
+private:
+    const uint64_t handle_;
+    vk::Format format_;
+    vk::Extent2D extent_;
+    std::vector<vk::UniqueDeviceMemory> memory_;
+    std::vector<vk::UniqueImage> owned_images_;
+    std::vector<vk::Image> images_;
+    network::SwapchainRing ring_;
+};
+
+} // namespace server
+} // namespace anarchy
@@ -0,0 +1,752 @@
+#include "client/frame_decoder.hpp"
+#include "common/tracer.hpp"
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <d3d11_4.h>
+#include <dxgi1_2.h>
+#include <mfapi.h>
+#include <mferror.h>
+#include <mfidl.h>
+#include <mftransform.h>
+#include <wrl/client.h>
+#include <vulkan/vk_icd.h>
+#endif
+
+namespace anarchy {
+namespace client {
+
+#ifdef _WIN32
+
+using Microsoft::WRL::ComPtr;
+
+namespace {
+
+void smooth(double& average, double sample) {
+    static constexpr double alpha = 0.1; // Smoothing factor
+    average = (1.0 - alpha) * average + alpha * sample;
+}
+
+double milliseconds(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+std::chrono::steady_clock::duration frameInterval(uint32_t fps) {
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1.0 / std::max(fps, 1u)));
+}
+
+// Back buffers of the window's swapchain
+constexpr UINT SWAPCHAIN_BUFFERS = 2;
+
+// Decoded pictures alive at once outside the decoder: the jitter buffer's,
+// the one being shown, and the one repeated when the server sends nothing new
+constexpr UINT HELD_PICTURES = JitterBuffer<int>::MAX_DEPTH + 3;
+
+bool decoderSubtype(network::FrameEncoding encoding, GUID& subtype) {
+    switch (encoding) {
+        case network::FrameEncoding::H264:
+            subtype = MFVideoFormat_H264;
+            return true;
+        case network::FrameEncoding::HEVC:
+            subtype = MFVideoFormat_HEVC;
+            return true;
+        case network::FrameEncoding::AV1:
+            subtype = MFVideoFormat_AV1;
+            return true;
+        default:
+            return false;
+    }
+}
+
+DXGI_FORMAT softwareFormat(uint32_t format) {
+    switch (static_cast<VkFormat>(format)) {
+        case VK_FORMAT_B8G8R8A8_UNORM:
+        case VK_FORMAT_B8G8R8A8_SRGB:
+            return DXGI_FORMAT_B8G8R8A8_UNORM;
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+            return DXGI_FORMAT_R8G8B8A8_UNORM;
+        default:
+            return DXGI_FORMAT_UNKNOWN;
+    }
+}
+
+} // namespace
+
+struct FrameDecoder::Platform {
+    // A decoded picture still on the GPU: a slice of a decoder texture
+    // array, or a software frame's upload texture
+    struct Picture {
+        ComPtr<IMFSample> sample;           // Keeps a decoder surface out of reuse
+        ComPtr<ID3D11Texture2D> texture;
+        UINT subresource;
+        UINT width;
+        UINT height;
+        uint64_t sequence;
+        uint64_t frame_id;
+        std::chrono::steady_clock::time_point received;
+    };
+
+    explicit Platform(const Config& config)
+        : jitter(config.jitter_frames, frameInterval(config.fps))
+    {
+    }
+
+    ~Platform() {
+        if (decoder) {
+            decoder->ProcessMessage(MFT_MESSAGE_NOTIFY_END_STREAMING, 0);
+        }
+        jitter.clear();
+        last = Picture{};
+        decoder.Reset();
+        device_manager.Reset();
+        if (mf_started) {
+            MFShutdown();
+        }
+    }
+
+    bool mf_started{false};
+    ComPtr<ID3D11Device> device;
+    ComPtr<ID3D11DeviceContext> context;
+    ComPtr<ID3D11VideoDevice> video_device;
+    ComPtr<ID3D11VideoContext> video_context;
+    ComPtr<IDXGISwapChain1> swapchain;
+    ComPtr<ID3D11VideoProcessorOutputView> output_view;
+
+    // Recreated when the picture size changes
+    ComPtr<ID3D11VideoProcessorEnumerator> processor_enum;
+    ComPtr<ID3D11VideoProcessor> processor;
+    UINT processor_width{0};
+    UINT processor_height{0};
+
+    // Media Foundation decoder, for the encoding it was created for
+    ComPtr<IMFDXGIDeviceManager> device_manager;
+    UINT reset_token{0};
+    ComPtr<IMFTransform> decoder;
+    network::FrameEncoding decoder_encoding{network::FrameEncoding::NONE};
+    UINT output_width{0};
+    UINT output_height{0};
+    LONGLONG sample_duration{0};        // 100ns units
+
+    // Software frames, a few so the jitter buffer can hold them
+    std::vector<ComPtr<ID3D11Texture2D>> upload_textures;
+    size_t next_upload{0};
+
+    JitterBuffer<Picture> jitter;
+    Picture last{};
+    UINT frame_index{0};
+
+    bool createSwapchain(const Config& config);
+    bool createDecoder(network::FrameEncoding encoding, const Config& config);
+    bool setOutputType();
+    bool drainDecoder(std::vector<Picture>& pictures);
+    bool uploadSoftware(const gpu::SoftwareDecoder& software, Picture& picture);
+    bool ensureProcessor(UINT width, UINT height, const Config& config);
+    bool present(const Picture& picture, const Config& config);
+};
+
+bool FrameDecoder::Platform::createSwapchain(const Config& config) {
+    ComPtr<IDXGIDevice> dxgi_device;
+    ComPtr<IDXGIAdapter> adapter;
+    ComPtr<IDXGIFactory2> factory;
+    if (FAILED(device.As(&dxgi_device)) || FAILED(dxgi_device->GetAdapter(&adapter)) ||
+        FAILED(adapter->GetParent(IID_PPV_ARGS(&factory)))) {
+        return false;
+    }
+
+    // Flip model: the compositor takes the back buffer as is, no extra copy
+    DXGI_SWAP_CHAIN_DESC1 desc = {};
+    desc.Width = config.width;
+    desc.Height = config.height;
+    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    desc.SampleDesc.Count = 1;
+    desc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+    desc.BufferCount = SWAPCHAIN_BUFFERS;
+    desc.Scaling = DXGI_SCALING_STRETCH;
+    desc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+    desc.AlphaMode = DXGI_ALPHA_MODE_IGNORE;
+
+    HWND window = static_cast<HWND>(config.window);
+    if (FAILED(factory->CreateSwapChainForHwnd(device.Get(), window, &desc,
+            nullptr, nullptr, &swapchain))) {
+        return false;
+    }
+    factory->MakeWindowAssociation(window, DXGI_MWA_NO_ALT_ENTER);
+    return true;
+}
+
+bool FrameDecoder::Platform::createDecoder(network::FrameEncoding encoding, const Config& config) {
+    decoder.Reset();
+    decoder_encoding = network::FrameEncoding::NONE;
+
+    GUID subtype;
+    if (!decoderSubtype(encoding, subtype)) {
+        return false;
+    }
+
+    MFT_REGISTER_TYPE_INFO input_info = {MFMediaType_Video, subtype};
+    MFT_REGISTER_TYPE_INFO output_info = {MFMediaType_Video, MFVideoFormat_NV12};
+    IMFActivate** activates = nullptr;
+    UINT32 count = 0;
+    if (FAILED(MFTEnumEx(MFT_CATEGORY_VIDEO_DECODER,
+            MFT_ENUM_FLAG_SYNCMFT | MFT_ENUM_FLAG_SORTANDFILTER,
+            &input_info, &output_info, &activates, &count))) {
+        return false;
+    }
+
+    // The first that decodes into D3D11 textures; the others would copy
+    // every picture through system memory
+    for (UINT32 i = 0; i < count; i++) {
+        ComPtr<IMFTransform> candidate;
+        ComPtr<IMFAttributes> attributes;
+        if (!decoder && SUCCEEDED(activates[i]->ActivateObject(IID_PPV_ARGS(&candidate))) &&
+            SUCCEEDED(candidate->GetAttributes(&attributes)) &&
+            MFGetAttributeUINT32(attributes.Get(), MF_SA_D3D11_AWARE, FALSE) &&
+            SUCCEEDED(candidate->ProcessMessage(MFT_MESSAGE_SET_D3D_MANAGER,
+                reinterpret_cast<ULONG_PTR>(device_manager.Get())))) {
+            attributes->SetUINT32(MF_LOW_LATENCY, TRUE);
+            decoder = candidate;
+        }
+        activates[i]->Release();
+    }
+    CoTaskMemFree(activates);
+    if (!decoder) {
+        return false;
+    }
+
+    ComPtr<IMFMediaType> input_type;
+    if (FAILED(MFCreateMediaType(&input_type))) {
+        return false;
+    }
+    input_type->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+    input_type->SetGUID(MF_MT_SUBTYPE, subtype);
+    input_type->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
+    MFSetAttributeSize(input_type.Get(), MF_MT_FRAME_SIZE, config.width, config.height);
+    MFSetAttributeRatio(input_type.Get(), MF_MT_FRAME_RATE, std::max(config.fps, 1u), 1);
+    if (FAILED(decoder->SetInputType(0, input_type.Get(), 0)) || !setOutputType()) {
+        decoder.Reset();
+        return false;
+    }
+
+    // The decoder's surface pool has to outlast the pictures held here
+    ComPtr<IMFAttributes> output_attributes;
+    if (SUCCEEDED(decoder->GetOutputStreamAttributes(0, &output_attributes))) {
+        output_attributes->SetUINT32(MF_SA_MINIMUM_OUTPUT_SAMPLE_COUNT, HELD_PICTURES);
+    }
+
+    if (FAILED(decoder->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, 0)) ||
+        FAILED(decoder->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0))) {
+        decoder.Reset();
+        return false;
+    }
+    sample_duration = 10000000LL / std::max(config.fps, 1u);
+    decoder_encoding = encoding;
+    return true;
+}
+
+bool FrameDecoder::Platform::setOutputType() {
+    ComPtr<IMFMediaType> type;
+    for (DWORD i = 0; SUCCEEDED(decoder->GetOutputAvailableType(0, i, &type)); i++) {
+        GUID subtype;
+        if (SUCCEEDED(type->GetGUID(MF_MT_SUBTYPE, &subtype)) && subtype == MFVideoFormat_NV12 &&
+            SUCCEEDED(decoder->SetOutputType(0, type.Get(), 0))) {
+            // Surfaces are padded to the macroblock size; the aperture is the picture
+            UINT32 width = 0;
+            UINT32 height = 0;
+            MFGetAttributeSize(type.Get(), MF_MT_FRAME_SIZE, &width, &height);
+            MFVideoArea aperture = {};
+            if (SUCCEEDED(type->GetBlob(MF_MT_MINIMUM_DISPLAY_APERTURE,
+                    reinterpret_cast<UINT8*>(&aperture), sizeof(aperture), nullptr))) {
+                width = static_cast<UINT32>(aperture.Area.cx);
+                height = static_cast<UINT32>(aperture.Area.cy);
+            }
+            output_width = width;
+            output_height = height;
+            return true;
+        }
+        type.Reset();
+    }
+    return false;
+}
+
+bool FrameDecoder::Platform::drainDecoder(std::vector<Picture>& pictures) {
+    for (;;) {
+        MFT_OUTPUT_DATA_BUFFER output = {};
+        DWORD status = 0;
+        HRESULT hr = decoder->ProcessOutput(0, 1, &output, &status);
+        if (output.pEvents) {
+            output.pEvents->Release();
+        }
+        if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT) {
+            return true;
+        }
+        if (hr == MF_E_TRANSFORM_STREAM_CHANGE) {
+            // New size from the server's rate control, or the real one
+            // after a guess from the swapchain
+            if (!setOutputType()) {
+                return false;
+            }
+            continue;
+        }
+
+        ComPtr<IMFSample> sample;
+        sample.Attach(output.pSample);
+        if (FAILED(hr) || !sample) {
+            return false;
+        }
+
+        ComPtr<IMFMediaBuffer> buffer;
+        ComPtr<IMFDXGIBuffer> dxgi_buffer;
+        Picture picture{};
+        if (FAILED(sample->GetBufferByIndex(0, &buffer)) || FAILED(buffer.As(&dxgi_buffer)) ||
+            FAILED(dxgi_buffer->GetResource(IID_PPV_ARGS(&picture.texture))) ||
+            FAILED(dxgi_buffer->GetSubresourceIndex(&picture.subresource))) {
+            return false;
+        }
+        LONGLONG time = 0;
+        sample->GetSampleTime(&time);
+        picture.sample = sample;
+        picture.width = output_width;
+        picture.height = output_height;
+        picture.sequence = static_cast<uint64_t>(time / sample_duration);
+        pictures.push_back(std::move(picture));
+    }
+}
+
+bool FrameDecoder::Platform::uploadSoftware(const gpu::SoftwareDecoder& software, Picture& picture) {
+    DXGI_FORMAT format = softwareFormat(software.format());
+    if (format == DXGI_FORMAT_UNKNOWN) {
+        return false;
+    }
+
+    if (upload_textures.empty()) {
+        upload_textures.resize(HELD_PICTURES);
+    }
+    ComPtr<ID3D11Texture2D>& texture = upload_textures[next_upload];
+    next_upload = (next_upload + 1) % upload_textures.size();
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    if (texture) {
+        texture->GetDesc(&desc);
+    }
+    if (!texture || desc.Width != software.width() || desc.Height != software.height() ||
+        desc.Format != format) {
+        desc = {};
+        desc.Width = software.width();
+        desc.Height = software.height();
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = format;
+        desc.SampleDesc.Count = 1;
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+        texture.Reset();
+        if (FAILED(device->CreateTexture2D(&desc, nullptr, &texture))) {
+            return false;
+        }
+    }
+
+    // The one copy a software frame takes: its pixels have to reach the GPU
+    context->UpdateSubresource(texture.Get(), 0, nullptr, software.pixels().data(),
+        software.width() * 4, 0);
+    picture.texture = texture;
+    picture.subresource = 0;
+    picture.width = software.width();
+    picture.height = software.height();
+    return true;
+}
+
+bool FrameDecoder::Platform::ensureProcessor(UINT width, UINT height, const Config& config) {
+    if (processor && processor_width == width && processor_height == height) {
+        return true;
+    }
+    processor.Reset();
+    processor_enum.Reset();
+
+    D3D11_VIDEO_PROCESSOR_CONTENT_DESC content = {};
+    content.InputFrameFormat = D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE;
+    content.InputFrameRate = {std::max(config.fps, 1u), 1};
+    content.InputWidth = width;
+    content.InputHeight = height;
+    content.OutputFrameRate = content.InputFrameRate;
+    content.OutputWidth = config.width;
+    content.OutputHeight = config.height;
+    content.Usage = D3D11_VIDEO_USAGE_OPTIMAL_SPEED;
+    if (FAILED(video_device->CreateVideoProcessorEnumerator(&content, &processor_enum)) ||
+        FAILED(video_device->CreateVideoProcessor(processor_enum.Get(), 0, &processor))) {
+        return false;
+    }
+
+    // The back buffer never changes identity under the flip model, so one
+    // output view serves every present
+    if (!output_view) {
+        ComPtr<ID3D11Texture2D> back_buffer;
+        D3D11_VIDEO_PROCESSOR_OUTPUT_VIEW_DESC output_desc = {};
+        output_desc.ViewDimension = D3D11_VPOV_DIMENSION_TEXTURE2D;
+        if (FAILED(swapchain->GetBuffer(0, IID_PPV_ARGS(&back_buffer))) ||
+            FAILED(video_device->CreateVideoProcessorOutputView(back_buffer.Get(),
+                processor_enum.Get(), &output_desc, &output_view))) {
+            processor.Reset();
+            return false;
+        }
+    }
+
+    // What NVENC produces; RGB input ignores the YCbCr fields
+    D3D11_VIDEO_PROCESSOR_COLOR_SPACE input_space = {};
+    input_space.YCbCr_Matrix = 1;   // BT.709
+    input_space.Nominal_Range = D3D11_VIDEO_PROCESSOR_NOMINAL_RANGE_16_235;
+    D3D11_VIDEO_PROCESSOR_COLOR_SPACE output_space = {};
+    output_space.Nominal_Range = D3D11_VIDEO_PROCESSOR_NOMINAL_RANGE_0_255;
+    video_context->VideoProcessorSetStreamColorSpace(processor.Get(), 0, &input_space);
+    video_context->VideoProcessorSetOutputColorSpace(processor.Get(), &output_space);
+    video_context->VideoProcessorSetStreamAutoProcessingMode(processor.Get(), 0, FALSE);
+    video_context->VideoProcessorSetStreamFrameFormat(processor.Get(), 0,
+        D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE);
+
+    RECT source = {0, 0, static_cast<LONG>(width), static_cast<LONG>(height)};
+    RECT target = {0, 0, static_cast<LONG>(config.width), static_cast<LONG>(config.height)};
+    video_context->VideoProcessorSetStreamSourceRect(processor.Get(), 0, TRUE, &source);
+    video_context->VideoProcessorSetStreamDestRect(processor.Get(), 0, TRUE, &target);
+    video_context->VideoProcessorSetOutputTargetRect(processor.Get(), TRUE, &target);
+
+    processor_width = width;
+    processor_height = height;
+    return true;
+}
+
+bool FrameDecoder::Platform::present(const Picture& picture, const Config& config) {
+    if (!ensureProcessor(picture.width, picture.height, config)) {
+        return false;
+    }
+
+    // Straight from the decoder's texture array into the back buffer
+    D3D11_VIDEO_PROCESSOR_INPUT_VIEW_DESC input_desc = {};
+    input_desc.ViewDimension = D3D11_VPIV_DIMENSION_TEXTURE2D;
+    input_desc.Texture2D.ArraySlice = picture.subresource;
+    ComPtr<ID3D11VideoProcessorInputView> input_view;
+    if (FAILED(video_device->CreateVideoProcessorInputView(picture.texture.Get(),
+            processor_enum.Get(), &input_desc, &input_view))) {
+        return false;
+    }
+
+    D3D11_VIDEO_PROCESSOR_STREAM stream = {};
+    stream.Enable = TRUE;
+    stream.pInputSurface = input_view.Get();
+    if (FAILED(video_context->VideoProcessorBlt(processor.Get(), output_view.Get(),
+            frame_index++, 1, &stream))) {
+        return false;
+    }
+
+    // No vsync wait: the jitter buffer already paced it
+    return SUCCEEDED(swapchain->Present(0, 0));
+}
+
+FrameDecoder::FrameDecoder(const Config& config)
+    : config_(config)
+    , jitter_frames_(config.jitter_frames)
+{
+}
+
+bool FrameDecoder::initialize() {
+    if (running_ || !config_.window) {
+        return false;
+    }
+
+    auto platform = std::make_unique<Platform>(config_);
+    if (FAILED(MFStartup(MF_VERSION, MFSTARTUP_LITE))) {
+        return false;
+    }
+    platform->mf_started = true;
+
+    // Video support for the decoder and the video processor, BGRA for the swapchain
+    UINT flags = D3D11_CREATE_DEVICE_VIDEO_SUPPORT | D3D11_CREATE_DEVICE_BGRA_SUPPORT;
+    D3D_FEATURE_LEVEL levels[] = {D3D_FEATURE_LEVEL_11_1, D3D_FEATURE_LEVEL_11_0};
+    if (FAILED(D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, flags,
+            levels, ARRAYSIZE(levels), D3D11_SDK_VERSION,
+            &platform->device, nullptr, &platform->context)) ||
+        FAILED(platform->device.As(&platform->video_device)) ||
+        FAILED(platform->context.As(&platform->video_context))) {
+        return false;
+    }
+
+    // Media Foundation uses the device from its own threads
+    ComPtr<ID3D11Multithread> multithread;
+    if (SUCCEEDED(platform->device.As(&multithread))) {
+        multithread->SetMultithreadProtected(TRUE);
+    }
+    if (FAILED(MFCreateDXGIDeviceManager(&platform->reset_token, &platform->device_manager)) ||
+        FAILED(platform->device_manager->ResetDevice(platform->device.Get(),
+            platform->reset_token))) {
+        return false;
+    }
+
+    if (!platform->createSwapchain(config_)) {
+        return false;
+    }
+
+    platform_ = std::move(platform);
+    running_ = true;
+    thread_ = std::thread(&FrameDecoder::decodeThread, this);
+    return true;
+}
+
+void FrameDecoder::decodeThread() {
+    // MFTEnumEx and the decoder are COM
+    CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+    while (running_) {
+        EncodedFrame frame;
+        bool have_frame = false;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            auto due = platform_->jitter.nextDue();
+            auto ready = [this]() { return !running_ || !queue_.empty(); };
+            if (due == std::chrono::steady_clock::time_point::max()) {
+                queue_cv_.wait(lock, ready);
+            } else {
+                queue_cv_.wait_until(lock, due, ready);
+            }
+            if (!running_) {
+                break;
+            }
+            if (!queue_.empty()) {
+                frame = std::move(queue_.front());
+                queue_.pop_front();
+                have_frame = true;
+            }
+        }
+
+        if (have_frame) {
+            platform_->jitter.setDepth(jitter_frames_);
+            bool decoded = decodeFrame(frame);
+            buffer_pool_.release(std::move(frame.data));
+
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            if (!decoded) {
+                stats_.decode_errors++;
+            }
+        }
+        presentDue(std::chrono::steady_clock::now());
+    }
+
+    platform_->jitter.clear();
+    CoUninitialize();
+}
+
+bool FrameDecoder::decodeFrame(EncodedFrame& frame) {
+    Platform& platform = *platform_;
+    auto submitted = std::chrono::steady_clock::now();
+    std::vector<Platform::Picture> pictures;
+
+    if (frame.data.empty()) {
+        // The server saw no change: show the last picture again
+        if (!platform.last.texture) {
+            return true;
+        }
+        Platform::Picture repeat = platform.last;
+        repeat.sequence = frame.sequence;
+        pictures.push_back(std::move(repeat));
+    } else if (frame.encoding == network::FrameEncoding::SOFTWARE) {
+        Platform::Picture picture{};
+        if (!software_decoder_.decode(frame.data.data(), frame.data.size()) ||
+            !platform.uploadSoftware(software_decoder_, picture)) {
+            return false;
+        }
+        picture.sequence = frame.sequence;
+        pictures.push_back(std::move(picture));
+    } else {
+        if (platform.decoder_encoding != frame.encoding &&
+            !platform.createDecoder(frame.encoding, config_)) {
+            return false;
+        }
+
+        ComPtr<IMFMediaBuffer> buffer;
+        ComPtr<IMFSample> sample;
+        BYTE* data = nullptr;
+        if (FAILED(MFCreateMemoryBuffer(static_cast<DWORD>(frame.data.size()), &buffer)) ||
+            FAILED(buffer->Lock(&data, nullptr, nullptr))) {
+            return false;
+        }
+        std::memcpy(data, frame.data.data(), frame.data.size());
+        buffer->Unlock();
+        buffer->SetCurrentLength(static_cast<DWORD>(frame.data.size()));
+        if (FAILED(MFCreateSample(&sample)) || FAILED(sample->AddBuffer(buffer.Get()))) {
+            return false;
+        }
+
+        // The sequence rides through the decoder as the timestamp
+        sample->SetSampleTime(static_cast<LONGLONG>(frame.sequence) * platform.sample_duration);
+        sample->SetSampleDuration(platform.sample_duration);
+
+        HRESULT hr = platform.decoder->ProcessInput(0, sample.Get(), 0);
+        if (hr == MF_E_NOTACCEPTING) {
+            if (!platform.drainDecoder(pictures)) {
+                return false;
+            }
+            hr = platform.decoder->ProcessInput(0, sample.Get(), 0);
+        }
+        if (FAILED(hr) || !platform.drainDecoder(pictures)) {
+            return false;
+        }
+    }
+
+    auto decoded = std::chrono::steady_clock::now();
+    Tracer::global().span(frame.frame_id, TraceStage::DECODE, Tracer::time(submitted),
+        Tracer::time(decoded));
+    for (Platform::Picture& picture : pictures) {
+        // A hardware decoder may hand back an earlier frame's picture
+        if (picture.sequence == frame.sequence) {
+            picture.frame_id = frame.frame_id;
+        }
+        picture.received = frame.received;
+        platform.jitter.push(picture, decoded);
+    }
+    if (!pictures.empty()) {
+        platform.last = pictures.back();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.frames_decoded += pictures.size();
+        smooth(stats_.average_decode_time, milliseconds(decoded - submitted));
+        stats_.frames_dropped = platform.jitter.dropped() + incomplete_frames_;
+    }
+
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    if (callback_) {
+        callback_(frame.sequence);
+    }
+    return true;
+}
+
+void FrameDecoder::presentDue(std::chrono::steady_clock::time_point now) {
+    Platform::Picture picture;
+    if (!platform_->jitter.pop(now, picture)) {
+        return;
+    }
+    bool presented = platform_->present(picture, config_);
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    if (presented) {
+        Tracer::global().instant(picture.frame_id, TraceStage::DISPLAY);
+        stats_.frames_presented++;
+        smooth(stats_.average_latency,
+            milliseconds(std::chrono::steady_clock::now() - picture.received));
+    }
+    stats_.frames_dropped = platform_->jitter.dropped() + incomplete_frames_;
+}
+
+void* FrameDecoder::windowFromSurface(VkSurfaceKHR surface) {
+    // The loader makes surfaces for ICDs that don't, as VkIcdSurface structs
+    auto* base = reinterpret_cast<VkIcdSurfaceBase*>(surface);
+    if (!base || base->platform != VK_ICD_WSI_PLATFORM_WIN32) {
+        return nullptr;
+    }
+    return reinterpret_cast<VkIcdSurfaceWin32*>(surface)->hwnd;
+}
+
+#else
+
+struct FrameDecoder::Platform {};
+
+FrameDecoder::FrameDecoder(const Config& config)
+    : config_(config)
+    , jitter_frames_(config.jitter_frames)
+{
+}
+
+bool FrameDecoder::initialize() {
+    // Decoding and presenting need D3D11 and Media Foundation
+    return false;
+}
+
+void FrameDecoder::decodeThread() {}
+
+bool FrameDecoder::decodeFrame(EncodedFrame&) {
+    return false;
+}
+
+void FrameDecoder::presentDue(std::chrono::steady_clock::time_point) {}
+
+void* FrameDecoder::windowFromSurface(VkSurfaceKHR) {
+    return nullptr;
+}
+
+#endif
+
+FrameDecoder::~FrameDecoder() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        running_ = false;
+    }
+    queue_cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void FrameDecoder::onFrameData(const network::Message& message) {
+    if (!running_) {
+        return;
+    }
+
+    // A frame is done when a slice arrives without the partial flag; a new
+    // sequence before that means the rest was lost
+    if (assembling_active_ && assembling_.sequence != message.header.sequence) {
+        buffer_pool_.release(std::move(assembling_.data));
+        assembling_active_ = false;
+        incomplete_frames_++;
+    }
+
+    size_t offset = 0;
+    if (!assembling_active_) {
+        assembling_.sequence = message.header.sequence;
+        assembling_.frame_id = message.header.request_id;
+        assembling_.encoding = message.header.frameEncoding();
+        assembling_.data = buffer_pool_.acquire(message.payload.size());
+        assembling_active_ = true;
+    } else {
+        offset = assembling_.data.size();
+        assembling_.data.resize(offset + message.payload.size());
+    }
+    if (!message.payload.empty()) {
+        std::memcpy(assembling_.data.data() + offset, message.payload.data(),
+            message.payload.size());
+    }
+    if (message.header.flags & network::HEADER_FLAG_PARTIAL_FRAME) {
+        return;
+    }
+
+    assembling_.received = std::chrono::steady_clock::now();
+    assembling_active_ = false;
+    Tracer::global().instant(assembling_.frame_id, TraceStage::RECEIVE);
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        queue_.push_back(std::move(assembling_));
+    }
+    queue_cv_.notify_one();
+    assembling_ = EncodedFrame{};
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.frames_received++;
+}
+
+void FrameDecoder::setFrameCallback(FrameCallback callback) {
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    callback_ = std::move(callback);
+}
+
+void FrameDecoder::setJitterFrames(uint32_t frames) {
+    jitter_frames_ = std::min(frames, JitterBuffer<int>::MAX_DEPTH);
+}
+
+FrameDecoder::Statistics FrameDecoder::getStatistics() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+} // namespace client
+} // namespace anarchy
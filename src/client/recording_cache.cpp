@@ -0,0 +1,257 @@
+#include "client/recording_cache.hpp"
+#include "common/network/command_stream.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+namespace anarchy {
+namespace client {
+
+namespace {
+
+std::atomic<uint64_t> next_pool_id{1};
+
+// Pools by id, so an exiting thread can tell which of the pools it used
+// still exist
+std::mutex live_pools_mutex;
+std::unordered_map<uint64_t, RecordingCachePool*> live_pools;
+
+// FNV-1a
+uint64_t hashBytes(const uint8_t* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// What the commands are, not what they were given
+uint64_t hashShape(const std::vector<uint8_t>& recording) {
+    uint64_t hash = hashBytes(nullptr, 0);
+    size_t offset = 0;
+    while (recording.size() - offset >= sizeof(network::CommandRecordHeader)) {
+        network::CommandRecordHeader header;
+        std::memcpy(&header, recording.data() + offset, sizeof(header));
+        hash = hashBytes(reinterpret_cast<const uint8_t*>(&header.type), sizeof(header.type), hash);
+        hash = hashBytes(reinterpret_cast<const uint8_t*>(&header.size), sizeof(header.size), hash);
+        offset += network::commandRecordSize(header.size);
+        if (offset > recording.size()) {
+            break;
+        }
+    }
+    uint64_t size = recording.size();
+    return hashBytes(reinterpret_cast<const uint8_t*>(&size), sizeof(size), hash);
+}
+
+uint32_t paddedSize(uint32_t size) {
+    return static_cast<uint32_t>((size + network::COMMAND_RECORD_ALIGNMENT - 1) &
+        ~(network::COMMAND_RECORD_ALIGNMENT - 1));
+}
+
+} // namespace
+
+RecordingCache::RecordingCache(uint32_t first_id, uint32_t capacity)
+    : first_id_(first_id)
+    , slots_(std::max(capacity, 1u))
+{
+}
+
+RecordingCache::Lookup RecordingCache::lookup(const std::vector<uint8_t>& recording) {
+    Lookup result = {};
+    uint64_t hash = hashBytes(recording.data(), recording.size());
+    uint64_t shape = hashShape(recording);
+    statistics_.bytes_recorded += recording.size();
+
+    // Recorded exactly like this before
+    auto exact = by_hash_.find(hash);
+    if (exact != by_hash_.end() && slots_[exact->second].data == recording) {
+        result.replay = true;
+        result.id = first_id_ + exact->second;
+        slots_[exact->second].last_use = ++clock_;
+        statistics_.replays++;
+        statistics_.bytes_sent += sizeof(network::ReplayRecordingParams);
+        return result;
+    }
+
+    // The same commands with other parameters: the slot takes the new ones
+    auto similar = by_shape_.find(shape);
+    if (similar != by_shape_.end() && diff(slots_[similar->second], recording, result.patches)) {
+        result.replay = true;
+        result.id = first_id_ + similar->second;
+        store(similar->second, recording, hash, shape);
+        statistics_.replays++;
+        statistics_.patched_replays++;
+        statistics_.bytes_sent += sizeof(network::ReplayRecordingParams);
+        for (const network::RecordingPatch& patch : result.patches) {
+            statistics_.bytes_sent += sizeof(patch) + paddedSize(patch.size);
+        }
+        return result;
+    }
+
+    uint32_t index = victim();
+    result.replay = false;
+    result.id = first_id_ + index;
+    result.patches.clear();
+    store(index, recording, hash, shape);
+    statistics_.recordings_sent++;
+    statistics_.bytes_sent += sizeof(network::RecordingParams) + recording.size();
+    return result;
+}
+
+bool RecordingCache::diff(const Slot& slot, const std::vector<uint8_t>& recording,
+    std::vector<network::RecordingPatch>& patches) const
+{
+    patches.clear();
+    if (slot.data.size() != recording.size()) {
+        return false;
+    }
+
+    // Records are aligned, so compare in words
+    constexpr size_t WORD = network::COMMAND_RECORD_ALIGNMENT;
+    size_t budget = recording.size() / 2;
+    size_t cost = sizeof(network::ReplayRecordingParams);
+    size_t offset = 0;
+    while (offset < recording.size()) {
+        size_t length = std::min(WORD, recording.size() - offset);
+        if (std::memcmp(slot.data.data() + offset, recording.data() + offset, length) == 0) {
+            offset += length;
+            continue;
+        }
+
+        network::RecordingPatch* last = patches.empty() ? nullptr : &patches.back();
+        if (last && offset - (last->offset + last->size) < MERGE_GAP) {
+            cost -= paddedSize(last->size);
+            last->size = static_cast<uint32_t>(offset + length - last->offset);
+            cost += paddedSize(last->size);
+        } else {
+            network::RecordingPatch patch = {};
+            patch.offset = static_cast<uint32_t>(offset);
+            patch.size = static_cast<uint32_t>(length);
+            patches.push_back(patch);
+            cost += sizeof(patch) + paddedSize(patch.size);
+        }
+        if (cost > budget) {
+            patches.clear();
+            return false;
+        }
+        offset += length;
+    }
+    return true;
+}
+
+void RecordingCache::store(uint32_t index, const std::vector<uint8_t>& recording,
+    uint64_t hash, uint64_t shape)
+{
+    Slot& slot = slots_[index];
+    auto old_hash = by_hash_.find(slot.hash);
+    if (!slot.data.empty() && old_hash != by_hash_.end() && old_hash->second == index) {
+        by_hash_.erase(old_hash);
+    }
+    auto old_shape = by_shape_.find(slot.shape);
+    if (!slot.data.empty() && old_shape != by_shape_.end() && old_shape->second == index) {
+        by_shape_.erase(old_shape);
+    }
+
+    slot.data = recording;
+    slot.hash = hash;
+    slot.shape = shape;
+    slot.last_use = ++clock_;
+    by_hash_[hash] = index;
+    by_shape_[shape] = index;
+}
+
+uint32_t RecordingCache::victim() const {
+    // An empty slot, or the one unused longest
+    uint32_t oldest = 0;
+    for (uint32_t index = 0; index < slots_.size(); index++) {
+        if (slots_[index].data.empty()) {
+            return index;
+        }
+        if (slots_[index].last_use < slots_[oldest].last_use) {
+            oldest = index;
+        }
+    }
+    return oldest;
+}
+
+struct RecordingCachePool::ThreadExit {
+    std::vector<uint64_t> pools;
+
+    ~ThreadExit() {
+        std::lock_guard<std::mutex> lock(live_pools_mutex);
+        for (uint64_t id : pools) {
+            auto it = live_pools.find(id);
+            if (it != live_pools.end()) {
+                it->second->releaseThread(std::this_thread::get_id());
+            }
+        }
+    }
+};
+
+RecordingCachePool::RecordingCachePool(uint32_t slots_per_thread, uint32_t slot_count)
+    : pool_id_(next_pool_id++)
+    , slots_per_thread_(slots_per_thread)
+{
+    for (uint32_t first_id = slot_count / slots_per_thread * slots_per_thread; first_id > 0;) {
+        first_id -= slots_per_thread;
+        free_ranges_.push_back(first_id);
+    }
+
+    std::lock_guard<std::mutex> lock(live_pools_mutex);
+    live_pools[pool_id_] = this;
+}
+
+RecordingCachePool::~RecordingCachePool() {
+    std::lock_guard<std::mutex> lock(live_pools_mutex);
+    live_pools.erase(pool_id_);
+}
+
+RecordingCache* RecordingCachePool::local() {
+    // Cache the lookup per thread, keyed by pool id like CommandStream's
+    static thread_local uint64_t cached_pool_id = 0;
+    static thread_local RecordingCache* cached_cache = nullptr;
+    static thread_local ThreadExit thread_exit;
+
+    if (cached_pool_id == pool_id_) {
+        return cached_cache;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& cache = caches_[std::this_thread::get_id()];
+    if (!cache) {
+        if (free_ranges_.empty()) {
+            // Asked again next time, a range may have come back by then
+            caches_.erase(std::this_thread::get_id());
+            return nullptr;
+        }
+        cache = std::make_unique<RecordingCache>(free_ranges_.back(), slots_per_thread_);
+        free_ranges_.pop_back();
+        if (std::find(thread_exit.pools.begin(), thread_exit.pools.end(), pool_id_) ==
+            thread_exit.pools.end()) {
+            thread_exit.pools.push_back(pool_id_);
+        }
+    }
+
+    cached_pool_id = pool_id_;
+    cached_cache = cache.get();
+    return cached_cache;
+}
+
+size_t RecordingCachePool::threadCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return caches_.size();
+}
+
+void RecordingCachePool::releaseThread(std::thread::id thread) {
+    // The server's copies of the range are overwritten by the next owner's
+    // recordings before any replay, since its cache starts out empty
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = caches_.find(thread);
+    if (it == caches_.end()) {
+        return;
+    }
+    free_ranges_.push_back(it->second->firstId());
+    caches_.erase(it);
+}
+
+} // namespace client
+} // namespace anarchy
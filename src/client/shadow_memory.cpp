@@ -0,0 +1,117 @@
+#include "client/shadow_memory.hpp"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace anarchy {
+namespace client {
+
+ShadowMemory::ShadowMemory(uint64_t size, bool use_write_watch)
+    : size_(size)
+    , allocated_(std::max<uint64_t>((size + PAGE_SIZE - 1) / PAGE_SIZE, 1) * PAGE_SIZE)
+{
+#ifdef _WIN32
+    if (use_write_watch) {
+        // Committed pages start zeroed
+        data_ = static_cast<uint8_t*>(VirtualAlloc(nullptr, static_cast<SIZE_T>(allocated_),
+            MEM_RESERVE | MEM_COMMIT | MEM_WRITE_WATCH, PAGE_READWRITE));
+        write_watch_ = data_ != nullptr;
+    }
+#else
+    (void)use_write_watch;
+#endif
+
+    if (!write_watch_) {
+        data_ = static_cast<uint8_t*>(::operator new(static_cast<size_t>(allocated_),
+            std::align_val_t(PAGE_SIZE)));
+        std::memset(data_, 0, static_cast<size_t>(allocated_));
+        sent_.assign(static_cast<size_t>(allocated_), 0);
+    }
+}
+
+ShadowMemory::~ShadowMemory() {
+#ifdef _WIN32
+    if (write_watch_) {
+        VirtualFree(data_, 0, MEM_RELEASE);
+        return;
+    }
+#endif
+    ::operator delete(data_, std::align_val_t(PAGE_SIZE));
+}
+
+void ShadowMemory::collectDirty(uint64_t offset, uint64_t size, std::vector<Range>& ranges) {
+    if (offset >= size_ || size == 0) {
+        return;
+    }
+    uint64_t end = size > size_ - offset ? size_ : offset + size;
+    uint64_t first_page = offset / PAGE_SIZE;
+    uint64_t last_page = (end + PAGE_SIZE - 1) / PAGE_SIZE;
+
+#ifdef _WIN32
+    if (write_watch_) {
+        std::vector<PVOID> pages(static_cast<size_t>(last_page - first_page));
+        ULONG_PTR count = pages.size();
+        ULONG granularity = 0;
+        if (GetWriteWatch(WRITE_WATCH_FLAG_RESET, data_ + first_page * PAGE_SIZE,
+                static_cast<SIZE_T>((last_page - first_page) * PAGE_SIZE),
+                pages.data(), &count, &granularity) != 0) {
+            // Can't tell what changed, so all of it did
+            for (uint64_t page = first_page; page < last_page; page++) {
+                addPage(page, ranges);
+            }
+            return;
+        }
+        // Reported in address order
+        for (ULONG_PTR i = 0; i < count; i++) {
+            addPage((static_cast<uint8_t*>(pages[i]) - data_) / PAGE_SIZE, ranges);
+        }
+        return;
+    }
+#endif
+
+    for (uint64_t page = first_page; page < last_page; page++) {
+        size_t page_offset = static_cast<size_t>(page * PAGE_SIZE);
+        if (std::memcmp(data_ + page_offset, sent_.data() + page_offset, PAGE_SIZE) != 0) {
+            std::memcpy(sent_.data() + page_offset, data_ + page_offset, PAGE_SIZE);
+            addPage(page, ranges);
+        }
+    }
+}
+
+void ShadowMemory::load(uint64_t offset, const uint8_t* data, uint64_t size) {
+    if (offset >= size_ || size == 0) {
+        return;
+    }
+    size = std::min(size, size_ - offset);
+    std::memcpy(data_ + offset, data, static_cast<size_t>(size));
+
+#ifdef _WIN32
+    if (write_watch_) {
+        // The copy tripped the watch on every page it touched
+        uint64_t first_page = offset / PAGE_SIZE;
+        uint64_t last_page = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+        ResetWriteWatch(data_ + first_page * PAGE_SIZE,
+            static_cast<SIZE_T>((last_page - first_page) * PAGE_SIZE));
+        return;
+    }
+#endif
+
+    std::memcpy(sent_.data() + offset, data, static_cast<size_t>(size));
+}
+
+void ShadowMemory::addPage(uint64_t page, std::vector<Range>& ranges) const {
+    uint64_t offset = page * PAGE_SIZE;
+    uint64_t size = std::min(PAGE_SIZE, size_ - offset);
+    if (!ranges.empty() && ranges.back().offset + ranges.back().size == offset) {
+        ranges.back().size += size;
+    } else {
+        ranges.push_back({offset, size});
+    }
+}
+
+} // namespace client
+} // namespace anarchy
@@ -1,96 +1,278 @@
 #include "client/vulkan_icd.hpp"
+#include "common/network/content_hash.hpp"
+#include "common/tracer.hpp"
+#include <algorithm>
 #include <cstring>
 #include <sstream>
 
 namespace anarchy {
 namespace client {
 
+namespace {
+
+// Placeholder the loader overwrites with its dispatch table pointer
+constexpr uintptr_t ICD_LOADER_MAGIC = 0x01CDC0DE;
+
+// What the server captures at; paces the jitter buffer
+constexpr uint32_t STREAM_FPS = 60;
+
+// Largest VK_WRITE_MEMORY or VK_READ_MEMORY; bigger ranges go as several,
+// so one transfer never sits in front of the rest of the stream for long
+constexpr VkDeviceSize MAX_WRITE_SIZE = 1 << 20;
+
+// Build a command message from a fixed-size parameter block, leaving
+// extra_size bytes after it for trailing arrays
+template <typename T>
+network::Message makeCommand(network::MessageType type, const T& params, size_t extra_size = 0) {
+    network::Message message;
+    message.header.type = type;
+    message.header.size = static_cast<uint32_t>(sizeof(T) + extra_size);
+    message.payload.resize(message.header.size);
+    std::memcpy(message.payload.data(), &params, sizeof(T));
+    return message;
+}
+
+} // namespace
+
 VulkanICD::VulkanICD(const std::string& server_address)
     : server_address_(server_address)
 {
-    network_ = std::make_unique<network::ZMQWrapper>(network::ZMQWrapper::Role::CLIENT);
-    if (!network_->connect(server_address_)) {
-        throw std::runtime_error("Failed to connect to server");
-    }
+    network_ = network::Transport::create(server_address_, network::Transport::Role::CLIENT);
+
+    // Deferred commands leave in batches through the same connection
+    command_stream_ = std::make_unique<network::CommandStream>(
+        [this](network::Message& batch) {
+            return network_->sendMessage(std::move(batch));
+        });
 
     // Set up message callback
     network_->setMessageCallback([this](const network::Message& message) {
         handleResponse(message);
     });
+
+    // The raw backend only connects in start()
+    if (!network_->start() || !network_->isConnected()) {
+        throw std::runtime_error("Failed to connect to server");
+    }
+
+    if (connectToServer() != VK_SUCCESS) {
+        network_->stop();
+        throw std::runtime_error("Server rejected the connection: incompatible protocol version");
+    }
+}
+
+VkResult VulkanICD::connectToServer() {
+    network::ConnectionParams params = network::localConnectionParams();
+
+    network::Message message;
+    message.header.type = network::MessageType::CONNECT;
+    message.header.size = sizeof(params);
+    message.payload.resize(sizeof(params));
+    std::memcpy(message.payload.data(), &params, sizeof(params));
+
+    // The server answers with the parameters both sides support, within the round trip
+    std::vector<uint8_t> response;
+    VkResult result = sendCommand(message, &response, 0);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+    if (response.size() < sizeof(connection_params_)) {
+        return VK_ERROR_INCOMPATIBLE_DRIVER;
+    }
+    std::memcpy(&connection_params_, response.data(), sizeof(connection_params_));
+    if (connection_params_.version.major != network::PROTOCOL_VERSION.major) {
+        return VK_ERROR_INCOMPATIBLE_DRIVER;
+    }
+    return VK_SUCCESS;
+}
+
+void VulkanICD::setBusyPoll(bool enable) {
+    busy_poll_ = enable;
+    network_->setBusyPoll(enable);
+}
+
+void VulkanICD::setJitterFrames(uint32_t frames) {
+    std::lock_guard<std::mutex> lock(decoder_mutex_);
+    jitter_frames_ = frames;
+    if (frame_decoder_) {
+        frame_decoder_->setJitterFrames(frames);
+    }
+}
+
+bool VulkanICD::writeTrace(const std::string& path) {
+    return Tracer::global().writeChromeTrace(path, Tracer::CLIENT_PROCESS);
 }
 
 VulkanICD::~VulkanICD() {
+    command_stream_->flush();
     cleanupResources();
-    network_->disconnect();
+    network_->stop();
+}
+
+template <typename T>
+T VulkanICD::createDispatchable(network::HandleType type) {
+    auto* object = new DispatchableObject{ICD_LOADER_MAGIC, handle_allocator_.allocate(type)};
+    return reinterpret_cast<T>(object);
+}
+
+template <typename T>
+void VulkanICD::destroyDispatchable(T handle) {
+    delete reinterpret_cast<DispatchableObject*>(handle);
+}
+
+template <typename T>
+T VulkanICD::createHandle(network::HandleType type) {
+    return reinterpret_cast<T>(handle_allocator_.allocate(type));
+}
+
+uint64_t VulkanICD::toWire(VkInstance instance) {
+    return instance ? reinterpret_cast<DispatchableObject*>(instance)->handle : 0;
+}
+
+uint64_t VulkanICD::toWire(VkPhysicalDevice physical_device) {
+    return physical_device ? reinterpret_cast<DispatchableObject*>(physical_device)->handle : 0;
+}
+
+uint64_t VulkanICD::toWire(VkDevice device) {
+    return device ? reinterpret_cast<DispatchableObject*>(device)->handle : 0;
+}
+
+uint64_t VulkanICD::toWire(VkQueue queue) {
+    return queue ? reinterpret_cast<DispatchableObject*>(queue)->handle : 0;
+}
+
+uint64_t VulkanICD::toWire(VkCommandBuffer command_buffer) {
+    return command_buffer ? reinterpret_cast<DispatchableObject*>(command_buffer)->handle : 0;
+}
+
+template <typename T>
+uint64_t VulkanICD::toWire(T handle) {
+    return reinterpret_cast<uint64_t>(handle);
+}
+
+uint64_t VulkanICD::mapHandle(network::HandleType type, uint64_t handle) {
+    if (handle == 0 || !network::isDispatchable(type)) {
+        return handle;
+    }
+    return reinterpret_cast<const DispatchableObject*>(handle)->handle;
+}
+
+template <typename T>
+VkResult VulkanICD::enqueueEncoded(network::MessageType type, const T& params) {
+    // Encoded straight into a per-thread arena and copied into the command stream
+    static thread_local std::vector<uint8_t> arena;
+    size_t size = network::encodeWire(params, arena, mapHandle);
+    if (!command_stream_->enqueue(type, nextSequence(), arena.data(), size)) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    return VK_SUCCESS;
+}
+
+template <typename T>
+network::Message VulkanICD::encodeCommand(network::MessageType type, const T& params) {
+    network::Message message;
+    message.header.type = type;
+    message.header.size = static_cast<uint32_t>(
+        network::encodeWire(params, message.payload, mapHandle));
+    return message;
 }
 
 VkResult VulkanICD::vkCreateInstance(const VkInstanceCreateInfo* pCreateInfo,
     const VkAllocationCallbacks* pAllocator, VkInstance* pInstance)
 {
     // Create message with instance creation parameters
-    network::Message message;
-    message.header.type = network::MessageType::VK_CREATE_INSTANCE;
-    message.header.size = sizeof(VkInstanceCreateInfo);
-    message.header.sequence = reinterpret_cast<uint64_t>(pInstance);
-    message.payload.resize(sizeof(VkInstanceCreateInfo));
-    std::memcpy(message.payload.data(), pCreateInfo, sizeof(VkInstanceCreateInfo));
-
-    // Send command and wait for response
-    VkResult result = sendCommand(message);
-    if (result == VK_SUCCESS) {
-        std::lock_guard<std::mutex> lock(instance_mutex_);
-        InstanceInfo info;
-        info.instance = *pInstance;
-        instances_[*pInstance] = info;
+    network::CreateInstanceParams params = {};
+    *pInstance = createDispatchable<VkInstance>(network::HandleType::INSTANCE);
+    params.instance = toWire(*pInstance);
+    params.create_info = *pCreateInfo;
+
+    // Fire and forget: the handle is minted locally, failures replay at the next sync point
+    VkResult result = enqueueEncoded(network::MessageType::VK_CREATE_INSTANCE, params);
+    if (result != VK_SUCCESS) {
+        destroyDispatchable(*pInstance);
+        *pInstance = VK_NULL_HANDLE;
+        return result;
     }
-    return result;
+
+    std::lock_guard<std::mutex> lock(instance_mutex_);
+    InstanceInfo info;
+    info.instance = *pInstance;
+    instances_[*pInstance] = info;
+    return VK_SUCCESS;
 }
 
 void VulkanICD::vkDestroyInstance(VkInstance instance,
     const VkAllocationCallbacks* pAllocator)
 {
+    if (instance == VK_NULL_HANDLE) {
+        return;
+    }
+
     // Create message with instance handle
-    network::Message message;
-    message.header.type = network::MessageType::VK_DESTROY_INSTANCE;
-    message.header.size = sizeof(VkInstance);
-    message.header.sequence = reinterpret_cast<uint64_t>(instance);
-    message.payload.resize(sizeof(VkInstance));
-    std::memcpy(message.payload.data(), &instance, sizeof(VkInstance));
+    network::DestroyObjectParams params = {};
+    params.object = toWire(instance);
 
-    // Send command
-    sendCommand(message);
+    // Deferred: no round trip
+    enqueueCommand(makeCommand(network::MessageType::VK_DESTROY_INSTANCE, params));
 
     // Clean up instance resources
     std::lock_guard<std::mutex> lock(instance_mutex_);
-    instances_.erase(instance);
+    auto it = instances_.find(instance);
+    if (it != instances_.end()) {
+        for (VkPhysicalDevice physical_device : it->second.physical_devices) {
+            destroyDispatchable(physical_device);
+        }
+        instances_.erase(it);
+    }
+    destroyDispatchable(instance);
 }
 
 VkResult VulkanICD::vkEnumeratePhysicalDevices(VkInstance instance,
     uint32_t* pPhysicalDeviceCount, VkPhysicalDevice* pPhysicalDevices)
 {
-    // Create message with instance handle
-    network::Message message;
-    message.header.type = network::MessageType::VK_ENUMERATE_PHYSICAL_DEVICES;
-    message.header.size = sizeof(VkInstance);
-    message.header.sequence = reinterpret_cast<uint64_t>(instance);
-    message.payload.resize(sizeof(VkInstance));
-    std::memcpy(message.payload.data(), &instance, sizeof(VkInstance));
+    std::lock_guard<std::mutex> lock(instance_mutex_);
+    auto it = instances_.find(instance);
+    if (it == instances_.end()) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
 
-    // Send command and wait for response
-    VkResult result = sendCommand(message);
-    if (result == VK_SUCCESS) {
-        std::lock_guard<std::mutex> lock(instance_mutex_);
-        auto it = instances_.find(instance);
-        if (it != instances_.end()) {
-            if (pPhysicalDevices) {
-                std::memcpy(pPhysicalDevices, it->second.physical_devices.data(),
-                    *pPhysicalDeviceCount * sizeof(VkPhysicalDevice));
-            } else {
-                *pPhysicalDeviceCount = it->second.physical_devices.size();
-            }
+    // Physical devices are minted by the server, ask once per instance
+    if (it->second.physical_devices.empty()) {
+        uint64_t wire_instance = toWire(instance);
+        network::Message message = makeCommand(
+            network::MessageType::VK_ENUMERATE_PHYSICAL_DEVICES, wire_instance);
+
+        std::vector<uint8_t> response;
+        VkResult result = sendCommand(message, &response);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+        if (response.size() < sizeof(network::PhysicalDeviceList)) {
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+
+        network::PhysicalDeviceList list;
+        std::memcpy(&list, response.data(), sizeof(list));
+        uint32_t count = std::min<uint32_t>(list.count, 8);
+        for (uint32_t i = 0; i < count; ++i) {
+            auto* object = new DispatchableObject{ICD_LOADER_MAGIC, list.physical_devices[i]};
+            auto physical_device = reinterpret_cast<VkPhysicalDevice>(object);
+            it->second.physical_devices.push_back(physical_device);
+            readback_memory_types_[physical_device] = list.readback_memory_types[i];
         }
     }
-    return result;
+
+    const auto& physical_devices = it->second.physical_devices;
+    if (!pPhysicalDevices) {
+        *pPhysicalDeviceCount = static_cast<uint32_t>(physical_devices.size());
+        return VK_SUCCESS;
+    }
+
+    uint32_t count = std::min<uint32_t>(*pPhysicalDeviceCount,
+        static_cast<uint32_t>(physical_devices.size()));
+    std::memcpy(pPhysicalDevices, physical_devices.data(), count * sizeof(VkPhysicalDevice));
+    *pPhysicalDeviceCount = count;
+    return count < physical_devices.size() ? VK_INCOMPLETE : VK_SUCCESS;
 }
 
 VkResult VulkanICD::vkCreateDevice(VkPhysicalDevice physicalDevice,
@@ -98,50 +280,82 @@ VkResult VulkanICD::vkCreateDevice(VkPhysicalDevice physicalDevice,
     VkDevice* pDevice)
 {
     // Create message with device creation parameters
-    struct DeviceCreateParams {
-        VkPhysicalDevice physical_device;
-        VkDeviceCreateInfo create_info;
-    };
-    DeviceCreateParams params;
-    params.physical_device = physicalDevice;
-    std::memcpy(&params.create_info, pCreateInfo, sizeof(VkDeviceCreateInfo));
-
-    network::Message message;
-    message.header.type = network::MessageType::VK_CREATE_DEVICE;
-    message.header.size = sizeof(DeviceCreateParams);
-    message.header.sequence = reinterpret_cast<uint64_t>(pDevice);
-    message.payload.resize(sizeof(DeviceCreateParams));
-    std::memcpy(message.payload.data(), &params, sizeof(DeviceCreateParams));
-
-    // Send command and wait for response
-    VkResult result = sendCommand(message);
-    if (result == VK_SUCCESS) {
-        std::lock_guard<std::mutex> lock(device_mutex_);
-        DeviceInfo info;
-        info.device = *pDevice;
-        info.physical_device = physicalDevice;
-        devices_[*pDevice] = info;
+    network::CreateDeviceParams params = {};
+    *pDevice = createDispatchable<VkDevice>(network::HandleType::DEVICE);
+    params.physical_device = toWire(physicalDevice);
+    params.device = toWire(*pDevice);
+    params.create_info = *pCreateInfo;
+
+    // Fire and forget: the handle is minted locally, failures replay at the next sync point
+    VkResult result = enqueueEncoded(network::MessageType::VK_CREATE_DEVICE, params);
+    if (result != VK_SUCCESS) {
+        destroyDispatchable(*pDevice);
+        *pDevice = VK_NULL_HANDLE;
+        return result;
     }
-    return result;
+
+    std::lock_guard<std::mutex> lock(device_mutex_);
+    DeviceInfo info;
+    info.device = *pDevice;
+    info.physical_device = physicalDevice;
+    devices_[*pDevice] = info;
+    return VK_SUCCESS;
 }
 
 void VulkanICD::vkDestroyDevice(VkDevice device,
     const VkAllocationCallbacks* pAllocator)
 {
+    if (device == VK_NULL_HANDLE) {
+        return;
+    }
+
     // Create message with device handle
-    network::Message message;
-    message.header.type = network::MessageType::VK_DESTROY_DEVICE;
-    message.header.size = sizeof(VkDevice);
-    message.header.sequence = reinterpret_cast<uint64_t>(device);
-    message.payload.resize(sizeof(VkDevice));
-    std::memcpy(message.payload.data(), &device, sizeof(VkDevice));
+    network::DestroyObjectParams params = {};
+    params.object = toWire(device);
 
-    // Send command
-    sendCommand(message);
+    // Deferred: no round trip
+    enqueueCommand(makeCommand(network::MessageType::VK_DESTROY_DEVICE, params));
 
     // Clean up device resources
     std::lock_guard<std::mutex> lock(device_mutex_);
-    devices_.erase(device);
+    auto it = devices_.find(device);
+    if (it != devices_.end()) {
+        for (auto& queue : it->second.queues) {
+            destroyDispatchable(queue.second);
+        }
+        devices_.erase(it);
+    }
+    destroyDispatchable(device);
+}
+
+void VulkanICD::vkGetDeviceQueue(VkDevice device, uint32_t queueFamilyIndex,
+    uint32_t queueIndex, VkQueue* pQueue)
+{
+    std::lock_guard<std::mutex> lock(device_mutex_);
+    auto it = devices_.find(device);
+    if (it == devices_.end()) {
+        *pQueue = VK_NULL_HANDLE;
+        return;
+    }
+
+    // The same queue must come back every time it is asked for
+    uint64_t key = (static_cast<uint64_t>(queueFamilyIndex) << 32) | queueIndex;
+    auto queue = it->second.queues.find(key);
+    if (queue != it->second.queues.end()) {
+        *pQueue = queue->second;
+        return;
+    }
+
+    network::GetDeviceQueueParams params = {};
+    *pQueue = createDispatchable<VkQueue>(network::HandleType::QUEUE);
+    params.device = toWire(device);
+    params.queue = toWire(*pQueue);
+    params.queue_family_index = queueFamilyIndex;
+    params.queue_index = queueIndex;
+
+    // Deferred: no round trip
+    enqueueCommand(makeCommand(network::MessageType::VK_GET_DEVICE_QUEUE, params));
+    it->second.queues[key] = *pQueue;
 }
 
 VkResult VulkanICD::vkCreateSwapchainKHR(VkDevice device,
@@ -149,81 +363,116 @@ VkResult VulkanICD::vkCreateSwapchainKHR(VkDevice device,
     const VkAllocationCallbacks* pAllocator, VkSwapchainKHR* pSwapchain)
 {
     // Create message with swapchain creation parameters
-    struct SwapchainCreateParams {
-        VkDevice device;
-        VkSwapchainCreateInfoKHR create_info;
-    };
-    SwapchainCreateParams params;
-    params.device = device;
-    std::memcpy(&params.create_info, pCreateInfo, sizeof(VkSwapchainCreateInfoKHR));
+    network::CreateSwapchainParams params = {};
+    *pSwapchain = createHandle<VkSwapchainKHR>(network::HandleType::SWAPCHAIN);
+    params.device = toWire(device);
+    params.swapchain = toWire(*pSwapchain);
+    params.create_info = *pCreateInfo;
+
+    // The images are minted here too, so acquiring one never asks the server
+    SwapchainInfo info;
+    info.swapchain = *pSwapchain;
+    info.device = device;
+    info.ring = network::SwapchainRing(
+        network::SwapchainRing::imageCount(pCreateInfo->minImageCount));
+    params.image_count = info.ring.imageCount();
+    for (uint32_t i = 0; i < params.image_count; i++) {
+        info.images.push_back(createHandle<VkImage>(network::HandleType::IMAGE));
+        params.images[i] = toWire(info.images.back());
+    }
 
-    network::Message message;
-    message.header.type = network::MessageType::VK_CREATE_SWAPCHAIN;
-    message.header.size = sizeof(SwapchainCreateParams);
-    message.header.sequence = reinterpret_cast<uint64_t>(pSwapchain);
-    message.payload.resize(sizeof(SwapchainCreateParams));
-    std::memcpy(message.payload.data(), &params, sizeof(SwapchainCreateParams));
+    // Fire and forget: the handle is minted locally, failures replay at the next sync point
+    VkResult result = enqueueEncoded(network::MessageType::VK_CREATE_SWAPCHAIN, params);
+    if (result != VK_SUCCESS) {
+        *pSwapchain = VK_NULL_HANDLE;
+        return result;
+    }
 
-    // Send command and wait for response
-    VkResult result = sendCommand(message);
-    if (result == VK_SUCCESS) {
+    {
         std::lock_guard<std::mutex> lock(swapchain_mutex_);
-        SwapchainInfo info;
-        info.swapchain = *pSwapchain;
-        info.device = device;
         swapchains_[*pSwapchain] = info;
     }
-    return result;
+
+    createFrameDecoder(*pSwapchain, *pCreateInfo);
+    requestFrame(*pSwapchain);
+    return VK_SUCCESS;
 }
 
 void VulkanICD::vkDestroySwapchainKHR(VkDevice device, VkSwapchainKHR swapchain,
     const VkAllocationCallbacks* pAllocator)
 {
     // Create message with swapchain handle
-    network::Message message;
-    message.header.type = network::MessageType::VK_DESTROY_SWAPCHAIN;
-    message.header.size = sizeof(VkSwapchainKHR);
-    message.header.sequence = reinterpret_cast<uint64_t>(swapchain);
-    message.payload.resize(sizeof(VkSwapchainKHR));
-    std::memcpy(message.payload.data(), &swapchain, sizeof(VkSwapchainKHR));
-
-    // Send command
-    sendCommand(message);
+    network::DestroyObjectParams params = {};
+    params.parent = toWire(device);
+    params.object = toWire(swapchain);
+
+    // Deferred: no round trip
+    enqueueCommand(makeCommand(network::MessageType::VK_DESTROY_SWAPCHAIN, params));
+
+    {
+        std::lock_guard<std::mutex> lock(decoder_mutex_);
+        if (decoder_swapchain_ == swapchain) {
+            frame_decoder_.reset();
+            decoder_swapchain_ = VK_NULL_HANDLE;
+        }
+    }
 
     // Clean up swapchain resources
     std::lock_guard<std::mutex> lock(swapchain_mutex_);
     swapchains_.erase(swapchain);
 }
 
+VkResult VulkanICD::vkGetSwapchainImagesKHR(VkDevice device, VkSwapchainKHR swapchain,
+    uint32_t* pSwapchainImageCount, VkImage* pSwapchainImages)
+{
+    std::lock_guard<std::mutex> lock(swapchain_mutex_);
+    auto it = swapchains_.find(swapchain);
+    if (it == swapchains_.end()) {
+        return VK_ERROR_DEVICE_LOST;
+    }
+
+    const std::vector<VkImage>& images = it->second.images;
+    if (!pSwapchainImages) {
+        *pSwapchainImageCount = static_cast<uint32_t>(images.size());
+        return VK_SUCCESS;
+    }
+    uint32_t count = std::min(*pSwapchainImageCount, static_cast<uint32_t>(images.size()));
+    std::copy(images.begin(), images.begin() + count, pSwapchainImages);
+    *pSwapchainImageCount = count;
+    return count < images.size() ? VK_INCOMPLETE : VK_SUCCESS;
+}
+
 VkResult VulkanICD::vkAcquireNextImageKHR(VkDevice device, VkSwapchainKHR swapchain,
     uint64_t timeout, VkSemaphore semaphore, VkFence fence, uint32_t* pImageIndex)
 {
-    // Create message with acquire parameters
-    struct AcquireParams {
-        VkDevice device;
-        VkSwapchainKHR swapchain;
-        uint64_t timeout;
-        VkSemaphore semaphore;
-        VkFence fence;
-    };
-    AcquireParams params;
-    params.device = device;
-    params.swapchain = swapchain;
-    params.timeout = timeout;
-    params.semaphore = semaphore;
-    params.fence = fence;
+    // The index is predicted locally: the server hands out images in the
+    // same order and checks it
+    uint32_t index = 0;
+    {
+        std::lock_guard<std::mutex> lock(swapchain_mutex_);
+        auto it = swapchains_.find(swapchain);
+        if (it == swapchains_.end()) {
+            return VK_ERROR_DEVICE_LOST;
+        }
+        if (!it->second.ring.acquire(index)) {
+            // Every image is held by the application; waiting would never end
+            return timeout == 0 ? VK_NOT_READY : VK_TIMEOUT;
+        }
+    }
 
-    network::Message message;
-    message.header.type = network::MessageType::VK_ACQUIRE_NEXT_IMAGE;
-    message.header.size = sizeof(AcquireParams);
-    message.header.sequence = reinterpret_cast<uint64_t>(swapchain);
-    message.payload.resize(sizeof(AcquireParams));
-    std::memcpy(message.payload.data(), &params, sizeof(AcquireParams));
+    network::AcquireNextImageParams params = {};
+    params.device = toWire(device);
+    params.swapchain = toWire(swapchain);
+    params.timeout = timeout;
+    params.semaphore = toWire(semaphore);
+    params.fence = toWire(fence);
+    params.image_index = index;
 
-    // Send command and wait for response
-    VkResult result = sendCommand(message);
+    // Deferred: the server signals semaphore and fence once the image is free
+    VkResult result = enqueueCommand(
+        makeCommand(network::MessageType::VK_ACQUIRE_NEXT_IMAGE, params));
     if (result == VK_SUCCESS) {
-        std::memcpy(pImageIndex, message.payload.data(), sizeof(uint32_t));
+        *pImageIndex = index;
     }
     return result;
 }
@@ -232,23 +481,58 @@ VkResult VulkanICD::vkQueuePresentKHR(VkQueue queue,
     const VkPresentInfoKHR* pPresentInfo)
 {
     // Create message with present parameters
-    struct PresentParams {
-        VkQueue queue;
-        VkPresentInfoKHR present_info;
-    };
-    PresentParams params;
-    params.queue = queue;
-    std::memcpy(&params.present_info, pPresentInfo, sizeof(VkPresentInfoKHR));
-
-    network::Message message;
-    message.header.type = network::MessageType::VK_PRESENT;
-    message.header.size = sizeof(PresentParams);
-    message.header.sequence = reinterpret_cast<uint64_t>(queue);
-    message.payload.resize(sizeof(PresentParams));
-    std::memcpy(message.payload.data(), &params, sizeof(PresentParams));
+    network::QueuePresentParams params = {};
+    params.queue = toWire(queue);
+    params.frame_id = next_frame_id_++;
+    params.present_info = *pPresentInfo;
+    params.present_info.pResults = nullptr;
+    Tracer::global().instant(params.frame_id, TraceStage::PRESENT);
+
+    // The images go back into their rings, as the server's will. One the
+    // ring refuses is left out of the message, so the server's rings step
+    // the same way, and the others are still presented.
+    std::vector<VkSwapchainKHR> swapchains;
+    std::vector<uint32_t> indices;
+    VkResult worst = VK_SUCCESS;
+    {
+        std::lock_guard<std::mutex> lock(swapchain_mutex_);
+        for (uint32_t i = 0; i < pPresentInfo->swapchainCount; i++) {
+            auto it = swapchains_.find(pPresentInfo->pSwapchains[i]);
+            VkResult present_result = it != swapchains_.end() &&
+                it->second.ring.present(pPresentInfo->pImageIndices[i]) ?
+                VK_SUCCESS : VK_ERROR_OUT_OF_DATE_KHR;
+            if (pPresentInfo->pResults) {
+                pPresentInfo->pResults[i] = present_result;
+            }
+            if (present_result == VK_SUCCESS) {
+                swapchains.push_back(pPresentInfo->pSwapchains[i]);
+                indices.push_back(pPresentInfo->pImageIndices[i]);
+            } else {
+                worst = present_result;
+            }
+        }
+    }
+    if (swapchains.empty()) {
+        return worst;
+    }
+    params.present_info.swapchainCount = static_cast<uint32_t>(swapchains.size());
+    params.present_info.pSwapchains = swapchains.data();
+    params.present_info.pImageIndices = indices.data();
 
-    // Send command and wait for response
-    return sendCommand(message);
+    // Deferred, but present ends a frame so push the batch out right away.
+    // The frame comes back as FRAME_DATA if it is being streamed.
+    VkResult result = enqueueEncoded(network::MessageType::VK_PRESENT, params);
+    if (result == VK_SUCCESS) {
+        result = flushCommands();
+    }
+    if (result != VK_SUCCESS && pPresentInfo->pResults) {
+        for (uint32_t i = 0; i < pPresentInfo->swapchainCount; i++) {
+            if (pPresentInfo->pResults[i] == VK_SUCCESS) {
+                pPresentInfo->pResults[i] = result;
+            }
+        }
+    }
+    return result != VK_SUCCESS ? result : worst;
 }
 
 VkResult VulkanICD::vkCreateCommandPool(VkDevice device,
@@ -256,50 +540,53 @@ VkResult VulkanICD::vkCreateCommandPool(VkDevice device,
     const VkAllocationCallbacks* pAllocator, VkCommandPool* pCommandPool)
 {
     // Create message with command pool creation parameters
-    struct CommandPoolCreateParams {
-        VkDevice device;
-        VkCommandPoolCreateInfo create_info;
-    };
-    CommandPoolCreateParams params;
-    params.device = device;
-    std::memcpy(&params.create_info, pCreateInfo, sizeof(VkCommandPoolCreateInfo));
-
-    network::Message message;
-    message.header.type = network::MessageType::VK_CREATE_COMMAND_POOL;
-    message.header.size = sizeof(CommandPoolCreateParams);
-    message.header.sequence = reinterpret_cast<uint64_t>(pCommandPool);
-    message.payload.resize(sizeof(CommandPoolCreateParams));
-    std::memcpy(message.payload.data(), &params, sizeof(CommandPoolCreateParams));
-
-    // Send command and wait for response
-    VkResult result = sendCommand(message);
-    if (result == VK_SUCCESS) {
-        std::lock_guard<std::mutex> lock(command_pool_mutex_);
-        CommandPoolInfo info;
-        info.command_pool = *pCommandPool;
-        info.device = device;
-        command_pools_[*pCommandPool] = info;
+    network::CreateCommandPoolParams params = {};
+    *pCommandPool = createHandle<VkCommandPool>(network::HandleType::COMMAND_POOL);
+    params.device = toWire(device);
+    params.command_pool = toWire(*pCommandPool);
+    params.create_info = *pCreateInfo;
+
+    // Fire and forget: the handle is minted locally, failures replay at the next sync point
+    VkResult result = enqueueEncoded(network::MessageType::VK_CREATE_COMMAND_POOL, params);
+    if (result != VK_SUCCESS) {
+        *pCommandPool = VK_NULL_HANDLE;
+        return result;
     }
-    return result;
+
+    std::lock_guard<std::mutex> lock(command_pool_mutex_);
+    CommandPoolInfo info;
+    info.command_pool = *pCommandPool;
+    info.device = device;
+    command_pools_[*pCommandPool] = info;
+    return VK_SUCCESS;
 }
 
 void VulkanICD::vkDestroyCommandPool(VkDevice device, VkCommandPool commandPool,
     const VkAllocationCallbacks* pAllocator)
 {
     // Create message with command pool handle
-    network::Message message;
-    message.header.type = network::MessageType::VK_DESTROY_COMMAND_POOL;
-    message.header.size = sizeof(VkCommandPool);
-    message.header.sequence = reinterpret_cast<uint64_t>(commandPool);
-    message.payload.resize(sizeof(VkCommandPool));
-    std::memcpy(message.payload.data(), &commandPool, sizeof(VkCommandPool));
+    network::DestroyObjectParams params = {};
+    params.parent = toWire(device);
+    params.object = toWire(commandPool);
 
-    // Send command
-    sendCommand(message);
+    // Deferred: no round trip
+    enqueueCommand(makeCommand(network::MessageType::VK_DESTROY_COMMAND_POOL, params));
 
-    // Clean up command pool resources
-    std::lock_guard<std::mutex> lock(command_pool_mutex_);
-    command_pools_.erase(commandPool);
+    // Clean up command pool resources, its command buffers go with it
+    {
+        std::lock_guard<std::mutex> lock(command_pool_mutex_);
+        command_pools_.erase(commandPool);
+    }
+
+    std::lock_guard<std::mutex> lock(command_buffer_mutex_);
+    for (auto it = command_buffers_.begin(); it != command_buffers_.end();) {
+        if (it->second.command_pool == commandPool) {
+            destroyDispatchable(it->first);
+            it = command_buffers_.erase(it);
+        } else {
+            ++it;
+        }
+    }
 }
 
 VkResult VulkanICD::vkAllocateCommandBuffers(VkDevice device,
@@ -307,67 +594,70 @@ VkResult VulkanICD::vkAllocateCommandBuffers(VkDevice device,
     VkCommandBuffer* pCommandBuffers)
 {
     // Create message with command buffer allocation parameters
-    struct CommandBufferAllocateParams {
-        VkDevice device;
-        VkCommandBufferAllocateInfo allocate_info;
-    };
-    CommandBufferAllocateParams params;
-    params.device = device;
-    std::memcpy(&params.allocate_info, pAllocateInfo, sizeof(VkCommandBufferAllocateInfo));
-
-    network::Message message;
-    message.header.type = network::MessageType::VK_ALLOCATE_COMMAND_BUFFERS;
-    message.header.size = sizeof(CommandBufferAllocateParams);
-    message.header.sequence = reinterpret_cast<uint64_t>(pCommandBuffers);
-    message.payload.resize(sizeof(CommandBufferAllocateParams));
-    std::memcpy(message.payload.data(), &params, sizeof(CommandBufferAllocateParams));
+    uint32_t count = pAllocateInfo->commandBufferCount;
+    network::AllocateCommandBuffersParams params = {};
+    params.device = toWire(device);
+    params.command_pool = toWire(pAllocateInfo->commandPool);
+    params.level = static_cast<uint32_t>(pAllocateInfo->level);
+    params.command_buffer_count = count;
+
+    network::Message message = makeCommand(network::MessageType::VK_ALLOCATE_COMMAND_BUFFERS,
+        params, count * sizeof(uint64_t));
+    uint8_t* handles = message.payload.data() + sizeof(params);
+    for (uint32_t i = 0; i < count; ++i) {
+        pCommandBuffers[i] = createDispatchable<VkCommandBuffer>(
+            network::HandleType::COMMAND_BUFFER);
+        uint64_t handle = toWire(pCommandBuffers[i]);
+        std::memcpy(handles + i * sizeof(uint64_t), &handle, sizeof(handle));
+    }
 
-    // Send command and wait for response
-    VkResult result = sendCommand(message);
-    if (result == VK_SUCCESS) {
-        std::lock_guard<std::mutex> lock(command_buffer_mutex_);
-        for (uint32_t i = 0; i < pAllocateInfo->commandBufferCount; ++i) {
-            CommandBufferInfo info;
-            info.command_buffer = pCommandBuffers[i];
-            info.command_pool = pAllocateInfo->commandPool;
-            info.device = device;
-            command_buffers_[pCommandBuffers[i]] = info;
+    // Fire and forget: the handles are minted locally, failures replay at the next sync point
+    VkResult result = enqueueCommand(message);
+    if (result != VK_SUCCESS) {
+        for (uint32_t i = 0; i < count; ++i) {
+            destroyDispatchable(pCommandBuffers[i]);
+            pCommandBuffers[i] = VK_NULL_HANDLE;
         }
+        return result;
     }
-    return result;
+
+    std::lock_guard<std::mutex> lock(command_buffer_mutex_);
+    for (uint32_t i = 0; i < count; ++i) {
+        CommandBufferInfo info;
+        info.command_buffer = pCommandBuffers[i];
+        info.command_pool = pAllocateInfo->commandPool;
+        info.device = device;
+        command_buffers_[pCommandBuffers[i]] = info;
+    }
+    return VK_SUCCESS;
 }
 
 void VulkanICD::vkFreeCommandBuffers(VkDevice device, VkCommandPool commandPool,
     uint32_t commandBufferCount, const VkCommandBuffer* pCommandBuffers)
 {
     // Create message with command buffer handles
-    struct CommandBufferFreeParams {
-        VkDevice device;
-        VkCommandPool command_pool;
-        uint32_t command_buffer_count;
-        std::vector<VkCommandBuffer> command_buffers;
-    };
-    CommandBufferFreeParams params;
-    params.device = device;
-    params.command_pool = commandPool;
+    network::FreeCommandBuffersParams params = {};
+    params.device = toWire(device);
+    params.command_pool = toWire(commandPool);
     params.command_buffer_count = commandBufferCount;
-    params.command_buffers.assign(pCommandBuffers, pCommandBuffers + commandBufferCount);
 
-    network::Message message;
-    message.header.type = network::MessageType::VK_FREE_COMMAND_BUFFERS;
-    message.header.size = sizeof(CommandBufferFreeParams) +
-        commandBufferCount * sizeof(VkCommandBuffer);
-    message.header.sequence = reinterpret_cast<uint64_t>(commandPool);
-    message.payload.resize(message.header.size);
-    std::memcpy(message.payload.data(), &params, sizeof(CommandBufferFreeParams));
+    network::Message message = makeCommand(network::MessageType::VK_FREE_COMMAND_BUFFERS,
+        params, commandBufferCount * sizeof(uint64_t));
+    uint8_t* handles = message.payload.data() + sizeof(params);
+    for (uint32_t i = 0; i < commandBufferCount; ++i) {
+        uint64_t handle = toWire(pCommandBuffers[i]);
+        std::memcpy(handles + i * sizeof(uint64_t), &handle, sizeof(handle));
+    }
 
-    // Send command
-    sendCommand(message);
+    // Deferred: no round trip
+    enqueueCommand(message);
 
     // Clean up command buffer resources
     std::lock_guard<std::mutex> lock(command_buffer_mutex_);
     for (uint32_t i = 0; i < commandBufferCount; ++i) {
-        command_buffers_.erase(pCommandBuffers[i]);
+        if (command_buffers_.erase(pCommandBuffers[i]) > 0) {
+            destroyDispatchable(pCommandBuffers[i]);
+        }
     }
 }
 
@@ -375,101 +665,196 @@ VkResult VulkanICD::vkBeginCommandBuffer(VkCommandBuffer commandBuffer,
     const VkCommandBufferBeginInfo* pBeginInfo)
 {
     // Create message with command buffer begin parameters
-    struct CommandBufferBeginParams {
-        VkCommandBuffer command_buffer;
-        VkCommandBufferBeginInfo begin_info;
-    };
-    CommandBufferBeginParams params;
-    params.command_buffer = commandBuffer;
-    std::memcpy(&params.begin_info, pBeginInfo, sizeof(VkCommandBufferBeginInfo));
+    network::BeginCommandBufferParams params = {};
+    params.command_buffer = toWire(commandBuffer);
+    params.begin_info = *pBeginInfo;
 
-    network::Message message;
-    message.header.type = network::MessageType::VK_BEGIN_COMMAND_BUFFER;
-    message.header.size = sizeof(CommandBufferBeginParams);
-    message.header.sequence = reinterpret_cast<uint64_t>(commandBuffer);
-    message.payload.resize(sizeof(CommandBufferBeginParams));
-    std::memcpy(message.payload.data(), &params, sizeof(CommandBufferBeginParams));
+    {
+        // Begin again without end or reset starts over, as in Vulkan
+        std::lock_guard<std::mutex> lock(command_buffer_mutex_);
+        auto it = command_buffers_.find(commandBuffer);
+        if (it != command_buffers_.end()) {
+            it->second.recording_open = true;
+            it->second.recording.clear();
+        }
+    }
 
-    // Send command and wait for response
-    return sendCommand(message);
+    // Deferred: the result is predicted locally, failures replay at the next sync point
+    static thread_local std::vector<uint8_t> arena;
+    size_t size = network::encodeWire(params, arena, mapHandle);
+    return recordCommand(commandBuffer, network::MessageType::VK_BEGIN_COMMAND_BUFFER,
+        arena.data(), size);
 }
 
 VkResult VulkanICD::vkEndCommandBuffer(VkCommandBuffer commandBuffer)
 {
     // Create message with command buffer handle
-    network::Message message;
-    message.header.type = network::MessageType::VK_END_COMMAND_BUFFER;
-    message.header.size = sizeof(VkCommandBuffer);
-    message.header.sequence = reinterpret_cast<uint64_t>(commandBuffer);
-    message.payload.resize(sizeof(VkCommandBuffer));
-    std::memcpy(message.payload.data(), &commandBuffer, sizeof(VkCommandBuffer));
+    uint64_t command_buffer = toWire(commandBuffer);
+    VkResult result = recordCommand(commandBuffer, network::MessageType::VK_END_COMMAND_BUFFER,
+        &command_buffer, sizeof(command_buffer));
+    if (result != VK_SUCCESS) {
+        return result;
+    }
 
-    // Send command and wait for response
-    return sendCommand(message);
+    std::vector<uint8_t> recording;
+    {
+        std::lock_guard<std::mutex> lock(command_buffer_mutex_);
+        auto it = command_buffers_.find(commandBuffer);
+        if (it == command_buffers_.end() || !it->second.recording_open) {
+            return VK_SUCCESS;  // Sent as it went
+        }
+        it->second.recording_open = false;
+        recording.swap(it->second.recording);
+    }
+
+    // Deferred: the result is predicted locally, failures replay at the next sync point
+    return sendRecording(commandBuffer, recording);
 }
 
 VkResult VulkanICD::vkResetCommandBuffer(VkCommandBuffer commandBuffer,
     VkCommandBufferResetFlags flags)
 {
     // Create message with command buffer reset parameters
-    struct CommandBufferResetParams {
-        VkCommandBuffer command_buffer;
-        VkCommandBufferResetFlags flags;
-    };
-    CommandBufferResetParams params;
-    params.command_buffer = commandBuffer;
+    network::ResetCommandBufferParams params = {};
+    params.command_buffer = toWire(commandBuffer);
     params.flags = flags;
 
-    network::Message message;
-    message.header.type = network::MessageType::VK_RESET_COMMAND_BUFFER;
-    message.header.size = sizeof(CommandBufferResetParams);
-    message.header.sequence = reinterpret_cast<uint64_t>(commandBuffer);
-    message.payload.resize(sizeof(CommandBufferResetParams));
-    std::memcpy(message.payload.data(), &params, sizeof(CommandBufferResetParams));
+    {
+        // A recording in progress is abandoned
+        std::lock_guard<std::mutex> lock(command_buffer_mutex_);
+        auto it = command_buffers_.find(commandBuffer);
+        if (it != command_buffers_.end()) {
+            it->second.recording_open = false;
+            it->second.recording.clear();
+        }
+    }
 
-    // Send command and wait for response
-    return sendCommand(message);
+    // Deferred: the result is predicted locally, failures replay at the next sync point
+    return enqueueCommand(makeCommand(network::MessageType::VK_RESET_COMMAND_BUFFER, params));
+}
+
+VkResult VulkanICD::recordCommand(VkCommandBuffer command_buffer, network::MessageType type,
+    const void* payload, size_t size)
+{
+    {
+        std::lock_guard<std::mutex> lock(command_buffer_mutex_);
+        auto it = command_buffers_.find(command_buffer);
+        if (it != command_buffers_.end() && it->second.recording_open &&
+            size >= sizeof(uint64_t)) {
+            // Packed without what changes between identical recordings: the
+            // sequence, and the command buffer every command starts with
+            std::vector<uint8_t>& recording = it->second.recording;
+            network::CommandRecordHeader header = {};
+            header.type = type;
+            header.size = static_cast<uint32_t>(size);
+            size_t offset = recording.size();
+            recording.resize(offset + network::commandRecordSize(size), 0);
+            std::memcpy(recording.data() + offset, &header, sizeof(header));
+            std::memcpy(recording.data() + offset + sizeof(header) + sizeof(uint64_t),
+                static_cast<const uint8_t*>(payload) + sizeof(uint64_t), size - sizeof(uint64_t));
+            return VK_SUCCESS;
+        }
+    }
+
+    if (!command_stream_->enqueue(type, nextSequence(), payload, size)) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    return VK_SUCCESS;
+}
+
+VkResult VulkanICD::sendRecording(VkCommandBuffer command_buffer,
+    const std::vector<uint8_t>& recording)
+{
+    uint64_t handle = toWire(command_buffer);
+    RecordingCache* cache = recording.size() <= network::MAX_RECORDING_SIZE ?
+        recording_caches_.local() : nullptr;
+
+    // Too large to keep, or no slots left: the commands go as they are
+    if (!cache) {
+        std::vector<uint8_t> payload;
+        bool sent = network::forEachCommandRecord(recording.data(), recording.size(),
+            [&](const network::CommandRecordHeader& record, const uint8_t* data) {
+                payload.assign(data, data + record.size);
+                std::memcpy(payload.data(), &handle, sizeof(handle));
+                return command_stream_->enqueue(record.type, nextSequence(),
+                    payload.data(), payload.size());
+            });
+        return sent ? VK_SUCCESS : VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    RecordingCache::Lookup lookup = cache->lookup(recording);
+    std::vector<uint8_t> payload;
+    network::MessageType type;
+    if (!lookup.replay) {
+        network::RecordingParams params = {};
+        params.command_buffer = handle;
+        params.recording_id = lookup.id;
+        params.size = static_cast<uint32_t>(recording.size());
+        payload.resize(sizeof(params) + recording.size());
+        std::memcpy(payload.data(), &params, sizeof(params));
+        std::memcpy(payload.data() + sizeof(params), recording.data(), recording.size());
+        type = network::MessageType::VK_RECORDING;
+    } else {
+        network::ReplayRecordingParams params = {};
+        params.command_buffer = handle;
+        params.recording_id = lookup.id;
+        params.patch_count = static_cast<uint32_t>(lookup.patches.size());
+        payload.resize(sizeof(params));
+        std::memcpy(payload.data(), &params, sizeof(params));
+        for (const network::RecordingPatch& patch : lookup.patches) {
+            size_t offset = payload.size();
+            size_t padded = (patch.size + network::COMMAND_RECORD_ALIGNMENT - 1) &
+                ~(network::COMMAND_RECORD_ALIGNMENT - 1);
+            payload.resize(offset + sizeof(patch) + padded, 0);
+            std::memcpy(payload.data() + offset, &patch, sizeof(patch));
+            std::memcpy(payload.data() + offset + sizeof(patch), recording.data() + patch.offset,
+                patch.size);
+        }
+        type = network::MessageType::VK_REPLAY_RECORDING;
+    }
+
+    if (!command_stream_->enqueue(type, nextSequence(), payload.data(), payload.size())) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    return VK_SUCCESS;
 }
 
 VkResult VulkanICD::vkQueueSubmit(VkQueue queue, uint32_t submitCount,
     const VkSubmitInfo* pSubmits, VkFence fence)
 {
     // Create message with queue submit parameters
-    struct QueueSubmitParams {
-        VkQueue queue;
-        uint32_t submit_count;
-        std::vector<VkSubmitInfo> submits;
-        VkFence fence;
-    };
-    QueueSubmitParams params;
-    params.queue = queue;
+    network::QueueSubmitParams params = {};
+    params.queue = toWire(queue);
+    params.fence = toWire(fence);
     params.submit_count = submitCount;
-    params.submits.assign(pSubmits, pSubmits + submitCount);
-    params.fence = fence;
-
-    network::Message message;
-    message.header.type = network::MessageType::VK_QUEUE_SUBMIT;
-    message.header.size = sizeof(QueueSubmitParams) + submitCount * sizeof(VkSubmitInfo);
-    message.header.sequence = reinterpret_cast<uint64_t>(queue);
-    message.payload.resize(message.header.size);
-    std::memcpy(message.payload.data(), &params, sizeof(QueueSubmitParams));
+    params.submits = pSubmits;
+
+    // Whatever the application wrote to mapped memory goes first, in the
+    // same stream, so the server has it before the work that reads it
+    {
+        std::lock_guard<std::mutex> lock(memory_mutex_);
+        for (auto& [memory, info] : memories_) {
+            if (info.mapped) {
+                VkResult result = uploadMemory(memory, info);
+                if (result != VK_SUCCESS) {
+                    return result;
+                }
+            }
+        }
+    }
 
-    // Send command and wait for response
-    return sendCommand(message);
+    // Deferred: the result is predicted locally, failures replay at the next sync point
+    return enqueueEncoded(network::MessageType::VK_QUEUE_SUBMIT, params);
 }
 
 VkResult VulkanICD::vkQueueWaitIdle(VkQueue queue)
 {
     // Create message with queue handle
-    network::Message message;
-    message.header.type = network::MessageType::VK_QUEUE_WAIT_IDLE;
-    message.header.size = sizeof(VkQueue);
-    message.header.sequence = reinterpret_cast<uint64_t>(queue);
-    message.payload.resize(sizeof(VkQueue));
-    std::memcpy(message.payload.data(), &queue, sizeof(VkQueue));
+    uint64_t wire_queue = toWire(queue);
+    network::Message message = makeCommand(network::MessageType::VK_QUEUE_WAIT_IDLE, wire_queue);
 
-    // Send command and wait for response
-    return sendCommand(message);
+    // Send command and wait for response, however long the queue takes
+    return sendCommand(message, nullptr, WAIT_FOREVER);
 }
 
 VkResult VulkanICD::vkAllocateMemory(VkDevice device,
@@ -477,86 +862,156 @@ VkResult VulkanICD::vkAllocateMemory(VkDevice device,
     const VkAllocationCallbacks* pAllocator, VkDeviceMemory* pMemory)
 {
     // Create message with memory allocation parameters
-    struct MemoryAllocateParams {
-        VkDevice device;
-        VkMemoryAllocateInfo allocate_info;
-    };
-    MemoryAllocateParams params;
-    params.device = device;
-    std::memcpy(&params.allocate_info, pAllocateInfo, sizeof(VkMemoryAllocateInfo));
+    network::AllocateMemoryParams params = {};
+    *pMemory = createHandle<VkDeviceMemory>(network::HandleType::DEVICE_MEMORY);
+    params.device = toWire(device);
+    params.memory = toWire(*pMemory);
+    params.allocate_info = *pAllocateInfo;
+
+    // Fire and forget: the handle is minted locally, failures replay at the next sync point
+    VkResult result = enqueueEncoded(network::MessageType::VK_ALLOCATE_MEMORY, params);
+    if (result != VK_SUCCESS) {
+        *pMemory = VK_NULL_HANDLE;
+        return result;
+    }
 
-    network::Message message;
-    message.header.type = network::MessageType::VK_ALLOCATE_MEMORY;
-    message.header.size = sizeof(MemoryAllocateParams);
-    message.header.sequence = reinterpret_cast<uint64_t>(pMemory);
-    message.payload.resize(sizeof(MemoryAllocateParams));
-    std::memcpy(message.payload.data(), &params, sizeof(MemoryAllocateParams));
+    VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+    {
+        std::lock_guard<std::mutex> lock(device_mutex_);
+        auto it = devices_.find(device);
+        if (it != devices_.end()) {
+            physical_device = it->second.physical_device;
+        }
+    }
+    uint32_t readback_types = 0;
+    {
+        std::lock_guard<std::mutex> lock(instance_mutex_);
+        auto it = readback_memory_types_.find(physical_device);
+        if (it != readback_memory_types_.end()) {
+            readback_types = it->second;
+        }
+    }
 
-    // Send command and wait for response
-    return sendCommand(message);
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    MemoryInfo& info = memories_[*pMemory];
+    info.device = device;
+    info.size = pAllocateInfo->allocationSize;
+    info.readback = pAllocateInfo->memoryTypeIndex < 32 &&
+        (readback_types & (1u << pAllocateInfo->memoryTypeIndex)) != 0;
+    info.mapped = false;
+    return result;
 }
 
 void VulkanICD::vkFreeMemory(VkDevice device, VkDeviceMemory memory,
     const VkAllocationCallbacks* pAllocator)
 {
     // Create message with memory handle
-    network::Message message;
-    message.header.type = network::MessageType::VK_FREE_MEMORY;
-    message.header.size = sizeof(VkDeviceMemory);
-    message.header.sequence = reinterpret_cast<uint64_t>(memory);
-    message.payload.resize(sizeof(VkDeviceMemory));
-    std::memcpy(message.payload.data(), &memory, sizeof(VkDeviceMemory));
+    network::DestroyObjectParams params = {};
+    params.parent = toWire(device);
+    params.object = toWire(memory);
 
-    // Send command
-    sendCommand(message);
+    // Deferred: no round trip
+    enqueueCommand(makeCommand(network::MessageType::VK_FREE_MEMORY, params));
+
+    // Unsent writes go with it
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    memories_.erase(memory);
 }
 
 VkResult VulkanICD::vkMapMemory(VkDevice device, VkDeviceMemory memory,
     VkDeviceSize offset, VkDeviceSize size, VkMemoryMapFlags flags,
     void** ppData)
 {
-    // Create message with memory mapping parameters
-    struct MemoryMapParams {
-        VkDevice device;
-        VkDeviceMemory memory;
-        VkDeviceSize offset;
-        VkDeviceSize size;
-        VkMemoryMapFlags flags;
-    };
-    MemoryMapParams params;
-    params.device = device;
-    params.memory = memory;
-    params.offset = offset;
-    params.size = size;
-    params.flags = flags;
-
-    network::Message message;
-    message.header.type = network::MessageType::VK_MAP_MEMORY;
-    message.header.size = sizeof(MemoryMapParams);
-    message.header.sequence = reinterpret_cast<uint64_t>(memory);
-    message.payload.resize(sizeof(MemoryMapParams));
-    std::memcpy(message.payload.data(), &params, sizeof(MemoryMapParams));
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    auto it = memories_.find(memory);
+    if (it == memories_.end() || it->second.mapped || offset >= it->second.size) {
+        return VK_ERROR_MEMORY_MAP_FAILED;
+    }
+    MemoryInfo& info = it->second;
 
-    // Send command and wait for response
-    VkResult result = sendCommand(message);
-    if (result == VK_SUCCESS) {
-        *ppData = message.payload.data();
+    // The application writes to the shadow, which is what the server's
+    // memory looks like as far as the client has told it
+    if (!info.shadow) {
+        info.shadow = std::make_unique<ShadowMemory>(info.size);
     }
-    return result;
+    info.map_offset = offset;
+    info.map_size = size == VK_WHOLE_SIZE ? info.size - offset : size;
+
+    // Memory the application reads back from is a sync point: the shadow
+    // takes in what the device wrote before the application sees it
+    if (info.readback) {
+        VkResult result = fetchMemory(memory, info);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+    info.mapped = true;
+    *ppData = info.shadow->data() + offset;
+    return VK_SUCCESS;
 }
 
 void VulkanICD::vkUnmapMemory(VkDevice device, VkDeviceMemory memory)
 {
-    // Create message with memory handle
-    network::Message message;
-    message.header.type = network::MessageType::VK_UNMAP_MEMORY;
-    message.header.size = sizeof(VkDeviceMemory);
-    message.header.sequence = reinterpret_cast<uint64_t>(memory);
-    message.payload.resize(sizeof(VkDeviceMemory));
-    std::memcpy(message.payload.data(), &memory, sizeof(VkDeviceMemory));
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    auto it = memories_.find(memory);
+    if (it == memories_.end() || !it->second.mapped) {
+        return;
+    }
 
-    // Send command
-    sendCommand(message);
+    // Deferred: no round trip
+    uploadMemory(memory, it->second);
+    it->second.mapped = false;
+}
+
+VkResult VulkanICD::uploadMemory(VkDeviceMemory memory, MemoryInfo& info)
+{
+    std::vector<ShadowMemory::Range> ranges;
+    info.shadow->collectDirty(info.map_offset, info.map_size, ranges);
+
+    network::WriteMemoryParams params = {};
+    params.device = toWire(info.device);
+    params.memory = toWire(memory);
+    for (const ShadowMemory::Range& range : ranges) {
+        for (VkDeviceSize done = 0; done < range.size; done += params.size) {
+            params.offset = range.offset + done;
+            params.size = std::min(range.size - done, MAX_WRITE_SIZE);
+
+            network::Message message = makeCommand(network::MessageType::VK_WRITE_MEMORY,
+                params, static_cast<size_t>(params.size));
+            std::memcpy(message.payload.data() + sizeof(params),
+                info.shadow->data() + params.offset, static_cast<size_t>(params.size));
+            VkResult result = enqueueCommand(message);
+            if (result != VK_SUCCESS) {
+                return result;
+            }
+        }
+    }
+    return VK_SUCCESS;
+}
+
+VkResult VulkanICD::fetchMemory(VkDeviceMemory memory, MemoryInfo& info)
+{
+    network::ReadMemoryParams params = {};
+    params.device = toWire(info.device);
+    params.memory = toWire(memory);
+    VkDeviceSize end = std::min(info.map_offset + info.map_size, info.size);
+    for (VkDeviceSize offset = info.map_offset; offset < end; offset += params.size) {
+        params.offset = offset;
+        params.size = std::min(end - offset, MAX_WRITE_SIZE);
+
+        // Flushes first, so what the application wrote earlier is in there
+        network::Message message = makeCommand(network::MessageType::VK_READ_MEMORY, params);
+        std::vector<uint8_t> response;
+        VkResult result = sendCommand(message, &response);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+        if (response.size() != params.size) {
+            return VK_ERROR_MEMORY_MAP_FAILED;
+        }
+        info.shadow->load(params.offset, response.data(), params.size);
+    }
+    return VK_SUCCESS;
 }
 
 VkResult VulkanICD::vkCreateBuffer(VkDevice device,
@@ -564,65 +1019,44 @@ VkResult VulkanICD::vkCreateBuffer(VkDevice device,
     const VkAllocationCallbacks* pAllocator, VkBuffer* pBuffer)
 {
     // Create message with buffer creation parameters
-    struct BufferCreateParams {
-        VkDevice device;
-        VkBufferCreateInfo create_info;
-    };
-    BufferCreateParams params;
-    params.device = device;
-    std::memcpy(&params.create_info, pCreateInfo, sizeof(VkBufferCreateInfo));
-
-    network::Message message;
-    message.header.type = network::MessageType::VK_CREATE_BUFFER;
-    message.header.size = sizeof(BufferCreateParams);
-    message.header.sequence = reinterpret_cast<uint64_t>(pBuffer);
-    message.payload.resize(sizeof(BufferCreateParams));
-    std::memcpy(message.payload.data(), &params, sizeof(BufferCreateParams));
-
-    // Send command and wait for response
-    return sendCommand(message);
+    network::CreateBufferParams params = {};
+    *pBuffer = createHandle<VkBuffer>(network::HandleType::BUFFER);
+    params.device = toWire(device);
+    params.buffer = toWire(*pBuffer);
+    params.create_info = *pCreateInfo;
+
+    // Fire and forget: the handle is minted locally, failures replay at the next sync point
+    VkResult result = enqueueEncoded(network::MessageType::VK_CREATE_BUFFER, params);
+    if (result != VK_SUCCESS) {
+        *pBuffer = VK_NULL_HANDLE;
+    }
+    return result;
 }
 
 void VulkanICD::vkDestroyBuffer(VkDevice device, VkBuffer buffer,
     const VkAllocationCallbacks* pAllocator)
 {
     // Create message with buffer handle
-    network::Message message;
-    message.header.type = network::MessageType::VK_DESTROY_BUFFER;
-    message.header.size = sizeof(VkBuffer);
-    message.header.sequence = reinterpret_cast<uint64_t>(buffer);
-    message.payload.resize(sizeof(VkBuffer));
-    std::memcpy(message.payload.data(), &buffer, sizeof(VkBuffer));
+    network::DestroyObjectParams params = {};
+    params.parent = toWire(device);
+    params.object = toWire(buffer);
 
-    // Send command
-    sendCommand(message);
+    // Deferred: no round trip
+    enqueueCommand(makeCommand(network::MessageType::VK_DESTROY_BUFFER, params));
 }
 
 VkResult VulkanICD::vkBindBufferMemory(VkDevice device, VkBuffer buffer,
     VkDeviceMemory memory, VkDeviceSize memoryOffset)
 {
     // Create message with buffer memory binding parameters
-    struct BufferMemoryBindParams {
-        VkDevice device;
-        VkBuffer buffer;
-        VkDeviceMemory memory;
-        VkDeviceSize memory_offset;
-    };
-    BufferMemoryBindParams params;
-    params.device = device;
-    params.buffer = buffer;
-    params.memory = memory;
+    network::BindMemoryParams params = {};
+    params.device = toWire(device);
+    params.object = toWire(buffer);
+    params.memory = toWire(memory);
     params.memory_offset = memoryOffset;
 
-    network::Message message;
-    message.header.type = network::MessageType::VK_BIND_BUFFER_MEMORY;
-    message.header.size = sizeof(BufferMemoryBindParams);
-    message.header.sequence = reinterpret_cast<uint64_t>(buffer);
-    message.payload.resize(sizeof(BufferMemoryBindParams));
-    std::memcpy(message.payload.data(), &params, sizeof(BufferMemoryBindParams));
-
-    // Send command and wait for response
-    return sendCommand(message);
+    // Deferred: the result is predicted locally, failures replay at the next sync point
+    return enqueueCommand(makeCommand(network::MessageType::VK_BIND_BUFFER_MEMORY, params));
 }
 
 VkResult VulkanICD::vkCreateImage(VkDevice device,
@@ -630,65 +1064,121 @@ VkResult VulkanICD::vkCreateImage(VkDevice device,
     const VkAllocationCallbacks* pAllocator, VkImage* pImage)
 {
     // Create message with image creation parameters
-    struct ImageCreateParams {
-        VkDevice device;
-        VkImageCreateInfo create_info;
-    };
-    ImageCreateParams params;
-    params.device = device;
-    std::memcpy(&params.create_info, pCreateInfo, sizeof(VkImageCreateInfo));
-
-    network::Message message;
-    message.header.type = network::MessageType::VK_CREATE_IMAGE;
-    message.header.size = sizeof(ImageCreateParams);
-    message.header.sequence = reinterpret_cast<uint64_t>(pImage);
-    message.payload.resize(sizeof(ImageCreateParams));
-    std::memcpy(message.payload.data(), &params, sizeof(ImageCreateParams));
-
-    // Send command and wait for response
-    return sendCommand(message);
+    network::CreateImageParams params = {};
+    *pImage = createHandle<VkImage>(network::HandleType::IMAGE);
+    params.device = toWire(device);
+    params.image = toWire(*pImage);
+    params.create_info = *pCreateInfo;
+
+    // Fire and forget: the handle is minted locally, failures replay at the next sync point
+    VkResult result = enqueueEncoded(network::MessageType::VK_CREATE_IMAGE, params);
+    if (result != VK_SUCCESS) {
+        *pImage = VK_NULL_HANDLE;
+    }
+    return result;
 }
 
 void VulkanICD::vkDestroyImage(VkDevice device, VkImage image,
     const VkAllocationCallbacks* pAllocator)
 {
     // Create message with image handle
-    network::Message message;
-    message.header.type = network::MessageType::VK_DESTROY_IMAGE;
-    message.header.size = sizeof(VkImage);
-    message.header.sequence = reinterpret_cast<uint64_t>(image);
-    message.payload.resize(sizeof(VkImage));
-    std::memcpy(message.payload.data(), &image, sizeof(VkImage));
+    network::DestroyObjectParams params = {};
+    params.parent = toWire(device);
+    params.object = toWire(image);
 
-    // Send command
-    sendCommand(message);
+    // Deferred: no round trip
+    enqueueCommand(makeCommand(network::MessageType::VK_DESTROY_IMAGE, params));
 }
 
 VkResult VulkanICD::vkBindImageMemory(VkDevice device, VkImage image,
     VkDeviceMemory memory, VkDeviceSize memoryOffset)
 {
     // Create message with image memory binding parameters
-    struct ImageMemoryBindParams {
-        VkDevice device;
-        VkImage image;
-        VkDeviceMemory memory;
-        VkDeviceSize memory_offset;
-    };
-    ImageMemoryBindParams params;
-    params.device = device;
-    params.image = image;
-    params.memory = memory;
+    network::BindMemoryParams params = {};
+    params.device = toWire(device);
+    params.object = toWire(image);
+    params.memory = toWire(memory);
     params.memory_offset = memoryOffset;
 
-    network::Message message;
-    message.header.type = network::MessageType::VK_BIND_IMAGE_MEMORY;
-    message.header.size = sizeof(ImageMemoryBindParams);
-    message.header.sequence = reinterpret_cast<uint64_t>(image);
-    message.payload.resize(sizeof(ImageMemoryBindParams));
-    std::memcpy(message.payload.data(), &params, sizeof(ImageMemoryBindParams));
+    // Deferred: the result is predicted locally, failures replay at the next sync point
+    return enqueueCommand(makeCommand(network::MessageType::VK_BIND_IMAGE_MEMORY, params));
+}
 
-    // Send command and wait for response
-    return sendCommand(message);
+VkResult VulkanICD::vkCreateShaderModule(VkDevice device,
+    const VkShaderModuleCreateInfo* pCreateInfo,
+    const VkAllocationCallbacks* pAllocator, VkShaderModule* pShaderModule)
+{
+    // Create message with shader module creation parameters
+    network::CreateShaderModuleParams params = {};
+    *pShaderModule = createHandle<VkShaderModule>(network::HandleType::SHADER_MODULE);
+    params.device = toWire(device);
+    params.shader_module = toWire(*pShaderModule);
+    params.hash = network::hashContent(pCreateInfo->pCode, pCreateInfo->codeSize);
+    params.code_size = pCreateInfo->codeSize;
+    params.flags = pCreateInfo->flags;
+
+    // The hash goes first; the SPIR-V only if the server hasn't stored it
+    std::lock_guard<std::mutex> lock(shader_mutex_);
+    VkResult result = fetchShaderInventory(device);
+    if (result == VK_SUCCESS) {
+        params.has_code = known_shaders_.count(params.hash) ? 0 : 1;
+        size_t code_size = params.has_code ? pCreateInfo->codeSize : 0;
+        network::Message message = makeCommand(network::MessageType::VK_CREATE_SHADER_MODULE,
+            params, code_size);
+        std::memcpy(message.payload.data() + sizeof(params), pCreateInfo->pCode, code_size);
+
+        // Fire and forget: the handle is minted locally, failures replay at the next sync point
+        result = enqueueCommand(message);
+    }
+    if (result != VK_SUCCESS) {
+        *pShaderModule = VK_NULL_HANDLE;
+        return result;
+    }
+    known_shaders_.insert(params.hash);
+    return VK_SUCCESS;
+}
+
+void VulkanICD::vkDestroyShaderModule(VkDevice device, VkShaderModule shaderModule,
+    const VkAllocationCallbacks* pAllocator)
+{
+    // Create message with shader module handle
+    network::DestroyObjectParams params = {};
+    params.parent = toWire(device);
+    params.object = toWire(shaderModule);
+
+    // Deferred: no round trip
+    enqueueCommand(makeCommand(network::MessageType::VK_DESTROY_SHADER_MODULE, params));
+}
+
+VkResult VulkanICD::fetchShaderInventory(VkDevice device) {
+    if (shader_inventory_fetched_) {
+        return VK_SUCCESS;
+    }
+
+    // One round trip per run, at the first shader module
+    uint64_t wire_device = toWire(device);
+    network::Message message = makeCommand(network::MessageType::VK_GET_SHADER_INVENTORY,
+        wire_device);
+    std::vector<uint8_t> response;
+    VkResult result = sendCommand(message, &response);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+    network::ShaderInventory inventory = {};
+    if (response.size() < sizeof(inventory)) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    std::memcpy(&inventory, response.data(), sizeof(inventory));
+    size_t count = std::min<size_t>(inventory.count,
+        (response.size() - sizeof(inventory)) / sizeof(network::ContentHash));
+    for (size_t i = 0; i < count; i++) {
+        network::ContentHash hash;
+        std::memcpy(hash.data(), response.data() + sizeof(inventory) + i * hash.size(),
+            hash.size());
+        known_shaders_.insert(hash);
+    }
+    shader_inventory_fetched_ = true;
+    return VK_SUCCESS;
 }
 
 VkResult VulkanICD::vkCreateSemaphore(VkDevice device,
@@ -696,38 +1186,30 @@ VkResult VulkanICD::vkCreateSemaphore(VkDevice device,
     const VkAllocationCallbacks* pAllocator, VkSemaphore* pSemaphore)
 {
     // Create message with semaphore creation parameters
-    struct SemaphoreCreateParams {
-        VkDevice device;
-        VkSemaphoreCreateInfo create_info;
-    };
-    SemaphoreCreateParams params;
-    params.device = device;
-    std::memcpy(&params.create_info, pCreateInfo, sizeof(VkSemaphoreCreateInfo));
-
-    network::Message message;
-    message.header.type = network::MessageType::VK_CREATE_SEMAPHORE;
-    message.header.size = sizeof(SemaphoreCreateParams);
-    message.header.sequence = reinterpret_cast<uint64_t>(pSemaphore);
-    message.payload.resize(sizeof(SemaphoreCreateParams));
-    std::memcpy(message.payload.data(), &params, sizeof(SemaphoreCreateParams));
-
-    // Send command and wait for response
-    return sendCommand(message);
+    network::CreateSemaphoreParams params = {};
+    *pSemaphore = createHandle<VkSemaphore>(network::HandleType::SEMAPHORE);
+    params.device = toWire(device);
+    params.semaphore = toWire(*pSemaphore);
+    params.create_info = *pCreateInfo;
+
+    // Fire and forget: the handle is minted locally, failures replay at the next sync point
+    VkResult result = enqueueEncoded(network::MessageType::VK_CREATE_SEMAPHORE, params);
+    if (result != VK_SUCCESS) {
+        *pSemaphore = VK_NULL_HANDLE;
+    }
+    return result;
 }
 
 void VulkanICD::vkDestroySemaphore(VkDevice device, VkSemaphore semaphore,
     const VkAllocationCallbacks* pAllocator)
 {
     // Create message with semaphore handle
-    network::Message message;
-    message.header.type = network::MessageType::VK_DESTROY_SEMAPHORE;
-    message.header.size = sizeof(VkSemaphore);
-    message.header.sequence = reinterpret_cast<uint64_t>(semaphore);
-    message.payload.resize(sizeof(VkSemaphore));
-    std::memcpy(message.payload.data(), &semaphore, sizeof(VkSemaphore));
+    network::DestroyObjectParams params = {};
+    params.parent = toWire(device);
+    params.object = toWire(semaphore);
 
-    // Send command
-    sendCommand(message);
+    // Deferred: no round trip
+    enqueueCommand(makeCommand(network::MessageType::VK_DESTROY_SEMAPHORE, params));
 }
 
 VkResult VulkanICD::vkCreateFence(VkDevice device,
@@ -735,138 +1217,333 @@ VkResult VulkanICD::vkCreateFence(VkDevice device,
     const VkAllocationCallbacks* pAllocator, VkFence* pFence)
 {
     // Create message with fence creation parameters
-    struct FenceCreateParams {
-        VkDevice device;
-        VkFenceCreateInfo create_info;
-    };
-    FenceCreateParams params;
-    params.device = device;
-    std::memcpy(&params.create_info, pCreateInfo, sizeof(VkFenceCreateInfo));
-
-    network::Message message;
-    message.header.type = network::MessageType::VK_CREATE_FENCE;
-    message.header.size = sizeof(FenceCreateParams);
-    message.header.sequence = reinterpret_cast<uint64_t>(pFence);
-    message.payload.resize(sizeof(FenceCreateParams));
-    std::memcpy(message.payload.data(), &params, sizeof(FenceCreateParams));
-
-    // Send command and wait for response
-    return sendCommand(message);
+    network::CreateFenceParams params = {};
+    *pFence = createHandle<VkFence>(network::HandleType::FENCE);
+    params.device = toWire(device);
+    params.fence = toWire(*pFence);
+    params.create_info = *pCreateInfo;
+
+    // Fire and forget: the handle is minted locally, failures replay at the next sync point
+    VkResult result = enqueueEncoded(network::MessageType::VK_CREATE_FENCE, params);
+    if (result != VK_SUCCESS) {
+        *pFence = VK_NULL_HANDLE;
+    }
+    return result;
 }
 
 void VulkanICD::vkDestroyFence(VkDevice device, VkFence fence,
     const VkAllocationCallbacks* pAllocator)
 {
     // Create message with fence handle
-    network::Message message;
-    message.header.type = network::MessageType::VK_DESTROY_FENCE;
-    message.header.size = sizeof(VkFence);
-    message.header.sequence = reinterpret_cast<uint64_t>(fence);
-    message.payload.resize(sizeof(VkFence));
-    std::memcpy(message.payload.data(), &fence, sizeof(VkFence));
+    network::DestroyObjectParams params = {};
+    params.parent = toWire(device);
+    params.object = toWire(fence);
 
-    // Send command
-    sendCommand(message);
+    // Deferred: no round trip
+    enqueueCommand(makeCommand(network::MessageType::VK_DESTROY_FENCE, params));
 }
 
 VkResult VulkanICD::vkWaitForFences(VkDevice device, uint32_t fenceCount,
     const VkFence* pFences, VkBool32 waitAll, uint64_t timeout)
 {
     // Create message with fence wait parameters
-    struct FenceWaitParams {
-        VkDevice device;
-        uint32_t fence_count;
-        std::vector<VkFence> fences;
-        VkBool32 wait_all;
-        uint64_t timeout;
-    };
-    FenceWaitParams params;
-    params.device = device;
+    network::WaitForFencesParams params = {};
+    params.device = toWire(device);
+    params.timeout = timeout;
     params.fence_count = fenceCount;
-    params.fences.assign(pFences, pFences + fenceCount);
     params.wait_all = waitAll;
-    params.timeout = timeout;
-
-    network::Message message;
-    message.header.type = network::MessageType::VK_WAIT_FOR_FENCES;
-    message.header.size = sizeof(FenceWaitParams) + fenceCount * sizeof(VkFence);
-    message.header.sequence = reinterpret_cast<uint64_t>(device);
-    message.payload.resize(message.header.size);
-    std::memcpy(message.payload.data(), &params, sizeof(FenceWaitParams));
+    params.fences = pFences;
 
     // Send command and wait for response
-    return sendCommand(message);
+    network::Message message = encodeCommand(network::MessageType::VK_WAIT_FOR_FENCES, params);
+    std::vector<uint8_t> response;
+    VkResult result = sendCommand(message, &response, timeout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    // The reply carries the server's result, VK_SUCCESS or VK_TIMEOUT
+    int32_t fence_result = VK_SUCCESS;
+    if (response.size() >= sizeof(fence_result)) {
+        std::memcpy(&fence_result, response.data(), sizeof(fence_result));
+    }
+    return static_cast<VkResult>(fence_result);
 }
 
 VkResult VulkanICD::vkResetFences(VkDevice device, uint32_t fenceCount,
     const VkFence* pFences)
 {
     // Create message with fence reset parameters
-    struct FenceResetParams {
-        VkDevice device;
-        uint32_t fence_count;
-        std::vector<VkFence> fences;
-    };
-    FenceResetParams params;
-    params.device = device;
+    network::ResetFencesParams params = {};
+    params.device = toWire(device);
     params.fence_count = fenceCount;
-    params.fences.assign(pFences, pFences + fenceCount);
+    params.fences = pFences;
 
-    network::Message message;
-    message.header.type = network::MessageType::VK_RESET_FENCES;
-    message.header.size = sizeof(FenceResetParams) + fenceCount * sizeof(VkFence);
-    message.header.sequence = reinterpret_cast<uint64_t>(device);
-    message.payload.resize(message.header.size);
-    std::memcpy(message.payload.data(), &params, sizeof(FenceResetParams));
-
-    // Send command and wait for response
-    return sendCommand(message);
+    // Deferred: the result is predicted locally, failures replay at the next sync point
+    return enqueueEncoded(network::MessageType::VK_RESET_FENCES, params);
 }
 
-VkResult VulkanICD::sendCommand(const network::Message& message) {
+VkResult VulkanICD::sendCommand(network::Message& message, std::vector<uint8_t>* response,
+    uint64_t timeout_ns)
+{
+    // Everything deferred so far must reach the server ahead of a sync point
+    VkResult result = flushCommands();
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    // The sequence doubles as the request id the server echoes back
+    uint64_t request_id = nextSequence();
+    message.header.sequence = request_id;
+    message.header.request_id = request_id;
+
+    // Registered before sending so a fast reply can't arrive ahead of it
+    auto pending = std::make_shared<PendingResponse>();
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        pending_responses_[request_id] = pending;
+    }
+
     if (!network_->sendMessage(message)) {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        pending_responses_.erase(request_id);
         return VK_ERROR_INITIALIZATION_FAILED;
     }
-    return waitForResponse(message.header.sequence);
+
+    result = waitForResponse(pending, request_id, response, timeout_ns);
+
+    // Surface failures of deferred commands at the sync point
+    int32_t deferred_error = command_stream_->takeDeferredError();
+    if (result == VK_SUCCESS && deferred_error != VK_SUCCESS) {
+        result = static_cast<VkResult>(deferred_error);
+    }
+    return result;
+}
+
+VkResult VulkanICD::enqueueCommand(const network::Message& message) {
+    if (!command_stream_->enqueue(message.header.type, nextSequence(),
+            message.payload.data(), message.payload.size())) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    return VK_SUCCESS;
+}
+
+VkResult VulkanICD::flushCommands() {
+    return command_stream_->flush() ? VK_SUCCESS : VK_ERROR_INITIALIZATION_FAILED;
+}
+
+uint64_t VulkanICD::nextSequence() {
+    return next_sequence_++;
+}
+
+VkResult VulkanICD::waitForResponse(const std::shared_ptr<PendingResponse>& pending,
+    uint64_t request_id, std::vector<uint8_t>* response, uint64_t timeout_ns)
+{
+    // A finite wait gets the round trip on top of the call's own timeout
+    auto now = std::chrono::steady_clock::now();
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    auto margin = std::chrono::milliseconds(REPLY_MARGIN_MS);
+    auto headroom = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now - margin);
+    if (timeout_ns < static_cast<uint64_t>(headroom.count())) {
+        deadline = now + margin + std::chrono::nanoseconds(static_cast<int64_t>(timeout_ns));
+    }
+
+    // Waits in slices, so a dropped connection ends the wait
+    VkResult result = VK_SUCCESS;
+    auto ready = [&pending]() { return pending->ready.load(std::memory_order_acquire); };
+    while (!ready()) {
+        now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            result = VK_TIMEOUT;
+            break;
+        }
+        if (!network_->isConnected()) {
+            result = VK_ERROR_DEVICE_LOST;
+            break;
+        }
+        auto slice_end = std::min(deadline, now + std::chrono::milliseconds(CONNECTION_CHECK_MS));
+        if (busy_poll_) {
+            while (!ready() && std::chrono::steady_clock::now() < slice_end) {
+            }
+        } else {
+            std::unique_lock<std::mutex> lock(pending->mutex);
+            pending->ready_cv.wait_until(lock, slice_end, ready);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        pending_responses_.erase(request_id);
+    }
+
+    // A reply that beat the check still counts
+    if (!ready()) {
+        return result;
+    }
+    if (response) {
+        *response = std::move(pending->payload);
+    }
+    return pending->result;
 }
 
-VkResult VulkanICD::waitForResponse(uint64_t sequence) {
-    // Wait for response with timeout
-    std::chrono::milliseconds timeout(5000);  // 5 seconds
-    auto start = std::chrono::steady_clock::now();
-    while (std::chrono::steady_clock::now() - start < timeout) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+void VulkanICD::completeResponse(uint64_t request_id, VkResult result,
+    const uint8_t* data, size_t size)
+{
+    std::shared_ptr<PendingResponse> pending;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        auto it = pending_responses_.find(request_id);
+        if (it == pending_responses_.end()) {
+            return;  // Timed out already, or not a reply to a synchronous call
+        }
+        pending = it->second;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pending->mutex);
+        pending->result = result;
+        pending->payload.assign(data, data + size);
+        pending->ready.store(true, std::memory_order_release);
     }
-    return VK_TIMEOUT;
+    pending->ready_cv.notify_one();
 }
 
 void VulkanICD::handleResponse(const network::Message& message) {
-    if (message.header.type == network::MessageType::ERROR) {
-        handleError(message);
+    switch (message.header.type) {
+        case network::MessageType::VK_COMMAND_RESULT:
+            command_stream_->handleResult(message);
+            break;
+        case network::MessageType::ERROR:
+            handleError(message);
+            break;
+        case network::MessageType::HEARTBEAT:
+            break;
+        case network::MessageType::FRAME_DATA: {
+            std::lock_guard<std::mutex> lock(decoder_mutex_);
+            if (frame_decoder_) {
+                frame_decoder_->onFrameData(message);
+            }
+            break;
+        }
+        default:
+            completeResponse(message.header.request_id, VK_SUCCESS,
+                message.payload.data(), message.payload.size());
+            break;
     }
 }
 
 void VulkanICD::handleError(const network::Message& message) {
     network::ErrorInfo error_info;
+    if (message.payload.size() < sizeof(error_info.code)) {
+        completeResponse(message.header.request_id, VK_ERROR_UNKNOWN, nullptr, 0);
+        return;
+    }
+
     std::memcpy(&error_info.code, message.payload.data(), sizeof(error_info.code));
     error_info.message = std::string(
         reinterpret_cast<const char*>(message.payload.data() + sizeof(error_info.code)),
         message.payload.size() - sizeof(error_info.code)
     );
-    // Log error
+
+    // The server sends the failing VkResult as the error code
+    completeResponse(message.header.request_id,
+        static_cast<VkResult>(static_cast<int32_t>(error_info.code)), nullptr, 0);
+}
+
+void VulkanICD::createFrameDecoder(VkSwapchainKHR swapchain,
+    const VkSwapchainCreateInfoKHR& create_info)
+{
+    void* window = FrameDecoder::windowFromSurface(create_info.surface);
+    if (!window) {
+        return;     // Not a window surface; nothing to show frames in
+    }
+
+    std::lock_guard<std::mutex> lock(decoder_mutex_);
+
+    // A window takes one flip model swapchain, so the old one goes first
+    frame_decoder_.reset();
+    decoder_swapchain_ = VK_NULL_HANDLE;
+
+    FrameDecoder::Config config = {};
+    config.window = window;
+    config.width = create_info.imageExtent.width;
+    config.height = create_info.imageExtent.height;
+    config.fps = STREAM_FPS;
+    config.jitter_frames = jitter_frames_;
+
+    auto decoder = std::make_unique<FrameDecoder>(config);
+    decoder->setFrameCallback([this](uint64_t sequence) {
+        sendFrameAck(sequence);
+    });
+    if (!decoder->initialize()) {
+        return;     // Rendering still works, it just isn't shown
+    }
+    frame_decoder_ = std::move(decoder);
+    decoder_swapchain_ = swapchain;
+}
+
+void VulkanICD::requestFrame(VkSwapchainKHR swapchain) {
+    // Once per window: the server streams every present after it
+    {
+        std::lock_guard<std::mutex> lock(decoder_mutex_);
+        if (!frame_decoder_) {
+            return;
+        }
+    }
+
+    network::FrameRequest request = {};
+    request.swapchain = toWire(swapchain);
+    network::Message message = makeCommand(network::MessageType::FRAME_REQUEST, request);
+    message.header.sequence = nextSequence();
+    message.header.request_id = message.header.sequence;
+    network_->sendMessage(std::move(message));
+}
+
+void VulkanICD::sendFrameAck(uint64_t sequence) {
+    // Frame sequences are the server's, echoed back
+    network::Message message;
+    message.header.type = network::MessageType::FRAME_ACK;
+    message.header.sequence = sequence;
+    network_->sendMessage(std::move(message));
 }
 
 void VulkanICD::cleanupResources() {
+    // Stop showing frames before the connection they arrive on goes away
+    {
+        std::lock_guard<std::mutex> lock(decoder_mutex_);
+        frame_decoder_.reset();
+        decoder_swapchain_ = VK_NULL_HANDLE;
+    }
+
     // Clean up all resources
     std::lock_guard<std::mutex> instance_lock(instance_mutex_);
     std::lock_guard<std::mutex> device_lock(device_mutex_);
     std::lock_guard<std::mutex> swapchain_lock(swapchain_mutex_);
+    std::lock_guard<std::mutex> memory_lock(memory_mutex_);
     std::lock_guard<std::mutex> command_pool_lock(command_pool_mutex_);
     std::lock_guard<std::mutex> command_buffer_lock(command_buffer_mutex_);
 
+    // Dispatchable handles are backed by client allocations
+    for (auto& command_buffer : command_buffers_) {
+        destroyDispatchable(command_buffer.first);
+    }
+    for (auto& device : devices_) {
+        for (auto& queue : device.second.queues) {
+            destroyDispatchable(queue.second);
+        }
+        destroyDispatchable(device.first);
+    }
+    for (auto& instance : instances_) {
+        for (VkPhysicalDevice physical_device : instance.second.physical_devices) {
+            destroyDispatchable(physical_device);
+        }
+        destroyDispatchable(instance.first);
+    }
+
     instances_.clear();
     devices_.clear();
     swapchains_.clear();
+    memories_.clear();
     command_pools_.clear();
     command_buffers_.clear();
 }
@@ -0,0 +1,114 @@
+#include "common/gpu/capture_engine.hpp"
+#include "common/gpu/readback_capture.hpp"
+
+namespace anarchy {
+namespace gpu {
+
+CaptureEngine::CaptureEngine(const FrameCapture::CaptureConfig& config, std::vector<Backend> order)
+    : config_(config)
+    , order_(std::move(order))
+{
+    if (order_.empty()) {
+        if (config_.hardware_encoding) {
+            order_.push_back(Backend::NVENC);
+        }
+        order_.push_back(Backend::SOFTWARE);
+    }
+}
+
+CaptureEngine::~CaptureEngine() = default;
+
+bool CaptureEngine::initialize(VkDevice device, VkPhysicalDevice physical_device,
+    uint32_t queue_family)
+{
+    // A backend that fails part way cleans up after itself when destroyed,
+    // so the next one starts on a clean device
+    for (Backend backend : order_) {
+        std::unique_ptr<CaptureBackend> candidate = createBackend(backend);
+        if (candidate->initialize(device, physical_device, queue_family)) {
+            active_ = std::move(candidate);
+            backend_ = backend;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::unique_ptr<CaptureBackend> CaptureEngine::createBackend(Backend backend) const {
+    if (backend == Backend::NVENC) {
+        return std::make_unique<FrameCapture>(config_);
+    }
+
+    ReadbackCapture::Config readback = {};
+    readback.width = config_.width;
+    readback.height = config_.height;
+    readback.format = config_.format;
+    readback.compress = backend == Backend::SOFTWARE;
+    readback.keyframe_interval = config_.gop_size > 0 ?
+        config_.gop_size : SoftwareEncoder::DEFAULT_KEYFRAME_INTERVAL;
+    readback.slot_count = ReadbackCapture::DEFAULT_SLOT_COUNT;
+    return std::make_unique<ReadbackCapture>(readback);
+}
+
+network::FrameEncoding CaptureEngine::encoding() const {
+    if (!active_) {
+        return network::FrameEncoding::NONE;
+    }
+    if (backend_ != Backend::NVENC) {
+        return network::FrameEncoding::SOFTWARE;
+    }
+    switch (config_.codec) {
+        case FrameCapture::Codec::HEVC:
+            return network::FrameEncoding::HEVC;
+        case FrameCapture::Codec::AV1:
+            return network::FrameEncoding::AV1;
+        case FrameCapture::Codec::H264:
+        default:
+            return network::FrameEncoding::H264;
+    }
+}
+
+const char* CaptureEngine::backendName(Backend backend) {
+    switch (backend) {
+        case Backend::NVENC:
+            return "nvenc";
+        case Backend::SOFTWARE:
+            return "software";
+        case Backend::RAW:
+            return "raw";
+    }
+    return "unknown";
+}
+
+bool CaptureEngine::captureFrame(VkImage image, uint64_t frame_id) {
+    return active_ && active_->captureFrame(image, frame_id);
+}
+
+bool CaptureEngine::getEncodedFrame(std::vector<uint8_t>& frame_data, bool* end_of_frame,
+    uint64_t* frame_id)
+{
+    return active_ && active_->getEncodedFrame(frame_data, end_of_frame, frame_id);
+}
+
+void CaptureEngine::flush() {
+    if (active_) {
+        active_->flush();
+    }
+}
+
+void CaptureEngine::setBitrate(uint32_t bitrate) {
+    if (active_) {
+        active_->setBitrate(bitrate);
+    }
+}
+
+bool CaptureEngine::setResolution(uint32_t width, uint32_t height) {
+    return active_ && active_->setResolution(width, height);
+}
+
+CaptureEngine::Statistics CaptureEngine::getStatistics() const {
+    return active_ ? active_->getStatistics() : Statistics{};
+}
+
+} // namespace gpu
+} // namespace anarchy
@@ -0,0 +1,100 @@
+#include "common/gpu/color_convert.hpp"
+
+namespace anarchy {
+namespace gpu {
+
+bool toSourceFormat(VkFormat format, SourceFormat& source_format) {
+    switch (format) {
+        case VK_FORMAT_B8G8R8A8_UNORM:
+        case VK_FORMAT_B8G8R8A8_SRGB:
+            source_format = SourceFormat::BGRA8;
+            return true;
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+            source_format = SourceFormat::RGBA8;
+            return true;
+        case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+            source_format = SourceFormat::RGB10A2;
+            return true;
+        case VK_FORMAT_A2R10G10B10_UNORM_PACK32:
+            source_format = SourceFormat::BGR10A2;
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool isTenBit(SourceFormat format) {
+    return format == SourceFormat::RGB10A2 || format == SourceFormat::BGR10A2;
+}
+
+bool isTenBit(TargetFormat format) {
+    return format == TargetFormat::P010 || format == TargetFormat::YUV444_10BIT;
+}
+
+bool isChroma444(TargetFormat format) {
+    return format == TargetFormat::YUV444 || format == TargetFormat::YUV444_10BIT;
+}
+
+size_t bytesPerSample(TargetFormat format) {
+    return isTenBit(format) ? 2 : 1;
+}
+
+uint32_t targetRows(TargetFormat format, uint32_t height) {
+    // 4:2:0 keeps interleaved UV at half height below the luma
+    return isChroma444(format) ? height * 3 : height + height / 2;
+}
+
+ColorCoefficients colorCoefficients(ColorMatrix matrix, bool full_range, TargetFormat target) {
+    float kr = 0.0f;
+    float kb = 0.0f;
+    switch (matrix) {
+        case ColorMatrix::BT601:
+            kr = 0.299f;
+            kb = 0.114f;
+            break;
+        case ColorMatrix::BT709:
+            kr = 0.2126f;
+            kb = 0.0722f;
+            break;
+        case ColorMatrix::BT2020:
+            kr = 0.2627f;
+            kb = 0.0593f;
+            break;
+    }
+    float kg = 1.0f - kr - kb;
+
+    // Limited range is 16-235 luma and 16-240 chroma at 8 bits, scaled up for 10
+    uint32_t bits = isTenBit(target) ? 10 : 8;
+    float scale = static_cast<float>(1u << (bits - 8));
+    float max_code = static_cast<float>((1u << bits) - 1);
+    float y_range = full_range ? max_code : 219.0f * scale;
+    float y_offset = full_range ? 0.0f : 16.0f * scale;
+    float c_range = full_range ? max_code : 224.0f * scale;
+    float c_offset = static_cast<float>(1u << (bits - 1));
+
+    ColorCoefficients coefficients = {};
+    coefficients.y[0] = kr * y_range;
+    coefficients.y[1] = kg * y_range;
+    coefficients.y[2] = kb * y_range;
+    coefficients.y[3] = y_offset;
+
+    // Cb = (B - Y) / (2 * (1 - Kb)), Cr = (R - Y) / (2 * (1 - Kr))
+    float cb = c_range / (2.0f * (1.0f - kb));
+    coefficients.u[0] = -kr * cb;
+    coefficients.u[1] = -kg * cb;
+    coefficients.u[2] = (1.0f - kb) * cb;
+    coefficients.u[3] = c_offset;
+
+    float cr = c_range / (2.0f * (1.0f - kr));
+    coefficients.v[0] = (1.0f - kr) * cr;
+    coefficients.v[1] = -kg * cr;
+    coefficients.v[2] = -kb * cr;
+    coefficients.v[3] = c_offset;
+
+    coefficients.max_code = max_code;
+    return coefficients;
+}
+
+} // namespace gpu
+} // namespace anarchy
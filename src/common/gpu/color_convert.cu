@@ -0,0 +1,161 @@
+#include "common/gpu/color_convert.hpp"
+#include <cuda_runtime.h>
+
+namespace anarchy {
+namespace gpu {
+
+namespace {
+
+constexpr uint32_t BLOCK_WIDTH = 32;
+constexpr uint32_t BLOCK_HEIGHT = 8;
+
+struct Rgb {
+    float r;
+    float g;
+    float b;
+};
+
+template <SourceFormat Format>
+__device__ Rgb loadPixel(const uint8_t* row, uint32_t x) {
+    uint32_t pixel = reinterpret_cast<const uint32_t*>(row)[x];
+    if constexpr (Format == SourceFormat::BGRA8) {
+        return {((pixel >> 16) & 0xFF) / 255.0f, ((pixel >> 8) & 0xFF) / 255.0f,
+            (pixel & 0xFF) / 255.0f};
+    } else if constexpr (Format == SourceFormat::RGBA8) {
+        return {(pixel & 0xFF) / 255.0f, ((pixel >> 8) & 0xFF) / 255.0f,
+            ((pixel >> 16) & 0xFF) / 255.0f};
+    } else if constexpr (Format == SourceFormat::RGB10A2) {
+        return {(pixel & 0x3FF) / 1023.0f, ((pixel >> 10) & 0x3FF) / 1023.0f,
+            ((pixel >> 20) & 0x3FF) / 1023.0f};
+    } else {
+        return {((pixel >> 20) & 0x3FF) / 1023.0f, ((pixel >> 10) & 0x3FF) / 1023.0f,
+            (pixel & 0x3FF) / 1023.0f};
+    }
+}
+
+__device__ float apply(const float (&row)[4], Rgb pixel) {
+    return fmaf(row[0], pixel.r, fmaf(row[1], pixel.g, fmaf(row[2], pixel.b, row[3])));
+}
+
+// 10-bit codes sit in the high bits of a 16-bit sample, as P010 expects
+template <typename Sample>
+__device__ Sample encode(float value, float max_code) {
+    uint32_t code = __float2uint_rn(fminf(fmaxf(value, 0.0f), max_code));
+    if constexpr (sizeof(Sample) == 2) {
+        return static_cast<Sample>(code << 6);
+    } else {
+        return static_cast<Sample>(code);
+    }
+}
+
+template <SourceFormat Format, typename Sample>
+__global__ void convert420(const uint8_t* source, size_t source_pitch, uint8_t* target,
+    size_t target_pitch, uint32_t width, uint32_t height, ColorCoefficients k)
+{
+    uint32_t x = (blockIdx.x * blockDim.x + threadIdx.x) * 2;
+    uint32_t y = (blockIdx.y * blockDim.y + threadIdx.y) * 2;
+    if (x >= width || y >= height) {
+        return;
+    }
+
+    const uint8_t* row0 = source + y * source_pitch;
+    const uint8_t* row1 = row0 + source_pitch;
+    Rgb p00 = loadPixel<Format>(row0, x);
+    Rgb p01 = loadPixel<Format>(row0, x + 1);
+    Rgb p10 = loadPixel<Format>(row1, x);
+    Rgb p11 = loadPixel<Format>(row1, x + 1);
+
+    Sample* luma0 = reinterpret_cast<Sample*>(target + y * target_pitch);
+    Sample* luma1 = reinterpret_cast<Sample*>(target + (y + 1) * target_pitch);
+    luma0[x] = encode<Sample>(apply(k.y, p00), k.max_code);
+    luma0[x + 1] = encode<Sample>(apply(k.y, p01), k.max_code);
+    luma1[x] = encode<Sample>(apply(k.y, p10), k.max_code);
+    luma1[x + 1] = encode<Sample>(apply(k.y, p11), k.max_code);
+
+    // The matrix is linear, so chroma of the block average is the average chroma
+    Rgb average = {(p00.r + p01.r + p10.r + p11.r) * 0.25f,
+        (p00.g + p01.g + p10.g + p11.g) * 0.25f,
+        (p00.b + p01.b + p10.b + p11.b) * 0.25f};
+    Sample* chroma = reinterpret_cast<Sample*>(target + (height + y / 2) * target_pitch);
+    chroma[x] = encode<Sample>(apply(k.u, average), k.max_code);
+    chroma[x + 1] = encode<Sample>(apply(k.v, average), k.max_code);
+}
+
+template <SourceFormat Format, typename Sample>
+__global__ void convert444(const uint8_t* source, size_t source_pitch, uint8_t* target,
+    size_t target_pitch, uint32_t width, uint32_t height, ColorCoefficients k)
+{
+    uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+    uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (x >= width || y >= height) {
+        return;
+    }
+
+    Rgb pixel = loadPixel<Format>(source + y * source_pitch, x);
+    size_t plane = static_cast<size_t>(height) * target_pitch;
+    uint8_t* row = target + y * target_pitch;
+    reinterpret_cast<Sample*>(row)[x] = encode<Sample>(apply(k.y, pixel), k.max_code);
+    reinterpret_cast<Sample*>(row + plane)[x] = encode<Sample>(apply(k.u, pixel), k.max_code);
+    reinterpret_cast<Sample*>(row + 2 * plane)[x] = encode<Sample>(apply(k.v, pixel), k.max_code);
+}
+
+template <SourceFormat Format>
+void launch(const ColorConvertParams& params, cudaStream_t stream) {
+    const uint8_t* source = reinterpret_cast<const uint8_t*>(params.source);
+    uint8_t* target = reinterpret_cast<uint8_t*>(params.target);
+    dim3 block(BLOCK_WIDTH, BLOCK_HEIGHT);
+
+    if (isChroma444(params.target_format)) {
+        dim3 grid((params.width + BLOCK_WIDTH - 1) / BLOCK_WIDTH,
+            (params.height + BLOCK_HEIGHT - 1) / BLOCK_HEIGHT);
+        if (isTenBit(params.target_format)) {
+            convert444<Format, uint16_t><<<grid, block, 0, stream>>>(source, params.source_pitch,
+                target, params.target_pitch, params.width, params.height, params.coefficients);
+        } else {
+            convert444<Format, uint8_t><<<grid, block, 0, stream>>>(source, params.source_pitch,
+                target, params.target_pitch, params.width, params.height, params.coefficients);
+        }
+        return;
+    }
+
+    dim3 grid((params.width / 2 + BLOCK_WIDTH - 1) / BLOCK_WIDTH,
+        (params.height / 2 + BLOCK_HEIGHT - 1) / BLOCK_HEIGHT);
+    if (isTenBit(params.target_format)) {
+        convert420<Format, uint16_t><<<grid, block, 0, stream>>>(source, params.source_pitch,
+            target, params.target_pitch, params.width, params.height, params.coefficients);
+    } else {
+        convert420<Format, uint8_t><<<grid, block, 0, stream>>>(source, params.source_pitch,
+            target, params.target_pitch, params.width, params.height, params.coefficients);
+    }
+}
+
+} // namespace
+
+CUresult convertColor(const ColorConvertParams& params, CUstream stream) {
+    if (params.width == 0 || params.height == 0) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (!isChroma444(params.target_format) && (params.width % 2 || params.height % 2)) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+
+    // Runtime launches go to the driver context current on this thread
+    switch (params.source_format) {
+        case SourceFormat::BGRA8:
+            launch<SourceFormat::BGRA8>(params, stream);
+            break;
+        case SourceFormat::RGBA8:
+            launch<SourceFormat::RGBA8>(params, stream);
+            break;
+        case SourceFormat::RGB10A2:
+            launch<SourceFormat::RGB10A2>(params, stream);
+            break;
+        case SourceFormat::BGR10A2:
+            launch<SourceFormat::BGR10A2>(params, stream);
+            break;
+    }
+    return cudaGetLastError() == cudaSuccess ? CUDA_SUCCESS : CUDA_ERROR_LAUNCH_FAILED;
+}
+
+} // namespace gpu
+} // namespace anarchy
@@ -0,0 +1,135 @@
+#include "common/gpu/command_list_graph.hpp"
+#include <algorithm>
+
+namespace anarchy {
+namespace gpu {
+
+void CommandListGraph::queue(uint32_t queue, List list) {
+    queues_[queue].lists.push_back(list);
+    queued_[list]++;
+}
+
+void CommandListGraph::addDependency(List list, List dependency) {
+    dependencies_[list].push_back(dependency);
+}
+
+std::vector<CommandListGraph::Batch> CommandListGraph::takeReady(const CompletedValue& completed) {
+    std::vector<Batch> batches;
+
+    // A batch on one queue can free lists on another, so until nothing moves
+    for (bool progress = true; progress;) {
+        progress = false;
+        for (auto& entry : queues_) {
+            Queue& queue = entry.second;
+            Batch batch = {};
+            batch.queue = entry.first;
+            batch.fence_value = queue.last_value + 1;
+
+            std::vector<Wait> waits;
+            while (!queue.lists.empty()) {
+                List list = queue.lists.front();
+                waits.clear();
+                if (!ready(list, entry.first, completed, waits)) {
+                    break;      // And everything behind it, to keep the order
+                }
+                for (const Wait& wait : waits) {
+                    auto it = std::find_if(batch.waits.begin(), batch.waits.end(),
+                        [&wait](const Wait& other) { return other.queue == wait.queue; });
+                    if (it == batch.waits.end()) {
+                        batch.waits.push_back(wait);
+                    } else {
+                        it->value = std::max(it->value, wait.value);
+                    }
+                }
+
+                queue.lists.pop_front();
+                if (--queued_[list] == 0) {
+                    queued_.erase(list);
+                }
+                dependencies_.erase(list);
+                submissions_[list] = {entry.first, batch.fence_value};
+                batch.lists.push_back(list);
+            }
+
+            if (!batch.lists.empty()) {
+                queue.last_value = batch.fence_value;
+                batches.push_back(std::move(batch));
+                progress = true;
+            }
+        }
+    }
+    return batches;
+}
+
+bool CommandListGraph::ready(List list, uint32_t queue, const CompletedValue& completed,
+    std::vector<Wait>& waits) const
+{
+    auto it = dependencies_.find(list);
+    if (it == dependencies_.end()) {
+        return true;
+    }
+    for (List dependency : it->second) {
+        if (queued_.count(dependency)) {
+            return false;
+        }
+        auto submission = submissions_.find(dependency);
+        if (submission == submissions_.end()) {
+            return false;
+        }
+
+        // The same queue runs it first anyway
+        const Submission& done = submission->second;
+        if (done.queue != queue && completed(done.queue) < done.value) {
+            waits.push_back({done.queue, done.value});
+        }
+    }
+    return true;
+}
+
+bool CommandListGraph::complete(List list, const CompletedValue& completed) const {
+    if (queued_.count(list)) {
+        return false;
+    }
+    auto it = submissions_.find(list);
+    return it != submissions_.end() && completed(it->second.queue) >= it->second.value;
+}
+
+bool CommandListGraph::dependenciesComplete(List list, const CompletedValue& completed) const {
+    auto it = dependencies_.find(list);
+    if (it == dependencies_.end()) {
+        return true;
+    }
+    return std::all_of(it->second.begin(), it->second.end(),
+        [this, &completed](List dependency) { return complete(dependency, completed); });
+}
+
+void CommandListGraph::forget(List list) {
+    for (auto& entry : queues_) {
+        auto& lists = entry.second.lists;
+        lists.erase(std::remove(lists.begin(), lists.end(), list), lists.end());
+    }
+    for (auto& entry : dependencies_) {
+        auto& dependencies = entry.second;
+        dependencies.erase(std::remove(dependencies.begin(), dependencies.end(), list),
+            dependencies.end());
+    }
+    queued_.erase(list);
+    submissions_.erase(list);
+    dependencies_.erase(list);
+}
+
+size_t CommandListGraph::pending() const {
+    size_t count = 0;
+    for (const auto& entry : queues_) {
+        count += entry.second.lists.size();
+    }
+    return count;
+}
+
+uint64_t CommandListGraph::lastValue(uint32_t queue) const {
+    auto it = queues_.find(queue);
+    return it != queues_.end() ? it->second.last_value : 0;
+}
+
+} // namespace gpu
+} // namespace anarchy
@@ -1,4 +1,6 @@
 #include "common/gpu/dx_compat.hpp"
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 #include <sstream>
 
@@ -7,7 +9,6 @@ namespace gpu {
 
 DXCompat::DXCompat(const DXConfig& config)
     : config_(config)
-    , current_fence_value_(0)
 {
 }
 
@@ -112,12 +113,15 @@ void DXCompat::cleanupResources() {
     {
         std::lock_guard<std::mutex> lock(resource_mutex_);
         resource_info_.clear();
+        mappings_.clear();
+        region_owners_.clear();
+        staging_ring_.reset();
+        staging_memory_.reset();
     }
 
     // Clean up command queues and batches
     cleanupCommandQueues();
     cleanupCommandRecords();
-    cleanupCommandOptimizations();
 
     // Release DirectX resources
     dx_.d3d11_context.Reset();
@@ -130,8 +134,8 @@ void DXCompat::cleanupResources() {
 void DXCompat::cleanupCommandQueues() {
     std::lock_guard<std::mutex> lock(command_queue_mutex_);
     command_queues_.clear();
-    command_batches_.clear();
-    current_fence_value_ = 0;
+    command_list_graph_ = CommandListGraph();
+    fence_signals_.clear();
 }
 
 void DXCompat::cleanupCommandRecords() {
@@ -139,12 +143,6 @@ void DXCompat::cleanupCommandRecords() {
     command_records_.clear();
 }
 
-void DXCompat::cleanupCommandOptimizations() {
-    std::lock_guard<std::mutex> lock(command_optimization_mutex_);
-    command_dependencies_.clear();
-    command_optimizations_.clear();
-}
-
 HRESULT DXCompat::getOrCreateCommandQueue(
     D3D12_COMMAND_LIST_TYPE type,
     UINT node_mask,
@@ -157,16 +155,38 @@ HRESULT DXCompat::getOrCreateCommandQueue(
     }
 
     std::lock_guard<std::mutex> lock(command_queue_mutex_);
+    HRESULT hr = ensureCommandQueue(type, node_mask, priority, flags);
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    *ppCommandQueue = command_queues_[type].queue.Get();
+    (*ppCommandQueue)->AddRef();
+    return S_OK;
+}
+
+HRESULT DXCompat::ensureCommandQueue(
+    D3D12_COMMAND_LIST_TYPE type,
+    UINT node_mask,
+    UINT priority,
+    D3D12_COMMAND_QUEUE_FLAGS flags)
+{
     auto it = command_queues_.find(type);
     if (it != command_queues_.end()) {
         // Return existing queue if it matches the requested parameters
         if (it->second.node_mask == node_mask &&
             it->second.priority == priority &&
             it->second.flags == flags) {
-            *ppCommandQueue = it->second.queue.Get();
-            (*ppCommandQueue)->AddRef();
             return S_OK;
         }
+
+        // Submissions refer to the old fence, so it has to be done first.
+        // A null event makes this a plain blocking wait.
+        HRESULT hr = it->second.fence->SetEventOnCompletion(
+            command_list_graph_.lastValue(type), nullptr);
+        if (FAILED(hr)) {
+            return hr;
+        }
     }
 
     // Create new command queue
@@ -182,35 +202,32 @@ HRESULT DXCompat::getOrCreateCommandQueue(
         return hr;
     }
 
+    // Starts where the type's fence values got to, so they keep increasing
+    Microsoft::WRL::ComPtr<ID3D12Fence> fence;
+    hr = dx_.d3d12_device->CreateFence(command_list_graph_.lastValue(type),
+        D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence));
+    if (FAILED(hr)) {
+        return hr;
+    }
+
     // Store the new queue
     CommandQueue cmd_queue = {
         queue,
+        fence,
         type,
         node_mask,
         priority,
         flags
     };
     command_queues_[type] = std::move(cmd_queue);
-
-    *ppCommandQueue = queue.Get();
-    (*ppCommandQueue)->AddRef();
     return S_OK;
 }
 
-HRESULT DXCompat::createCommandListBatch(
-    D3D12_COMMAND_LIST_TYPE type,
-    CommandListBatch** ppBatch)
-{
-    if (!ppBatch) {
-        return E_INVALIDARG;
-    }
-
-    std::lock_guard<std::mutex> lock(command_queue_mutex_);
-    command_batches_.emplace_back();
-    *ppBatch = &command_batches_.back();
-    (*ppBatch)->fence_value = ++current_fence_value_;
-    (*ppBatch)->is_closed = false;
-    return S_OK;
+CommandListGraph::CompletedValue DXCompat::completedValue() const {
+    return [this](uint32_t type) -> uint64_t {
+        auto it = command_queues_.find(static_cast<D3D12_COMMAND_LIST_TYPE>(type));
+        return it != command_queues_.end() ? it->second.fence->GetCompletedValue() : 0;
+    };
 }
 
 HRESULT DXCompat::recordCommandList(
@@ -225,16 +242,11 @@ HRESULT DXCompat::recordCommandList(
     std::lock_guard<std::mutex> lock(command_record_mutex_);
     
     // Get command list type
-    D3D12_COMMAND_LIST_TYPE type;
-    HRESULT hr = pCommandList->GetType(&type);
-    if (FAILED(hr)) {
-        return hr;
-    }
+    D3D12_COMMAND_LIST_TYPE type = pCommandList->GetType();
 
     // Create or update command record
     CommandListRecord& record = command_records_[pCommandList];
     record.type = type;
-    record.fence_value = ++current_fence_value_;
     record.is_closed = false;
     record.is_executing = false;
 
@@ -245,69 +257,113 @@ HRESULT DXCompat::recordCommandList(
     return S_OK;
 }
 
-HRESULT DXCompat::playbackCommandList(
+HRESULT DXCompat::playbackCommandList(ID3D12CommandList* pCommandList) {
+    if (!pCommandList) {
+        return E_INVALIDARG;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(command_record_mutex_);
+        if (command_records_.find(pCommandList) == command_records_.end()) {
+            return E_INVALIDARG;
+        }
+    }
+
+    // Recorded lists are played back together at the next flush
+    return queueCommandList(pCommandList);
+}
+
+HRESULT DXCompat::queueCommandList(
     ID3D12CommandList* pCommandList,
-    ID3D12CommandQueue* pCommandQueue)
+    ID3D12Fence* pFence,
+    UINT64 FenceValue)
 {
-    if (!pCommandList || !pCommandQueue) {
+    if (!dx_.d3d12_device || !pCommandList) {
         return E_INVALIDARG;
     }
 
-    std::lock_guard<std::mutex> lock(command_record_mutex_);
-    
-    auto it = command_records_.find(pCommandList);
-    if (it == command_records_.end()) {
+    // Bundles only run from other command lists
+    D3D12_COMMAND_LIST_TYPE type = pCommandList->GetType();
+    if (type == D3D12_COMMAND_LIST_TYPE_BUNDLE) {
         return E_INVALIDARG;
     }
 
-    CommandListRecord& record = it->second;
-    if (record.is_executing) {
-        return E_INVALIDARG;
+    std::lock_guard<std::mutex> lock(command_queue_mutex_);
+    if (command_queues_.find(type) == command_queues_.end()) {
+        HRESULT hr = ensureCommandQueue(type, 0, 0, D3D12_COMMAND_QUEUE_FLAG_NONE);
+        if (FAILED(hr)) {
+            return hr;
+        }
     }
 
-    // Mark as executing
-    record.is_executing = true;
+    command_list_graph_.queue(type, pCommandList);
+    fence_signals_[pCommandList].push_back({pFence, FenceValue});
+    return S_OK;
+}
 
-    // Execute the command list
-    pCommandQueue->ExecuteCommandLists(1, &pCommandList);
+HRESULT DXCompat::flushCommandLists() {
+    std::lock_guard<std::mutex> lock(command_queue_mutex_);
+    return submitReady();
+}
 
-    // Signal fence
-    ID3D12Fence* fence = nullptr;
-    HRESULT hr = dx_.d3d12_device->CreateFence(
-        record.fence_value,
-        D3D12_FENCE_FLAG_NONE,
-        IID_PPV_ARGS(&fence)
-    );
+HRESULT DXCompat::submitReady() {
+    for (const CommandListBatch& batch : command_list_graph_.takeReady(completedValue())) {
+        CommandQueue& queue = command_queues_.at(
+            static_cast<D3D12_COMMAND_LIST_TYPE>(batch.queue));
 
-    if (SUCCEEDED(hr)) {
-        hr = pCommandQueue->Signal(fence, record.fence_value);
-        fence->Release();
-    }
+        // Work on other queues this batch depends on, waited for on the GPU
+        for (const CommandListGraph::Wait& wait : batch.waits) {
+            const CommandQueue& other = command_queues_.at(
+                static_cast<D3D12_COMMAND_LIST_TYPE>(wait.queue));
+            HRESULT hr = queue.queue->Wait(other.fence.Get(), wait.value);
+            if (FAILED(hr)) {
+                return hr;
+            }
+        }
 
-    // Reset execution state
-    record.is_executing = false;
+        submit_lists_.clear();
+        for (CommandListGraph::List list : batch.lists) {
+            submit_lists_.push_back(static_cast<ID3D12CommandList*>(const_cast<void*>(list)));
+        }
+        queue.queue->ExecuteCommandLists(static_cast<UINT>(submit_lists_.size()),
+            submit_lists_.data());
+        HRESULT hr = queue.queue->Signal(queue.fence.Get(), batch.fence_value);
+        if (FAILED(hr)) {
+            return hr;
+        }
 
-    return hr;
+        // Then the application's fences, in the order it queued the lists
+        for (ID3D12CommandList* list : submit_lists_) {
+            auto it = fence_signals_.find(list);
+            if (it == fence_signals_.end()) {
+                continue;
+            }
+            FenceSignal signal = std::move(it->second.front());
+            it->second.pop_front();
+            if (it->second.empty()) {
+                fence_signals_.erase(it);
+            }
+            if (signal.fence) {
+                hr = queue.queue->Signal(signal.fence.Get(), signal.value);
+                if (FAILED(hr)) {
+                    return hr;
+                }
+            }
+        }
+    }
+    return command_list_graph_.pending() > 0 ? E_PENDING : S_OK;
 }
 
 HRESULT DXCompat::addCommandListDependency(
     ID3D12CommandList* pCommandList,
-    ID3D12CommandList* pDependentList,
-    UINT64 FenceValue)
+    ID3D12CommandList* pDependency)
 {
-    if (!pCommandList || !pDependentList) {
+    if (!pCommandList || !pDependency) {
         return E_INVALIDARG;
     }
 
-    std::lock_guard<std::mutex> lock(command_optimization_mutex_);
-    
-    CommandListDependency dependency = {
-        pDependentList,
-        FenceValue,
-        false
-    };
-
-    command_dependencies_[pCommandList].push_back(dependency);
+    std::lock_guard<std::mutex> lock(command_queue_mutex_);
+    command_list_graph_.addDependency(pCommandList, pDependency);
     return S_OK;
 }
 
@@ -318,92 +374,30 @@ HRESULT DXCompat::checkCommandListDependencies(
         return E_INVALIDARG;
     }
 
-    std::lock_guard<std::mutex> lock(command_optimization_mutex_);
-    
-    auto it = command_dependencies_.find(pCommandList);
-    if (it == command_dependencies_.end()) {
-        return S_OK;
-    }
-
-    for (const auto& dependency : it->second) {
-        if (!dependency.is_ready) {
-            // Check if the dependent command list has completed
-            ID3D12Fence* fence = nullptr;
-            HRESULT hr = dx_.d3d12_device->CreateFence(
-                dependency.fence_value,
-                D3D12_FENCE_FLAG_NONE,
-                IID_PPV_ARGS(&fence)
-            );
-
-            if (SUCCEEDED(hr)) {
-                // Create an event for fence completion
-                HANDLE fence_event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-                if (fence_event) {
-                    hr = fence->SetEventOnCompletion(dependency.fence_value, fence_event);
-                    if (SUCCEEDED(hr)) {
-                        DWORD wait_result = WaitForSingleObject(fence_event, 0);
-                        if (wait_result == WAIT_OBJECT_0) {
-                            dependency.is_ready = true;
-                        }
-                    }
-                    CloseHandle(fence_event);
-                }
-                fence->Release();
-            }
-        }
-    }
-
-    // Check if all dependencies are ready
-    bool all_ready = true;
-    for (const auto& dependency : it->second) {
-        if (!dependency.is_ready) {
-            all_ready = false;
-            break;
-        }
-    }
-
-    return all_ready ? S_OK : E_PENDING;
+    // The queues' fences say it all; no events, no new fences
+    std::lock_guard<std::mutex> lock(command_queue_mutex_);
+    return command_list_graph_.dependenciesComplete(pCommandList, completedValue()) ?
+        S_OK : E_PENDING;
 }
 
-HRESULT DXCompat::optimizeCommandList(
-    ID3D12CommandList* pCommandList)
+HRESULT DXCompat::ExecuteCommandLists(
+    UINT NumCommandLists,
+    ID3D12CommandList* const* ppCommandLists)
 {
-    if (!pCommandList) {
+    if (NumCommandLists > 0 && !ppCommandLists) {
         return E_INVALIDARG;
     }
 
-    std::lock_guard<std::mutex> lock(command_optimization_mutex_);
-    
-    auto it = command_optimizations_.find(pCommandList);
-    if (it != command_optimizations_.end() && it->second.is_optimized) {
-        return S_OK;
-    }
-
-    // Get command list type
-    D3D12_COMMAND_LIST_TYPE type;
-    HRESULT hr = pCommandList->GetType(&type);
-    if (FAILED(hr)) {
-        return hr;
-    }
-
-    // Create optimization record
-    CommandListOptimization& optimization = command_optimizations_[pCommandList];
-    optimization.is_optimized = false;
-    optimization.optimization_timestamp = GetTickCount64();
-
-    // Check for mergeable command lists
-    for (const auto& [other_list, other_opt] : command_optimizations_) {
-        if (other_list != pCommandList && other_opt.is_optimized) {
-            D3D12_COMMAND_LIST_TYPE other_type;
-            if (SUCCEEDED(other_list->GetType(&other_type)) && other_type == type) {
-                optimization.merged_lists.push_back(other_list);
-            }
+    for (UINT i = 0; i < NumCommandLists; i++) {
+        HRESULT hr = queueCommandList(ppCommandLists[i]);
+        if (FAILED(hr)) {
+            return hr;
         }
     }
 
-    // Mark as optimized if we found mergeable lists
-    optimization.is_optimized = !optimization.merged_lists.empty();
-    return S_OK;
+    // Lists still waiting on dependencies go out with a later flush
+    HRESULT hr = flushCommandLists();
+    return hr == E_PENDING ? S_OK : hr;
 }
 
 HRESULT DXCompat::ExecuteCommandList(
@@ -411,68 +405,18 @@ HRESULT DXCompat::ExecuteCommandList(
     ID3D12Fence* pFence,
     UINT64 FenceValue)
 {
-    if (!dx_.d3d12_device || !pCommandList || !pFence) {
+    if (!pFence) {
         return E_INVALIDARG;
     }
 
-    // Check dependencies
-    HRESULT hr = checkCommandListDependencies(pCommandList);
-    if (FAILED(hr) && hr != E_PENDING) {
-        return hr;
-    }
-
-    // Optimize command list
-    hr = optimizeCommandList(pCommandList);
-    if (FAILED(hr)) {
-        return hr;
-    }
-
-    // Get the command queue type from the command list
-    D3D12_COMMAND_LIST_TYPE type;
-    hr = pCommandList->GetType(&type);
+    HRESULT hr = queueCommandList(pCommandList, pFence, FenceValue);
     if (FAILED(hr)) {
         return hr;
     }
 
-    // Get or create the appropriate command queue
-    ID3D12CommandQueue* command_queue = nullptr;
-    hr = getOrCreateCommandQueue(
-        type,
-        0,  // node_mask
-        0,  // priority
-        D3D12_COMMAND_QUEUE_FLAG_NONE,
-        &command_queue
-    );
-
-    if (FAILED(hr)) {
-        return hr;
-    }
-
-    // Record command list if not already recorded
-    {
-        std::lock_guard<std::mutex> lock(command_record_mutex_);
-        if (command_records_.find(pCommandList) == command_records_.end()) {
-            // TODO: Get actual command data size and data
-            hr = recordCommandList(pCommandList, nullptr, 0);
-            if (FAILED(hr)) {
-                command_queue->Release();
-                return hr;
-            }
-        }
-    }
-
-    // Playback the command list
-    hr = playbackCommandList(pCommandList, command_queue);
-    if (FAILED(hr)) {
-        command_queue->Release();
-        return hr;
-    }
-
-    // Signal the fence
-    hr = command_queue->Signal(pFence, FenceValue);
-    command_queue->Release();
-
-    return hr;
+    // pFence is signalled when the list goes out, even if that is later
+    hr = flushCommandLists();
+    return hr == E_PENDING ? S_OK : hr;
 }
 
 HRESULT DXCompat::Signal(
@@ -483,25 +427,19 @@ HRESULT DXCompat::Signal(
         return E_INVALIDARG;
     }
 
-    // Get the default command queue
-    ID3D12CommandQueue* command_queue = nullptr;
-    HRESULT hr = getOrCreateCommandQueue(
-        D3D12_COMMAND_LIST_TYPE_DIRECT,
-        0,  // node_mask
-        0,  // priority
-        D3D12_COMMAND_QUEUE_FLAG_NONE,
-        &command_queue
-    );
-
+    std::lock_guard<std::mutex> lock(command_queue_mutex_);
+    HRESULT hr = ensureCommandQueue(D3D12_COMMAND_LIST_TYPE_DIRECT, 0, 0,
+        D3D12_COMMAND_QUEUE_FLAG_NONE);
     if (FAILED(hr)) {
         return hr;
     }
 
-    // Signal the fence
-    hr = command_queue->Signal(pFence, FenceValue);
-    command_queue->Release();
-
-    return hr;
+    // After what has been queued so far, as the application would expect
+    hr = submitReady();
+    if (FAILED(hr) && hr != E_PENDING) {
+        return hr;
+    }
+    return command_queues_[D3D12_COMMAND_LIST_TYPE_DIRECT].queue->Signal(pFence, FenceValue);
 }
 
 HRESULT DXCompat::WaitForFence(
@@ -512,28 +450,17 @@ HRESULT DXCompat::WaitForFence(
         return E_INVALIDARG;
     }
 
-    // Create an event for fence completion
-    HANDLE fence_event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-    if (!fence_event) {
-        return E_FAIL;
-    }
-
-    // Set up fence completion notification
-    HRESULT hr = pFence->SetEventOnCompletion(FenceValue, fence_event);
-    if (FAILED(hr)) {
-        CloseHandle(fence_event);
+    // The work it waits for may still be queued here
+    HRESULT hr = flushCommandLists();
+    if (FAILED(hr) && hr != E_PENDING) {
         return hr;
     }
-
-    // Wait for the fence to complete
-    DWORD wait_result = WaitForSingleObject(fence_event, INFINITE);
-    CloseHandle(fence_event);
-
-    if (wait_result != WAIT_OBJECT_0) {
-        return E_FAIL;
+    if (pFence->GetCompletedValue() >= FenceValue) {
+        return S_OK;
     }
 
-    return S_OK;
+    // With no event the call itself blocks until the fence gets there
+    return pFence->SetEventOnCompletion(FenceValue, nullptr);
 }
 
 HRESULT DXCompat::D3D11CreateDevice(
@@ -657,6 +584,7 @@ HRESULT DXCompat::createResource(
         info.cpu_access_flags = pDesc->CPUAccessFlags;
         info.misc_flags = pDesc->MiscFlags;
         info.structure_byte_stride = pDesc->StructureByteStride;
+        info.size = dimension == D3D11_RESOURCE_DIMENSION_BUFFER ? pDesc->ByteWidth : 0;
 
         trackResource(static_cast<ID3D11Resource*>(*ppResource), info);
     }
@@ -672,6 +600,15 @@ void DXCompat::trackResource(ID3D11Resource* pResource, const ResourceInfo& info
 void DXCompat::untrackResource(ID3D11Resource* pResource) {
     std::lock_guard<std::mutex> lock(resource_mutex_);
     resource_info_.erase(pResource);
+
+    auto it = mappings_.lower_bound(SubresourceKey(pResource, 0));
+    while (it != mappings_.end() && it->first.first == pResource) {
+        if (it->second.staged) {
+            staging_ring_->release(it->second.offset, uploads_);
+            region_owners_.erase(it->second.offset);
+        }
+        it = mappings_.erase(it);
+    }
 }
 
 HRESULT DXCompat::Map(
@@ -712,40 +649,43 @@ HRESULT DXCompat::Map(
         }
     }
 
-    // Calculate resource size and row pitch
-    UINT64 resource_size = 0;
-    UINT row_pitch = 0;
-    UINT depth_pitch = 0;
+    const SubresourceKey key(pResource, Subresource);
+    auto found = mappings_.find(key);
+    if (found != mappings_.end() && found->second.mapped) {
+        return E_INVALIDARG;
+    }
 
-    if (info.dimension == D3D11_RESOURCE_DIMENSION_BUFFER) {
-        resource_size = info.structure_byte_stride;
-    } else if (info.dimension == D3D11_RESOURCE_DIMENSION_TEXTURE2D) {
-        const D3D11_TEXTURE2D_DESC* tex_desc = static_cast<const D3D11_TEXTURE2D_DESC*>(pResource);
-        resource_size = tex_desc->Width * tex_desc->Height * 4; // Assuming RGBA format
-        row_pitch = tex_desc->Width * 4;
-        depth_pitch = row_pitch * tex_desc->Height;
+    // Reads, textures and plain writes see the resource itself
+    bool stageable = info.dimension == D3D11_RESOURCE_DIMENSION_BUFFER && info.size > 0;
+    if (!stageable || MapType == D3D11_MAP_READ || MapType == D3D11_MAP_WRITE ||
+        MapType == D3D11_MAP_READ_WRITE) {
+        return mapDirect(key, MapType, MapFlags, pMappedResource);
     }
 
-    // Allocate mapped memory
-    void* mapped_data = nullptr;
     if (MapType == D3D11_MAP_WRITE_DISCARD) {
-        // For write discard, we can allocate new memory
-        mapped_data = new uint8_t[resource_size];
-    } else {
-        // For other map types, we need to preserve existing data
-        // This would typically involve copying from GPU memory
-        mapped_data = new uint8_t[resource_size];
-        // TODO: Copy data from GPU memory
-    }
+        // Renaming is taking the next region; the old one goes back to the ring
+        releaseRegion(key);
+        uint64_t offset = 0;
+        if (!stageRegion(key, info.size, offset)) {
+            return mapDirect(key, MapType, MapFlags, pMappedResource);
+        }
 
-    if (!mapped_data) {
-        return E_OUTOFMEMORY;
+        // Whatever an earlier owner wrote here is not this buffer's
+        std::vector<client::ShadowMemory::Range> stale;
+        staging_memory_->collectDirty(offset, info.size, stale);
+        found = mappings_.emplace(key, StagedMapping{offset, info.size, true, false, true}).first;
+    } else if (found == mappings_.end()) {
+        // No region of ours holds what the resource does
+        return mapDirect(key, MapType, MapFlags, pMappedResource);
+    } else {
+        found->second.discarded = false;
     }
 
-    // Store mapping information
-    pMappedResource->pData = mapped_data;
-    pMappedResource->RowPitch = row_pitch;
-    pMappedResource->DepthPitch = depth_pitch;
+    StagedMapping& mapping = found->second;
+    mapping.mapped = true;
+    pMappedResource->pData = staging_memory_->data() + mapping.offset;
+    pMappedResource->RowPitch = static_cast<UINT>(mapping.size);
+    pMappedResource->DepthPitch = static_cast<UINT>(mapping.size);
 
     return S_OK;
 }
@@ -759,67 +699,115 @@ void DXCompat::Unmap(
     }
 
     std::lock_guard<std::mutex> lock(resource_mutex_);
-    auto it = resource_info_.find(pResource);
-    if (it == resource_info_.end()) {
+    auto it = mappings_.find(SubresourceKey(pResource, Subresource));
+    if (it == mappings_.end() || !it->second.mapped) {
         return;
     }
 
-    // Get the mapped data
-    D3D11_MAPPED_SUBRESOURCE mapped = {};
-    if (SUCCEEDED(pResource->Map(Subresource, D3D11_MAP_READ, 0, &mapped))) {
-        // Free the mapped memory
-        delete[] static_cast<uint8_t*>(mapped.pData);
-        pResource->Unmap(Subresource);
+    StagedMapping& mapping = it->second;
+    if (!mapping.staged) {
+        dx_.d3d11_context->Unmap(pResource, Subresource);
+        mappings_.erase(it);
+        return;
+    }
+
+    mapping.mapped = false;
+    if (!uploadStaged(it->first, mapping)) {
+        // Left behind: the next WRITE_NO_OVERWRITE maps the resource instead
+        releaseRegion(it->first);
     }
 }
 
-#ifdef HAS_DIRECTX
+HRESULT DXCompat::mapDirect(
+    const SubresourceKey& key,
+    D3D11_MAP MapType,
+    UINT MapFlags,
+    D3D11_MAPPED_SUBRESOURCE* pMappedResource)
+{
+    // The resource is about to change behind its region's back
+    releaseRegion(key);
 
-HRESULT DXCompat::ExecuteCommandList(ID3D12CommandList* pCommandList, BOOL WaitForCompletion) {
-    if (!pCommandList) {
-        return E_INVALIDARG;
+    HRESULT hr = dx_.d3d11_context->Map(key.first, key.second, MapType, MapFlags,
+        pMappedResource);
+    if (SUCCEEDED(hr)) {
+        mappings_[key] = StagedMapping{0, 0, false, true, false};
     }
+    return hr;
+}
 
-    std::lock_guard<std::mutex> lock(command_records_mutex_);
-    auto it = command_records_.find(pCommandList);
-    if (it == command_records_.end()) {
-        return playbackCommandList(pCommandList);
+bool DXCompat::stageRegion(const SubresourceKey& key, uint64_t size, uint64_t& offset) {
+    if (!staging_ring_) {
+        staging_memory_ = std::make_unique<client::ShadowMemory>(STAGING_RING_SIZE);
+        staging_ring_ = std::make_unique<StagingRing>(STAGING_RING_SIZE,
+            client::ShadowMemory::PAGE_SIZE);
     }
-    return S_OK;
+
+    staging_ring_->reclaim(uploads_);
+    while (!staging_ring_->allocate(size, offset)) {
+        // Out of room: the oldest region's owner goes back to mapping directly
+        uint64_t oldest = 0;
+        if (!staging_ring_->oldest(oldest)) {
+            return false;   // Larger than the whole ring
+        }
+        auto owner = region_owners_.find(oldest);
+        if (owner == region_owners_.end() || mappings_.at(owner->second).mapped) {
+            return false;
+        }
+        releaseRegion(owner->second);
+        staging_ring_->reclaim(uploads_);
+    }
+
+    region_owners_[offset] = key;
+    return true;
 }
 
-HRESULT DXCompat::recordCommandList(ID3D12CommandList* pCommandList) {
-    if (!pCommandList) {
-        return E_INVALIDARG;
+void DXCompat::releaseRegion(const SubresourceKey& key) {
+    auto it = mappings_.find(key);
+    if (it == mappings_.end() || !it->second.staged) {
+        return;
     }
 
-    std::lock_guard<std::mutex> lock(command_records_mutex_);
-    CommandListRecord record;
-    record.type = D3D12_COMMAND_LIST_TYPE_DIRECT;  // Default to direct command list
-    record.fenceValue = 0;
-    command_records_[pCommandList] = record;
-    return S_OK;
+    // Its contents were copied out by the last upload
+    staging_ring_->release(it->second.offset, uploads_);
+    region_owners_.erase(it->second.offset);
+    mappings_.erase(it);
 }
 
-HRESULT DXCompat::playbackCommandList(ID3D12CommandList* pCommandList) {
-    if (!pCommandList) {
-        return E_INVALIDARG;
+bool DXCompat::uploadStaged(const SubresourceKey& key, const StagedMapping& mapping) {
+    // The same delta path as mapped Vulkan memory: after a discard all of
+    // the region is new, otherwise only the pages written since the last
+    // upload are copied
+    std::vector<client::ShadowMemory::Range> ranges;
+    staging_memory_->collectDirty(mapping.offset, mapping.size, ranges);
+    if (mapping.discarded) {
+        ranges.assign(1, client::ShadowMemory::Range{mapping.offset, mapping.size});
+    }
+    if (ranges.empty()) {
+        return true;
     }
 
-    std::lock_guard<std::mutex> lock(command_records_mutex_);
-    auto it = command_records_.find(pCommandList);
-    if (it == command_records_.end()) {
-        return E_FAIL;
+    // Dynamic resources can't take UpdateSubresource, so the copy goes
+    // through a map of the resource. NO_OVERWRITE keeps what isn't copied.
+    D3D11_MAPPED_SUBRESOURCE target = {};
+    D3D11_MAP map_type = mapping.discarded ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE;
+    if (FAILED(dx_.d3d11_context->Map(key.first, key.second, map_type, 0, &target))) {
+        return false;
     }
-    return S_OK;
-}
 
-void DXCompat::cleanupCommandRecords() {
-    std::lock_guard<std::mutex> lock(command_records_mutex_);
-    command_records_.clear();
-}
+    const uint8_t* staged = staging_memory_->data();
+    const uint64_t end = mapping.offset + mapping.size;
+    for (const auto& range : ranges) {
+        // Dirty pages can run past the region into the padding after it
+        uint64_t range_end = std::min(range.offset + range.size, end);
+        std::memcpy(static_cast<uint8_t*>(target.pData) + (range.offset - mapping.offset),
+            staged + range.offset, range_end - range.offset);
+    }
+    dx_.d3d11_context->Unmap(key.first, key.second);
 
-#endif // HAS_DIRECTX
+    uploads_++;
+    staging_ring_->reclaim(uploads_);
+    return true;
+}
 
 } // namespace gpu
 } // namespace anarchy 
\ No newline at end of file
@@ -1,32 +1,227 @@
 #include "common/gpu/frame_capture.hpp"
+#include "common/tracer.hpp"
 #include <stdexcept>
 #include <cstring>
+#include <algorithm>
+#include <unistd.h>
 
 namespace anarchy {
 namespace gpu {
 
+namespace {
+
+uint32_t findMemoryType(VkPhysicalDevice physical_device, uint32_t type_filter,
+    VkMemoryPropertyFlags properties)
+{
+    VkPhysicalDeviceMemoryProperties mem_properties;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_properties);
+    for (uint32_t i = 0; i < mem_properties.memoryTypeCount; i++) {
+        if ((type_filter & (1 << i)) &&
+            (mem_properties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+    return UINT32_MAX;
+}
+
+NV_ENC_BUFFER_FORMAT toNvencFormat(TargetFormat format) {
+    switch (format) {
+        case TargetFormat::P010:
+            return NV_ENC_BUFFER_FORMAT_YUV420_10BIT;
+        case TargetFormat::YUV444:
+            return NV_ENC_BUFFER_FORMAT_YUV444;
+        case TargetFormat::YUV444_10BIT:
+            return NV_ENC_BUFFER_FORMAT_YUV444_10BIT;
+        case TargetFormat::NV12:
+        default:
+            return NV_ENC_BUFFER_FORMAT_NV12;
+    }
+}
+
+// H.273 codes: BT.601 as SMPTE 170M, BT.2020 with PQ transfer for HDR.
+// Primaries and matrix share their code for all three.
+void colorCodes(ColorMatrix matrix, uint32_t& color_code, uint32_t& transfer) {
+    switch (matrix) {
+        case ColorMatrix::BT601:
+            color_code = 6;
+            transfer = 6;
+            break;
+        case ColorMatrix::BT709:
+            color_code = 1;
+            transfer = 1;
+            break;
+        case ColorMatrix::BT2020:
+            color_code = 9;
+            transfer = 16;
+            break;
+    }
+}
+
+// Tells the decoder which matrix and range the conversion used
+template <typename Vui>
+void setColorDescription(Vui& vui, ColorMatrix matrix, bool full_range) {
+    uint32_t color_code = 1;
+    uint32_t transfer = 1;
+    colorCodes(matrix, color_code, transfer);
+
+    vui.videoSignalTypePresentFlag = 1;
+    vui.videoFormat = static_cast<decltype(vui.videoFormat)>(5); // Unspecified
+    vui.videoFullRangeFlag = full_range ? 1 : 0;
+    vui.colourDescriptionPresentFlag = 1;
+    vui.colourPrimaries = static_cast<decltype(vui.colourPrimaries)>(color_code);
+    vui.transferCharacteristics = static_cast<decltype(vui.transferCharacteristics)>(transfer);
+    vui.colourMatrix = static_cast<decltype(vui.colourMatrix)>(color_code);
+}
+
+// AV1 carries the same codes in its sequence header rather than a VUI
+void setColorDescription(NV_ENC_CONFIG_AV1& av1, ColorMatrix matrix, bool full_range) {
+    uint32_t color_code = 1;
+    uint32_t transfer = 1;
+    colorCodes(matrix, color_code, transfer);
+
+    av1.colorPrimaries = static_cast<NV_ENC_VUI_COLOR_PRIMARIES>(color_code);
+    av1.transferCharacteristics = static_cast<NV_ENC_VUI_TRANSFER_CHARACTERISTIC>(transfer);
+    av1.matrixCoefficients = static_cast<NV_ENC_VUI_MATRIX_COEFFS>(color_code);
+    av1.colorRange = full_range ? 1 : 0;
+}
+
+// Frames come out slice by slice; NVENC cannot write AV1 tiles early
+bool sliceOutput(const FrameCapture::CaptureConfig& config) {
+    return config.latency_profile == FrameCapture::LatencyProfile::ULTRA_LOW_LATENCY &&
+        config.codec != FrameCapture::Codec::AV1;
+}
+
+// Room for each slot's frame, in pieces if it is split into slices
+size_t outputCapacity(const FrameCapture::CaptureConfig& config) {
+    size_t frames = std::max(config.slot_count, FrameCapture::MIN_SLOT_COUNT);
+    return sliceOutput(config) ? frames * std::max(config.slice_count, 1u) : frames;
+}
+
+GUID codecGuid(FrameCapture::Codec codec) {
+    switch (codec) {
+        case FrameCapture::Codec::HEVC:
+            return NV_ENC_CODEC_HEVC_GUID;
+        case FrameCapture::Codec::AV1:
+            return NV_ENC_CODEC_AV1_GUID;
+        case FrameCapture::Codec::H264:
+        default:
+            return NV_ENC_CODEC_H264_GUID;
+    }
+}
+
+// One intra refresh wave per period, spread over a quarter second so no
+// single frame carries much of it
+template <typename CodecConfig>
+void setIntraRefresh(CodecConfig& codec_config, uint32_t period, uint32_t fps) {
+    period = std::max(period, 2u);
+    codec_config.idrPeriod = NVENC_INFINITE_GOPLENGTH;
+    codec_config.enableIntraRefresh = 1;
+    codec_config.intraRefreshPeriod = period;
+    codec_config.intraRefreshCnt = std::clamp(fps / 4, 1u, period - 1);
+}
+
+// CUDA device backing the same GPU as the Vulkan device
+bool findCudaDevice(VkPhysicalDevice physical_device, CUdevice& cuda_device) {
+    VkPhysicalDeviceIDProperties id_properties = {};
+    id_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &id_properties;
+    vkGetPhysicalDeviceProperties2(physical_device, &properties);
+
+    int count = 0;
+    if (cuDeviceGetCount(&count) != CUDA_SUCCESS) {
+        return false;
+    }
+    for (int i = 0; i < count; ++i) {
+        CUdevice device;
+        CUuuid uuid;
+        if (cuDeviceGet(&device, i) == CUDA_SUCCESS &&
+            cuDeviceGetUuid(&uuid, device) == CUDA_SUCCESS &&
+            std::memcmp(uuid.bytes, id_properties.deviceUUID, VK_UUID_SIZE) == 0) {
+            cuda_device = device;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Moving average for the latency figures
+void smooth(double& average, double sample) {
+    static constexpr double alpha = 0.1; // Smoothing factor
+    average = (1.0 - alpha) * average + alpha * sample;
+}
+
+double milliseconds(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+} // namespace
+
 FrameCapture::FrameCapture(const CaptureConfig& config)
     : config_(config)
+    , frame_ring_(outputCapacity(config), SpscRing<FrameData>::OverflowPolicy::DROP_OLDEST)
     , should_stop_(false)
 {
     // Initialize statistics
     stats_ = Statistics{};
+    fps_since_ = std::chrono::steady_clock::now();
 }
 
 FrameCapture::~FrameCapture() {
     flush();
-    should_stop_ = true;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        should_stop_ = true;
+    }
+    queue_cv_.notify_all();
     if (encode_thread_.joinable()) {
         encode_thread_.join();
     }
+    if (completion_thread_.joinable()) {
+        completion_thread_.join();
+    }
     cleanupResources();
 }
 
-bool FrameCapture::initialize(VkDevice device, VkPhysicalDevice physical_device) {
+std::vector<const char*> FrameCapture::requiredDeviceExtensions() {
+    return {
+        VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME,
+        VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME,
+        VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
+    };
+}
+
+bool FrameCapture::initialize(VkDevice device, VkPhysicalDevice physical_device,
+    uint32_t queue_family)
+{
     vulkan_.device = device;
     vulkan_.physical_device = physical_device;
+    vulkan_.queue_family = queue_family;
+
+    if (!toSourceFormat(config_.format, source_format_)) {
+        return false;
+    }
+
+    // NVENC's H.264 encoder is 8-bit only, its AV1 encoder 4:2:0 only
+    if (config_.codec == Codec::AV1 && config_.yuv444) {
+        return false;
+    }
+    bool ten_bit = isTenBit(source_format_) && config_.codec != Codec::H264;
+    if (config_.yuv444) {
+        target_format_ = ten_bit ? TargetFormat::YUV444_10BIT : TargetFormat::YUV444;
+    } else {
+        target_format_ = ten_bit ? TargetFormat::P010 : TargetFormat::NV12;
+    }
+    nvenc_.buffer_format = toNvencFormat(target_format_);
+    capture_width_ = config_.width;
+    capture_height_ = config_.height;
+    color_coefficients_ = colorCoefficients(config_.color_matrix, config_.full_range, target_format_);
 
-    // Initialize subsystems
+    // With a single slot nothing could overlap
+    slots_.assign(std::max(config_.slot_count, MIN_SLOT_COUNT), CaptureSlot{});
+
+    // Initialize subsystems; each picks up what the previous one exported
     if (!initializeVulkan()) {
         return false;
     }
@@ -37,76 +232,151 @@ bool FrameCapture::initialize(VkDevice device, VkPhysicalDevice physical_device)
         return false;
     }
 
-    // Start encoding thread
+    for (uint32_t i = 0; i < slots_.size(); ++i) {
+        free_slots_.push_back(i);
+    }
+
+    // Start encoding threads
     encode_thread_ = std::thread(&FrameCapture::encodeThread, this);
+    completion_thread_ = std::thread(&FrameCapture::completionThread, this);
     return true;
 }
 
 bool FrameCapture::initializeVulkan() {
-    // Create staging buffer
+    vkGetDeviceQueue(vulkan_.device, vulkan_.queue_family, 0, &vulkan_.queue);
+
+    vulkan_.get_memory_fd = reinterpret_cast<PFN_vkGetMemoryFdKHR>(
+        vkGetDeviceProcAddr(vulkan_.device, "vkGetMemoryFdKHR"));
+    vulkan_.get_semaphore_fd = reinterpret_cast<PFN_vkGetSemaphoreFdKHR>(
+        vkGetDeviceProcAddr(vulkan_.device, "vkGetSemaphoreFdKHR"));
+    if (!vulkan_.get_memory_fd || !vulkan_.get_semaphore_fd) {
+        return false;
+    }
+
+    // Create command pool; slot command buffers are re-recorded every frame
+    VkCommandPoolCreateInfo pool_create_info = {};
+    pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool_create_info.queueFamilyIndex = vulkan_.queue_family;
+
+    VkResult result = vkCreateCommandPool(vulkan_.device, &pool_create_info, nullptr, &vulkan_.command_pool);
+    if (result != VK_SUCCESS) {
+        return false;
+    }
+
+    // Timeline semaphore exported to CUDA, signalled with a slot's ready_value
+    VkExportSemaphoreCreateInfo export_info = {};
+    export_info.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO;
+    export_info.handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT;
+
+    VkSemaphoreTypeCreateInfo type_info = {};
+    type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    type_info.pNext = &export_info;
+    type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    type_info.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphore_create_info = {};
+    semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_create_info.pNext = &type_info;
+
+    result = vkCreateSemaphore(vulkan_.device, &semaphore_create_info, nullptr, &vulkan_.timeline);
+    if (result != VK_SUCCESS) {
+        return false;
+    }
+
+    // Copy timings, if the queue can take timestamps
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(vulkan_.physical_device, &family_count, nullptr);
+    std::vector<VkQueueFamilyProperties> families(family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(vulkan_.physical_device, &family_count, families.data());
+
+    if (vulkan_.queue_family < family_count && families[vulkan_.queue_family].timestampValidBits > 0) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(vulkan_.physical_device, &properties);
+
+        VkQueryPoolCreateInfo query_pool_info = {};
+        query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        query_pool_info.queryCount = static_cast<uint32_t>(slots_.size()) * 2;
+
+        result = vkCreateQueryPool(vulkan_.device, &query_pool_info, nullptr, &vulkan_.timestamps);
+        if (result != VK_SUCCESS) {
+            return false;
+        }
+        vulkan_.timestamp_period = properties.limits.timestampPeriod;
+    }
+
+    for (uint32_t i = 0; i < slots_.size(); ++i) {
+        slots_[i].first_query = i * 2;
+        if (!createSlot(slots_[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FrameCapture::createSlot(CaptureSlot& slot) {
+    // Linear device-local copy target: CUDA sees it as a plain pitched buffer
+    VkExternalMemoryBufferCreateInfo external_info = {};
+    external_info.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+    external_info.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+
     VkBufferCreateInfo buffer_create_info = {};
     buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_create_info.pNext = &external_info;
     buffer_create_info.size = config_.width * config_.height * 4; // RGBA
     buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
     buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    VkResult result = vkCreateBuffer(vulkan_.device, &buffer_create_info, nullptr, &vulkan_.staging_buffer);
+    VkResult result = vkCreateBuffer(vulkan_.device, &buffer_create_info, nullptr, &slot.buffer);
     if (result != VK_SUCCESS) {
         return false;
     }
 
-    // Get memory requirements
     VkMemoryRequirements mem_requirements;
-    vkGetBufferMemoryRequirements(vulkan_.device, vulkan_.staging_buffer, &mem_requirements);
+    vkGetBufferMemoryRequirements(vulkan_.device, slot.buffer, &mem_requirements);
+
+    uint32_t memory_type = findMemoryType(vulkan_.physical_device,
+        mem_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (memory_type == UINT32_MAX) {
+        return false;
+    }
+
+    // Dedicated, as CUDA has to be told when it imports the memory
+    VkMemoryDedicatedAllocateInfo dedicated_info = {};
+    dedicated_info.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicated_info.buffer = slot.buffer;
+
+    VkExportMemoryAllocateInfo export_info = {};
+    export_info.sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO;
+    export_info.pNext = &dedicated_info;
+    export_info.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
 
-    // Allocate memory
     VkMemoryAllocateInfo alloc_info = {};
     alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.pNext = &export_info;
     alloc_info.allocationSize = mem_requirements.size;
-    alloc_info.memoryTypeIndex = 0; // TODO: Find suitable memory type
-
-    result = vkAllocateMemory(vulkan_.device, &alloc_info, nullptr, &vulkan_.staging_memory);
-    if (result != VK_SUCCESS) {
-        vkDestroyBuffer(vulkan_.device, vulkan_.staging_buffer, nullptr);
-        return false;
-    }
+    alloc_info.memoryTypeIndex = memory_type;
 
-    // Bind memory
-    result = vkBindBufferMemory(vulkan_.device, vulkan_.staging_buffer, vulkan_.staging_memory, 0);
+    result = vkAllocateMemory(vulkan_.device, &alloc_info, nullptr, &slot.memory);
     if (result != VK_SUCCESS) {
-        vkFreeMemory(vulkan_.device, vulkan_.staging_memory, nullptr);
-        vkDestroyBuffer(vulkan_.device, vulkan_.staging_buffer, nullptr);
         return false;
     }
+    slot.memory_size = mem_requirements.size;
 
-    // Create command pool
-    VkCommandPoolCreateInfo pool_create_info = {};
-    pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    pool_create_info.queueFamilyIndex = 0; // TODO: Get from device
-
-    result = vkCreateCommandPool(vulkan_.device, &pool_create_info, nullptr, &vulkan_.command_pool);
+    result = vkBindBufferMemory(vulkan_.device, slot.buffer, slot.memory, 0);
     if (result != VK_SUCCESS) {
-        vkFreeMemory(vulkan_.device, vulkan_.staging_memory, nullptr);
-        vkDestroyBuffer(vulkan_.device, vulkan_.staging_buffer, nullptr);
         return false;
     }
 
-    // Create command buffer
     VkCommandBufferAllocateInfo alloc_info_cb = {};
     alloc_info_cb.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     alloc_info_cb.commandPool = vulkan_.command_pool;
     alloc_info_cb.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     alloc_info_cb.commandBufferCount = 1;
 
-    result = vkAllocateCommandBuffers(vulkan_.device, &alloc_info_cb, &vulkan_.command_buffer);
-    if (result != VK_SUCCESS) {
-        vkDestroyCommandPool(vulkan_.device, vulkan_.command_pool, nullptr);
-        vkFreeMemory(vulkan_.device, vulkan_.staging_memory, nullptr);
-        vkDestroyBuffer(vulkan_.device, vulkan_.staging_buffer, nullptr);
-        return false;
-    }
-
-    return true;
+    result = vkAllocateCommandBuffers(vulkan_.device, &alloc_info_cb, &slot.command_buffer);
+    return result == VK_SUCCESS;
 }
 
 bool FrameCapture::initializeCUDA() {
@@ -116,47 +386,164 @@ bool FrameCapture::initializeCUDA() {
         return false;
     }
 
+    CUdevice cuda_device;
+    if (!findCudaDevice(vulkan_.physical_device, cuda_device)) {
+        return false;
+    }
+
     // Create CUDA context
-    result = cuCtxCreate(&cuda_.context, 0, 0);
+    result = cuCtxCreate(&cuda_.context, 0, cuda_device);
     if (result != CUDA_SUCCESS) {
         return false;
     }
 
-    // Create CUDA stream
-    result = cuStreamCreate(&cuda_.stream, 0);
+    // Create CUDA stream; NVENC reads its input in order on it
+    result = cuStreamCreate(&cuda_.stream, CU_STREAM_NON_BLOCKING);
     if (result != CUDA_SUCCESS) {
-        cuCtxDestroy(cuda_.context);
         return false;
     }
 
-    // Allocate device buffer
-    cuda_.buffer_size = config_.width * config_.height * 4;
-    result = cuMemAlloc(&cuda_.device_buffer, cuda_.buffer_size);
+    if (config_.unchanged_frames != UnchangedFrames::ENCODE) {
+        // Sized for the largest frame; smaller ones use a prefix
+        size_t hashes_size = diffTileCount(config_.width, config_.height) * sizeof(uint64_t);
+        if (cuStreamCreate(&cuda_.diff_stream, CU_STREAM_NON_BLOCKING) != CUDA_SUCCESS ||
+            cuMemAlloc(&cuda_.tile_hashes, hashes_size) != CUDA_SUCCESS ||
+            cuMemsetD8(cuda_.tile_hashes, 0, hashes_size) != CUDA_SUCCESS ||
+            cuMemAlloc(&cuda_.changed_tiles, sizeof(uint32_t)) != CUDA_SUCCESS ||
+            cuMemAllocHost(reinterpret_cast<void**>(&cuda_.changed_host), sizeof(uint32_t)) != CUDA_SUCCESS ||
+            cuEventCreate(&cuda_.diff_done, CU_EVENT_DISABLE_TIMING) != CUDA_SUCCESS) {
+            return false;
+        }
+    }
+
+    // Import the timeline semaphore. On success CUDA owns the fd.
+    VkSemaphoreGetFdInfoKHR semaphore_fd_info = {};
+    semaphore_fd_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR;
+    semaphore_fd_info.semaphore = vulkan_.timeline;
+    semaphore_fd_info.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT;
+
+    int fd = -1;
+    if (vulkan_.get_semaphore_fd(vulkan_.device, &semaphore_fd_info, &fd) != VK_SUCCESS) {
+        return false;
+    }
+
+    CUDA_EXTERNAL_SEMAPHORE_HANDLE_DESC semaphore_desc = {};
+    semaphore_desc.type = CU_EXTERNAL_SEMAPHORE_HANDLE_TYPE_TIMELINE_SEMAPHORE_FD;
+    semaphore_desc.handle.fd = fd;
+    result = cuImportExternalSemaphore(&cuda_.timeline, &semaphore_desc);
     if (result != CUDA_SUCCESS) {
-        cuStreamDestroy(cuda_.stream);
-        cuCtxDestroy(cuda_.context);
+        close(fd);
         return false;
     }
 
+    // Import every slot's memory and map it as one linear buffer
+    for (auto& slot : slots_) {
+        VkMemoryGetFdInfoKHR memory_fd_info = {};
+        memory_fd_info.sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR;
+        memory_fd_info.memory = slot.memory;
+        memory_fd_info.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+
+        fd = -1;
+        if (vulkan_.get_memory_fd(vulkan_.device, &memory_fd_info, &fd) != VK_SUCCESS) {
+            return false;
+        }
+
+        CUDA_EXTERNAL_MEMORY_HANDLE_DESC memory_desc = {};
+        memory_desc.type = CU_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD;
+        memory_desc.handle.fd = fd;
+        memory_desc.size = slot.memory_size;
+        memory_desc.flags = CUDA_EXTERNAL_MEMORY_DEDICATED;
+        result = cuImportExternalMemory(&slot.external_memory, &memory_desc);
+        if (result != CUDA_SUCCESS) {
+            close(fd);
+            return false;
+        }
+
+        CUDA_EXTERNAL_MEMORY_BUFFER_DESC buffer_desc = {};
+        buffer_desc.offset = 0;
+        buffer_desc.size = config_.width * config_.height * 4;
+        result = cuExternalMemoryGetMappedBuffer(&slot.device_ptr, slot.external_memory, &buffer_desc);
+        if (result != CUDA_SUCCESS) {
+            return false;
+        }
+
+        // Conversion output, the buffer NVENC actually reads
+        result = cuMemAllocPitch(&slot.yuv_ptr, &slot.yuv_pitch,
+            config_.width * bytesPerSample(target_format_),
+            targetRows(target_format_, config_.height), 16);
+        if (result != CUDA_SUCCESS) {
+            return false;
+        }
+
+        // Bracket the conversion for the stage timings
+        if (cuEventCreate(&slot.convert_start, CU_EVENT_DEFAULT) != CUDA_SUCCESS ||
+            cuEventCreate(&slot.convert_end, CU_EVENT_DEFAULT) != CUDA_SUCCESS) {
+            return false;
+        }
+    }
+
     return true;
 }
 
 bool FrameCapture::initializeNVENC() {
     // Load NVENC API
+    nvenc_.nv_enc.version = NV_ENCODE_API_FUNCTION_LIST_VER;
     NVENCSTATUS status = NvEncodeAPICreateInstance(&nvenc_.nv_enc);
     if (status != NV_ENC_SUCCESS) {
         return false;
     }
 
-    // Initialize encoder
-    NV_ENC_INITIALIZE_PARAMS init_params = {};
+    // Open a session on the CUDA context the capture slots are mapped in
+    NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS session_params = {};
+    session_params.version = NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER;
+    session_params.device = cuda_.context;
+    session_params.deviceType = NV_ENC_DEVICE_TYPE_CUDA;
+    session_params.apiVersion = NVENCAPI_VERSION;
+
+    status = nvenc_.nv_enc.nvEncOpenEncodeSessionEx(&session_params, &nvenc_.encoder);
+    if (status != NV_ENC_SUCCESS) {
+        nvenc_.encoder = nullptr;
+        return false;
+    }
+
+    // Start from the preset for the profile, then override what matters here
+    bool ultra_low_latency = config_.latency_profile == LatencyProfile::ULTRA_LOW_LATENCY;
+    NV_ENC_INITIALIZE_PARAMS& init_params = nvenc_.init_params;
     init_params.version = NV_ENC_INITIALIZE_PARAMS_VER;
+    init_params.encodeGUID = codecGuid(config_.codec);
+    init_params.presetGUID = ultra_low_latency ? NV_ENC_PRESET_P1_GUID : NV_ENC_PRESET_P4_GUID;
+    init_params.tuningInfo = ultra_low_latency ?
+        NV_ENC_TUNING_INFO_ULTRA_LOW_LATENCY : NV_ENC_TUNING_INFO_LOW_LATENCY;
+
+    NV_ENC_PRESET_CONFIG preset_config = {};
+    preset_config.version = NV_ENC_PRESET_CONFIG_VER;
+    preset_config.presetCfg.version = NV_ENC_CONFIG_VER;
+    status = nvenc_.nv_enc.nvEncGetEncodePresetConfigEx(nvenc_.encoder, init_params.encodeGUID,
+        init_params.presetGUID, init_params.tuningInfo, &preset_config);
+    if (status != NV_ENC_SUCCESS) {
+        return false;
+    }
+    nvenc_.encode_config = preset_config.presetCfg;
+
+    init_params.encodeWidth = config_.width;
+    init_params.encodeHeight = config_.height;
+    init_params.darWidth = config_.width;
+    init_params.darHeight = config_.height;
+    init_params.frameRateNum = config_.fps;
+    init_params.frameRateDen = 1;
+    init_params.enablePTD = 1;
+    init_params.maxEncodeWidth = config_.width;     // setResolution() only goes down
+    init_params.maxEncodeHeight = config_.height;
+    init_params.enableSubFrameWrite = sliceOutput(config_) ? 1 : 0;
     init_params.encodeConfig = &nvenc_.encode_config;
-    init_params.encodeConfig->version = NV_ENC_CONFIG_VER;
-    init_params.encodeConfig->rcParams.version = NV_ENC_RC_PARAMS_VER;
-    init_params.encodeConfig->encodeCodecConfig.h264Config.version = NV_ENC_CODEC_CONFIG_VER;
 
-    // Configure encoding parameters
+    // No B-frames, so every picture comes back from the call that submitted it
+    init_params.encodeConfig->gopLength =
+        ultra_low_latency ? NVENC_INFINITE_GOPLENGTH : config_.gop_size;
+    init_params.encodeConfig->frameIntervalP = 1;
+
+    // Configure encoding parameters; the VBV holds one frame, so no frame can
+    // take longer than a frame interval to send
     init_params.encodeConfig->rcParams.rateControlMode = NV_ENC_PARAMS_RC_CBR_LOWDELAY_HQ;
     init_params.encodeConfig->rcParams.averageBitRate = config_.bitrate;
     init_params.encodeConfig->rcParams.maxBitRate = config_.bitrate;
@@ -165,98 +552,312 @@ bool FrameCapture::initializeNVENC() {
     init_params.encodeConfig->rcParams.maxQP = 51;
     init_params.encodeConfig->rcParams.minQP = 0;
 
-    // Configure H.264 parameters
-    init_params.encodeConfig->encodeCodecConfig.h264Config.idrPeriod = config_.gop_size;
-    init_params.encodeConfig->encodeCodecConfig.h264Config.maxNumRefFramesInDPB = 4;
+    // Configure codec parameters. Without periodic IDRs, headers repeat so
+    // a decoder can join at any refresh point.
+    auto& codec_config = init_params.encodeConfig->encodeCodecConfig;
+    uint32_t slice_count = std::max(config_.slice_count, 1u);
+    switch (config_.codec) {
+        case Codec::H264: {
+            auto& h264 = codec_config.h264Config;
+            h264.idrPeriod = config_.gop_size;
+            h264.maxNumRefFramesInDPB = 4;
+            if (isChroma444(target_format_)) {
+                init_params.encodeConfig->profileGUID = NV_ENC_H264_PROFILE_HIGH_444_GUID;
+                h264.chromaFormatIDC = 3;
+            }
+            if (ultra_low_latency) {
+                setIntraRefresh(h264, config_.gop_size, config_.fps);
+                h264.repeatSPSPPS = 1;
+                h264.outputRecoveryPointSEI = 1;
+                h264.sliceMode = 3;     // sliceModeData slices per picture
+                h264.sliceModeData = slice_count;
+            }
+            setColorDescription(h264.h264VUIParameters, config_.color_matrix, config_.full_range);
+            break;
+        }
+        case Codec::HEVC: {
+            auto& hevc = codec_config.hevcConfig;
+            hevc.idrPeriod = config_.gop_size;
+            if (isChroma444(target_format_)) {
+                init_params.encodeConfig->profileGUID = NV_ENC_HEVC_PROFILE_FREXT_GUID;
+                hevc.chromaFormatIDC = 3;
+            } else if (isTenBit(target_format_)) {
+                init_params.encodeConfig->profileGUID = NV_ENC_HEVC_PROFILE_MAIN10_GUID;
+            }
+            if (isTenBit(target_format_)) {
+                hevc.pixelBitDepthMinus8 = 2;
+            }
+            if (ultra_low_latency) {
+                setIntraRefresh(hevc, config_.gop_size, config_.fps);
+                hevc.repeatSPSPPS = 1;
+                hevc.sliceMode = 3;
+                hevc.sliceModeData = slice_count;
+            }
+            setColorDescription(hevc.hevcVUIParameters, config_.color_matrix, config_.full_range);
+            break;
+        }
+        case Codec::AV1: {
+            auto& av1 = codec_config.av1Config;
+            av1.idrPeriod = config_.gop_size;
+            init_params.encodeConfig->profileGUID = NV_ENC_AV1_PROFILE_MAIN_GUID;
+            if (isTenBit(target_format_)) {
+                av1.inputPixelBitDepthMinus8 = 2;
+                av1.pixelBitDepthMinus8 = 2;
+            }
+            if (ultra_low_latency) {
+                setIntraRefresh(av1, config_.gop_size, config_.fps);
+                av1.repeatSeqHdr = 1;
+            }
+            setColorDescription(av1, config_.color_matrix, config_.full_range);
+            break;
+        }
+    }
 
-    // Create encoder
-    status = nvenc_.nv_enc.nvEncInitializeEncoder(&nvenc_.encoder, &init_params);
+    status = nvenc_.nv_enc.nvEncInitializeEncoder(nvenc_.encoder, &init_params);
     if (status != NV_ENC_SUCCESS) {
         return false;
     }
 
-    // Allocate output buffers
-    nvenc_.output_buffers.resize(4);
-    for (auto& buffer : nvenc_.output_buffers) {
+    // Input reads are queued behind the conversions on cuda_.stream
+    status = nvenc_.nv_enc.nvEncSetIOCudaStreams(nvenc_.encoder, &cuda_.stream, &cuda_.stream);
+    if (status != NV_ENC_SUCCESS) {
+        return false;
+    }
+
+    // Register each slot's YUV buffer as encoder input, with its own bitstream
+    for (auto& slot : slots_) {
+        slot.width = config_.width;
+        slot.height = config_.height;
+        if (!registerInput(slot)) {
+            return false;
+        }
+
         NV_ENC_CREATE_BITSTREAM_BUFFER create_bitstream_buffer = {};
         create_bitstream_buffer.version = NV_ENC_CREATE_BITSTREAM_BUFFER_VER;
         create_bitstream_buffer.size = config_.width * config_.height * 4;
         create_bitstream_buffer.memoryHeap = NV_ENC_MEMORY_HEAP_SYSMEM_CACHED;
+        slot.slice_offsets.assign(slice_count, 0);
 
         status = nvenc_.nv_enc.nvEncCreateBitstreamBuffer(nvenc_.encoder, &create_bitstream_buffer);
         if (status != NV_ENC_SUCCESS) {
             return false;
         }
-        buffer = create_bitstream_buffer.bitstreamBuffer;
+        slot.bitstream = create_bitstream_buffer.bitstreamBuffer;
+    }
+
+    return true;
+}
+
+bool FrameCapture::registerInput(CaptureSlot& slot) {
+    // The chroma planes start where NVENC expects them for this height
+    NV_ENC_REGISTER_RESOURCE register_resource = {};
+    register_resource.version = NV_ENC_REGISTER_RESOURCE_VER;
+    register_resource.resourceType = NV_ENC_INPUT_RESOURCE_TYPE_CUDADEVICEPTR;
+    register_resource.resourceToRegister = reinterpret_cast<void*>(slot.yuv_ptr);
+    register_resource.width = slot.width;
+    register_resource.height = slot.height;
+    register_resource.pitch = static_cast<uint32_t>(slot.yuv_pitch);
+    register_resource.bufferFormat = nvenc_.buffer_format;
+    register_resource.bufferUsage = NV_ENC_INPUT_IMAGE;
+
+    NVENCSTATUS status = nvenc_.nv_enc.nvEncRegisterResource(nvenc_.encoder, &register_resource);
+    if (status != NV_ENC_SUCCESS) {
+        slot.registered = nullptr;
+        return false;
+    }
+    slot.registered = register_resource.registeredResource;
+    slot.registered_width = slot.width;
+    slot.registered_height = slot.height;
+    return true;
+}
+
+bool FrameCapture::applyEncoderSettings(CaptureSlot& slot) {
+    NV_ENC_INITIALIZE_PARAMS& current = nvenc_.init_params;
+    uint32_t bitrate = pending_bitrate_.exchange(0);
+    bool resized = slot.width != current.encodeWidth || slot.height != current.encodeHeight;
+    if (bitrate == 0 && !resized) {
+        return true;
     }
 
+    if (resized) {
+        tile_hashes_valid_ = false;
+
+        // A reset encoder must not have pictures of the old size in flight
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        queue_cv_.wait(lock, [this]() { return encode_queue_.empty() || should_stop_; });
+    }
+
+    // Work on copies: a rejected reconfigure leaves the encoder as it was
+    NV_ENC_CONFIG encode_config = nvenc_.encode_config;
+    NV_ENC_RECONFIGURE_PARAMS reconfigure = {};
+    reconfigure.version = NV_ENC_RECONFIGURE_PARAMS_VER;
+    reconfigure.reInitEncodeParams = current;
+    reconfigure.reInitEncodeParams.encodeConfig = &encode_config;
+    reconfigure.reInitEncodeParams.encodeWidth = slot.width;
+    reconfigure.reInitEncodeParams.encodeHeight = slot.height;
+    reconfigure.reInitEncodeParams.darWidth = slot.width;
+    reconfigure.reInitEncodeParams.darHeight = slot.height;
+    if (bitrate != 0) {
+        encode_config.rcParams.averageBitRate = bitrate;
+        encode_config.rcParams.maxBitRate = bitrate;
+        encode_config.rcParams.vbvBufferSize = bitrate / config_.fps;
+        encode_config.rcParams.vbvInitialDelay = encode_config.rcParams.vbvBufferSize;
+    }
+
+    // A new bitrate keeps the reference frames; a new size cannot
+    reconfigure.resetEncoder = resized ? 1 : 0;
+    reconfigure.forceIDR = resized ? 1 : 0;
+
+    NVENCSTATUS status = nvenc_.nv_enc.nvEncReconfigureEncoder(nvenc_.encoder, &reconfigure);
+    if (status != NV_ENC_SUCCESS) {
+        return false;
+    }
+    nvenc_.encode_config = encode_config;
+    current = reconfigure.reInitEncodeParams;
+    current.encodeConfig = &nvenc_.encode_config;
     return true;
 }
 
 void FrameCapture::cleanupResources() {
+    // Nothing may still be copying into the slots
+    if (vulkan_.queue) {
+        vkQueueWaitIdle(vulkan_.queue);
+    }
+
     // Clean up NVENC resources
     if (nvenc_.encoder) {
+        for (auto& slot : slots_) {
+            if (slot.registered) {
+                nvenc_.nv_enc.nvEncUnregisterResource(nvenc_.encoder, slot.registered);
+            }
+            if (slot.bitstream) {
+                nvenc_.nv_enc.nvEncDestroyBitstreamBuffer(nvenc_.encoder, slot.bitstream);
+            }
+        }
         nvenc_.nv_enc.nvEncDestroyEncoder(nvenc_.encoder);
     }
 
     // Clean up CUDA resources
-    if (cuda_.device_buffer) {
-        cuMemFree(cuda_.device_buffer);
-    }
-    if (cuda_.stream) {
-        cuStreamDestroy(cuda_.stream);
-    }
     if (cuda_.context) {
+        cuCtxPushCurrent(cuda_.context);
+        for (auto& slot : slots_) {
+            if (slot.yuv_ptr) {
+                cuMemFree(slot.yuv_ptr);
+            }
+            if (slot.device_ptr) {
+                cuMemFree(slot.device_ptr);
+            }
+            if (slot.external_memory) {
+                cuDestroyExternalMemory(slot.external_memory);
+            }
+            if (slot.convert_start) {
+                cuEventDestroy(slot.convert_start);
+            }
+            if (slot.convert_end) {
+                cuEventDestroy(slot.convert_end);
+            }
+        }
+        if (cuda_.diff_done) {
+            cuEventDestroy(cuda_.diff_done);
+        }
+        if (cuda_.changed_host) {
+            cuMemFreeHost(cuda_.changed_host);
+        }
+        if (cuda_.changed_tiles) {
+            cuMemFree(cuda_.changed_tiles);
+        }
+        if (cuda_.tile_hashes) {
+            cuMemFree(cuda_.tile_hashes);
+        }
+        if (cuda_.diff_stream) {
+            cuStreamDestroy(cuda_.diff_stream);
+        }
+        if (cuda_.timeline) {
+            cuDestroyExternalSemaphore(cuda_.timeline);
+        }
+        if (cuda_.stream) {
+            cuStreamDestroy(cuda_.stream);
+        }
+        cuCtxPopCurrent(nullptr);
         cuCtxDestroy(cuda_.context);
     }
 
     // Clean up Vulkan resources
-    if (vulkan_.command_buffer) {
-        vkFreeCommandBuffers(vulkan_.device, vulkan_.command_pool, 1, &vulkan_.command_buffer);
+    for (auto& slot : slots_) {
+        if (slot.command_buffer) {
+            vkFreeCommandBuffers(vulkan_.device, vulkan_.command_pool, 1, &slot.command_buffer);
+        }
+        if (slot.buffer) {
+            vkDestroyBuffer(vulkan_.device, slot.buffer, nullptr);
+        }
+        if (slot.memory) {
+            vkFreeMemory(vulkan_.device, slot.memory, nullptr);
+        }
     }
-    if (vulkan_.command_pool) {
-        vkDestroyCommandPool(vulkan_.device, vulkan_.command_pool, nullptr);
+    if (vulkan_.timeline) {
+        vkDestroySemaphore(vulkan_.device, vulkan_.timeline, nullptr);
     }
-    if (vulkan_.staging_memory) {
-        vkFreeMemory(vulkan_.device, vulkan_.staging_memory, nullptr);
+    if (vulkan_.timestamps) {
+        vkDestroyQueryPool(vulkan_.device, vulkan_.timestamps, nullptr);
     }
-    if (vulkan_.staging_buffer) {
-        vkDestroyBuffer(vulkan_.device, vulkan_.staging_buffer, nullptr);
+    if (vulkan_.command_pool) {
+        vkDestroyCommandPool(vulkan_.device, vulkan_.command_pool, nullptr);
     }
 }
 
-bool FrameCapture::captureFrame(VkCommandBuffer command_buffer, VkImage image) {
-    if (!copyImageToBuffer(command_buffer, image)) {
+bool FrameCapture::captureFrame(VkImage image, uint64_t frame_id) {
+    uint32_t index;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (free_slots_.empty()) {
+            // The encoder is behind; a stale frame is worth less than latency
+            std::lock_guard<std::mutex> stats_lock(stats_mutex_);
+            stats_.frames_dropped++;
+            return false;
+        }
+        index = free_slots_.front();
+        free_slots_.pop_front();
+        slots_[index].width = capture_width_;
+        slots_[index].height = capture_height_;
+    }
+
+    CaptureSlot& slot = slots_[index];
+    if (!recordCopy(slot, image)) {
+        releaseSlot(index);
         return false;
     }
 
-    // Copy from staging buffer to CUDA buffer
-    void* staging_data;
-    vkMapMemory(vulkan_.device, vulkan_.staging_memory, 0, cuda_.buffer_size, 0, &staging_data);
-    
-    CUresult result = cuMemcpyHtoDAsync(cuda_.device_buffer, staging_data, cuda_.buffer_size, cuda_.stream);
-    vkUnmapMemory(vulkan_.device, vulkan_.staging_memory);
-    
-    if (result != CUDA_SUCCESS) {
+    // The copy signals the slot's value; CUDA waits on it before NVENC reads
+    slot.ready_value = ++vulkan_.timeline_value;
+    slot.frame_id = frame_id;
+    slot.captured = std::chrono::steady_clock::now();
+
+    VkTimelineSemaphoreSubmitInfo timeline_info = {};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_info.signalSemaphoreValueCount = 1;
+    timeline_info.pSignalSemaphoreValues = &slot.ready_value;
+
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = &timeline_info;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &slot.command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &vulkan_.timeline;
+
+    VkResult result = vkQueueSubmit(vulkan_.queue, 1, &submit_info, VK_NULL_HANDLE);
+    if (result != VK_SUCCESS) {
+        releaseSlot(index);
         return false;
     }
 
     // Queue frame for encoding
     {
         std::lock_guard<std::mutex> lock(queue_mutex_);
-        FrameData frame_data;
-        frame_data.data.resize(cuda_.buffer_size);
-        frame_data.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::steady_clock::now().time_since_epoch()).count();
-        
-        result = cuMemcpyDtoHAsync(frame_data.data.data(), cuda_.device_buffer, cuda_.buffer_size, cuda_.stream);
-        if (result != CUDA_SUCCESS) {
-            return false;
-        }
-        
-        frame_queue_.push(std::move(frame_data));
-        queue_cv_.notify_one();
+        capture_queue_.push(index);
+        pending_frames_++;
     }
+    queue_cv_.notify_all();
 
     // Update statistics
     {
@@ -267,71 +868,112 @@ bool FrameCapture::captureFrame(VkCommandBuffer command_buffer, VkImage image) {
     return true;
 }
 
-bool FrameCapture::getEncodedFrame(std::vector<uint8_t>& frame_data) {
-    std::unique_lock<std::mutex> lock(queue_mutex_);
-    if (frame_queue_.empty()) {
-        return false;
-    }
+bool FrameCapture::getEncodedFrame(std::vector<uint8_t>& frame_data, bool* end_of_frame,
+    uint64_t* frame_id)
+{
+    while (true) {
+        FrameData* frame = frame_ring_.pop();
+        if (!frame) {
+            // publish() notifies under the lock after every push, so checking
+            // the ring here cannot miss one
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            queue_cv_.wait(lock, [this]() {
+                return !frame_ring_.empty() || pending_frames_ == 0;
+            });
+            if (frame_ring_.empty()) {
+                return false;
+            }
+            continue;
+        }
 
-    FrameData frame = std::move(frame_queue_.front());
-    frame_queue_.pop();
-    lock.unlock();
+        // P-frames after a gap reference pictures the client never got
+        if (frame->sequence != expected_sequence_) {
+            awaiting_keyframe_ = true;
+        }
+        expected_sequence_ = frame->sequence + 1;
+        if (awaiting_keyframe_ && !frame->keyframe) {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.frames_dropped++;
+            continue;
+        }
+        awaiting_keyframe_ = false;
 
-    // Encode frame
-    if (!encodeFrame(frame.data.data())) {
-        return false;
+        // The caller's old buffer goes back into the ring for reuse
+        frame_data.swap(frame->data);
+        if (end_of_frame) {
+            *end_of_frame = frame->end_of_frame;
+        }
+        if (frame_id) {
+            *frame_id = frame->frame_id;
+        }
+        return true;
     }
+}
 
-    // Get encoded data from output buffer
-    NV_ENC_LOCK_BITSTREAM lock_bitstream = {};
-    lock_bitstream.version = NV_ENC_LOCK_BITSTREAM_VER;
-    lock_bitstream.outputBitstream = nvenc_.output_buffers[0];
-
-    NVENCSTATUS status = nvenc_.nv_enc.nvEncLockBitstream(nvenc_.encoder, &lock_bitstream);
-    if (status != NV_ENC_SUCCESS) {
-        return false;
+void FrameCapture::flush() {
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        queue_cv_.wait(lock, [this]() { return pending_frames_ == 0; });
     }
 
-    // Copy encoded data
-    frame_data.resize(lock_bitstream.bitstreamSizeInBytes);
-    std::memcpy(frame_data.data(), lock_bitstream.bitstreamBufferPtr, lock_bitstream.bitstreamSizeInBytes);
+    bool discarded = false;
+    while (FrameData* frame = frame_ring_.pop()) {
+        expected_sequence_ = frame->sequence + 1;
+        discarded = true;
+    }
+    if (discarded) {
+        // Whatever is encoded next must not reference what was thrown away
+        awaiting_keyframe_ = true;
+        force_idr_ = true;
+    }
+}
 
-    // Unlock bitstream
-    nvenc_.nv_enc.nvEncUnlockBitstream(nvenc_.encoder, lock_bitstream.outputBitstream);
+void FrameCapture::setBitrate(uint32_t bitrate) {
+    pending_bitrate_ = bitrate;
+}
 
-    // Update statistics
-    {
-        std::lock_guard<std::mutex> stats_lock(stats_mutex_);
-        stats_.frames_encoded++;
-        stats_.total_bytes += lock_bitstream.bitstreamSizeInBytes;
-        updateStatistics(lock_bitstream.bitstreamSizeInBytes, 0.0); // TODO: Calculate actual latency
+bool FrameCapture::setResolution(uint32_t width, uint32_t height) {
+    if (width == 0 || height == 0 || width > config_.width || height > config_.height) {
+        return false;
+    }
+    if (!isChroma444(target_format_) && (width % 2 || height % 2)) {
+        return false;
     }
 
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    capture_width_ = width;
+    capture_height_ = height;
     return true;
 }
 
-void FrameCapture::flush() {
-    std::unique_lock<std::mutex> lock(queue_mutex_);
-    queue_cv_.wait(lock, [this]() { return frame_queue_.empty(); });
-}
-
 FrameCapture::Statistics FrameCapture::getStatistics() const {
     std::lock_guard<std::mutex> lock(stats_mutex_);
     return stats_;
 }
 
-bool FrameCapture::copyImageToBuffer(VkCommandBuffer command_buffer, VkImage image) {
+void FrameCapture::releaseSlot(uint32_t index) {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        free_slots_.push_back(index);
+    }
+    queue_cv_.notify_all();
+}
+
+bool FrameCapture::recordCopy(CaptureSlot& slot, VkImage image) {
     // Begin command buffer
     VkCommandBufferBeginInfo begin_info = {};
     begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-    VkResult result = vkBeginCommandBuffer(command_buffer, &begin_info);
+    VkResult result = vkBeginCommandBuffer(slot.command_buffer, &begin_info);
     if (result != VK_SUCCESS) {
         return false;
     }
+    if (vulkan_.timestamps) {
+        vkCmdResetQueryPool(slot.command_buffer, vulkan_.timestamps, slot.first_query, 2);
+    }
 
-    // Create image memory barrier
+    // Wait for rendering into the image, then make it a transfer source
     VkImageMemoryBarrier barrier = {};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     barrier.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
@@ -344,156 +986,417 @@ bool FrameCapture::copyImageToBuffer(VkCommandBuffer command_buffer, VkImage ima
     barrier.subresourceRange.levelCount = 1;
     barrier.subresourceRange.baseArrayLayer = 0;
     barrier.subresourceRange.layerCount = 1;
-    barrier.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
     barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 
-    vkCmdPipelineBarrier(command_buffer,
-        VK_PIPELINE_STAGE_TRANSFER_BIT,
+    vkCmdPipelineBarrier(slot.command_buffer,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
         VK_PIPELINE_STAGE_TRANSFER_BIT,
         0,
         0, nullptr,
         0, nullptr,
         1, &barrier);
 
-    // Copy image to buffer
+    if (vulkan_.timestamps) {
+        vkCmdWriteTimestamp(slot.command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            vulkan_.timestamps, slot.first_query);
+    }
+
+    // Copy image to the slot's device-local buffer, tightly packed
     VkBufferImageCopy region = {};
     region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     region.imageSubresource.mipLevel = 0;
     region.imageSubresource.baseArrayLayer = 0;
     region.imageSubresource.layerCount = 1;
-    region.imageExtent.width = config_.width;
-    region.imageExtent.height = config_.height;
+    region.imageExtent.width = slot.width;
+    region.imageExtent.height = slot.height;
     region.imageExtent.depth = 1;
 
-    vkCmdCopyImageToBuffer(command_buffer,
+    vkCmdCopyImageToBuffer(slot.command_buffer,
         image,
         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-        vulkan_.staging_buffer,
+        slot.buffer,
         1,
         &region);
 
-    // Create buffer memory barrier
+    if (vulkan_.timestamps) {
+        vkCmdWriteTimestamp(slot.command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            vulkan_.timestamps, slot.first_query + 1);
+    }
+
+    // Hand the image back for presentation and the buffer over to CUDA.
+    // The next copy overwrites the whole buffer, so it is never acquired back.
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = 0;
+
     VkBufferMemoryBarrier buffer_barrier = {};
     buffer_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
     buffer_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    buffer_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
-    buffer_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    buffer_barrier.buffer = vulkan_.staging_buffer;
+    buffer_barrier.dstAccessMask = 0;
+    buffer_barrier.srcQueueFamilyIndex = vulkan_.queue_family;
+    buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_EXTERNAL;
+    buffer_barrier.buffer = slot.buffer;
     buffer_barrier.offset = 0;
     buffer_barrier.size = VK_WHOLE_SIZE;
 
-    vkCmdPipelineBarrier(command_buffer,
+    vkCmdPipelineBarrier(slot.command_buffer,
         VK_PIPELINE_STAGE_TRANSFER_BIT,
-        VK_PIPELINE_STAGE_HOST_BIT,
+        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
         0,
         0, nullptr,
         1, &buffer_barrier,
-        0, nullptr);
+        1, &barrier);
 
     // End command buffer
-    result = vkEndCommandBuffer(command_buffer);
-    if (result != VK_SUCCESS) {
+    result = vkEndCommandBuffer(slot.command_buffer);
+    return result == VK_SUCCESS;
+}
+
+bool FrameCapture::frameChanged(CaptureSlot& slot) {
+    if (config_.unchanged_frames == UnchangedFrames::ENCODE) {
+        return true;
+    }
+
+    CUDA_EXTERNAL_SEMAPHORE_WAIT_PARAMS wait_params = {};
+    wait_params.params.fence.value = slot.ready_value;
+
+    TileHashParams params = {};
+    params.source = slot.device_ptr;
+    params.source_pitch = slot.width * 4;
+    params.width = slot.width;
+    params.height = slot.height;
+    params.hashes = cuda_.tile_hashes;
+    params.changed = cuda_.changed_tiles;
+
+    // The one place the encode thread waits for the GPU: a few microseconds
+    // after the copy lands. If the check fails, encode to be safe.
+    CUstream stream = cuda_.diff_stream;
+    if (cuWaitExternalSemaphoresAsync(&cuda_.timeline, &wait_params, 1, stream) != CUDA_SUCCESS ||
+        cuMemsetD32Async(cuda_.changed_tiles, 0, 1, stream) != CUDA_SUCCESS ||
+        hashTiles(params, stream) != CUDA_SUCCESS ||
+        cuMemcpyDtoHAsync(cuda_.changed_host, cuda_.changed_tiles, sizeof(uint32_t), stream) != CUDA_SUCCESS ||
+        cuEventRecord(cuda_.diff_done, stream) != CUDA_SUCCESS ||
+        cuEventSynchronize(cuda_.diff_done) != CUDA_SUCCESS) {
+        tile_hashes_valid_ = false;
+        return true;
+    }
+
+    // Hashes from before a resize or a failed check compare against nothing.
+    // A frame that has to restart the stream goes out regardless.
+    bool changed = *cuda_.changed_host != 0 || !tile_hashes_valid_ || force_idr_;
+    tile_hashes_valid_ = true;
+    return changed;
+}
+
+bool FrameCapture::submitEncode(CaptureSlot& slot) {
+    slot.submitted = std::chrono::steady_clock::now();
+
+    // Bitrate or size asked for since the last frame
+    if (!applyEncoderSettings(slot)) {
         return false;
     }
 
-    // Submit command buffer
-    VkSubmitInfo submit_info = {};
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &command_buffer;
+    // The completion thread passes unchanged frames on in order
+    slot.unchanged = !frameChanged(slot);
+    if (slot.unchanged) {
+        return true;
+    }
 
-    result = vkQueueSubmit(VK_NULL_HANDLE, 1, &submit_info, VK_NULL_HANDLE);
-    if (result != VK_SUCCESS) {
+    // Order the conversion after the Vulkan copy, on the GPU
+    CUDA_EXTERNAL_SEMAPHORE_WAIT_PARAMS wait_params = {};
+    wait_params.params.fence.value = slot.ready_value;
+
+    CUresult result = cuWaitExternalSemaphoresAsync(&cuda_.timeline, &wait_params, 1, cuda_.stream);
+    if (result != CUDA_SUCCESS) {
         return false;
     }
 
-    // Wait for queue to idle
-    result = vkQueueWaitIdle(VK_NULL_HANDLE);
-    if (result != VK_SUCCESS) {
+    ColorConvertParams convert_params = {};
+    convert_params.source = slot.device_ptr;
+    convert_params.source_pitch = slot.width * 4;
+    convert_params.source_format = source_format_;
+    convert_params.target = slot.yuv_ptr;
+    convert_params.target_pitch = slot.yuv_pitch;
+    convert_params.target_format = target_format_;
+    convert_params.width = slot.width;
+    convert_params.height = slot.height;
+    convert_params.coefficients = color_coefficients_;
+
+    cuEventRecord(slot.convert_start, cuda_.stream);
+    result = convertColor(convert_params, cuda_.stream);
+    if (result != CUDA_SUCCESS) {
         return false;
     }
+    cuEventRecord(slot.convert_end, cuda_.stream);
 
-    return true;
-}
+    // Registered for another size before a resize
+    if (slot.registered_width != slot.width || slot.registered_height != slot.height) {
+        nvenc_.nv_enc.nvEncUnregisterResource(nvenc_.encoder, slot.registered);
+        if (!registerInput(slot)) {
+            return false;
+        }
+    }
 
-bool FrameCapture::encodeFrame(const void* frame_data) {
-    // Map input buffer
+    // Map input buffer; it stays mapped until the bitstream is retrieved
     NV_ENC_MAP_INPUT_RESOURCE map_input_resource = {};
     map_input_resource.version = NV_ENC_MAP_INPUT_RESOURCE_VER;
-    map_input_resource.resourceType = NV_ENC_INPUT_RESOURCE_TYPE_CUDADEVICEPTR;
-    map_input_resource.resource = (void*)cuda_.device_buffer;
+    map_input_resource.registeredResource = slot.registered;
 
     NVENCSTATUS status = nvenc_.nv_enc.nvEncMapInputResource(nvenc_.encoder, &map_input_resource);
     if (status != NV_ENC_SUCCESS) {
         return false;
     }
+    slot.mapped = map_input_resource.mappedResource;
 
-    // Encode frame
+    // Queue the encode; NVENC returns before the picture is done
     NV_ENC_PIC_PARAMS pic_params = {};
     pic_params.version = NV_ENC_PIC_PARAMS_VER;
     pic_params.pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
-    pic_params.inputBuffer = map_input_resource.mappedResource;
-    pic_params.bufferFmt = NV_ENC_BUFFER_FORMAT_NV12_PL;
-    pic_params.inputWidth = config_.width;
-    pic_params.inputHeight = config_.height;
-    pic_params.outputBitstream = nvenc_.output_buffers[0];
+    pic_params.inputBuffer = slot.mapped;
+    pic_params.bufferFmt = map_input_resource.mappedBufferFmt;
+    pic_params.inputWidth = slot.width;
+    pic_params.inputHeight = slot.height;
+    pic_params.inputPitch = static_cast<uint32_t>(slot.yuv_pitch);
+    pic_params.outputBitstream = slot.bitstream;
     pic_params.completionEvent = nullptr;
 
+    // The reader lost frames; restart the reference chain
+    if (force_idr_.exchange(false)) {
+        pic_params.encodePicFlags = NV_ENC_PIC_FLAG_FORCEIDR | NV_ENC_PIC_FLAG_OUTPUT_SPSPPS;
+    }
+
     status = nvenc_.nv_enc.nvEncEncodePicture(nvenc_.encoder, &pic_params);
     if (status != NV_ENC_SUCCESS) {
-        nvenc_.nv_enc.nvEncUnmapInputResource(nvenc_.encoder, map_input_resource.mappedResource);
+        nvenc_.nv_enc.nvEncUnmapInputResource(nvenc_.encoder, slot.mapped);
+        slot.mapped = nullptr;
         return false;
     }
+    return true;
+}
+
+bool FrameCapture::retrieveBitstream(CaptureSlot& slot, size_t& bytes) {
+    NV_ENC_LOCK_BITSTREAM lock_bitstream = {};
+    lock_bitstream.version = NV_ENC_LOCK_BITSTREAM_VER;
+    lock_bitstream.outputBitstream = slot.bitstream;
+    bytes = 0;
+
+    NVENCSTATUS status;
+    if (!sliceOutput(config_)) {
+        // Blocks until NVENC has finished the picture; the bitstream is the
+        // first thing to reach host memory
+        status = nvenc_.nv_enc.nvEncLockBitstream(nvenc_.encoder, &lock_bitstream);
+        if (status == NV_ENC_SUCCESS) {
+            bytes = lock_bitstream.bitstreamSizeInBytes;
+            publish(slot, static_cast<const uint8_t*>(lock_bitstream.bitstreamBufferPtr), bytes,
+                lock_bitstream.pictureType == NV_ENC_PIC_TYPE_IDR, true);
+            nvenc_.nv_enc.nvEncUnlockBitstream(nvenc_.encoder, lock_bitstream.outputBitstream);
+        }
+    } else {
+        // NVENC writes slices out as it finishes them; poll without waiting
+        // and pass on whatever is new, so the first slice is on its way while
+        // the rest of the picture is still encoding
+        lock_bitstream.doNotWait = 1;
+        lock_bitstream.sliceOffsets = slot.slice_offsets.data();
+        bool complete = false;
+        while (!complete) {
+            status = nvenc_.nv_enc.nvEncLockBitstream(nvenc_.encoder, &lock_bitstream);
+            if (status == NV_ENC_ERR_LOCK_BUSY) {
+                std::this_thread::yield();
+                continue;
+            }
+            if (status != NV_ENC_SUCCESS) {
+                break;
+            }
+
+            complete = lock_bitstream.hwEncodeStatus == 2;
+            size_t written = lock_bitstream.bitstreamSizeInBytes;
+            if (written > bytes || complete) {
+                const uint8_t* data = static_cast<const uint8_t*>(lock_bitstream.bitstreamBufferPtr);
+                publish(slot, data + bytes, written - bytes,
+                    bytes == 0 && lock_bitstream.pictureType == NV_ENC_PIC_TYPE_IDR, complete);
+                bytes = written;
+            }
+            nvenc_.nv_enc.nvEncUnlockBitstream(nvenc_.encoder, lock_bitstream.outputBitstream);
+            if (!complete) {
+                std::this_thread::yield();
+            }
+        }
+    }
 
     // Unmap input buffer
-    status = nvenc_.nv_enc.nvEncUnmapInputResource(nvenc_.encoder, map_input_resource.mappedResource);
-    if (status != NV_ENC_SUCCESS) {
-        return false;
+    nvenc_.nv_enc.nvEncUnmapInputResource(nvenc_.encoder, slot.mapped);
+    slot.mapped = nullptr;
+    return status == NV_ENC_SUCCESS;
+}
+
+void FrameCapture::publish(const CaptureSlot& slot, const uint8_t* data, size_t size,
+    bool keyframe, bool end_of_frame)
+{
+    // Copied straight into the ring's next slot
+    FrameData& frame = frame_ring_.back();
+    frame.data.assign(data, data + size);
+    frame.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+        slot.captured.time_since_epoch()).count();
+    frame.sequence = next_sequence_++;
+    frame.frame_id = slot.frame_id;
+    frame.keyframe = keyframe;
+    frame.end_of_frame = end_of_frame;
+
+    // A full ring drops its oldest entry rather than holding this one back;
+    // the reader skips to the IDR asked for here
+    uint64_t dropped = frame_ring_.dropped();
+    frame_ring_.push();
+    if (frame_ring_.dropped() != dropped) {
+        force_idr_ = true;
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.frames_dropped++;
     }
 
-    return true;
+    // Taking the lock orders this push against a reader about to sleep
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+    }
+    queue_cv_.notify_all();
 }
 
 void FrameCapture::updateStatistics(uint64_t bytes, double latency) {
     stats_.total_bytes += bytes;
-    
+
     // Update average latency
-    static constexpr double alpha = 0.1; // Smoothing factor
-    stats_.average_latency = (1.0 - alpha) * stats_.average_latency + alpha * latency;
-    
-    // Update average FPS
-    static auto last_update = std::chrono::steady_clock::now();
+    smooth(stats_.average_latency, latency);
+
+    // Update average FPS, once a second
+    fps_frames_++;
     auto now = std::chrono::steady_clock::now();
-    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_update).count();
-    if (elapsed >= 1000) { // Update every second
-        stats_.average_fps = static_cast<double>(stats_.frames_encoded) * 1000.0 / elapsed;
-        stats_.frames_encoded = 0;
-        last_update = now;
+    double elapsed = milliseconds(now - fps_since_);
+    if (elapsed >= 1000.0) {
+        stats_.average_fps = fps_frames_ * 1000.0 / elapsed;
+        fps_frames_ = 0;
+        fps_since_ = now;
+    }
+}
+
+void FrameCapture::updateStageTimings(CaptureSlot& slot, std::chrono::steady_clock::time_point done) {
+    smooth(stats_.average_queue_time, milliseconds(slot.submitted - slot.captured));
+    smooth(stats_.average_encode_time, milliseconds(done - slot.submitted));
+
+    // Both GPU stages finished before NVENC could read its input
+    float convert_time = 0.0f;
+    if (cuEventElapsedTime(&convert_time, slot.convert_start, slot.convert_end) == CUDA_SUCCESS) {
+        smooth(stats_.average_convert_time, convert_time);
+    }
+
+    double copy_time = 0.0;
+    uint64_t ticks[2] = {};
+    if (vulkan_.timestamps &&
+        vkGetQueryPoolResults(vulkan_.device, vulkan_.timestamps, slot.first_query, 2,
+            sizeof(ticks), ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+        copy_time = static_cast<double>(ticks[1] - ticks[0]) * vulkan_.timestamp_period / 1e6;
+        smooth(stats_.average_copy_time, copy_time);
+    }
+
+    // The GPU stages as spans of their measured length, from where the host
+    // queued them: the copy at capture, the conversion at encode submission
+    Tracer& tracer = Tracer::global();
+    if (tracer.enabled()) {
+        int64_t captured = Tracer::time(slot.captured);
+        int64_t submitted = Tracer::time(slot.submitted);
+        int64_t converted = submitted + static_cast<int64_t>(convert_time * 1000.0);
+        tracer.span(slot.frame_id, TraceStage::CAPTURE, captured,
+            captured + static_cast<int64_t>(copy_time * 1000.0));
+        tracer.span(slot.frame_id, TraceStage::CONVERT, submitted, converted);
+        tracer.span(slot.frame_id, TraceStage::ENCODE, converted, Tracer::time(done));
     }
 }
 
+void FrameCapture::finishSlot(uint32_t index) {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        free_slots_.push_back(index);
+        pending_frames_--;
+    }
+    queue_cv_.notify_all();
+}
+
 void FrameCapture::encodeThread() {
-    while (!should_stop_) {
+    // The semaphore waits, the conversion and NVENC's stream belong to this context
+    cuCtxSetCurrent(cuda_.context);
+
+    while (true) {
         std::unique_lock<std::mutex> lock(queue_mutex_);
         queue_cv_.wait(lock, [this]() {
-            return !frame_queue_.empty() || should_stop_;
+            return !capture_queue_.empty() || should_stop_;
         });
 
         if (should_stop_) {
             break;
         }
 
-        FrameData frame = std::move(frame_queue_.front());
-        frame_queue_.pop();
+        uint32_t index = capture_queue_.front();
+        capture_queue_.pop();
         lock.unlock();
 
-        if (!encodeFrame(frame.data.data())) {
-            // Handle encoding error
+        // Submit and move on; the completion thread waits for the result
+        if (!submitEncode(slots_[index])) {
+            finishSlot(index);
             continue;
         }
+
+        lock.lock();
+        encode_queue_.push(index);
+        lock.unlock();
+        queue_cv_.notify_all();
+    }
+}
+
+void FrameCapture::completionThread() {
+    cuCtxSetCurrent(cuda_.context);
+
+    while (true) {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        queue_cv_.wait(lock, [this]() {
+            return !encode_queue_.empty() || should_stop_;
+        });
+
+        if (should_stop_) {
+            break;
+        }
+
+        // NVENC hands bitstreams back in submission order
+        uint32_t index = encode_queue_.front();
+        encode_queue_.pop();
+        lock.unlock();
+
+        CaptureSlot& slot = slots_[index];
+        if (slot.unchanged) {
+            if (config_.unchanged_frames == UnchangedFrames::REPEAT) {
+                publish(slot, nullptr, 0, false, true);
+            }
+            {
+                std::lock_guard<std::mutex> stats_lock(stats_mutex_);
+                stats_.frames_skipped++;
+            }
+            finishSlot(index);
+            continue;
+        }
+
+        size_t bytes = 0;
+        bool encoded = retrieveBitstream(slot, bytes);
+        auto done = std::chrono::steady_clock::now();
+
+        if (encoded) {
+            std::lock_guard<std::mutex> stats_lock(stats_mutex_);
+            stats_.frames_encoded++;
+            updateStatistics(bytes, milliseconds(done - slot.captured));
+            updateStageTimings(slot, done);
+        }
+
+        // The slot is free again once NVENC has read it
+        finishSlot(index);
     }
 }
 
 } // namespace gpu
-} // namespace anarchy 
\ No newline at end of file
+} // namespace anarchy
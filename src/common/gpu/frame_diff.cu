@@ -0,0 +1,82 @@
+#include "common/gpu/frame_diff.hpp"
+#include <cuda_runtime.h>
+
+namespace anarchy {
+namespace gpu {
+
+namespace {
+
+constexpr uint32_t BLOCK_WIDTH = 32;
+constexpr uint32_t BLOCK_HEIGHT = 8;
+constexpr uint32_t WARP_COUNT = BLOCK_WIDTH * BLOCK_HEIGHT / 32;
+
+// splitmix64 finalizer
+__device__ uint64_t mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ull;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+}
+
+__global__ void hashTilesKernel(const uint8_t* source, size_t source_pitch, uint32_t width,
+    uint32_t height, uint64_t* hashes, uint32_t* changed)
+{
+    uint32_t x_begin = blockIdx.x * DIFF_TILE_SIZE;
+    uint32_t y_begin = blockIdx.y * DIFF_TILE_SIZE;
+    uint32_t x_end = min(x_begin + DIFF_TILE_SIZE, width);
+    uint32_t y_end = min(y_begin + DIFF_TILE_SIZE, height);
+
+    // Each pixel is mixed with its position, so moving content changes the
+    // hash; summing makes the result independent of thread order
+    uint64_t sum = 0;
+    for (uint32_t y = y_begin + threadIdx.y; y < y_end; y += BLOCK_HEIGHT) {
+        const uint32_t* row = reinterpret_cast<const uint32_t*>(source + y * source_pitch);
+        for (uint32_t x = x_begin + threadIdx.x; x < x_end; x += BLOCK_WIDTH) {
+            uint64_t position = static_cast<uint64_t>(y) * width + x;
+            sum += mix((position << 32) | row[x]);
+        }
+    }
+
+    for (uint32_t offset = 16; offset > 0; offset /= 2) {
+        sum += __shfl_xor_sync(0xFFFFFFFF, sum, offset);
+    }
+
+    __shared__ uint64_t warp_sums[WARP_COUNT];
+    uint32_t thread = threadIdx.y * BLOCK_WIDTH + threadIdx.x;
+    if (thread % 32 == 0) {
+        warp_sums[thread / 32] = sum;
+    }
+    __syncthreads();
+
+    if (thread == 0) {
+        uint64_t hash = 0;
+        for (uint32_t i = 0; i < WARP_COUNT; ++i) {
+            hash += warp_sums[i];
+        }
+        uint32_t tile = blockIdx.y * gridDim.x + blockIdx.x;
+        if (hashes[tile] != hash) {
+            hashes[tile] = hash;
+            atomicAdd(changed, 1u);
+        }
+    }
+}
+
+} // namespace
+
+CUresult hashTiles(const TileHashParams& params, CUstream stream) {
+    if (params.width == 0 || params.height == 0) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+
+    dim3 block(BLOCK_WIDTH, BLOCK_HEIGHT);
+    dim3 grid((params.width + DIFF_TILE_SIZE - 1) / DIFF_TILE_SIZE,
+        (params.height + DIFF_TILE_SIZE - 1) / DIFF_TILE_SIZE);
+    hashTilesKernel<<<grid, block, 0, stream>>>(reinterpret_cast<const uint8_t*>(params.source),
+        params.source_pitch, params.width, params.height,
+        reinterpret_cast<uint64_t*>(params.hashes), reinterpret_cast<uint32_t*>(params.changed));
+    return cudaGetLastError() == cudaSuccess ? CUDA_SUCCESS : CUDA_ERROR_LAUNCH_FAILED;
+}
+
+} // namespace gpu
+} // namespace anarchy
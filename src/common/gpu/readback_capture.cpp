@@ -0,0 +1,450 @@
+#include "common/gpu/readback_capture.hpp"
+#include "common/tracer.hpp"
+#include <algorithm>
+
+namespace anarchy {
+namespace gpu {
+
+namespace {
+
+constexpr uint32_t MIN_SLOT_COUNT = 2;
+
+// A type with required and preferred if there is one, else the first with
+// required. Host-visible memory without HOST_CACHED is usually
+// write-combined, which reads back an order of magnitude slower.
+uint32_t findMemoryType(VkPhysicalDevice physical_device, uint32_t type_filter,
+    VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+    VkMemoryPropertyFlags& chosen_flags)
+{
+    VkPhysicalDeviceMemoryProperties mem_properties;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_properties);
+
+    uint32_t fallback = UINT32_MAX;
+    for (uint32_t i = 0; i < mem_properties.memoryTypeCount; i++) {
+        VkMemoryPropertyFlags flags = mem_properties.memoryTypes[i].propertyFlags;
+        if (!(type_filter & (1u << i)) || (flags & required) != required) {
+            continue;
+        }
+        if ((flags & preferred) == preferred) {
+            chosen_flags = flags;
+            return i;
+        }
+        if (fallback == UINT32_MAX) {
+            fallback = i;
+        }
+    }
+    if (fallback != UINT32_MAX) {
+        chosen_flags = mem_properties.memoryTypes[fallback].propertyFlags;
+    }
+    return fallback;
+}
+
+void smooth(double& average, double sample) {
+    static constexpr double alpha = 0.1; // Smoothing factor
+    average = (1.0 - alpha) * average + alpha * sample;
+}
+
+double milliseconds(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+} // namespace
+
+ReadbackCapture::ReadbackCapture(const Config& config)
+    : config_(config)
+    , encoder_(config.compress, config.keyframe_interval)
+{
+}
+
+ReadbackCapture::~ReadbackCapture() {
+    flush();
+    cleanupResources();
+}
+
+uint32_t ReadbackCapture::bytesPerPixel(VkFormat format) {
+    switch (format) {
+        case VK_FORMAT_B8G8R8A8_UNORM:
+        case VK_FORMAT_B8G8R8A8_SRGB:
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+        case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+        case VK_FORMAT_A2R10G10B10_UNORM_PACK32:
+            return 4;
+        case VK_FORMAT_R16G16B16A16_UNORM:
+        case VK_FORMAT_R16G16B16A16_SFLOAT:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+bool ReadbackCapture::initialize(VkDevice device, VkPhysicalDevice physical_device,
+    uint32_t queue_family)
+{
+    device_ = device;
+    physical_device_ = physical_device;
+    queue_family_ = queue_family;
+
+    bytes_per_pixel_ = bytesPerPixel(config_.format);
+    if (bytes_per_pixel_ == 0 || config_.width == 0 || config_.height == 0) {
+        return false;
+    }
+    capture_width_ = config_.width;
+    capture_height_ = config_.height;
+    fps_since_ = std::chrono::steady_clock::now();
+
+    vkGetDeviceQueue(device_, queue_family_, 0, &queue_);
+
+    // Create command pool; slot command buffers are re-recorded every frame
+    VkCommandPoolCreateInfo pool_create_info = {};
+    pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool_create_info.queueFamilyIndex = queue_family_;
+
+    VkResult result = vkCreateCommandPool(device_, &pool_create_info, nullptr, &command_pool_);
+    if (result != VK_SUCCESS) {
+        return false;
+    }
+
+    slots_.assign(std::max(config_.slot_count, MIN_SLOT_COUNT), Slot{});
+    for (uint32_t i = 0; i < slots_.size(); ++i) {
+        if (!createSlot(slots_[i])) {
+            return false;
+        }
+        free_slots_.push_back(i);
+    }
+    return true;
+}
+
+bool ReadbackCapture::createSlot(Slot& slot) {
+    VkBufferCreateInfo buffer_create_info = {};
+    buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_create_info.size = static_cast<VkDeviceSize>(config_.width) * config_.height *
+        bytes_per_pixel_;
+    buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkResult result = vkCreateBuffer(device_, &buffer_create_info, nullptr, &slot.buffer);
+    if (result != VK_SUCCESS) {
+        return false;
+    }
+
+    VkMemoryRequirements mem_requirements;
+    vkGetBufferMemoryRequirements(device_, slot.buffer, &mem_requirements);
+
+    VkMemoryPropertyFlags flags = 0;
+    uint32_t memory_type = findMemoryType(physical_device_, mem_requirements.memoryTypeBits,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT, flags);
+    if (memory_type == UINT32_MAX) {
+        return false;
+    }
+    slot.coherent = flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    VkMemoryAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = mem_requirements.size;
+    alloc_info.memoryTypeIndex = memory_type;
+
+    result = vkAllocateMemory(device_, &alloc_info, nullptr, &slot.memory);
+    if (result != VK_SUCCESS) {
+        return false;
+    }
+
+    result = vkBindBufferMemory(device_, slot.buffer, slot.memory, 0);
+    if (result != VK_SUCCESS) {
+        return false;
+    }
+
+    result = vkMapMemory(device_, slot.memory, 0, VK_WHOLE_SIZE, 0, &slot.mapped);
+    if (result != VK_SUCCESS) {
+        return false;
+    }
+
+    VkCommandBufferAllocateInfo alloc_info_cb = {};
+    alloc_info_cb.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info_cb.commandPool = command_pool_;
+    alloc_info_cb.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info_cb.commandBufferCount = 1;
+
+    result = vkAllocateCommandBuffers(device_, &alloc_info_cb, &slot.command_buffer);
+    if (result != VK_SUCCESS) {
+        return false;
+    }
+
+    VkFenceCreateInfo fence_create_info = {};
+    fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    result = vkCreateFence(device_, &fence_create_info, nullptr, &slot.fence);
+    return result == VK_SUCCESS;
+}
+
+void ReadbackCapture::cleanupResources() {
+    for (auto& slot : slots_) {
+        if (slot.fence) {
+            vkDestroyFence(device_, slot.fence, nullptr);
+        }
+        if (slot.command_buffer) {
+            vkFreeCommandBuffers(device_, command_pool_, 1, &slot.command_buffer);
+        }
+        if (slot.buffer) {
+            vkDestroyBuffer(device_, slot.buffer, nullptr);
+        }
+        if (slot.memory) {
+            vkFreeMemory(device_, slot.memory, nullptr);    // Unmaps it
+        }
+    }
+    slots_.clear();
+    if (command_pool_) {
+        vkDestroyCommandPool(device_, command_pool_, nullptr);
+        command_pool_ = VK_NULL_HANDLE;
+    }
+}
+
+bool ReadbackCapture::captureFrame(VkImage image, uint64_t frame_id) {
+    uint32_t index;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_slots_.empty()) {
+            // The reader is behind; a stale frame is worth less than latency
+            std::lock_guard<std::mutex> stats_lock(stats_mutex_);
+            stats_.frames_dropped++;
+            return false;
+        }
+        index = free_slots_.front();
+        free_slots_.pop_front();
+        slots_[index].width = capture_width_;
+        slots_[index].height = capture_height_;
+    }
+
+    Slot& slot = slots_[index];
+    if (!recordCopy(slot, image)) {
+        releaseSlot(index);
+        return false;
+    }
+    slot.frame_id = frame_id;
+    slot.captured = std::chrono::steady_clock::now();
+
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &slot.command_buffer;
+
+    VkResult result = vkQueueSubmit(queue_, 1, &submit_info, slot.fence);
+    if (result != VK_SUCCESS) {
+        releaseSlot(index);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push(index);
+    }
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.frames_captured++;
+    }
+    return true;
+}
+
+bool ReadbackCapture::recordCopy(Slot& slot, VkImage image) {
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VkResult result = vkBeginCommandBuffer(slot.command_buffer, &begin_info);
+    if (result != VK_SUCCESS) {
+        return false;
+    }
+
+    // Wait for rendering into the image, then make it a transfer source
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    vkCmdPipelineBarrier(slot.command_buffer,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0, nullptr,
+        0, nullptr,
+        1, &barrier);
+
+    // Tightly packed, so the encoder reads it as is
+    VkBufferImageCopy region = {};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent.width = slot.width;
+    region.imageExtent.height = slot.height;
+    region.imageExtent.depth = 1;
+
+    vkCmdCopyImageToBuffer(slot.command_buffer,
+        image,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        slot.buffer,
+        1,
+        &region);
+
+    // Hand the image back for presentation and make the copy visible to
+    // host reads once the fence signals
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = 0;
+
+    VkBufferMemoryBarrier buffer_barrier = {};
+    buffer_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    buffer_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    buffer_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    buffer_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    buffer_barrier.buffer = slot.buffer;
+    buffer_barrier.offset = 0;
+    buffer_barrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(slot.command_buffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0,
+        0, nullptr,
+        1, &buffer_barrier,
+        1, &barrier);
+
+    result = vkEndCommandBuffer(slot.command_buffer);
+    return result == VK_SUCCESS;
+}
+
+bool ReadbackCapture::waitForCopy(Slot& slot) {
+    VkResult result = vkWaitForFences(device_, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+    if (result != VK_SUCCESS || vkResetFences(device_, 1, &slot.fence) != VK_SUCCESS) {
+        return false;
+    }
+    if (slot.coherent) {
+        return true;
+    }
+
+    VkMappedMemoryRange range = {};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = slot.memory;
+    range.offset = 0;
+    range.size = VK_WHOLE_SIZE;
+    return vkInvalidateMappedMemoryRanges(device_, 1, &range) == VK_SUCCESS;
+}
+
+bool ReadbackCapture::getEncodedFrame(std::vector<uint8_t>& frame_data, bool* end_of_frame,
+    uint64_t* frame_id)
+{
+    uint32_t index;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_.empty()) {
+            return false;
+        }
+        index = pending_.front();
+        pending_.pop();
+    }
+
+    Slot& slot = slots_[index];
+    bool copied = waitForCopy(slot);
+    auto captured = slot.captured;
+    uint64_t id = slot.frame_id;
+    auto ready = std::chrono::steady_clock::now();
+    if (copied) {
+        encoder_.encode(static_cast<const uint8_t*>(slot.mapped), slot.width, slot.height,
+            config_.format, bytes_per_pixel_, frame_data);
+    }
+    auto done = std::chrono::steady_clock::now();
+    releaseSlot(index);     // Not to be touched after this
+
+    if (copied) {
+        Tracer& tracer = Tracer::global();
+        tracer.span(id, TraceStage::CAPTURE, Tracer::time(captured), Tracer::time(ready));
+        tracer.span(id, TraceStage::ENCODE, Tracer::time(ready), Tracer::time(done));
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    if (!copied) {
+        stats_.frames_dropped++;
+        encoder_.forceKeyframe();
+        return false;
+    }
+    stats_.frames_encoded++;
+    stats_.total_bytes += frame_data.size();
+    smooth(stats_.average_copy_time, milliseconds(ready - captured));
+    smooth(stats_.average_encode_time, milliseconds(done - ready));
+    smooth(stats_.average_latency, milliseconds(done - captured));
+
+    fps_frames_++;
+    double elapsed = milliseconds(done - fps_since_);
+    if (elapsed >= 1000.0) {
+        stats_.average_fps = fps_frames_ * 1000.0 / elapsed;
+        fps_frames_ = 0;
+        fps_since_ = done;
+    }
+
+    if (end_of_frame) {
+        *end_of_frame = true;
+    }
+    if (frame_id) {
+        *frame_id = id;
+    }
+    return true;
+}
+
+void ReadbackCapture::flush() {
+    bool discarded = false;
+    while (true) {
+        uint32_t index;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (pending_.empty()) {
+                break;
+            }
+            index = pending_.front();
+            pending_.pop();
+        }
+        waitForCopy(slots_[index]);
+        releaseSlot(index);
+        discarded = true;
+    }
+    if (discarded) {
+        // The client never sees what was thrown away, so no delta against it
+        encoder_.forceKeyframe();
+    }
+}
+
+bool ReadbackCapture::setResolution(uint32_t width, uint32_t height) {
+    if (width == 0 || height == 0 || width > config_.width || height > config_.height) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    capture_width_ = width;
+    capture_height_ = height;
+    return true;
+}
+
+ReadbackCapture::Statistics ReadbackCapture::getStatistics() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+void ReadbackCapture::releaseSlot(uint32_t index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_slots_.push_back(index);
+}
+
+} // namespace gpu
+} // namespace anarchy
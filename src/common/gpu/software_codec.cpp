@@ -0,0 +1,154 @@
+#include "common/gpu/software_codec.hpp"
+#include <lz4.h>
+#include <cstring>
+
+namespace anarchy {
+namespace gpu {
+
+namespace {
+
+constexpr uint32_t MAX_DIMENSION = 16384;
+constexpr uint32_t MAX_BYTES_PER_PIXEL = 16;
+
+// dst = a ^ b, a word at a time; dst may be a or b
+void xorBytes(uint8_t* dst, const uint8_t* a, const uint8_t* b, size_t size) {
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t x;
+        uint64_t y;
+        std::memcpy(&x, a + i, sizeof(x));
+        std::memcpy(&y, b + i, sizeof(y));
+        x ^= y;
+        std::memcpy(dst + i, &x, sizeof(x));
+    }
+    for (; i < size; ++i) {
+        dst[i] = a[i] ^ b[i];
+    }
+}
+
+} // namespace
+
+SoftwareEncoder::SoftwareEncoder(bool compress, uint32_t keyframe_interval)
+    : compress_(compress)
+    , keyframe_interval_(keyframe_interval)
+{
+}
+
+void SoftwareEncoder::encode(const uint8_t* pixels, uint32_t width, uint32_t height,
+    uint32_t format, uint32_t bytes_per_pixel, std::vector<uint8_t>& frame)
+{
+    size_t raw_size = static_cast<size_t>(width) * height * bytes_per_pixel;
+    bool keyframe = !compress_ || force_keyframe_ ||
+        width != width_ || height != height_ || format != format_ ||
+        (keyframe_interval_ > 0 && since_keyframe_ >= keyframe_interval_);
+    force_keyframe_ = false;
+    since_keyframe_ = keyframe ? 1 : since_keyframe_ + 1;
+    width_ = width;
+    height_ = height;
+    format_ = format;
+
+    const uint8_t* payload = pixels;
+    if (compress_) {
+        if (!keyframe) {
+            residual_.resize(raw_size);
+            xorBytes(residual_.data(), pixels, previous_.data(), raw_size);
+            payload = residual_.data();
+        }
+        previous_.assign(pixels, pixels + raw_size);
+    }
+
+    SoftwareFrameHeader header = {};
+    header.magic = SOFTWARE_FRAME_MAGIC;
+    header.width = width;
+    header.height = height;
+    header.format = format;
+    header.raw_size = static_cast<uint32_t>(raw_size);
+    header.keyframe = keyframe ? 1 : 0;
+    header.compression = static_cast<uint8_t>(network::CompressionType::NONE);
+
+    // Noise comes out of LZ4 larger than it went in; it is stored as is
+    bool compressed = false;
+    if (compress_ && raw_size <= LZ4_MAX_INPUT_SIZE) {
+        int bound = LZ4_compressBound(static_cast<int>(raw_size));
+        frame.resize(sizeof(header) + bound);
+        int written = LZ4_compress_default(reinterpret_cast<const char*>(payload),
+            reinterpret_cast<char*>(frame.data() + sizeof(header)),
+            static_cast<int>(raw_size), bound);
+        if (written > 0 && static_cast<size_t>(written) < raw_size) {
+            frame.resize(sizeof(header) + written);
+            header.compression = static_cast<uint8_t>(network::CompressionType::LZ4);
+            compressed = true;
+        }
+    }
+    if (!compressed) {
+        frame.resize(sizeof(header) + raw_size);
+        std::memcpy(frame.data() + sizeof(header), payload, raw_size);
+    }
+    std::memcpy(frame.data(), &header, sizeof(header));
+}
+
+void SoftwareEncoder::forceKeyframe() {
+    force_keyframe_ = true;
+}
+
+bool SoftwareDecoder::decode(const uint8_t* data, size_t size) {
+    SoftwareFrameHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+
+    size_t pixels = static_cast<size_t>(header.width) * header.height;
+    if (header.magic != SOFTWARE_FRAME_MAGIC || pixels == 0 ||
+        header.width > MAX_DIMENSION || header.height > MAX_DIMENSION ||
+        header.raw_size % pixels != 0 || header.raw_size / pixels > MAX_BYTES_PER_PIXEL) {
+        return false;
+    }
+
+    bool delta = !header.keyframe;
+    if (delta && (!valid_ || header.width != width_ || header.height != height_ ||
+            header.format != format_)) {
+        valid_ = false;
+        return false;
+    }
+
+    // Keyframes land straight in the picture, deltas next to it
+    std::vector<uint8_t>& target = delta ? residual_ : pixels_;
+    target.resize(header.raw_size);
+    const uint8_t* body = data + sizeof(header);
+    size_t body_size = size - sizeof(header);
+
+    bool decoded = false;
+    switch (static_cast<network::CompressionType>(header.compression)) {
+        case network::CompressionType::NONE:
+            if (body_size == header.raw_size) {
+                std::memcpy(target.data(), body, body_size);
+                decoded = true;
+            }
+            break;
+        case network::CompressionType::LZ4:
+            decoded = body_size <= LZ4_MAX_INPUT_SIZE &&
+                LZ4_decompress_safe(reinterpret_cast<const char*>(body),
+                    reinterpret_cast<char*>(target.data()), static_cast<int>(body_size),
+                    static_cast<int>(header.raw_size)) == static_cast<int>(header.raw_size);
+            break;
+        default:
+            break;
+    }
+    if (!decoded) {
+        valid_ = false;
+        return false;
+    }
+
+    if (delta) {
+        xorBytes(pixels_.data(), pixels_.data(), residual_.data(), header.raw_size);
+    }
+    width_ = header.width;
+    height_ = header.height;
+    format_ = header.format;
+    valid_ = true;
+    return true;
+}
+
+} // namespace gpu
+} // namespace anarchy
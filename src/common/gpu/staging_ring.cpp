@@ -0,0 +1,76 @@
+#include "common/gpu/staging_ring.hpp"
+#include <algorithm>
+
+namespace anarchy {
+namespace gpu {
+
+StagingRing::StagingRing(uint64_t capacity, uint64_t alignment)
+    : capacity_(capacity / alignment * alignment)
+    , alignment_(alignment)
+{
+}
+
+bool StagingRing::allocate(uint64_t size, uint64_t& offset) {
+    size = std::max<uint64_t>((size + alignment_ - 1) & ~(alignment_ - 1), alignment_);
+    if (size > capacity_) {
+        return false;
+    }
+    if (regions_.empty()) {
+        head_ = 0;
+    } else {
+        uint64_t tail = regions_.front().offset;
+        if (head_ > tail) {
+            // Room at the end, or else at the start ahead of the oldest region
+            if (capacity_ - head_ < size) {
+                if (size > tail) {
+                    return false;
+                }
+                // The gap at the end goes with the last region, and is freed with it
+                regions_.back().size += capacity_ - head_;
+                head_ = 0;
+            }
+        } else if (tail - head_ < size) {
+            return false;
+        }
+    }
+
+    offset = head_;
+    regions_.push_back({head_, size});
+    head_ += size;
+    return true;
+}
+
+void StagingRing::release(uint64_t offset, uint64_t fence_value) {
+    auto it = std::find_if(regions_.begin(), regions_.end(),
+        [offset](const Region& region) { return region.offset == offset; });
+    if (it != regions_.end()) {
+        it->released = true;
+        it->fence_value = fence_value;
+    }
+}
+
+void StagingRing::reclaim(uint64_t completed_value) {
+    while (!regions_.empty() && regions_.front().released &&
+        regions_.front().fence_value <= completed_value) {
+        regions_.pop_front();
+    }
+}
+
+bool StagingRing::oldest(uint64_t& offset) const {
+    if (regions_.empty()) {
+        return false;
+    }
+    offset = regions_.front().offset;
+    return true;
+}
+
+uint64_t StagingRing::used() const {
+    uint64_t total = 0;
+    for (const Region& region : regions_) {
+        total += region.size;
+    }
+    return total;
+}
+
+} // namespace gpu
+} // namespace anarchy
@@ -2,6 +2,7 @@
 #include <stdexcept>
 #include <set>
 #include <algorithm>
+#include <cstring>
 
 namespace anarchy {
 namespace gpu {
@@ -90,8 +91,19 @@ VulkanUtils::Device::Device(const Instance& instance, const std::vector<const ch
         enabled_extensions_.data()
     );
 
+    // The extension alone doesn't turn timeline semaphores on
+    vk::PhysicalDeviceTimelineSemaphoreFeatures timeline_features(VK_TRUE);
+    bool timeline = std::any_of(enabled_extensions_.begin(), enabled_extensions_.end(),
+        [](const char* name) {
+            return std::strcmp(name, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0;
+        });
+    if (timeline) {
+        device_create_info.pNext = &timeline_features;
+    }
+
     device_ = physical_device_.createDeviceUnique(device_create_info);
     graphics_queue_ = device_->getQueue(graphics_queue_family, 0);
+    graphics_queue_family_ = graphics_queue_family;
     command_pool_ = createCommandPool(device_.get(), graphics_queue_family);
 }
 
@@ -134,88 +146,6 @@ void VulkanUtils::Device::submitCommandBuffer(vk::CommandBuffer cmd_buffer) {
     graphics_queue_.waitIdle();
 }
 
-std::vector<uint8_t> VulkanUtils::Device::captureFramebuffer(
-    vk::Image image, vk::Format format, uint32_t width, uint32_t height)
-{
-    // Create staging buffer
-    vk::DeviceSize image_size = width * height * 4;  // RGBA
-    auto staging_buffer = createBuffer(device_.get(), physical_device_,
-        image_size, vk::BufferUsageFlagBits::eTransferDst,
-        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-
-    // Create command buffer
-    auto cmd_buffer = beginCommandBuffer();
-
-    // Transition image layout
-    vk::ImageMemoryBarrier barrier(
-        vk::AccessFlagBits::eMemoryRead,
-        vk::AccessFlagBits::eTransferRead,
-        vk::ImageLayout::ePresentSrcKHR,
-        vk::ImageLayout::eTransferSrcOptimal,
-        VK_QUEUE_FAMILY_IGNORED,
-        VK_QUEUE_FAMILY_IGNORED,
-        image,
-        vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)
-    );
-
-    cmd_buffer.pipelineBarrier(
-        vk::PipelineStageFlagBits::eTransfer,
-        vk::PipelineStageFlagBits::eTransfer,
-        vk::DependencyFlags(),
-        0, nullptr,
-        0, nullptr,
-        1, &barrier
-    );
-
-    // Copy image to buffer
-    vk::BufferImageCopy region(
-        0, 0, 0,
-        vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
-        vk::Offset3D(0, 0, 0),
-        vk::Extent3D(width, height, 1)
-    );
-
-    cmd_buffer.copyImageToBuffer(
-        image, vk::ImageLayout::eTransferSrcOptimal,
-        staging_buffer.get(), region
-    );
-
-    // Transition image back
-    barrier.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
-    barrier.newLayout = vk::ImageLayout::ePresentSrcKHR;
-    barrier.srcAccessMask = vk::AccessFlagBits::eTransferRead;
-    barrier.dstAccessMask = vk::AccessFlagBits::eMemoryRead;
-
-    cmd_buffer.pipelineBarrier(
-        vk::PipelineStageFlagBits::eTransfer,
-        vk::PipelineStageFlagBits::eTransfer,
-        vk::DependencyFlags(),
-        0, nullptr,
-        0, nullptr,
-        1, &barrier
-    );
-
-    endCommandBuffer(cmd_buffer);
-    submitCommandBuffer(cmd_buffer);
-
-    // Map buffer and copy data
-    auto memory_reqs = device_->getBufferMemoryRequirements(staging_buffer.get());
-    auto device_memory = device_->allocateMemory(vk::MemoryAllocateInfo(memory_reqs.size,
-        findMemoryType(physical_device_, memory_reqs.memoryTypeBits,
-            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent)));
-    
-    device_->bindBufferMemory(staging_buffer.get(), device_memory, 0);
-    
-    void* mapped = device_->mapMemory(device_memory, 0, memory_reqs.size);
-    std::vector<uint8_t> pixels(static_cast<uint8_t*>(mapped),
-        static_cast<uint8_t*>(mapped) + image_size);
-    
-    device_->unmapMemory(device_memory);
-    device_->freeMemory(device_memory);
-    
-    return pixels;
-}
-
 // Swapchain implementation
 VulkanUtils::Swapchain::Swapchain(const Device& device, vk::SurfaceKHR surface,
     uint32_t width, uint32_t height)
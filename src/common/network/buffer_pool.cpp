@@ -0,0 +1,86 @@
+#include "common/network/buffer_pool.hpp"
+
+namespace anarchy {
+namespace network {
+
+BufferPool::BufferPool(size_t max_buffers)
+    : max_buffers_(max_buffers)
+{
+    buffers_.reserve(max_buffers_);
+}
+
+std::vector<uint8_t> BufferPool::acquire(size_t size) {
+    std::vector<uint8_t> buffer;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // Best fit, otherwise grow the largest one we have
+        size_t best = buffers_.size();
+        for (size_t i = 0; i < buffers_.size(); ++i) {
+            size_t capacity = buffers_[i].capacity();
+            if (capacity >= size &&
+                (best == buffers_.size() || capacity < buffers_[best].capacity())) {
+                best = i;
+            }
+        }
+        if (best == buffers_.size() && !buffers_.empty()) {
+            best = 0;
+            for (size_t i = 1; i < buffers_.size(); ++i) {
+                if (buffers_[i].capacity() > buffers_[best].capacity()) {
+                    best = i;
+                }
+            }
+        }
+
+        if (best < buffers_.size()) {
+            buffer = std::move(buffers_[best]);
+            buffers_[best] = std::move(buffers_.back());
+            buffers_.pop_back();
+        }
+    }
+
+    if (buffer.capacity() < size) {
+        // Reserve the whole size class so later, slightly larger payloads
+        // still fit
+        buffer.reserve(sizeClass(size));
+        allocations_++;
+    }
+
+    // Released buffers keep their size, so reusing one at or below that
+    // size doesn't zero-fill the payload again
+    buffer.resize(size);
+    return buffer;
+}
+
+void BufferPool::release(std::vector<uint8_t>&& buffer) {
+    if (buffer.capacity() == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (buffers_.size() < max_buffers_) {
+        buffers_.push_back(std::move(buffer));
+    }
+}
+
+size_t BufferPool::sizeClass(size_t size) {
+    if (size <= MIN_SIZE_CLASS) {
+        return MIN_SIZE_CLASS;
+    }
+
+    // Quarter steps between powers of two keep the slack under 25%
+    size_t power = MIN_SIZE_CLASS;
+    while (power <= size / 2) {
+        power *= 2;
+    }
+    size_t step = power / 4;
+    return (size + step - 1) / step * step;
+}
+
+size_t BufferPool::available() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return buffers_.size();
+}
+
+} // namespace network
+} // namespace anarchy
@@ -0,0 +1,88 @@
+#include "common/network/clock_sync.hpp"
+#include <chrono>
+#include <cstring>
+
+namespace anarchy {
+namespace network {
+
+uint64_t ClockSync::now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ClockSync::stamp(Message& heartbeat, uint64_t peer) {
+    HeartbeatTiming echo = {};
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = peers_.find(peer);
+        if (it != peers_.end()) {
+            echo = it->second.echo;
+        }
+    }
+
+    heartbeat.payload.resize(sizeof(echo));
+    std::memcpy(heartbeat.payload.data(), &echo, sizeof(echo));
+    heartbeat.header.size = sizeof(echo);
+    heartbeat.header.timestamp = now();
+}
+
+void ClockSync::onHeartbeat(const MessageHeader& header, const uint8_t* payload, size_t size,
+    uint64_t peer, uint64_t received)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Peer& state = peers_[peer];
+    state.echo.echo_timestamp = header.timestamp;
+    state.echo.echo_received = received;
+
+    // Older peers send heartbeats without the echo; so does everyone
+    // before hearing from the other side
+    HeartbeatTiming timing = {};
+    if (size < sizeof(timing)) {
+        return;
+    }
+    std::memcpy(&timing, payload, sizeof(timing));
+    if (timing.echo_timestamp == 0) {
+        return;
+    }
+
+    // Ours out, theirs in, theirs out, ours in
+    int64_t t0 = static_cast<int64_t>(timing.echo_timestamp);
+    int64_t t1 = static_cast<int64_t>(timing.echo_received);
+    int64_t t2 = static_cast<int64_t>(header.timestamp);
+    int64_t t3 = static_cast<int64_t>(received);
+    Estimate sample = {};
+    sample.round_trip = (t3 - t0) - (t2 - t1);
+    sample.offset = ((t1 - t0) + (t2 - t3)) / 2;
+    if (sample.round_trip < 0) {
+        return;     // Garbage, or an echo of a heartbeat from a previous connection
+    }
+
+    state.samples.push_back(sample);
+    if (state.samples.size() > WINDOW) {
+        state.samples.pop_front();
+    }
+}
+
+bool ClockSync::estimate(uint64_t peer, Estimate& estimate) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = peers_.find(peer);
+    if (it == peers_.end() || it->second.samples.empty()) {
+        return false;
+    }
+
+    estimate = it->second.samples.front();
+    for (const Estimate& sample : it->second.samples) {
+        if (sample.round_trip < estimate.round_trip) {
+            estimate = sample;
+        }
+    }
+    return true;
+}
+
+void ClockSync::forget(uint64_t peer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    peers_.erase(peer);
+}
+
+} // namespace network
+} // namespace anarchy
@@ -0,0 +1,292 @@
+#include "common/network/command_stream.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace anarchy {
+namespace network {
+
+namespace {
+
+std::atomic<uint64_t> next_stream_id{1};
+
+// Streams by id, so an exiting thread can tell which of the streams it
+// used still exist
+std::mutex live_streams_mutex;
+std::unordered_map<uint64_t, CommandStream*> live_streams;
+
+} // namespace
+
+struct CommandStream::ThreadExit {
+    std::vector<uint64_t> streams;
+
+    ~ThreadExit() {
+        std::lock_guard<std::mutex> lock(live_streams_mutex);
+        for (uint64_t id : streams) {
+            auto it = live_streams.find(id);
+            if (it != live_streams.end()) {
+                it->second->releaseThread(std::this_thread::get_id());
+            }
+        }
+    }
+};
+
+CommandStream::CommandStream(FlushCallback flush_callback, size_t buffer_size,
+    size_t flush_threshold)
+    : stream_id_(next_stream_id++)
+    , flush_callback_(std::move(flush_callback))
+    , buffer_size_(buffer_size)
+    , flush_threshold_(std::min(flush_threshold, buffer_size))
+{
+    std::lock_guard<std::mutex> lock(live_streams_mutex);
+    live_streams[stream_id_] = this;
+}
+
+CommandStream::~CommandStream() {
+    {
+        std::lock_guard<std::mutex> lock(live_streams_mutex);
+        live_streams.erase(stream_id_);
+    }
+    flush();
+}
+
+bool CommandStream::enqueue(MessageType type, uint64_t sequence,
+    const void* payload, size_t size)
+{
+    size_t record_size = commandRecordSize(size);
+    ThreadBuffer& buffer = localBuffer();
+
+    CommandRecordHeader header = {};
+    header.type = type;
+    header.size = static_cast<uint32_t>(size);
+    header.sequence = sequence;
+
+    // Oversized commands bypass the buffer and go out with everything pending
+    if (record_size > buffer_size_) {
+        std::vector<uint8_t> record(record_size, 0);
+        std::memcpy(record.data(), &header, sizeof(header));
+        if (size > 0) {
+            std::memcpy(record.data() + sizeof(header), payload, size);
+        }
+        commands_enqueued_++;
+        return flushAll(record.data(), record.size());
+    }
+
+    // Only this thread appends to its buffer, and flushes only ever empty
+    // it, so the room made here is still there below
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        full = buffer.used + record_size > buffer.data.size();
+    }
+    if (full && !flushAll()) {
+        return false;
+    }
+
+    bool reached;
+    {
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        uint8_t* dst = buffer.data.data() + buffer.used;
+        std::memcpy(dst, &header, sizeof(header));
+        if (size > 0) {
+            std::memcpy(dst + sizeof(header), payload, size);
+        }
+        std::memset(dst + sizeof(header) + size, 0, record_size - sizeof(header) - size);
+
+        buffer.used += record_size;
+        buffer.count++;
+        buffer.last_sequence = sequence;
+        reached = buffer.used >= flush_threshold_;
+    }
+    commands_enqueued_++;
+
+    if (reached) {
+        return flushAll();
+    }
+    return true;
+}
+
+bool CommandStream::flush() {
+    return flushAll();
+}
+
+void CommandStream::handleResult(const Message& message) {
+    if (message.payload.size() < sizeof(CommandBatchResult)) {
+        return;
+    }
+
+    CommandBatchResult result;
+    std::memcpy(&result, message.payload.data(), sizeof(result));
+
+    // Record completion as a high-water mark, batches may be answered out of order
+    uint64_t completed = completed_sequence_.load();
+    while (completed < result.last_sequence &&
+           !completed_sequence_.compare_exchange_weak(completed, result.last_sequence)) {
+    }
+
+    size_t available = (message.payload.size() - sizeof(result)) / sizeof(CommandFailure);
+    size_t count = std::min<size_t>(result.failure_count, available);
+    const uint8_t* entries = message.payload.data() + sizeof(result);
+
+    for (size_t i = 0; i < count; ++i) {
+        CommandFailure failure;
+        std::memcpy(&failure, entries + i * sizeof(CommandFailure), sizeof(failure));
+        deferred_failures_++;
+
+        // Keep the first failure until a sync point reports it
+        int32_t expected = 0;
+        deferred_error_.compare_exchange_strong(expected, failure.result);
+    }
+}
+
+int32_t CommandStream::takeDeferredError() {
+    return deferred_error_.exchange(0);
+}
+
+CommandStream::Statistics CommandStream::getStatistics() const {
+    Statistics stats;
+    stats.commands_enqueued = commands_enqueued_;
+    stats.batches_sent = batches_sent_;
+    stats.bytes_sent = bytes_sent_;
+    stats.deferred_failures = deferred_failures_;
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    stats.thread_buffers = buffers_.size();
+    return stats;
+}
+
+CommandStream::ThreadBuffer& CommandStream::localBuffer() {
+    // Cache the lookup per thread, keyed by stream id so a destroyed and
+    // re-created stream at the same address can't hand out a stale buffer
+    static thread_local uint64_t cached_stream_id = 0;
+    static thread_local ThreadBuffer* cached_buffer = nullptr;
+    static thread_local ThreadExit thread_exit;
+
+    if (cached_stream_id == stream_id_) {
+        return *cached_buffer;
+    }
+
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    auto& buffer = buffers_[std::this_thread::get_id()];
+    if (!buffer) {
+        buffer = std::make_unique<ThreadBuffer>();
+        buffer->data.resize(buffer_size_);
+        if (std::find(thread_exit.streams.begin(), thread_exit.streams.end(), stream_id_) ==
+            thread_exit.streams.end()) {
+            thread_exit.streams.push_back(stream_id_);
+        }
+    }
+
+    cached_stream_id = stream_id_;
+    cached_buffer = buffer.get();
+    return *buffer;
+}
+
+bool CommandStream::flushAll(const uint8_t* extra, size_t extra_size) {
+    std::lock_guard<std::mutex> registry_lock(registry_mutex_);
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(buffers_.size());
+    pending_.clear();
+
+    // Each buffer is in sequence order already; merging them keeps a
+    // command from overtaking one enqueued on another thread before it
+    size_t total = 0;
+    auto collect = [&](const uint8_t* data, size_t size) {
+        return forEachCommandRecord(data, size,
+            [&](const CommandRecordHeader& header, const uint8_t* payload) {
+                const uint8_t* record = payload - sizeof(header);
+                size_t record_size = commandRecordSize(header.size);
+                pending_.push_back({header.sequence, record, record_size});
+                total += record_size;
+                return true;
+            });
+    };
+    for (auto& entry : buffers_) {
+        ThreadBuffer& buffer = *entry.second;
+        locks.emplace_back(buffer.mutex);
+        collect(buffer.data.data(), buffer.used);
+    }
+    if (extra) {
+        collect(extra, extra_size);
+    }
+    if (pending_.empty()) {
+        return true;
+    }
+
+    std::stable_sort(pending_.begin(), pending_.end(),
+        [](const PendingRecord& a, const PendingRecord& b) { return a.sequence < b.sequence; });
+    merged_.resize(total);
+    size_t offset = 0;
+    for (const PendingRecord& record : pending_) {
+        std::memcpy(merged_.data() + offset, record.data, record.size);
+        offset += record.size;
+    }
+
+    // Copied out; a failed send drops them like any lost batch
+    for (auto& entry : buffers_) {
+        entry.second->used = 0;
+        entry.second->count = 0;
+    }
+    return sendBatch(merged_.data(), merged_.size(), pending_.back().sequence);
+}
+
+void CommandStream::releaseThread(std::thread::id thread) {
+    flushAll();
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    buffers_.erase(thread);
+}
+
+bool CommandStream::sendBatch(const uint8_t* data, size_t size, uint64_t last_sequence) {
+    Message batch;
+    batch.header.type = MessageType::VK_COMMAND_BATCH;
+    batch.header.size = static_cast<uint32_t>(size);
+    batch.header.sequence = last_sequence;
+    batch.header.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    batch.payload.assign(data, data + size);
+
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (!flush_callback_ || !flush_callback_(batch)) {
+        return false;
+    }
+
+    uint64_t submitted = submitted_sequence_.load();
+    while (submitted < last_sequence &&
+           !submitted_sequence_.compare_exchange_weak(submitted, last_sequence)) {
+    }
+
+    batches_sent_++;
+    bytes_sent_ += size;
+    return true;
+}
+
+bool forEachCommandRecord(const Message& batch, const CommandRecordVisitor& visitor) {
+    return forEachCommandRecord(batch.payload.data(), batch.payload.size(), visitor);
+}
+
+bool forEachCommandRecord(const uint8_t* data, size_t size, const CommandRecordVisitor& visitor) {
+    size_t offset = 0;
+
+    while (offset < size) {
+        if (size - offset < sizeof(CommandRecordHeader)) {
+            return false;
+        }
+
+        CommandRecordHeader header;
+        std::memcpy(&header, data + offset, sizeof(header));
+
+        size_t record_size = commandRecordSize(header.size);
+        if (record_size > size - offset) {
+            return false;
+        }
+
+        if (!visitor(header, data + offset + sizeof(header))) {
+            return false;
+        }
+        offset += record_size;
+    }
+
+    return true;
+}
+
+} // namespace network
+} // namespace anarchy
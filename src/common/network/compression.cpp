@@ -0,0 +1,168 @@
+#include "common/network/compression.hpp"
+#include <lz4.h>
+#include <zlib.h>
+
+// Define LZ4 acceleration constants if not defined
+#ifndef LZ4_ACCELERATION_DEFAULT
+#define LZ4_ACCELERATION_DEFAULT 1
+#endif
+
+#ifndef LZ4_ACCELERATION_MAX
+#define LZ4_ACCELERATION_MAX 65537
+#endif
+
+namespace anarchy {
+namespace network {
+
+namespace {
+
+struct CompressionContext {
+    z_stream deflate_stream{};
+    int deflate_level{0};
+    bool deflate_ready{false};
+    z_stream inflate_stream{};
+    bool inflate_ready{false};
+    LZ4_stream_t lz4_state{};
+
+    ~CompressionContext() {
+        if (deflate_ready) {
+            deflateEnd(&deflate_stream);
+        }
+        if (inflate_ready) {
+            inflateEnd(&inflate_stream);
+        }
+    }
+};
+
+CompressionContext& compressionContext() {
+    thread_local CompressionContext context;
+    return context;
+}
+
+} // namespace
+
+size_t compressBound(CompressionType type, size_t size) {
+    if (type == CompressionType::LZ4) {
+        return static_cast<size_t>(LZ4_compressBound(static_cast<int>(size)));
+    }
+    return ::compressBound(static_cast<uLong>(size));
+}
+
+size_t compressData(CompressionType type, CompressionLevel level, const uint8_t* input,
+    size_t input_size, uint8_t* output, size_t output_size, bool* stream_initialized)
+{
+    CompressionContext& context = compressionContext();
+
+    if (type == CompressionType::LZ4) {
+        int acceleration;
+        switch (level) {
+            case CompressionLevel::FAST:
+                acceleration = LZ4_ACCELERATION_MAX;
+                break;
+            case CompressionLevel::MAX:
+                acceleration = 1;  // Best compression
+                break;
+            default:
+                acceleration = LZ4_ACCELERATION_DEFAULT;
+                break;
+        }
+
+        // extState reuses the thread's LZ4 state instead of allocating one
+        int result = LZ4_compress_fast_extState(&context.lz4_state,
+                               reinterpret_cast<const char*>(input),
+                               reinterpret_cast<char*>(output),
+                               static_cast<int>(input_size),
+                               static_cast<int>(output_size),
+                               acceleration);
+        return result > 0 ? static_cast<size_t>(result) : 0;
+    }
+
+    int zlib_level;
+    switch (level) {
+        case CompressionLevel::FAST:
+            zlib_level = Z_BEST_SPEED;
+            break;
+        case CompressionLevel::MAX:
+            zlib_level = Z_BEST_COMPRESSION;
+            break;
+        default:
+            zlib_level = Z_DEFAULT_COMPRESSION;
+            break;
+    }
+
+    // The stream is set up once per thread and level, then only reset
+    z_stream& stream = context.deflate_stream;
+    if (!context.deflate_ready || context.deflate_level != zlib_level) {
+        if (context.deflate_ready) {
+            deflateEnd(&stream);
+            context.deflate_ready = false;
+        }
+        stream.zalloc = Z_NULL;
+        stream.zfree = Z_NULL;
+        stream.opaque = Z_NULL;
+        if (deflateInit(&stream, zlib_level) != Z_OK) {
+            return 0;
+        }
+        context.deflate_ready = true;
+        context.deflate_level = zlib_level;
+        if (stream_initialized) {
+            *stream_initialized = true;
+        }
+    } else if (deflateReset(&stream) != Z_OK) {
+        return 0;
+    }
+
+    stream.next_in = const_cast<uint8_t*>(input);
+    stream.avail_in = static_cast<uInt>(input_size);
+    stream.next_out = output;
+    stream.avail_out = static_cast<uInt>(output_size);
+
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+        return 0;
+    }
+    return output_size - stream.avail_out;
+}
+
+size_t decompressData(CompressionType type, const uint8_t* input, size_t input_size,
+    uint8_t* output, size_t output_size, bool* stream_initialized)
+{
+    if (type == CompressionType::LZ4) {
+        int result = LZ4_decompress_safe(reinterpret_cast<const char*>(input),
+                                 reinterpret_cast<char*>(output),
+                                 static_cast<int>(input_size),
+                                 static_cast<int>(output_size));
+        return result > 0 ? static_cast<size_t>(result) : 0;
+    }
+
+    CompressionContext& context = compressionContext();
+    z_stream& stream = context.inflate_stream;
+    if (!context.inflate_ready) {
+        stream.zalloc = Z_NULL;
+        stream.zfree = Z_NULL;
+        stream.opaque = Z_NULL;
+        stream.avail_in = 0;
+        stream.next_in = Z_NULL;
+        if (inflateInit(&stream) != Z_OK) {
+            return 0;
+        }
+        context.inflate_ready = true;
+        if (stream_initialized) {
+            *stream_initialized = true;
+        }
+    } else if (inflateReset(&stream) != Z_OK) {
+        return 0;
+    }
+
+    stream.next_in = const_cast<uint8_t*>(input);
+    stream.avail_in = static_cast<uInt>(input_size);
+    stream.next_out = output;
+    stream.avail_out = static_cast<uInt>(output_size);
+
+    if (inflate(&stream, Z_FINISH) != Z_STREAM_END) {
+        return 0;
+    }
+    return output_size - stream.avail_out;
+}
+
+} // namespace network
+} // namespace anarchy
@@ -0,0 +1,137 @@
+#include "common/network/compression_policy.hpp"
+#include <algorithm>
+
+namespace anarchy {
+namespace network {
+
+namespace {
+
+double perSecond(size_t bytes, std::chrono::microseconds elapsed) {
+    // Sub-microsecond work still counts as a microsecond
+    double seconds = static_cast<double>(std::max<int64_t>(elapsed.count(), 1)) / 1e6;
+    return static_cast<double>(bytes) / seconds;
+}
+
+} // namespace
+
+void EwmaEstimate::add(double sample) {
+    if (!valid_.load(std::memory_order_relaxed)) {
+        value_.store(sample, std::memory_order_relaxed);
+        valid_.store(true, std::memory_order_relaxed);
+        return;
+    }
+    double current = value_.load(std::memory_order_relaxed);
+    value_.store(current + WEIGHT * (sample - current), std::memory_order_relaxed);
+}
+
+CompressionPolicy::CompressionPolicy() {
+    for (size_t i = 0; i < TYPE_COUNT; ++i) {
+        rules_[i].store(pack({CompressionType::LZ4, MIN_COMMAND_SIZE}), std::memory_order_relaxed);
+        skipped_[i].store(0, std::memory_order_relaxed);
+    }
+
+    // Small and latency bound, or carrying nothing worth compressing
+    for (MessageType type : {MessageType::CONNECT, MessageType::DISCONNECT,
+             MessageType::HEARTBEAT, MessageType::FRAME_ACK, MessageType::FRAME_REQUEST,
+             MessageType::VK_COMMAND_RESULT, MessageType::ERROR, MessageType::RESET}) {
+        setRule(type, {CompressionType::NONE, 0});
+    }
+
+    // Already H.264/HEVC, another pass only costs time
+    setRule(MessageType::FRAME_DATA, {CompressionType::NONE, 0});
+
+    // Buffer and image contents: bulky and often sparse, LZ4 keeps up with the
+    // link. They go as VK_WRITE_MEMORY records inside command batches.
+    setRule(MessageType::VK_COMMAND_BATCH, {CompressionType::LZ4, MIN_UPLOAD_SIZE});
+    setRule(MessageType::VK_WRITE_MEMORY, {CompressionType::LZ4, MIN_UPLOAD_SIZE});
+}
+
+void CompressionPolicy::setRule(MessageType type, CompressionRule rule) {
+    rules_[static_cast<uint8_t>(type)].store(pack(rule), std::memory_order_relaxed);
+}
+
+CompressionRule CompressionPolicy::rule(MessageType type) const {
+    return unpack(rules_[static_cast<uint8_t>(type)].load(std::memory_order_relaxed));
+}
+
+void CompressionPolicy::setCodecOverride(CompressionType codec) {
+    codec_override_ = codec;
+}
+
+void CompressionPolicy::setAdaptive(bool enable) {
+    adaptive_ = enable;
+}
+
+CompressionType CompressionPolicy::select(MessageType type, size_t size) {
+    CompressionRule type_rule = rule(type);
+    if (type_rule.codec == CompressionType::NONE || size < type_rule.min_size) {
+        return CompressionType::NONE;
+    }
+
+    CompressionType override_codec = codec_override_;
+    CompressionType codec = override_codec != CompressionType::NONE ? override_codec :
+        type_rule.codec;
+    if (!adaptive_) {
+        return codec;
+    }
+
+    // Until there is something to go on, compress and measure
+    size_t index = static_cast<uint8_t>(type);
+    const EwmaEstimate& ratio = ratios_[index];
+    const EwmaEstimate& throughput = codec_throughput_[static_cast<size_t>(codec)];
+    if (!bandwidth_.valid() || !ratio.valid() || !throughput.valid()) {
+        return codec;
+    }
+
+    if (throughput.value() * (1.0 - ratio.value()) > bandwidth_.value()) {
+        return codec;
+    }
+
+    // Not worth it at the moment, but compress now and then so the ratio
+    // follows the data
+    if (skipped_[index].fetch_add(1, std::memory_order_relaxed) + 1 >= PROBE_INTERVAL) {
+        skipped_[index].store(0, std::memory_order_relaxed);
+        return codec;
+    }
+    return CompressionType::NONE;
+}
+
+void CompressionPolicy::recordTransfer(size_t bytes, std::chrono::microseconds elapsed) {
+    if (bytes < MIN_BANDWIDTH_SAMPLE) {
+        return;
+    }
+    bandwidth_.add(perSecond(bytes, elapsed));
+}
+
+void CompressionPolicy::recordCompression(MessageType type, CompressionType codec,
+    size_t before, size_t after, std::chrono::microseconds elapsed)
+{
+    if (before == 0 || codec == CompressionType::NONE) {
+        return;
+    }
+    ratios_[static_cast<uint8_t>(type)].add(
+        std::min(1.0, static_cast<double>(after) / static_cast<double>(before)));
+    codec_throughput_[static_cast<size_t>(codec)].add(perSecond(before, elapsed));
+}
+
+double CompressionPolicy::codecThroughput(CompressionType codec) const {
+    return codec_throughput_[static_cast<size_t>(codec)].value();
+}
+
+double CompressionPolicy::compressionRatio(MessageType type) const {
+    return ratios_[static_cast<uint8_t>(type)].value();
+}
+
+uint64_t CompressionPolicy::pack(CompressionRule rule) {
+    return (static_cast<uint64_t>(rule.min_size) << 8) | static_cast<uint8_t>(rule.codec);
+}
+
+CompressionRule CompressionPolicy::unpack(uint64_t packed) {
+    CompressionRule rule;
+    rule.codec = static_cast<CompressionType>(packed & 0xFF);
+    rule.min_size = static_cast<uint32_t>(packed >> 8);
+    return rule;
+}
+
+} // namespace network
+} // namespace anarchy
@@ -0,0 +1,248 @@
+#include "common/network/rate_controller.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace anarchy {
+namespace network {
+
+namespace {
+
+double milliseconds(RateController::Clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// NV12 and P010 need even dimensions
+uint32_t scaleDimension(uint32_t full, double scale) {
+    uint32_t scaled = static_cast<uint32_t>(std::lround(full * scale)) & ~1u;
+    return std::max(scaled, 2u);
+}
+
+} // namespace
+
+RateController::RateController(const RateControlConfig& config)
+    : config_(config)
+    , target_bitrate_(std::clamp(config.start_bitrate, config.min_bitrate, config.max_bitrate))
+    , bitrate_(static_cast<uint32_t>(target_bitrate_))
+    , width_(config.width)
+    , height_(config.height)
+{
+}
+
+void RateController::onFrameSent(uint64_t sequence, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    in_flight_.push_back({sequence, now});
+    if (in_flight_.size() > MAX_IN_FLIGHT) {
+        in_flight_.pop_front();
+    }
+}
+
+void RateController::onFrameAck(uint64_t sequence, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!in_flight_.empty() && in_flight_.front().sequence < sequence) {
+        in_flight_.pop_front();
+    }
+    if (in_flight_.empty() || in_flight_.front().sequence != sequence) {
+        return;  // Already acked, or never tracked
+    }
+
+    double rtt = milliseconds(now - in_flight_.front().sent);
+    in_flight_.pop_front();
+    rtt_.add(rtt);
+    last_rtt_ = rtt;
+
+    // The floor has to be refreshed now and then, or a route change that
+    // lengthens the path would read as permanent congestion
+    if (base_rtt_time_ == Clock::time_point{} || rtt <= base_rtt_ ||
+        now - base_rtt_time_ > BASE_RTT_WINDOW) {
+        base_rtt_ = rtt;
+        base_rtt_time_ = now;
+    }
+}
+
+void RateController::onBandwidthEstimate(double bytes_per_second) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bandwidth_ = bytes_per_second;
+}
+
+RateController::Decision RateController::update(Clock::time_point now) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    double rtt = rtt_.valid() ? rtt_.value() : 0.0;
+    double queue_delay = rtt_.valid() ? std::max(last_rtt_ - base_rtt_, 0.0) : 0.0;
+
+    // A frame held up behind a full queue delays its ack without adding a
+    // round trip sample yet; waiting for it to show up in the average
+    // would cost several frames
+    bool acks_missing = false;
+    if (rtt_.valid() && !in_flight_.empty()) {
+        double waited = milliseconds(now - in_flight_.front().sent) - base_rtt_;
+        acks_missing = waited > 2.0 * delayThresholdMs();
+    }
+
+    Decision decision = {};
+    decision.time = now;
+    decision.reason = Reason::HOLD;
+    decision.bitrate_changed = adjustBitrate(now, queue_delay, acks_missing, decision.reason);
+    decision.resolution_changed = adjustScale(now, decision.reason);
+    decision.bitrate = bitrate_;
+    decision.width = width_;
+    decision.height = height_;
+    decision.rtt_ms = rtt;
+    decision.queue_delay_ms = queue_delay;
+    decision.bandwidth = bandwidth_;
+    decision.frames_in_flight = in_flight_.size();
+    last_update_ = now;
+
+    if (decision.bitrate_changed || decision.resolution_changed) {
+        DecisionCallback callback = callback_;
+        lock.unlock();
+        if (callback) {
+            callback(decision);
+        }
+    }
+    return decision;
+}
+
+void RateController::setDecisionCallback(DecisionCallback callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    callback_ = std::move(callback);
+}
+
+uint32_t RateController::bitrate() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bitrate_;
+}
+
+uint32_t RateController::width() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return width_;
+}
+
+uint32_t RateController::height() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return height_;
+}
+
+const char* RateController::reasonName(Reason reason) {
+    switch (reason) {
+        case Reason::HOLD:
+            return "hold";
+        case Reason::QUEUE_DELAY:
+            return "queue delay";
+        case Reason::ACKS_MISSING:
+            return "acks missing";
+        case Reason::BANDWIDTH_LIMIT:
+            return "bandwidth limit";
+        case Reason::PROBE:
+            return "probe";
+        case Reason::DOWNSCALE:
+            return "downscale";
+        case Reason::UPSCALE:
+            return "upscale";
+    }
+    return "unknown";
+}
+
+double RateController::delayThresholdMs() const {
+    // Up to a frame of queueing is jitter, not congestion
+    double frame_interval = config_.fps > 0 ? 1000.0 / config_.fps : 0.0;
+    return std::max(frame_interval, milliseconds(MIN_DELAY_THRESHOLD));
+}
+
+double RateController::bitsPerPixel(double scale) const {
+    double pixels = config_.width * scale * config_.height * scale;
+    return pixels > 0.0 && config_.fps > 0 ? bitrate_ / (pixels * config_.fps) : 0.0;
+}
+
+bool RateController::adjustBitrate(Clock::time_point now, double queue_delay, bool acks_missing,
+    Reason& reason)
+{
+    double threshold = delayThresholdMs();
+    bool overuse = queue_delay > threshold || acks_missing;
+    overuse_frames_ = overuse ? overuse_frames_ + 1 : 0;
+
+    if (overuse_frames_ >= OVERUSE_FRAMES) {
+        // One cut per round trip: the last one hasn't reached the acks yet
+        bool settled = last_decrease_ == Clock::time_point{} ||
+            milliseconds(now - last_decrease_) >= std::max(rtt_.value(), threshold);
+        if (settled) {
+            target_bitrate_ = std::min<double>(target_bitrate_, bitrate_) * DECREASE_FACTOR;
+            last_decrease_ = now;
+            reason = acks_missing ? Reason::ACKS_MISSING : Reason::QUEUE_DELAY;
+        }
+    } else if (!overuse && queue_delay < threshold / 2 && last_update_ != Clock::time_point{}) {
+        double elapsed = std::min(milliseconds(now - last_update_), 100.0) / 1000.0;
+        target_bitrate_ *= 1.0 + INCREASE_PER_SECOND * elapsed;
+    }
+
+    double limit = config_.max_bitrate;
+    if (bandwidth_ > 0.0) {
+        limit = std::min(limit, bandwidth_ * 8.0 * BANDWIDTH_HEADROOM);
+    }
+    if (target_bitrate_ > limit) {
+        target_bitrate_ = limit;
+        if (bitrate_ > limit && reason == Reason::HOLD) {
+            reason = Reason::BANDWIDTH_LIMIT;
+        }
+    }
+    target_bitrate_ = std::max<double>(target_bitrate_, config_.min_bitrate);
+
+    // Cuts go through at once, growth only in steps worth a reconfigure
+    uint32_t target = static_cast<uint32_t>(target_bitrate_);
+    bool changed = target < bitrate_ ||
+        target >= bitrate_ * (1.0 + PROBE_STEP) ||
+        (target > bitrate_ && target == static_cast<uint32_t>(limit));
+    if (!changed) {
+        return false;
+    }
+    if (reason == Reason::HOLD) {
+        reason = target > bitrate_ ? Reason::PROBE : Reason::BANDWIDTH_LIMIT;
+    }
+    bitrate_ = target;
+    return true;
+}
+
+bool RateController::adjustScale(Clock::time_point now, Reason& reason) {
+    double previous = scale_;
+
+    // Starved at this size for a while: step down
+    if (bitsPerPixel(scale_) < config_.min_bits_per_pixel && scale_ > config_.min_scale) {
+        if (!starved_) {
+            starved_ = true;
+            starved_since_ = now;
+        } else if (now - starved_since_ >= DOWNSCALE_AFTER) {
+            scale_ = std::max(scale_ * SCALE_STEP, config_.min_scale);
+            starved_ = false;
+            reason = Reason::DOWNSCALE;
+        }
+    } else {
+        starved_ = false;
+    }
+
+    // Twice the minimum at the next size up, for longer, to come back:
+    // otherwise it would flip between the two
+    double larger = std::min(scale_ / SCALE_STEP, 1.0);
+    if (scale_ == previous && scale_ < 1.0 &&
+        bitsPerPixel(larger) >= 2.0 * config_.min_bits_per_pixel) {
+        if (!recovered_) {
+            recovered_ = true;
+            recovered_since_ = now;
+        } else if (now - recovered_since_ >= UPSCALE_AFTER) {
+            scale_ = larger;
+            recovered_ = false;
+            reason = Reason::UPSCALE;
+        }
+    } else {
+        recovered_ = false;
+    }
+
+    if (scale_ == previous) {
+        return false;
+    }
+    width_ = scale_ >= 1.0 ? config_.width : scaleDimension(config_.width, scale_);
+    height_ = scale_ >= 1.0 ? config_.height : scaleDimension(config_.height, scale_);
+    return true;
+}
+
+} // namespace network
+} // namespace anarchy
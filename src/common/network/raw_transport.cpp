@@ -0,0 +1,842 @@
+#include "common/network/raw_transport.hpp"
+
+#ifdef __linux__
+
+#include <stdexcept>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <random>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+
+// Older kernel headers lack the zerocopy and busy poll definitions
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+namespace anarchy {
+namespace network {
+
+namespace {
+
+// "*" or an empty host binds every interface
+addrinfo* resolve(const std::string& host, int port, bool passive) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+    const char* node = host.empty() || host == "*" ? nullptr : host.c_str();
+    std::string service = std::to_string(port);
+    addrinfo* result = nullptr;
+    if (getaddrinfo(node, service.c_str(), &hints, &result) != 0) {
+        return nullptr;
+    }
+    return result;
+}
+
+bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Adds data to an iovec list, skipping the first skip bytes of what's added
+void appendIov(iovec* iov, size_t& count, const void* data, size_t size, size_t& skip) {
+    if (skip >= size) {
+        skip -= size;
+        return;
+    }
+    iov[count].iov_base = const_cast<uint8_t*>(static_cast<const uint8_t*>(data) + skip);
+    iov[count].iov_len = size - skip;
+    count++;
+    skip = 0;
+}
+
+} // namespace
+
+RawTransport::RawTransport(const std::string& endpoint, Role role)
+    : role_(role)
+{
+    listen_fds_.fill(-1);
+
+    const std::string scheme = "raw://";
+    std::string address = endpoint.compare(0, scheme.size(), scheme) == 0 ?
+        endpoint.substr(scheme.size()) : endpoint;
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        throw std::runtime_error("Invalid raw endpoint: " + endpoint);
+    }
+    host_ = address.substr(0, colon);
+    try {
+        port_ = std::stoi(address.substr(colon + 1));
+    } catch (const std::exception&) {
+        throw std::runtime_error("Invalid raw endpoint: " + endpoint);
+    }
+    if (port_ <= 0 || port_ + static_cast<int>(CHANNEL_COUNT) - 1 > 65535) {
+        throw std::runtime_error("Invalid raw endpoint port: " + endpoint);
+    }
+
+    std::random_device random;
+    client_id_ = (static_cast<uint64_t>(random()) << 32) | random();
+}
+
+RawTransport::~RawTransport() {
+    stop();
+}
+
+bool RawTransport::start() {
+    if (worker_thread_.joinable()) {
+        return true;
+    }
+
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0) {
+        handleError("Failed to create wake eventfd: " + std::string(strerror(errno)));
+        return false;
+    }
+
+    bool opened = role_ == Role::SERVER ? openListeners() : openConnections();
+    if (!opened) {
+        closeAll();
+        return false;
+    }
+
+    should_stop_ = false;
+    connected_ = true;
+    last_heartbeat_ = std::chrono::steady_clock::now();
+    worker_thread_ = std::thread(&RawTransport::workerThread, this);
+    return true;
+}
+
+void RawTransport::stop() {
+    should_stop_ = true;
+    wake();
+    if (worker_thread_.joinable()) {
+        worker_thread_.join();
+    }
+    connected_ = false;
+    closeAll();
+
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    send_queue_.clear();
+}
+
+void RawTransport::closeAll() {
+    for (auto& connection : connections_) {
+        if (connection->fd >= 0) {
+            close(connection->fd);
+        }
+    }
+    connections_.clear();
+    peer_connections_.clear();
+
+    for (int& fd : listen_fds_) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (wake_fd_ >= 0) {
+        close(wake_fd_);
+        wake_fd_ = -1;
+    }
+}
+
+bool RawTransport::openListeners() {
+    for (size_t i = 0; i < CHANNEL_COUNT; ++i) {
+        int port = port_ + static_cast<int>(i);
+        addrinfo* info = resolve(host_, port, true);
+        if (!info) {
+            handleError("Failed to resolve " + host_);
+            return false;
+        }
+
+        int fd = socket(info->ai_family, info->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            info->ai_protocol);
+        int one = 1;
+        bool listening = fd >= 0 &&
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0 &&
+            bind(fd, info->ai_addr, info->ai_addrlen) == 0 &&
+            listen(fd, SOMAXCONN) == 0;
+        int error = errno;
+        freeaddrinfo(info);
+
+        if (fd >= 0) {
+            // Accepted sockets inherit the buffer sizes, which have to be in
+            // place before the handshake to get a large window
+            configureSocket(fd);
+            listen_fds_[i] = fd;
+        }
+        if (!listening) {
+            handleError("Failed to listen on port " + std::to_string(port) + ": " +
+                std::string(strerror(error)));
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RawTransport::openConnections() {
+    for (size_t i = 0; i < CHANNEL_COUNT; ++i) {
+        int port = port_ + static_cast<int>(i);
+        addrinfo* info = resolve(host_, port, false);
+
+        int fd = -1;
+        bool zerocopy = false;
+        for (addrinfo* entry = info; entry && fd < 0; entry = entry->ai_next) {
+            fd = socket(entry->ai_family, entry->ai_socktype | SOCK_CLOEXEC, entry->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+            zerocopy = configureSocket(fd);
+            if (connect(fd, entry->ai_addr, entry->ai_addrlen) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        if (info) {
+            freeaddrinfo(info);
+        }
+        if (fd < 0) {
+            handleError("Failed to connect to " + host_ + ":" + std::to_string(port));
+            return false;
+        }
+
+        // Still blocking here, so the id can't go out halfway
+        bool identified = send(fd, &client_id_, sizeof(client_id_), MSG_NOSIGNAL) ==
+            static_cast<ssize_t>(sizeof(client_id_));
+        if (!identified || !setNonBlocking(fd)) {
+            close(fd);
+            handleError("Failed to open connection to " + host_ + ":" + std::to_string(port));
+            return false;
+        }
+
+        auto connection = std::make_unique<Connection>();
+        connection->fd = fd;
+        connection->channel = static_cast<Channel>(i);
+        connection->identified = true;
+        connection->zerocopy = zerocopy;
+        connection->rx.resize(RECEIVE_BUFFER_SIZE);
+        peer_connections_[0][i] = connection.get();
+        connections_.push_back(std::move(connection));
+    }
+    return true;
+}
+
+bool RawTransport::configureSocket(int fd) {
+    int one = 1;
+    int buffer_size = SOCKET_BUFFER_SIZE;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // Capped by net.core.wmem_max / rmem_max
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+    if (busy_poll_) {
+        int usec = BUSY_POLL_USEC;
+        setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+    }
+    return setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+}
+
+bool RawTransport::sendMessage(const Message& message) {
+    Outgoing outgoing;
+    outgoing.frame.header = message.header;
+    outgoing.frame.payload_size = message.payload.size();
+    if (!message.payload.empty()) {
+        outgoing.payload = buffer_pool_->acquire(message.payload.size());
+        std::memcpy(outgoing.payload.data(), message.payload.data(), message.payload.size());
+    }
+    outgoing.peer = message.peer;
+    return queue(std::move(outgoing));
+}
+
+bool RawTransport::sendMessage(Message&& message) {
+    Outgoing outgoing;
+    outgoing.frame.header = message.header;
+    outgoing.frame.payload_size = message.payload.size();
+    outgoing.payload = std::move(message.payload);
+    outgoing.peer = message.peer;
+    return queue(std::move(outgoing));
+}
+
+bool RawTransport::queue(Outgoing&& outgoing) {
+    if (!connected_) {
+        handleError("Cannot send message: not connected");
+        return false;
+    }
+
+    if (outgoing.frame.payload_size > MAX_MESSAGE_SIZE) {
+        handleError("Message size exceeds limit");
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        send_queue_.push_back(std::move(outgoing));
+    }
+    wake();
+    return true;
+}
+
+void RawTransport::wake() {
+    if (wake_fd_ < 0) {
+        return;
+    }
+    uint64_t count = 1;
+    ssize_t written = write(wake_fd_, &count, sizeof(count));
+    (void)written;  // A full counter still wakes the worker
+}
+
+void RawTransport::routeQueued() {
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        std::swap(send_queue_, send_batch_);
+    }
+
+    for (Outgoing& outgoing : send_batch_) {
+        Channel channel = channelForMessage(outgoing.frame.header.type);
+        uint64_t peer = 0;
+        if (role_ == Role::SERVER) {
+            peer = outgoing.peer != 0 ? outgoing.peer : last_peer_.load();
+        }
+
+        auto it = peer_connections_.find(peer);
+        Connection* connection = it != peer_connections_.end() ?
+            it->second[static_cast<size_t>(channel)] : nullptr;
+        if (!connection) {
+            handleError(role_ == Role::SERVER ? "Cannot send message: unknown peer" :
+                "Cannot send message: not connected");
+            buffer_pool_->release(std::move(outgoing.payload));
+            continue;
+        }
+
+        // Only a frame's first slice makes room, the rest follow it
+        if (channel == Channel::FRAME) {
+            if (!connection->frame_open) {
+                dropStaleFrames(*connection);
+            }
+            connection->frame_open = isPartialFrame(outgoing.frame.header);
+        }
+        connection->send_queue.push_back(std::move(outgoing));
+    }
+    send_batch_.clear();
+}
+
+void RawTransport::dropStaleFrames(Connection& connection) {
+    // Make room for the frame about to be queued, dropping whole frames
+    // only. One with any slice on the wire has to finish.
+    auto droppable = [&connection](const Outgoing& entry) {
+        return !entry.dropped && !(connection.frame_written &&
+            entry.frame.header.sequence == connection.written_frame);
+    };
+    size_t first = connection.unsent + (connection.write_offset > 0 ? 1 : 0);
+    size_t waiting = 0;
+    uint64_t previous = 0;
+    for (size_t i = first; i < connection.send_queue.size(); ++i) {
+        const Outgoing& entry = connection.send_queue[i];
+        if (droppable(entry) && (waiting == 0 || entry.frame.header.sequence != previous)) {
+            waiting++;
+            previous = entry.frame.header.sequence;
+        }
+    }
+
+    for (size_t i = first; i < connection.send_queue.size() && waiting >= FRAME_SEND_QUEUE; ) {
+        if (!droppable(connection.send_queue[i])) {
+            ++i;
+            continue;
+        }
+        uint64_t sequence = connection.send_queue[i].frame.header.sequence;
+        for (; i < connection.send_queue.size() &&
+               connection.send_queue[i].frame.header.sequence == sequence; ++i) {
+            Outgoing& entry = connection.send_queue[i];
+            entry.dropped = true;
+            buffer_pool_->release(std::move(entry.payload));
+        }
+        waiting--;
+        frames_dropped_++;
+    }
+}
+
+void RawTransport::acceptConnections(int listen_fd, Channel channel) {
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                handleError("Failed to accept connection: " + std::string(strerror(errno)));
+            }
+            return;
+        }
+
+        auto connection = std::make_unique<Connection>();
+        connection->fd = fd;
+        connection->channel = channel;
+        connection->zerocopy = configureSocket(fd);
+        connection->rx.resize(RECEIVE_BUFFER_SIZE);
+        connections_.push_back(std::move(connection));
+    }
+}
+
+void RawTransport::identify(Connection& connection, uint64_t client_id) {
+    auto it = peer_ids_.find(client_id);
+    if (it == peer_ids_.end()) {
+        it = peer_ids_.emplace(client_id, next_peer_id_++).first;
+    }
+    connection.peer = it->second;
+    connection.identified = true;
+    peer_connections_[connection.peer][static_cast<size_t>(connection.channel)] = &connection;
+}
+
+bool RawTransport::flushConnection(Connection& connection) {
+    std::array<iovec, MAX_WRITE_BATCH * 2> iov;
+
+    while (true) {
+        // Dropped frames count as written, they never start halfway
+        while (connection.unsent < connection.send_queue.size() &&
+               connection.send_queue[connection.unsent].dropped) {
+            connection.unsent++;
+        }
+        if (connection.unsent == connection.send_queue.size()) {
+            return true;
+        }
+
+        // Gather a batch into one sendmsg(): header and payload per message
+        size_t iov_count = 0;
+        size_t skip = connection.write_offset;
+        bool zerocopy = false;
+        size_t batched = 0;
+        for (size_t i = connection.unsent;
+             i < connection.send_queue.size() && batched < MAX_WRITE_BATCH; ++i) {
+            Outgoing& entry = connection.send_queue[i];
+            if (entry.dropped) {
+                continue;
+            }
+            appendIov(iov.data(), iov_count, &entry.frame, sizeof(RawFrameHeader), skip);
+            appendIov(iov.data(), iov_count, entry.payload.data(), entry.payload.size(), skip);
+            zerocopy = zerocopy || entry.payload.size() >= ZEROCOPY_THRESHOLD;
+            batched++;
+        }
+        zerocopy = zerocopy && connection.zerocopy;
+
+        msghdr msg{};
+        msg.msg_iov = iov.data();
+        msg.msg_iovlen = iov_count;
+        int flags = MSG_DONTWAIT | MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0);
+        ssize_t sent = sendmsg(connection.fd, &msg, flags);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;  // Resumed on POLLOUT
+            }
+            if (errno == ENOBUFS && zerocopy) {
+                // Out of locked memory for pinned pages, keep copying from here on
+                connection.zerocopy = false;
+                continue;
+            }
+            handleError("Error sending message: " + std::string(strerror(errno)));
+            return false;
+        }
+
+        uint32_t zerocopy_id = zerocopy ? connection.zerocopy_next++ : 0;
+        size_t remaining = static_cast<size_t>(sent);
+        while (remaining > 0) {
+            Outgoing& entry = connection.send_queue[connection.unsent];
+            if (entry.dropped) {
+                connection.unsent++;
+                continue;
+            }
+
+            size_t total = sizeof(RawFrameHeader) + entry.payload.size();
+            size_t consumed = std::min(remaining, total - connection.write_offset);
+            if (connection.channel == Channel::FRAME) {
+                connection.written_frame = entry.frame.header.sequence;
+                connection.frame_written = true;
+            }
+            if (zerocopy) {
+                entry.zerocopy_used = true;
+                entry.zerocopy_id = zerocopy_id;
+            }
+            connection.write_offset += consumed;
+            remaining -= consumed;
+            if (connection.write_offset < total) {
+                break;
+            }
+            connection.write_offset = 0;
+            connection.unsent++;
+        }
+        releaseWritten(connection);
+    }
+}
+
+void RawTransport::reapZerocopy(Connection& connection) {
+    while (true) {
+        char control[128];
+        msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(connection.fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            bool recverr = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+            if (!recverr) {
+                continue;
+            }
+            sock_extended_err error;
+            std::memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+            if (error.ee_errno != 0 || error.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            // Sends ee_info..ee_data are done; TCP completes them in order
+            uint32_t done = error.ee_data + 1;
+            if (static_cast<int32_t>(done - connection.zerocopy_done) > 0) {
+                connection.zerocopy_done = done;
+            }
+        }
+    }
+    releaseWritten(connection);
+}
+
+void RawTransport::releaseWritten(Connection& connection) {
+    while (connection.unsent > 0) {
+        Outgoing& entry = connection.send_queue.front();
+        if (entry.zerocopy_used &&
+            static_cast<int32_t>(entry.zerocopy_id - connection.zerocopy_done) >= 0) {
+            break;  // The kernel may still be reading it
+        }
+        buffer_pool_->release(std::move(entry.payload));
+        connection.send_queue.pop_front();
+        connection.unsent--;
+    }
+}
+
+bool RawTransport::readConnection(Connection& connection) {
+    size_t delivered = 0;
+    while (delivered < MAX_MESSAGES_PER_POLL) {
+        // Parse whatever is buffered first
+        size_t buffered = connection.rx_used - connection.rx_pos;
+        const uint8_t* data = connection.rx.data() + connection.rx_pos;
+        if (!connection.identified) {
+            if (buffered >= sizeof(uint64_t)) {
+                uint64_t client_id;
+                std::memcpy(&client_id, data, sizeof(client_id));
+                connection.rx_pos += sizeof(client_id);
+                identify(connection, client_id);
+                continue;
+            }
+        } else if (!connection.in_payload) {
+            if (buffered >= sizeof(RawFrameHeader)) {
+                std::memcpy(&connection.frame, data, sizeof(RawFrameHeader));
+                connection.rx_pos += sizeof(RawFrameHeader);
+                if (connection.frame.payload_size > MAX_MESSAGE_SIZE) {
+                    // The stream can't be resynchronized after this
+                    handleError("Received message size exceeds limit");
+                    return false;
+                }
+                connection.payload = connection.frame.payload_size > 0 ?
+                    buffer_pool_->acquire(connection.frame.payload_size) : std::vector<uint8_t>();
+                connection.payload_read = 0;
+                connection.in_payload = true;
+                continue;
+            }
+        } else {
+            size_t take = std::min(buffered,
+                connection.payload.size() - connection.payload_read);
+            if (take > 0) {
+                std::memcpy(connection.payload.data() + connection.payload_read, data, take);
+            }
+            connection.rx_pos += take;
+            connection.payload_read += take;
+            if (connection.payload_read == connection.payload.size()) {
+                completeMessage(connection);
+                delivered++;
+                continue;
+            }
+        }
+
+        // Out of buffered bytes. Large payload remainders skip the receive
+        // buffer, everything else is read in bulk.
+        ssize_t received;
+        size_t payload_left = connection.in_payload ?
+            connection.payload.size() - connection.payload_read : 0;
+        if (payload_left >= RECEIVE_BUFFER_SIZE) {
+            received = recv(connection.fd, connection.payload.data() + connection.payload_read,
+                payload_left, MSG_DONTWAIT);
+            if (received > 0) {
+                connection.payload_read += static_cast<size_t>(received);
+            }
+        } else {
+            // Whatever the parsing above has not consumed yet
+            size_t unparsed = connection.rx_used - connection.rx_pos;
+            std::memmove(connection.rx.data(), connection.rx.data() + connection.rx_pos, unparsed);
+            connection.rx_pos = 0;
+            connection.rx_used = unparsed;
+            received = recv(connection.fd, connection.rx.data() + connection.rx_used,
+                connection.rx.size() - connection.rx_used, MSG_DONTWAIT);
+            if (received > 0) {
+                connection.rx_used += static_cast<size_t>(received);
+            }
+        }
+
+        if (received == 0) {
+            return false;  // Closed by the peer
+        }
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            handleError("Error receiving message: " + std::string(strerror(errno)));
+            return false;
+        }
+    }
+    return true;
+}
+
+void RawTransport::completeMessage(Connection& connection) {
+    Message message;
+    message.header = connection.frame.header;
+    message.payload = std::move(connection.payload);
+    message.peer = connection.peer;
+    connection.in_payload = false;
+    messages_received_++;
+    if (role_ == Role::SERVER) {
+        last_peer_ = connection.peer;
+    }
+    if (message.header.type == MessageType::HEARTBEAT) {
+        clock_sync_.onHeartbeat(message.header, message.payload.data(), message.payload.size(),
+            message.peer, ClockSync::now());
+    }
+
+    // Frames are picked once the pass has read them all
+    if (connection.channel == Channel::FRAME) {
+        frame_slices_.push_back(std::move(message));
+        return;
+    }
+
+    handleMessage(message);
+    buffer_pool_->release(std::move(message.payload));
+}
+
+void RawTransport::deliverFrames() {
+    frames_dropped_ += frame_filter_.select(frame_slices_, frame_deliver_);
+    for (Message& slice : frame_deliver_) {
+        handleMessage(slice);
+        buffer_pool_->release(std::move(slice.payload));
+    }
+    for (Message& slice : frame_slices_) {
+        buffer_pool_->release(std::move(slice.payload));
+    }
+    frame_deliver_.clear();
+    frame_slices_.clear();
+}
+
+void RawTransport::closeConnection(Connection& connection) {
+    auto it = peer_connections_.find(connection.peer);
+    if (it != peer_connections_.end()) {
+        Connection*& slot = it->second[static_cast<size_t>(connection.channel)];
+        if (slot == &connection) {
+            slot = nullptr;
+        }
+        if (std::all_of(it->second.begin(), it->second.end(),
+                [](const Connection* entry) { return entry == nullptr; })) {
+            peer_connections_.erase(it);
+            clock_sync_.forget(connection.peer);
+        }
+    }
+
+    close(connection.fd);
+    connection.fd = -1;
+    for (Outgoing& entry : connection.send_queue) {
+        buffer_pool_->release(std::move(entry.payload));
+    }
+    connection.send_queue.clear();
+    connection.unsent = 0;
+
+    if (role_ == Role::CLIENT) {
+        connected_ = false;
+        handleError("Connection to server lost");
+    }
+}
+
+void RawTransport::workerThread() {
+    const auto heartbeat_interval = std::chrono::milliseconds(HEARTBEAT_INTERVAL);
+    std::vector<pollfd> fds;
+
+    while (!should_stop_) {
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_heartbeat_ >= heartbeat_interval) {
+            sendHeartbeats();
+            last_heartbeat_ = now;
+        }
+
+        routeQueued();
+        for (auto& connection : connections_) {
+            if (connection->fd >= 0 && connection->unsent < connection->send_queue.size() &&
+                !flushConnection(*connection)) {
+                closeConnection(*connection);
+            }
+        }
+        connections_.erase(std::remove_if(connections_.begin(), connections_.end(),
+            [](const std::unique_ptr<Connection>& entry) { return entry->fd < 0; }),
+            connections_.end());
+
+        // Wake eventfd, listeners, then connections
+        fds.clear();
+        fds.push_back({wake_fd_, POLLIN, 0});
+        for (int fd : listen_fds_) {
+            if (fd >= 0) {
+                fds.push_back({fd, POLLIN, 0});
+            }
+        }
+        for (auto& connection : connections_) {
+            short events = POLLIN;
+            if (connection->unsent < connection->send_queue.size()) {
+                events |= POLLOUT;
+            }
+            fds.push_back({connection->fd, events, 0});
+        }
+
+        int timeout = 0;
+        if (!busy_poll_) {
+            auto until_heartbeat = std::chrono::duration_cast<std::chrono::milliseconds>(
+                last_heartbeat_ + heartbeat_interval - std::chrono::steady_clock::now());
+            timeout = static_cast<int>(std::max<int64_t>(until_heartbeat.count(), 0));
+        }
+        int ready = poll(fds.data(), fds.size(), timeout);
+        if (ready < 0) {
+            if (errno != EINTR) {
+                handleError("Error in worker thread: " + std::string(strerror(errno)));
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            continue;
+        }
+        if (ready == 0) {
+            continue;
+        }
+
+        size_t index = 0;
+        if (fds[index++].revents & POLLIN) {
+            uint64_t count;
+            ssize_t drained = read(wake_fd_, &count, sizeof(count));
+            (void)drained;
+        }
+
+        for (size_t i = 0; i < CHANNEL_COUNT; ++i) {
+            if (listen_fds_[i] >= 0 && (fds[index++].revents & POLLIN)) {
+                acceptConnections(listen_fds_[i], static_cast<Channel>(i));
+            }
+        }
+
+        // Connections accepted just now come up in the next poll
+        size_t polled = fds.size() - index;
+        for (size_t i = 0; i < polled; ++i) {
+            Connection& connection = *connections_[i];
+            short revents = fds[index + i].revents;
+            bool open = true;
+
+            if (revents & POLLERR) {
+                reapZerocopy(connection);
+            }
+            if (revents & POLLOUT) {
+                open = flushConnection(connection);
+            }
+            if (open && (revents & (POLLIN | POLLHUP | POLLERR))) {
+                open = readConnection(connection);
+            }
+            if (!open) {
+                closeConnection(connection);
+            }
+        }
+
+        if (!frame_slices_.empty()) {
+            deliverFrames();
+        }
+    }
+}
+
+void RawTransport::sendHeartbeats() {
+    Message heartbeat;
+    heartbeat.header.type = MessageType::HEARTBEAT;
+    heartbeat.header.sequence = messages_received_;
+
+    // Each carries the echo for the clock estimate of the peer it goes to
+    if (role_ == Role::CLIENT) {
+        clock_sync_.stamp(heartbeat, 0);
+        sendMessage(heartbeat);
+        return;
+    }
+
+    for (const auto& entry : peer_connections_) {
+        heartbeat.peer = entry.first;
+        clock_sync_.stamp(heartbeat, entry.first);
+        sendMessage(heartbeat);
+    }
+}
+
+void RawTransport::setMessageCallback(MessageCallback callback) {
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    message_callback_ = std::move(callback);
+}
+
+void RawTransport::setErrorCallback(ErrorCallback callback) {
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    error_callback_ = std::move(callback);
+}
+
+bool RawTransport::isConnected() const {
+    return connected_;
+}
+
+void RawTransport::setBusyPoll(bool enable) {
+    // SO_BUSY_POLL is set on sockets opened from here on
+    busy_poll_ = enable;
+}
+
+void RawTransport::handleMessage(const Message& message) {
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    if (message_callback_) {
+        message_callback_(message);
+    }
+}
+
+void RawTransport::handleError(const std::string& error) {
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    if (error_callback_) {
+        error_callback_(error);
+    }
+}
+
+} // namespace network
+} // namespace anarchy
+
+#endif // __linux__
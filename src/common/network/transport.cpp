@@ -0,0 +1,21 @@
+#include "common/network/transport.hpp"
+#include "common/network/zmq_wrapper.hpp"
+#include "common/network/raw_transport.hpp"
+#include <stdexcept>
+
+namespace anarchy {
+namespace network {
+
+std::unique_ptr<Transport> Transport::create(const std::string& endpoint, Role role) {
+    if (endpoint.compare(0, 6, "raw://") == 0) {
+#ifdef __linux__
+        return std::make_unique<RawTransport>(endpoint, role);
+#else
+        throw std::runtime_error("raw:// endpoints are only supported on Linux");
+#endif
+    }
+    return std::make_unique<ZMQWrapper>(endpoint, role);
+}
+
+} // namespace network
+} // namespace anarchy
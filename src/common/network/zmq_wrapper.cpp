@@ -6,21 +6,128 @@
 #include <cstring>
 #include <iostream>
 #include <algorithm>
+#include <random>
 #include <netdb.h>
 #include <arpa/inet.h>
 
-// Define LZ4 acceleration constants if not defined
-#ifndef LZ4_ACCELERATION_DEFAULT
-#define LZ4_ACCELERATION_DEFAULT 1
-#endif
-
-#ifndef LZ4_ACCELERATION_MAX
-#define LZ4_ACCELERATION_MAX 65537
-#endif
-
 namespace anarchy {
 namespace network {
 
+namespace {
+
+// Pooled buffer owned by an outgoing ZeroMQ frame until the send completes.
+// Holders are recycled as well, so a send doesn't allocate one per frame.
+struct PooledPayload {
+    std::shared_ptr<BufferPool> pool;
+    std::vector<uint8_t> buffer;
+};
+
+constexpr size_t MAX_FREE_PAYLOAD_HOLDERS = 64;
+
+std::mutex payload_holder_mutex;
+std::vector<std::unique_ptr<PooledPayload>> free_payload_holders;
+
+PooledPayload* acquirePayloadHolder(std::shared_ptr<BufferPool> pool,
+    std::vector<uint8_t>&& buffer)
+{
+    std::unique_ptr<PooledPayload> holder;
+    {
+        std::lock_guard<std::mutex> lock(payload_holder_mutex);
+        if (!free_payload_holders.empty()) {
+            holder = std::move(free_payload_holders.back());
+            free_payload_holders.pop_back();
+        }
+    }
+    if (!holder) {
+        holder = std::make_unique<PooledPayload>();
+    }
+
+    holder->pool = std::move(pool);
+    holder->buffer = std::move(buffer);
+    return holder.release();
+}
+
+// zmq_free_fn: hands the buffer back to its pool and recycles the holder
+void freePooledPayload(void*, void* hint) {
+    std::unique_ptr<PooledPayload> holder(static_cast<PooledPayload*>(hint));
+    holder->pool->release(std::move(holder->buffer));
+    holder->pool.reset();
+
+    std::lock_guard<std::mutex> lock(payload_holder_mutex);
+    if (free_payload_holders.size() < MAX_FREE_PAYLOAD_HOLDERS) {
+        free_payload_holders.push_back(std::move(holder));
+    }
+}
+
+} // namespace
+
+ReceivedMessage::ReceivedMessage(const MessageHeader& header, zmq::message_t&& frame)
+    : header(header)
+    , frame_(std::move(frame))
+{
+}
+
+ReceivedMessage::ReceivedMessage(const MessageHeader& header, std::vector<uint8_t>&& buffer,
+    std::shared_ptr<BufferPool> pool)
+    : header(header)
+    , buffer_(std::move(buffer))
+    , pool_(std::move(pool))
+{
+}
+
+ReceivedMessage::~ReceivedMessage() {
+    releaseBuffer();
+}
+
+ReceivedMessage::ReceivedMessage(ReceivedMessage&& other) noexcept
+    : header(other.header)
+    , peer(other.peer)
+    , frame_(std::move(other.frame_))
+    , buffer_(std::move(other.buffer_))
+    , pool_(std::move(other.pool_))
+{
+}
+
+ReceivedMessage& ReceivedMessage::operator=(ReceivedMessage&& other) noexcept {
+    if (this != &other) {
+        releaseBuffer();
+        header = other.header;
+        peer = other.peer;
+        frame_ = std::move(other.frame_);
+        buffer_ = std::move(other.buffer_);
+        pool_ = std::move(other.pool_);
+    }
+    return *this;
+}
+
+PayloadView ReceivedMessage::payload() const {
+    if (pool_) {
+        return {buffer_.data(), buffer_.size()};
+    }
+    return {frame_.data<uint8_t>(), frame_.size()};
+}
+
+Message ReceivedMessage::toMessage() && {
+    Message message;
+    message.header = header;
+    message.peer = peer;
+    if (pool_) {
+        message.payload = std::move(buffer_);
+        pool_.reset();
+    } else {
+        const uint8_t* data = frame_.data<uint8_t>();
+        message.payload.assign(data, data + frame_.size());
+    }
+    return message;
+}
+
+void ReceivedMessage::releaseBuffer() {
+    if (pool_) {
+        pool_->release(std::move(buffer_));
+        pool_.reset();
+    }
+}
+
 ZMQWrapper::ZMQWrapper(const std::string& endpoint, Role role)
     : endpoint_(endpoint)
     , role_(role)
@@ -28,19 +135,50 @@ ZMQWrapper::ZMQWrapper(const std::string& endpoint, Role role)
     , last_heartbeat_(std::chrono::steady_clock::now())
 {
     try {
-        socket_ = std::make_unique<zmq::socket_t>(context_, role == Role::SERVER ? ZMQ_REP : ZMQ_REQ);
-        
-        if (role == Role::SERVER) {
-            socket_->bind(endpoint);
-        } else {
-            socket_->connect(endpoint);
+        // A client's channels share one routing id so the server sees them
+        // as one peer. Ids must not start with a zero byte; eight bytes keep
+        // the string inline.
+        std::string routing_id;
+        if (role == Role::CLIENT) {
+            std::random_device random;
+            uint64_t id = (static_cast<uint64_t>(random()) << 32) | random();
+            routing_id.assign(reinterpret_cast<const char*>(&id), sizeof(id));
+            routing_id[0] = 'A';
+        }
+
+        for (size_t i = 0; i < CHANNEL_COUNT; ++i) {
+            Channel channel = static_cast<Channel>(i);
+            ChannelSocket& entry = channels_[i];
+            entry.endpoint = channelEndpoint(endpoint, channel);
+            entry.socket = std::make_unique<zmq::socket_t>(context_,
+                role == Role::SERVER ? ZMQ_ROUTER : ZMQ_DEALER);
+
+            // Set socket options
+            int linger = 0;
+            entry.socket->set(zmq::sockopt::linger, linger);
+            entry.socket->set(zmq::sockopt::rcvtimeo, static_cast<int>(DEFAULT_CONNECTION_TIMEOUT));
+            entry.socket->set(zmq::sockopt::sndtimeo, static_cast<int>(DEFAULT_CONNECTION_TIMEOUT));
+            if (channel == Channel::FRAME) {
+                entry.socket->set(zmq::sockopt::sndhwm, FRAME_SEND_QUEUE);
+            }
+
+            if (role == Role::SERVER) {
+                // Fail sends to unknown peers instead of dropping them silently
+                entry.socket->set(zmq::sockopt::router_mandatory, 1);
+                entry.socket->bind(entry.endpoint);
+            } else {
+                entry.socket->set(zmq::sockopt::routing_id, routing_id);
+                entry.socket->connect(entry.endpoint);
+            }
         }
         
-        // Set socket options
-        int linger = 0;
-        socket_->set(zmq::sockopt::linger, linger);
-        socket_->set(zmq::sockopt::rcvtimeo, static_cast<int>(DEFAULT_CONNECTION_TIMEOUT));
-        socket_->set(zmq::sockopt::sndtimeo, static_cast<int>(DEFAULT_CONNECTION_TIMEOUT));
+        // Wake-up pair for the worker's poll; inproc needs bind before connect
+        std::string wake_endpoint = "inproc://anarchy-wake-" +
+            std::to_string(reinterpret_cast<uintptr_t>(this));
+        wake_recv_ = std::make_unique<zmq::socket_t>(context_, ZMQ_PAIR);
+        wake_recv_->bind(wake_endpoint);
+        wake_send_ = std::make_unique<zmq::socket_t>(context_, ZMQ_PAIR);
+        wake_send_->connect(wake_endpoint);
         
         connection_state_ = ConnectionState::CONNECTED;
         connected_ = true;
@@ -56,7 +194,7 @@ ZMQWrapper::~ZMQWrapper() {
 }
 
 bool ZMQWrapper::start() {
-    if (worker_thread_.joinable()) {
+    if (worker_thread_.joinable() || !wake_recv_) {
         return false;
     }
     
@@ -68,93 +206,418 @@ bool ZMQWrapper::start() {
 void ZMQWrapper::stop() {
     should_stop_ = true;
     if (worker_thread_.joinable()) {
+        wake();
         worker_thread_.join();
     }
     
-    if (socket_) {
+    for (ChannelSocket& entry : channels_) {
+        if (!entry.socket) {
+            continue;
+        }
+
         try {
             if (role_ == Role::SERVER) {
-                socket_->unbind(endpoint_);
+                entry.socket->unbind(entry.endpoint);
             } else {
-                socket_->disconnect(endpoint_);
+                entry.socket->disconnect(entry.endpoint);
             }
         } catch (const zmq::error_t& e) {
             // Log error but continue cleanup
             handleError("Error during socket cleanup: " + std::string(e.what()));
         }
-        socket_.reset();
+        entry.socket.reset();
+    }
+
+    // Whatever never made it out is dropped; free functions run unlocked
+    std::array<std::vector<OutgoingMessage>, CHANNEL_COUNT> unsent;
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        std::swap(unsent, send_queues_);
     }
+    unsent = {};
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        wake_send_.reset();
+    }
+    wake_recv_.reset();
     
     connection_state_ = ConnectionState::DISCONNECTED;
     connected_ = false;
 }
 
 bool ZMQWrapper::sendMessage(const Message& message) {
+    if (!canSend(message.header)) {
+        return false;
+    }
+
+    try {
+        MessageHeader header = message.header;
+        zmq::message_t payload_msg;
+        if (!compressPayload(message.payload.data(), message.payload.size(), header, payload_msg) &&
+            !message.payload.empty()) {
+            // The caller keeps its buffer, so this path pays one copy into the frame
+            payload_msg.rebuild(message.payload.data(), message.payload.size());
+        }
+        return queueMessage(header, message.peer, payload_msg);
+
+    } catch (const zmq::error_t& e) {
+        handleError("Error sending message: " + std::string(e.what()));
+        return false;
+    }
+}
+
+bool ZMQWrapper::sendMessage(Message&& message) {
+    if (!canSend(message.header)) {
+        return false;
+    }
+
+    try {
+        MessageHeader header = message.header;
+        zmq::message_t payload_msg;
+        if (!compressPayload(message.payload.data(), message.payload.size(), header, payload_msg) &&
+            !message.payload.empty()) {
+            // The vector joins the buffer pool once ZeroMQ is done with it
+            PooledPayload* payload = acquirePayloadHolder(buffer_pool_, std::move(message.payload));
+            try {
+                payload_msg.rebuild(payload->buffer.data(), payload->buffer.size(),
+                    freePooledPayload, payload);
+            } catch (...) {
+                freePooledPayload(nullptr, payload);
+                throw;
+            }
+        }
+        return queueMessage(header, message.peer, payload_msg);
+
+    } catch (const zmq::error_t& e) {
+        handleError("Error sending message: " + std::string(e.what()));
+        return false;
+    }
+}
+
+bool ZMQWrapper::sendZeroCopy(const MessageHeader& header, void* data, size_t size,
+    FreeFunction free_fn, void* hint, uint64_t peer)
+{
+    if (!canSend(header)) {
+        free_fn(data, hint);
+        return false;
+    }
+
+    bool owned = true;
+    try {
+        MessageHeader wire_header = header;
+        zmq::message_t payload_msg;
+        if (compressPayload(static_cast<const uint8_t*>(data), size, wire_header, payload_msg) ||
+            size == 0) {
+            // What goes out is the compressed copy, the caller's buffer is done
+            owned = false;
+            free_fn(data, hint);
+        } else {
+            payload_msg.rebuild(data, size, free_fn, hint);
+            owned = false;  // Freed by ZeroMQ from here on
+        }
+        return queueMessage(wire_header, peer, payload_msg);
+
+    } catch (const zmq::error_t& e) {
+        if (owned) {
+            free_fn(data, hint);
+        }
+        handleError("Error sending message: " + std::string(e.what()));
+        return false;
+    }
+}
+
+bool ZMQWrapper::canSend(const MessageHeader& header) {
     if (!connected_) {
         handleError("Cannot send message: not connected");
         return false;
     }
-    
+
     // Check message size
-    if (message.header.size > max_message_size_) {
+    if (header.size > max_message_size_) {
         handleError("Message size exceeds limit");
         return false;
     }
-    
+    return true;
+}
+
+bool ZMQWrapper::compressPayload(const uint8_t* data, size_t size, MessageHeader& header,
+    zmq::message_t& payload_msg)
+{
+    CompressionType type = compression_policy_.select(header.type, size);
+    if (type == CompressionType::NONE) {
+        return false;
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    // Compress straight from the caller's buffer into a pooled one, sized for
+    // the worst case so incompressible input can't overrun it
+    PooledPayload* payload = acquirePayloadHolder(buffer_pool_,
+        buffer_pool_->acquire(compressBound(type, size)));
+    size_t compressed_size = compressData(type, data, size, payload->buffer.data(),
+        payload->buffer.size());
+    auto end_time = std::chrono::steady_clock::now();
+    auto compression_time = std::chrono::duration_cast<std::chrono::microseconds>(
+        end_time - start_time);
+
+    // Incompressible input still teaches the policy something
+    bool compressed = compressed_size > 0 && compressed_size < size;
+    compression_policy_.recordCompression(header.type, type, size,
+        compressed ? compressed_size : size, compression_time);
+    if (!compressed) {
+        freePooledPayload(nullptr, payload);
+        return false;
+    }
+
     try {
-        Message msg = message;
-        size_t original_size = msg.payload.size();
-        
-        // Check if we should compress the message
-        if (shouldCompressMessage(original_size)) {
-            auto start_time = std::chrono::steady_clock::now();
-            
-            // Allocate buffer for compressed data
-            std::vector<uint8_t> compressed_data(original_size);
-            size_t compressed_size = compressData(msg.payload.data(), original_size,
-                                                compressed_data.data(), compressed_data.size());
-            
-            if (compressed_size > 0 && compressed_size < original_size) {
-                auto end_time = std::chrono::steady_clock::now();
-                auto compression_time = std::chrono::duration_cast<std::chrono::microseconds>(
-                    end_time - start_time);
-                
-                compressed_data.resize(compressed_size);
-                msg.payload = std::move(compressed_data);
-                msg.header.compression = selectCompressionType(original_size);
-                
-                updateCompressionStats(original_size, compressed_size, compression_time);
+        payload_msg.rebuild(payload->buffer.data(), compressed_size, freePooledPayload, payload);
+    } catch (...) {
+        freePooledPayload(nullptr, payload);
+        throw;
+    }
+    header.setCompression(type);
+
+    updateCompressionStats(size, compressed_size, compression_time);
+    return true;
+}
+
+bool ZMQWrapper::queueMessage(const MessageHeader& header, uint64_t peer,
+    zmq::message_t& payload_msg)
+{
+    Channel channel = channelForMessage(header.type);
+
+    OutgoingMessage outgoing;
+    outgoing.header = header;
+    outgoing.payload = std::move(payload_msg);
+    if (role_ == Role::SERVER) {
+        std::lock_guard<std::mutex> lock(peer_mutex_);
+        auto it = peer_routes_.find(peer != 0 ? peer : last_peer_);
+        if (it == peer_routes_.end()) {
+            handleError("Cannot send message: unknown peer");
+            return false;
+        }
+        outgoing.route = it->second;
+    }
+
+    // Frames waiting behind a newer one are stale; destroyed after unlocking
+    // since that may run a caller's free function. Only a frame's first
+    // slice makes room, the rest follow it.
+    std::vector<OutgoingMessage> stale;
+    size_t dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        auto& queue = send_queues_[static_cast<size_t>(channel)];
+        if (channel == Channel::FRAME) {
+            if (!frame_queue_open_) {
+                dropped = dropStaleFrames(queue, stale);
             }
+            frame_queue_open_ = isPartialFrame(header);
         }
-        
-        // Send the message
-        zmq::message_t header_msg(&msg.header, sizeof(MessageHeader));
-        zmq::message_t payload_msg(msg.payload.data(), msg.payload.size());
-        
-        if (!socket_->send(header_msg, zmq::send_flags::sndmore)) {
+        queue.push_back(std::move(outgoing));
+    }
+    frames_dropped_ += dropped;
+
+    wake();
+    return true;
+}
+
+size_t ZMQWrapper::dropStaleFrames(std::vector<OutgoingMessage>& queue,
+    std::vector<OutgoingMessage>& stale)
+{
+    // Whole frames only, and none the worker has started sending
+    auto droppable = [this](const OutgoingMessage& message) {
+        return !(frame_handed_ && message.header.sequence == handed_frame_);
+    };
+    size_t waiting = 0;
+    for (size_t i = 0; i < queue.size(); ++i) {
+        if (droppable(queue[i]) &&
+            (i == 0 || queue[i].header.sequence != queue[i - 1].header.sequence)) {
+            waiting++;
+        }
+    }
+
+    size_t dropped = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < queue.size(); ) {
+        uint64_t sequence = queue[i].header.sequence;
+        bool drop = droppable(queue[i]) && waiting >= static_cast<size_t>(FRAME_SEND_QUEUE);
+        for (; i < queue.size() && queue[i].header.sequence == sequence; ++i) {
+            if (drop) {
+                stale.push_back(std::move(queue[i]));
+            } else {
+                queue[kept++] = std::move(queue[i]);
+            }
+        }
+        if (drop) {
+            waiting--;
+            dropped++;
+        }
+    }
+    queue.resize(kept);
+    return dropped;
+}
+
+size_t ZMQWrapper::sendFrames(Channel channel, OutgoingMessage& message) {
+    ChannelSocket& entry = channels_[static_cast<size_t>(channel)];
+    if (!entry.socket) {
+        return 0;
+    }
+
+    // Frames never hold up the worker, a full socket means the peer is
+    // behind. That drops a frame at its first slice; the rest of a frame
+    // already started waits for room, since a partial frame is no use.
+    bool continues = false;
+    if (channel == Channel::FRAME) {
+        uint64_t sequence = message.header.sequence;
+        if (frame_skipping_ && sequence == skipped_frame_) {
+            frame_skipping_ = isPartialFrame(message.header);
+            return 0;
+        }
+        frame_skipping_ = false;
+        continues = frame_wire_open_ && sequence == wire_frame_;
+        wire_frame_ = sequence;
+        frame_wire_open_ = false;
+    }
+    zmq::send_flags flags = channel == Channel::FRAME && !continues ?
+        zmq::send_flags::dontwait : zmq::send_flags::none;
+
+    zmq::message_t header_msg(&message.header, sizeof(MessageHeader));
+    size_t payload_size = message.payload.size();
+
+    // Only the first part can fail with EAGAIN, multipart sends are atomic
+    bool first_sent = true;
+    if (role_ == Role::SERVER) {
+        zmq::message_t route_msg(message.route.data(), message.route.size());
+        first_sent = static_cast<bool>(
+            entry.socket->send(route_msg, flags | zmq::send_flags::sndmore));
+    }
+    if (first_sent) {
+        first_sent = static_cast<bool>(
+            entry.socket->send(header_msg, flags | zmq::send_flags::sndmore));
+    }
+
+    if (!first_sent) {
+        if (channel == Channel::FRAME) {
+            frames_dropped_++;
+            frame_skipping_ = isPartialFrame(message.header);
+            skipped_frame_ = message.header.sequence;
+        } else {
             handleError("Failed to send message header");
-            return false;
         }
-        
-        if (!socket_->send(payload_msg, zmq::send_flags::none)) {
-            handleError("Failed to send message payload");
-            return false;
+        return 0;
+    }
+
+    if (!entry.socket->send(message.payload, flags)) {
+        handleError("Failed to send message payload");
+        return 0;
+    }
+    if (channel == Channel::FRAME) {
+        frame_wire_open_ = isPartialFrame(message.header);
+    }
+    return sizeof(MessageHeader) + payload_size;
+}
+
+void ZMQWrapper::flushSendQueue() {
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        for (size_t i = 0; i < CHANNEL_COUNT; ++i) {
+            std::swap(send_queues_[i], send_batch_[i]);
         }
-        
-        updateNetworkSpeed(sizeof(MessageHeader) + msg.payload.size());
-        return true;
-        
-    } catch (const zmq::error_t& e) {
-        handleError("Error sending message: " + std::string(e.what()));
-        return false;
+        const auto& frames = send_batch_[static_cast<size_t>(Channel::FRAME)];
+        if (!frames.empty()) {
+            handed_frame_ = frames.back().header.sequence;
+            frame_handed_ = true;
+        }
+    }
+
+    // Control goes first, so heartbeats and acks never wait behind bulk data
+    auto start_time = std::chrono::steady_clock::now();
+    size_t bytes_sent = 0;
+    for (size_t i = 0; i < CHANNEL_COUNT; ++i) {
+        for (OutgoingMessage& message : send_batch_[i]) {
+            try {
+                bytes_sent += sendFrames(static_cast<Channel>(i), message);
+            } catch (const zmq::error_t& e) {
+                handleError("Error sending message: " + std::string(e.what()));
+            }
+        }
+        send_batch_[i].clear();
+    }
+
+    // Blocking sends take as long as the link needs once ZeroMQ's queue is
+    // full, so a busy batch measures what actually gets through
+    if (bytes_sent > 0) {
+        compression_policy_.recordTransfer(bytes_sent,
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start_time));
+    }
+}
+
+void ZMQWrapper::wake() {
+    // One pending wake-up is enough, the worker drains every queue
+    if (wake_pending_.exchange(true)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    if (wake_send_) {
+        zmq::message_t signal;
+        wake_send_->send(signal, zmq::send_flags::dontwait);
+    }
+}
+
+void ZMQWrapper::waitForActivity(std::chrono::milliseconds timeout) {
+    // The wake-up socket goes first so its slot is fixed
+    std::array<zmq::pollitem_t, CHANNEL_COUNT + 1> items = {};
+    items[0].socket = wake_recv_->handle();
+    items[0].events = ZMQ_POLLIN;
+    size_t item_count = 1;
+    for (const ChannelSocket& entry : channels_) {
+        if (entry.socket) {
+            items[item_count].socket = entry.socket->handle();
+            items[item_count].events = ZMQ_POLLIN;
+            item_count++;
+        }
+    }
+
+    zmq::poll(items.data(), item_count, busy_poll_ ? std::chrono::milliseconds(0) : timeout);
+
+    if (items[0].revents & ZMQ_POLLIN) {
+        zmq::message_t signal;
+        while (wake_recv_->recv(signal, zmq::recv_flags::dontwait)) {
+        }
+        wake_pending_ = false;
     }
 }
 
+std::string ZMQWrapper::channelEndpoint(const std::string& endpoint, Channel channel) {
+    size_t index = static_cast<size_t>(channel);
+    if (endpoint.compare(0, 6, "tcp://") == 0) {
+        size_t colon = endpoint.rfind(':');
+        if (colon != std::string::npos && colon > 5) {
+            try {
+                int port = std::stoi(endpoint.substr(colon + 1));
+                return endpoint.substr(0, colon + 1) + std::to_string(port + index);
+            } catch (const std::exception&) {
+                // Not a numeric port, fall back to a suffix
+            }
+        }
+    }
+
+    static const char* suffixes[CHANNEL_COUNT] = {"", "-command", "-frame"};
+    return endpoint + suffixes[index];
+}
+
 void ZMQWrapper::setMessageCallback(MessageCallback callback) {
     std::lock_guard<std::mutex> lock(callback_mutex_);
     message_callback_ = std::move(callback);
 }
 
+void ZMQWrapper::setZeroCopyCallback(ZeroCopyCallback callback) {
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    zero_copy_callback_ = std::move(callback);
+}
+
 void ZMQWrapper::setErrorCallback(ErrorCallback callback) {
     std::lock_guard<std::mutex> lock(callback_mutex_);
     error_callback_ = std::move(callback);
@@ -190,114 +653,104 @@ std::string ZMQWrapper::getServerAddress() const {
 }
 
 void ZMQWrapper::setCompressionType(CompressionType type) {
-    compression_type_ = type;
+    compression_policy_.setCodecOverride(type);
 }
 
 void ZMQWrapper::setCompressionLevel(CompressionLevel level) {
     compression_level_ = level;
 }
 
+void ZMQWrapper::setCompressionRule(MessageType type, CompressionRule rule) {
+    compression_policy_.setRule(type, rule);
+}
+
 void ZMQWrapper::enableAdaptiveCompression(bool enable) {
-    adaptive_compression_ = enable;
+    compression_policy_.setAdaptive(enable);
 }
 
 CompressionStatsData ZMQWrapper::getCompressionStats() const {
     std::lock_guard<std::mutex> lock(compression_stats_mutex_);
-    return compression_stats_.toData();
+    CompressionStatsData data = compression_stats_.toData();
+    data.buffer_allocations = buffer_pool_->allocations();
+    return data;
 }
 
 double ZMQWrapper::getCurrentNetworkSpeed() const {
-    std::lock_guard<std::mutex> lock(network_speed_mutex_);
-    cleanupOldSpeedHistory();
-    
-    // Calculate current speed in bytes per second
-    size_t total_bytes = 0;
-    for (const auto& entry : network_speed_history_) {
-        total_bytes += entry.second;
-    }
-    
-    return static_cast<double>(total_bytes);
-}
-
-void ZMQWrapper::cleanupOldSpeedHistory() const {
-    auto now = std::chrono::steady_clock::now();
-    auto window_start = now - std::chrono::seconds(1);
-    
-    // Remove old entries
-    network_speed_history_.erase(
-        std::remove_if(network_speed_history_.begin(), network_speed_history_.end(),
-                      [window_start](const auto& m) {
-                          return m.first < window_start;
-                      }),
-        network_speed_history_.end()
-    );
+    return compression_policy_.bandwidth();
 }
 
 void ZMQWrapper::workerThread() {
+    const auto heartbeat_interval = std::chrono::milliseconds(DEFAULT_HEARTBEAT_INTERVAL);
+
     while (!should_stop_) {
         try {
             // Check if we need to send a heartbeat
             auto now = std::chrono::steady_clock::now();
-            if (now - last_heartbeat_ >= std::chrono::milliseconds(DEFAULT_HEARTBEAT_INTERVAL)) {
-                Message heartbeat;
-                heartbeat.header.type = MessageType::HEARTBEAT;
-                heartbeat.header.size = 0;
-                heartbeat.header.sequence = messages_received_;
-                heartbeat.header.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
-                    now.time_since_epoch()).count();
-                
-                if (sendMessage(heartbeat)) {
-                    last_heartbeat_ = now;
-                }
+            if (now - last_heartbeat_ >= heartbeat_interval) {
+                sendHeartbeats();
+                last_heartbeat_ = now;
             }
+
+            flushSendQueue();
             
-            // Try to receive a message with a short timeout
-            zmq::message_t header_msg;
-            if (!socket_->recv(header_msg, zmq::recv_flags::dontwait)) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                continue;
+            bool idle = true;
+
+            // Control and command traffic is delivered in arrival order
+            for (Channel channel : {Channel::CONTROL, Channel::COMMAND}) {
+                for (int i = 0; i < MAX_MESSAGES_PER_POLL; ++i) {
+                    ReceivedMessage msg;
+                    ReceiveStatus status = receiveMessage(channel, msg);
+                    if (status == ReceiveStatus::EMPTY) {
+                        break;
+                    }
+                    idle = false;
+
+                    if (status == ReceiveStatus::RECEIVED && decompressMessage(msg)) {
+                        if (msg.header.type == MessageType::HEARTBEAT) {
+                            PayloadView payload = msg.payload();
+                            clock_sync_.onHeartbeat(msg.header, payload.data, payload.size,
+                                msg.peer, ClockSync::now());
+                        }
+                        handleMessage(msg);
+                        messages_received_++;
+                    }
+                }
             }
-            
-            MessageHeader* header = static_cast<MessageHeader*>(header_msg.data());
-            
-            zmq::message_t payload_msg;
-            if (!socket_->recv(payload_msg, zmq::recv_flags::none)) {
-                handleError("Failed to receive message payload");
-                continue;
+
+            // Of the frames queued up since the last pass only the newest is
+            // worth showing, see FrameFilter
+            for (int i = 0; i < MAX_MESSAGES_PER_POLL; ++i) {
+                ReceivedMessage msg;
+                ReceiveStatus status = receiveMessage(Channel::FRAME, msg);
+                if (status == ReceiveStatus::EMPTY) {
+                    break;
+                }
+                idle = false;
+
+                if (status == ReceiveStatus::RECEIVED) {
+                    frame_slices_.push_back(std::move(msg));
+                }
             }
-            
-            Message msg;
-            msg.header = *header;
-            msg.payload.resize(payload_msg.size());
-            std::memcpy(msg.payload.data(), payload_msg.data(), payload_msg.size());
-            
-            if (msg.header.compression != CompressionType::NONE) {
-                auto start_time = std::chrono::steady_clock::now();
-                
-                std::vector<uint8_t> decompressed_data(msg.header.size);
-                size_t decompressed_size = decompressData(msg.payload.data(), msg.payload.size(),
-                                                        decompressed_data.data(), decompressed_data.size());
-                
-                if (decompressed_size > 0) {
-                    auto end_time = std::chrono::steady_clock::now();
-                    auto decompression_time = std::chrono::duration_cast<std::chrono::microseconds>(
-                        end_time - start_time);
-                    
-                    decompressed_data.resize(decompressed_size);
-                    msg.payload = std::move(decompressed_data);
-                    msg.header.compression = CompressionType::NONE;
-                    
-                    updateCompressionStats(msg.payload.size(), payload_msg.size(), decompression_time);
-                } else {
-                    handleError("Failed to decompress message");
-                    std::lock_guard<std::mutex> lock(compression_stats_mutex_);
-                    compression_stats_.decompression_failures++;
-                    continue;
+
+            if (!frame_slices_.empty()) {
+                frames_dropped_ += frame_filter_.select(frame_slices_, frame_deliver_);
+                for (ReceivedMessage& slice : frame_deliver_) {
+                    if (decompressMessage(slice)) {
+                        handleMessage(slice);
+                        messages_received_++;
+                    }
                 }
+                frame_deliver_.clear();
+                frame_slices_.clear();
+            }
+
+            // Block until a socket is readable, a sender queued something,
+            // stop() was called or the next heartbeat is due
+            if (idle) {
+                auto until_heartbeat = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    last_heartbeat_ + heartbeat_interval - std::chrono::steady_clock::now());
+                waitForActivity(std::max(until_heartbeat, std::chrono::milliseconds(0)));
             }
-            
-            handleMessage(msg);
-            messages_received_++;
             
         } catch (const zmq::error_t& e) {
             handleError("Error in worker thread: " + std::string(e.what()));
@@ -306,139 +759,168 @@ void ZMQWrapper::workerThread() {
     }
 }
 
-void ZMQWrapper::handleMessage(const Message& message) {
-    std::lock_guard<std::mutex> lock(callback_mutex_);
-    if (message_callback_) {
-        message_callback_(message);
+void ZMQWrapper::sendHeartbeats() {
+    Message heartbeat;
+    heartbeat.header.type = MessageType::HEARTBEAT;
+    heartbeat.header.sequence = messages_received_;
+
+    // Each carries the echo for the clock estimate of the peer it goes to
+    if (role_ == Role::CLIENT) {
+        clock_sync_.stamp(heartbeat, 0);
+        sendMessage(heartbeat);
+        return;
+    }
+
+    // The server has to address each client it has heard from
+    std::vector<uint64_t> peers;
+    {
+        std::lock_guard<std::mutex> lock(peer_mutex_);
+        for (const auto& entry : peer_routes_) {
+            peers.push_back(entry.first);
+        }
+    }
+    for (uint64_t peer : peers) {
+        heartbeat.peer = peer;
+        clock_sync_.stamp(heartbeat, peer);
+        sendMessage(heartbeat);
     }
 }
 
-void ZMQWrapper::handleError(const std::string& error) {
-    std::lock_guard<std::mutex> lock(callback_mutex_);
-    if (error_callback_) {
-        error_callback_(error);
+ZMQWrapper::ReceiveStatus ZMQWrapper::receiveMessage(Channel channel, ReceivedMessage& message) {
+    ChannelSocket& entry = channels_[static_cast<size_t>(channel)];
+
+    // ROUTER prepends the routing id: [id] header payload
+    const size_t expected_parts = role_ == Role::SERVER ? 3 : 2;
+    std::array<zmq::message_t, 3> parts;
+    size_t part_count = 0;
+    if (!entry.socket || !entry.socket->recv(parts[0], zmq::recv_flags::dontwait)) {
+        return ReceiveStatus::EMPTY;
+    }
+    part_count = 1;
+
+    // The remaining parts of a multipart message arrive together
+    bool more = parts[0].more();
+    zmq::message_t extra;
+    while (more) {
+        zmq::message_t& part = part_count < parts.size() ? parts[part_count] : extra;
+        if (!entry.socket->recv(part, zmq::recv_flags::none)) {
+            break;
+        }
+        part_count++;
+        more = part.more();
+    }
+
+    if (part_count != expected_parts) {
+        handleError("Received malformed message");
+        return ReceiveStatus::DISCARDED;
     }
+
+    zmq::message_t& header_msg = parts[expected_parts - 2];
+    zmq::message_t& payload_msg = parts[expected_parts - 1];
+    if (header_msg.size() != sizeof(MessageHeader)) {
+        handleError("Received malformed message header");
+        return ReceiveStatus::DISCARDED;
+    }
+
+    MessageHeader header;
+    std::memcpy(&header, header_msg.data(), sizeof(header));
+    if (header.size > max_message_size_) {
+        handleError("Received message size exceeds limit");
+        return ReceiveStatus::DISCARDED;
+    }
+
+    // Uncompressed payloads are handed out straight from the frame
+    message = ReceivedMessage(header, std::move(payload_msg));
+    if (role_ == Role::SERVER) {
+        message.peer = peerForRoute(parts[0]);
+    }
+    return ReceiveStatus::RECEIVED;
 }
 
-bool ZMQWrapper::shouldCompressMessage(size_t message_size) const {
-    if (!adaptive_compression_) {
-        return message_size > 1024;  // Compress messages larger than 1KB
+bool ZMQWrapper::decompressMessage(ReceivedMessage& message) {
+    if (message.header.compression() == CompressionType::NONE) {
+        return true;
     }
-    
-    double network_speed = getCurrentNetworkSpeed();
-    return message_size > 1024 && network_speed < message_size * 10;
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    const zmq::message_t& frame = message.frame_;
+    std::vector<uint8_t> decompressed_data = buffer_pool_->acquire(message.header.size);
+    size_t decompressed_size = decompressData(message.header.compression(),
+        frame.data<uint8_t>(), frame.size(), decompressed_data.data(), decompressed_data.size());
+
+    if (decompressed_size == 0) {
+        buffer_pool_->release(std::move(decompressed_data));
+        handleError("Failed to decompress message");
+        std::lock_guard<std::mutex> lock(compression_stats_mutex_);
+        compression_stats_.decompression_failures++;
+        return false;
+    }
+
+    auto end_time = std::chrono::steady_clock::now();
+    auto decompression_time = std::chrono::duration_cast<std::chrono::microseconds>(
+        end_time - start_time);
+    updateCompressionStats(decompressed_size, frame.size(), decompression_time);
+
+    decompressed_data.resize(decompressed_size);
+    message.releaseBuffer();
+    message.buffer_ = std::move(decompressed_data);
+    message.pool_ = buffer_pool_;
+    message.frame_.rebuild();
+    message.header.setCompression(CompressionType::NONE);
+    return true;
 }
 
-CompressionType ZMQWrapper::selectCompressionType(size_t message_size) const {
-    if (compression_type_ != CompressionType::NONE) {
-        return compression_type_;
+uint64_t ZMQWrapper::peerForRoute(const zmq::message_t& routing_id) {
+    std::string route(routing_id.data<char>(), routing_id.size());
+
+    std::lock_guard<std::mutex> lock(peer_mutex_);
+    auto it = peer_ids_.find(route);
+    if (it == peer_ids_.end()) {
+        uint64_t peer = next_peer_id_++;
+        it = peer_ids_.emplace(route, peer).first;
+        peer_routes_.emplace(peer, route);
     }
-    
-    // Use ZLIB for smaller messages (better compression ratio)
-    // Use LZ4 for larger messages (faster compression)
-    return message_size < 1024 * 1024 ? CompressionType::ZLIB : CompressionType::LZ4;
+    last_peer_ = it->second;
+    return it->second;
 }
 
-size_t ZMQWrapper::compressData(const uint8_t* input, size_t input_size,
-                               uint8_t* output, size_t output_size) {
-    if (compression_type_ == CompressionType::LZ4) {
-        int compression_level;
-        switch (compression_level_) {
-            case CompressionLevel::FAST:
-                compression_level = LZ4_ACCELERATION_MAX;
-                break;
-            case CompressionLevel::MAX:
-                compression_level = 1;  // Best compression
-                break;
-            default:
-                compression_level = LZ4_ACCELERATION_DEFAULT;
-                break;
-        }
-        
-        return LZ4_compress_fast(reinterpret_cast<const char*>(input),
-                               reinterpret_cast<char*>(output),
-                               static_cast<int>(input_size),
-                               static_cast<int>(output_size),
-                               compression_level);
-    } else {
-        // ZLIB compression
-        z_stream stream;
-        stream.zalloc = Z_NULL;
-        stream.zfree = Z_NULL;
-        stream.opaque = Z_NULL;
-        
-        int level;
-        switch (compression_level_) {
-            case CompressionLevel::FAST:
-                level = Z_BEST_SPEED;
-                break;
-            case CompressionLevel::MAX:
-                level = Z_BEST_COMPRESSION;
-                break;
-            default:
-                level = Z_DEFAULT_COMPRESSION;
-                break;
-        }
-        
-        if (deflateInit(&stream, level) != Z_OK) {
-            return 0;
-        }
-        
-        stream.next_in = const_cast<uint8_t*>(input);
-        stream.avail_in = static_cast<uInt>(input_size);
-        stream.next_out = output;
-        stream.avail_out = static_cast<uInt>(output_size);
-        
-        int ret = deflate(&stream, Z_FINISH);
-        deflateEnd(&stream);
-        
-        if (ret != Z_STREAM_END) {
-            return 0;
-        }
-        
-        return output_size - stream.avail_out;
+void ZMQWrapper::handleMessage(ReceivedMessage& message) {
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    if (zero_copy_callback_) {
+        zero_copy_callback_(message);
+    } else if (message_callback_) {
+        message_callback_(std::move(message).toMessage());
     }
 }
 
-size_t ZMQWrapper::decompressData(const uint8_t* input, size_t input_size,
-                                 uint8_t* output, size_t output_size) {
-    if (compression_type_ == CompressionType::LZ4) {
-        return LZ4_decompress_safe(reinterpret_cast<const char*>(input),
-                                 reinterpret_cast<char*>(output),
-                                 static_cast<int>(input_size),
-                                 static_cast<int>(output_size));
-    } else {
-        // ZLIB decompression
-        z_stream stream;
-        stream.zalloc = Z_NULL;
-        stream.zfree = Z_NULL;
-        stream.opaque = Z_NULL;
-        stream.avail_in = 0;
-        stream.next_in = Z_NULL;
-        
-        if (inflateInit(&stream) != Z_OK) {
-            return 0;
-        }
-        
-        stream.next_in = const_cast<uint8_t*>(input);
-        stream.avail_in = static_cast<uInt>(input_size);
-        stream.next_out = output;
-        stream.avail_out = static_cast<uInt>(output_size);
-        
-        int ret = inflate(&stream, Z_FINISH);
-        inflateEnd(&stream);
-        
-        if (ret != Z_STREAM_END) {
-            return 0;
-        }
-        
-        return output_size - stream.avail_out;
+void ZMQWrapper::handleError(const std::string& error) {
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    if (error_callback_) {
+        error_callback_(error);
     }
 }
 
-void ZMQWrapper::updateNetworkSpeed(size_t bytes_sent) {
-    std::lock_guard<std::mutex> lock(network_speed_mutex_);
-    network_speed_history_.emplace_back(std::chrono::steady_clock::now(), bytes_sent);
+size_t ZMQWrapper::compressData(CompressionType type, const uint8_t* input, size_t input_size,
+                               uint8_t* output, size_t output_size) {
+    bool initialized = false;
+    size_t written = network::compressData(type, compression_level_, input, input_size,
+        output, output_size, &initialized);
+    if (initialized) {
+        compression_stats_.context_initializations++;
+    }
+    return written;
+}
+
+size_t ZMQWrapper::decompressData(CompressionType type, const uint8_t* input, size_t input_size,
+                                 uint8_t* output, size_t output_size) {
+    bool initialized = false;
+    size_t written = network::decompressData(type, input, input_size, output, output_size,
+        &initialized);
+    if (initialized) {
+        compression_stats_.context_initializations++;
+    }
+    return written;
 }
 
 void ZMQWrapper::updateCompressionStats(size_t before_size, size_t after_size,
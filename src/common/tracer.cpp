@@ -0,0 +1,285 @@
+#include "common/tracer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+namespace anarchy {
+
+namespace {
+
+// Which tracer the calling thread's cached buffer belongs to
+struct ThreadCache {
+    uint64_t tracer{0};
+    void* buffer{nullptr};
+};
+
+thread_local ThreadCache thread_cache;
+std::atomic<uint64_t> next_tracer_id{1};
+
+// Marks in time, not durations: nothing to put in a histogram
+bool instantStage(TraceStage stage) {
+    return stage == TraceStage::PRESENT || stage == TraceStage::SEND ||
+        stage == TraceStage::RECEIVE || stage == TraceStage::DISPLAY;
+}
+
+uint32_t bitWidth(uint64_t value) {
+    uint32_t width = 0;
+    while (value) {
+        value >>= 1;
+        width++;
+    }
+    return width;
+}
+
+} // namespace
+
+const char* traceStageName(TraceStage stage) {
+    switch (stage) {
+        case TraceStage::PRESENT:
+            return "present";
+        case TraceStage::EXECUTE:
+            return "execute";
+        case TraceStage::CAPTURE:
+            return "capture";
+        case TraceStage::CONVERT:
+            return "convert";
+        case TraceStage::ENCODE:
+            return "encode";
+        case TraceStage::SEND:
+            return "send";
+        case TraceStage::RECEIVE:
+            return "receive";
+        case TraceStage::DECODE:
+            return "decode";
+        case TraceStage::DISPLAY:
+            return "display";
+    }
+    return "unknown";
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t value) {
+    // Exact below two powers' worth of sub-buckets, then 32 per power of two
+    constexpr uint64_t SUB_BUCKETS = uint64_t(1) << SUB_BUCKET_BITS;
+    if (value < 2 * SUB_BUCKETS) {
+        return static_cast<size_t>(value);
+    }
+    uint32_t shift = bitWidth(value) - 1 - SUB_BUCKET_BITS;
+    return static_cast<size_t>((shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS));
+}
+
+uint64_t LatencyHistogram::bucketHighest(size_t index) {
+    constexpr uint64_t SUB_BUCKETS = uint64_t(1) << SUB_BUCKET_BITS;
+    if (index < 2 * SUB_BUCKETS) {
+        return index;
+    }
+    uint64_t shift = index / SUB_BUCKETS - 1;
+    uint64_t lowest = (index % SUB_BUCKETS + SUB_BUCKETS) << shift;
+    return lowest + (uint64_t(1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    value = std::min(value, MAX_VALUE);
+    buckets_[bucketIndex(value)]++;
+    count_++;
+    sum_ += value;
+    max_ = std::max(max_, value);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < BUCKET_COUNT; i++) {
+        buckets_[i] += other.buckets_[i];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    max_ = std::max(max_, other.max_);
+}
+
+void LatencyHistogram::reset() {
+    *this = LatencyHistogram();
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    if (count_ == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(std::ceil(std::clamp(p, 0.0, 100.0) / 100.0 * count_));
+    rank = std::max<uint64_t>(rank, 1);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; i++) {
+        seen += buckets_[i];
+        if (seen >= rank) {
+            return std::min(bucketHighest(i), max_);
+        }
+    }
+    return max_;
+}
+
+Tracer::Tracer()
+    : id_(next_tracer_id++)
+{
+}
+
+Tracer::~Tracer() = default;
+
+Tracer& Tracer::global() {
+    static Tracer tracer;
+    return tracer;
+}
+
+void Tracer::push(uint64_t frame_id, TraceStage stage, int64_t begin, int64_t end) {
+    ThreadBuffer& buffer = threadBuffer();
+    Event& event = buffer.ring.back();
+    event.frame_id = frame_id;
+    event.begin = begin;
+    event.end = end;
+    event.stage = stage;
+    event.thread = buffer.index;
+    buffer.ring.push();
+}
+
+Tracer::ThreadBuffer& Tracer::threadBuffer() {
+    if (thread_cache.tracer == id_) {
+        return *static_cast<ThreadBuffer*>(thread_cache.buffer);
+    }
+
+    // A thread's first event here, or its first since it recorded
+    // somewhere else. A thread id reused after its thread ended gets that
+    // thread's ring, which then has one producer again.
+    std::lock_guard<std::mutex> lock(buffers_mutex_);
+    std::unique_ptr<ThreadBuffer>& buffer = buffers_[std::this_thread::get_id()];
+    if (!buffer) {
+        buffer = std::make_unique<ThreadBuffer>(static_cast<uint32_t>(buffers_.size()));
+    }
+    thread_cache.tracer = id_;
+    thread_cache.buffer = buffer.get();
+    return *buffer;
+}
+
+void Tracer::collect() {
+    std::lock_guard<std::mutex> lock(collect_mutex_);
+    collected_.clear();
+    {
+        std::lock_guard<std::mutex> buffers_lock(buffers_mutex_);
+        for (auto& entry : buffers_) {
+            while (Event* event = entry.second->ring.pop()) {
+                collected_.push_back(*event);
+            }
+        }
+    }
+
+    // A frame's present and display come from different threads' rings
+    std::sort(collected_.begin(), collected_.end(), [](const Event& a, const Event& b) {
+        return a.begin < b.begin;
+    });
+    for (const Event& event : collected_) {
+        fold(event);
+    }
+}
+
+void Tracer::fold(const Event& event) {
+    if (!instantStage(event.stage)) {
+        stages_[static_cast<size_t>(event.stage)].record(
+            static_cast<uint64_t>(std::max<int64_t>(event.end - event.begin, 0)));
+    }
+
+    if (event.frame_id != 0 && event.stage == TraceStage::PRESENT) {
+        open_frames_[event.frame_id] = event.begin;
+        open_order_.push_back(event.frame_id);
+        if (open_order_.size() > OPEN_FRAMES) {
+            // Never displayed: not streamed, or dropped on the way
+            open_frames_.erase(open_order_.front());
+            open_order_.pop_front();
+        }
+    } else if (event.frame_id != 0 && event.stage == TraceStage::DISPLAY) {
+        auto it = open_frames_.find(event.frame_id);
+        if (it != open_frames_.end()) {
+            int64_t latency = std::max<int64_t>(event.begin - it->second, 0);
+            end_to_end_.record(static_cast<uint64_t>(latency));
+            open_frames_.erase(it);
+        }
+    }
+
+    kept_.push_back(event);
+    if (kept_.size() > KEPT_EVENTS) {
+        kept_.pop_front();
+    }
+}
+
+Tracer::StageReport Tracer::stageReport(TraceStage stage,
+    const LatencyHistogram& histogram) const
+{
+    StageReport report = {};
+    report.stage = stage;
+    report.count = histogram.count();
+    report.p50 = histogram.percentile(50.0);
+    report.p99 = histogram.percentile(99.0);
+    report.p999 = histogram.percentile(99.9);
+    report.max = histogram.max();
+    return report;
+}
+
+Tracer::Report Tracer::report() {
+    collect();
+
+    Report report = {};
+    std::lock_guard<std::mutex> lock(collect_mutex_);
+    for (size_t i = 0; i < TRACE_STAGE_COUNT; i++) {
+        if (stages_[i].count() > 0) {
+            report.stages.push_back(stageReport(static_cast<TraceStage>(i), stages_[i]));
+        }
+    }
+    report.end_to_end = stageReport(TraceStage::PRESENT, end_to_end_);
+
+    std::lock_guard<std::mutex> buffers_lock(buffers_mutex_);
+    for (const auto& entry : buffers_) {
+        report.events_dropped += entry.second->ring.dropped();
+    }
+    return report;
+}
+
+void Tracer::reset() {
+    collect();
+
+    std::lock_guard<std::mutex> lock(collect_mutex_);
+    for (LatencyHistogram& histogram : stages_) {
+        histogram.reset();
+    }
+    end_to_end_.reset();
+    open_frames_.clear();
+    open_order_.clear();
+    kept_.clear();
+}
+
+bool Tracer::writeChromeTrace(const std::string& path, uint32_t process_id,
+    int64_t clock_offset)
+{
+    collect();
+
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+
+    // Complete events for spans, thread-scoped instants for the rest; the
+    // frame id goes in args, where the viewers can search for it
+    std::lock_guard<std::mutex> lock(collect_mutex_);
+    file << "{\"traceEvents\":[";
+    bool first = true;
+    for (const Event& event : kept_) {
+        file << (first ? "\n" : ",\n");
+        first = false;
+        file << "{\"name\":\"" << traceStageName(event.stage) << "\",\"cat\":\"frame\"";
+        if (instantStage(event.stage)) {
+            file << ",\"ph\":\"i\",\"s\":\"t\"";
+        } else {
+            file << ",\"ph\":\"X\",\"dur\":" << std::max<int64_t>(event.end - event.begin, 0);
+        }
+        file << ",\"ts\":" << event.begin + clock_offset << ",\"pid\":" << process_id <<
+            ",\"tid\":" << event.thread << ",\"args\":{\"frame\":" << event.frame_id << "}}";
+    }
+    file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return static_cast<bool>(file);
+}
+
+} // namespace anarchy
@@ -0,0 +1,88 @@
+#include "server/buddy_allocator.hpp"
+#include <algorithm>
+
+namespace anarchy {
+namespace server {
+
+BuddyAllocator::BuddyAllocator(uint64_t size, uint64_t min_size)
+    : size_(size)
+    , min_size_(min_size)
+{
+    uint32_t orders = 1;
+    while (pieceSize(orders - 1) < size_) {
+        orders++;
+    }
+    free_.resize(orders);
+    free_.back().insert(0);
+}
+
+uint32_t BuddyAllocator::orderFor(uint64_t size) const {
+    uint32_t order = 0;
+    while (pieceSize(order) < size) {
+        order++;
+    }
+    return order;
+}
+
+uint64_t BuddyAllocator::allocate(uint64_t size) {
+    if (size == 0 || size > size_) {
+        return INVALID_OFFSET;
+    }
+    uint32_t order = orderFor(size);
+
+    // Smallest free piece that fits, split down to size
+    uint32_t found = order;
+    while (found < free_.size() && free_[found].empty()) {
+        found++;
+    }
+    if (found == free_.size()) {
+        return INVALID_OFFSET;
+    }
+
+    // Lowest address first keeps the top of the block free for large pieces
+    uint64_t offset = *free_[found].begin();
+    free_[found].erase(free_[found].begin());
+    while (found > order) {
+        found--;
+        free_[found].insert(offset + pieceSize(found));
+    }
+
+    allocated_[offset] = order;
+    used_ += pieceSize(order);
+    return offset;
+}
+
+void BuddyAllocator::free(uint64_t offset) {
+    auto it = allocated_.find(offset);
+    if (it == allocated_.end()) {
+        return;
+    }
+    uint32_t order = it->second;
+    allocated_.erase(it);
+    used_ -= pieceSize(order);
+
+    // Merge with the buddy for as long as it is free too
+    while (order + 1 < free_.size()) {
+        uint64_t buddy = offset ^ pieceSize(order);
+        auto free_buddy = free_[order].find(buddy);
+        if (free_buddy == free_[order].end()) {
+            break;
+        }
+        free_[order].erase(free_buddy);
+        offset = std::min(offset, buddy);
+        order++;
+    }
+    free_[order].insert(offset);
+}
+
+uint64_t BuddyAllocator::largestFree() const {
+    for (size_t order = free_.size(); order > 0; order--) {
+        if (!free_[order - 1].empty()) {
+            return pieceSize(static_cast<uint32_t>(order - 1));
+        }
+    }
+    return 0;
+}
+
+} // namespace server
+} // namespace anarchy
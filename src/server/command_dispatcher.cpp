@@ -0,0 +1,136 @@
+#include "server/command_dispatcher.hpp"
+#include <algorithm>
+#include <chrono>
+
+namespace anarchy {
+namespace server {
+
+namespace {
+
+// Idle workers check back this often even if a wakeup was missed
+constexpr auto IDLE_TIMEOUT = std::chrono::milliseconds(1);
+
+// Handles are sequential, so spread them before picking a worker
+size_t workerFor(uint64_t lane, size_t worker_count) {
+    return static_cast<size_t>((lane * 0x9E3779B97F4A7C15ull) >> 32) % worker_count;
+}
+
+} // namespace
+
+CommandDispatcher::CommandDispatcher(Handler handler, size_t worker_count)
+    : handler_(std::move(handler))
+{
+    for (size_t i = 0; i < std::max<size_t>(worker_count, 1); i++) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for (auto& worker : workers_) {
+        worker->thread = std::thread(&CommandDispatcher::run, this, std::ref(*worker));
+    }
+}
+
+CommandDispatcher::~CommandDispatcher() {
+    stop_ = true;
+    for (auto& worker : workers_) {
+        {
+            std::lock_guard<std::mutex> lock(worker->sleep_mutex);
+            worker->wake_cv.notify_one();
+        }
+        worker->thread.join();
+    }
+}
+
+size_t CommandDispatcher::defaultWorkerCount() {
+    unsigned cores = std::thread::hardware_concurrency();
+    return cores > 3 ? cores - 2 : 1;
+}
+
+void CommandDispatcher::dispatch(const network::CommandRecordHeader& record,
+    const uint8_t* payload, uint64_t timestamp, uint64_t lane)
+{
+    if (lane == IN_ORDER) {
+        std::vector<network::CommandFailure> failures;
+        drain(failures);
+        failures_.insert(failures_.end(), failures.begin(), failures.end());
+
+        fill(in_order_, record, payload, timestamp);
+        addFailure(failures_, record.sequence, handler_(in_order_));
+        return;
+    }
+
+    Worker& worker = *workers_[workerFor(lane, workers_.size())];
+    fill(worker.queue.back(), record, payload, timestamp);
+    while (!worker.queue.push()) {
+        // The worker is a full queue behind; its slot is still ours
+        std::this_thread::yield();
+    }
+    worker.dispatched++;
+
+    if (worker.sleeping.load()) {
+        std::lock_guard<std::mutex> lock(worker.sleep_mutex);
+        worker.wake_cv.notify_one();
+    }
+}
+
+void CommandDispatcher::drain(std::vector<network::CommandFailure>& failures) {
+    size_t first = failures.size();
+    for (auto& worker : workers_) {
+        while (worker->completed.load(std::memory_order_acquire) != worker->dispatched) {
+            std::this_thread::yield();
+        }
+        failures.insert(failures.end(), worker->failures.begin(), worker->failures.end());
+        worker->failures.clear();
+    }
+    failures.insert(failures.end(), failures_.begin(), failures_.end());
+    failures_.clear();
+
+    std::sort(failures.begin() + first, failures.end(),
+        [](const network::CommandFailure& a, const network::CommandFailure& b) {
+            return a.sequence < b.sequence;
+        });
+}
+
+void CommandDispatcher::run(Worker& worker) {
+    while (true) {
+        network::Message* command = worker.queue.pop();
+        if (command) {
+            addFailure(worker.failures, command->header.sequence, handler_(*command));
+            worker.completed.fetch_add(1, std::memory_order_release);
+            continue;
+        }
+        if (stop_) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(worker.sleep_mutex);
+        worker.sleeping = true;
+        if (worker.queue.empty() && !stop_) {
+            worker.wake_cv.wait_for(lock, IDLE_TIMEOUT);
+        }
+        worker.sleeping = false;
+    }
+}
+
+void CommandDispatcher::fill(network::Message& command,
+    const network::CommandRecordHeader& record, const uint8_t* payload, uint64_t timestamp) const
+{
+    command.header = network::MessageHeader();
+    command.header.type = record.type;
+    command.header.size = record.size;
+    command.header.sequence = record.sequence;
+    command.header.timestamp = timestamp;
+    command.payload.assign(payload, payload + record.size);
+}
+
+void CommandDispatcher::addFailure(std::vector<network::CommandFailure>& failures,
+    uint64_t sequence, int32_t result) const
+{
+    if (result != 0) {
+        network::CommandFailure failure = {};
+        failure.sequence = sequence;
+        failure.result = result;
+        failures.push_back(failure);
+    }
+}
+
+} // namespace server
+} // namespace anarchy
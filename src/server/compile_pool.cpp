@@ -0,0 +1,76 @@
+#include "server/compile_pool.hpp"
+#include <algorithm>
+
+namespace anarchy {
+namespace server {
+
+CompilePool::CompilePool(size_t thread_count) {
+    thread_count = std::max<size_t>(thread_count, 1);
+    for (size_t i = 0; i < thread_count; i++) {
+        threads_.emplace_back([this] { run(); });
+    }
+}
+
+CompilePool::~CompilePool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+CompilePool::Ticket CompilePool::submit(Task task) {
+    Ticket ticket;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ticket = next_ticket_++;
+        queue_.emplace_back(ticket, std::move(task));
+        pending_.insert(ticket);
+    }
+    work_cv_.notify_one();
+    return ticket;
+}
+
+void CompilePool::wait(Ticket ticket) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this, ticket] { return pending_.count(ticket) == 0; });
+}
+
+void CompilePool::waitAll() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return pending_.empty(); });
+}
+
+size_t CompilePool::pending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_.size();
+}
+
+size_t CompilePool::defaultThreadCount() {
+    return std::max<size_t>(std::thread::hardware_concurrency() / 2, 1);
+}
+
+void CompilePool::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        work_cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            return;     // Stopping, and everything submitted has been taken
+        }
+        auto work = std::move(queue_.front());
+        queue_.pop_front();
+
+        lock.unlock();
+        work.second();
+        lock.lock();
+
+        pending_.erase(work.first);
+        done_cv_.notify_all();
+    }
+}
+
+} // namespace server
+} // namespace anarchy
@@ -0,0 +1,155 @@
+#include "server/gpu_scheduler.hpp"
+#include <algorithm>
+#include <limits>
+
+namespace anarchy {
+namespace server {
+
+GpuScheduler::GpuScheduler(uint32_t max_in_flight)
+    : max_in_flight_(std::max(max_in_flight, 1u))
+{
+}
+
+uint32_t GpuScheduler::weight(Priority priority) {
+    switch (priority) {
+        case Priority::BACKGROUND:
+            return 1;
+        case Priority::INTERACTIVE:
+            return 8;
+        case Priority::NORMAL:
+        default:
+            return 4;
+    }
+}
+
+void GpuScheduler::addSession(uint64_t session, Priority priority) {
+    Session& state = sessions_[session];
+    state.priority = priority;
+    state.removed = false;
+    state.virtual_time = std::max(state.virtual_time, minimumVirtualTime());
+}
+
+void GpuScheduler::removeSession(uint64_t session) {
+    auto it = sessions_.find(session);
+    if (it == sessions_.end()) {
+        return;
+    }
+    it->second.jobs.clear();
+    it->second.removed = true;
+    if (it->second.in_flight == 0) {
+        sessions_.erase(it);
+    }
+}
+
+void GpuScheduler::setPriority(uint64_t session, Priority priority) {
+    auto it = sessions_.find(session);
+    if (it != sessions_.end()) {
+        it->second.priority = priority;
+    }
+}
+
+void GpuScheduler::enqueue(uint64_t session, Job job) {
+    auto it = sessions_.find(session);
+    if (it == sessions_.end()) {
+        addSession(session);
+        it = sessions_.find(session);
+    }
+    Session& state = it->second;
+    if (state.removed) {
+        return;
+    }
+
+    // Time spent idle is not saved up to spend later as a burst
+    if (state.jobs.empty() && state.in_flight == 0) {
+        state.virtual_time = std::max(state.virtual_time, minimumVirtualTime());
+    }
+    state.jobs.push_back(std::move(job));
+}
+
+bool GpuScheduler::next(uint64_t& session, Job& job) {
+    if (in_flight_ >= max_in_flight_) {
+        return false;
+    }
+
+    // Furthest behind its share goes first; ties by id, so the order is
+    // the same every time
+    Session* chosen = nullptr;
+    for (auto& [id, state] : sessions_) {
+        if (state.jobs.empty()) {
+            continue;
+        }
+        if (!chosen || state.virtual_time < chosen->virtual_time ||
+            (state.virtual_time == chosen->virtual_time && id < session)) {
+            chosen = &state;
+            session = id;
+        }
+    }
+    if (!chosen) {
+        return false;
+    }
+
+    job = std::move(chosen->jobs.front());
+    chosen->jobs.pop_front();
+
+    // Charged up front, so a session can't take every slot before its
+    // first completion comes back
+    uint64_t charge = scaled(*chosen, chosen->estimate);
+    chosen->virtual_time += charge;
+    chosen->charged.push_back(charge);
+    chosen->in_flight++;
+    in_flight_++;
+    return true;
+}
+
+void GpuScheduler::complete(uint64_t session, uint64_t gpu_time_ns) {
+    if (in_flight_ > 0) {
+        in_flight_--;
+    }
+    auto it = sessions_.find(session);
+    if (it == sessions_.end() || it->second.in_flight == 0) {
+        return;
+    }
+
+    Session& state = it->second;
+    state.in_flight--;
+    state.virtual_time -= state.charged.front();
+    state.charged.pop_front();
+    state.virtual_time += scaled(state, gpu_time_ns);
+    state.gpu_time += gpu_time_ns;
+    state.estimate = state.estimate == 0 ? gpu_time_ns : (state.estimate * 3 + gpu_time_ns) / 4;
+    if (state.removed && state.in_flight == 0) {
+        sessions_.erase(it);
+    }
+}
+
+bool GpuScheduler::idle(uint64_t session) const {
+    auto it = sessions_.find(session);
+    return it == sessions_.end() || (it->second.jobs.empty() && it->second.in_flight == 0);
+}
+
+size_t GpuScheduler::queued(uint64_t session) const {
+    auto it = sessions_.find(session);
+    return it != sessions_.end() ? it->second.jobs.size() : 0;
+}
+
+uint64_t GpuScheduler::gpuTime(uint64_t session) const {
+    auto it = sessions_.find(session);
+    return it != sessions_.end() ? it->second.gpu_time : 0;
+}
+
+uint64_t GpuScheduler::scaled(const Session& session, uint64_t gpu_time_ns) const {
+    return gpu_time_ns * weight(Priority::INTERACTIVE) / weight(session.priority);
+}
+
+uint64_t GpuScheduler::minimumVirtualTime() const {
+    uint64_t minimum = std::numeric_limits<uint64_t>::max();
+    for (const auto& [id, state] : sessions_) {
+        if (!state.jobs.empty() || state.in_flight > 0) {
+            minimum = std::min(minimum, state.virtual_time);
+        }
+    }
+    return minimum != std::numeric_limits<uint64_t>::max() ? minimum : 0;
+}
+
+} // namespace server
+} // namespace anarchy
@@ -1,4 +1,9 @@
 #include "server/gpu_server.hpp"
+#include "common/network/command_stream.hpp"
+#include "common/network/content_hash.hpp"
+#include "common/tracer.hpp"
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <sstream>
 #include <stdexcept>
@@ -6,17 +11,185 @@
 namespace anarchy {
 namespace server {
 
-GPUServer::GPUServer(const std::string& address)
+namespace {
+
+uint64_t currentTimestamp() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Copy a fixed-size parameter block out of a message payload
+template <typename T>
+T readParams(const network::Message& message) {
+    if (message.payload.size() < sizeof(T)) {
+        throw std::runtime_error("Truncated command payload");
+    }
+    T params;
+    std::memcpy(&params, message.payload.data(), sizeof(T));
+    return params;
+}
+
+// Trailing array of virtual handles after a fixed-size parameter block
+std::vector<uint64_t> readHandles(const network::Message& message, size_t offset, uint32_t count) {
+    if (message.payload.size() < offset + count * sizeof(uint64_t)) {
+        throw std::runtime_error("Truncated handle array");
+    }
+    std::vector<uint64_t> handles(count);
+    if (count > 0) {
+        std::memcpy(handles.data(), message.payload.data() + offset, count * sizeof(uint64_t));
+    }
+    return handles;
+}
+
+template <typename T>
+T resolveHandle(const HandleTable& table, uint64_t virtual_handle) {
+    T handle = table.get<T>(virtual_handle);
+    if (handle == VK_NULL_HANDLE) {
+        throw vk::SystemError(vk::make_error_code(vk::Result::eErrorUnknown),
+            "Unknown handle");
+    }
+    return handle;
+}
+
+// Enough to feed NVENC if the GPU has it; otherwise capture falls back to
+// reading frames back, which any device can do
+std::vector<const char*> captureExtensions(const gpu::VulkanUtils::Instance& instance) {
+    std::vector<const char*> extensions = gpu::FrameCapture::requiredDeviceExtensions();
+    if (!gpu::VulkanUtils::checkDeviceExtensionSupport(instance.getPhysicalDevice(), extensions)) {
+        extensions.clear();
+    }
+    return extensions;
+}
+
+// Stream settings for a new capture
+constexpr uint32_t CAPTURE_FPS = 60;
+constexpr uint32_t CAPTURE_BITRATE = 20000000;
+constexpr uint32_t CAPTURE_GOP_SIZE = 120;
+
+// Hashes in a VK_GET_SHADER_INVENTORY reply; shaders past it are uploaded again
+constexpr size_t MAX_INVENTORY_HASHES =
+    (network::MAX_MESSAGE_SIZE - sizeof(network::ShaderInventory)) / sizeof(network::ContentHash);
+
+// How long the scheduler waits on work in flight before looking for more
+constexpr uint64_t MARKER_WAIT_NS = 500000;
+
+// And a client's fence wait, before checking whether its session is closing
+constexpr uint64_t FENCE_WAIT_SLICE_NS = 100000000;
+
+template <typename T>
+void registerHandle(HandleTable& table, uint64_t virtual_handle, T real_handle) {
+    if (!table.insert(virtual_handle, real_handle)) {
+        throw vk::SystemError(vk::make_error_code(vk::Result::eErrorInitializationFailed),
+            "Invalid or duplicate handle");
+    }
+}
+
+} // namespace
+
+GPUServer::GPUServer(const std::string& address, const std::string& cache_directory)
     : vulkan_instance_(std::make_unique<gpu::VulkanUtils::Instance>())
-    , vulkan_device_(std::make_unique<gpu::VulkanUtils::Device>(*vulkan_instance_))
-    , zmq_(std::make_unique<network::ZMQWrapper>(address, network::ZMQWrapper::Role::SERVER))
+    , vulkan_device_(std::make_unique<gpu::VulkanUtils::Device>(*vulkan_instance_,
+        captureExtensions(*vulkan_instance_)))
+    , memory_allocator_(std::make_unique<MemoryAllocator>(vulkan_device_->get(),
+        vulkan_device_->physical_device_))
+    , shader_cache_(cache_directory)
+    , transport_(network::Transport::create(address, network::Transport::Role::SERVER))
+    , server_address_(address)
+    , last_completion_(std::chrono::steady_clock::now())
     , running_(false)
 {
-    zmq_->start();
+    schedule_thread_ = std::thread(&GPUServer::scheduleThread, this);
+    transport_->setMessageCallback([this](const network::Message& message) {
+        processCommand(message);
+    });
+    transport_->start();
 }
 
 GPUServer::~GPUServer() {
     stop();
+    transport_->stop();
+
+    // Sessions wait for their queue work, which needs the scheduler running
+    std::vector<std::shared_ptr<Session>> sessions;
+    {
+        std::lock_guard<std::mutex> lock(sessions_mutex_);
+        for (auto& entry : sessions_) {
+            sessions.push_back(entry.second);
+        }
+    }
+    for (auto& session : sessions) {
+        closeSession(session);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(schedule_mutex_);
+        stop_scheduling_ = true;
+    }
+    schedule_cv_.notify_all();
+    if (schedule_thread_.joinable()) {
+        schedule_thread_.join();
+    }
+}
+
+MemoryAllocator::Statistics GPUServer::getMemoryStatistics() {
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    return memory_allocator_->getStatistics();
+}
+
+std::vector<GPUServer::SessionStatistics> GPUServer::getSessionStatistics() {
+    std::vector<std::shared_ptr<Session>> sessions;
+    {
+        std::lock_guard<std::mutex> lock(sessions_mutex_);
+        for (auto& entry : sessions_) {
+            sessions.push_back(entry.second);
+        }
+    }
+
+    std::vector<SessionStatistics> statistics;
+    for (auto& session : sessions) {
+        SessionStatistics entry = {};
+        entry.peer = session->peer;
+        entry.handle_count = session->handles.size();
+        entry.frames_sent = session->frame_sequence.load();
+        {
+            std::lock_guard<std::mutex> lock(memory_mutex_);
+            entry.allocation_count = session->allocations.size();
+            entry.memory_bytes = session->memory_bytes;
+        }
+        {
+            std::lock_guard<std::mutex> lock(schedule_mutex_);
+            entry.gpu_time_ns = scheduler_.gpuTime(session->peer);
+        }
+        statistics.push_back(entry);
+    }
+    return statistics;
+}
+
+void GPUServer::setPriority(uint64_t peer, GpuScheduler::Priority priority) {
+    std::lock_guard<std::mutex> lock(schedule_mutex_);
+    scheduler_.setPriority(peer, priority);
+}
+
+void GPUServer::setLatencyProfile(gpu::FrameCapture::LatencyProfile profile) {
+    latency_profile_ = profile;
+}
+
+bool GPUServer::writeTrace(const std::string& path, uint64_t peer) {
+    // Unshifted until heartbeats have crossed: still readable on its own
+    network::ClockSync::Estimate estimate = {};
+    int64_t offset = transport_->getClockEstimate(peer, estimate) ? estimate.offset : 0;
+    return Tracer::global().writeChromeTrace(path, Tracer::SERVER_PROCESS, offset);
+}
+
+const MemoryAllocator::Allocation& GPUServer::findAllocation(const Session& session,
+    uint64_t memory) const
+{
+    auto it = session.allocations.find(memory);
+    if (it == session.allocations.end()) {
+        throw vk::SystemError(vk::make_error_code(vk::Result::eErrorUnknown),
+            "Unknown handle");
+    }
+    return it->second;
 }
 
 void GPUServer::start() {
@@ -27,5 +200,1578 @@ void GPUServer::stop() {
     running_ = false;
 }
 
+bool GPUServer::isRunning() const {
+    return running_;
+}
+
+std::shared_ptr<GPUServer::Session> GPUServer::findSession(uint64_t peer) {
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    auto it = sessions_.find(peer);
+    return it != sessions_.end() ? it->second : nullptr;
+}
+
+std::shared_ptr<GPUServer::Session> GPUServer::openSession(uint64_t peer) {
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    auto it = sessions_.find(peer);
+    if (it != sessions_.end()) {
+        return it->second;
+    }
+    if (sessions_.size() >= MAX_SESSIONS) {
+        return nullptr;
+    }
+
+    // Worker threads are split between the sessions the server can hold
+    auto session = std::make_shared<Session>();
+    Session* state = session.get();
+    state->peer = peer;
+    state->dispatcher = std::make_unique<CommandDispatcher>(
+        [this, state](const network::Message& command) {
+            return runDeferredCommand(*state, command);
+        },
+        std::max<size_t>(CommandDispatcher::defaultWorkerCount() / MAX_SESSIONS, 1));
+    state->encode_thread = std::thread(&GPUServer::encodeThread, this, std::ref(*state));
+    state->wait_thread = std::thread(&GPUServer::waitThread, this, std::ref(*state));
+    {
+        std::lock_guard<std::mutex> schedule_lock(schedule_mutex_);
+        scheduler_.addSession(peer);
+    }
+    sessions_[peer] = session;
+    return session;
+}
+
+void GPUServer::closeSession(const std::shared_ptr<Session>& session) {
+    {
+        std::lock_guard<std::mutex> lock(sessions_mutex_);
+        auto it = sessions_.find(session->peer);
+        if (it == sessions_.end() || it->second != session) {
+            return;     // Closed already
+        }
+        sessions_.erase(it);
+    }
+
+    // Queued work is dropped; what is on the GPU has to finish before
+    // anything it uses goes away
+    {
+        std::lock_guard<std::mutex> lock(schedule_mutex_);
+        scheduler_.removeSession(session->peer);
+    }
+    waitForSession(*session);
+
+    {
+        std::lock_guard<std::mutex> lock(session->wait_mutex);
+        session->stop_waiting = true;
+    }
+    session->wait_cv.notify_all();
+    if (session->wait_thread.joinable()) {
+        session->wait_thread.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(session->frame_mutex);
+        session->stop_encoding = true;
+    }
+    session->capture_cv.notify_all();
+    if (session->encode_thread.joinable()) {
+        session->encode_thread.join();
+    }
+    session->dispatcher.reset();
+    session->capture.reset();
+    session->rate_controller.reset();
+
+    destroySessionObjects(*session);
+}
+
+void GPUServer::destroySessionObjects(Session& session) {
+    // Nothing the client created outlives it. Swapchains own their images.
+    for (auto& entry : session.swapchains) {
+        session.handles.remove(entry.first);
+        for (uint64_t image : entry.second.images) {
+            session.handles.remove(image);
+        }
+    }
+    session.swapchains.clear();
+    session.command_buffer_pools.clear();
+
+    // Command buffers go with their pools
+    vk::Device device = vulkan_device_->get();
+    session.handles.take(network::HandleType::COMMAND_BUFFER);
+    for (uint64_t pool : session.handles.take(network::HandleType::COMMAND_POOL)) {
+        device.destroyCommandPool(reinterpret_cast<VkCommandPool>(pool));
+    }
+    for (uint64_t buffer : session.handles.take(network::HandleType::BUFFER)) {
+        device.destroyBuffer(reinterpret_cast<VkBuffer>(buffer));
+    }
+    for (uint64_t image : session.handles.take(network::HandleType::IMAGE)) {
+        device.destroyImage(reinterpret_cast<VkImage>(image));
+    }
+    for (uint64_t semaphore : session.handles.take(network::HandleType::SEMAPHORE)) {
+        device.destroySemaphore(reinterpret_cast<VkSemaphore>(semaphore));
+    }
+    for (uint64_t fence : session.handles.take(network::HandleType::FENCE)) {
+        device.destroyFence(reinterpret_cast<VkFence>(fence));
+    }
+    for (uint64_t module : session.handles.take(network::HandleType::SHADER_MODULE)) {
+        device.destroyShaderModule(reinterpret_cast<VkShaderModule>(module));
+    }
+    closePipelineCache(session);
+    session.shader_stores.clear();
+    session.shader_key.clear();
+    {
+        std::lock_guard<std::mutex> lock(memory_mutex_);
+        for (auto& entry : session.allocations) {
+            memory_allocator_->free(entry.second);
+        }
+        session.allocations.clear();
+        session.memory_bytes = 0;
+    }
+    session.handles.clear();
+    session.physical_device_handle = 0;
+}
+
+void GPUServer::processCommand(const network::Message& message) {
+    switch (message.header.type) {
+        case network::MessageType::CONNECT:
+            handleConnection(message);
+            return;
+        case network::MessageType::DISCONNECT:
+            handleDisconnection(message);
+            return;
+        case network::MessageType::HEARTBEAT:
+            // Liveness is tracked by the transport
+            return;
+        default:
+            break;
+    }
+
+    // Clients that skip the handshake get a session on first use too
+    std::shared_ptr<Session> session = openSession(message.peer);
+    if (!session) {
+        sendError(message, static_cast<uint32_t>(VK_ERROR_TOO_MANY_OBJECTS),
+            "Server is full");
+        return;
+    }
+
+    switch (message.header.type) {
+        case network::MessageType::FRAME_REQUEST:
+            handleFrameRequest(*session, message);
+            return;
+        case network::MessageType::FRAME_ACK:
+            handleFrameAck(*session, message);
+            return;
+        case network::MessageType::VK_COMMAND_BATCH:
+            handleCommandBatch(*session, message);
+            return;
+        case network::MessageType::VK_WAIT_FOR_FENCES:
+        case network::MessageType::VK_QUEUE_WAIT_IDLE: {
+            // Answered from the session's wait thread
+            std::lock_guard<std::mutex> lock(session->wait_mutex);
+            session->waits.push_back(message);
+            session->wait_cv.notify_one();
+            return;
+        }
+        default:
+            break;
+    }
+
+    // Synchronous Vulkan command: the client is blocked on the reply
+    try {
+        handleVulkanCommand(*session, message);
+    } catch (const vk::SystemError& e) {
+        sendError(message, static_cast<uint32_t>(e.code().value()), e.what());
+    } catch (const std::exception& e) {
+        sendError(message, static_cast<uint32_t>(VK_ERROR_UNKNOWN), e.what());
+    }
+}
+
+void GPUServer::handleVulkanCommand(Session& session, const network::Message& message) {
+    switch (message.header.type) {
+        case network::MessageType::VK_CREATE_INSTANCE:
+            handleCreateInstance(session, message);
+            break;
+        case network::MessageType::VK_DESTROY_INSTANCE:
+            handleDestroyInstance(session, message);
+            break;
+        case network::MessageType::VK_ENUMERATE_PHYSICAL_DEVICES:
+            handleEnumeratePhysicalDevices(session, message);
+            break;
+        case network::MessageType::VK_CREATE_DEVICE:
+            handleCreateDevice(session, message);
+            break;
+        case network::MessageType::VK_DESTROY_DEVICE:
+            handleDestroyDevice(session, message);
+            break;
+        case network::MessageType::VK_GET_DEVICE_QUEUE:
+            handleGetDeviceQueue(session, message);
+            break;
+        case network::MessageType::VK_CREATE_SWAPCHAIN:
+            handleCreateSwapchain(session, message);
+            break;
+        case network::MessageType::VK_DESTROY_SWAPCHAIN:
+            handleDestroySwapchain(session, message);
+            break;
+        case network::MessageType::VK_CREATE_COMMAND_POOL:
+            handleCreateCommandPool(session, message);
+            break;
+        case network::MessageType::VK_DESTROY_COMMAND_POOL:
+            handleDestroyCommandPool(session, message);
+            break;
+        case network::MessageType::VK_CREATE_COMMAND_BUFFER:
+        case network::MessageType::VK_ALLOCATE_COMMAND_BUFFERS:
+            handleAllocateCommandBuffers(session, message);
+            break;
+        case network::MessageType::VK_FREE_COMMAND_BUFFERS:
+            handleFreeCommandBuffers(session, message);
+            break;
+        case network::MessageType::VK_BEGIN_COMMAND_BUFFER:
+            handleBeginCommandBuffer(session, message);
+            break;
+        case network::MessageType::VK_END_COMMAND_BUFFER:
+            handleEndCommandBuffer(session, message);
+            break;
+        case network::MessageType::VK_RESET_COMMAND_BUFFER:
+            handleResetCommandBuffer(session, message);
+            break;
+        case network::MessageType::VK_RECORDING:
+            handleRecording(session, message);
+            break;
+        case network::MessageType::VK_QUEUE_SUBMIT:
+            handleQueueSubmit(session, message);
+            break;
+        case network::MessageType::VK_QUEUE_WAIT_IDLE:
+            handleQueueWaitIdle(session, message);
+            break;
+        case network::MessageType::VK_ACQUIRE_NEXT_IMAGE:
+            handleAcquireNextImage(session, message);
+            break;
+        case network::MessageType::VK_PRESENT:
+            handlePresent(session, message);
+            break;
+        case network::MessageType::VK_CREATE_SHADER_MODULE:
+            handleCreateShaderModule(session, message);
+            break;
+        case network::MessageType::VK_DESTROY_SHADER_MODULE:
+            handleDestroyShaderModule(session, message);
+            break;
+        case network::MessageType::VK_GET_SHADER_INVENTORY:
+            handleGetShaderInventory(session, message);
+            break;
+        case network::MessageType::VK_ALLOCATE_MEMORY:
+            handleAllocateMemory(session, message);
+            break;
+        case network::MessageType::VK_FREE_MEMORY:
+            handleFreeMemory(session, message);
+            break;
+        case network::MessageType::VK_WRITE_MEMORY:
+            handleWriteMemory(session, message);
+            break;
+        case network::MessageType::VK_READ_MEMORY:
+            handleReadMemory(session, message);
+            break;
+        case network::MessageType::VK_CREATE_BUFFER:
+            handleCreateBuffer(session, message);
+            break;
+        case network::MessageType::VK_DESTROY_BUFFER:
+            handleDestroyBuffer(session, message);
+            break;
+        case network::MessageType::VK_BIND_BUFFER_MEMORY:
+            handleBindBufferMemory(session, message);
+            break;
+        case network::MessageType::VK_CREATE_IMAGE:
+            handleCreateImage(session, message);
+            break;
+        case network::MessageType::VK_DESTROY_IMAGE:
+            handleDestroyImage(session, message);
+            break;
+        case network::MessageType::VK_BIND_IMAGE_MEMORY:
+            handleBindImageMemory(session, message);
+            break;
+        case network::MessageType::VK_CREATE_SEMAPHORE:
+            handleCreateSemaphore(session, message);
+            break;
+        case network::MessageType::VK_DESTROY_SEMAPHORE:
+            handleDestroySemaphore(session, message);
+            break;
+        case network::MessageType::VK_CREATE_FENCE:
+            handleCreateFence(session, message);
+            break;
+        case network::MessageType::VK_DESTROY_FENCE:
+            handleDestroyFence(session, message);
+            break;
+        case network::MessageType::VK_WAIT_FOR_FENCES:
+            handleWaitForFences(session, message);
+            break;
+        case network::MessageType::VK_RESET_FENCES:
+            handleResetFences(session, message);
+            break;
+        default:
+            throw vk::SystemError(vk::make_error_code(vk::Result::eErrorFeatureNotPresent),
+                "Unsupported Vulkan command");
+    }
+}
+
+void GPUServer::handleCommandBatch(Session& session, const network::Message& message) {
+    std::vector<network::CommandFailure> failures;
+    uint64_t last_sequence = 0;
+
+    // Recording runs in parallel across command pools, everything else in
+    // the order the client issued it
+    std::vector<uint8_t> resolved;
+    bool well_formed = network::forEachCommandRecord(message,
+        [&](const network::CommandRecordHeader& record, const uint8_t* payload) {
+            last_sequence = record.sequence;
+            if (record.type != network::MessageType::VK_RECORDING &&
+                record.type != network::MessageType::VK_REPLAY_RECORDING) {
+                session.dispatcher->dispatch(record, payload, message.header.timestamp,
+                    commandLane(session, record, payload));
+                return true;
+            }
+
+            // Replays go to the worker as the recording they come to
+            int32_t result = VK_SUCCESS;
+            try {
+                resolveRecording(session, record, payload, resolved);
+            } catch (const vk::SystemError& e) {
+                result = e.code().value();
+            } catch (const std::exception&) {
+                result = VK_ERROR_UNKNOWN;
+            }
+            if (result != VK_SUCCESS) {
+                network::CommandFailure failure = {};
+                failure.sequence = record.sequence;
+                failure.result = result;
+                failures.push_back(failure);
+                return true;
+            }
+            network::CommandRecordHeader recording = record;
+            recording.type = network::MessageType::VK_RECORDING;
+            recording.size = static_cast<uint32_t>(resolved.size());
+            session.dispatcher->dispatch(recording, resolved.data(), message.header.timestamp,
+                commandLane(session, recording, resolved.data()));
+            return true;
+        });
+
+    // Deferred commands don't get individual replies, only failures are reported
+    session.dispatcher->drain(failures);
+    std::sort(failures.begin(), failures.end(),
+        [](const network::CommandFailure& a, const network::CommandFailure& b) {
+            return a.sequence < b.sequence;
+        });
+    if (!well_formed) {
+        network::CommandFailure failure = {};
+        failure.sequence = last_sequence + 1;
+        failure.result = VK_ERROR_DEVICE_LOST;
+        failures.push_back(failure);
+    }
+
+    sendCommandResult(session, message, last_sequence, failures);
+}
+
+int32_t GPUServer::runDeferredCommand(Session& session, const network::Message& command) {
+    try {
+        handleVulkanCommand(session, command);
+    } catch (const vk::SystemError& e) {
+        return e.code().value();
+    } catch (const std::exception&) {
+        return VK_ERROR_UNKNOWN;
+    }
+    return VK_SUCCESS;
+}
+
+uint64_t GPUServer::commandLane(const Session& session,
+    const network::CommandRecordHeader& record, const uint8_t* payload) const
+{
+    switch (record.type) {
+        case network::MessageType::VK_BEGIN_COMMAND_BUFFER:
+        case network::MessageType::VK_END_COMMAND_BUFFER:
+        case network::MessageType::VK_RESET_COMMAND_BUFFER:
+        case network::MessageType::VK_RECORDING:
+            break;
+        default:
+            return CommandDispatcher::IN_ORDER;
+    }
+
+    // Each starts with the command buffer. Vulkan wants the pool externally
+    // synchronized, so the pool is the lane.
+    uint64_t command_buffer = 0;
+    if (record.size < sizeof(command_buffer)) {
+        return CommandDispatcher::IN_ORDER;
+    }
+    std::memcpy(&command_buffer, payload, sizeof(command_buffer));
+    auto it = session.command_buffer_pools.find(command_buffer);
+    return it != session.command_buffer_pools.end() ? it->second : CommandDispatcher::IN_ORDER;
+}
+
+void GPUServer::resolveRecording(Session& session, const network::CommandRecordHeader& record,
+    const uint8_t* payload, std::vector<uint8_t>& resolved)
+{
+    if (record.type == network::MessageType::VK_RECORDING) {
+        network::RecordingParams params = {};
+        if (record.size < sizeof(params)) {
+            throw std::runtime_error("Truncated recording");
+        }
+        std::memcpy(&params, payload, sizeof(params));
+        if (params.recording_id >= network::MAX_RECORDINGS ||
+            params.size > network::MAX_RECORDING_SIZE ||
+            record.size < sizeof(params) + params.size) {
+            throw std::runtime_error("Malformed recording");
+        }
+        const uint8_t* commands = payload + sizeof(params);
+        session.recordings[params.recording_id].assign(commands, commands + params.size);
+        resolved.assign(payload, commands + params.size);
+        return;
+    }
+
+    network::ReplayRecordingParams params = {};
+    if (record.size < sizeof(params)) {
+        throw std::runtime_error("Truncated recording");
+    }
+    std::memcpy(&params, payload, sizeof(params));
+    if (params.recording_id >= network::MAX_RECORDINGS) {
+        throw std::runtime_error("Malformed recording");
+    }
+    std::vector<uint8_t>& slot = session.recordings[params.recording_id];
+    if (slot.empty()) {
+        throw vk::SystemError(vk::make_error_code(vk::Result::eErrorUnknown),
+            "Unknown recording");
+    }
+
+    // The patched bytes stay, as they do in the client's slot
+    size_t offset = sizeof(params);
+    for (uint32_t i = 0; i < params.patch_count; i++) {
+        network::RecordingPatch patch = {};
+        if (record.size - offset < sizeof(patch)) {
+            throw std::runtime_error("Truncated recording patch");
+        }
+        std::memcpy(&patch, payload + offset, sizeof(patch));
+        offset += sizeof(patch);
+        size_t padded = (patch.size + network::COMMAND_RECORD_ALIGNMENT - 1) &
+            ~(network::COMMAND_RECORD_ALIGNMENT - 1);
+        if (patch.offset > slot.size() || patch.size > slot.size() - patch.offset ||
+            record.size - offset < padded) {
+            throw std::runtime_error("Malformed recording patch");
+        }
+        std::memcpy(slot.data() + patch.offset, payload + offset, patch.size);
+        offset += padded;
+    }
+
+    network::RecordingParams recording = {};
+    recording.command_buffer = params.command_buffer;
+    recording.recording_id = params.recording_id;
+    recording.size = static_cast<uint32_t>(slot.size());
+    resolved.resize(sizeof(recording) + slot.size());
+    std::memcpy(resolved.data(), &recording, sizeof(recording));
+    std::memcpy(resolved.data() + sizeof(recording), slot.data(), slot.size());
+}
+
+void GPUServer::scheduleQueueWork(Session& session, const network::Message& message,
+    std::function<void()> work)
+{
+    // Handles were resolved before this, so what can fail here is the
+    // driver; the client hears about it with its next batch
+    Session* state = &session;
+    uint64_t sequence = message.header.sequence;
+    auto job = [this, state, sequence, work = std::move(work)]() {
+        int32_t result = VK_SUCCESS;
+        try {
+            work();
+        } catch (const vk::SystemError& e) {
+            result = e.code().value();
+        } catch (const std::exception&) {
+            result = VK_ERROR_UNKNOWN;
+        }
+        if (result != VK_SUCCESS) {
+            network::CommandFailure failure = {};
+            failure.sequence = sequence;
+            failure.result = result;
+            std::lock_guard<std::mutex> lock(schedule_mutex_);
+            state->late_failures.push_back(failure);
+        }
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(schedule_mutex_);
+        scheduler_.enqueue(session.peer, std::move(job));
+    }
+    schedule_cv_.notify_all();
+}
+
+void GPUServer::waitForSession(const Session& session) {
+    std::unique_lock<std::mutex> lock(schedule_mutex_);
+    schedule_cv_.wait(lock, [&]() { return scheduler_.idle(session.peer); });
+}
+
+void GPUServer::scheduleThread() {
+    VkDevice device = static_cast<VkDevice>(vulkan_device_->get());
+    std::unique_lock<std::mutex> lock(schedule_mutex_);
+    while (!stop_scheduling_) {
+        uint64_t session = 0;
+        GpuScheduler::Job job;
+        if (scheduler_.next(session, job)) {
+            // A job submits what one client command asked for; the marker
+            // after it says when the GPU is done with that
+            lock.unlock();
+            job();
+            VkFence marker = submitMarker();
+            lock.lock();
+            in_flight_.push_back({session, marker, std::chrono::steady_clock::now()});
+            continue;
+        }
+        if (in_flight_.empty()) {
+            schedule_cv_.wait(lock);
+            continue;
+        }
+
+        // Wait on the oldest work in turns, so new work is noticed
+        InFlight oldest = in_flight_.front();
+        lock.unlock();
+        VkResult result = VK_SUCCESS;
+        if (oldest.fence != VK_NULL_HANDLE) {
+            result = vkWaitForFences(device, 1, &oldest.fence, VK_TRUE, MARKER_WAIT_NS);
+        }
+        auto now = std::chrono::steady_clock::now();
+        lock.lock();
+        if (result == VK_TIMEOUT) {
+            continue;
+        }
+
+        // The GPU runs work in submission order, so this work started when
+        // it was submitted or when the work before it finished, if later
+        in_flight_.pop_front();
+        auto started = std::max(oldest.submitted, last_completion_);
+        last_completion_ = now;
+        scheduler_.complete(oldest.session, static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - started).count()));
+        if (oldest.fence != VK_NULL_HANDLE) {
+            vkResetFences(device, 1, &oldest.fence);
+            spare_fences_.push_back(oldest.fence);
+        }
+        schedule_cv_.notify_all();
+    }
+
+    for (const InFlight& work : in_flight_) {
+        if (work.fence != VK_NULL_HANDLE) {
+            vkWaitForFences(device, 1, &work.fence, VK_TRUE, UINT64_MAX);
+            spare_fences_.push_back(work.fence);
+        }
+    }
+    in_flight_.clear();
+    for (VkFence fence : spare_fences_) {
+        vkDestroyFence(device, fence, nullptr);
+    }
+    spare_fences_.clear();
+}
+
+VkFence GPUServer::submitMarker() {
+    VkDevice device = static_cast<VkDevice>(vulkan_device_->get());
+    VkFence fence = VK_NULL_HANDLE;
+    {
+        std::lock_guard<std::mutex> lock(schedule_mutex_);
+        if (!spare_fences_.empty()) {
+            fence = spare_fences_.back();
+            spare_fences_.pop_back();
+        }
+    }
+    if (fence == VK_NULL_HANDLE) {
+        VkFenceCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        if (vkCreateFence(device, &create_info, nullptr, &fence) != VK_SUCCESS) {
+            return VK_NULL_HANDLE;
+        }
+    }
+
+    // An empty submit signals once everything before it is done. Without
+    // one the work counts as done at once, rather than stalling everyone.
+    VkResult result = vkQueueSubmit(static_cast<VkQueue>(vulkan_device_->getGraphicsQueue()),
+        0, nullptr, fence);
+    if (result != VK_SUCCESS) {
+        std::lock_guard<std::mutex> lock(schedule_mutex_);
+        spare_fences_.push_back(fence);
+        return VK_NULL_HANDLE;
+    }
+    return fence;
+}
+
+void GPUServer::waitThread(Session& session) {
+    std::unique_lock<std::mutex> lock(session.wait_mutex);
+    for (;;) {
+        session.wait_cv.wait(lock, [&session]() {
+            return !session.waits.empty() || session.stop_waiting;
+        });
+        if (session.stop_waiting) {
+            return;
+        }
+        network::Message message = std::move(session.waits.front());
+        session.waits.pop_front();
+        lock.unlock();
+
+        try {
+            handleVulkanCommand(session, message);
+        } catch (const vk::SystemError& e) {
+            sendError(message, static_cast<uint32_t>(e.code().value()), e.what());
+        } catch (const std::exception& e) {
+            sendError(message, static_cast<uint32_t>(VK_ERROR_UNKNOWN), e.what());
+        }
+        lock.lock();
+    }
+}
+
+void GPUServer::handleFrameRequest(Session& session, const network::Message& message) {
+    uint64_t swapchain = 0;
+    if (message.payload.size() >= sizeof(network::FrameRequest)) {
+        swapchain = readParams<network::FrameRequest>(message).swapchain;
+    }
+
+    // Every present of the swapchain streams from now on, starting with the
+    // image it presented last
+    {
+        std::lock_guard<std::mutex> lock(session.frame_mutex);
+        session.streaming = true;
+        session.streamed_swapchain = swapchain;
+    }
+
+    // The capture is queue work like the client's own
+    Session* state = &session;
+    network::Message request;
+    request.header = message.header;
+    request.peer = message.peer;
+    scheduleQueueWork(session, message, [this, state, swapchain, request]() {
+        std::lock_guard<std::mutex> lock(state->frame_mutex);
+        auto it = state->frame_states.find(swapchain != 0 ? swapchain : state->last_presented);
+        if (it == state->frame_states.end()) {
+            return;     // Nothing presented yet
+        }
+        if (!queueCapture(*state, it->second)) {
+            state->streaming = false;
+            sendError(request, static_cast<uint32_t>(VK_ERROR_INITIALIZATION_FAILED),
+                "No frame capture backend");
+        }
+    });
+}
+
+void GPUServer::handleFrameAck(Session& session, const network::Message& message) {
+    std::lock_guard<std::mutex> lock(session.frame_mutex);
+    if (session.rate_controller) {
+        session.rate_controller->onFrameAck(message.header.sequence);
+    }
+}
+
+bool GPUServer::queueCapture(Session& session, const FrameState& state) {
+    if (!prepareCapture(session, state)) {
+        return false;
+    }
+
+    network::RateController::Decision decision = session.rate_controller->update();
+    if (decision.bitrate_changed) {
+        session.capture->setBitrate(decision.bitrate);
+    }
+    if (decision.resolution_changed) {
+        session.capture->setResolution(decision.width, decision.height);
+    }
+
+    // Only records and submits the copy; false means every slot is busy and
+    // the frame is dropped
+    if (session.capture->captureFrame(static_cast<VkImage>(state.image), state.frame_id)) {
+        session.captures_pending++;
+        session.capture_cv.notify_one();
+    }
+    return true;
+}
+
+void GPUServer::encodeThread(Session& session) {
+    std::unique_lock<std::mutex> lock(session.frame_mutex);
+    for (;;) {
+        session.capture_cv.wait(lock, [&session]() {
+            return session.captures_pending > 0 || session.stop_encoding;
+        });
+        if (session.stop_encoding) {
+            return;
+        }
+        session.captures_pending = 0;
+        std::shared_ptr<gpu::CaptureEngine> capture = session.capture;
+        std::shared_ptr<network::RateController> rate_controller = session.rate_controller;
+        lock.unlock();
+
+        if (capture) {
+            sendFrames(session, *capture, *rate_controller);
+        }
+
+        // An engine replaced meanwhile is destroyed here, outside the lock
+        capture.reset();
+        rate_controller.reset();
+        lock.lock();
+    }
+}
+
+void GPUServer::sendFrames(Session& session, gpu::CaptureEngine& capture,
+    network::RateController& rate_controller)
+{
+    // Everything captured so far, which with a pipelined backend includes
+    // frames captured before the last wakeup
+    std::vector<uint8_t> frame_data;
+    bool end_of_frame = true;
+    uint64_t frame_id = 0;
+    while (capture.getEncodedFrame(frame_data, &end_of_frame, &frame_id)) {
+        uint64_t sequence = session.frame_sequence.load();
+        network::Message frame;
+        frame.header.type = network::MessageType::FRAME_DATA;
+        frame.header.sequence = sequence;
+        frame.header.request_id = frame_id;
+        frame.header.timestamp = currentTimestamp();
+        frame.header.setFrameEncoding(capture.encoding());
+        if (!end_of_frame) {
+            frame.header.flags |= network::HEADER_FLAG_PARTIAL_FRAME;
+        }
+        frame.header.size = static_cast<uint32_t>(frame_data.size());
+        frame.payload = std::move(frame_data);
+        frame.peer = session.peer;
+        transport_->sendMessage(std::move(frame));
+
+        frame_data.clear();
+        if (end_of_frame) {
+            Tracer::global().instant(frame_id, TraceStage::SEND);
+            rate_controller.onFrameSent(sequence);
+            session.frame_sequence.store(sequence + 1);
+        }
+    }
+}
+
+bool GPUServer::prepareCapture(Session& session, const FrameState& state) {
+    gpu::FrameCapture::LatencyProfile profile = latency_profile_;
+    if (session.capture && session.capture_state.format == state.format &&
+        session.capture_state.width == state.width &&
+        session.capture_state.height == state.height && session.capture_profile == profile) {
+        return true;
+    }
+
+    // A new swapchain size or format needs new slots
+    session.capture.reset();
+
+    gpu::FrameCapture::CaptureConfig config = {};
+    config.width = state.width;
+    config.height = state.height;
+    config.format = static_cast<VkFormat>(state.format);
+    config.fps = CAPTURE_FPS;
+    config.bitrate = CAPTURE_BITRATE;
+    config.gop_size = CAPTURE_GOP_SIZE;
+    config.codec = gpu::FrameCapture::Codec::H264;
+    config.hardware_encoding = true;
+    config.latency_profile = profile;
+
+    // Each session encodes its own stream
+    auto capture = std::make_shared<gpu::CaptureEngine>(config);
+    if (!capture->initialize(vulkan_device_->get(), vulkan_device_->physical_device_,
+            vulkan_device_->getGraphicsQueueFamily())) {
+        return false;
+    }
+    session.capture = std::move(capture);
+    session.capture_state = state;
+    session.capture_profile = profile;
+
+    network::RateControlConfig rate_config = {};
+    rate_config.width = state.width;
+    rate_config.height = state.height;
+    rate_config.fps = CAPTURE_FPS;
+    rate_config.start_bitrate = CAPTURE_BITRATE;
+    session.rate_controller = std::make_shared<network::RateController>(rate_config);
+    return true;
+}
+
+void GPUServer::handleCreateInstance(Session& session, const network::Message& message) {
+    auto& params = decodeParams<network::CreateInstanceParams>(session, message);
+
+    // Every client instance is backed by the server's own instance
+    registerHandle(session.handles, params.instance,
+        static_cast<VkInstance>(vulkan_instance_->get()));
+
+    // Shaders and pipelines are cached per application, per driver
+    const VkApplicationInfo* application = params.create_info.pApplicationInfo;
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(
+        static_cast<VkPhysicalDevice>(vulkan_instance_->getPhysicalDevice()), &properties);
+    session.shader_key = ShaderCache::applicationKey(
+        application && application->pApplicationName ? application->pApplicationName : "",
+        application ? application->applicationVersion : 0,
+        application && application->pEngineName ? application->pEngineName : "",
+        application ? application->engineVersion : 0,
+        properties.pipelineCacheUUID, properties.driverVersion);
+    openPipelineCache(session);
+}
+
+void GPUServer::handleDestroyInstance(Session& session, const network::Message& message) {
+    auto params = readParams<network::DestroyObjectParams>(message);
+    session.handles.remove(params.object);
+}
+
+void GPUServer::handleEnumeratePhysicalDevices(Session& session, const network::Message& message) {
+    auto instance = readParams<uint64_t>(message);
+    resolveHandle<VkInstance>(session.handles, instance);
+
+    // Only the physical device backing vulkan_device_ is exposed
+    if (session.physical_device_handle == 0) {
+        session.physical_device_handle = session.handles.allocate(
+            network::HandleType::PHYSICAL_DEVICE,
+            static_cast<VkPhysicalDevice>(vulkan_instance_->getPhysicalDevice()));
+    }
+
+    network::PhysicalDeviceList list = {};
+    list.count = 1;
+    list.physical_devices[0] = session.physical_device_handle;
+    list.readback_memory_types[0] = memory_allocator_->readbackMemoryTypes();
+
+    std::vector<uint8_t> response(sizeof(list));
+    std::memcpy(response.data(), &list, sizeof(list));
+    sendResponse(message, response);
+}
+
+void GPUServer::handleCreateDevice(Session& session, const network::Message& message) {
+    auto& params = decodeParams<network::CreateDeviceParams>(session, message);
+    resolveHandle<VkPhysicalDevice>(session.handles, params.physical_device);
+
+    // Client devices share the server device, so the decoded queue and
+    // extension requests aren't applied
+    registerHandle(session.handles, params.device, static_cast<VkDevice>(vulkan_device_->get()));
+}
+
+void GPUServer::handleDestroyDevice(Session& session, const network::Message& message) {
+    auto params = readParams<network::DestroyObjectParams>(message);
+    session.handles.remove(params.object);
+}
+
+void GPUServer::handleGetDeviceQueue(Session& session, const network::Message& message) {
+    auto params = readParams<network::GetDeviceQueueParams>(message);
+    resolveHandle<VkDevice>(session.handles, params.device);
+    registerHandle(session.handles, params.queue,
+        static_cast<VkQueue>(vulkan_device_->getGraphicsQueue()));
+}
+
+void GPUServer::handleCreateSwapchain(Session& session, const network::Message& message) {
+    auto& params = decodeParams<network::CreateSwapchainParams>(session, message);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.device));
+
+    // There is no surface here; the images are offscreen and presents are captured
+    auto swapchain = std::make_unique<VirtualSwapchain>(params.swapchain, device,
+        vulkan_device_->physical_device_, params.create_info, params.image_count);
+    SwapchainState state;
+    registerHandle(session.handles, params.swapchain, swapchain.get());
+    for (uint32_t i = 0; i < params.image_count; i++) {
+        registerHandle(session.handles, params.images[i],
+            static_cast<VkImage>(swapchain->image(i)));
+        state.images.push_back(params.images[i]);
+    }
+    state.swapchain = std::move(swapchain);
+    session.swapchains[params.swapchain] = std::move(state);
+}
+
+void GPUServer::handleDestroySwapchain(Session& session, const network::Message& message) {
+    auto params = readParams<network::DestroyObjectParams>(message);
+    auto it = session.swapchains.find(params.object);
+    if (it == session.swapchains.end()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(session.frame_mutex);
+        session.frame_states.erase(params.object);
+        if (session.last_presented == params.object) {
+            session.last_presented = 0;
+        }
+    }
+
+    // A capture copy may still be reading the images, or a present queued
+    waitForSession(session);
+    session.handles.remove(params.object);
+    for (uint64_t image : it->second.images) {
+        session.handles.remove(image);
+    }
+    session.swapchains.erase(it);
+}
+
+void GPUServer::handleAcquireNextImage(Session& session, const network::Message& message) {
+    auto params = readParams<network::AcquireNextImageParams>(message);
+    auto* swapchain = resolveHandle<VirtualSwapchain*>(session.handles, params.swapchain);
+    VkSemaphore semaphore = params.semaphore ?
+        resolveHandle<VkSemaphore>(session.handles, params.semaphore) : VK_NULL_HANDLE;
+    VkFence fence = params.fence ?
+        resolveHandle<VkFence>(session.handles, params.fence) : VK_NULL_HANDLE;
+    VkQueue queue = static_cast<VkQueue>(vulkan_device_->getGraphicsQueue());
+    uint32_t image_index = params.image_index;
+
+    scheduleQueueWork(session, message, [swapchain, semaphore, fence, queue, image_index]() {
+        swapchain->acquire(image_index);
+
+        // The image is free once everything submitted before it is done,
+        // including the copy of its last present, so an empty batch signals
+        if (semaphore == VK_NULL_HANDLE && fence == VK_NULL_HANDLE) {
+            return;
+        }
+        VkSubmitInfo submit = {};
+        submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit.signalSemaphoreCount = semaphore != VK_NULL_HANDLE ? 1 : 0;
+        submit.pSignalSemaphores = &semaphore;
+        VkResult result = vkQueueSubmit(queue, submit.signalSemaphoreCount, &submit, fence);
+        if (result != VK_SUCCESS) {
+            throw vk::SystemError(vk::make_error_code(static_cast<vk::Result>(result)),
+                "vkAcquireNextImageKHR");
+        }
+    });
+}
+
+void GPUServer::handlePresent(Session& session, const network::Message& message) {
+    // Once a frame is often enough to notice the pipeline cache is due
+    if (std::chrono::steady_clock::now() - session.pipeline_cache_flushed >=
+            PIPELINE_CACHE_FLUSH_INTERVAL) {
+        flushPipelineCache(session);
+    }
+
+    // Decoded into storage the job keeps, since it runs later
+    auto arena = std::make_shared<std::vector<uint8_t>>();
+    auto* params = &decodeParams<network::QueuePresentParams>(session, message, arena.get());
+    VkQueue queue = resolveHandle<VkQueue>(session.handles, params->queue);
+    for (uint32_t i = 0; i < params->present_info.swapchainCount; i++) {
+        // Decoded to the VirtualSwapchain registered under the client's handle
+        if (params->present_info.pSwapchains[i] == VK_NULL_HANDLE) {
+            throw vk::SystemError(vk::make_error_code(vk::Result::eErrorUnknown),
+                "Unknown handle");
+        }
+    }
+
+    Session* state = &session;
+    int64_t arrived = Tracer::now();
+    scheduleQueueWork(session, message, [this, state, arena, params, queue, arrived]() {
+        const VkPresentInfoKHR& present_info = params->present_info;
+
+        // Capture waits for rendering the way a presentation engine would: an
+        // empty batch takes the wait, and submission order carries it over to
+        // the copy submitted after it
+        if (present_info.waitSemaphoreCount > 0) {
+            std::vector<VkPipelineStageFlags> stages(present_info.waitSemaphoreCount,
+                VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+            VkSubmitInfo submit = {};
+            submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submit.waitSemaphoreCount = present_info.waitSemaphoreCount;
+            submit.pWaitSemaphores = present_info.pWaitSemaphores;
+            submit.pWaitDstStageMask = stages.data();
+            VkResult result = vkQueueSubmit(queue, 1, &submit, VK_NULL_HANDLE);
+            if (result != VK_SUCCESS) {
+                throw vk::SystemError(vk::make_error_code(static_cast<vk::Result>(result)),
+                    "vkQueuePresentKHR");
+            }
+        }
+
+        for (uint32_t i = 0; i < present_info.swapchainCount; i++) {
+            auto* swapchain = reinterpret_cast<VirtualSwapchain*>(present_info.pSwapchains[i]);
+            uint32_t index = present_info.pImageIndices[i];
+            swapchain->present(index);
+
+            FrameState frame = {};
+            frame.image = swapchain->image(index);
+            frame.format = swapchain->format();
+            frame.width = swapchain->extent().width;
+            frame.height = swapchain->extent().height;
+            frame.frame_id = params->frame_id;
+
+            std::lock_guard<std::mutex> lock(state->frame_mutex);
+            state->frame_states[swapchain->handle()] = frame;
+            state->last_presented = swapchain->handle();
+            if (state->streaming && (state->streamed_swapchain == 0 ||
+                    state->streamed_swapchain == swapchain->handle()) &&
+                !queueCapture(*state, frame)) {
+                state->streaming = false;   // The application keeps running, unseen
+            }
+        }
+        Tracer::global().span(params->frame_id, TraceStage::EXECUTE, arrived, Tracer::now());
+    });
+}
+
+void GPUServer::handleCreateShaderModule(Session& session, const network::Message& message) {
+    auto params = readParams<network::CreateShaderModuleParams>(message);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.device));
+
+    std::vector<uint8_t> code;
+    if (params.has_code) {
+        if (message.payload.size() < sizeof(params) + params.code_size) {
+            throw std::runtime_error("Truncated shader code");
+        }
+        const uint8_t* begin = message.payload.data() + sizeof(params);
+        code.assign(begin, begin + params.code_size);
+        if (network::hashContent(code.data(), code.size()) != params.hash) {
+            throw std::runtime_error("Shader code doesn't match its hash");
+        }
+    } else {
+        // Sent earlier this session, its store may still be on the pool
+        auto it = session.shader_stores.find(params.hash);
+        if (it != session.shader_stores.end()) {
+            compile_pool_.wait(it->second);
+        }
+        if (!shader_cache_.loadShader(session.shader_key, params.hash, code)) {
+            throw vk::SystemError(vk::make_error_code(vk::Result::eErrorInitializationFailed),
+                "Unknown shader");
+        }
+    }
+
+    vk::ShaderModuleCreateInfo create_info(
+        static_cast<vk::ShaderModuleCreateFlags>(params.flags), code.size(),
+        reinterpret_cast<const uint32_t*>(code.data()));
+    vk::ShaderModule module = device.createShaderModule(create_info);
+    registerHandle(session.handles, params.shader_module, static_cast<VkShaderModule>(module));
+
+    // Kept for the next run, without holding up the stream for the disk
+    if (params.has_code && !session.shader_stores.count(params.hash)) {
+        auto stored = std::make_shared<std::vector<uint8_t>>(std::move(code));
+        std::string key = session.shader_key;
+        network::ContentHash hash = params.hash;
+        session.shader_stores[hash] = compile_pool_.submit([this, key, hash, stored]() {
+            shader_cache_.storeShader(key, hash, stored->data(), stored->size());
+        });
+    }
+}
+
+void GPUServer::handleDestroyShaderModule(Session& session, const network::Message& message) {
+    auto params = readParams<network::DestroyObjectParams>(message);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.parent));
+    auto module = reinterpret_cast<VkShaderModule>(session.handles.remove(params.object));
+    if (module != VK_NULL_HANDLE) {
+        device.destroyShaderModule(module);
+    }
+}
+
+void GPUServer::handleGetShaderInventory(Session& session, const network::Message& message) {
+    auto device = readParams<uint64_t>(message);
+    resolveHandle<VkDevice>(session.handles, device);
+
+    std::vector<network::ContentHash> hashes = shader_cache_.shaders(session.shader_key);
+    hashes.resize(std::min(hashes.size(), MAX_INVENTORY_HASHES));
+
+    network::ShaderInventory inventory = {};
+    inventory.count = static_cast<uint32_t>(hashes.size());
+    std::vector<uint8_t> response(sizeof(inventory) + hashes.size() * sizeof(network::ContentHash));
+    std::memcpy(response.data(), &inventory, sizeof(inventory));
+    if (!hashes.empty()) {
+        std::memcpy(response.data() + sizeof(inventory), hashes.data(),
+            hashes.size() * sizeof(network::ContentHash));
+    }
+    sendResponse(message, response);
+}
+
+void GPUServer::openPipelineCache(Session& session) {
+    closePipelineCache(session);    // The client created another instance
+
+    // Drivers ignore data from another driver or version, so whatever is
+    // on disk can be handed over
+    std::vector<uint8_t> data;
+    shader_cache_.loadPipelineCache(session.shader_key, data);
+    vk::PipelineCacheCreateInfo create_info({}, data.size(), data.data());
+    session.pipeline_cache = vulkan_device_->get().createPipelineCache(create_info);
+    session.pipeline_cache_stored = data.size();
+    session.pipeline_cache_flushed = std::chrono::steady_clock::now();
+}
+
+void GPUServer::flushPipelineCache(Session& session) {
+    session.pipeline_cache_flushed = std::chrono::steady_clock::now();
+    if (!session.pipeline_cache) {
+        return;
+    }
+
+    // Reading the data back takes the driver a while for a big cache
+    VkDevice device = static_cast<VkDevice>(vulkan_device_->get());
+    VkPipelineCache pipeline_cache = static_cast<VkPipelineCache>(session.pipeline_cache);
+    std::string key = session.shader_key;
+    Session* state = &session;
+    session.pipeline_cache_flush = compile_pool_.submit(
+        [this, device, pipeline_cache, key, state]() {
+            size_t size = 0;
+            if (vkGetPipelineCacheData(device, pipeline_cache, &size, nullptr) != VK_SUCCESS) {
+                return;
+            }
+            std::vector<uint8_t> data(size);
+            if (vkGetPipelineCacheData(device, pipeline_cache, &size, data.data()) != VK_SUCCESS) {
+                return;
+            }
+            data.resize(size);
+
+            // Caches only grow, so the same size is the same cache
+            if (size != state->pipeline_cache_stored &&
+                shader_cache_.storePipelineCache(key, data)) {
+                state->pipeline_cache_stored = size;
+            }
+        });
+}
+
+void GPUServer::closePipelineCache(Session& session) {
+    if (!session.pipeline_cache) {
+        return;
+    }
+    flushPipelineCache(session);
+    compile_pool_.wait(session.pipeline_cache_flush);
+    vulkan_device_->get().destroyPipelineCache(session.pipeline_cache);
+    session.pipeline_cache = nullptr;
+}
+
+void GPUServer::handleCreateCommandPool(Session& session, const network::Message& message) {
+    auto& params = decodeParams<network::CreateCommandPoolParams>(session, message);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.device));
+
+    // The server device exposes a single queue family
+    vk::CommandPoolCreateInfo create_info(
+        static_cast<vk::CommandPoolCreateFlags>(params.create_info.flags),
+        vulkan_device_->getGraphicsQueueFamily());
+    vk::CommandPool command_pool = device.createCommandPool(create_info);
+    registerHandle(session.handles, params.command_pool, static_cast<VkCommandPool>(command_pool));
+}
+
+void GPUServer::handleDestroyCommandPool(Session& session, const network::Message& message) {
+    auto params = readParams<network::DestroyObjectParams>(message);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.parent));
+    auto command_pool = reinterpret_cast<VkCommandPool>(session.handles.remove(params.object));
+    if (command_pool != VK_NULL_HANDLE) {
+        device.destroyCommandPool(command_pool);
+    }
+
+    // Its command buffers went with it
+    auto& pools = session.command_buffer_pools;
+    for (auto it = pools.begin(); it != pools.end();) {
+        it = it->second == params.object ? pools.erase(it) : std::next(it);
+    }
+}
+
+void GPUServer::handleAllocateCommandBuffers(Session& session, const network::Message& message) {
+    auto params = readParams<network::AllocateCommandBuffersParams>(message);
+    auto virtual_handles = readHandles(message, sizeof(params), params.command_buffer_count);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.device));
+    vk::CommandPool command_pool(
+        resolveHandle<VkCommandPool>(session.handles, params.command_pool));
+
+    vk::CommandBufferAllocateInfo allocate_info(command_pool,
+        static_cast<vk::CommandBufferLevel>(params.level), params.command_buffer_count);
+    auto command_buffers = device.allocateCommandBuffers(allocate_info);
+    for (size_t i = 0; i < command_buffers.size(); ++i) {
+        registerHandle(session.handles, virtual_handles[i],
+            static_cast<VkCommandBuffer>(command_buffers[i]));
+        session.command_buffer_pools[virtual_handles[i]] = params.command_pool;
+    }
+}
+
+void GPUServer::handleFreeCommandBuffers(Session& session, const network::Message& message) {
+    auto params = readParams<network::FreeCommandBuffersParams>(message);
+    auto virtual_handles = readHandles(message, sizeof(params), params.command_buffer_count);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.device));
+    vk::CommandPool command_pool(
+        resolveHandle<VkCommandPool>(session.handles, params.command_pool));
+
+    std::vector<vk::CommandBuffer> command_buffers;
+    for (uint64_t handle : virtual_handles) {
+        session.command_buffer_pools.erase(handle);
+        auto command_buffer = reinterpret_cast<VkCommandBuffer>(session.handles.remove(handle));
+        if (command_buffer != VK_NULL_HANDLE) {
+            command_buffers.push_back(command_buffer);
+        }
+    }
+    if (!command_buffers.empty()) {
+        device.freeCommandBuffers(command_pool, command_buffers);
+    }
+}
+
+void GPUServer::handleBeginCommandBuffer(Session& session, const network::Message& message) {
+    auto& params = decodeParams<network::BeginCommandBufferParams>(session, message);
+    vk::CommandBuffer command_buffer(
+        resolveHandle<VkCommandBuffer>(session.handles, params.command_buffer));
+
+    command_buffer.begin(vk::CommandBufferBeginInfo(params.begin_info));
+}
+
+void GPUServer::handleEndCommandBuffer(Session& session, const network::Message& message) {
+    auto handle = readParams<uint64_t>(message);
+    vk::CommandBuffer command_buffer(resolveHandle<VkCommandBuffer>(session.handles, handle));
+    command_buffer.end();
+}
+
+void GPUServer::handleResetCommandBuffer(Session& session, const network::Message& message) {
+    auto params = readParams<network::ResetCommandBufferParams>(message);
+    vk::CommandBuffer command_buffer(
+        resolveHandle<VkCommandBuffer>(session.handles, params.command_buffer));
+    command_buffer.reset(static_cast<vk::CommandBufferResetFlags>(params.flags));
+}
+
+void GPUServer::handleRecording(Session& session, const network::Message& message) {
+    // Resolved from the slot by handleCommandBatch, which is the only way
+    // recordings arrive
+    auto params = readParams<network::RecordingParams>(message);
+    if (message.payload.size() < sizeof(params) + params.size) {
+        throw std::runtime_error("Truncated recording");
+    }
+
+    // Each command gets back the command buffer packing left out
+    static thread_local network::Message command;
+    bool well_formed = network::forEachCommandRecord(message.payload.data() + sizeof(params),
+        params.size, [&](const network::CommandRecordHeader& record, const uint8_t* payload) {
+            switch (record.type) {
+                case network::MessageType::VK_BEGIN_COMMAND_BUFFER:
+                case network::MessageType::VK_END_COMMAND_BUFFER:
+                    break;
+                default:
+                    throw vk::SystemError(vk::make_error_code(vk::Result::eErrorFeatureNotPresent),
+                        "Unsupported command in recording");
+            }
+            if (record.size < sizeof(params.command_buffer)) {
+                throw std::runtime_error("Truncated command payload");
+            }
+            command.header = network::MessageHeader();
+            command.header.type = record.type;
+            command.header.size = record.size;
+            command.header.sequence = message.header.sequence;
+            command.header.timestamp = message.header.timestamp;
+            command.peer = message.peer;
+            command.payload.assign(payload, payload + record.size);
+            std::memcpy(command.payload.data(), &params.command_buffer,
+                sizeof(params.command_buffer));
+            handleVulkanCommand(session, command);
+            return true;
+        });
+    if (!well_formed) {
+        throw std::runtime_error("Malformed recording");
+    }
+}
+
+void GPUServer::handleQueueSubmit(Session& session, const network::Message& message) {
+    // Decoded into storage the job keeps, since it runs later
+    auto arena = std::make_shared<std::vector<uint8_t>>();
+    auto* params = &decodeParams<network::QueueSubmitParams>(session, message, arena.get());
+    VkQueue queue = resolveHandle<VkQueue>(session.handles, params->queue);
+    VkFence fence = params->fence ?
+        resolveHandle<VkFence>(session.handles, params->fence) : VK_NULL_HANDLE;
+
+    scheduleQueueWork(session, message, [arena, params, queue, fence]() {
+        // Submit infos were decoded in place with their handles already translated
+        VkResult result = vkQueueSubmit(queue, params->submit_count, params->submits, fence);
+        if (result != VK_SUCCESS) {
+            throw vk::SystemError(vk::make_error_code(static_cast<vk::Result>(result)),
+                "vkQueueSubmit");
+        }
+    });
+}
+
+void GPUServer::handleQueueWaitIdle(Session& session, const network::Message& message) {
+    auto handle = readParams<uint64_t>(message);
+    resolveHandle<VkQueue>(session.handles, handle);
+
+    // Only this client's work; the others' keeps running
+    waitForSession(session);
+    sendResponse(message, {});
+}
+
+void GPUServer::handleAllocateMemory(Session& session, const network::Message& message) {
+    auto& params = decodeParams<network::AllocateMemoryParams>(session, message);
+    resolveHandle<VkDevice>(session.handles, params.device);
+
+    // A piece of a shared block, usually without calling into the driver
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    MemoryAllocator::Allocation allocation = memory_allocator_->allocate(params.allocate_info);
+    if (!session.handles.insert(params.memory, static_cast<VkDeviceMemory>(allocation.memory))) {
+        memory_allocator_->free(allocation);
+        throw vk::SystemError(vk::make_error_code(vk::Result::eErrorInitializationFailed),
+            "Invalid or duplicate handle");
+    }
+    session.allocations[params.memory] = allocation;
+    session.memory_bytes += allocation.size;
+}
+
+void GPUServer::handleFreeMemory(Session& session, const network::Message& message) {
+    auto params = readParams<network::DestroyObjectParams>(message);
+    resolveHandle<VkDevice>(session.handles, params.parent);
+    session.handles.remove(params.object);
+
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    auto it = session.allocations.find(params.object);
+    if (it != session.allocations.end()) {
+        session.memory_bytes -= it->second.size;
+        memory_allocator_->free(it->second);
+        session.allocations.erase(it);
+    }
+}
+
+void GPUServer::handleWriteMemory(Session& session, const network::Message& message) {
+    auto params = readParams<network::WriteMemoryParams>(message);
+    resolveHandle<VkDevice>(session.handles, params.device);
+
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    const MemoryAllocator::Allocation& allocation = findAllocation(session, params.memory);
+    if (allocation.mapped == nullptr) {
+        throw vk::SystemError(vk::make_error_code(vk::Result::eErrorMemoryMapFailed),
+            "Write to memory that is not host visible");
+    }
+    if (params.offset > allocation.size || params.size > allocation.size - params.offset ||
+        message.payload.size() < sizeof(params) + params.size) {
+        throw std::runtime_error("Truncated memory write");
+    }
+
+    // Host-visible memory stays mapped, so an upload is a copy
+    std::memcpy(allocation.mapped + params.offset, message.payload.data() + sizeof(params),
+        static_cast<size_t>(params.size));
+    memory_allocator_->flush(allocation, params.offset, params.size);
+}
+
+void GPUServer::handleReadMemory(Session& session, const network::Message& message) {
+    auto params = readParams<network::ReadMemoryParams>(message);
+    resolveHandle<VkDevice>(session.handles, params.device);
+
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    const MemoryAllocator::Allocation& allocation = findAllocation(session, params.memory);
+    if (allocation.mapped == nullptr) {
+        throw vk::SystemError(vk::make_error_code(vk::Result::eErrorMemoryMapFailed),
+            "Read from memory that is not host visible");
+    }
+    if (params.offset > allocation.size || params.size > allocation.size - params.offset) {
+        throw std::runtime_error("Memory read out of range");
+    }
+
+    // Read straight from the persistent mapping, once the device's writes
+    // are visible to it
+    memory_allocator_->invalidate(allocation, params.offset, params.size);
+    std::vector<uint8_t> response(allocation.mapped + params.offset,
+        allocation.mapped + params.offset + params.size);
+    sendResponse(message, response);
+}
+
+void GPUServer::handleCreateBuffer(Session& session, const network::Message& message) {
+    auto& params = decodeParams<network::CreateBufferParams>(session, message);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.device));
+
+    vk::Buffer buffer = device.createBuffer(vk::BufferCreateInfo(params.create_info));
+    registerHandle(session.handles, params.buffer, static_cast<VkBuffer>(buffer));
+}
+
+void GPUServer::handleDestroyBuffer(Session& session, const network::Message& message) {
+    auto params = readParams<network::DestroyObjectParams>(message);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.parent));
+    auto buffer = reinterpret_cast<VkBuffer>(session.handles.remove(params.object));
+    if (buffer != VK_NULL_HANDLE) {
+        device.destroyBuffer(buffer);
+    }
+}
+
+void GPUServer::handleBindBufferMemory(Session& session, const network::Message& message) {
+    auto params = readParams<network::BindMemoryParams>(message);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.device));
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    const MemoryAllocator::Allocation& allocation = findAllocation(session, params.memory);
+    device.bindBufferMemory(resolveHandle<VkBuffer>(session.handles, params.object),
+        allocation.memory, allocation.offset + params.memory_offset);
+}
+
+void GPUServer::handleCreateImage(Session& session, const network::Message& message) {
+    auto& params = decodeParams<network::CreateImageParams>(session, message);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.device));
+
+    vk::Image image = device.createImage(vk::ImageCreateInfo(params.create_info));
+    registerHandle(session.handles, params.image, static_cast<VkImage>(image));
+}
+
+void GPUServer::handleDestroyImage(Session& session, const network::Message& message) {
+    auto params = readParams<network::DestroyObjectParams>(message);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.parent));
+    auto image = reinterpret_cast<VkImage>(session.handles.remove(params.object));
+    if (image != VK_NULL_HANDLE) {
+        device.destroyImage(image);
+    }
+}
+
+void GPUServer::handleBindImageMemory(Session& session, const network::Message& message) {
+    auto params = readParams<network::BindMemoryParams>(message);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.device));
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    const MemoryAllocator::Allocation& allocation = findAllocation(session, params.memory);
+    device.bindImageMemory(resolveHandle<VkImage>(session.handles, params.object),
+        allocation.memory, allocation.offset + params.memory_offset);
+}
+
+void GPUServer::handleCreateSemaphore(Session& session, const network::Message& message) {
+    auto& params = decodeParams<network::CreateSemaphoreParams>(session, message);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.device));
+
+    vk::Semaphore semaphore = device.createSemaphore(vk::SemaphoreCreateInfo(params.create_info));
+    registerHandle(session.handles, params.semaphore, static_cast<VkSemaphore>(semaphore));
+}
+
+void GPUServer::handleDestroySemaphore(Session& session, const network::Message& message) {
+    auto params = readParams<network::DestroyObjectParams>(message);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.parent));
+    auto semaphore = reinterpret_cast<VkSemaphore>(session.handles.remove(params.object));
+    if (semaphore != VK_NULL_HANDLE) {
+        device.destroySemaphore(semaphore);
+    }
+}
+
+void GPUServer::handleCreateFence(Session& session, const network::Message& message) {
+    auto& params = decodeParams<network::CreateFenceParams>(session, message);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.device));
+
+    vk::Fence fence = device.createFence(vk::FenceCreateInfo(params.create_info));
+    registerHandle(session.handles, params.fence, static_cast<VkFence>(fence));
+}
+
+void GPUServer::handleDestroyFence(Session& session, const network::Message& message) {
+    auto params = readParams<network::DestroyObjectParams>(message);
+    vk::Device device(resolveHandle<VkDevice>(session.handles, params.parent));
+    auto fence = reinterpret_cast<VkFence>(session.handles.remove(params.object));
+    if (fence != VK_NULL_HANDLE) {
+        device.destroyFence(fence);
+    }
+}
+
+void GPUServer::handleWaitForFences(Session& session, const network::Message& message) {
+    auto& params = decodeParams<network::WaitForFencesParams>(session, message);
+    VkDevice device = resolveHandle<VkDevice>(session.handles, params.device);
+
+    // In slices, so a session closing doesn't wait out a long timeout
+    uint64_t remaining = params.timeout;
+    VkResult result;
+    do {
+        uint64_t slice = std::min(remaining, FENCE_WAIT_SLICE_NS);
+        result = vkWaitForFences(device, params.fence_count, params.fences,
+            params.wait_all, slice);
+        remaining -= slice;
+    } while (result == VK_TIMEOUT && remaining > 0 && !session.stop_waiting);
+    if (result != VK_SUCCESS && result != VK_TIMEOUT) {
+        throw vk::SystemError(vk::make_error_code(static_cast<vk::Result>(result)),
+            "vkWaitForFences");
+    }
+
+    std::vector<uint8_t> response(sizeof(int32_t));
+    int32_t code = result;
+    std::memcpy(response.data(), &code, sizeof(code));
+    sendResponse(message, response);
+}
+
+void GPUServer::handleResetFences(Session& session, const network::Message& message) {
+    auto& params = decodeParams<network::ResetFencesParams>(session, message);
+    VkDevice device = resolveHandle<VkDevice>(session.handles, params.device);
+
+    VkResult result = vkResetFences(device, params.fence_count, params.fences);
+    if (result != VK_SUCCESS) {
+        throw vk::SystemError(vk::make_error_code(static_cast<vk::Result>(result)),
+            "vkResetFences");
+    }
+}
+
+template <typename T>
+T& GPUServer::decodeParams(Session& session, const network::Message& message,
+    std::vector<uint8_t>* arena)
+{
+    // Offsets are rewritten into pointers, so decode a copy of the payload:
+    // per thread, unless the caller keeps it
+    static thread_local std::vector<uint8_t> thread_arena;
+    std::vector<uint8_t>& storage = arena ? *arena : thread_arena;
+    storage.assign(message.payload.begin(), message.payload.end());
+
+    T* params = network::decodeWire<T>(storage.data(), storage.size(),
+        [&session](network::HandleType type, uint64_t handle) -> uint64_t {
+            return network::virtualHandleType(handle) == type ? session.handles.lookup(handle) : 0;
+        });
+    if (!params) {
+        throw std::runtime_error("Malformed command payload");
+    }
+    return *params;
+}
+
+void GPUServer::sendResponse(const network::Message& original_message,
+    const std::vector<uint8_t>& response_data)
+{
+    network::Message response;
+    response.header.type = original_message.header.type;
+    response.header.size = static_cast<uint32_t>(response_data.size());
+    response.header.sequence = original_message.header.sequence;
+    response.header.request_id = original_message.header.request_id;
+    response.header.timestamp = currentTimestamp();
+    response.payload = response_data;
+    response.peer = original_message.peer;
+    transport_->sendMessage(std::move(response));
+}
+
+void GPUServer::sendError(const network::Message& original_message,
+    uint32_t error_code, const std::string& error_message)
+{
+    network::Message error;
+    error.header.type = network::MessageType::ERROR;
+    error.header.sequence = original_message.header.sequence;
+    error.header.request_id = original_message.header.request_id;
+    error.header.timestamp = currentTimestamp();
+    error.peer = original_message.peer;
+    error.payload.resize(sizeof(error_code) + error_message.size());
+    std::memcpy(error.payload.data(), &error_code, sizeof(error_code));
+    std::memcpy(error.payload.data() + sizeof(error_code), error_message.data(),
+        error_message.size());
+    error.header.size = static_cast<uint32_t>(error.payload.size());
+    transport_->sendMessage(std::move(error));
+}
+
+void GPUServer::sendCommandResult(Session& session, const network::Message& batch,
+    uint64_t last_sequence, std::vector<network::CommandFailure>& failures)
+{
+    // Queue work from earlier batches that failed since the last reply
+    {
+        std::lock_guard<std::mutex> lock(schedule_mutex_);
+        failures.insert(failures.begin(), session.late_failures.begin(),
+            session.late_failures.end());
+        session.late_failures.clear();
+    }
+
+    network::CommandBatchResult result = {};
+    result.last_sequence = last_sequence;
+    result.failure_count = static_cast<uint32_t>(failures.size());
+
+    network::Message response;
+    response.header.type = network::MessageType::VK_COMMAND_RESULT;
+    response.header.sequence = batch.header.sequence;
+    response.header.timestamp = currentTimestamp();
+    response.peer = batch.peer;
+    response.payload.resize(sizeof(result) + failures.size() * sizeof(network::CommandFailure));
+    std::memcpy(response.payload.data(), &result, sizeof(result));
+    if (!failures.empty()) {
+        std::memcpy(response.payload.data() + sizeof(result), failures.data(),
+            failures.size() * sizeof(network::CommandFailure));
+    }
+    response.header.size = static_cast<uint32_t>(response.payload.size());
+    transport_->sendMessage(std::move(response));
+}
+
+void GPUServer::handleConnection(const network::Message& message) {
+    // Version handshake: nothing else is accepted from a client that gets an
+    // error here, since it can't parse our replies
+    if (message.payload.size() < sizeof(network::ConnectionParams)) {
+        sendError(message, static_cast<uint32_t>(VK_ERROR_INCOMPATIBLE_DRIVER),
+            "Missing connection parameters");
+        return;
+    }
+
+    auto client_params = readParams<network::ConnectionParams>(message);
+    network::ConnectionParams agreed;
+    if (!network::negotiateConnection(network::localConnectionParams(), client_params, agreed)) {
+        sendError(message, static_cast<uint32_t>(VK_ERROR_INCOMPATIBLE_DRIVER),
+            "Unsupported protocol version " + std::to_string(client_params.version.major) + "." +
+            std::to_string(client_params.version.minor));
+        return;
+    }
+
+    // A client that connects again starts over
+    if (std::shared_ptr<Session> session = findSession(message.peer)) {
+        closeSession(session);
+    }
+    if (!openSession(message.peer)) {
+        sendError(message, static_cast<uint32_t>(VK_ERROR_TOO_MANY_OBJECTS),
+            "Server is full: " + std::to_string(MAX_SESSIONS) + " clients connected");
+        return;
+    }
+
+    std::vector<uint8_t> reply(sizeof(agreed));
+    std::memcpy(reply.data(), &agreed, sizeof(agreed));
+    sendResponse(message, reply);
+}
+
+void GPUServer::handleDisconnection(const network::Message& message) {
+    // Tears down everything the client had, leaving the other sessions be
+    if (std::shared_ptr<Session> session = findSession(message.peer)) {
+        closeSession(session);
+    }
+}
+
 } // namespace server
-} // namespace anarchy 
\ No newline at end of file
+} // namespace anarchy
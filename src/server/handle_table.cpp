@@ -0,0 +1,135 @@
+#include "server/handle_table.hpp"
+
+namespace anarchy {
+namespace server {
+
+HandleTable::HandleTable()
+    : pages_(new std::atomic<Page*>[network::HANDLE_TYPE_COUNT * MAX_PAGES]())
+{
+    for (auto& next : next_index_) {
+        next = 1;
+    }
+}
+
+HandleTable::~HandleTable() {
+    for (size_t i = 0; i < network::HANDLE_TYPE_COUNT * MAX_PAGES; ++i) {
+        delete pages_[i].load();
+    }
+}
+
+bool HandleTable::insert(uint64_t virtual_handle, uint64_t real_handle) {
+    std::atomic<uint64_t>* entry = slot(virtual_handle, true);
+    if (!entry || real_handle == 0) {
+        return false;
+    }
+
+    uint64_t expected = 0;
+    if (!entry->compare_exchange_strong(expected, real_handle)) {
+        return false;
+    }
+    count_++;
+    return true;
+}
+
+uint64_t HandleTable::lookup(uint64_t virtual_handle) const {
+    size_t type = static_cast<size_t>(network::virtualHandleType(virtual_handle));
+    uint64_t index = network::virtualHandleIndex(virtual_handle);
+    if (type == 0 || type >= network::HANDLE_TYPE_COUNT || index >= PAGE_SIZE * MAX_PAGES) {
+        return 0;
+    }
+
+    const Page* page = pages_[type * MAX_PAGES + (index >> PAGE_BITS)].load(
+        std::memory_order_acquire);
+    if (!page) {
+        return 0;
+    }
+    return page->entries[index & (PAGE_SIZE - 1)].load(std::memory_order_acquire);
+}
+
+uint64_t HandleTable::remove(uint64_t virtual_handle) {
+    std::atomic<uint64_t>* entry = slot(virtual_handle, false);
+    if (!entry) {
+        return 0;
+    }
+
+    uint64_t real_handle = entry->exchange(0);
+    if (real_handle != 0) {
+        count_--;
+    }
+    return real_handle;
+}
+
+uint64_t HandleTable::allocate(network::HandleType type, uint64_t real_handle) {
+    size_t index = static_cast<size_t>(type);
+    if (index == 0 || index >= network::HANDLE_TYPE_COUNT) {
+        return 0;
+    }
+
+    uint64_t virtual_handle = network::makeVirtualHandle(type, next_index_[index]++);
+    return insert(virtual_handle, real_handle) ? virtual_handle : 0;
+}
+
+void HandleTable::clear() {
+    for (size_t i = 0; i < network::HANDLE_TYPE_COUNT * MAX_PAGES; ++i) {
+        Page* page = pages_[i].load();
+        if (page) {
+            for (auto& entry : page->entries) {
+                entry.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+    for (auto& next : next_index_) {
+        next = 1;
+    }
+    count_ = 0;
+}
+
+std::vector<uint64_t> HandleTable::take(network::HandleType type) {
+    std::vector<uint64_t> real_handles;
+    size_t index = static_cast<size_t>(type);
+    if (index == 0 || index >= network::HANDLE_TYPE_COUNT) {
+        return real_handles;
+    }
+
+    for (size_t i = index * MAX_PAGES; i < (index + 1) * MAX_PAGES; ++i) {
+        Page* page = pages_[i].load();
+        if (!page) {
+            continue;
+        }
+        for (auto& entry : page->entries) {
+            uint64_t real_handle = entry.exchange(0);
+            if (real_handle != 0) {
+                real_handles.push_back(real_handle);
+                count_--;
+            }
+        }
+    }
+    return real_handles;
+}
+
+std::atomic<uint64_t>* HandleTable::slot(uint64_t virtual_handle, bool create) {
+    size_t type = static_cast<size_t>(network::virtualHandleType(virtual_handle));
+    uint64_t index = network::virtualHandleIndex(virtual_handle);
+    if (type == 0 || type >= network::HANDLE_TYPE_COUNT || index >= PAGE_SIZE * MAX_PAGES) {
+        return nullptr;
+    }
+
+    std::atomic<Page*>& page_slot = pages_[type * MAX_PAGES + (index >> PAGE_BITS)];
+    Page* page = page_slot.load(std::memory_order_acquire);
+    if (!page) {
+        if (!create) {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(page_mutex_);
+        page = page_slot.load(std::memory_order_acquire);
+        if (!page) {
+            page = new Page();
+            page_slot.store(page, std::memory_order_release);
+        }
+    }
+    return &page->entries[index & (PAGE_SIZE - 1)];
+}
+
+} // namespace server
+} // namespace anarchy
@@ -15,7 +15,7 @@ int main() {
             std::cout << "Received message type: " << static_cast<int>(msg.header.type) << std::endl;
             std::cout << "Message size: " << msg.header.size << " bytes" << std::endl;
             std::cout << "Sequence: " << msg.header.sequence << std::endl;
-            std::cout << "Compression: " << static_cast<int>(msg.header.compression) << std::endl;
+            std::cout << "Compression: " << static_cast<int>(msg.header.compression()) << std::endl;
             std::cout << "----------------------------------------" << std::endl;
         });
         
@@ -0,0 +1,243 @@
+#include "server/memory_allocator.hpp"
+#include <algorithm>
+
+namespace anarchy {
+namespace server {
+
+MemoryAllocator::MemoryAllocator(vk::Device device, vk::PhysicalDevice physical_device)
+    : device_(device)
+    , properties_(physical_device.getMemoryProperties())
+    , min_piece_(MIN_PIECE)
+{
+    vk::PhysicalDeviceLimits limits = physical_device.getProperties().limits;
+    atom_size_ = std::max<vk::DeviceSize>(limits.nonCoherentAtomSize, 1);
+
+    // Pieces are aligned to their size, so a power of two at least the
+    // granularity keeps linear and optimal resources off each other's pages
+    while (min_piece_ < limits.bufferImageGranularity) {
+        min_piece_ *= 2;
+    }
+}
+
+MemoryAllocator::~MemoryAllocator() {
+    reset();
+}
+
+MemoryAllocator::Allocation MemoryAllocator::allocate(const VkMemoryAllocateInfo& allocate_info) {
+    uint32_t type = allocate_info.memoryTypeIndex;
+    if (type >= properties_.memoryTypeCount) {
+        throw vk::SystemError(vk::make_error_code(vk::Result::eErrorOutOfDeviceMemory),
+            "Bad memory type index");
+    }
+    vk::MemoryPropertyFlags flags = properties_.memoryTypes[type].propertyFlags;
+
+    Allocation allocation = {};
+    allocation.size = allocate_info.allocationSize;
+    allocation.coherent = static_cast<bool>(flags & vk::MemoryPropertyFlagBits::eHostCoherent);
+
+    // A pNext chain asks for something a shared block can't give
+    if (allocate_info.pNext == nullptr && allocation.size <= blockSize(type) / 4) {
+        for (uint32_t i = 0; i < blocks_.size(); i++) {
+            Block& block = blocks_[i];
+            if (!block.pieces || block.memory_type != type) {
+                continue;
+            }
+            uint64_t offset = block.pieces->allocate(std::max(allocation.size, min_piece_));
+            if (offset != BuddyAllocator::INVALID_OFFSET) {
+                allocation.memory = block.memory;
+                allocation.offset = offset;
+                allocation.mapped = block.mapped ? block.mapped + offset : nullptr;
+                allocation.block = i;
+                return allocation;
+            }
+        }
+
+        // Every block of this type is full. If the heap can't take another,
+        // the allocation may still fit on its own.
+        uint32_t index = DEDICATED;
+        try {
+            index = createBlock(type);
+        } catch (const vk::OutOfDeviceMemoryError&) {
+        }
+        if (index != DEDICATED) {
+            Block& block = blocks_[index];
+            allocation.memory = block.memory;
+            allocation.offset = block.pieces->allocate(std::max(allocation.size, min_piece_));
+            allocation.mapped = block.mapped ? block.mapped + allocation.offset : nullptr;
+            allocation.block = index;
+            return allocation;
+        }
+    }
+
+    allocation.memory = device_.allocateMemory(vk::MemoryAllocateInfo(allocate_info));
+    allocation.offset = 0;
+    allocation.mapped = nullptr;
+    allocation.block = DEDICATED;
+    if (flags & vk::MemoryPropertyFlagBits::eHostVisible) {
+        allocation.mapped = static_cast<uint8_t*>(
+            device_.mapMemory(allocation.memory, 0, VK_WHOLE_SIZE));
+    }
+    dedicated_[static_cast<VkDeviceMemory>(allocation.memory)] = allocation.size;
+    return allocation;
+}
+
+void MemoryAllocator::free(const Allocation& allocation) {
+    if (allocation.block == DEDICATED) {
+        if (dedicated_.erase(static_cast<VkDeviceMemory>(allocation.memory)) > 0) {
+            device_.freeMemory(allocation.memory);
+        }
+        return;
+    }
+    if (allocation.block >= blocks_.size() || !blocks_[allocation.block].pieces) {
+        return;
+    }
+
+    Block& block = blocks_[allocation.block];
+    block.pieces->free(allocation.offset);
+    if (!block.pieces->empty()) {
+        return;
+    }
+
+    // Keep one empty block per type so freeing and allocating in a loop
+    // doesn't go to the driver every time
+    for (uint32_t i = 0; i < blocks_.size(); i++) {
+        if (i != allocation.block && blocks_[i].pieces &&
+            blocks_[i].memory_type == block.memory_type) {
+            releaseBlock(allocation.block);
+            return;
+        }
+    }
+}
+
+void MemoryAllocator::flush(const Allocation& allocation, vk::DeviceSize offset,
+    vk::DeviceSize size)
+{
+    if (allocation.coherent || size == 0) {
+        return;
+    }
+    device_.flushMappedMemoryRanges(mappedRange(allocation, offset, size));
+}
+
+void MemoryAllocator::invalidate(const Allocation& allocation, vk::DeviceSize offset,
+    vk::DeviceSize size)
+{
+    if (allocation.coherent || size == 0) {
+        return;
+    }
+    device_.invalidateMappedMemoryRanges(mappedRange(allocation, offset, size));
+}
+
+uint32_t MemoryAllocator::readbackMemoryTypes() const {
+    uint32_t types = 0;
+    auto readback = vk::MemoryPropertyFlagBits::eHostVisible |
+        vk::MemoryPropertyFlagBits::eHostCached;
+    for (uint32_t i = 0; i < properties_.memoryTypeCount; i++) {
+        if ((properties_.memoryTypes[i].propertyFlags & readback) == readback) {
+            types |= 1u << i;
+        }
+    }
+    return types;
+}
+
+vk::MappedMemoryRange MemoryAllocator::mappedRange(const Allocation& allocation,
+    vk::DeviceSize offset, vk::DeviceSize size) const
+{
+    // Whole atoms, which may reach past the allocation but not the memory
+    vk::DeviceSize begin = (allocation.offset + offset) / atom_size_ * atom_size_;
+    vk::DeviceSize end = allocation.offset + offset + size;
+    vk::DeviceSize memory_size = allocation.block == DEDICATED ?
+        allocation.size : blocks_[allocation.block].pieces->size();
+    vk::DeviceSize range_size = (end - begin + atom_size_ - 1) / atom_size_ * atom_size_;
+    if (begin + range_size >= memory_size) {
+        range_size = VK_WHOLE_SIZE;
+    }
+    return vk::MappedMemoryRange(allocation.memory, begin, range_size);
+}
+
+void MemoryAllocator::reset() {
+    for (uint32_t i = 0; i < blocks_.size(); i++) {
+        if (blocks_[i].pieces) {
+            releaseBlock(i);
+        }
+    }
+    blocks_.clear();
+    unused_blocks_.clear();
+
+    for (const auto& dedicated : dedicated_) {
+        device_.freeMemory(dedicated.first);
+    }
+    dedicated_.clear();
+}
+
+MemoryAllocator::Statistics MemoryAllocator::getStatistics() const {
+    Statistics stats = {};
+    uint64_t free_bytes = 0;
+    uint64_t largest_free = 0;
+    for (const Block& block : blocks_) {
+        if (!block.pieces) {
+            continue;
+        }
+        stats.block_count++;
+        stats.allocation_count += block.pieces->allocationCount();
+        stats.reserved_bytes += block.pieces->size();
+        stats.used_bytes += block.pieces->used();
+        free_bytes += block.pieces->size() - block.pieces->used();
+        largest_free = std::max(largest_free, block.pieces->largestFree());
+    }
+    for (const auto& dedicated : dedicated_) {
+        stats.dedicated_count++;
+        stats.allocation_count++;
+        stats.reserved_bytes += dedicated.second;
+        stats.used_bytes += dedicated.second;
+    }
+    if (free_bytes > 0) {
+        stats.fragmentation = 1.0f - static_cast<float>(largest_free) / free_bytes;
+    }
+    return stats;
+}
+
+vk::DeviceSize MemoryAllocator::blockSize(uint32_t memory_type) const {
+    // Small heaps (BAR windows, integrated carve-outs) get smaller blocks so
+    // one block never takes a large share of them
+    uint32_t heap_index = properties_.memoryTypes[memory_type].heapIndex;
+    vk::DeviceSize heap = properties_.memoryHeaps[heap_index].size;
+    vk::DeviceSize size = BLOCK_SIZE;
+    while (size > min_piece_ && size > heap / 8) {
+        size /= 2;
+    }
+    return size;
+}
+
+uint32_t MemoryAllocator::createBlock(uint32_t memory_type) {
+    vk::DeviceSize size = blockSize(memory_type);
+    Block block = {};
+    block.memory_type = memory_type;
+    block.memory = device_.allocateMemory(vk::MemoryAllocateInfo(size, memory_type));
+    vk::MemoryPropertyFlags flags = properties_.memoryTypes[memory_type].propertyFlags;
+    if (flags & vk::MemoryPropertyFlagBits::eHostVisible) {
+        block.mapped = static_cast<uint8_t*>(device_.mapMemory(block.memory, 0, VK_WHOLE_SIZE));
+    }
+    block.pieces = std::make_unique<BuddyAllocator>(size, min_piece_);
+
+    if (!unused_blocks_.empty()) {
+        uint32_t index = unused_blocks_.back();
+        unused_blocks_.pop_back();
+        blocks_[index] = std::move(block);
+        return index;
+    }
+    blocks_.push_back(std::move(block));
+    return static_cast<uint32_t>(blocks_.size() - 1);
+}
+
+void MemoryAllocator::releaseBlock(uint32_t index) {
+    // Freeing unmaps
+    Block& block = blocks_[index];
+    device_.freeMemory(block.memory);
+    block.memory = nullptr;
+    block.mapped = nullptr;
+    block.pieces.reset();
+    unused_blocks_.push_back(index);
+}
+
+} // namespace server
+} // namespace anarchy
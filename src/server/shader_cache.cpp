@@ -0,0 +1,148 @@
+#include "server/shader_cache.hpp"
+#include "common/network/content_hash.hpp"
+#include <fstream>
+#include <system_error>
+
+namespace anarchy {
+namespace server {
+
+namespace {
+
+constexpr const char* SHADER_DIRECTORY = "shaders";
+constexpr const char* SHADER_EXTENSION = ".spv";
+constexpr const char* PIPELINE_CACHE_FILE = "pipeline_cache.bin";
+
+bool readFile(const std::filesystem::path& path, std::vector<uint8_t>& data) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+    std::streamsize size = file.tellg();
+    if (size < 0) {
+        return false;
+    }
+    data.resize(static_cast<size_t>(size));
+    file.seekg(0);
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(data.data()), size));
+}
+
+// Hex digest back to bytes; false for names that aren't one
+bool parseHash(const std::string& hex, network::ContentHash& hash) {
+    if (hex.size() != hash.size() * 2) {
+        return false;
+    }
+    auto digit = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    };
+    for (size_t i = 0; i < hash.size(); i++) {
+        int high = digit(hex[i * 2]);
+        int low = digit(hex[i * 2 + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        hash[i] = static_cast<uint8_t>(high << 4 | low);
+    }
+    return true;
+}
+
+} // namespace
+
+ShaderCache::ShaderCache(std::string root)
+    : root_(std::move(root))
+{
+}
+
+std::string ShaderCache::applicationKey(const std::string& application,
+    uint32_t application_version, const std::string& engine, uint32_t engine_version,
+    const uint8_t (&pipeline_cache_uuid)[VK_UUID_SIZE], uint32_t driver_version)
+{
+    // Names from the client never reach the file system as they are
+    std::string identity = application + '\0' + std::to_string(application_version) + '\0' +
+        engine + '\0' + std::to_string(engine_version) + '\0' +
+        network::toHex(pipeline_cache_uuid, VK_UUID_SIZE) + '\0' + std::to_string(driver_version);
+    network::ContentHash hash = network::hashContent(identity.data(), identity.size());
+    return network::toHex(hash.data(), 16);
+}
+
+bool ShaderCache::loadShader(const std::string& key, const network::ContentHash& hash,
+    std::vector<uint8_t>& code) const
+{
+    std::filesystem::path path = directory(key) / SHADER_DIRECTORY /
+        (network::toHex(hash) + SHADER_EXTENSION);
+    if (!readFile(path, code)) {
+        return false;
+    }
+    return network::hashContent(code.data(), code.size()) == hash;
+}
+
+bool ShaderCache::storeShader(const std::string& key, const network::ContentHash& hash,
+    const uint8_t* code, size_t size)
+{
+    std::filesystem::path path = directory(key) / SHADER_DIRECTORY /
+        (network::toHex(hash) + SHADER_EXTENSION);
+    std::error_code error;
+    if (std::filesystem::exists(path, error)) {
+        return true;    // Content-addressed, so already the same
+    }
+    return writeFile(path, code, size);
+}
+
+std::vector<network::ContentHash> ShaderCache::shaders(const std::string& key) const {
+    std::vector<network::ContentHash> hashes;
+    std::error_code error;
+    std::filesystem::directory_iterator it(directory(key) / SHADER_DIRECTORY, error);
+    if (error) {
+        return hashes;
+    }
+    for (const auto& entry : it) {
+        network::ContentHash hash;
+        if (entry.path().extension() == SHADER_EXTENSION &&
+            parseHash(entry.path().stem().string(), hash)) {
+            hashes.push_back(hash);
+        }
+    }
+    return hashes;
+}
+
+bool ShaderCache::loadPipelineCache(const std::string& key, std::vector<uint8_t>& data) const {
+    return readFile(directory(key) / PIPELINE_CACHE_FILE, data);
+}
+
+bool ShaderCache::storePipelineCache(const std::string& key, const std::vector<uint8_t>& data) {
+    return writeFile(directory(key) / PIPELINE_CACHE_FILE, data.data(), data.size());
+}
+
+std::filesystem::path ShaderCache::directory(const std::string& key) const {
+    return root_ / key;
+}
+
+bool ShaderCache::writeFile(const std::filesystem::path& path, const uint8_t* data, size_t size) {
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    if (error) {
+        return false;
+    }
+
+    // Unique per write, so concurrent writers never share a temporary
+    std::filesystem::path temporary = path;
+    temporary += ".tmp" + std::to_string(next_temporary_++);
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size))) {
+            file.close();
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+    }
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
+
+} // namespace server
+} // namespace anarchy
@@ -0,0 +1,74 @@
+#include "server/virtual_swapchain.hpp"
+#include "common/gpu/vulkan_utils.hpp"
+#include <algorithm>
+
+namespace anarchy {
+namespace server {
+
+VirtualSwapchain::VirtualSwapchain(uint64_t handle, vk::Device device,
+    vk::PhysicalDevice physical_device, const VkSwapchainCreateInfoKHR& create_info,
+    uint32_t image_count)
+    : handle_(handle)
+    , format_(static_cast<vk::Format>(create_info.imageFormat))
+    , extent_(create_info.imageExtent.width, create_info.imageExtent.height)
+    , ring_(image_count)
+{
+    if (image_count == 0 || image_count > network::SwapchainRing::MAX_IMAGES) {
+        throw vk::SystemError(vk::make_error_code(vk::Result::eErrorInitializationFailed),
+            "Bad swapchain image count");
+    }
+
+    // Whatever the application renders with, plus the copy out for capture
+    vk::ImageCreateInfo image_info;
+    image_info.imageType = vk::ImageType::e2D;
+    image_info.format = format_;
+    image_info.extent = vk::Extent3D(extent_, 1);
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = std::max(create_info.imageArrayLayers, 1u);
+    image_info.samples = vk::SampleCountFlagBits::e1;
+    image_info.tiling = vk::ImageTiling::eOptimal;
+    image_info.usage = static_cast<vk::ImageUsageFlags>(create_info.imageUsage) |
+        vk::ImageUsageFlagBits::eTransferSrc;
+    image_info.sharingMode = vk::SharingMode::eExclusive;
+    image_info.initialLayout = vk::ImageLayout::eUndefined;
+
+    for (uint32_t i = 0; i < image_count; i++) {
+        vk::UniqueImage image = device.createImageUnique(image_info);
+        vk::MemoryRequirements requirements = device.getImageMemoryRequirements(*image);
+        vk::MemoryAllocateInfo allocate_info(requirements.size,
+            gpu::VulkanUtils::findMemoryType(physical_device, requirements.memoryTypeBits,
+                vk::MemoryPropertyFlagBits::eDeviceLocal));
+        vk::UniqueDeviceMemory memory = device.allocateMemoryUnique(allocate_info);
+        device.bindImageMemory(*image, *memory, 0);
+
+        images_.push_back(*image);
+        owned_images_.push_back(std::move(image));
+        memory_.push_back(std::move(memory));
+    }
+}
+
+void VirtualSwapchain::acquire(uint32_t index) {
+    uint32_t expected = ring_.next();
+    if (index != expected || !ring_.acquire(expected)) {
+        throw vk::SystemError(vk::make_error_code(vk::Result::eErrorOutOfDateKHR),
+            "Swapchain image index out of step with the client");
+    }
+}
+
+void VirtualSwapchain::present(uint32_t index) {
+    if (!ring_.present(index)) {
+        throw vk::SystemError(vk::make_error_code(vk::Result::eErrorOutOfDateKHR),
+            "Presenting a swapchain image that was not acquired");
+    }
+}
+
+vk::Image VirtualSwapchain::image(uint32_t index) const {
+    if (index >= images_.size()) {
+        throw vk::SystemError(vk::make_error_code(vk::Result::eErrorOutOfDateKHR),
+            "Swapchain image index out of range");
+    }
+    return images_[index];
+}
+
+} // namespace server
+} // namespace anarchy
@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include "server/buddy_allocator.hpp"
+#include <algorithm>
+
+using namespace anarchy::server;
+
+TEST(BuddyAllocatorTest, PiecesAreAlignedToTheirSize) {
+    BuddyAllocator allocator(1 << 20, 256);
+    uint64_t small = allocator.allocate(100);
+    uint64_t large = allocator.allocate(64 << 10);
+    uint64_t odd = allocator.allocate(3000);
+    ASSERT_NE(small, BuddyAllocator::INVALID_OFFSET);
+    ASSERT_NE(large, BuddyAllocator::INVALID_OFFSET);
+    ASSERT_NE(odd, BuddyAllocator::INVALID_OFFSET);
+
+    EXPECT_EQ(small % 256, 0u);
+    EXPECT_EQ(large % (64 << 10), 0u);
+    EXPECT_EQ(odd % 4096, 0u);
+    EXPECT_EQ(allocator.used(), 256u + (64 << 10) + 4096u);
+    EXPECT_EQ(allocator.allocationCount(), 3u);
+}
+
+TEST(BuddyAllocatorTest, PiecesDoNotOverlap) {
+    BuddyAllocator allocator(64 << 10, 256);
+    std::vector<uint64_t> offsets;
+    for (int i = 0; i < 256; i++) {
+        uint64_t offset = allocator.allocate(256);
+        ASSERT_NE(offset, BuddyAllocator::INVALID_OFFSET);
+        offsets.push_back(offset);
+    }
+    std::sort(offsets.begin(), offsets.end());
+    for (size_t i = 1; i < offsets.size(); i++) {
+        EXPECT_GE(offsets[i], offsets[i - 1] + 256);
+    }
+
+    // Full
+    EXPECT_EQ(allocator.allocate(1), BuddyAllocator::INVALID_OFFSET);
+    EXPECT_EQ(allocator.largestFree(), 0u);
+}
+
+TEST(BuddyAllocatorTest, FreedBuddiesMerge) {
+    BuddyAllocator allocator(1 << 20, 256);
+    std::vector<uint64_t> offsets;
+    for (int i = 0; i < 100; i++) {
+        offsets.push_back(allocator.allocate(256 << (i % 4)));
+    }
+    for (uint64_t offset : offsets) {
+        allocator.free(offset);
+    }
+
+    EXPECT_TRUE(allocator.empty());
+    EXPECT_EQ(allocator.used(), 0u);
+    EXPECT_EQ(allocator.largestFree(), 1u << 20);
+    EXPECT_EQ(allocator.allocate(1 << 20), 0u);
+}
+
+TEST(BuddyAllocatorTest, RejectsWhatCannotFit) {
+    BuddyAllocator allocator(1 << 20, 256);
+    EXPECT_EQ(allocator.allocate(0), BuddyAllocator::INVALID_OFFSET);
+    EXPECT_EQ(allocator.allocate((1 << 20) + 1), BuddyAllocator::INVALID_OFFSET);
+
+    ASSERT_EQ(allocator.allocate(1), 0u);
+    EXPECT_EQ(allocator.allocate(1 << 20), BuddyAllocator::INVALID_OFFSET);
+    EXPECT_EQ(allocator.largestFree(), 512u << 10);
+}
+
+TEST(BuddyAllocatorTest, UnknownOffsetsAreIgnored) {
+    BuddyAllocator allocator(1 << 20, 256);
+    uint64_t offset = allocator.allocate(256);
+    allocator.free(offset + 256);
+    allocator.free(offset);
+    allocator.free(offset);
+    EXPECT_TRUE(allocator.empty());
+    EXPECT_EQ(allocator.largestFree(), 1u << 20);
+}
@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+#include "common/network/buffer_pool.hpp"
+#include <thread>
+#include <vector>
+
+using namespace anarchy::network;
+
+TEST(BufferPoolTest, ReusesReleasedBuffers) {
+    BufferPool pool;
+    std::vector<uint8_t> buffer = pool.acquire(4096);
+    EXPECT_EQ(buffer.size(), 4096);
+    EXPECT_EQ(pool.allocations(), 1);
+
+    const uint8_t* data = buffer.data();
+    pool.release(std::move(buffer));
+    EXPECT_EQ(pool.available(), 1);
+
+    // Smaller requests fit in the same storage
+    std::vector<uint8_t> reused = pool.acquire(1024);
+    EXPECT_EQ(reused.data(), data);
+    EXPECT_EQ(reused.size(), 1024);
+    EXPECT_EQ(pool.allocations(), 1);
+    EXPECT_EQ(pool.available(), 0);
+}
+
+TEST(BufferPoolTest, PicksBestFit) {
+    BufferPool pool;
+    std::vector<uint8_t> small = pool.acquire(1024);
+    std::vector<uint8_t> large = pool.acquire(64 * 1024);
+    const uint8_t* small_data = small.data();
+    pool.release(std::move(large));
+    pool.release(std::move(small));
+
+    EXPECT_EQ(pool.acquire(512).data(), small_data);
+}
+
+TEST(BufferPoolTest, BoundedSize) {
+    BufferPool pool(2);
+    for (int i = 0; i < 4; ++i) {
+        pool.release(std::vector<uint8_t>(128));
+    }
+    EXPECT_EQ(pool.available(), 2);
+
+    // Empty buffers aren't worth keeping
+    BufferPool empty_pool;
+    empty_pool.release(std::vector<uint8_t>());
+    EXPECT_EQ(empty_pool.available(), 0);
+}
+
+TEST(BufferPoolTest, ConcurrentAcquireRelease) {
+    BufferPool pool(4);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&pool]() {
+            for (int i = 0; i < 1000; ++i) {
+                std::vector<uint8_t> buffer = pool.acquire(8192);
+                buffer[0] = static_cast<uint8_t>(i);
+                pool.release(std::move(buffer));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_LE(pool.available(), 4);
+    EXPECT_LE(pool.allocations(), 4);
+}
+
+TEST(BufferPoolTest, SizeClasses) {
+    EXPECT_EQ(BufferPool::sizeClass(1), BufferPool::MIN_SIZE_CLASS);
+    EXPECT_EQ(BufferPool::sizeClass(4096), 4096);
+    EXPECT_EQ(BufferPool::sizeClass(4097), 5120);
+    EXPECT_EQ(BufferPool::sizeClass(9 * 1024 * 1024), 10 * 1024 * 1024);
+    EXPECT_EQ(BufferPool::sizeClass(16 * 1024 * 1024), 16 * 1024 * 1024);
+
+    // Anything up to the class reuses the same buffer without reallocating
+    BufferPool pool;
+    pool.release(pool.acquire(4097));
+    pool.release(pool.acquire(5000));
+    EXPECT_EQ(pool.allocations(), 1);
+}
@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include "common/network/clock_sync.hpp"
+#include <cstring>
+
+using namespace anarchy::network;
+
+namespace {
+
+// A heartbeat sent at sent on the peer's clock, echoing ours
+void receive(ClockSync& sync, uint64_t peer, uint64_t sent, uint64_t echo_timestamp,
+    uint64_t echo_received, uint64_t received)
+{
+    MessageHeader header = {};
+    header.type = MessageType::HEARTBEAT;
+    header.timestamp = sent;
+    HeartbeatTiming timing = {echo_timestamp, echo_received};
+    uint8_t payload[sizeof(timing)];
+    std::memcpy(payload, &timing, sizeof(timing));
+    sync.onHeartbeat(header, payload, sizeof(payload), peer, received);
+}
+
+} // namespace
+
+TEST(ClockSyncTest, NoEstimateBeforeAnEcho) {
+    ClockSync sync;
+    ClockSync::Estimate estimate = {};
+    EXPECT_FALSE(sync.estimate(0, estimate));
+
+    // The peer hasn't heard from us yet
+    receive(sync, 0, 5000, 0, 0, 1000);
+    EXPECT_FALSE(sync.estimate(0, estimate));
+
+    // But the next heartbeat to it echoes this one
+    Message heartbeat;
+    sync.stamp(heartbeat, 0);
+    ASSERT_EQ(heartbeat.header.size, sizeof(HeartbeatTiming));
+    HeartbeatTiming timing = {};
+    std::memcpy(&timing, heartbeat.payload.data(), sizeof(timing));
+    EXPECT_EQ(timing.echo_timestamp, 5000u);
+    EXPECT_EQ(timing.echo_received, 1000u);
+    EXPECT_NE(heartbeat.header.timestamp, 0u);
+}
+
+TEST(ClockSyncTest, SplitsTheRoundTrip) {
+    ClockSync sync;
+
+    // Peer runs 10000us ahead, 100us each way, held 50us there
+    receive(sync, 3, 10000 + 1150, 1000, 10000 + 1100, 1250);
+
+    ClockSync::Estimate estimate = {};
+    ASSERT_TRUE(sync.estimate(3, estimate));
+    EXPECT_EQ(estimate.offset, 10000);
+    EXPECT_EQ(estimate.round_trip, 200);
+}
+
+TEST(ClockSyncTest, PrefersTheShortestRoundTrip) {
+    ClockSync sync;
+
+    // Queued 300us on the way back: offset looks 150us short
+    receive(sync, 1, 5000 + 1150, 1000, 5000 + 1100, 1550);
+    receive(sync, 1, 5000 + 2110, 2000, 5000 + 2100, 2210);
+    receive(sync, 1, 5000 + 3150, 3000, 5000 + 3100, 3650);
+
+    ClockSync::Estimate estimate = {};
+    ASSERT_TRUE(sync.estimate(1, estimate));
+    EXPECT_EQ(estimate.offset, 5000);
+    EXPECT_EQ(estimate.round_trip, 200);
+}
+
+TEST(ClockSyncTest, RejectsImpossibleSamplesAndForgets) {
+    ClockSync sync;
+    ClockSync::Estimate estimate = {};
+
+    // Held longer than the whole round trip
+    receive(sync, 2, 9000, 1000, 1000, 1500);
+    EXPECT_FALSE(sync.estimate(2, estimate));
+
+    receive(sync, 2, 1150, 1000, 1100, 1250);
+    ASSERT_TRUE(sync.estimate(2, estimate));
+    EXPECT_FALSE(sync.estimate(4, estimate));
+
+    sync.forget(2);
+    EXPECT_FALSE(sync.estimate(2, estimate));
+}
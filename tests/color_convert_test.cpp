@@ -0,0 +1,59 @@
+#include <gtest/gtest.h>
+#include "common/gpu/color_convert.hpp"
+
+using namespace anarchy::gpu;
+
+namespace {
+
+float apply(const float (&row)[4], float r, float g, float b) {
+    return row[0] * r + row[1] * g + row[2] * b + row[3];
+}
+
+} // namespace
+
+TEST(ColorConvertTest, LimitedRangeEightBit) {
+    auto k = colorCoefficients(ColorMatrix::BT709, false, TargetFormat::NV12);
+
+    EXPECT_NEAR(apply(k.y, 1.0f, 1.0f, 1.0f), 235.0f, 0.01f);
+    EXPECT_NEAR(apply(k.y, 0.0f, 0.0f, 0.0f), 16.0f, 0.01f);
+
+    // Greys carry no chroma
+    EXPECT_NEAR(apply(k.u, 0.5f, 0.5f, 0.5f), 128.0f, 0.01f);
+    EXPECT_NEAR(apply(k.v, 0.5f, 0.5f, 0.5f), 128.0f, 0.01f);
+
+    // Blue and red reach the top of the chroma range
+    EXPECT_NEAR(apply(k.u, 0.0f, 0.0f, 1.0f), 240.0f, 0.01f);
+    EXPECT_NEAR(apply(k.v, 1.0f, 0.0f, 0.0f), 240.0f, 0.01f);
+    EXPECT_FLOAT_EQ(k.max_code, 255.0f);
+}
+
+TEST(ColorConvertTest, FullRangeTenBit) {
+    auto k = colorCoefficients(ColorMatrix::BT2020, true, TargetFormat::P010);
+
+    EXPECT_NEAR(apply(k.y, 1.0f, 1.0f, 1.0f), 1023.0f, 0.01f);
+    EXPECT_NEAR(apply(k.y, 0.0f, 0.0f, 0.0f), 0.0f, 0.01f);
+    EXPECT_NEAR(apply(k.u, 1.0f, 1.0f, 1.0f), 512.0f, 0.01f);
+    EXPECT_FLOAT_EQ(k.max_code, 1023.0f);
+}
+
+TEST(ColorConvertTest, MatricesWeighLumaDifferently) {
+    auto bt601 = colorCoefficients(ColorMatrix::BT601, false, TargetFormat::NV12);
+    auto bt709 = colorCoefficients(ColorMatrix::BT709, false, TargetFormat::NV12);
+
+    EXPECT_NEAR(apply(bt601.y, 0.0f, 1.0f, 0.0f), 16.0f + 219.0f * 0.587f, 0.01f);
+    EXPECT_NEAR(apply(bt709.y, 0.0f, 1.0f, 0.0f), 16.0f + 219.0f * 0.7152f, 0.01f);
+}
+
+TEST(ColorConvertTest, FormatLayouts) {
+    SourceFormat source;
+    ASSERT_TRUE(toSourceFormat(VK_FORMAT_B8G8R8A8_UNORM, source));
+    EXPECT_EQ(source, SourceFormat::BGRA8);
+    ASSERT_TRUE(toSourceFormat(VK_FORMAT_A2B10G10R10_UNORM_PACK32, source));
+    EXPECT_TRUE(isTenBit(source));
+    EXPECT_FALSE(toSourceFormat(VK_FORMAT_R16G16B16A16_SFLOAT, source));
+
+    EXPECT_EQ(targetRows(TargetFormat::NV12, 1200), 1800);
+    EXPECT_EQ(targetRows(TargetFormat::YUV444_10BIT, 1200), 3600);
+    EXPECT_EQ(bytesPerSample(TargetFormat::P010), 2);
+    EXPECT_EQ(bytesPerSample(TargetFormat::YUV444), 1);
+}
@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+#include "server/command_dispatcher.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+
+using namespace anarchy::server;
+using namespace anarchy::network;
+
+namespace {
+
+// Each command carries its lane, so the handler can check the order per lane
+void dispatchCommand(CommandDispatcher& dispatcher, uint64_t sequence, uint64_t lane) {
+    CommandRecordHeader record = {};
+    record.type = MessageType::VK_END_COMMAND_BUFFER;
+    record.size = sizeof(lane);
+    record.sequence = sequence;
+    dispatcher.dispatch(record, reinterpret_cast<const uint8_t*>(&lane), 0, lane);
+}
+
+uint64_t laneOf(const Message& command) {
+    uint64_t lane = 0;
+    std::memcpy(&lane, command.payload.data(), sizeof(lane));
+    return lane;
+}
+
+} // namespace
+
+TEST(CommandDispatcherTest, LanesKeepTheirOrder) {
+    std::mutex mutex;
+    std::map<uint64_t, std::vector<uint64_t>> seen;
+    CommandDispatcher dispatcher([&](const Message& command) {
+        std::lock_guard<std::mutex> lock(mutex);
+        seen[laneOf(command)].push_back(command.header.sequence);
+        return 0;
+    }, 4);
+
+    uint64_t sequence = 1;
+    for (int i = 0; i < 1000; i++) {
+        dispatchCommand(dispatcher, sequence++, 1 + i % 7);
+    }
+    std::vector<CommandFailure> failures;
+    dispatcher.drain(failures);
+    EXPECT_TRUE(failures.empty());
+
+    size_t total = 0;
+    for (auto& lane : seen) {
+        EXPECT_TRUE(std::is_sorted(lane.second.begin(), lane.second.end()));
+        total += lane.second.size();
+    }
+    EXPECT_EQ(total, 1000u);
+}
+
+TEST(CommandDispatcherTest, InOrderCommandsWaitForEverythingBefore) {
+    std::atomic<int> done{0};
+    std::vector<int> done_at_barrier;
+    CommandDispatcher dispatcher([&](const Message& command) {
+        if (laneOf(command) == CommandDispatcher::IN_ORDER) {
+            done_at_barrier.push_back(done.load());
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            done++;
+        }
+        return 0;
+    }, 4);
+
+    uint64_t sequence = 1;
+    for (int round = 1; round <= 3; round++) {
+        for (int i = 0; i < 20; i++) {
+            dispatchCommand(dispatcher, sequence++, 1 + i);
+        }
+        dispatchCommand(dispatcher, sequence++, CommandDispatcher::IN_ORDER);
+    }
+    std::vector<CommandFailure> failures;
+    dispatcher.drain(failures);
+
+    EXPECT_EQ(done_at_barrier, (std::vector<int>{20, 40, 60}));
+}
+
+TEST(CommandDispatcherTest, FailuresComeBackInSequenceOrder) {
+    // Every third command fails, on whichever thread ran it
+    CommandDispatcher dispatcher([](const Message& command) {
+        return command.header.sequence % 3 == 0 ? -4 : 0;
+    }, 3);
+
+    for (uint64_t sequence = 1; sequence <= 30; sequence++) {
+        dispatchCommand(dispatcher, sequence, sequence % 5 == 0 ? 0 : sequence % 4 + 1);
+    }
+    std::vector<CommandFailure> failures;
+    dispatcher.drain(failures);
+
+    ASSERT_EQ(failures.size(), 10u);
+    for (size_t i = 0; i < failures.size(); i++) {
+        EXPECT_EQ(failures[i].sequence, 3 * (i + 1));
+        EXPECT_EQ(failures[i].result, -4);
+    }
+
+    // Reported once
+    dispatcher.drain(failures);
+    EXPECT_EQ(failures.size(), 10u);
+}
+
+TEST(CommandDispatcherTest, SurvivesAFullQueue) {
+    std::atomic<uint64_t> count{0};
+    CommandDispatcher dispatcher([&](const Message&) {
+        count++;
+        return 0;
+    }, 1);
+
+    for (uint64_t sequence = 1; sequence <= CommandDispatcher::QUEUE_DEPTH * 4; sequence++) {
+        dispatchCommand(dispatcher, sequence, 1);
+    }
+    std::vector<CommandFailure> failures;
+    dispatcher.drain(failures);
+    EXPECT_EQ(count.load(), CommandDispatcher::QUEUE_DEPTH * 4);
+}
@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+#include "common/gpu/command_list_graph.hpp"
+#include <map>
+
+using namespace anarchy::gpu;
+
+namespace {
+
+constexpr uint32_t DIRECT = 0;
+constexpr uint32_t COPY = 3;
+
+// Stand-ins for ID3D12CommandList pointers
+int lists[8];
+CommandListGraph::List list(int i) { return &lists[i]; }
+
+// Fences that reach whatever the test says the GPU has finished
+struct Fences {
+    std::map<uint32_t, uint64_t> completed;
+    CommandListGraph::CompletedValue value() const {
+        return [this](uint32_t queue) {
+            auto it = completed.find(queue);
+            return it != completed.end() ? it->second : 0;
+        };
+    }
+};
+
+} // namespace
+
+TEST(CommandListGraphTest, ReadyListsLeaveAsOneBatch) {
+    CommandListGraph graph;
+    Fences fences;
+    for (int i = 0; i < 4; i++) {
+        graph.queue(DIRECT, list(i));
+    }
+
+    auto batches = graph.takeReady(fences.value());
+    ASSERT_EQ(batches.size(), 1u);
+    EXPECT_EQ(batches[0].queue, DIRECT);
+    EXPECT_EQ(batches[0].lists.size(), 4u);
+    EXPECT_TRUE(batches[0].waits.empty());
+    EXPECT_EQ(batches[0].fence_value, 1u);
+    EXPECT_EQ(graph.pending(), 0u);
+
+    // The next batch signals the same fence with the next value
+    graph.queue(DIRECT, list(0));
+    batches = graph.takeReady(fences.value());
+    ASSERT_EQ(batches.size(), 1u);
+    EXPECT_EQ(batches[0].fence_value, 2u);
+    EXPECT_EQ(graph.lastValue(DIRECT), 2u);
+}
+
+TEST(CommandListGraphTest, CrossQueueDependenciesWaitOnTheGpu) {
+    CommandListGraph graph;
+    Fences fences;
+
+    // An upload on the copy queue, then the frame that reads it
+    graph.queue(COPY, list(0));
+    graph.queue(DIRECT, list(1));
+    graph.addDependency(list(1), list(0));
+
+    auto batches = graph.takeReady(fences.value());
+    ASSERT_EQ(batches.size(), 2u);
+    EXPECT_EQ(batches[0].queue, COPY);
+    EXPECT_EQ(batches[1].queue, DIRECT);
+    ASSERT_EQ(batches[1].waits.size(), 1u);
+    EXPECT_EQ(batches[1].waits[0].queue, COPY);
+    EXPECT_EQ(batches[1].waits[0].value, batches[0].fence_value);
+
+    // Once the upload is done, depending on it costs nothing
+    EXPECT_FALSE(graph.complete(list(0), fences.value()));
+    fences.completed[COPY] = batches[0].fence_value;
+    EXPECT_TRUE(graph.complete(list(0), fences.value()));
+    graph.queue(DIRECT, list(2));
+    graph.addDependency(list(2), list(0));
+    batches = graph.takeReady(fences.value());
+    ASSERT_EQ(batches.size(), 1u);
+    EXPECT_TRUE(batches[0].waits.empty());
+}
+
+TEST(CommandListGraphTest, WaitingListsHoldTheQueueInOrder) {
+    CommandListGraph graph;
+    Fences fences;
+    graph.queue(DIRECT, list(0));
+    graph.queue(DIRECT, list(1));
+    graph.queue(DIRECT, list(2));
+    graph.addDependency(list(1), list(5));
+
+    // list(1) waits for one that hasn't been queued, and list(2) behind it
+    auto batches = graph.takeReady(fences.value());
+    ASSERT_EQ(batches.size(), 1u);
+    EXPECT_EQ(batches[0].lists, (std::vector<CommandListGraph::List>{list(0)}));
+    EXPECT_EQ(graph.pending(), 2u);
+    EXPECT_FALSE(graph.dependenciesComplete(list(1), fences.value()));
+
+    graph.queue(COPY, list(5));
+    batches = graph.takeReady(fences.value());
+    ASSERT_EQ(batches.size(), 2u);
+    EXPECT_EQ(batches[1].lists, (std::vector<CommandListGraph::List>{list(1), list(2)}));
+    EXPECT_EQ(graph.pending(), 0u);
+}
+
+TEST(CommandListGraphTest, ForgottenListsReleaseTheirDependents) {
+    CommandListGraph graph;
+    Fences fences;
+    graph.queue(DIRECT, list(0));
+    graph.addDependency(list(0), list(1));
+    EXPECT_TRUE(graph.takeReady(fences.value()).empty());
+
+    graph.forget(list(1));
+    auto batches = graph.takeReady(fences.value());
+    ASSERT_EQ(batches.size(), 1u);
+    EXPECT_EQ(batches[0].lists.size(), 1u);
+}
@@ -0,0 +1,206 @@
+#include <gtest/gtest.h>
+#include "common/network/command_stream.hpp"
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+using namespace anarchy::network;
+
+class CommandStreamTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        stream = std::make_unique<CommandStream>([this](Message& batch) {
+            sent_batches.push_back(batch);
+            return true;
+        }, 1024, 512);
+    }
+
+    void TearDown() override {
+        stream.reset();
+        sent_batches.clear();
+    }
+
+    // Record sequences of one sent batch, in the order they were packed
+    std::vector<uint64_t> sentSequences(size_t batch) {
+        std::vector<uint64_t> sequences;
+        forEachCommandRecord(sent_batches[batch],
+            [&](const CommandRecordHeader& header, const uint8_t*) {
+                sequences.push_back(header.sequence);
+                return true;
+            });
+        return sequences;
+    }
+
+    std::unique_ptr<CommandStream> stream;
+    std::vector<Message> sent_batches;
+};
+
+TEST_F(CommandStreamTest, CommandsAreDeferredUntilFlush) {
+    uint64_t handle = 0x1234;
+    EXPECT_TRUE(stream->enqueue(MessageType::VK_DESTROY_BUFFER, 1, &handle, sizeof(handle)));
+    EXPECT_TRUE(stream->enqueue(MessageType::VK_DESTROY_IMAGE, 2, &handle, sizeof(handle)));
+    EXPECT_TRUE(sent_batches.empty());
+
+    EXPECT_TRUE(stream->flush());
+    ASSERT_EQ(sent_batches.size(), 1);
+    EXPECT_EQ(sent_batches[0].header.type, MessageType::VK_COMMAND_BATCH);
+    EXPECT_EQ(stream->getSubmittedSequence(), 2);
+
+    std::vector<CommandRecordHeader> records;
+    EXPECT_TRUE(forEachCommandRecord(sent_batches[0],
+        [&](const CommandRecordHeader& header, const uint8_t* payload) {
+            uint64_t value;
+            std::memcpy(&value, payload, sizeof(value));
+            EXPECT_EQ(value, handle);
+            records.push_back(header);
+            return true;
+        }));
+
+    ASSERT_EQ(records.size(), 2);
+    EXPECT_EQ(records[0].type, MessageType::VK_DESTROY_BUFFER);
+    EXPECT_EQ(records[0].sequence, 1);
+    EXPECT_EQ(records[1].type, MessageType::VK_DESTROY_IMAGE);
+    EXPECT_EQ(records[1].sequence, 2);
+}
+
+TEST_F(CommandStreamTest, FlushesAtThreshold) {
+    std::vector<uint8_t> params(200, 0xAB);
+    for (uint64_t i = 1; i <= 3; ++i) {
+        EXPECT_TRUE(stream->enqueue(MessageType::VK_QUEUE_SUBMIT, i, params.data(), params.size()));
+    }
+
+    // Three 216 byte records cross the 512 byte threshold
+    EXPECT_EQ(sent_batches.size(), 1);
+    EXPECT_EQ(stream->getStatistics().commands_enqueued, 3);
+}
+
+TEST_F(CommandStreamTest, OversizedCommandIsSentAlone) {
+    std::vector<uint8_t> params(4096, 0x5A);
+    EXPECT_TRUE(stream->enqueue(MessageType::VK_QUEUE_SUBMIT, 7, params.data(), params.size()));
+    ASSERT_EQ(sent_batches.size(), 1);
+    EXPECT_EQ(sent_batches[0].payload.size(), commandRecordSize(params.size()));
+}
+
+TEST_F(CommandStreamTest, PerThreadBuffersFlushTogether) {
+    uint64_t handle = 1;
+    std::mutex mutex;
+    std::condition_variable changed;
+    int step = 0;
+
+    // The worker stays alive until flushed, so its exit doesn't flush it
+    std::thread worker([&]() {
+        stream->enqueue(MessageType::VK_FREE_MEMORY, 10, &handle, sizeof(handle));
+        std::unique_lock<std::mutex> lock(mutex);
+        step = 1;
+        changed.notify_all();
+        changed.wait(lock, [&] { return step == 2; });
+    });
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return step == 1; });
+    }
+    stream->enqueue(MessageType::VK_FREE_MEMORY, 11, &handle, sizeof(handle));
+
+    EXPECT_TRUE(stream->flush());
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        step = 2;
+        changed.notify_all();
+    }
+    worker.join();
+
+    ASSERT_EQ(sent_batches.size(), 1);
+    EXPECT_EQ(sentSequences(0), (std::vector<uint64_t>{10, 11}));
+    EXPECT_EQ(stream->getSubmittedSequence(), 11);
+}
+
+TEST_F(CommandStreamTest, ThresholdFlushKeepsOtherThreadsInOrder) {
+    // A create on one thread, then a use of it on another that crosses the
+    // threshold: the create must not arrive later than the use
+    std::vector<uint8_t> params(200, 0xAB);
+    std::thread creator([&]() {
+        stream->enqueue(MessageType::VK_CREATE_BUFFER, 1, params.data(), params.size());
+        stream->enqueue(MessageType::VK_END_COMMAND_BUFFER, 3, params.data(), params.size());
+    });
+    creator.join();
+    ASSERT_EQ(sent_batches.size(), 1);     // Flushed as the creator exited
+    EXPECT_EQ(stream->getStatistics().thread_buffers, 0u);
+
+    stream->enqueue(MessageType::VK_BIND_BUFFER_MEMORY, 4, params.data(), params.size());
+    std::thread other([&]() {
+        stream->enqueue(MessageType::VK_CREATE_IMAGE, 5, params.data(), params.size());
+        EXPECT_EQ(sent_batches.size(), 1u);
+        stream->enqueue(MessageType::VK_QUEUE_SUBMIT, 6, params.data(), params.size());
+        stream->enqueue(MessageType::VK_QUEUE_SUBMIT, 7, params.data(), params.size());
+        EXPECT_EQ(sent_batches.size(), 2u);    // This thread's buffer crossed the threshold
+    });
+    other.join();
+
+    ASSERT_EQ(sent_batches.size(), 2);
+    EXPECT_EQ(sentSequences(0), (std::vector<uint64_t>{1, 3}));
+    EXPECT_EQ(sentSequences(1), (std::vector<uint64_t>{4, 5, 6, 7}));
+}
+
+TEST_F(CommandStreamTest, OversizedCommandGoesOutInOrder) {
+    uint64_t handle = 1;
+    stream->enqueue(MessageType::VK_FREE_MEMORY, 1, &handle, sizeof(handle));
+    std::vector<uint8_t> params(4096, 0x5A);
+    EXPECT_TRUE(stream->enqueue(MessageType::VK_QUEUE_SUBMIT, 2, params.data(), params.size()));
+
+    ASSERT_EQ(sent_batches.size(), 1);
+    EXPECT_EQ(sentSequences(0), (std::vector<uint64_t>{1, 2}));
+}
+
+TEST_F(CommandStreamTest, ExitedThreadsFreeTheirBuffers) {
+    uint64_t handle = 1;
+    for (uint64_t i = 0; i < 4; ++i) {
+        std::thread worker([&]() {
+            stream->enqueue(MessageType::VK_FREE_MEMORY, i + 1, &handle, sizeof(handle));
+        });
+        worker.join();
+    }
+    EXPECT_EQ(stream->getStatistics().thread_buffers, 0u);
+    EXPECT_EQ(sent_batches.size(), 4u);
+    EXPECT_EQ(stream->getSubmittedSequence(), 4u);
+}
+
+TEST_F(CommandStreamTest, DeferredFailuresReplay) {
+    CommandBatchResult result = {};
+    result.last_sequence = 42;
+    result.failure_count = 2;
+
+    CommandFailure failures[2] = {};
+    failures[0].sequence = 40;
+    failures[0].result = -4;  // VK_ERROR_DEVICE_LOST
+    failures[1].sequence = 41;
+    failures[1].result = -2;  // VK_ERROR_OUT_OF_DEVICE_MEMORY
+
+    Message message;
+    message.header.type = MessageType::VK_COMMAND_RESULT;
+    message.payload.resize(sizeof(result) + sizeof(failures));
+    std::memcpy(message.payload.data(), &result, sizeof(result));
+    std::memcpy(message.payload.data() + sizeof(result), failures, sizeof(failures));
+
+    stream->handleResult(message);
+    EXPECT_EQ(stream->getCompletedSequence(), 42);
+    EXPECT_EQ(stream->getStatistics().deferred_failures, 2);
+
+    // The first failure is reported once
+    EXPECT_EQ(stream->takeDeferredError(), -4);
+    EXPECT_EQ(stream->takeDeferredError(), 0);
+}
+
+TEST_F(CommandStreamTest, MalformedBatchIsRejected) {
+    Message batch;
+    batch.header.type = MessageType::VK_COMMAND_BATCH;
+    batch.payload.resize(sizeof(CommandRecordHeader));
+
+    CommandRecordHeader header = {};
+    header.type = MessageType::VK_FREE_MEMORY;
+    header.size = 64;  // Larger than what follows
+    std::memcpy(batch.payload.data(), &header, sizeof(header));
+
+    EXPECT_FALSE(forEachCommandRecord(batch,
+        [](const CommandRecordHeader&, const uint8_t*) { return true; }));
+}
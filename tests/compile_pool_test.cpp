@@ -0,0 +1,50 @@
+#include <gtest/gtest.h>
+#include "server/compile_pool.hpp"
+#include <atomic>
+#include <chrono>
+
+using namespace anarchy::server;
+
+TEST(CompilePoolTest, WaitsForOneTicket) {
+    CompilePool pool(2);
+    std::atomic<bool> released{false};
+    std::atomic<bool> done{false};
+
+    // A long compile doesn't hold up a short one behind it
+    pool.submit([&released] {
+        while (!released) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    auto ticket = pool.submit([&done] { done = true; });
+    pool.wait(ticket);
+    EXPECT_TRUE(done);
+    EXPECT_EQ(pool.pending(), 1u);
+
+    released = true;
+    pool.waitAll();
+    EXPECT_EQ(pool.pending(), 0u);
+    pool.wait(ticket);
+}
+
+TEST(CompilePoolTest, RunsEverythingSubmitted) {
+    std::atomic<int> ran{0};
+    {
+        CompilePool pool(3);
+        for (int i = 0; i < 100; i++) {
+            pool.submit([&ran] { ran++; });
+        }
+    }
+    // The destructor finished the queue before stopping
+    EXPECT_EQ(ran, 100);
+}
+
+TEST(CompilePoolTest, RunsInSubmissionOrderOnOneThread) {
+    CompilePool pool(1);
+    std::vector<int> order;
+    for (int i = 0; i < 10; i++) {
+        pool.submit([&order, i] { order.push_back(i); });
+    }
+    pool.waitAll();
+    EXPECT_EQ(order, (std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9}));
+}
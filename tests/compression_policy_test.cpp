@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+#include "common/network/compression_policy.hpp"
+
+using namespace anarchy::network;
+
+namespace {
+
+constexpr std::chrono::microseconds SECOND{1000000};
+
+} // namespace
+
+TEST(CompressionPolicyTest, DefaultRules) {
+    CompressionPolicy policy;
+
+    // Encoded frames and control traffic stay as they are
+    EXPECT_EQ(policy.select(MessageType::FRAME_DATA, 1024 * 1024), CompressionType::NONE);
+    EXPECT_EQ(policy.select(MessageType::HEARTBEAT, 8192), CompressionType::NONE);
+
+    // Tiny commands aren't worth the call; bulky ones and uploads get LZ4
+    EXPECT_EQ(policy.select(MessageType::VK_QUEUE_SUBMIT, 64), CompressionType::NONE);
+    EXPECT_EQ(policy.select(MessageType::VK_QUEUE_SUBMIT, 64 * 1024), CompressionType::LZ4);
+    EXPECT_EQ(policy.select(MessageType::VK_MAP_MEMORY, 2048), CompressionType::NONE);
+
+    // Uploads travel in command batches, compressed from the smaller upload size
+    EXPECT_EQ(policy.select(MessageType::VK_COMMAND_BATCH, 512), CompressionType::NONE);
+    EXPECT_EQ(policy.select(MessageType::VK_COMMAND_BATCH, 2048), CompressionType::LZ4);
+    EXPECT_EQ(policy.select(MessageType::VK_WRITE_MEMORY, 2048), CompressionType::LZ4);
+}
+
+TEST(CompressionPolicyTest, OverrideAndRules) {
+    CompressionPolicy policy;
+    policy.setCodecOverride(CompressionType::ZLIB);
+    EXPECT_EQ(policy.select(MessageType::VK_COMMAND_BATCH, 2048), CompressionType::ZLIB);
+
+    // The override never turns compression on for a type that has it off
+    EXPECT_EQ(policy.select(MessageType::FRAME_DATA, 1024 * 1024), CompressionType::NONE);
+
+    policy.setCodecOverride(CompressionType::NONE);
+    policy.setRule(MessageType::FRAME_DATA, {CompressionType::ZLIB, 100});
+    EXPECT_EQ(policy.select(MessageType::FRAME_DATA, 99), CompressionType::NONE);
+    EXPECT_EQ(policy.select(MessageType::FRAME_DATA, 100), CompressionType::ZLIB);
+    EXPECT_EQ(policy.rule(MessageType::FRAME_DATA).min_size, 100);
+}
+
+TEST(CompressionPolicyTest, AdaptiveFollowsCost) {
+    CompressionPolicy policy;
+    policy.setAdaptive(true);
+
+    // Nothing measured yet: compress to find out
+    EXPECT_EQ(policy.select(MessageType::VK_COMMAND_BATCH, 1 << 20), CompressionType::LZ4);
+
+    // LZ4 at 1GB/s halving the data beats a 100MB/s link
+    policy.recordCompression(MessageType::VK_COMMAND_BATCH, CompressionType::LZ4,
+        1000000000, 500000000, SECOND);
+    policy.recordTransfer(100000000, SECOND);
+    EXPECT_DOUBLE_EQ(policy.bandwidth(), 100000000.0);
+    EXPECT_DOUBLE_EQ(policy.compressionRatio(MessageType::VK_COMMAND_BATCH), 0.5);
+    EXPECT_EQ(policy.select(MessageType::VK_COMMAND_BATCH, 1 << 20), CompressionType::LZ4);
+
+    // On a 10GB/s link it only adds latency, apart from the periodic probe
+    for (int i = 0; i < 100; ++i) {
+        policy.recordTransfer(10000000000, SECOND);
+    }
+    size_t compressed = 0;
+    for (uint32_t i = 0; i < CompressionPolicy::PROBE_INTERVAL * 2; ++i) {
+        if (policy.select(MessageType::VK_COMMAND_BATCH, 1 << 20) != CompressionType::NONE) {
+            compressed++;
+        }
+    }
+    EXPECT_EQ(compressed, 2);
+}
+
+TEST(CompressionPolicyTest, EwmaSmoothsSamples) {
+    EwmaEstimate estimate;
+    EXPECT_FALSE(estimate.valid());
+
+    estimate.add(100.0);
+    EXPECT_TRUE(estimate.valid());
+    EXPECT_DOUBLE_EQ(estimate.value(), 100.0);
+
+    estimate.add(200.0);
+    EXPECT_DOUBLE_EQ(estimate.value(), 100.0 + EwmaEstimate::WEIGHT * 100.0);
+
+    for (int i = 0; i < 200; ++i) {
+        estimate.add(200.0);
+    }
+    EXPECT_NEAR(estimate.value(), 200.0, 0.01);
+}
+
+TEST(CompressionPolicyTest, SmallTransfersAreNotTimed) {
+    CompressionPolicy policy;
+    policy.recordTransfer(CompressionPolicy::MIN_BANDWIDTH_SAMPLE - 1,
+        std::chrono::microseconds(1));
+    EXPECT_DOUBLE_EQ(policy.bandwidth(), 0.0);
+}
@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
+#include "common/gpu/capture_engine.hpp"
 #include "common/gpu/frame_capture.hpp"
+#include "common/gpu/readback_capture.hpp"
+#include "common/gpu/software_codec.hpp"
 #include "common/gpu/vulkan_utils.hpp"
 #include <thread>
 #include <chrono>
@@ -37,8 +40,21 @@ protected:
         queue_create_info.pQueuePriorities = &queue_priority;
         device_create_info.pQueueCreateInfos = &queue_create_info;
 
+        // Capture hands frames to CUDA through exported memory and a timeline semaphore
+        auto extensions = FrameCapture::requiredDeviceExtensions();
+        device_create_info.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+        device_create_info.ppEnabledExtensionNames = extensions.data();
+
+        VkPhysicalDeviceTimelineSemaphoreFeatures timeline_features = {};
+        timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+        timeline_features.timelineSemaphore = VK_TRUE;
+        device_create_info.pNext = &timeline_features;
+
         result = vkCreateDevice(physical_devices[0], &device_create_info, nullptr, &device_);
         ASSERT_EQ(result, VK_SUCCESS);
+        physical_device_ = physical_devices[0];
+        vkGetDeviceQueue(device_, 0, 0, &queue_);
+        ASSERT_NO_FATAL_FAILURE(createImage());
 
         // Create frame capture
         FrameCapture::CaptureConfig config;
@@ -48,85 +64,145 @@ protected:
         config.fps = 60;
         config.bitrate = 5000000; // 5 Mbps
         config.gop_size = 30;
-        config.h264 = true;
+        config.codec = FrameCapture::Codec::H264;
         config.hardware_encoding = true;
 
         frame_capture_ = std::make_unique<FrameCapture>(config);
-        ASSERT_TRUE(frame_capture_->initialize(device_, physical_devices[0]));
+        ASSERT_TRUE(frame_capture_->initialize(device_, physical_device_));
     }
 
     void TearDown() override {
         frame_capture_.reset();
+        vkDestroyImage(device_, image_, nullptr);
+        vkFreeMemory(device_, image_memory_, nullptr);
         vkDestroyDevice(device_, nullptr);
         vkDestroyInstance(instance_, nullptr);
     }
 
+    // Stands in for a swapchain image: 1920x1080 BGRA in PRESENT_SRC_KHR
+    void createImage() {
+        VkImageCreateInfo image_create_info = {};
+        image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        image_create_info.imageType = VK_IMAGE_TYPE_2D;
+        image_create_info.format = VK_FORMAT_B8G8R8A8_UNORM;
+        image_create_info.extent.width = 1920;
+        image_create_info.extent.height = 1080;
+        image_create_info.extent.depth = 1;
+        image_create_info.mipLevels = 1;
+        image_create_info.arrayLayers = 1;
+        image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+        image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        image_create_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        ASSERT_EQ(vkCreateImage(device_, &image_create_info, nullptr, &image_), VK_SUCCESS);
+
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(device_, image_, &requirements);
+        VkPhysicalDeviceMemoryProperties properties;
+        vkGetPhysicalDeviceMemoryProperties(physical_device_, &properties);
+        uint32_t type = properties.memoryTypeCount;
+        for (uint32_t i = 0; i < properties.memoryTypeCount && type == properties.memoryTypeCount;
+             ++i) {
+            if ((requirements.memoryTypeBits & (1u << i)) &&
+                (properties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+                type = i;
+            }
+        }
+        ASSERT_LT(type, properties.memoryTypeCount);
+
+        VkMemoryAllocateInfo allocate_info = {};
+        allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocate_info.allocationSize = requirements.size;
+        allocate_info.memoryTypeIndex = type;
+        ASSERT_EQ(vkAllocateMemory(device_, &allocate_info, nullptr, &image_memory_), VK_SUCCESS);
+        ASSERT_EQ(vkBindImageMemory(device_, image_, image_memory_, 0), VK_SUCCESS);
+        fillImage(0.25f);
+    }
+
+    // Clears the image to one grey level, leaving it in PRESENT_SRC_KHR
+    void fillImage(float level) {
+        VkCommandPoolCreateInfo pool_info = {};
+        pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        pool_info.queueFamilyIndex = 0;
+        VkCommandPool pool;
+        ASSERT_EQ(vkCreateCommandPool(device_, &pool_info, nullptr, &pool), VK_SUCCESS);
+
+        VkCommandBufferAllocateInfo allocate_info = {};
+        allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocate_info.commandPool = pool;
+        allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocate_info.commandBufferCount = 1;
+        VkCommandBuffer cmd;
+        ASSERT_EQ(vkAllocateCommandBuffers(device_, &allocate_info, &cmd), VK_SUCCESS);
+
+        VkCommandBufferBeginInfo begin_info = {};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(cmd, &begin_info);
+
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image_;
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        VkClearColorValue color = {};
+        color.float32[0] = level;
+        color.float32[1] = level;
+        color.float32[2] = level;
+        color.float32[3] = 1.0f;
+        vkCmdClearColorImage(cmd, image_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1,
+            &barrier.subresourceRange);
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        vkEndCommandBuffer(cmd);
+
+        VkSubmitInfo submit_info = {};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &cmd;
+        EXPECT_EQ(vkQueueSubmit(queue_, 1, &submit_info, VK_NULL_HANDLE), VK_SUCCESS);
+        EXPECT_EQ(vkQueueWaitIdle(queue_), VK_SUCCESS);
+        vkDestroyCommandPool(device_, pool, nullptr);
+    }
+
     VkInstance instance_;
+    VkPhysicalDevice physical_device_;
     VkDevice device_;
+    VkQueue queue_;
+    VkImage image_{VK_NULL_HANDLE};
+    VkDeviceMemory image_memory_{VK_NULL_HANDLE};
     std::unique_ptr<FrameCapture> frame_capture_;
 };
 
 TEST_F(FrameCaptureTest, FrameCaptureAndEncode) {
-    // Create test image
-    VkImageCreateInfo image_create_info = {};
-    image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    image_create_info.imageType = VK_IMAGE_TYPE_2D;
-    image_create_info.format = VK_FORMAT_B8G8R8A8_UNORM;
-    image_create_info.extent.width = 1920;
-    image_create_info.extent.height = 1080;
-    image_create_info.extent.depth = 1;
-    image_create_info.mipLevels = 1;
-    image_create_info.arrayLayers = 1;
-    image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
-    image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
-    image_create_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-    image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-
-    VkImage image;
-    VkResult result = vkCreateImage(device_, &image_create_info, nullptr, &image);
-    ASSERT_EQ(result, VK_SUCCESS);
-
-    // Create command buffer
-    VkCommandPoolCreateInfo pool_create_info = {};
-    pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    pool_create_info.queueFamilyIndex = 0;
-
-    VkCommandPool command_pool;
-    result = vkCreateCommandPool(device_, &pool_create_info, nullptr, &command_pool);
-    ASSERT_EQ(result, VK_SUCCESS);
-
-    VkCommandBufferAllocateInfo alloc_info = {};
-    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    alloc_info.commandPool = command_pool;
-    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    alloc_info.commandBufferCount = 1;
-
-    VkCommandBuffer command_buffer;
-    result = vkAllocateCommandBuffers(device_, &alloc_info, &command_buffer);
-    ASSERT_EQ(result, VK_SUCCESS);
-
     // Capture frame
-    ASSERT_TRUE(frame_capture_->captureFrame(command_buffer, image));
+    ASSERT_TRUE(frame_capture_->captureFrame(image_));
 
     // Get encoded frame
     std::vector<uint8_t> frame_data;
     ASSERT_TRUE(frame_capture_->getEncodedFrame(frame_data));
     ASSERT_FALSE(frame_data.empty());
-
-    // Clean up
-    vkFreeCommandBuffers(device_, command_pool, 1, &command_buffer);
-    vkDestroyCommandPool(device_, command_pool, nullptr);
-    vkDestroyImage(device_, image, nullptr);
 }
 
 TEST_F(FrameCaptureTest, Statistics) {
-    // Create test image and command buffer (similar to previous test)
-    // ... (reuse code from previous test)
-
     // Capture multiple frames
     for (int i = 0; i < 10; ++i) {
-        ASSERT_TRUE(frame_capture_->captureFrame(command_buffer, image));
+        ASSERT_TRUE(frame_capture_->captureFrame(image_));
         std::vector<uint8_t> frame_data;
         ASSERT_TRUE(frame_capture_->getEncodedFrame(frame_data));
         std::this_thread::sleep_for(std::chrono::milliseconds(16)); // ~60 FPS
@@ -139,18 +215,15 @@ TEST_F(FrameCaptureTest, Statistics) {
     ASSERT_GT(stats.total_bytes, 0);
     ASSERT_GT(stats.average_fps, 0);
     ASSERT_GE(stats.average_latency, 0);
-
-    // Clean up
-    // ... (reuse cleanup code from previous test)
+    ASSERT_GT(stats.average_encode_time, 0);
+    ASSERT_GE(stats.average_convert_time, 0);
+    ASSERT_GE(stats.average_copy_time, 0);
 }
 
 TEST_F(FrameCaptureTest, Flush) {
-    // Create test image and command buffer (similar to previous test)
-    // ... (reuse code from previous test)
-
     // Capture multiple frames
     for (int i = 0; i < 5; ++i) {
-        ASSERT_TRUE(frame_capture_->captureFrame(command_buffer, image));
+        ASSERT_TRUE(frame_capture_->captureFrame(image_));
         std::this_thread::sleep_for(std::chrono::milliseconds(16));
     }
 
@@ -158,9 +231,218 @@ TEST_F(FrameCaptureTest, Flush) {
     frame_capture_->flush();
     std::vector<uint8_t> frame_data;
     ASSERT_FALSE(frame_capture_->getEncodedFrame(frame_data));
+}
+
+TEST_F(FrameCaptureTest, FramesOverlapInFlight) {
+    // Every slot can hold a frame before anything is collected
+    for (uint32_t i = 0; i < FrameCapture::DEFAULT_SLOT_COUNT; ++i) {
+        ASSERT_TRUE(frame_capture_->captureFrame(image_));
+    }
+
+    // Bitstreams come back in capture order, one per frame
+    std::vector<uint8_t> frame_data;
+    for (uint32_t i = 0; i < FrameCapture::DEFAULT_SLOT_COUNT; ++i) {
+        ASSERT_TRUE(frame_capture_->getEncodedFrame(frame_data));
+        ASSERT_FALSE(frame_data.empty());
+    }
+    ASSERT_FALSE(frame_capture_->getEncodedFrame(frame_data));
+}
 
-    // Clean up
-    // ... (reuse cleanup code from previous test)
+TEST_F(FrameCaptureTest, SlowReaderDropsOldFrames) {
+    // Keep capturing without collecting; the output ring only holds the newest
+    for (uint32_t i = 0; i < FrameCapture::DEFAULT_SLOT_COUNT * 3; ++i) {
+        frame_capture_->captureFrame(image_);
+        std::this_thread::sleep_for(std::chrono::milliseconds(16));
+    }
+
+    std::vector<uint8_t> frame_data;
+    uint32_t collected = 0;
+    while (frame_capture_->getEncodedFrame(frame_data)) {
+        ASSERT_FALSE(frame_data.empty());
+        collected++;
+    }
+    EXPECT_LE(collected, FrameCapture::DEFAULT_SLOT_COUNT);
+    EXPECT_GT(frame_capture_->getStatistics().frames_dropped, 0);
+}
+
+TEST_F(FrameCaptureTest, UltraLowLatencySlices) {
+    FrameCapture::CaptureConfig config = {};
+    config.width = 1920;
+    config.height = 1080;
+    config.format = VK_FORMAT_B8G8R8A8_UNORM;
+    config.fps = 60;
+    config.bitrate = 5000000;
+    config.gop_size = 60;
+    config.codec = FrameCapture::Codec::HEVC;
+    config.hardware_encoding = true;
+    config.latency_profile = FrameCapture::LatencyProfile::ULTRA_LOW_LATENCY;
+    config.slice_count = 4;
+
+    FrameCapture capture(config);
+    ASSERT_TRUE(capture.initialize(device_, physical_device_));
+
+    // Each frame arrives in one or more pieces carrying its id, the last one marked
+    for (uint64_t id = 1; id <= 3; ++id) {
+        ASSERT_TRUE(capture.captureFrame(image_, id));
+        std::vector<uint8_t> frame_data;
+        bool end_of_frame = false;
+        size_t total = 0;
+        while (!end_of_frame) {
+            uint64_t frame_id = 0;
+            ASSERT_TRUE(capture.getEncodedFrame(frame_data, &end_of_frame, &frame_id));
+            EXPECT_EQ(frame_id, id);
+            total += frame_data.size();
+        }
+        EXPECT_GT(total, 0);
+    }
+    std::vector<uint8_t> frame_data;
+    EXPECT_FALSE(capture.getEncodedFrame(frame_data));
+}
+
+TEST_F(FrameCaptureTest, ReconfiguresOnTheFly) {
+    std::vector<uint8_t> frame_data;
+    frame_capture_->setBitrate(2000000);
+    ASSERT_TRUE(frame_capture_->captureFrame(image_));
+    ASSERT_TRUE(frame_capture_->getEncodedFrame(frame_data));
+
+    // Only ever down from the configured size, and even for 4:2:0
+    EXPECT_FALSE(frame_capture_->setResolution(3840, 2160));
+    EXPECT_FALSE(frame_capture_->setResolution(1279, 720));
+    ASSERT_TRUE(frame_capture_->setResolution(1280, 720));
+    ASSERT_TRUE(frame_capture_->captureFrame(image_));
+    ASSERT_TRUE(frame_capture_->getEncodedFrame(frame_data));
+    EXPECT_FALSE(frame_data.empty());
+}
+
+TEST_F(FrameCaptureTest, UnchangedFramesRepeat) {
+    FrameCapture::CaptureConfig config = {};
+    config.width = 1920;
+    config.height = 1080;
+    config.format = VK_FORMAT_B8G8R8A8_UNORM;
+    config.fps = 60;
+    config.bitrate = 5000000;
+    config.gop_size = 30;
+    config.codec = FrameCapture::Codec::H264;
+    config.hardware_encoding = true;
+    config.unchanged_frames = FrameCapture::UnchangedFrames::REPEAT;
+
+    FrameCapture capture(config);
+    ASSERT_TRUE(capture.initialize(device_, physical_device_));
+
+    // The same image twice: the second comes out as an empty repeat
+    std::vector<uint8_t> frame_data;
+    ASSERT_TRUE(capture.captureFrame(image_));
+    ASSERT_TRUE(capture.getEncodedFrame(frame_data));
+    EXPECT_FALSE(frame_data.empty());
+    ASSERT_TRUE(capture.captureFrame(image_));
+    ASSERT_TRUE(capture.getEncodedFrame(frame_data));
+    EXPECT_TRUE(frame_data.empty());
+
+    // New content is encoded again
+    fillImage(0.75f);
+    ASSERT_TRUE(capture.captureFrame(image_));
+    ASSERT_TRUE(capture.getEncodedFrame(frame_data));
+    EXPECT_FALSE(frame_data.empty());
+
+    auto stats = capture.getStatistics();
+    EXPECT_EQ(stats.frames_skipped, 1);
+    EXPECT_EQ(stats.frames_captured, 3);
+}
+
+TEST_F(FrameCaptureTest, RejectsAv1Yuv444) {
+    FrameCapture::CaptureConfig config = {};
+    config.width = 1920;
+    config.height = 1080;
+    config.format = VK_FORMAT_B8G8R8A8_UNORM;
+    config.fps = 60;
+    config.bitrate = 5000000;
+    config.gop_size = 30;
+    config.codec = FrameCapture::Codec::AV1;
+    config.hardware_encoding = true;
+    config.yuv444 = true;
+
+    FrameCapture capture(config);
+    EXPECT_FALSE(capture.initialize(device_, physical_device_));
+}
+
+TEST_F(FrameCaptureTest, RejectsUnsupportedFormat) {
+    FrameCapture::CaptureConfig config = {};
+    config.width = 1920;
+    config.height = 1080;
+    config.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+    config.fps = 60;
+    config.bitrate = 5000000;
+    config.gop_size = 30;
+    config.codec = FrameCapture::Codec::H264;
+    config.hardware_encoding = true;
+
+    FrameCapture capture(config);
+    EXPECT_FALSE(capture.initialize(device_, physical_device_));
+
+    // Nothing was captured, so there is nothing to wait for
+    std::vector<uint8_t> frame_data;
+    EXPECT_FALSE(capture.getEncodedFrame(frame_data));
+}
+
+TEST_F(FrameCaptureTest, EngineFallsBackToSoftware) {
+    // NVENC turns this down, so the engine reads frames back instead
+    FrameCapture::CaptureConfig config = {};
+    config.width = 1920;
+    config.height = 1080;
+    config.format = VK_FORMAT_B8G8R8A8_UNORM;
+    config.fps = 60;
+    config.bitrate = 5000000;
+    config.gop_size = 30;
+    config.codec = FrameCapture::Codec::AV1;
+    config.hardware_encoding = true;
+    config.yuv444 = true;
+
+    CaptureEngine engine(config);
+    ASSERT_TRUE(engine.initialize(device_, physical_device_));
+    EXPECT_EQ(engine.backend(), CaptureEngine::Backend::SOFTWARE);
+    EXPECT_EQ(engine.encoding(), anarchy::network::FrameEncoding::SOFTWARE);
+
+    SoftwareDecoder decoder;
+    std::vector<uint8_t> frame_data;
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_TRUE(engine.captureFrame(image_));
+        ASSERT_TRUE(engine.getEncodedFrame(frame_data));
+        ASSERT_TRUE(decoder.decode(frame_data.data(), frame_data.size()));
+    }
+    EXPECT_EQ(decoder.width(), 1920u);
+    EXPECT_EQ(decoder.pixels().size(), 1920u * 1080u * 4u);
+    EXPECT_EQ(decoder.pixels()[0], 64);     // The fixture's 0.25 grey
+    EXPECT_FALSE(engine.getEncodedFrame(frame_data));
+    EXPECT_EQ(engine.getStatistics().frames_captured, 3);
+}
+
+TEST_F(FrameCaptureTest, RawReadbackReusesSlots) {
+    FrameCapture::CaptureConfig config = {};
+    config.width = 1920;
+    config.height = 1080;
+    config.format = VK_FORMAT_B8G8R8A8_UNORM;
+    config.fps = 60;
+    config.gop_size = 30;
+
+    CaptureEngine engine(config, {CaptureEngine::Backend::RAW});
+    ASSERT_TRUE(engine.initialize(device_, physical_device_));
+
+    // More frames than slots, each collected before the next
+    std::vector<uint8_t> frame_data;
+    for (int i = 0; i < 8; ++i) {
+        ASSERT_TRUE(engine.captureFrame(image_));
+        ASSERT_TRUE(engine.getEncodedFrame(frame_data));
+        EXPECT_EQ(frame_data.size(), sizeof(SoftwareFrameHeader) + 1920u * 1080u * 4u);
+    }
+
+    // Uncollected frames hold their slots, and the next capture is dropped
+    for (uint32_t i = 0; i < ReadbackCapture::DEFAULT_SLOT_COUNT; ++i) {
+        ASSERT_TRUE(engine.captureFrame(image_));
+    }
+    EXPECT_FALSE(engine.captureFrame(image_));
+    engine.flush();
+    EXPECT_FALSE(engine.getEncodedFrame(frame_data));
+    EXPECT_EQ(engine.getStatistics().frames_dropped, 1);
 }
 
 int main(int argc, char** argv) {
@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+#include "common/network/frame_filter.hpp"
+#include <vector>
+
+using namespace anarchy::network;
+
+class FrameFilterTest : public ::testing::Test {
+protected:
+    void addSlice(uint64_t sequence, bool partial) {
+        Message slice;
+        slice.header.type = MessageType::FRAME_DATA;
+        slice.header.sequence = sequence;
+        slice.header.flags = partial ? HEADER_FLAG_PARTIAL_FRAME : 0;
+        slices.push_back(slice);
+    }
+
+    // A whole frame of count slices
+    void addFrame(uint64_t sequence, uint32_t count) {
+        for (uint32_t i = 0; i < count; ++i) {
+            addSlice(sequence, i + 1 < count);
+        }
+    }
+
+    // Sequences of the slices delivered out of what was added
+    std::vector<uint64_t> pass() {
+        std::vector<Message> deliver;
+        dropped += filter.select(slices, deliver);
+        slices.clear();
+        std::vector<uint64_t> sequences;
+        for (const Message& slice : deliver) {
+            sequences.push_back(slice.header.sequence);
+        }
+        return sequences;
+    }
+
+    FrameFilter filter;
+    std::vector<Message> slices;
+    size_t dropped = 0;
+};
+
+TEST_F(FrameFilterTest, DeliversOnlyTheNewestFrame) {
+    addFrame(1, 3);
+    addFrame(2, 3);
+    EXPECT_EQ(pass(), (std::vector<uint64_t>{2, 2, 2}));
+    EXPECT_EQ(dropped, 1);
+}
+
+TEST_F(FrameFilterTest, FinishesAStartedFrame) {
+    addSlice(1, true);
+    addSlice(1, true);
+    EXPECT_EQ(pass(), (std::vector<uint64_t>{1, 1}));
+
+    // The rest of frame 1 comes first, even with newer frames behind it
+    addSlice(1, false);
+    addFrame(2, 2);
+    addFrame(3, 2);
+    EXPECT_EQ(pass(), (std::vector<uint64_t>{1, 3, 3}));
+    EXPECT_EQ(dropped, 1);
+}
+
+TEST_F(FrameFilterTest, DropsStaleFramesWhole) {
+    addFrame(5, 1);
+    EXPECT_EQ(pass(), (std::vector<uint64_t>{5}));
+
+    // Its slices are split over two passes but it counts as one frame
+    addSlice(4, true);
+    EXPECT_TRUE(pass().empty());
+    addSlice(4, false);
+    EXPECT_TRUE(pass().empty());
+    EXPECT_EQ(dropped, 1);
+
+    addFrame(6, 2);
+    EXPECT_EQ(pass(), (std::vector<uint64_t>{6, 6}));
+}
+
+TEST_F(FrameFilterTest, SequencesWrap) {
+    addFrame(UINT64_MAX, 1);
+    EXPECT_EQ(pass(), (std::vector<uint64_t>{UINT64_MAX}));
+    addFrame(0, 1);
+    EXPECT_EQ(pass(), (std::vector<uint64_t>{0}));
+    EXPECT_EQ(dropped, 0);
+}
@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+#include "server/gpu_scheduler.hpp"
+#include <map>
+#include <vector>
+
+using namespace anarchy::server;
+
+namespace {
+
+// Runs the scheduler against a GPU that executes one job at a time, each
+// session's jobs costing what costs says, until total_time has passed
+void simulate(GpuScheduler& scheduler, const std::map<uint64_t, uint64_t>& costs,
+    uint64_t total_time)
+{
+    for (uint64_t time = 0; time < total_time;) {
+        for (const auto& cost : costs) {
+            while (scheduler.queued(cost.first) < 4) {
+                scheduler.enqueue(cost.first, [] {});
+            }
+        }
+        uint64_t session = 0;
+        GpuScheduler::Job job;
+        ASSERT_TRUE(scheduler.next(session, job));
+        job();
+        scheduler.complete(session, costs.at(session));
+        time += costs.at(session);
+    }
+}
+
+} // namespace
+
+TEST(GpuSchedulerTest, SessionWorkRunsInOrder) {
+    GpuScheduler scheduler;
+    std::vector<int> ran;
+    for (int i = 0; i < 5; i++) {
+        scheduler.enqueue(1, [&ran, i] { ran.push_back(i); });
+    }
+
+    uint64_t session = 0;
+    GpuScheduler::Job job;
+    while (scheduler.next(session, job)) {
+        EXPECT_EQ(session, 1u);
+        job();
+        scheduler.complete(session, 1000);
+    }
+    EXPECT_EQ(ran, (std::vector<int>{0, 1, 2, 3, 4}));
+    EXPECT_TRUE(scheduler.idle(1));
+    EXPECT_EQ(scheduler.gpuTime(1), 5000u);
+}
+
+TEST(GpuSchedulerTest, LimitsWorkInFlight) {
+    GpuScheduler scheduler(2);
+    for (int i = 0; i < 4; i++) {
+        scheduler.enqueue(1, [] {});
+    }
+
+    uint64_t session = 0;
+    GpuScheduler::Job job;
+    EXPECT_TRUE(scheduler.next(session, job));
+    EXPECT_TRUE(scheduler.next(session, job));
+    EXPECT_FALSE(scheduler.next(session, job));
+    EXPECT_EQ(scheduler.inFlight(), 2u);
+
+    scheduler.complete(1, 100);
+    EXPECT_TRUE(scheduler.next(session, job));
+    EXPECT_FALSE(scheduler.idle(1));
+}
+
+TEST(GpuSchedulerTest, HeavySessionGetsItsShareOnly) {
+    // One client's frames cost ten times the other's
+    GpuScheduler scheduler(1);
+    scheduler.addSession(1);
+    scheduler.addSession(2);
+    simulate(scheduler, {{1, 10000}, {2, 1000}}, 10000000);
+
+    double ratio = static_cast<double>(scheduler.gpuTime(1)) / scheduler.gpuTime(2);
+    EXPECT_NEAR(ratio, 1.0, 0.05);
+}
+
+TEST(GpuSchedulerTest, PrioritiesWeightTheShares) {
+    GpuScheduler scheduler(1);
+    scheduler.addSession(1, GpuScheduler::Priority::INTERACTIVE);
+    scheduler.addSession(2, GpuScheduler::Priority::NORMAL);
+    scheduler.addSession(3, GpuScheduler::Priority::BACKGROUND);
+    simulate(scheduler, {{1, 2000}, {2, 2000}, {3, 2000}}, 13000000);
+
+    // 8 : 4 : 1, and the background session still runs
+    EXPECT_NEAR(static_cast<double>(scheduler.gpuTime(1)) / scheduler.gpuTime(2), 2.0, 0.1);
+    EXPECT_NEAR(static_cast<double>(scheduler.gpuTime(2)) / scheduler.gpuTime(3), 4.0, 0.2);
+}
+
+TEST(GpuSchedulerTest, IdleTimeIsNotSavedUp) {
+    GpuScheduler scheduler(1);
+    scheduler.addSession(1);
+    scheduler.addSession(2);
+    simulate(scheduler, {{1, 1000}}, 1000000);
+
+    // Session 2 comes back after a long pause and shares from then on,
+    // rather than having the GPU to itself until it has caught up
+    simulate(scheduler, {{1, 1000}, {2, 1000}}, 20000);
+    EXPECT_NEAR(static_cast<double>(scheduler.gpuTime(2)), 10000.0, 2000.0);
+}
+
+TEST(GpuSchedulerTest, RemovedSessionsDropTheirWork) {
+    GpuScheduler scheduler(1);
+    bool ran = false;
+    scheduler.enqueue(1, [] {});
+    scheduler.enqueue(1, [&ran] { ran = true; });
+
+    uint64_t session = 0;
+    GpuScheduler::Job job;
+    ASSERT_TRUE(scheduler.next(session, job));
+    scheduler.removeSession(1);
+    scheduler.enqueue(1, [&ran] { ran = true; });
+
+    // Its job in flight still counts until it completes
+    EXPECT_FALSE(scheduler.idle(1));
+    scheduler.complete(1, 100);
+    EXPECT_EQ(scheduler.inFlight(), 0u);
+    EXPECT_FALSE(scheduler.next(session, job));
+    EXPECT_FALSE(ran);
+    EXPECT_TRUE(scheduler.idle(1));
+}
@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+#include "server/handle_table.hpp"
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace anarchy::network;
+using namespace anarchy::server;
+
+TEST(VirtualHandleTest, EncodesTypeAndIndex) {
+    uint64_t handle = makeVirtualHandle(HandleType::BUFFER, 42);
+    EXPECT_EQ(virtualHandleType(handle), HandleType::BUFFER);
+    EXPECT_EQ(virtualHandleIndex(handle), 42);
+
+    HandleAllocator allocator;
+    uint64_t first = allocator.allocate(HandleType::FENCE);
+    uint64_t second = allocator.allocate(HandleType::FENCE);
+    EXPECT_NE(first, 0);
+    EXPECT_NE(first, second);
+    EXPECT_EQ(virtualHandleType(second), HandleType::FENCE);
+
+    // ID spaces are per type
+    EXPECT_EQ(virtualHandleIndex(allocator.allocate(HandleType::IMAGE)), 1);
+}
+
+TEST(HandleTableTest, InsertLookupRemove) {
+    HandleTable table;
+    uint64_t handle = makeVirtualHandle(HandleType::IMAGE, 7);
+
+    EXPECT_EQ(table.lookup(handle), 0);
+    EXPECT_TRUE(table.insert(handle, uint64_t(0xDEADBEEF)));
+    EXPECT_EQ(table.lookup(handle), 0xDEADBEEF);
+    EXPECT_EQ(table.size(), 1);
+
+    // A handle can only be mapped once
+    EXPECT_FALSE(table.insert(handle, uint64_t(0x1234)));
+
+    EXPECT_EQ(table.remove(handle), 0xDEADBEEF);
+    EXPECT_EQ(table.lookup(handle), 0);
+    EXPECT_EQ(table.size(), 0);
+}
+
+TEST(HandleTableTest, RejectsMalformedHandles) {
+    HandleTable table;
+    EXPECT_FALSE(table.insert(0, uint64_t(1)));
+    EXPECT_FALSE(table.insert(makeVirtualHandle(HandleType::COUNT, 1), uint64_t(1)));
+    EXPECT_FALSE(table.insert(
+        makeVirtualHandle(HandleType::BUFFER, HandleTable::PAGE_SIZE * HandleTable::MAX_PAGES),
+        uint64_t(1)));
+    EXPECT_EQ(table.lookup(makeVirtualHandle(HandleType::BUFFER, 99)), 0);
+}
+
+TEST(HandleTableTest, TypesDoNotAlias) {
+    HandleTable table;
+    EXPECT_TRUE(table.insert(makeVirtualHandle(HandleType::BUFFER, 1), uint64_t(100)));
+    EXPECT_TRUE(table.insert(makeVirtualHandle(HandleType::IMAGE, 1), uint64_t(200)));
+    EXPECT_EQ(table.lookup(makeVirtualHandle(HandleType::BUFFER, 1)), 100);
+    EXPECT_EQ(table.lookup(makeVirtualHandle(HandleType::IMAGE, 1)), 200);
+}
+
+TEST(HandleTableTest, ServerAllocatedHandles) {
+    HandleTable table;
+    uint64_t handle = table.allocate(HandleType::PHYSICAL_DEVICE, 0xABCD);
+    EXPECT_EQ(virtualHandleType(handle), HandleType::PHYSICAL_DEVICE);
+    EXPECT_EQ(table.lookup(handle), 0xABCD);
+
+    table.clear();
+    EXPECT_EQ(table.lookup(handle), 0);
+    EXPECT_EQ(table.size(), 0);
+}
+
+TEST(HandleTableTest, TakeEmptiesOneType) {
+    HandleTable table;
+    uint64_t far_index = HandleTable::PAGE_SIZE * 3 + 5;
+    ASSERT_TRUE(table.insert(makeVirtualHandle(HandleType::FENCE, 1), uint64_t(0x10)));
+    ASSERT_TRUE(table.insert(makeVirtualHandle(HandleType::FENCE, far_index), uint64_t(0x20)));
+    ASSERT_TRUE(table.insert(makeVirtualHandle(HandleType::BUFFER, 1), uint64_t(0x30)));
+
+    std::vector<uint64_t> fences = table.take(HandleType::FENCE);
+    std::sort(fences.begin(), fences.end());
+    EXPECT_EQ(fences, (std::vector<uint64_t>{0x10, 0x20}));
+    EXPECT_EQ(table.lookup(makeVirtualHandle(HandleType::FENCE, 1)), 0u);
+    EXPECT_EQ(table.lookup(makeVirtualHandle(HandleType::BUFFER, 1)), 0x30u);
+    EXPECT_EQ(table.size(), 1u);
+    EXPECT_TRUE(table.take(HandleType::FENCE).empty());
+}
+
+TEST(HandleTableTest, ConcurrentInsertsAcrossPages) {
+    HandleTable table;
+    const uint64_t per_thread = HandleTable::PAGE_SIZE * 2;
+
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&table, t, per_thread]() {
+            for (uint64_t i = 1; i <= per_thread; ++i) {
+                uint64_t index = t * per_thread + i;
+                table.insert(makeVirtualHandle(HandleType::COMMAND_BUFFER, index), index);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(table.size(), 4 * per_thread);
+    for (uint64_t index = 1; index <= 4 * per_thread; ++index) {
+        ASSERT_EQ(table.lookup(makeVirtualHandle(HandleType::COMMAND_BUFFER, index)), index);
+    }
+}
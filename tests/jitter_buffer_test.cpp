@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+#include "client/jitter_buffer.hpp"
+
+using namespace anarchy::client;
+
+namespace {
+
+using Buffer = JitterBuffer<int>;
+using Clock = Buffer::Clock;
+using std::chrono::milliseconds;
+
+const Clock::time_point START = Clock::time_point() + milliseconds(1000);
+const milliseconds INTERVAL(16);
+
+} // namespace
+
+TEST(JitterBufferTest, ZeroDepthShowsNewestImmediately) {
+    Buffer buffer(0, INTERVAL);
+    int picture = 0;
+    EXPECT_FALSE(buffer.pop(START, picture));
+
+    buffer.push(1, START);
+    EXPECT_EQ(buffer.nextDue(), START);
+    ASSERT_TRUE(buffer.pop(START, picture));
+    EXPECT_EQ(picture, 1);
+
+    // Two arriving before a present: only the newer is shown
+    buffer.push(2, START + milliseconds(1));
+    buffer.push(3, START + milliseconds(2));
+    EXPECT_EQ(buffer.size(), 1u);
+    ASSERT_TRUE(buffer.pop(START + milliseconds(2), picture));
+    EXPECT_EQ(picture, 3);
+    EXPECT_EQ(buffer.dropped(), 1u);
+    EXPECT_EQ(buffer.nextDue(), Clock::time_point::max());
+}
+
+TEST(JitterBufferTest, OneFrameDepthSmoothsBursts) {
+    Buffer buffer(1, INTERVAL);
+    buffer.push(1, START);
+    int picture = 0;
+    ASSERT_TRUE(buffer.pop(START, picture));
+    EXPECT_EQ(picture, 1);
+
+    // A late frame followed closely by the next one
+    Clock::time_point burst = START + milliseconds(30);
+    buffer.push(2, burst);
+    buffer.push(3, burst + milliseconds(1));
+
+    ASSERT_TRUE(buffer.pop(burst, picture));
+    EXPECT_EQ(picture, 2);
+    EXPECT_FALSE(buffer.pop(burst + milliseconds(1), picture));
+
+    // Paced one interval after its predecessor rather than shown at once
+    EXPECT_EQ(buffer.nextDue(), burst + INTERVAL);
+    ASSERT_TRUE(buffer.pop(burst + INTERVAL, picture));
+    EXPECT_EQ(picture, 3);
+    EXPECT_EQ(buffer.dropped(), 0u);
+}
+
+TEST(JitterBufferTest, DelayIsBoundedByDepth) {
+    Buffer buffer(1, INTERVAL);
+    int picture = 0;
+    Clock::time_point now = START;
+    for (int i = 0; i < 4; i++) {
+        buffer.push(i, now);
+        EXPECT_LE(buffer.nextDue(), now + INTERVAL);
+        ASSERT_TRUE(buffer.pop(buffer.nextDue(), picture));
+        EXPECT_EQ(picture, i);
+        now += milliseconds(1);
+    }
+}
+
+TEST(JitterBufferTest, DropsOldestWhenFull) {
+    Buffer buffer(1, INTERVAL);
+    buffer.push(1, START);
+    buffer.push(2, START);
+    buffer.push(3, START);
+    EXPECT_EQ(buffer.size(), 2u);
+    EXPECT_EQ(buffer.dropped(), 1u);
+
+    // Both left are due together, so only the newer is shown
+    int picture = 0;
+    EXPECT_FALSE(buffer.pop(START, picture));
+    ASSERT_TRUE(buffer.pop(START + INTERVAL, picture));
+    EXPECT_EQ(picture, 3);
+    EXPECT_EQ(buffer.dropped(), 2u);
+}
+
+TEST(JitterBufferTest, DepthIsClamped) {
+    Buffer buffer(5, INTERVAL);
+    EXPECT_EQ(buffer.depth(), Buffer::MAX_DEPTH);
+    buffer.setDepth(0);
+    EXPECT_EQ(buffer.depth(), 0u);
+}
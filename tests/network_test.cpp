@@ -5,6 +5,7 @@
 #include <chrono>
 #include <iostream>
 #include <atomic>
+#include <mutex>
 
 using namespace anarchy::network;
 
@@ -117,9 +118,10 @@ TEST_F(NetworkTest, LargeMessage) {
 }
 
 TEST_F(NetworkTest, Compression) {
-    // Create a large message with repeating data (good for compression)
+    // Create a large upload with repeating data (good for compression); frames
+    // are never compressed
     Message test_msg;
-    test_msg.header.type = MessageType::FRAME_DATA;
+    test_msg.header.type = MessageType::VK_WRITE_MEMORY;
     test_msg.header.size = 1024 * 10;  // 10KB
     test_msg.header.sequence = 1;
     test_msg.header.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
@@ -145,7 +147,7 @@ TEST_F(NetworkTest, Compression) {
     // Verify message was received and decompressed correctly
     ASSERT_FALSE(received_messages.empty());
     const Message& received = received_messages.back();
-    EXPECT_EQ(received.header.type, MessageType::FRAME_DATA);
+    EXPECT_EQ(received.header.type, MessageType::VK_WRITE_MEMORY);
     EXPECT_EQ(received.header.size, test_msg.header.size);
     EXPECT_EQ(received.payload, test_msg.payload);
 }
@@ -153,7 +155,7 @@ TEST_F(NetworkTest, Compression) {
 TEST_F(NetworkTest, CompressionStats) {
     // Create a large message with repeating data
     Message test_msg;
-    test_msg.header.type = MessageType::FRAME_DATA;
+    test_msg.header.type = MessageType::VK_MAP_MEMORY;
     test_msg.header.size = 1024 * 10;  // 10KB
     test_msg.header.sequence = 1;
     test_msg.header.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
@@ -184,6 +186,216 @@ TEST_F(NetworkTest, CompressionStats) {
     EXPECT_GT(stats.average_compression_time.count(), 0);
 }
 
+TEST_F(NetworkTest, CompressionReusesBuffers) {
+    Message test_msg;
+    test_msg.header.type = MessageType::VK_MAP_MEMORY;
+    test_msg.header.size = 1024 * 64;
+    test_msg.payload.resize(test_msg.header.size);
+    for (size_t i = 0; i < test_msg.payload.size(); ++i) {
+        test_msg.payload[i] = static_cast<uint8_t>(i % 256);
+    }
+
+    server->setMessageCallback([this](const Message& msg) {
+        Message ack;
+        ack.header.type = MessageType::FRAME_ACK;
+        ack.header.sequence = msg.header.sequence;
+        ack.header.size = 0;
+        server->sendMessage(ack);
+    });
+
+    client->setCompressionType(CompressionType::LZ4);
+    for (uint32_t i = 0; i < 10; ++i) {
+        test_msg.header.sequence = i + 1;
+        EXPECT_TRUE(client->sendMessage(test_msg));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    // Steady state recycles the output buffer instead of allocating per message
+    CompressionStatsData stats = client->getCompressionStats();
+    EXPECT_EQ(stats.messages_compressed, 10);
+    EXPECT_LE(stats.buffer_allocations, 2);
+}
+
+TEST_F(NetworkTest, ZeroCopySend) {
+    std::vector<uint8_t> payload(64 * 1024);
+    for (size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = static_cast<uint8_t>(rand() % 256);
+    }
+
+    std::atomic<bool> freed{false};
+    std::vector<uint8_t> received;
+    PayloadView view;
+    server->setZeroCopyCallback([&](ReceivedMessage& msg) {
+        view = msg.payload();
+        received.assign(view.data, view.data + view.size);
+    });
+
+    MessageHeader header{};
+    header.type = MessageType::FRAME_DATA;
+    header.size = static_cast<uint32_t>(payload.size());
+    header.sequence = 1;
+
+    EXPECT_TRUE(client->sendZeroCopy(header, payload.data(), payload.size(),
+        [](void*, void* hint) { static_cast<std::atomic<bool>*>(hint)->store(true); }, &freed));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    EXPECT_TRUE(freed);
+    EXPECT_EQ(received, payload);
+    EXPECT_EQ(view.size, payload.size());
+}
+
+TEST_F(NetworkTest, ZeroCopyReceiveOwnership) {
+    std::vector<ReceivedMessage> kept;
+    server->setZeroCopyCallback([&](ReceivedMessage& msg) {
+        if (msg.header.type == MessageType::VK_MAP_MEMORY) {
+            kept.push_back(std::move(msg));
+        }
+    });
+
+    Message test_msg;
+    test_msg.header.type = MessageType::VK_MAP_MEMORY;
+    test_msg.header.size = 1024 * 10;
+    test_msg.header.sequence = 1;
+    test_msg.payload.resize(test_msg.header.size);
+    for (size_t i = 0; i < test_msg.payload.size(); ++i) {
+        test_msg.payload[i] = static_cast<uint8_t>(i % 256);
+    }
+    std::vector<uint8_t> expected = test_msg.payload;
+
+    // Compressed on the way out, decompressed into a pooled buffer
+    client->setCompressionType(CompressionType::ZLIB);
+    EXPECT_TRUE(client->sendMessage(std::move(test_msg)));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    ASSERT_EQ(kept.size(), 1);
+    EXPECT_EQ(kept[0].header.compression(), CompressionType::NONE);
+    PayloadView view = kept[0].payload();
+    ASSERT_EQ(view.size, expected.size());
+    EXPECT_EQ(std::vector<uint8_t>(view.data, view.data + view.size), expected);
+
+    Message owned = std::move(kept[0]).toMessage();
+    EXPECT_EQ(owned.payload, expected);
+}
+
+TEST(ChannelTest, Endpoints) {
+    EXPECT_EQ(ZMQWrapper::channelEndpoint("tcp://*:5555", Channel::CONTROL), "tcp://*:5555");
+    EXPECT_EQ(ZMQWrapper::channelEndpoint("tcp://*:5555", Channel::COMMAND), "tcp://*:5556");
+    EXPECT_EQ(ZMQWrapper::channelEndpoint("tcp://127.0.0.1:5555", Channel::FRAME),
+        "tcp://127.0.0.1:5557");
+    EXPECT_EQ(ZMQWrapper::channelEndpoint("inproc://gpu", Channel::FRAME), "inproc://gpu-frame");
+
+    EXPECT_EQ(channelForMessage(MessageType::HEARTBEAT), Channel::CONTROL);
+    EXPECT_EQ(channelForMessage(MessageType::VK_QUEUE_SUBMIT), Channel::COMMAND);
+    EXPECT_EQ(channelForMessage(MessageType::FRAME_DATA), Channel::FRAME);
+}
+
+TEST_F(NetworkTest, ServerRepliesToPeer) {
+    std::atomic<uint64_t> peer{0};
+    server->setMessageCallback([&](const Message& msg) {
+        if (msg.header.type != MessageType::VK_CREATE_INSTANCE) {
+            return;
+        }
+        peer = msg.peer;
+
+        Message reply;
+        reply.header = msg.header;
+        reply.header.size = 0;
+        reply.peer = msg.peer;
+        server->sendMessage(reply);
+    });
+
+    Message request;
+    request.header.type = MessageType::VK_CREATE_INSTANCE;
+    request.header.sequence = 7;
+    EXPECT_TRUE(client->sendMessage(request));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    EXPECT_NE(peer, 0);
+    bool replied = false;
+    for (const auto& msg : received_messages) {
+        replied |= msg.header.type == MessageType::VK_CREATE_INSTANCE && msg.header.sequence == 7;
+    }
+    EXPECT_TRUE(replied);
+}
+
+TEST_F(NetworkTest, CommandsBypassFrameBacklog) {
+    std::atomic<int> frames{0};
+    std::atomic<bool> command{false};
+    server->setMessageCallback([&](const Message& msg) {
+        if (msg.header.type == MessageType::FRAME_DATA) {
+            frames++;
+        } else if (msg.header.type == MessageType::VK_QUEUE_SUBMIT) {
+            command = true;
+        }
+    });
+
+    Message frame;
+    frame.header.type = MessageType::FRAME_DATA;
+    frame.header.size = 1024 * 1024;
+    frame.payload.resize(frame.header.size);
+
+    for (uint32_t i = 0; i < 32; ++i) {
+        frame.header.sequence = i + 1;
+        EXPECT_TRUE(client->sendMessage(frame));
+    }
+
+    Message submit;
+    submit.header.type = MessageType::VK_QUEUE_SUBMIT;
+    EXPECT_TRUE(client->sendMessage(submit));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    // Every frame was either shown or dropped as stale on one of the two sides
+    EXPECT_TRUE(command);
+    EXPECT_GT(frames, 0);
+    EXPECT_EQ(frames + client->getDroppedFrames() + server->getDroppedFrames(), 32);
+}
+
+TEST_F(NetworkTest, FrameSlicesAreKeptOrDroppedWhole) {
+    constexpr uint32_t FRAMES = 24;
+    constexpr uint32_t SLICES = 4;
+    std::mutex mutex;
+    std::vector<Message> received;
+    server->setMessageCallback([&](const Message& msg) {
+        if (msg.header.type == MessageType::FRAME_DATA) {
+            std::lock_guard<std::mutex> lock(mutex);
+            received.push_back(msg);
+        }
+    });
+
+    Message slice;
+    slice.header.type = MessageType::FRAME_DATA;
+    slice.header.size = 256 * 1024;
+    for (uint32_t i = 0; i < FRAMES; ++i) {
+        for (uint32_t j = 0; j < SLICES; ++j) {
+            slice.header.sequence = i + 1;
+            slice.header.flags = j + 1 < SLICES ? HEADER_FLAG_PARTIAL_FRAME : 0;
+            slice.payload.assign(slice.header.size, static_cast<uint8_t>(j));
+            EXPECT_TRUE(client->sendMessage(slice));
+        }
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    // Every frame shown is all there, in order, and only ever newer
+    std::lock_guard<std::mutex> lock(mutex);
+    ASSERT_EQ(received.size() % SLICES, 0);
+    for (size_t i = 0; i < received.size(); ++i) {
+        size_t j = i % SLICES;
+        EXPECT_EQ(received[i].header.sequence, received[i - j].header.sequence);
+        EXPECT_EQ(received[i].payload[0], j);
+        if (j == 0 && i > 0) {
+            EXPECT_GT(received[i].header.sequence, received[i - 1].header.sequence);
+        }
+    }
+    size_t frames = received.size() / SLICES;
+    EXPECT_GT(frames, 0);
+    EXPECT_EQ(frames + client->getDroppedFrames() + server->getDroppedFrames(), FRAMES);
+}
+
 TEST_F(NetworkTest, NetworkSpeed) {
     // Create a large message
     Message test_msg;
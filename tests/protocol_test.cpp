@@ -18,10 +18,53 @@ protected:
 };
 
 TEST_F(ProtocolTest, MessageHeaderSize) {
-    // MessageHeader should be 32 bytes (8 bytes for type + 4 bytes for size + 4 bytes for sequence + 8 bytes for timestamp + 8 bytes for compression)
+    // MessageHeader should be 32 bytes (1 byte type + 1 byte flags + 2 reserved + 4 bytes size + 8 bytes each for sequence, request id and timestamp)
     EXPECT_EQ(sizeof(MessageHeader), 32);
 }
 
+TEST_F(ProtocolTest, MessageHeaderWireLayout) {
+    MessageHeader header;
+    header.type = MessageType::VK_QUEUE_SUBMIT;
+    header.size = 0x11223344;
+    header.sequence = 0x0102030405060708ull;
+    header.request_id = 0x1112131415161718ull;
+    header.timestamp = 42;
+    header.setCompression(CompressionType::LZ4);
+
+    uint8_t wire[sizeof(MessageHeader)];
+    std::memcpy(wire, &header, sizeof(header));
+    EXPECT_EQ(wire[0], static_cast<uint8_t>(MessageType::VK_QUEUE_SUBMIT));
+    EXPECT_EQ(wire[1], static_cast<uint8_t>(CompressionType::LZ4));
+    EXPECT_EQ(wire[2], 0);
+    EXPECT_EQ(wire[3], 0);
+
+    uint64_t sequence;
+    std::memcpy(&sequence, wire + 8, sizeof(sequence));
+    EXPECT_EQ(sequence, 0x0102030405060708ull);
+    uint64_t request_id;
+    std::memcpy(&request_id, wire + 16, sizeof(request_id));
+    EXPECT_EQ(request_id, 0x1112131415161718ull);
+}
+
+TEST_F(ProtocolTest, HeaderFlags) {
+    MessageHeader header;
+    EXPECT_EQ(header.compression(), CompressionType::NONE);
+    EXPECT_EQ(header.priority(), 0);
+
+    header.flags = HEADER_FLAG_FRAGMENT;
+    header.setCompression(CompressionType::ZLIB);
+    header.setPriority(3);
+    EXPECT_EQ(header.compression(), CompressionType::ZLIB);
+    EXPECT_EQ(header.priority(), 3);
+    EXPECT_TRUE(header.flags & HEADER_FLAG_FRAGMENT);
+
+    // Setters leave the other bits alone
+    header.setCompression(CompressionType::NONE);
+    EXPECT_EQ(header.priority(), 3);
+    EXPECT_TRUE(header.flags & HEADER_FLAG_FRAGMENT);
+    EXPECT_FALSE(header.flags & HEADER_FLAG_LAST_FRAGMENT);
+}
+
 TEST_F(ProtocolTest, MessageTypeValues) {
     // Verify message type values are unique and properly ordered
     EXPECT_EQ(static_cast<uint8_t>(MessageType::CONNECT), 0x01);
@@ -76,6 +119,49 @@ TEST_F(ProtocolTest, ConnectionParams) {
     EXPECT_FALSE(params.encryption_enabled);
 }
 
+TEST_F(ProtocolTest, NegotiateConnection) {
+    ConnectionParams server = localConnectionParams();
+    ConnectionParams client = localConnectionParams();
+    client.version.minor = PROTOCOL_VERSION.minor + 1;
+    client.max_message_size = 4096;
+    client.compression_enabled = false;
+
+    ConnectionParams agreed;
+    ASSERT_TRUE(negotiateConnection(server, client, agreed));
+    EXPECT_EQ(agreed.version.major, PROTOCOL_VERSION.major);
+    EXPECT_EQ(agreed.version.minor, PROTOCOL_VERSION.minor);
+    EXPECT_EQ(agreed.max_message_size, 4096);
+    EXPECT_EQ(agreed.max_frame_size, MAX_FRAME_SIZE);
+    EXPECT_FALSE(agreed.compression_enabled);
+
+    // A different major version can't parse our headers
+    client.version.major = PROTOCOL_VERSION.major + 1;
+    EXPECT_FALSE(negotiateConnection(server, client, agreed));
+}
+
+TEST_F(ProtocolTest, NegotiateSettlesOnTheOlderVersion) {
+    ConnectionParams server = localConnectionParams();
+    ConnectionParams client = localConnectionParams();
+    server.version = {2, 1, 0};
+    client.version = {2, 0, 3};
+
+    // A newer minor version wins over a newer patch, from either side
+    ConnectionParams agreed;
+    ASSERT_TRUE(negotiateConnection(server, client, agreed));
+    EXPECT_EQ(agreed.version.major, 2);
+    EXPECT_EQ(agreed.version.minor, 0);
+    EXPECT_EQ(agreed.version.patch, 3);
+    ASSERT_TRUE(negotiateConnection(client, server, agreed));
+    EXPECT_EQ(agreed.version.minor, 0);
+    EXPECT_EQ(agreed.version.patch, 3);
+
+    // Same minor version: the lower patch
+    server.version = {2, 0, 1};
+    ASSERT_TRUE(negotiateConnection(server, client, agreed));
+    EXPECT_EQ(agreed.version.minor, 0);
+    EXPECT_EQ(agreed.version.patch, 1);
+}
+
 TEST_F(ProtocolTest, ErrorInfo) {
     // Create test error info
     ErrorInfo error;
@@ -0,0 +1,193 @@
+#include <gtest/gtest.h>
+#include "common/network/rate_controller.hpp"
+#include <vector>
+
+using namespace anarchy::network;
+
+namespace {
+
+using Clock = RateController::Clock;
+using std::chrono::milliseconds;
+
+RateControlConfig testConfig() {
+    RateControlConfig config;
+    config.width = 1920;
+    config.height = 1080;
+    config.fps = 60;
+    config.start_bitrate = 20000000;
+    return config;
+}
+
+// Streams frames at 60fps, each acked after rtt
+class StreamSimulation {
+public:
+    explicit StreamSimulation(RateController& controller) : controller_(controller) {}
+
+    RateController::Decision frame(milliseconds rtt) {
+        RateController::Decision decision = controller_.update(now_);
+        controller_.onFrameSent(sequence_, now_);
+        controller_.onFrameAck(sequence_, now_ + rtt);
+        sequence_++;
+        now_ += milliseconds(16);
+        return decision;
+    }
+
+    // Frame sent, ack still outstanding
+    RateController::Decision unacked() {
+        RateController::Decision decision = controller_.update(now_);
+        controller_.onFrameSent(sequence_++, now_);
+        now_ += milliseconds(16);
+        return decision;
+    }
+
+private:
+    RateController& controller_;
+    Clock::time_point now_ = Clock::now();
+    uint64_t sequence_ = 0;
+};
+
+} // namespace
+
+TEST(RateControllerTest, HoldsOnSteadyLink) {
+    RateController controller(testConfig());
+    StreamSimulation stream(controller);
+
+    for (int i = 0; i < 30; ++i) {
+        RateController::Decision decision = stream.frame(milliseconds(10));
+        EXPECT_FALSE(decision.resolution_changed);
+        EXPECT_NE(decision.reason, RateController::Reason::QUEUE_DELAY);
+    }
+    EXPECT_GE(controller.bitrate(), 20000000u);
+    EXPECT_EQ(controller.width(), 1920u);
+}
+
+TEST(RateControllerTest, CutsWithinFramesOfDelay) {
+    RateController controller(testConfig());
+    StreamSimulation stream(controller);
+    std::vector<RateController::Decision> log;
+    controller.setDecisionCallback([&](const RateController::Decision& d) { log.push_back(d); });
+
+    for (int i = 0; i < 10; ++i) {
+        stream.frame(milliseconds(10));
+    }
+    log.clear();
+
+    // Round trips jump by 40ms: queueing, not a longer path
+    int frames = 0;
+    while (controller.bitrate() >= 20000000u && frames < 10) {
+        stream.frame(milliseconds(50));
+        frames++;
+    }
+    EXPECT_LT(controller.bitrate(), 20000000u);
+    EXPECT_LE(frames, static_cast<int>(RateController::OVERUSE_FRAMES) + 1);
+
+    ASSERT_FALSE(log.empty());
+    EXPECT_EQ(log.front().reason, RateController::Reason::QUEUE_DELAY);
+    EXPECT_TRUE(log.front().bitrate_changed);
+    EXPECT_GT(log.front().queue_delay_ms, 0.0);
+}
+
+TEST(RateControllerTest, MissingAcksCountAsCongestion) {
+    RateController controller(testConfig());
+    StreamSimulation stream(controller);
+    for (int i = 0; i < 10; ++i) {
+        stream.frame(milliseconds(5));
+    }
+
+    RateController::Decision decision = {};
+    for (int i = 0; i < 10 && !decision.bitrate_changed; ++i) {
+        decision = stream.unacked();
+    }
+    EXPECT_TRUE(decision.bitrate_changed);
+    EXPECT_EQ(decision.reason, RateController::Reason::ACKS_MISSING);
+    EXPECT_GT(decision.frames_in_flight, 0);
+}
+
+TEST(RateControllerTest, BandwidthCapsAndProbes) {
+    RateController controller(testConfig());
+    StreamSimulation stream(controller);
+
+    // 1MB/s of link leaves room for 7.2Mbit/s
+    controller.onBandwidthEstimate(1000000.0);
+    RateController::Decision decision = stream.frame(milliseconds(5));
+    EXPECT_TRUE(decision.bitrate_changed);
+    EXPECT_EQ(decision.reason, RateController::Reason::BANDWIDTH_LIMIT);
+    EXPECT_EQ(decision.bitrate, 7200000u);
+
+    // With the cap lifted a clear link grows the rate in steps
+    controller.onBandwidthEstimate(100000000.0);
+    uint32_t probes = 0;
+    for (int i = 0; i < 600; ++i) {
+        decision = stream.frame(milliseconds(5));
+        if (decision.bitrate_changed) {
+            EXPECT_EQ(decision.reason, RateController::Reason::PROBE);
+            probes++;
+        }
+    }
+    EXPECT_GT(probes, 0u);
+    EXPECT_LT(probes, 600u);
+    EXPECT_GT(controller.bitrate(), 7200000u);
+}
+
+TEST(RateControllerTest, StarvationLowersResolution) {
+    RateControlConfig config = testConfig();
+    config.start_bitrate = 2000000;    // ~0.016 bits per pixel at 1080p60
+    config.max_bitrate = 2000000;
+    RateController controller(config);
+    StreamSimulation stream(controller);
+
+    RateController::Decision decision = {};
+    for (int i = 0; i < 300 && !decision.resolution_changed; ++i) {
+        decision = stream.frame(milliseconds(5));
+    }
+    ASSERT_TRUE(decision.resolution_changed);
+    EXPECT_EQ(decision.reason, RateController::Reason::DOWNSCALE);
+    EXPECT_EQ(decision.width, 1440u);
+    EXPECT_EQ(decision.height, 810u);
+    EXPECT_EQ(decision.width % 2, 0u);
+
+    // Down until the rate is enough for the size
+    for (int i = 0; i < 3000; ++i) {
+        stream.frame(milliseconds(5));
+    }
+    EXPECT_EQ(controller.width(), 1080u);
+    EXPECT_EQ(controller.height(), 608u);
+}
+
+TEST(RateControllerTest, MinimumScale) {
+    RateControlConfig config = testConfig();
+    config.start_bitrate = 1000000;
+    config.max_bitrate = 1000000;
+    config.min_bits_per_pixel = 0.1;
+    RateController controller(config);
+    StreamSimulation stream(controller);
+
+    for (int i = 0; i < 3000; ++i) {
+        stream.frame(milliseconds(5));
+    }
+    EXPECT_EQ(controller.width(), 960u);
+    EXPECT_EQ(controller.height(), 540u);
+}
+
+TEST(RateControllerTest, ResolutionRecovers) {
+    RateControlConfig config = testConfig();
+    config.start_bitrate = 2000000;
+    RateController controller(config);
+    StreamSimulation stream(controller);
+
+    // Starved until the bandwidth estimate lifts
+    controller.onBandwidthEstimate(2000000.0 / 8 / RateController::BANDWIDTH_HEADROOM);
+    for (int i = 0; i < 300 && controller.width() == 1920u; ++i) {
+        stream.frame(milliseconds(5));
+    }
+    ASSERT_LT(controller.width(), 1920u);
+
+    controller.onBandwidthEstimate(1e9);
+    bool upscaled = false;
+    for (int i = 0; i < 6000 && !upscaled; ++i) {
+        RateController::Decision decision = stream.frame(milliseconds(5));
+        upscaled = decision.reason == RateController::Reason::UPSCALE;
+    }
+    EXPECT_TRUE(upscaled);
+    EXPECT_EQ(controller.width(), 1920u);
+}
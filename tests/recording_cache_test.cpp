@@ -0,0 +1,204 @@
+#include <gtest/gtest.h>
+#include "client/recording_cache.hpp"
+#include "common/network/command_stream.hpp"
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <thread>
+
+using namespace anarchy::client;
+using namespace anarchy::network;
+
+namespace {
+
+// A packed recording of count commands, each with a payload of words
+std::vector<uint8_t> makeRecording(uint32_t count, uint64_t parameter = 0, uint32_t words = 8) {
+    std::vector<uint8_t> recording;
+    for (uint32_t i = 0; i < count; i++) {
+        CommandRecordHeader header = {};
+        header.type = MessageType::VK_BEGIN_COMMAND_BUFFER;
+        header.size = words * sizeof(uint64_t);
+        size_t offset = recording.size();
+        recording.resize(offset + commandRecordSize(header.size));
+        std::memcpy(recording.data() + offset, &header, sizeof(header));
+        for (uint32_t word = 1; word < words; word++) {
+            uint64_t value = i * 100 + word + (word == words - 1 ? parameter : 0);
+            std::memcpy(recording.data() + offset + sizeof(header) + word * sizeof(value),
+                &value, sizeof(value));
+        }
+    }
+    return recording;
+}
+
+// What the server does with a replay
+std::vector<uint8_t> applyPatches(std::vector<uint8_t> slot, const std::vector<uint8_t>& recording,
+    const std::vector<RecordingPatch>& patches)
+{
+    for (const RecordingPatch& patch : patches) {
+        std::memcpy(slot.data() + patch.offset, recording.data() + patch.offset, patch.size);
+    }
+    return slot;
+}
+
+} // namespace
+
+TEST(RecordingCacheTest, ReplaysIdenticalRecordings) {
+    RecordingCache cache;
+    auto recording = makeRecording(20);
+
+    auto first = cache.lookup(recording);
+    EXPECT_FALSE(first.replay);
+
+    auto second = cache.lookup(recording);
+    EXPECT_TRUE(second.replay);
+    EXPECT_EQ(second.id, first.id);
+    EXPECT_TRUE(second.patches.empty());
+    EXPECT_EQ(cache.getStatistics().replays, 1u);
+}
+
+TEST(RecordingCacheTest, PatchesChangedParameters) {
+    RecordingCache cache;
+    auto before = makeRecording(20);
+    auto stored = cache.lookup(before);
+
+    // Each command got a new last parameter
+    auto after = makeRecording(20, 7);
+    auto replay = cache.lookup(after);
+    ASSERT_TRUE(replay.replay);
+    EXPECT_EQ(replay.id, stored.id);
+    EXPECT_EQ(replay.patches.size(), 20u);
+    EXPECT_EQ(applyPatches(before, after, replay.patches), after);
+
+    // The slot holds the new parameters now, as the server's does
+    EXPECT_EQ(cache.recording(replay.id), after);
+    EXPECT_LT(cache.getStatistics().bytes_sent, 2 * before.size());
+}
+
+TEST(RecordingCacheTest, SendsRecordingsThatChangedTooMuch) {
+    RecordingCache cache;
+    auto before = makeRecording(4, 0, 2);
+    cache.lookup(before);
+
+    // Every parameter differs: patches would cost about what the recording does
+    auto after = before;
+    size_t record_size = commandRecordSize(2 * sizeof(uint64_t));
+    for (size_t i = 0; i < after.size(); i++) {
+        if (i % record_size >= sizeof(CommandRecordHeader)) {
+            after[i] ^= 0xFF;
+        }
+    }
+    auto result = cache.lookup(after);
+    EXPECT_FALSE(result.replay);
+    EXPECT_EQ(cache.recording(result.id), after);
+
+    // A different shape is a new recording too
+    auto longer = makeRecording(5, 0, 2);
+    EXPECT_FALSE(cache.lookup(longer).replay);
+}
+
+TEST(RecordingCacheTest, EvictsTheLeastRecentlyUsed) {
+    RecordingCache cache(64, 32);
+    std::vector<std::vector<uint8_t>> recordings;
+    for (uint32_t i = 0; i < cache.capacity(); i++) {
+        // Distinct shapes, so none is a patch of another
+        recordings.push_back(makeRecording(i + 1));
+        EXPECT_FALSE(cache.lookup(recordings.back()).replay);
+    }
+
+    // Recording 0 is used again, so recording 1 goes first
+    uint32_t kept = cache.lookup(recordings[0]).id;
+    auto result = cache.lookup(makeRecording(cache.capacity() + 1));
+    EXPECT_FALSE(result.replay);
+    EXPECT_NE(result.id, kept);
+    EXPECT_GE(result.id, 64u);
+    EXPECT_LT(result.id, 64u + 32u);
+    EXPECT_TRUE(cache.lookup(recordings[0]).replay);
+    EXPECT_FALSE(cache.lookup(recordings[1]).replay);
+}
+
+TEST(RecordingCachePoolTest, CoversARecordingThreadPool) {
+    RecordingCachePool pool;
+    const uint32_t threads = MAX_RECORDINGS / RecordingCachePool::SLOTS_PER_THREAD;
+    EXPECT_GE(threads, 16u);
+
+    // Two generations of workers, the second replacing the first once it exited
+    for (int generation = 0; generation < 2; ++generation) {
+        std::mutex mutex;
+        std::condition_variable all_recorded;
+        uint32_t recorded = 0;
+        std::set<uint32_t> first_ids;
+        std::vector<std::thread> workers;
+        for (uint32_t i = 0; i < threads; ++i) {
+            workers.emplace_back([&]() {
+                RecordingCache* cache = pool.local();
+                std::unique_lock<std::mutex> lock(mutex);
+                EXPECT_NE(cache, nullptr);
+                if (cache) {
+                    first_ids.insert(cache->firstId());
+                    EXPECT_FALSE(cache->lookup(makeRecording(2)).replay);
+                    EXPECT_TRUE(cache->lookup(makeRecording(2)).replay);
+                }
+
+                // Every worker holds its range until all have one
+                ++recorded;
+                all_recorded.notify_all();
+                all_recorded.wait(lock, [&]() { return recorded == threads; });
+            });
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        EXPECT_EQ(first_ids.size(), threads);
+        EXPECT_EQ(pool.threadCount(), 0u);
+    }
+}
+
+TEST(RecordingCachePoolTest, ReplacementThreadsGetFreedRanges) {
+    RecordingCachePool pool(32, 128);
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    uint32_t holding = 0;
+    bool release = false;
+    std::vector<std::thread> holders;
+    for (int i = 0; i < 4; ++i) {
+        holders.emplace_back([&]() {
+            EXPECT_NE(pool.local(), nullptr);
+            std::unique_lock<std::mutex> lock(mutex);
+            ++holding;
+            changed.notify_all();
+            changed.wait(lock, [&]() { return release; });
+        });
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&]() { return holding == 4; });
+    }
+
+    // A fifth thread finds every range taken
+    std::thread fifth([&]() { EXPECT_EQ(pool.local(), nullptr); });
+    fifth.join();
+    EXPECT_EQ(pool.threadCount(), 4u);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release = true;
+    }
+    changed.notify_all();
+    for (std::thread& holder : holders) {
+        holder.join();
+    }
+    EXPECT_EQ(pool.threadCount(), 0u);
+
+    // Their replacements get the ranges back, and start out empty
+    for (int i = 0; i < 5; ++i) {
+        std::thread replacement([&]() {
+            RecordingCache* cache = pool.local();
+            ASSERT_NE(cache, nullptr);
+            EXPECT_LT(cache->firstId(), 128u);
+            EXPECT_FALSE(cache->lookup(makeRecording(3)).replay);
+        });
+        replacement.join();
+    }
+}
@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+#include "server/shader_cache.hpp"
+#include "common/network/content_hash.hpp"
+#include <fstream>
+
+using namespace anarchy::server;
+using namespace anarchy::network;
+
+namespace {
+
+class ShaderCacheTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        root_ = std::filesystem::temp_directory_path() / (std::string("anarchy_shader_cache_") +
+            ::testing::UnitTest::GetInstance()->current_test_info()->name());
+        std::filesystem::remove_all(root_);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(root_);
+    }
+
+    std::string key(uint32_t driver_version = 1) const {
+        uint8_t uuid[VK_UUID_SIZE] = {1, 2, 3};
+        return ShaderCache::applicationKey("game", 1, "engine", 2, uuid, driver_version);
+    }
+
+    std::filesystem::path root_;
+};
+
+std::vector<uint8_t> makeCode(uint8_t seed) {
+    std::vector<uint8_t> code(256);
+    for (size_t i = 0; i < code.size(); i++) {
+        code[i] = static_cast<uint8_t>(seed + i);
+    }
+    return code;
+}
+
+} // namespace
+
+TEST_F(ShaderCacheTest, StoresShadersByContent) {
+    ShaderCache cache(root_.string());
+    auto code = makeCode(1);
+    auto hash = hashContent(code.data(), code.size());
+    std::vector<uint8_t> loaded;
+    EXPECT_FALSE(cache.loadShader(key(), hash, loaded));
+
+    ASSERT_TRUE(cache.storeShader(key(), hash, code.data(), code.size()));
+    EXPECT_TRUE(cache.storeShader(key(), hash, code.data(), code.size()));
+
+    // A new cache over the same directory, as on the next run
+    ShaderCache reopened(root_.string());
+    ASSERT_TRUE(reopened.loadShader(key(), hash, loaded));
+    EXPECT_EQ(loaded, code);
+    auto shaders = reopened.shaders(key());
+    ASSERT_EQ(shaders.size(), 1u);
+    EXPECT_EQ(shaders[0], hash);
+
+    // Another driver sees none of it
+    EXPECT_FALSE(reopened.loadShader(key(2), hash, loaded));
+    EXPECT_TRUE(reopened.shaders(key(2)).empty());
+}
+
+TEST_F(ShaderCacheTest, RejectsCorruptShaders) {
+    ShaderCache cache(root_.string());
+    auto code = makeCode(2);
+    auto hash = hashContent(code.data(), code.size());
+    ASSERT_TRUE(cache.storeShader(key(), hash, code.data(), code.size()));
+
+    auto path = root_ / key() / "shaders" / (toHex(hash) + ".spv");
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write("junk", 4);
+    }
+    std::vector<uint8_t> loaded;
+    EXPECT_FALSE(cache.loadShader(key(), hash, loaded));
+}
+
+TEST_F(ShaderCacheTest, ReplacesThePipelineCache) {
+    ShaderCache cache(root_.string());
+    std::vector<uint8_t> data;
+    EXPECT_FALSE(cache.loadPipelineCache(key(), data));
+
+    ASSERT_TRUE(cache.storePipelineCache(key(), std::vector<uint8_t>(100, 1)));
+    ASSERT_TRUE(cache.storePipelineCache(key(), std::vector<uint8_t>(50, 2)));
+    ASSERT_TRUE(cache.loadPipelineCache(key(), data));
+    EXPECT_EQ(data, std::vector<uint8_t>(50, 2));
+
+    // Only the file itself is left, no temporaries
+    size_t files = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(root_ / key())) {
+        files += entry.is_regular_file();
+    }
+    EXPECT_EQ(files, 1u);
+}
+
+TEST(ShaderCacheKeyTest, KeysAreSafeFileNames) {
+    uint8_t uuid[VK_UUID_SIZE] = {};
+    auto key = ShaderCache::applicationKey("../../etc", 1, "", 0, uuid, 0);
+    EXPECT_EQ(key.find_first_not_of("0123456789abcdef"), std::string::npos);
+    EXPECT_NE(key, ShaderCache::applicationKey("../../etc", 2, "", 0, uuid, 0));
+}
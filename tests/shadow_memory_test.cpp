@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+#include "client/shadow_memory.hpp"
+#include <cstring>
+
+using namespace anarchy::client;
+
+namespace {
+constexpr uint64_t PAGE = ShadowMemory::PAGE_SIZE;
+
+std::vector<ShadowMemory::Range> collect(ShadowMemory& shadow, uint64_t offset = 0,
+    uint64_t size = ~0ull) {
+    std::vector<ShadowMemory::Range> ranges;
+    shadow.collectDirty(offset, size, ranges);
+    return ranges;
+}
+}
+
+TEST(ShadowMemoryTest, StartsCleanAndZeroed) {
+    ShadowMemory shadow(3 * PAGE);
+    EXPECT_EQ(shadow.size(), 3 * PAGE);
+    for (uint64_t i = 0; i < shadow.size(); i++) {
+        ASSERT_EQ(shadow.data()[i], 0);
+    }
+    EXPECT_TRUE(collect(shadow).empty());
+}
+
+TEST(ShadowMemoryTest, ReportsWrittenPagesOnce) {
+    ShadowMemory shadow(4 * PAGE);
+    shadow.data()[PAGE + 10] = 1;
+
+    auto ranges = collect(shadow);
+    ASSERT_EQ(ranges.size(), 1u);
+    EXPECT_EQ(ranges[0].offset, PAGE);
+    EXPECT_EQ(ranges[0].size, PAGE);
+
+    // Already sent
+    EXPECT_TRUE(collect(shadow).empty());
+}
+
+TEST(ShadowMemoryTest, MergesAdjacentPages) {
+    ShadowMemory shadow(6 * PAGE);
+    std::memset(shadow.data() + PAGE - 1, 7, PAGE + 2);
+    shadow.data()[5 * PAGE] = 1;
+
+    auto ranges = collect(shadow);
+    ASSERT_EQ(ranges.size(), 2u);
+    EXPECT_EQ(ranges[0].offset, 0u);
+    EXPECT_EQ(ranges[0].size, 3 * PAGE);
+    EXPECT_EQ(ranges[1].offset, 5 * PAGE);
+    EXPECT_EQ(ranges[1].size, PAGE);
+}
+
+TEST(ShadowMemoryTest, LastPageIsClippedToTheAllocation) {
+    ShadowMemory shadow(PAGE + 100);
+    shadow.data()[PAGE + 99] = 1;
+
+    auto ranges = collect(shadow);
+    ASSERT_EQ(ranges.size(), 1u);
+    EXPECT_EQ(ranges[0].offset, PAGE);
+    EXPECT_EQ(ranges[0].size, 100u);
+}
+
+TEST(ShadowMemoryTest, OnlyCollectsTheRequestedRange) {
+    ShadowMemory shadow(4 * PAGE);
+    shadow.data()[0] = 1;
+    shadow.data()[3 * PAGE] = 1;
+
+    auto ranges = collect(shadow, 2 * PAGE, 2 * PAGE);
+    ASSERT_EQ(ranges.size(), 1u);
+    EXPECT_EQ(ranges[0].offset, 3 * PAGE);
+
+    // The first page is still owed
+    ranges = collect(shadow);
+    ASSERT_EQ(ranges.size(), 1u);
+    EXPECT_EQ(ranges[0].offset, 0u);
+
+    EXPECT_TRUE(collect(shadow, 5 * PAGE, PAGE).empty());
+}
+
+TEST(ShadowMemoryTest, LoadedContentsAreNotWrites) {
+    ShadowMemory shadow(3 * PAGE);
+    std::vector<uint8_t> server(PAGE + 20, 9);
+    shadow.load(PAGE - 10, server.data(), server.size());
+    EXPECT_EQ(shadow.data()[PAGE - 10], 9);
+    EXPECT_EQ(shadow.data()[2 * PAGE + 9], 9);
+    EXPECT_EQ(shadow.data()[2 * PAGE + 10], 0);
+    EXPECT_TRUE(collect(shadow).empty());
+
+    // Writes after the load still go out
+    shadow.data()[2 * PAGE] = 1;
+    auto ranges = collect(shadow);
+    ASSERT_EQ(ranges.size(), 1u);
+    EXPECT_EQ(ranges[0].offset, 2 * PAGE);
+}
+
+TEST(ShadowMemoryTest, LoadIsClippedToTheAllocation) {
+    ShadowMemory shadow(PAGE + 100);
+    std::vector<uint8_t> server(2 * PAGE, 5);
+    shadow.load(PAGE, server.data(), server.size());
+    EXPECT_EQ(shadow.data()[PAGE + 99], 5);
+    EXPECT_TRUE(collect(shadow).empty());
+}
@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+#include "common/gpu/software_codec.hpp"
+#include <cstring>
+#include <vector>
+
+using namespace anarchy::gpu;
+
+namespace {
+
+constexpr uint32_t WIDTH = 64;
+constexpr uint32_t HEIGHT = 32;
+constexpr uint32_t FORMAT = 44;     // VK_FORMAT_B8G8R8A8_UNORM
+
+std::vector<uint8_t> testPattern(uint8_t seed) {
+    std::vector<uint8_t> pixels(WIDTH * HEIGHT * 4);
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        pixels[i] = static_cast<uint8_t>(i / 4 + seed);
+    }
+    return pixels;
+}
+
+SoftwareFrameHeader headerOf(const std::vector<uint8_t>& frame) {
+    SoftwareFrameHeader header;
+    std::memcpy(&header, frame.data(), sizeof(header));
+    return header;
+}
+
+} // namespace
+
+TEST(SoftwareCodecTest, RawFramesAreKeyframes) {
+    SoftwareEncoder encoder(false);
+    SoftwareDecoder decoder;
+    std::vector<uint8_t> frame;
+
+    for (uint8_t i = 0; i < 3; ++i) {
+        std::vector<uint8_t> pixels = testPattern(i);
+        encoder.encode(pixels.data(), WIDTH, HEIGHT, FORMAT, 4, frame);
+        ASSERT_EQ(frame.size(), sizeof(SoftwareFrameHeader) + pixels.size());
+        EXPECT_TRUE(headerOf(frame).keyframe);
+
+        ASSERT_TRUE(decoder.decode(frame.data(), frame.size()));
+        EXPECT_EQ(decoder.pixels(), pixels);
+        EXPECT_EQ(decoder.width(), WIDTH);
+        EXPECT_EQ(decoder.format(), FORMAT);
+    }
+}
+
+TEST(SoftwareCodecTest, DeltaRoundTrip) {
+    SoftwareEncoder encoder(true);
+    SoftwareDecoder decoder;
+    std::vector<uint8_t> pixels = testPattern(0);
+    std::vector<uint8_t> frame;
+
+    encoder.encode(pixels.data(), WIDTH, HEIGHT, FORMAT, 4, frame);
+    EXPECT_TRUE(headerOf(frame).keyframe);
+    ASSERT_TRUE(decoder.decode(frame.data(), frame.size()));
+
+    // A small change is a small delta
+    pixels[100] ^= 0xFF;
+    pixels[2000] = 7;
+    encoder.encode(pixels.data(), WIDTH, HEIGHT, FORMAT, 4, frame);
+    EXPECT_FALSE(headerOf(frame).keyframe);
+    EXPECT_LT(frame.size(), pixels.size() / 8);
+    ASSERT_TRUE(decoder.decode(frame.data(), frame.size()));
+    EXPECT_EQ(decoder.pixels(), pixels);
+}
+
+TEST(SoftwareCodecTest, KeyframeInterval) {
+    SoftwareEncoder encoder(true, 3);
+    std::vector<uint8_t> pixels = testPattern(0);
+    std::vector<uint8_t> frame;
+
+    std::vector<bool> keyframes;
+    for (int i = 0; i < 7; ++i) {
+        encoder.encode(pixels.data(), WIDTH, HEIGHT, FORMAT, 4, frame);
+        keyframes.push_back(headerOf(frame).keyframe != 0);
+    }
+    EXPECT_EQ(keyframes, (std::vector<bool>{true, false, false, true, false, false, true}));
+
+    encoder.forceKeyframe();
+    encoder.encode(pixels.data(), WIDTH, HEIGHT, FORMAT, 4, frame);
+    EXPECT_TRUE(headerOf(frame).keyframe);
+
+    // So does a new size
+    encoder.encode(pixels.data(), WIDTH / 2, HEIGHT, FORMAT, 4, frame);
+    EXPECT_TRUE(headerOf(frame).keyframe);
+}
+
+TEST(SoftwareCodecTest, DeltaNeedsItsReference) {
+    SoftwareEncoder encoder(true);
+    SoftwareDecoder decoder;
+    std::vector<uint8_t> first;
+    std::vector<uint8_t> second;
+    std::vector<uint8_t> pixels = testPattern(0);
+
+    encoder.encode(pixels.data(), WIDTH, HEIGHT, FORMAT, 4, first);
+    pixels[0]++;
+    encoder.encode(pixels.data(), WIDTH, HEIGHT, FORMAT, 4, second);
+
+    // The keyframe was lost
+    EXPECT_FALSE(decoder.decode(second.data(), second.size()));
+    ASSERT_TRUE(decoder.decode(first.data(), first.size()));
+    ASSERT_TRUE(decoder.decode(second.data(), second.size()));
+    EXPECT_EQ(decoder.pixels(), pixels);
+}
+
+TEST(SoftwareCodecTest, RejectsMalformedFrames) {
+    SoftwareEncoder encoder(true);
+    SoftwareDecoder decoder;
+    std::vector<uint8_t> pixels = testPattern(0);
+    std::vector<uint8_t> frame;
+    encoder.encode(pixels.data(), WIDTH, HEIGHT, FORMAT, 4, frame);
+
+    EXPECT_FALSE(decoder.decode(frame.data(), sizeof(SoftwareFrameHeader) - 1));
+    EXPECT_FALSE(decoder.decode(frame.data(), frame.size() - 1));
+
+    std::vector<uint8_t> bad_magic = frame;
+    bad_magic[0] ^= 1;
+    EXPECT_FALSE(decoder.decode(bad_magic.data(), bad_magic.size()));
+
+    // Claims more pixels than any format has per pixel
+    std::vector<uint8_t> oversized = frame;
+    SoftwareFrameHeader header = headerOf(frame);
+    header.raw_size = WIDTH * HEIGHT * 64;
+    std::memcpy(oversized.data(), &header, sizeof(header));
+    EXPECT_FALSE(decoder.decode(oversized.data(), oversized.size()));
+
+    EXPECT_TRUE(decoder.decode(frame.data(), frame.size()));
+}
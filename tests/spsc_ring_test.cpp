@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+#include "common/spsc_ring.hpp"
+#include <thread>
+#include <vector>
+
+using namespace anarchy;
+
+namespace {
+
+using Ring = SpscRing<uint64_t>;
+
+bool pushValue(Ring& ring, uint64_t value) {
+    ring.back() = value;
+    return ring.push();
+}
+
+} // namespace
+
+TEST(SpscRingTest, FifoOrder) {
+    Ring ring(4);
+    EXPECT_TRUE(ring.empty());
+    EXPECT_EQ(ring.pop(), nullptr);
+
+    for (uint64_t i = 1; i <= 3; ++i) {
+        EXPECT_TRUE(pushValue(ring, i));
+    }
+    EXPECT_EQ(ring.size(), 3);
+
+    for (uint64_t i = 1; i <= 3; ++i) {
+        uint64_t* value = ring.pop();
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(*value, i);
+    }
+    EXPECT_EQ(ring.pop(), nullptr);
+}
+
+TEST(SpscRingTest, RejectWhenFull) {
+    Ring ring(2);
+    EXPECT_TRUE(pushValue(ring, 1));
+    EXPECT_TRUE(pushValue(ring, 2));
+    EXPECT_FALSE(pushValue(ring, 3));
+    EXPECT_EQ(ring.dropped(), 0);
+
+    // The rejected value stays with the producer for the next attempt
+    EXPECT_EQ(ring.back(), 3);
+    EXPECT_EQ(*ring.pop(), 1);
+    EXPECT_TRUE(ring.push());
+    EXPECT_EQ(*ring.pop(), 2);
+    EXPECT_EQ(*ring.pop(), 3);
+}
+
+TEST(SpscRingTest, LatestWins) {
+    Ring ring(2, Ring::OverflowPolicy::DROP_OLDEST);
+    for (uint64_t i = 1; i <= 5; ++i) {
+        EXPECT_TRUE(pushValue(ring, i));
+    }
+    EXPECT_EQ(ring.dropped(), 3);
+    EXPECT_EQ(*ring.pop(), 4);
+    EXPECT_EQ(*ring.pop(), 5);
+    EXPECT_EQ(ring.pop(), nullptr);
+}
+
+TEST(SpscRingTest, PoppedSlotIsNotReused) {
+    // The consumer keeps its entry however far the producer runs ahead
+    Ring ring(1, Ring::OverflowPolicy::DROP_OLDEST);
+    pushValue(ring, 7);
+    uint64_t* held = ring.pop();
+    ASSERT_NE(held, nullptr);
+
+    for (uint64_t i = 0; i < 10; ++i) {
+        pushValue(ring, 100 + i);
+    }
+    EXPECT_EQ(*held, 7);
+    EXPECT_EQ(*ring.pop(), 109);
+}
+
+TEST(SpscRingTest, SlotsKeepTheirCapacity) {
+    SpscRing<std::vector<uint8_t>> ring(2);
+    for (auto& slot : ring.slots()) {
+        slot.reserve(1024);
+    }
+
+    for (int i = 0; i < 16; ++i) {
+        ring.back().assign(512, static_cast<uint8_t>(i));
+        ASSERT_TRUE(ring.push());
+        std::vector<uint8_t>* popped = ring.pop();
+        ASSERT_NE(popped, nullptr);
+        EXPECT_EQ(popped->front(), static_cast<uint8_t>(i));
+        EXPECT_GE(popped->capacity(), 1024);
+    }
+}
+
+TEST(SpscRingTest, ConcurrentHandoff) {
+    // Values only ever arrive in order; with DROP_OLDEST some are skipped,
+    // and every skipped one is counted
+    for (auto policy : {Ring::OverflowPolicy::REJECT, Ring::OverflowPolicy::DROP_OLDEST}) {
+        Ring ring(8, policy);
+        constexpr uint64_t COUNT = 200000;
+
+        std::thread producer([&]() {
+            for (uint64_t i = 1; i <= COUNT; ++i) {
+                ring.back() = i;
+                while (!ring.push()) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+
+        uint64_t last = 0;
+        uint64_t received = 0;
+        bool ordered = true;
+        while (last != COUNT) {
+            uint64_t* value = ring.pop();
+            if (!value) {
+                std::this_thread::yield();
+                continue;
+            }
+            ordered = ordered && *value > last;
+            last = *value;
+            received++;
+        }
+        producer.join();
+
+        EXPECT_TRUE(ordered);
+        EXPECT_EQ(received + ring.dropped(), COUNT);
+        if (policy == Ring::OverflowPolicy::REJECT) {
+            EXPECT_EQ(ring.dropped(), 0);
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+#include "common/gpu/staging_ring.hpp"
+
+using namespace anarchy::gpu;
+
+TEST(StagingRingTest, HandsOutAlignedRegionsInOrder) {
+    StagingRing ring(4096, 256);
+    uint64_t first = 0, second = 0;
+    ASSERT_TRUE(ring.allocate(100, first));
+    ASSERT_TRUE(ring.allocate(300, second));
+    EXPECT_EQ(first, 0u);
+    EXPECT_EQ(second, 256u);
+    EXPECT_EQ(ring.used(), 256u + 512u);
+}
+
+TEST(StagingRingTest, ReclaimsOnceTheFenceCompletes) {
+    StagingRing ring(1024, 256);
+    uint64_t offsets[4];
+    for (uint64_t& offset : offsets) {
+        ASSERT_TRUE(ring.allocate(256, offset));
+    }
+    uint64_t offset = 0;
+    EXPECT_FALSE(ring.allocate(256, offset));
+
+    ring.release(offsets[0], 5);
+    ring.reclaim(4);
+    EXPECT_FALSE(ring.allocate(256, offset));
+    ring.reclaim(5);
+    ASSERT_TRUE(ring.allocate(256, offset));
+    EXPECT_EQ(offset, 0u);      // Wrapped around
+
+    // Released out of order: nothing is freed until the oldest is
+    ring.release(offsets[2], 1);
+    ring.reclaim(10);
+    EXPECT_EQ(ring.regionCount(), 4u);
+    ASSERT_TRUE(ring.oldest(offset));
+    EXPECT_EQ(offset, offsets[1]);
+    ring.release(offsets[1], 1);
+    ring.reclaim(10);
+    EXPECT_EQ(ring.regionCount(), 2u);
+}
+
+TEST(StagingRingTest, WrapsRatherThanSplitting) {
+    StagingRing ring(1024, 256);
+    uint64_t a = 0, b = 0, c = 0;
+    ASSERT_TRUE(ring.allocate(512, a));
+    ASSERT_TRUE(ring.allocate(256, b));
+    ring.release(a, 0);
+    ring.reclaim(0);
+
+    // 256 bytes left at the end; 512 has to go to the start
+    ASSERT_TRUE(ring.allocate(512, c));
+    EXPECT_EQ(c, 0u);
+
+    // The skipped end is freed along with the region before it
+    ring.release(b, 0);
+    ring.reclaim(0);
+    EXPECT_EQ(ring.used(), 512u);
+    EXPECT_FALSE(ring.allocate(1024, c));
+    EXPECT_FALSE(ring.allocate(2048, c));
+}
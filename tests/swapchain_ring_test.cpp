@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+#include "common/network/swapchain_ring.hpp"
+
+using namespace anarchy::network;
+
+TEST(SwapchainRingTest, ImageCountIsClamped) {
+    EXPECT_EQ(SwapchainRing::imageCount(1), SwapchainRing::MIN_IMAGES);
+    EXPECT_EQ(SwapchainRing::imageCount(4), 4u);
+    EXPECT_EQ(SwapchainRing::imageCount(8), SwapchainRing::MAX_IMAGES);
+}
+
+TEST(SwapchainRingTest, HandsOutImagesInOrder) {
+    SwapchainRing ring(3);
+    uint32_t index = 0;
+    for (uint32_t frame = 0; frame < 7; frame++) {
+        ASSERT_TRUE(ring.acquire(index));
+        EXPECT_EQ(index, frame % 3);
+        EXPECT_TRUE(ring.present(index));
+    }
+}
+
+TEST(SwapchainRingTest, ImagesInFlightBlockReuse) {
+    SwapchainRing ring(3);
+    uint32_t first = 0;
+    uint32_t index = 0;
+    ASSERT_TRUE(ring.acquire(first));
+    ASSERT_TRUE(ring.acquire(index));
+    ASSERT_TRUE(ring.acquire(index));
+
+    // Every image held: nothing to hand out until the oldest is presented
+    EXPECT_FALSE(ring.acquire(index));
+    EXPECT_TRUE(ring.present(first));
+    ASSERT_TRUE(ring.acquire(index));
+    EXPECT_EQ(index, first);
+}
+
+TEST(SwapchainRingTest, PresentNeedsAnAcquiredImage) {
+    SwapchainRing ring(3);
+    EXPECT_FALSE(ring.present(0));
+    EXPECT_FALSE(ring.present(5));
+
+    uint32_t index = 0;
+    ASSERT_TRUE(ring.acquire(index));
+    EXPECT_TRUE(ring.present(index));
+    EXPECT_FALSE(ring.present(index));
+}
+
+TEST(SwapchainRingTest, ClientAndServerAgree) {
+    // The server replays the client's acquires and checks each index
+    SwapchainRing client(4);
+    SwapchainRing server(4);
+    for (int frame = 0; frame < 10; frame++) {
+        uint32_t predicted = 0;
+        uint32_t expected = 0;
+        ASSERT_TRUE(client.acquire(predicted));
+        ASSERT_TRUE(server.acquire(expected));
+        EXPECT_EQ(predicted, expected);
+        EXPECT_TRUE(client.present(predicted));
+        EXPECT_TRUE(server.present(expected));
+    }
+}
@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+#include "common/tracer.hpp"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+using namespace anarchy;
+
+TEST(LatencyHistogramTest, SmallValuesAreExact) {
+    LatencyHistogram histogram;
+    for (uint64_t value = 1; value <= 50; value++) {
+        histogram.record(value);
+    }
+    EXPECT_EQ(histogram.count(), 50u);
+    EXPECT_EQ(histogram.percentile(50.0), 25u);
+    EXPECT_EQ(histogram.percentile(100.0), 50u);
+    EXPECT_EQ(histogram.percentile(0.0), 1u);
+    EXPECT_EQ(histogram.max(), 50u);
+    EXPECT_DOUBLE_EQ(histogram.mean(), 25.5);
+}
+
+TEST(LatencyHistogramTest, LargeValuesRoundUpWithinABucket) {
+    LatencyHistogram histogram;
+    histogram.record(1000);
+    histogram.record(100000);
+
+    // 1000 shares a 32 wide bucket; the top one is capped at the max seen
+    uint64_t p50 = histogram.percentile(50.0);
+    EXPECT_GE(p50, 1000u);
+    EXPECT_LT(p50, 1000u + 32u);
+    EXPECT_EQ(histogram.percentile(99.0), 100000u);
+
+    LatencyHistogram other;
+    other.record(5);
+    histogram.merge(other);
+    EXPECT_EQ(histogram.count(), 3u);
+    EXPECT_EQ(histogram.percentile(10.0), 5u);
+
+    histogram.reset();
+    EXPECT_EQ(histogram.count(), 0u);
+    EXPECT_EQ(histogram.percentile(50.0), 0u);
+}
+
+TEST(TracerTest, DisabledRecordsNothing) {
+    Tracer tracer;
+    tracer.instant(1, TraceStage::PRESENT);
+    tracer.span(1, TraceStage::ENCODE, 0, 100);
+    Tracer::Report report = tracer.report();
+    EXPECT_TRUE(report.stages.empty());
+    EXPECT_EQ(report.end_to_end.count, 0u);
+}
+
+TEST(TracerTest, ReportsSpansPerStage) {
+    Tracer tracer;
+    tracer.setEnabled(true);
+    for (uint64_t frame = 1; frame <= 100; frame++) {
+        int64_t begin = static_cast<int64_t>(frame) * 1000;
+        tracer.span(frame, TraceStage::ENCODE, begin, begin + static_cast<int64_t>(frame));
+        tracer.span(frame, TraceStage::DECODE, begin, begin + 7);
+    }
+
+    Tracer::Report report = tracer.report();
+    ASSERT_EQ(report.stages.size(), 2u);
+    EXPECT_EQ(report.stages[0].stage, TraceStage::ENCODE);
+    EXPECT_EQ(report.stages[0].count, 100u);
+    EXPECT_EQ(report.stages[0].p50, 50u);
+    EXPECT_EQ(report.stages[0].p99, 99u);
+    EXPECT_EQ(report.stages[0].max, 100u);
+    EXPECT_EQ(report.stages[1].stage, TraceStage::DECODE);
+    EXPECT_EQ(report.stages[1].p999, 7u);
+
+    tracer.reset();
+    EXPECT_TRUE(tracer.report().stages.empty());
+}
+
+TEST(TracerTest, MatchesPresentToDisplayAcrossThreads) {
+    Tracer tracer;
+    tracer.setEnabled(true);
+
+    // Presented on one thread, displayed on another
+    std::thread presenter([&] {
+        for (uint64_t frame = 1; frame <= 10; frame++) {
+            tracer.span(frame, TraceStage::PRESENT, frame * 100, frame * 100);
+        }
+    });
+    presenter.join();
+    std::thread display([&] {
+        for (uint64_t frame = 1; frame <= 10; frame++) {
+            tracer.span(frame, TraceStage::DISPLAY, frame * 100 + 40, frame * 100 + 40);
+        }
+        tracer.span(99, TraceStage::DISPLAY, 5000, 5000);   // Never presented
+    });
+    display.join();
+
+    Tracer::Report report = tracer.report();
+    EXPECT_TRUE(report.stages.empty());     // Instants only
+    EXPECT_EQ(report.end_to_end.count, 10u);
+    EXPECT_EQ(report.end_to_end.p50, 40u);
+    EXPECT_EQ(report.end_to_end.max, 40u);
+    EXPECT_EQ(report.events_dropped, 0u);
+}
+
+TEST(TracerTest, WritesChromeTrace) {
+    Tracer tracer;
+    tracer.setEnabled(true);
+    tracer.span(7, TraceStage::PRESENT, 100, 100);
+    tracer.span(7, TraceStage::ENCODE, 200, 250);
+
+    std::string path = ::testing::TempDir() + "tracer_test.json";
+    ASSERT_TRUE(tracer.writeChromeTrace(path, Tracer::SERVER_PROCESS, 1000));
+
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::string json = contents.str();
+    std::remove(path.c_str());
+
+    EXPECT_NE(json.find("\"traceEvents\""), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"present\",\"cat\":\"frame\",\"ph\":\"i\""),
+        std::string::npos);
+    EXPECT_NE(json.find("\"ph\":\"X\",\"dur\":50,\"ts\":1200,\"pid\":2"), std::string::npos);
+    EXPECT_NE(json.find("\"args\":{\"frame\":7}"), std::string::npos);
+}
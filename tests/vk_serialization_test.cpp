@@ -0,0 +1,181 @@
+#include <gtest/gtest.h>
+#include "common/network/vulkan_commands.hpp"
+#include <cstring>
+#include <string>
+
+using namespace anarchy::network;
+
+namespace {
+
+uint64_t identityMap(HandleType, uint64_t handle) {
+    return handle;
+}
+
+// Stand-in for the server handle table: real handle = virtual handle + 1
+uint64_t offsetResolve(HandleType, uint64_t handle) {
+    return handle + 1;
+}
+
+} // namespace
+
+TEST(VkSerializationTest, InstanceCreateInfoRoundTrip) {
+    VkApplicationInfo app_info = {};
+    app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    app_info.pApplicationName = "Anarchy";
+    app_info.pEngineName = "Engine";
+
+    const char* extensions[] = {"VK_KHR_surface", "VK_KHR_win32_surface"};
+
+    CreateInstanceParams params = {};
+    params.instance = 0x42;
+    params.create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    params.create_info.pApplicationInfo = &app_info;
+    params.create_info.enabledExtensionCount = 2;
+    params.create_info.ppEnabledExtensionNames = extensions;
+
+    std::vector<uint8_t> buffer;
+    size_t size = encodeWire(params, buffer, identityMap);
+    EXPECT_EQ(size, buffer.size());
+
+    auto* decoded = decodeWire<CreateInstanceParams>(buffer.data(), buffer.size(), offsetResolve);
+    ASSERT_NE(decoded, nullptr);
+    EXPECT_EQ(decoded->instance, 0x42);
+    ASSERT_NE(decoded->create_info.pApplicationInfo, nullptr);
+    EXPECT_STREQ(decoded->create_info.pApplicationInfo->pApplicationName, "Anarchy");
+    EXPECT_STREQ(decoded->create_info.pApplicationInfo->pEngineName, "Engine");
+    ASSERT_EQ(decoded->create_info.enabledExtensionCount, 2);
+    EXPECT_STREQ(decoded->create_info.ppEnabledExtensionNames[1], "VK_KHR_win32_surface");
+    EXPECT_EQ(decoded->create_info.ppEnabledLayerNames, nullptr);
+
+    // Decoded pointers land inside the arena, not in client memory
+    auto inArena = [&](const void* ptr) {
+        auto* p = static_cast<const uint8_t*>(ptr);
+        return p >= buffer.data() && p < buffer.data() + buffer.size();
+    };
+    EXPECT_TRUE(inArena(decoded->create_info.pApplicationInfo));
+    EXPECT_TRUE(inArena(decoded->create_info.ppEnabledExtensionNames[0]));
+}
+
+TEST(VkSerializationTest, SubmitTranslatesHandles) {
+    VkSemaphore wait_semaphores[] = {reinterpret_cast<VkSemaphore>(uint64_t(10))};
+    VkPipelineStageFlags wait_stages[] = {0x400};
+    VkCommandBuffer command_buffers[] = {
+        reinterpret_cast<VkCommandBuffer>(uint64_t(20)),
+        reinterpret_cast<VkCommandBuffer>(uint64_t(21))};
+    uint64_t wait_values[] = {7};
+
+    VkTimelineSemaphoreSubmitInfo timeline = {};
+    timeline.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline.waitSemaphoreValueCount = 1;
+    timeline.pWaitSemaphoreValues = wait_values;
+
+    VkSubmitInfo submit = {};
+    submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit.pNext = &timeline;
+    submit.waitSemaphoreCount = 1;
+    submit.pWaitSemaphores = wait_semaphores;
+    submit.pWaitDstStageMask = wait_stages;
+    submit.commandBufferCount = 2;
+    submit.pCommandBuffers = command_buffers;
+
+    QueueSubmitParams params = {};
+    params.queue = 1;
+    params.submit_count = 1;
+    params.submits = &submit;
+
+    // Client side mapping doubles each handle
+    std::vector<uint8_t> buffer;
+    encodeWire(params, buffer, [](HandleType type, uint64_t handle) {
+        return type == HandleType::COMMAND_BUFFER ? handle * 2 : handle;
+    });
+
+    auto* decoded = decodeWire<QueueSubmitParams>(buffer.data(), buffer.size(), offsetResolve);
+    ASSERT_NE(decoded, nullptr);
+    ASSERT_EQ(decoded->submit_count, 1);
+    const VkSubmitInfo& out = decoded->submits[0];
+    EXPECT_EQ(reinterpret_cast<uint64_t>(out.pWaitSemaphores[0]), 11);
+    EXPECT_EQ(out.pWaitDstStageMask[0], 0x400);
+    EXPECT_EQ(reinterpret_cast<uint64_t>(out.pCommandBuffers[0]), 41);
+    EXPECT_EQ(reinterpret_cast<uint64_t>(out.pCommandBuffers[1]), 43);
+    EXPECT_EQ(out.pSignalSemaphores, nullptr);
+
+    ASSERT_NE(out.pNext, nullptr);
+    auto* chained = static_cast<const VkTimelineSemaphoreSubmitInfo*>(out.pNext);
+    EXPECT_EQ(chained->sType, VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO);
+    EXPECT_EQ(chained->pWaitSemaphoreValues[0], 7);
+}
+
+TEST(VkSerializationTest, UnknownChainEntriesAreDropped) {
+    VkMemoryAllocateFlagsInfo flags_info = {};
+    flags_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+    flags_info.deviceMask = 1;
+
+    VkBaseInStructure unknown = {};
+    unknown.sType = static_cast<VkStructureType>(0x7FFF0000);
+    unknown.pNext = reinterpret_cast<const VkBaseInStructure*>(&flags_info);
+
+    AllocateMemoryParams params = {};
+    params.allocate_info.pNext = &unknown;
+    params.allocate_info.allocationSize = 4096;
+
+    std::vector<uint8_t> buffer;
+    encodeWire(params, buffer, identityMap);
+    auto* decoded = decodeWire<AllocateMemoryParams>(buffer.data(), buffer.size(), offsetResolve);
+    ASSERT_NE(decoded, nullptr);
+    EXPECT_EQ(decoded->allocate_info.allocationSize, 4096);
+
+    auto* next = static_cast<const VkMemoryAllocateFlagsInfo*>(decoded->allocate_info.pNext);
+    ASSERT_NE(next, nullptr);
+    EXPECT_EQ(next->sType, VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO);
+    EXPECT_EQ(next->deviceMask, 1);
+    EXPECT_EQ(next->pNext, nullptr);
+}
+
+TEST(VkSerializationTest, EncodeReusesBuffer) {
+    VkFence fences[] = {reinterpret_cast<VkFence>(uint64_t(5))};
+    ResetFencesParams params = {};
+    params.fence_count = 1;
+    params.fences = fences;
+
+    std::vector<uint8_t> buffer;
+    encodeWire(params, buffer, identityMap);
+    const uint8_t* data = buffer.data();
+    size_t size = encodeWire(params, buffer, identityMap);
+    EXPECT_EQ(buffer.data(), data);
+    EXPECT_EQ(size, sizeof(params) + sizeof(uint64_t));
+}
+
+TEST(VkSerializationTest, RejectsMalformedPayloads) {
+    VkFence fences[] = {reinterpret_cast<VkFence>(uint64_t(5))};
+    WaitForFencesParams params = {};
+    params.fence_count = 1;
+    params.fences = fences;
+
+    std::vector<uint8_t> buffer;
+    encodeWire(params, buffer, identityMap);
+
+    // Truncated block
+    std::vector<uint8_t> truncated(buffer.begin(), buffer.begin() + sizeof(params) - 1);
+    EXPECT_EQ(decodeWire<WaitForFencesParams>(truncated.data(), truncated.size(), offsetResolve),
+        nullptr);
+
+    // Count larger than the arena
+    std::vector<uint8_t> overflow = buffer;
+    uint32_t count = 1000;
+    std::memcpy(overflow.data() + offsetof(WaitForFencesParams, fence_count), &count,
+        sizeof(count));
+    EXPECT_EQ(decodeWire<WaitForFencesParams>(overflow.data(), overflow.size(), offsetResolve),
+        nullptr);
+
+    // Offset pointing back at the root
+    std::vector<uint8_t> backwards = buffer;
+    uint64_t offset = 0x8;
+    std::memcpy(backwards.data() + offsetof(WaitForFencesParams, fences), &offset,
+        sizeof(offset));
+    EXPECT_EQ(decodeWire<WaitForFencesParams>(backwards.data(), backwards.size(), offsetResolve),
+        nullptr);
+
+    // Unknown handle
+    EXPECT_EQ(decodeWire<WaitForFencesParams>(buffer.data(), buffer.size(),
+        [](HandleType, uint64_t) { return uint64_t(0); }), nullptr);
+}
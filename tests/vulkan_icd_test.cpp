@@ -1,6 +1,11 @@
 #include <gtest/gtest.h>
 #include "client/vulkan_icd.hpp"
+#include "common/network/command_stream.hpp"
 #include "common/network/protocol.hpp"
+#include "common/network/transport.hpp"
+#include "common/network/vulkan_commands.hpp"
+#include <cstring>
+#include <mutex>
 #include <thread>
 #include <chrono>
 
@@ -240,6 +245,82 @@ TEST_F(VulkanICDTest, SwapchainOperations) {
     icd->vkDestroyInstance(instance, nullptr);
 }
 
+TEST_F(VulkanICDTest, PresentKeepsGoingPastARefusedImage) {
+    VkInstanceCreateInfo instance_create_info = {};
+    instance_create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    VkInstance instance;
+    ASSERT_EQ(icd->vkCreateInstance(&instance_create_info, nullptr, &instance), VK_SUCCESS);
+
+    uint32_t device_count = 1;
+    VkPhysicalDevice physical_device;
+    VkResult result = icd->vkEnumeratePhysicalDevices(instance, &device_count, &physical_device);
+    ASSERT_TRUE(result == VK_SUCCESS || result == VK_INCOMPLETE);
+    ASSERT_GT(device_count, 0);
+
+    VkDeviceQueueCreateInfo queue_create_info = {};
+    queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queue_create_info.queueFamilyIndex = 0;
+    queue_create_info.queueCount = 1;
+    float queue_priority = 1.0f;
+    queue_create_info.pQueuePriorities = &queue_priority;
+    VkDeviceCreateInfo device_create_info = {};
+    device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    device_create_info.queueCreateInfoCount = 1;
+    device_create_info.pQueueCreateInfos = &queue_create_info;
+    VkDevice device;
+    ASSERT_EQ(icd->vkCreateDevice(physical_device, &device_create_info, nullptr, &device),
+        VK_SUCCESS);
+
+    VkSwapchainCreateInfoKHR swapchain_create_info = {};
+    swapchain_create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    swapchain_create_info.minImageCount = 3;
+    swapchain_create_info.imageFormat = VK_FORMAT_B8G8R8A8_UNORM;
+    swapchain_create_info.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+    swapchain_create_info.imageExtent = {800, 600};
+    swapchain_create_info.imageArrayLayers = 1;
+    swapchain_create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    swapchain_create_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    swapchain_create_info.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+    swapchain_create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    swapchain_create_info.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    swapchain_create_info.clipped = VK_TRUE;
+    VkSwapchainKHR swapchains[2];
+    for (VkSwapchainKHR& swapchain : swapchains) {
+        ASSERT_EQ(icd->vkCreateSwapchainKHR(device, &swapchain_create_info, nullptr, &swapchain),
+            VK_SUCCESS);
+    }
+
+    // Every image of the second swapchain held, none of the first
+    uint32_t image_index = 0;
+    while (icd->vkAcquireNextImageKHR(device, swapchains[1], 0, VK_NULL_HANDLE, VK_NULL_HANDLE,
+               &image_index) == VK_SUCCESS) {
+    }
+
+    // The first swapchain's image was never acquired, the second's was
+    uint32_t indices[2] = {0, 0};
+    VkResult results[2] = {VK_SUCCESS, VK_SUCCESS};
+    VkPresentInfoKHR present_info = {};
+    present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    present_info.swapchainCount = 2;
+    present_info.pSwapchains = swapchains;
+    present_info.pImageIndices = indices;
+    present_info.pResults = results;
+    EXPECT_EQ(icd->vkQueuePresentKHR(VK_NULL_HANDLE, &present_info), VK_ERROR_OUT_OF_DATE_KHR);
+    EXPECT_EQ(results[0], VK_ERROR_OUT_OF_DATE_KHR);
+    EXPECT_EQ(results[1], VK_SUCCESS);
+
+    // So the second one's image came back
+    EXPECT_EQ(icd->vkAcquireNextImageKHR(device, swapchains[1], 0, VK_NULL_HANDLE,
+        VK_NULL_HANDLE, &image_index), VK_SUCCESS);
+    EXPECT_EQ(image_index, 0u);
+
+    for (VkSwapchainKHR swapchain : swapchains) {
+        icd->vkDestroySwapchainKHR(device, swapchain, nullptr);
+    }
+    icd->vkDestroyDevice(device, nullptr);
+    icd->vkDestroyInstance(instance, nullptr);
+}
+
 TEST_F(VulkanICDTest, MemoryOperations) {
     // Create instance and device
     VkInstanceCreateInfo instance_create_info = {};
@@ -361,6 +442,155 @@ TEST_F(VulkanICDTest, Synchronization) {
     icd->vkDestroyInstance(instance, nullptr);
 }
 
+// A stand-in server over the raw transport: memory type 0 is host cached and
+// holds a known pattern, so what a map hands back can only have come over
+// the wire
+class MappedReadbackTest : public ::testing::Test {
+protected:
+    static constexpr uint64_t MEMORY_SIZE = 3 * 4096 + 100;
+
+    static uint8_t serverByte(uint64_t offset) { return static_cast<uint8_t>(offset % 251 + 1); }
+
+    void SetUp() override {
+        server = Transport::create("raw://127.0.0.1:5630", Transport::Role::SERVER);
+        server->setMessageCallback([this](const Message& message) { serve(message); });
+        ASSERT_TRUE(server->start());
+        icd = std::make_unique<VulkanICD>("raw://127.0.0.1:5630");
+
+        VkInstanceCreateInfo instance_create_info = {};
+        instance_create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        ASSERT_EQ(icd->vkCreateInstance(&instance_create_info, nullptr, &instance), VK_SUCCESS);
+        uint32_t count = 1;
+        VkPhysicalDevice physical_device;
+        ASSERT_EQ(icd->vkEnumeratePhysicalDevices(instance, &count, &physical_device),
+            VK_SUCCESS);
+        VkDeviceCreateInfo device_create_info = {};
+        device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        ASSERT_EQ(icd->vkCreateDevice(physical_device, &device_create_info, nullptr, &device),
+            VK_SUCCESS);
+    }
+
+    void TearDown() override {
+        icd.reset();
+        server->stop();
+    }
+
+    void serve(const Message& message) {
+        std::vector<uint8_t> reply;
+        switch (message.header.type) {
+            case MessageType::CONNECT: {
+                ConnectionParams params = localConnectionParams();
+                reply.assign(reinterpret_cast<uint8_t*>(&params),
+                    reinterpret_cast<uint8_t*>(&params) + sizeof(params));
+                break;
+            }
+            case MessageType::VK_ENUMERATE_PHYSICAL_DEVICES: {
+                PhysicalDeviceList list = {};
+                list.count = 1;
+                list.physical_devices[0] = 1;
+                list.readback_memory_types[0] = 1u << 0;
+                reply.assign(reinterpret_cast<uint8_t*>(&list),
+                    reinterpret_cast<uint8_t*>(&list) + sizeof(list));
+                break;
+            }
+            case MessageType::VK_READ_MEMORY: {
+                ReadMemoryParams params;
+                std::memcpy(&params, message.payload.data(), sizeof(params));
+                for (uint64_t i = 0; i < params.size; i++) {
+                    reply.push_back(serverByte(params.offset + i));
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                reads++;
+                break;
+            }
+            case MessageType::VK_COMMAND_BATCH: {
+                std::lock_guard<std::mutex> lock(mutex);
+                forEachCommandRecord(message, [this](const CommandRecordHeader& header,
+                        const uint8_t* payload) {
+                    if (header.type == MessageType::VK_WRITE_MEMORY) {
+                        WriteMemoryParams params;
+                        std::memcpy(&params, payload, sizeof(params));
+                        written_bytes += params.size;
+                    }
+                    return true;
+                });
+                return;
+            }
+            default:
+                break;
+        }
+
+        Message response;
+        response.header.type = message.header.type;
+        response.header.size = static_cast<uint32_t>(reply.size());
+        response.header.sequence = message.header.sequence;
+        response.header.request_id = message.header.request_id;
+        response.payload = std::move(reply);
+        response.peer = message.peer;
+        server->sendMessage(std::move(response));
+    }
+
+    VkDeviceMemory allocate(uint32_t memory_type) {
+        VkMemoryAllocateInfo allocate_info = {};
+        allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocate_info.allocationSize = MEMORY_SIZE;
+        allocate_info.memoryTypeIndex = memory_type;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        EXPECT_EQ(icd->vkAllocateMemory(device, &allocate_info, nullptr, &memory), VK_SUCCESS);
+        return memory;
+    }
+
+    std::unique_ptr<Transport> server;
+    std::unique_ptr<VulkanICD> icd;
+    VkInstance instance = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+
+    std::mutex mutex;
+    uint32_t reads = 0;
+    uint64_t written_bytes = 0;
+};
+
+TEST_F(MappedReadbackTest, MapFetchesHostCachedMemory) {
+    VkDeviceMemory memory = allocate(0);
+    void* data = nullptr;
+    ASSERT_EQ(icd->vkMapMemory(device, memory, 100, VK_WHOLE_SIZE, 0, &data), VK_SUCCESS);
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (uint64_t i = 0; i < MEMORY_SIZE - 100; i++) {
+        ASSERT_EQ(bytes[i], serverByte(100 + i));
+    }
+    icd->vkUnmapMemory(device, memory);
+
+    // The fetched bytes aren't sent back as writes; the next map flushes
+    ASSERT_EQ(icd->vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &data), VK_SUCCESS);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        EXPECT_EQ(reads, 2u);
+        EXPECT_EQ(written_bytes, 0u);
+    }
+
+    // What the application writes still goes out, a page of it
+    static_cast<uint8_t*>(data)[5000] = 0;
+    icd->vkUnmapMemory(device, memory);
+    ASSERT_EQ(icd->vkMapMemory(device, memory, 0, 16, 0, &data), VK_SUCCESS);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        EXPECT_EQ(written_bytes, 4096u);
+    }
+    icd->vkUnmapMemory(device, memory);
+    icd->vkFreeMemory(device, memory, nullptr);
+}
+
+TEST_F(MappedReadbackTest, OtherMemoryMapsLocally) {
+    VkDeviceMemory memory = allocate(1);
+    void* data = nullptr;
+    ASSERT_EQ(icd->vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &data), VK_SUCCESS);
+    EXPECT_EQ(static_cast<const uint8_t*>(data)[0], 0);
+    icd->vkUnmapMemory(device, memory);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    EXPECT_EQ(reads, 0u);
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();